@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Run the benchmark shaders of this directory with `testshade --benchmark`
+# and compare the median time per point of each to the checked-in
+# baseline. See README.md.
+
+import argparse
+import glob
+import json
+import os
+import subprocess
+import sys
+
+benchdir = os.path.dirname(os.path.abspath(__file__))
+srcdir = os.path.dirname(benchdir)
+
+
+def expand(s):
+    return s.replace("{src}", srcdir)
+
+
+def run(cmd, cwd):
+    print("  $ " + " ".join(cmd), flush=True)
+    return subprocess.run(cmd, cwd=cwd).returncode == 0
+
+
+# Compile the shaders of a benchmark into its work directory, and return
+# the per-mode results of `testshade --benchmark` (plus the OptiX run, if
+# asked for), as { mode: median ns per point }, or None if it failed.
+def run_benchmark(name, bench, args):
+    workdir = os.path.join(args.workdir, name)
+    os.makedirs(workdir, exist_ok=True)
+    for shader in bench["shaders"]:
+        path = expand(shader)
+        if not os.path.isabs(path):
+            path = os.path.join(benchdir, name, path)
+        include = "-I" + os.path.join(srcdir, "src", "shaders")
+        if not run([args.oslc, "-q", include, path], workdir):
+            return None
+    testargs = [expand(a) for a in bench["args"]]
+    results = {}
+
+    stats = os.path.join(workdir, "stats.json")
+    cmd = [args.testshade, "--batched", "--benchmark", str(args.trials),
+           "--stats_json", stats] + testargs
+    if not run(cmd, workdir):
+        return None
+    with open(stats) as f:
+        for mode in json.load(f)["benchmark"]["modes"]:
+            results[mode["mode"]] = mode["median_ns"]
+
+    if args.optix:
+        # --benchmark doesn't time OptiX launches, so take the mean of
+        # --iters runs from the "run" stage instead.
+        stats = os.path.join(workdir, "stats_optix.json")
+        cmd = [args.testshade, "--optix", "--iters", str(args.trials),
+               "--stats_json", stats] + testargs
+        if not run(cmd, workdir):
+            return None
+        with open(stats) as f:
+            js = json.load(f)
+        with open(os.path.join(workdir, "stats.json")) as f:
+            points = json.load(f)["benchmark"]["points"]
+        results["optix"] = (js["stages"]["run"] * 1.0e9
+                            / (args.trials * points))
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Run the OSL benchmarks")
+    parser.add_argument("names", nargs="*",
+                        help="Benchmarks to run (default: all)")
+    parser.add_argument("--testshade", default="testshade")
+    parser.add_argument("--oslc", default="oslc")
+    parser.add_argument("--workdir", default="benchmark-results")
+    parser.add_argument("--trials", type=int, default=10)
+    parser.add_argument("--optix", action="store_true",
+                        help="Also time the shaders with OptiX")
+    parser.add_argument("--baseline",
+                        default=os.path.join(benchdir, "baseline.json"))
+    parser.add_argument("--update-baseline", action="store_true",
+                        help="Write the results as the new baseline")
+    parser.add_argument("--threshold", type=float, default=0.10,
+                        help="Slowdown that counts as a regression "
+                        "(default: 0.10, that is 10%%)")
+    args = parser.parse_args()
+    args.workdir = os.path.abspath(args.workdir)
+    os.makedirs(args.workdir, exist_ok=True)
+
+    names = args.names or sorted(
+        os.path.basename(os.path.dirname(p))
+        for p in glob.glob(os.path.join(benchdir, "*", "bench.json")))
+
+    results = {}
+    failed = []
+    for name in names:
+        with open(os.path.join(benchdir, name, "bench.json")) as f:
+            bench = json.load(f)
+        print("{}: {}".format(name, bench["description"]), flush=True)
+        r = run_benchmark(name, bench, args)
+        if r is None:
+            failed.append(name)
+        else:
+            results[name] = r
+
+    with open(os.path.join(args.workdir, "results.json"), "w") as f:
+        json.dump(results, f, indent=4, sort_keys=True)
+
+    baseline = {}
+    if os.path.exists(args.baseline):
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+
+    regressions = []
+    print("\n{:<16} {:<10} {:>12} {:>12} {:>8}".format(
+        "benchmark", "mode", "ns/point", "baseline", "change"))
+    for name, modes in sorted(results.items()):
+        for mode, ns in sorted(modes.items()):
+            base = baseline.get(name, {}).get(mode)
+            if base:
+                change = ns / base - 1.0
+                print("{:<16} {:<10} {:>12.1f} {:>12.1f} {:>+7.1f}%".format(
+                    name, mode, ns, base, change * 100))
+                if change > args.threshold:
+                    regressions.append("{} {}".format(name, mode))
+            else:
+                print("{:<16} {:<10} {:>12.1f} {:>12} {:>8}".format(
+                    name, mode, ns, "-", "-"))
+
+    if args.update_baseline:
+        baseline.update(results)
+        with open(args.baseline, "w") as f:
+            json.dump(baseline, f, indent=4, sort_keys=True)
+            f.write("\n")
+        print("\nUpdated " + args.baseline)
+        regressions = []
+
+    for name in failed:
+        print("FAILED: " + name)
+    for r in regressions:
+        print("REGRESSION: " + r)
+    return 1 if failed or regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
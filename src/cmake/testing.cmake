@@ -270,47 +270,53 @@ macro (osl_add_all_tests)
     # special installed tests.
     TESTSUITE ( aastep allowconnect-err andor-reg and-or-not-synonyms
                 arithmetic area-reg arithmetic-reg
-                array array-reg array-copy array-copy-reg array-derivs array-range
+                array array-reg array-copy array-copy-reg array-derivs
+                array-loop-range array-range
                 array-aassign array-assign-reg array-length-reg
                 bitwise-and-reg bitwise-or-reg bitwise-shl-reg  bitwise-shr-reg bitwise-xor-reg
                 blackbody blackbody-reg blendmath breakcont breakcont-reg
                 bug-array-heapoffsets bug-locallifetime bug-outputinit
                 bug-param-duplicate bug-peep bug-return
                 calculatenormal-reg
-                cellnoise closure closure-array closure-layered closure-parameters closure-zero closure-conditional
-                color color2 color4 color-reg colorspace comparison
+                cellnoise closure closure-array closure-layered closure-mix-lazy closure-parameters closure-weights closure-zero closure-conditional
+                color color2 color4 color-reg colorspace compact-code
+                comparison
                 complement-reg compile-buffer compassign-bool compassign-reg
                 component-range
                 control-flow-reg connect-components
                 const-array-params const-array-fill
-                debugnan debug-uninit
+                debugnan debugnan-sampled debug-uninit
                 derivs derivs-muldiv-clobber
                 draw_string
                 error-dupes error-serialized
                 example-deformer
                 example-batched-deformer
-                exit exponential
+                execute-many exit exponential
                 filterwidth-reg
                 for-reg format-reg fprintf
                 function-earlyreturn function-simple function-outputelem
                 function-overloads function-redef
-                geomath getattribute-camera getattribute-shader getattribute-shading
+                geomath getattribute-batched-cache getattribute-camera
+                getattribute-shader getattribute-shading
                 getsymbol-nonheap gettextureinfo gettextureinfo-reg
                 gettextureinfo-udim gettextureinfo-udim-reg
-                globals-needed
-                group-outputs groupdata-opt groupstring
+                globals-needed globals-placement
+                group-desc group-outputs groupdata-opt groupdata-share
+                groupstring
                 hash hashnoise hex hyperb
                 ieee_fp ieee_fp-reg if if-reg incdec initlist
                 initops initops-instance-clash
                 intbits isconnected
                 isconstant
+                jit-cache jit-cache-variants jit-lazy-entry jit-shared-ops
+                jit-threads jit-tiered
                 layers layers-Ciassign layers-entry layers-lazy layers-lazyerror
                 layers-nonlazycopy layers-repeatedoutputs
                 lazytrace
                 length-reg linearstep
                 lockgeom
                 logic loop luminance-reg
-                matrix matrix-reg matrix-arithmetic-reg
+                math-precision matrix matrix-reg matrix-arithmetic-reg
                 matrix-compref-reg max-reg message message-no-closure message-reg
                 mergeinstances-duplicate-entrylayers
                 mergeinstances-nouserdata mergeinstances-vararray
@@ -318,19 +324,20 @@ macro (osl_add_all_tests)
                 mix-reg
                 named-components
                 nestedloop-reg
-                noise noise-cell
+                noise noise-baked noise-cell
                 noise-gabor noise-gabor2d-filter noise-gabor3d-filter
                 noise-gabor-reg
-                noise-generic
-                noise-perlin noise-simplex
+                noise-fractal noise-generic noise-memo
+                noise-pcg noise-perlin noise-simplex noise-voronoi
                 noise-reg
                 normalize-reg
                 pnoise pnoise-cell pnoise-gabor
                 pnoise-generic pnoise-perlin
                 pnoise-reg
                 operator-overloading
+                opt-loops opt-report opt-sccp opt-snapshot opt-threads
                 opt-warnings
-                oslc-comma oslc-D oslc-M
+                oslc-comma oslc-D oslc-header-cache oslc-M oslc-O2
                 oslc-err-arrayindex oslc-err-assignmenttypes
                 oslc-err-closuremul oslc-err-field
                 oslc-err-format oslc-err-funcoverload
@@ -343,20 +350,24 @@ macro (osl_add_all_tests)
                 oslc-err-struct-dup oslc-err-struct-print
                 oslc-err-type-as-variable
                 oslc-err-unknown-ctr
-                oslc-literalfold
+                oslc-literalfold oslc-multifile
                 oslc-pragma-warnerr
                 oslc-warn-commainit
                 oslc-variadic-macro
                 oslc-version
                 oslinfo-arrayparams oslinfo-colorctrfloat
+                oslinfo-cost oslinfo-directory
                 oslinfo-metadata oslinfo-noparams
-                osl-imageio
+                osl-imageio oso-binary
                 paramval-floatpromotion
                 pragma-nowarn
                 printf-reg
                 printf-whole-array
-                raytype raytype-reg raytype-specialized regex-reg
-                reparam reparam-arrays reparam-string testoptix-reparam
+                raytype raytype-reg raytype-specialized raytype-variants
+                readonly-params
+                regex-reg reparam reparam-arrays reparam-batch reparam-rebuild
+                reparam-string
+                testoptix-reparam
                 render-background render-bumptest
                 render-bunny
                 render-cornell
@@ -375,7 +386,8 @@ macro (osl_add_all_tests)
                 render-spi-thinlayer
                 render-uv render-veachmis render-ward
                 render-raytypes
-                select select-reg shaderglobals shortcircuit
+                select select-reg shader-bundle shaderglobals
+                shared-constants shortcircuit
                 smoothstep-reg
                 spline spline-reg splineinverse splineinverse-ident
                 splineinverse-knots-ascend-reg splineinverse-knots-descend-reg
@@ -396,22 +408,24 @@ macro (osl_add_all_tests)
                 texture-blur texture-colorspace texture-connected-options
                 texture-derivs texture-environment texture-errormsg
                 texture-environment-opts-reg
-                texture-firstchannel texture-interp
+                texture-firstchannel texture-fusion texture-interp
                 texture-missingalpha texture-missingcolor texture-opts-reg texture-simple
-                texture-smallderivs texture-swirl texture-udim
+                texture-smallderivs texture-swirl texture-udim texture-udim-cache
                 texture-width texture-withderivs texture-wrap
-                trace-reg
+                trace-deferred trace-reg
                 trailing-commas
                 transcendental-reg
                 transitive-assign
-                transform transform-reg transformc transformc-reg trig trig-reg
+                transform transform-hoist transform-reg transformc
+                transformc-reg trig trig-reg
                 typecast
                 unknown-instruction
                 userdata userdata-defaults userdata-partial userdata-custom userdata-passthrough
+                userdata-variants
                 vararray-connect vararray-default
                 vararray-deserialize vararray-param
                 vecctr vector vector2 vector4 vector-reg
-                wavelength_color wavelength_color-reg Werror xml xml-reg )
+                wavelength_color wavelength_color-reg Werror xml xml-fold xml-odict xml-reg )
 
     # Only run the ocio test if the OIIO we are using has OCIO support
     if (OpenImageIO_HAS_OpenColorIO)
@@ -435,7 +449,7 @@ macro (osl_add_all_tests)
 
     # Only run pointcloud tests if Partio is found
     if (partio_FOUND)
-        TESTSUITE ( pointcloud pointcloud-fold )
+        TESTSUITE ( pointcloud pointcloud-fold pointcloud-opc )
     endif ()
 
     # Only run the OptiX tests if OptiX and CUDA are found
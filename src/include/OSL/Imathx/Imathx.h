@@ -351,6 +351,75 @@ Matrix44 OSL_HOSTDEVICE nonAffineInverse(const Matrix44 &source)
 }
 
 
+// cofactorInverse - general inverse by Cramer's rule, SIMD friendly as it
+// has no pivoting or data dependent branches, so non-affine matrices can
+// be inverted inside a SIMD loop too.  Like affineInverse, it doesn't
+// check whether the division by the determinant may have overflowed, but
+// reports it through ok, in which case the caller should fall back to
+// nonAffineInverse (which also handles singular matrices).
+static OSL_FORCEINLINE OSL_HOSTDEVICE Matrix44
+cofactorInverse(const Matrix44 &m, bool &ok)
+{
+    using ScalarT = typename Matrix44::BaseType;
+    const auto &a = m.x;
+
+    // 2x2 minors of the top two rows and of the bottom two rows
+    ScalarT s0 = a[0][0] * a[1][1] - a[1][0] * a[0][1];
+    ScalarT s1 = a[0][0] * a[1][2] - a[1][0] * a[0][2];
+    ScalarT s2 = a[0][0] * a[1][3] - a[1][0] * a[0][3];
+    ScalarT s3 = a[0][1] * a[1][2] - a[1][1] * a[0][2];
+    ScalarT s4 = a[0][1] * a[1][3] - a[1][1] * a[0][3];
+    ScalarT s5 = a[0][2] * a[1][3] - a[1][2] * a[0][3];
+
+    ScalarT c0 = a[2][0] * a[3][1] - a[3][0] * a[2][1];
+    ScalarT c1 = a[2][0] * a[3][2] - a[3][0] * a[2][2];
+    ScalarT c2 = a[2][0] * a[3][3] - a[3][0] * a[2][3];
+    ScalarT c3 = a[2][1] * a[3][2] - a[3][1] * a[2][2];
+    ScalarT c4 = a[2][1] * a[3][3] - a[3][1] * a[2][3];
+    ScalarT c5 = a[2][2] * a[3][3] - a[3][2] * a[2][3];
+
+    // Adjugate
+    Matrix44 s (a[1][1] * c5 - a[1][2] * c4 + a[1][3] * c3,
+                -a[0][1] * c5 + a[0][2] * c4 - a[0][3] * c3,
+                a[3][1] * s5 - a[3][2] * s4 + a[3][3] * s3,
+                -a[2][1] * s5 + a[2][2] * s4 - a[2][3] * s3,
+
+                -a[1][0] * c5 + a[1][2] * c2 - a[1][3] * c1,
+                a[0][0] * c5 - a[0][2] * c2 + a[0][3] * c1,
+                -a[3][0] * s5 + a[3][2] * s2 - a[3][3] * s1,
+                a[2][0] * s5 - a[2][2] * s2 + a[2][3] * s1,
+
+                a[1][0] * c4 - a[1][1] * c2 + a[1][3] * c0,
+                -a[0][0] * c4 + a[0][1] * c2 - a[0][3] * c0,
+                a[3][0] * s4 - a[3][1] * s2 + a[3][3] * s0,
+                -a[2][0] * s4 + a[2][1] * s2 - a[2][3] * s0,
+
+                -a[1][0] * c3 + a[1][1] * c1 - a[1][2] * c0,
+                a[0][0] * c3 - a[0][1] * c1 + a[0][2] * c0,
+                -a[3][0] * s3 + a[3][1] * s1 - a[3][2] * s0,
+                a[2][0] * s3 - a[2][1] * s1 + a[2][2] * s0);
+
+    auto r = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+    auto abs_r = std::abs (r);
+
+    // Same test as affineInverse: would any s/r overflow?
+    bool may_have_divided_by_zero = false;
+    if (OSL_UNLIKELY(abs_r < ScalarT(1)))
+    {
+        auto mr = abs_r / std::numeric_limits<ScalarT>::min();
+        for (int i = 0; i < 4; ++i)
+            for (int j = 0; j < 4; ++j)
+                may_have_divided_by_zero |= (mr <= std::abs (s.x[i][j]));
+    }
+    ok = !may_have_divided_by_zero;
+
+    for (int i = 0; i < 4; ++i)
+        for (int j = 0; j < 4; ++j)
+            s.x[i][j] /= r;
+    return s;
+}
+
+
 // In order to have inlinable Matrix44*float
 // Override with a more specific version than
 // template <class T>
@@ -8,6 +8,7 @@
 #include <OSL/oslconfig.h>
 #include <list>
 #include <stack>
+#include <string>
 
 OSL_NAMESPACE_BEGIN
 
@@ -48,12 +49,80 @@ struct AovOutput {
         alpha     = 0.0f;
         has_alpha = has_color = false;
     };
+    /// Applies the inversion, if any, as flush() does before sending
+    void resolve();
     /// Sends the color information to the AOV
     void flush(void* flush_data);
 };
 
 
 
+class AccumAutomata;
+
+/// Per-thread AOV buffers with a final reduction
+///
+/// Flushing every path straight to the AOVs makes threads that render the
+/// same pixels lock or use atomics. Instead, each thread can add its paths
+/// to its own buffer (see Accumulator::end), and at the end of the pass
+/// reduce() sums the threads' buffers for each pixel, always in thread
+/// order so that the result doesn't depend on which thread got there
+/// first, and flush() sends the sums on to the AOVs. What a pixel is is up
+/// to the renderer, a tile or the whole image; reduce() may be called on
+/// disjoint ranges of pixels at once from many threads.
+class OSLEXECPUBLIC AovBuffers {
+public:
+    AovBuffers(const AccumAutomata* accauto, int npixels, int nthreads);
+
+    /// The AOV an output is flushed to, or NULL to drop it
+    void setAov(int outidx, Aov* aov);
+
+    int outputs() const { return int(m_aovs.size()); }
+    int pixels() const { return m_npixels; }
+    int threads() const { return int(m_threads.size()); }
+
+    /// Clears every thread's buffer and the reduced values
+    void clear();
+
+    /// Adds the outputs of a path (after inversion, as flush() would send
+    /// them) to a pixel of a thread's buffer. Only that thread may be
+    /// adding to its buffer, but all threads can add at once.
+    void add(int thread, int pixel, int outidx, const AovOutput& output);
+
+    /// Sums the threads' buffers for the pixels in [begin, end)
+    void reduce(int begin, int end);
+
+    /// Sends the reduced values of a pixel to the AOVs
+    void flush(int pixel, void* flush_data);
+
+    /// The reduced color and alpha of an output in a pixel, the sum of
+    /// every path added there
+    const Color3& getColor(int outidx, int pixel) const
+    {
+        return m_reduced[size_t(pixel) * m_aovs.size() + outidx].color;
+    }
+    float getAlpha(int outidx, int pixel) const
+    {
+        return m_reduced[size_t(pixel) * m_aovs.size() + outidx].alpha;
+    }
+
+private:
+    struct Value {
+        Color3 color { 0, 0, 0 };
+        float alpha    = 0.0f;
+        bool has_color = false;
+        bool has_alpha = false;
+    };
+    int m_npixels;
+    // The AOV of each output
+    std::vector<Aov*> m_aovs;
+    // Per thread, the values of every output of every pixel, pixel major
+    std::vector<std::vector<Value>> m_threads;
+    // And their sums
+    std::vector<Value> m_reduced;
+};
+
+
+
 /// Rule mapping a pattern to an AOV
 ///
 /// This is the entity being linked from the automata. At any state, if
@@ -118,7 +187,10 @@ public:
     ///
     AccumRule* addRule(const char* pattern, int outidx, bool toalpha = false);
 
-    /// Once all the desired rules have been added, compile the automata
+    /// Once all the desired rules have been added, compile the automata.
+    /// Automata compiled from the same rules (and custom symbols) are
+    /// cached for the life of the process, so rendering again with the
+    /// same rules skips the NFA to DFA conversion.
     void compile();
 
     /// Performs an accumulation in the given outputs vector if any rule is activated in the given state
@@ -131,6 +203,28 @@ public:
         return m_dfoptautomata.getTransition(state, symbol);
     };
 
+    /// Get the id of a symbol (label), to look it up once and then move
+    /// with the id instead of the ustring
+    int getSymbolId(ustring symbol) const
+    {
+        return m_dfoptautomata.getSymbolId(symbol);
+    };
+
+    /// Get an specific transition by symbol id
+    int getTransition(int state, int symbol_id) const
+    {
+        return m_dfoptautomata.getTransition(state, symbol_id);
+    };
+
+    /// Number of symbol ids, not counting the one for unknown symbols
+    int numSymbols() const { return m_dfoptautomata.numSymbols(); };
+
+    /// The whole transition table, numSymbols()+1 entries per state
+    const int* getTransitionTable() const
+    {
+        return m_dfoptautomata.getTransitionTable();
+    };
+
     /// The rule list is for public use in read-only, so Accumulator knows what AOVS are we using
     const std::list<AccumRule>& getRuleList() const { return m_accumrules; };
 
@@ -152,6 +246,8 @@ private:
     std::vector<ustring> m_user_events;
     // Custom symbols to support on expressions as scattering
     std::vector<ustring> m_user_scatterings;
+    // The rules added so far, as the key of compiled automata in the cache
+    std::string m_rules_key;
 };
 
 
@@ -180,6 +276,13 @@ public:
     /// Push a NONE terminated array of labels
     void move(const ustring* symbols);
 
+    /// Push a single label by its id from AccumAutomata::getSymbolId
+    void moveId(int symbol_id)
+    {
+        if (m_state >= 0)
+            m_state = m_accum_automata->getTransition(m_state, symbol_id);
+    }
+
     /// very commonly we push all labels, this helps reducing code. custom can be NULL
     /// and although the last label is always stop, we leave the argument to make the
     /// code show that there is a STOP label there.
@@ -205,6 +308,10 @@ public:
     /// finishes and flushes the outputs to the sample store
     void end(void* flush_data);
 
+    /// finishes and adds the outputs to a pixel of a thread's buffer,
+    /// instead of flushing them
+    void end(AovBuffers& buffers, int thread, int pixel);
+
 
     /// Send a result to whatever rules might be active in the current state
     void accum(const Color3& color)
@@ -230,4 +337,75 @@ private:
 };
 
 
+
+/// Accumulator for a batch of paths
+///
+/// The same as Accumulator, for wavefront integrators that trace many
+/// paths at once: every path has its own state, they all step together
+/// through the automata's transition table, and the outputs are kept per
+/// AOV as arrays over the paths (color channels and alpha separately).
+///
+class OSLEXECPUBLIC BatchedAccumulator {
+public:
+    BatchedAccumulator(const AccumAutomata* accauto, int size);
+
+    int size() const { return m_size; }
+
+    void setAov(int outidx, Aov* aov, bool neg_color, bool neg_alpha);
+
+    /// If a path's machine is broken no result will be stored for it
+    bool broken(int path) const { return m_states[path] < 0; }
+
+    /// Save and restore the states of all paths
+    void pushState();
+    void popState();
+
+    /// Move all paths by the same label, by its AccumAutomata::getSymbolId
+    void moveId(int symbol_id);
+
+    /// Move each path by its own label id, a negative id leaves the path
+    /// where it is
+    void moveIds(const int* symbol_ids);
+
+    /// Clears all the outputs and puts all paths at the initial state
+    void begin();
+
+    /// Send each path's result to whatever rules are active in its state
+    void accum(const Color3* colors);
+
+    /// Flushes the outputs of one path to the sample store
+    void end(int path, void* flush_data);
+
+    /// Adds the outputs of one path to a pixel of a thread's buffer
+    void end(int path, AovBuffers& buffers, int thread, int pixel);
+
+    /// The accumulated channel (0-2) of the colors of an output, one per
+    /// path, and its alphas
+    const float* getColor(int outidx, int channel) const
+    {
+        return &m_color[(size_t(outidx) * 3 + channel) * m_size];
+    }
+    const float* getAlpha(int outidx) const
+    {
+        return &m_alpha[size_t(outidx) * m_size];
+    }
+
+private:
+    AovOutput getOutput(int path, int outidx) const;
+
+    const AccumAutomata* m_accum_automata;
+    int m_size;
+    // The AOV and flags of each output, as in Accumulator
+    std::vector<AovOutput> m_outputs;
+    // Per output, the paths' values, and whether they got any
+    std::vector<float> m_color;
+    std::vector<float> m_alpha;
+    std::vector<char> m_has_color;
+    std::vector<char> m_has_alpha;
+    // Current state of each path, and saved states
+    std::vector<int> m_states;
+    std::vector<int> m_stack;
+};
+
+
 OSL_NAMESPACE_END
@@ -0,0 +1,191 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <cmath>
+#include <limits>
+
+#include <OSL/dual.h>
+#include <OSL/oslconfig.h>
+
+
+OSL_NAMESPACE_BEGIN
+
+// Approximations of the transcendental functions good to about four
+// significant digits, for the "approx" tier of the "math_precision"
+// option, where looks tolerate them and speed matters more. Like the
+// OIIO::fast_* functions, these are plain scalar code that vectorizes in
+// SIMD loops and runs on the GPU. The polynomials are least-squares fits
+// over the reduced ranges.
+
+
+
+/// 2^x, to a relative error of 1e-4. x is clamped to [-126,126].
+OSL_HOSTDEVICE OSL_FORCEINLINE float
+approx_exp2(float x)
+{
+    x       = x < -126.0f ? -126.0f : (x > 126.0f ? 126.0f : x);
+    float i = floorf(x);
+    float f = x - i;
+    float p = 1.0f + f * (0.6951231f + f * (0.2276447f + f * 0.0770589f));
+    return p * bitcast<float>(uint32_t(int(i) + 127) << 23);
+}
+
+
+
+/// log2(x), to an absolute error of 1.2e-4. Like OIIO::fast_log2, x is
+/// clamped to the normal floats, so zero and negative numbers give -126.
+OSL_HOSTDEVICE OSL_FORCEINLINE float
+approx_log2(float x)
+{
+    const float lo = std::numeric_limits<float>::min();
+    const float hi = std::numeric_limits<float>::max();
+    x              = x < lo ? lo : (x > hi ? hi : x);
+    uint32_t bits  = bitcast<uint32_t>(x);
+    float e        = float(int(bits >> 23) - 127);
+    float t        = bitcast<float>((bits & 0x007fffff) | 0x3f800000) - 1.0f;
+    return e
+           + t * (1.4386377f
+                  + t * (-0.6777412f + t * (0.3218756f - t * 0.0828582f)));
+}
+
+
+
+OSL_HOSTDEVICE OSL_FORCEINLINE float
+approx_exp(float x)
+{
+    return approx_exp2(x * float(M_LOG2E));
+}
+
+
+
+OSL_HOSTDEVICE OSL_FORCEINLINE float
+approx_log(float x)
+{
+    return approx_log2(x) * float(M_LN2);
+}
+
+
+
+/// x^y, with the special cases of OIIO::fast_safe_pow: x^0 is 1, 0^y is 0,
+/// and a negative x to a non-integer power is 0.
+OSL_HOSTDEVICE OSL_FORCEINLINE float
+approx_safe_pow(float x, float y)
+{
+    if (y == 0.0f)
+        return 1.0f;
+    if (x == 0.0f)
+        return 0.0f;
+    if (y == 1.0f)
+        return x;
+    float sign = 1.0f;
+    if (x < 0.0f) {
+        if (floorf(y) != y)
+            return 0.0f;
+        sign = fmodf(y, 2.0f) != 0.0f ? -1.0f : 1.0f;
+    }
+    return sign * approx_exp2(y * approx_log2(fabsf(x)));
+}
+
+
+
+/// sin(x), to an absolute error of 1.2e-4 (reducing x by multiples of
+/// pi, so large arguments lose accuracy as they do for OIIO::fast_sin).
+OSL_HOSTDEVICE OSL_FORCEINLINE float
+approx_sin(float x)
+{
+    float q  = floorf(x * float(M_1_PI) + 0.5f);
+    float r  = x - q * float(M_PI);
+    float r2 = r * r;
+    float s  = r + r * r2 * (-0.1660784f + r2 * 0.0076337f);
+    // sin(r + q*pi) is -sin(r) for odd q
+    return q - 2.0f * floorf(q * 0.5f) != 0.0f ? -s : s;
+}
+
+
+
+OSL_HOSTDEVICE OSL_FORCEINLINE float
+approx_cos(float x)
+{
+    return approx_sin(x + float(M_PI_2));
+}
+
+
+
+/// atan2(y,x), to an absolute error of 2e-4 radians.
+OSL_HOSTDEVICE OSL_FORCEINLINE float
+approx_atan2(float y, float x)
+{
+    float ax = fabsf(x), ay = fabsf(y);
+    float hi = ax > ay ? ax : ay;
+    float lo = ax > ay ? ay : ax;
+    float a  = hi > 0.0f ? lo / hi : 0.0f;
+    float s  = a * a;
+    float r  = a + a * s * (-0.3276228f + s * (0.1593142f - s * 0.0464965f));
+    if (ay > ax)
+        r = float(M_PI_2) - r;
+    if (x < 0.0f)
+        r = float(M_PI) - r;
+    return copysignf(r, y);
+}
+
+
+
+// Dual versions, with the derivatives from the same approximations
+
+template<class T, int P>
+OSL_HOSTDEVICE OSL_FORCEINLINE Dual<T, P>
+approx_exp(const Dual<T, P>& a)
+{
+    T f = approx_exp(a.val());
+    return dualfunc(a, f, f);
+}
+
+template<class T, int P>
+OSL_HOSTDEVICE OSL_FORCEINLINE Dual<T, P>
+approx_log(const Dual<T, P>& a)
+{
+    T f  = approx_log(a.val());
+    T df = a.val() < std::numeric_limits<float>::min() ? 0.0f : 1.0f / a.val();
+    return dualfunc(a, f, df);
+}
+
+template<class T, int P>
+OSL_HOSTDEVICE OSL_FORCEINLINE Dual<T, P>
+approx_safe_pow(const Dual<T, P>& u, const Dual<T, P>& v)
+{
+    // Same formulation as fast_safe_pow: u^v = u * u^(v-1)
+    T powuvm1 = approx_safe_pow(u.val(), v.val() - 1.0f);
+    T powuv   = powuvm1 * u.val();
+    T logu    = u.val() > 0 ? approx_log(u.val()) : 0.0f;
+    return dualfunc(u, v, powuv, v.val() * powuvm1, logu * powuv);
+}
+
+template<class T, int P>
+OSL_HOSTDEVICE OSL_FORCEINLINE Dual<T, P>
+approx_sin(const Dual<T, P>& a)
+{
+    return dualfunc(a, approx_sin(a.val()), approx_cos(a.val()));
+}
+
+template<class T, int P>
+OSL_HOSTDEVICE OSL_FORCEINLINE Dual<T, P>
+approx_cos(const Dual<T, P>& a)
+{
+    return dualfunc(a, approx_cos(a.val()), -approx_sin(a.val()));
+}
+
+template<class T, int P>
+OSL_HOSTDEVICE OSL_FORCEINLINE Dual<T, P>
+approx_atan2(const Dual<T, P>& y, const Dual<T, P>& x)
+{
+    T atan2xy = approx_atan2(y.val(), x.val());
+    T denom   = (x.val() == 0 && y.val() == 0)
+                    ? 0.0f
+                    : 1.0f / (x.val() * x.val() + y.val() * y.val());
+    return dualfunc(y, x, atan2xy, -x.val() * denom, y.val() * denom);
+}
+
+OSL_NAMESPACE_END
@@ -91,6 +91,23 @@ public:
                             Wide<const float> wtime);
     virtual bool is_overridden_get_matrix_WmWsWf() const = 0;
 
+    /// Get the 4x4 matrix that transforms points from the named 'from'
+    /// coordinate system to "common" space at a single time.  When the
+    /// space name is uniform and all the active lanes of a batch share a
+    /// time, as camera rays often do, this is called just once and its
+    /// result broadcast to the lanes (or inverted once and broadcast, for
+    /// the inverse matrix), instead of calling the wide get_matrix or
+    /// get_inverse_matrix.  Return true if ok, false if the named matrix
+    /// is not known.  Only called if is_overridden_get_matrix_uniform()
+    /// returns true.
+    virtual bool get_matrix_uniform(BatchedShaderGlobals* bsg,
+                                    Matrix44& result, ustringhash from,
+                                    float time)
+    {
+        return false;
+    }
+    virtual bool is_overridden_get_matrix_uniform() const { return false; }
+
 
     /// Get the 4x4 matrix that transforms points from "common" space to
     /// the named 'to' coordinate system to at the given time.  The
@@ -157,6 +174,29 @@ public:
         return false;
     }
 
+    /// One request of a get_attributes() gather: the object and name to
+    /// look up, the type and derivatives wanted, where to write the wide
+    /// value (laid out as the MaskedData passed to get_attribute), and
+    /// the lanes for which it was found.
+    struct AttributeGather {
+        ustringhash object;
+        ustringhash name;
+        TypeDesc type;
+        bool derivs;
+        void* wide_data;
+        Mask found;
+    };
+
+    /// Fetch several attributes for the lanes in mask at once, setting
+    /// the found mask of each request.  When the "batched_attribute_cache"
+    /// option is on, this is called once per batch with every attribute
+    /// the shader group may ask for, and the results serve the batch's
+    /// getattribute calls.  Renderers storing attributes in columns can
+    /// override it to fill them in one pass; the default simply calls
+    /// get_attribute() for each request.
+    virtual void get_attributes(BatchedShaderGlobals* bsg, Mask mask,
+                                span<AttributeGather> requests);
+
     /// Get multiple named user-data from the current object and write them into
     /// 'val'. If derivatives is true, the derivatives should be written into val
     /// as well. It is assumed the results are varying and returns Mask
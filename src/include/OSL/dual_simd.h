@@ -0,0 +1,272 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <OSL/dual.h>
+#include <OSL/oslconfig.h>
+
+#ifndef __CUDACC__
+#    include <OpenImageIO/simd.h>
+#endif
+
+// OSL_DUAL2_PACKED is 1 when Dual2f4 is backed by real SIMD registers, so
+// that code with a plain Dual2<float> fallback knows it's worth using.
+#if !defined(__CUDACC__) && OIIO_SIMD_SSE
+#    define OSL_DUAL2_PACKED 1
+#else
+#    define OSL_DUAL2_PACKED 0
+#endif
+
+
+OSL_NAMESPACE_BEGIN
+
+#ifndef __CUDACC__
+
+/// A Dual2<float> with its value and both partials packed into the lanes
+/// of one vfloat4, as (val, dx, dy, 0), so that each arithmetic operation
+/// on the dual is a single SIMD operation or two rather than a scalar one
+/// per component.
+///
+/// Dual2<float> itself keeps its layout of three consecutive floats, since
+/// that is how derivative-carrying symbols are laid out in the memory that
+/// shadeops are handed. Load into a Dual2f4 at the start of a computation,
+/// and store back with dual2() at the end.
+class Dual2f4 {
+public:
+    typedef OIIO::simd::vfloat4 vfloat4;
+
+    Dual2f4() {}
+    explicit Dual2f4(const vfloat4& v)
+        : m_v(v)
+    {
+    }
+    explicit Dual2f4(float val)
+        : m_v(val, 0.0f, 0.0f, 0.0f)
+    {
+    }
+    Dual2f4(float val, float dx, float dy)
+        : m_v(val, dx, dy, 0.0f)
+    {
+    }
+    explicit Dual2f4(const Dual2<float>& d)
+        : m_v(d.val(), d.dx(), d.dy(), 0.0f)
+    {
+    }
+
+    float val() const { return OIIO::simd::extract<0>(m_v); }
+    float dx() const { return OIIO::simd::extract<1>(m_v); }
+    float dy() const { return OIIO::simd::extract<2>(m_v); }
+
+    /// The packed lanes (val, dx, dy, 0).
+    const vfloat4& simd() const { return m_v; }
+
+    /// The same value and partials as a plain Dual2<float>.
+    Dual2<float> dual2() const { return Dual2<float>(val(), dx(), dy()); }
+
+    /// Just the partials, (0, dx, dy, 0).
+    vfloat4 partials() const { return OIIO::simd::insert<0>(m_v, 0.0f); }
+
+    /// The value in all four lanes.
+    vfloat4 splat_val() const { return OIIO::simd::shuffle<0>(m_v); }
+
+private:
+    vfloat4 m_v;
+};
+
+
+
+inline Dual2f4
+operator+(const Dual2f4& a, const Dual2f4& b)
+{
+    return Dual2f4(a.simd() + b.simd());
+}
+
+inline Dual2f4
+operator+(const Dual2f4& a, float b)
+{
+    return Dual2f4(a.simd() + Dual2f4(b).simd());
+}
+
+inline Dual2f4
+operator+(float a, const Dual2f4& b)
+{
+    return b + a;
+}
+
+inline Dual2f4
+operator-(const Dual2f4& a, const Dual2f4& b)
+{
+    return Dual2f4(a.simd() - b.simd());
+}
+
+inline Dual2f4
+operator-(const Dual2f4& a, float b)
+{
+    return Dual2f4(a.simd() - Dual2f4(b).simd());
+}
+
+inline Dual2f4
+operator-(float a, const Dual2f4& b)
+{
+    return Dual2f4(Dual2f4(a).simd() - b.simd());
+}
+
+inline Dual2f4
+operator-(const Dual2f4& a)
+{
+    return Dual2f4(-a.simd());
+}
+
+
+
+/// Product rule: (a*b)' = a'*b + a*b', with the value lane getting a*b
+/// from the first term and nothing from the second.
+inline Dual2f4
+operator*(const Dual2f4& a, const Dual2f4& b)
+{
+    return Dual2f4(OIIO::simd::madd(a.simd(), b.splat_val(),
+                                    a.splat_val() * b.partials()));
+}
+
+inline Dual2f4
+operator*(const Dual2f4& a, float b)
+{
+    return Dual2f4(a.simd() * b);
+}
+
+inline Dual2f4
+operator*(float a, const Dual2f4& b)
+{
+    return Dual2f4(b.simd() * a);
+}
+
+
+
+/// Quotient rule: (a/b)' = (a' - (a/b)*b') / b. The value is divided
+/// rather than multiplied by the reciprocal, to round like Dual2<float>.
+inline Dual2f4
+operator/(const Dual2f4& a, const Dual2f4& b)
+{
+    float bval      = b.val();
+    float aval_bval = a.val() / bval;
+    Dual2f4::vfloat4 r = OIIO::simd::nmadd(Dual2f4::vfloat4(aval_bval),
+                                           b.partials(), a.simd())
+                         * (1.0f / bval);
+    return Dual2f4(OIIO::simd::insert<0>(r, aval_bval));
+}
+
+inline Dual2f4
+operator/(const Dual2f4& a, float b)
+{
+    return Dual2f4(OIIO::simd::insert<0>(a.simd() * (1.0f / b), a.val() / b));
+}
+
+inline Dual2f4
+operator/(float a, const Dual2f4& b)
+{
+    float bval      = b.val();
+    float aval_bval = a / bval;
+    return Dual2f4(OIIO::simd::insert<0>(b.simd() * (-aval_bval / bval),
+                                         aval_bval));
+}
+
+
+
+/// Packed counterparts of the dualfunc() helpers in dual.h: the result
+/// has value f_val and partials df_val*u' (+ dfdv_val*v').
+inline Dual2f4
+dualfunc(const Dual2f4& u, float f_val, float df_val)
+{
+    return Dual2f4(OIIO::simd::insert<0>(u.simd() * df_val, f_val));
+}
+
+inline Dual2f4
+dualfunc(const Dual2f4& u, const Dual2f4& v, float f_val, float dfdu_val,
+         float dfdv_val)
+{
+    return Dual2f4(OIIO::simd::insert<0>(
+        OIIO::simd::madd(u.simd(), Dual2f4::vfloat4(dfdu_val),
+                         v.simd() * dfdv_val),
+        f_val));
+}
+
+
+
+/// Apply any of the Dual math functions (sin, fast_exp, safe_pow, ...) to
+/// a Dual2f4: evaluate it on a dual with a single unit partial, which
+/// gives f and f' with the exact same math (and special cases) as the
+/// Dual2<float> version, and then scale all the partials at once.
+template<typename F>
+inline Dual2f4
+dual2f4_apply(const Dual2f4& u, F func)
+{
+    Dual<float, 1> f = func(Dual<float, 1>(u.val(), 1.0f));
+    return dualfunc(u, f.val(), f.dx());
+}
+
+template<typename F>
+inline Dual2f4
+dual2f4_apply(const Dual2f4& u, const Dual2f4& v, F func)
+{
+    Dual<float, 2> f = func(Dual<float, 2>(u.val(), 1.0f, 0.0f),
+                            Dual<float, 2>(v.val(), 0.0f, 1.0f));
+    return dualfunc(u, v, f.val(), f.dx(), f.dy());
+}
+
+
+
+#    define OSL_DUAL2F4_UNARY(name)                                  \
+        inline Dual2f4 name(const Dual2f4& a)                        \
+        {                                                            \
+            return dual2f4_apply(a, [](const Dual<float, 1>& x) {    \
+                return name(x);                                      \
+            });                                                      \
+        }
+
+#    define OSL_DUAL2F4_BINARY(name)                                     \
+        inline Dual2f4 name(const Dual2f4& a, const Dual2f4& b)          \
+        {                                                                \
+            return dual2f4_apply(a, b,                                   \
+                                 [](const Dual<float, 2>& x,             \
+                                    const Dual<float, 2>& y) {           \
+                                     return name(x, y);                  \
+                                 });                                     \
+        }
+
+OSL_DUAL2F4_UNARY(sqrt)
+OSL_DUAL2F4_UNARY(inversesqrt)
+OSL_DUAL2F4_UNARY(exp)
+OSL_DUAL2F4_UNARY(safe_log)
+OSL_DUAL2F4_UNARY(sin)
+OSL_DUAL2F4_UNARY(cos)
+OSL_DUAL2F4_UNARY(fast_exp)
+OSL_DUAL2F4_UNARY(fast_log)
+OSL_DUAL2F4_UNARY(fast_sin)
+OSL_DUAL2F4_UNARY(fast_cos)
+OSL_DUAL2F4_BINARY(safe_pow)
+OSL_DUAL2F4_BINARY(atan2)
+OSL_DUAL2F4_BINARY(fast_safe_pow)
+OSL_DUAL2F4_BINARY(fast_atan2)
+
+#    undef OSL_DUAL2F4_UNARY
+#    undef OSL_DUAL2F4_BINARY
+
+
+
+// f(t) = (3-2t)t^2,   t = (x-e0)/(e1-e0)
+inline Dual2f4
+smoothstep(const Dual2f4& e0, const Dual2f4& e1, const Dual2f4& x)
+{
+    if (x.val() < e0.val())
+        return Dual2f4(0.0f);
+    else if (x.val() >= e1.val())
+        return Dual2f4(1.0f);
+    Dual2f4 t = (x - e0) / (e1 - e0);
+    return (3.0f - 2.0f * t) * t * t;
+}
+
+#endif  // __CUDACC__
+
+OSL_NAMESPACE_END
@@ -20,6 +20,38 @@ struct ClosureParam {
     int         field_size;
 };
 
+// The TypeDesc of closure parameters of C++ type T
+template<typename T> struct ClosureParamType;
+template<> struct ClosureParamType<int> {
+    static TypeDesc type() { return TypeInt; }
+};
+template<> struct ClosureParamType<float> {
+    static TypeDesc type() { return TypeFloat; }
+};
+template<> struct ClosureParamType<Color3> {
+    static TypeDesc type() { return TypeColor; }
+};
+template<> struct ClosureParamType<Vec3> {
+    static TypeDesc type() { return TypeVector; }
+};
+template<> struct ClosureParamType<ustring> {
+    static TypeDesc type() { return TypeString; }
+};
+template<> struct ClosureParamType<ustringhash> {
+    static TypeDesc type() { return TypeString; }
+};
+template<typename T> struct ClosureParamType<T*> {
+    static TypeDesc type() { return TypeDesc::PTR; }
+};
+template<typename T, int N> struct ClosureParamType<T[N]> {
+    static TypeDesc type()
+    {
+        TypeDesc t = ClosureParamType<T>::type();
+        t.arraylen = N;
+        return t;
+    }
+};
+
 #define reckless_offsetof(st, fld) (((char *)&(((st *)16)->fld)) - (char *)16)
 #define fieldsize(st, fld) sizeof(((st *)0)->fld)
 
@@ -59,6 +91,13 @@ struct ClosureParam {
 #define CLOSURE_STRING_KEYPARAM(st, fld, key) \
     { TypeString, (int)reckless_offsetof(st, fld), key, fieldsize(st, fld) }
 
+// The same, with the type deduced from the field's C++ type at compile
+// time, so that it can't disagree with the struct
+#define CLOSURE_PARAM(st, fld) \
+    { ClosureParamType<decltype(st::fld)>::type(), (int)reckless_offsetof(st, fld), NULL, fieldsize(st, fld) }
+#define CLOSURE_KEYPARAM(st, fld, key) \
+    { ClosureParamType<decltype(st::fld)>::type(), (int)reckless_offsetof(st, fld), key, fieldsize(st, fld) }
+
 #define CLOSURE_FINISH_PARAM(st) { TypeDesc(), sizeof(st), nullptr, alignof(st) }
 
 OSL_NAMESPACE_END
@@ -101,6 +101,12 @@ OSLEXECPUBLIC bool
 initialize_buffer(uint8_t* const buffer, uint32_t buf_size_,
                   uint32_t page_size_, int thread_count_);
 
+/// Fraction [0,1] of the buffer's pages claimed by writers so far.
+/// Renderers with long or many passes can poll this between them and
+/// drain_buffer before it fills up and entries start being dropped.
+OSLEXECPUBLIC float
+buffer_usage(const uint8_t* const buffer);
+
 /// Abstract base class intended for Renders to override and handle messages
 /// decoded from a journal buffer
 class OSLEXECPUBLIC Reporter {
@@ -173,8 +179,22 @@ public:
     Reader(const uint8_t* buffer_, Reporter& reporter);
     void process();
 
+    /// Decode the pages of the journal's threads in parallel, using up to
+    /// nthreads threads (0 meaning one per core), into per-thread buffers.
+    /// The Reporter still sees exactly what process() would report, in the
+    /// same order (all of thread 0's entries, then thread 1's, ...), and is
+    /// only ever called from the calling thread.  If stream is true, each
+    /// thread's entries are reported as soon as they and those of all the
+    /// threads before it are decoded; otherwise nothing is reported until
+    /// everything is decoded.
+    void process(int nthreads, bool stream = true);
+
 private:
-    void process_entries_for_thread(int thread_index);
+    struct DecodedEntries;
+    void decode_entries_for_thread(int thread_index,
+                                   DecodedEntries& decoded) const;
+    void report_entries(int thread_index, const DecodedEntries& decoded);
+    void report_journal_limits();
 
     const uint8_t* const m_buffer;   //Read  from this?
     const pvt::Organization& m_org;  //
@@ -182,6 +202,12 @@ private:
     Reporter& m_reporter;
 };
 
+/// Process all entries of the journal buffer through the reporter, then
+/// re-initialize it with its original sizes, ready for more shading.
+/// No Writer may be recording into the buffer during the call.
+OSLEXECPUBLIC bool
+drain_buffer(uint8_t* const buffer, Reporter& reporter);
+
 /// Writer is a lightweight class meant to be constructed as a local variable
 /// with an already initalized journal buffer and used to record error,
 /// warnings, prints, or fprints into the buffer and then go out of scope.
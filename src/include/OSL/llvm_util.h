@@ -6,6 +6,8 @@
 
 #include <OSL/oslconfig.h>
 
+#include <functional>
+#include <memory>
 #include <unordered_set>
 #include <vector>
 
@@ -50,6 +52,8 @@ class PassManager;
 
 OSL_NAMESPACE_BEGIN
 
+class ShaderRegistry;
+
 namespace pvt {  // OSL::pvt
 
 
@@ -63,6 +67,7 @@ enum class TargetISA {
     AVX2_noFMA,
     AVX512,
     AVX512_noFMA,
+    NEON,
     HOST,
     NVPTX,
     COUNT
@@ -135,6 +140,7 @@ public:
         m_llvm_module       = m;
         m_ModuleIsFinalized = false;
         m_ModuleIsPruned    = false;
+        m_ModuleIsSplit     = false;
     }
 
     /// Create a new empty module.
@@ -196,10 +202,33 @@ public:
     ///     ["x64", "SSE4.2", "AVX", "AVX2", "AVX512"]
     ///     (ignored if requested ISA not valid for host)
     /// Optionally enable debugging symbols (source file & line number)
-    /// Optionally enable profiling events
+    /// Optionally enable profiling events, a bitfield of ProfilingEvents
+    /// (for compatibility, true is ProfileVTune).
     llvm::ExecutionEngine* make_jit_execengine(
         std::string* err = nullptr, TargetISA requestedISA = TargetISA::NONE,
-        bool debugging_symbols = false, bool profiling_events = false);
+        bool debugging_symbols = false, int profiling_events = 0);
+
+    /// Memory holding JITed code, which stays allocated (and the code in
+    /// it valid) for as long as any reference to it is held.
+    typedef std::shared_ptr<llvm::SectionMemoryManager> JitMemoryRef;
+
+    /// Have the engines made from here on JIT into memory of their own,
+    /// rather than the memory that this thread shares with everything
+    /// else it JITs, which is only freed when the last ScopedJitMemoryUser
+    /// goes away, and return it. Holding the returned reference keeps the
+    /// code alive; letting go of the last one frees it.
+    JitMemoryRef private_jit_memory();
+
+    /// Bytes of code and data that the engines made by this LLVM_Util
+    /// have JITed.
+    size_t jit_bytes() const { return m_jit_bytes; }
+
+    /// Kinds of profiling events that make_jit_execengine can emit.
+    enum ProfilingEvents {
+        ProfileVTune   = 1,  ///< Intel JIT events, for VTune
+        ProfilePerfMap = 2,  ///< Append to /tmp/perf-<pid>.map, for perf
+        ProfileJitDump = 4,  ///< jitdump files, for `perf inject --jit`
+    };
 
     /// Report the host's TargetISA as chosen by the last call to
     /// make_jit_execengine() or to detect_cpu_features(). Don't call
@@ -269,10 +298,113 @@ public:
     /// current one).
     void execengine(llvm::ExecutionEngine* exec);
 
+    /// Attach a persistent object cache, living in directory `cachedir`,
+    /// to the current ExecutionEngine. The machine code that the JIT
+    /// generates for the current module is saved in a file named from
+    /// `key` combined with the target machine's triple and CPU, as the
+    /// variant for the engine's TargetISA, so `key` must identify the
+    /// module's IR and anything else that affects codegen. Return true if
+    /// the cache already holds code for that key, for our ISA or else for
+    /// the most capable lesser one the host supports; the caller may then
+    /// skip optimizing the module, since the cached object will be loaded
+    /// in place of running codegen. With a `registry`, the code is also
+    /// kept there, in memory, and looked for there first. Passing an empty
+    /// `cachedir` and no registry detaches any cache.
+    bool jit_object_cache(string_view cachedir, string_view key,
+                          ShaderRegistry* registry = nullptr);
+
+    /// Generate the machine code for the current, already optimized,
+    /// module for each of `isas` of the engine's architecture, other than
+    /// its own, and store it in the attached object cache as that ISA's
+    /// variant, so that hosts of those kinds find it there. Return how
+    /// many variants were stored; `err` describes any that failed.
+    int jit_object_cache_populate(cspan<TargetISA> isas,
+                                  std::string* err = nullptr);
+
+    /// Did the most recent JIT load its code from the object cache?
+    bool jit_object_cache_hit() const;
+
+    /// Generate the machine code for the current, already optimized,
+    /// module on up to `nthreads` threads: split it into partitions, have
+    /// each compiled to an object file in its own LLVMContext, and load
+    /// those into the ExecutionEngine in place of the module's own IR.
+    /// Afterwards getPointerToFunction() works as usual, but the module is
+    /// left with bare declarations, so it can't be split, cached, or have
+    /// functions deferred any more. Return false, leaving the module
+    /// untouched to be JITed the normal way, if there is nothing to gain
+    /// (one thread, tiny module) or if it can't be done (debug symbols, an
+    /// attached object cache, or a codegen failure).
+    ///
+    /// If `run_tasks` is given, the partitions are compiled by calling
+    /// run_tasks(npartitions, task), which runs task(0) through
+    /// task(npartitions-1) on whatever threads it likes (a shared pool,
+    /// say) and returns when all are done. Otherwise they get threads of
+    /// their own.
+    typedef std::function<void(int ntasks,
+                               const std::function<void(int)>& task)>
+        TaskRunner;
+    bool parallel_codegen(int nthreads, std::string* err = nullptr,
+                          const TaskRunner& run_tasks = {});
+
+    /// Replace the current module's copies of the larger functions from
+    /// the library bitcode[0..size-1] (at least `min_insts` instructions
+    /// and not always-inline) by calls into a resident copy of them that
+    /// is JITed just once per library and target machine and is shared by
+    /// every module linked this way, until the last ScopedJitMemoryUser
+    /// goes away. The current module must have been created from that
+    /// bitcode and must not be pruned yet. Return the number of functions
+    /// linked to the shared copy; if the library couldn't be built, return
+    /// 0 and set *err.
+    int link_shared_library(const char* bitcode, size_t size,
+                            string_view name, int min_insts,
+                            std::string* err = nullptr);
+
+    /// Functions taken out of a module by defer_functions(), to be JITed
+    /// one at a time by jit_deferred_function() if they are ever needed.
+    class DeferredCode;
+    typedef std::shared_ptr<DeferredCode> DeferredCodeRef;
+
+    /// Take the named functions, which nothing else in the current, already
+    /// optimized module may call, out of it before it is JITed, keeping a
+    /// copy of the module from which each can be JITed on its own later.
+    /// Return nullptr, leaving the module untouched, if that can't be done
+    /// (a function is missing or called, debug symbols, an attached object
+    /// cache, or the module was already JITed).
+    DeferredCodeRef defer_functions(cspan<std::string> names);
+
+    /// JIT the function `name` of the deferred code by itself and return
+    /// its address, or nullptr (and set *err) if that fails. Safe to call
+    /// from any thread; a function is only compiled once, and its code
+    /// stays resident for as long as the DeferredCode does.
+    static void* jit_deferred_function(DeferredCode& code, string_view name,
+                                       std::string* err = nullptr);
+
+    /// Number of counters that instrument_branch_profile() needs for the
+    /// given (not yet optimized) functions: one for each function entry,
+    /// and two for each conditional branch.
+    size_t branch_profile_size(cspan<llvm::Function*> funcs);
+
+    /// Make the functions count, in counters[0..branch_profile_size-1],
+    /// how many times each of them is called and each of their conditional
+    /// branches goes either way. The counter array must outlive the JITed
+    /// code.
+    void instrument_branch_profile(cspan<llvm::Function*> funcs,
+                                   uint64_t* counters);
+
+    /// Give the functions the entry counts and branch weights recorded by
+    /// instrument_branch_profile() for identical IR, for the optimizer to
+    /// use. Return false if counts can't belong to these functions.
+    bool apply_branch_profile(cspan<llvm::Function*> funcs,
+                              cspan<uint64_t> counts);
+
     /// Return a pointer to the TargetMachine for NVPTX.  Create the TargetMachine
     /// if it has not yet been created.
     llvm::TargetMachine* nvptx_target_machine();
 
+    /// Set the GPU architecture (such as "sm_80") to generate PTX for,
+    /// rather than the one OSL was built for (if arch is empty).
+    void nvptx_target_arch(string_view arch);
+
     enum class Linkage {
         External,  // Externally visible
         LinkOnceODR,  // One Definition Rule:  Inline version, but allow replacement by equivalent.
@@ -1031,6 +1163,14 @@ public:
     bool ptx_compile_group(llvm::Module* lib_module, const std::string& name,
                            std::string& out);
 
+    /// Mark func as a CUDA kernel (a __global__ function), which NVPTX
+    /// emits as an entry point the host can launch.
+    void make_cuda_kernel(llvm::Function* func);
+
+    /// Return the index of the calling CUDA thread across the whole 1D
+    /// launch, blockIdx.x * blockDim.x + threadIdx.x, as an int.
+    llvm::Value* cuda_thread_index();
+
     /// Convert all functions in module's bitcode to a string.
     std::string bitcode_string(llvm::Module* module);
 
@@ -1049,10 +1189,22 @@ public:
 
     std::string func_name(llvm::Function* f);
 
+    /// Bytes of JITed code and data currently allocated, by every thread.
+    /// Goes down as private_jit_memory() and DeferredCode are freed.
     static size_t total_jit_memory_held();
 
+    /// Place JITed code and read-only data, from now on, in 2MB slabs
+    /// (backed by huge pages where the OS allows), shared by all threads,
+    /// rather than mapping every block of them separately.
+    static void jit_huge_pages(bool on);
+
+    /// Bytes of those slabs currently mapped, and how many of them are
+    /// in use (the rest being lost to fragmentation or not yet filled).
+    static void jit_slab_memory(size_t& reserved, size_t& used);
+
 private:
     class MemoryManager;
+    class ObjectCache;
     class IRBuilder;
     struct NewPassManager;
 
@@ -1069,13 +1221,18 @@ private:
     llvm::Module* m_llvm_module;
     IRBuilder* m_builder;
     llvm::SectionMemoryManager* m_llvm_jitmm;
+    JitMemoryRef m_private_jitmm;  // Set by private_jit_memory()
+    size_t m_jit_bytes = 0;        // Bytes JITed, see jit_bytes()
     llvm::Function* m_current_function;
     llvm::legacy::PassManager* m_llvm_module_passes;
     llvm::legacy::FunctionPassManager* m_llvm_func_passes;
     NewPassManager* m_new_pass_manager;
     llvm::ExecutionEngine* m_llvm_exec;
+    ObjectCache* m_object_cache = nullptr;
+    void* (*m_lazy_function_creator)(const std::string&) = nullptr;
     TargetISA m_target_isa = TargetISA::UNKNOWN;
     llvm::TargetMachine* m_nvptx_target_machine;
+    std::string m_nvptx_target_arch;
 
     std::vector<llvm::BasicBlock*> m_return_block;      // stack for func call
     std::vector<llvm::BasicBlock*> m_loop_after_block;  // stack for break
@@ -1139,6 +1296,8 @@ private:
 
     // Profiling Info
     llvm::JITEventListener* mVTuneNotifier;
+    llvm::JITEventListener* mPerfNotifier    = nullptr;  // Static, not owned
+    llvm::JITEventListener* mPerfMapNotifier = nullptr;  // Static, not owned
 
     // Debug Info
     llvm::DIFile* getOrCreateDebugFileFor(const std::string& file_name);
@@ -1155,6 +1314,7 @@ private:
     llvm::DISubroutineType* mSubTypeForInlinedFunction;
     bool m_ModuleIsFinalized;
     bool m_ModuleIsPruned;
+    bool m_ModuleIsSplit;  // Its code went to objects by parallel_codegen
 
     // Additional tracking for masked conditionals, shaders, subroutines, and loop flow control
     struct MaskInfo {
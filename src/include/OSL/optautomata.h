@@ -22,48 +22,72 @@ class DfAutomata;
 /// is a fast compact equivalent of the DfAutomata designed for read
 /// only operations.
 ///
+/// The symbols the automata knows get dense ids, [0,numSymbols()), and
+/// numSymbols() stands for any other symbol. Transitions are a flat
+/// table of states by symbol ids, so a renderer that looks up the ids of
+/// its labels once with getSymbolId() can step with a single load.
+///
 class OSLEXECPUBLIC DfOptimizedAutomata {
 public:
     void compileFrom(const DfAutomata& dfautomata);
 
-    int getTransition(int state, OIIO::ustring symbol) const
+    /// The id of a symbol, or numSymbols() if no transition uses it
+    int getSymbolId(OIIO::ustring symbol) const
     {
-        const State& mystate    = m_states[state];
-        const Transition* begin = &m_trans[mystate.begin_trans];
-        const Transition* end   = begin + mystate.ntrans;
+        const OIIO::ustring* begin = m_symbols.data();
+        const OIIO::ustring* end   = begin + m_symbols.size();
+        const OIIO::ustring* first = begin;
         while (begin < end) {  // binary search
-            const Transition* middle = begin + ((end - begin) >> 1);
-            if (symbol.data() < middle->symbol.data())
+            const OIIO::ustring* middle = begin + ((end - begin) >> 1);
+            if (symbol.data() < middle->data())
                 end = middle;
-            else if (middle->symbol.data() < symbol.data())
+            else if (middle->data() < symbol.data())
                 begin = middle + 1;
             else  // match
-                return middle->state;
+                return int(middle - first);
         }
-        return mystate.wildcard_trans;
+        return numSymbols();
+    }
+
+    int numSymbols() const { return int(m_symbols.size()); }
+
+    int getTransition(int state, int symbol_id) const
+    {
+        return m_trans[size_t(state) * (m_symbols.size() + 1) + symbol_id];
     }
 
+    int getTransition(int state, OIIO::ustring symbol) const
+    {
+        return getTransition(state, getSymbolId(symbol));
+    }
+
+    /// The transition table, numSymbols()+1 entries per state
+    const int* getTransitionTable() const { return m_trans.data(); }
+
     void* const* getRules(int state, int& count) const
     {
         count = m_states[state].nrules;
         return &m_rules[m_states[state].begin_rules];
     }
 
+    /// Replace every rule pointer r with f(r), for when the rules the
+    /// states point to are copied elsewhere
+    template<typename F> void mapRules(F f)
+    {
+        for (auto& r : m_rules)
+            r = f(r);
+    }
+
 protected:
     struct State {
-        unsigned int begin_trans;
-        unsigned int ntrans;
         unsigned int begin_rules;
         unsigned int nrules;
-        int wildcard_trans;
-    };
-    struct Transition {
-        // we use this only for sorting
-        static bool trans_comp(const Transition& a, const Transition& b);
-        OIIO::ustring symbol;
-        int state;
     };
-    std::vector<Transition> m_trans;
+    // Symbols sorted by address, their index is their id
+    std::vector<OIIO::ustring> m_symbols;
+    // The next state for each state and symbol id, the last column being
+    // the wildcard transition for any other symbol
+    std::vector<int> m_trans;
     std::vector<void*> m_rules;
     std::vector<State> m_states;
 };
@@ -146,4 +146,55 @@ typedef ClosureComponent* ClosureComponentPtr;
 typedef ClosureAdd* ClosureAddPtr;
 typedef ClosureMul* ClosureMulPtr;
 
+
+
+/// One component of a closure, with the weights of the tree above it
+/// multiplied through, as made by flatten_closure().
+struct FlatClosure {
+    const ClosureComponent* comp;  ///< The component (id, w, and params)
+    Color3 weight;  ///< Product of the multipliers above it (not comp->w)
+};
+
+/// Flatten the closure tree into an array of at most `max` components, in
+/// depth-first order, each with the product of `weight` and all the
+/// multipliers above it, and return how many there are. Components past
+/// `max` (or trees nested too deeply) are left out. An integrator can
+/// then set up its BSDFs with a linear scan of the array instead of
+/// walking the tree through pointers.
+OSL_HOSTDEVICE inline int
+flatten_closure(const ClosureColor* closure, FlatClosure* out, int max,
+                const Color3& weight = Color3(1.0f))
+{
+    // Non-recursive traversal stack
+    const int STACK_SIZE = 16;
+    int stack_idx        = 0;
+    const ClosureColor* ptr_stack[STACK_SIZE];
+    Color3 weight_stack[STACK_SIZE];
+    Color3 w = weight;
+    int n    = 0;
+
+    while (closure && n < max) {
+        if (closure->id == ClosureColor::MUL) {
+            w *= closure->as_mul()->weight;
+            closure = closure->as_mul()->closure;
+        } else if (closure->id == ClosureColor::ADD) {
+            if (stack_idx < STACK_SIZE) {
+                ptr_stack[stack_idx]      = closure->as_add()->closureB;
+                weight_stack[stack_idx++] = w;
+            }
+            closure = closure->as_add()->closureA;
+        } else {
+            out[n].comp   = closure->as_comp();
+            out[n].weight = w;
+            ++n;
+            closure = nullptr;
+        }
+        if (closure == nullptr && stack_idx > 0) {
+            closure = ptr_stack[--stack_idx];
+            w       = weight_stack[stack_idx];
+        }
+    }
+    return n;
+}
+
 OSL_NAMESPACE_END
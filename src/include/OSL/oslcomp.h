@@ -33,6 +33,12 @@ public:
     /// (the compile() from file method would have used the name of the
     /// actual file for this purpose). Return true if ok, false if the
     /// compile failed.
+    ///
+    /// Warning-free results are remembered for the life of the process,
+    /// keyed by the source, options, stdoslpath and filename, and reused
+    /// while the headers they included are unchanged. With the option
+    /// "-compile-cache DIR" they are also kept in (and found in) DIR,
+    /// across processes.
     bool compile_buffer(string_view sourcecode, std::string& osobuffer,
                         const std::vector<std::string>& options,
                         string_view stdoslpath = string_view(),
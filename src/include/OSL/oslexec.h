@@ -4,11 +4,15 @@
 
 #pragma once
 
+#include <functional>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include <OSL/oslconfig.h>
 #include <OSL/shaderglobals.h>
 
+#include <OpenImageIO/paramlist.h>
 #include <OpenImageIO/refcnt.h>
 
 
@@ -65,7 +69,30 @@ namespace Strings {
 
 
 
+/// Where an `indirect` SymLocationDesc finds its data.  The binding itself
+/// lives at the symloc's offset from its arena base pointer, and may be
+/// rewritten before any execute to retarget the symbol (for example,
+/// straight into a framebuffer or AOV) with no re-JIT and no lookup by
+/// name.  Batched execution uses the symloc's stride rather than this one.
+struct SymLocationBinding {
+    void* data     = nullptr;  ///< Address of the value for shade index 0
+    int64_t stride = 0;        ///< Bytes between shade points
+};
+
+
+
 /// Description of where a symbol is located on the app side.
+///
+/// With arena SymArena::ShaderGlobals, the symbol is one of the globals P,
+/// I, N, Ng, u, v, dPdu, dPdv, time, dtime, dPdtime or Ps, and the JITed
+/// scalar code reads and writes it at that offset and stride from the
+/// userdata base pointer passed to execute, rather than in ShaderGlobals.
+/// A renderer can point the globals straight into its own hit records
+/// (with a stride of 0 if userdata_base_ptr is the current hit), leaving
+/// those fields of ShaderGlobals unset. The type must match the global's,
+/// and a global whose derivatives are used is only placed if `derivs` is
+/// set, the value then being followed by its x and y derivatives. Batched
+/// execution and the other globals still use the ShaderGlobals structs.
 struct SymLocationDesc {
 public:
     using offset_t                  = int64_t;
@@ -102,6 +129,20 @@ public:
     stride_t stride = AutoStride;      ///< Stride in bytes between shade points
     SymArena arena  = SymArena::Heap;  ///< Memory arena type for the symbol
     bool derivs     = false;           ///< Space allocated for derivs also
+    bool indirect   = false;           ///< Offset locates a SymLocationBinding
+};
+
+
+
+/// Where ShadingSystem::execute_many() copies an output symbol that lives
+/// on the context's heap after shading each point: the value (without
+/// derivatives) for the i-th point of the span goes to data + i * stride.
+/// Outputs placed with SymLocationDesc need no binding, since they are
+/// already written to their arena by shade index.
+struct OutputBinding {
+    const ShaderSymbol* symbol = nullptr;  ///< As returned by find_symbol()
+    void* data                 = nullptr;  ///< Destination for the first point
+    int64_t stride             = 0;        ///< Bytes between points
 };
 
 
@@ -167,6 +208,101 @@ set(ParamHints& a, ParamHints b, bool on = true)
 
 
 
+/// A complete shader group, with its parameters and connections already
+/// resolved to indices, for building many groups without the name lookups
+/// and string parsing of the Parameter/Shader/ConnectShaders calls. Layers
+/// are referred to by their position in `layers`, and parameters by the
+/// index that ShadingSystem::find_param returns for the layer's shader,
+/// which the app can look up once per shader and reuse for every group.
+/// A descriptor is a plain value: copy it and call set_param to describe a
+/// variant that differs in a few parameter values, and hand either one to
+/// ShadingSystem::build_shader_group, from any thread.
+struct ShaderGroupDesc {
+    struct Layer {
+        ustring shadername;
+        ustring layername;  ///< Made up if empty, as with Shader()
+    };
+    struct Param {
+        int layer;  ///< Index into `layers`
+        int param;  ///< Index from ShadingSystem::find_param
+        OIIO::ParamValue value;
+        ParamHints hints = ParamHints::none;
+    };
+    /// Connect an output of an earlier layer to a parameter of a later one.
+    struct Connection {
+        int srclayer, srcparam;
+        int dstlayer, dstparam;
+    };
+
+    ustring name;
+    ustring usage;
+    std::vector<Layer> layers;
+    std::vector<Param> params;
+    std::vector<Connection> connections;
+
+    /// Set the value of a layer's parameter, replacing any value it was
+    /// already given in this descriptor.
+    void set_param(int layer, int param, TypeDesc type, const void* val,
+                   ParamHints hints = ParamHints::none)
+    {
+        Param* p = nullptr;
+        for (auto& q : params)
+            if (q.layer == layer && q.param == param)
+                p = &q;
+        if (!p) {
+            params.emplace_back();
+            p        = &params.back();
+            p->layer = layer;
+            p->param = param;
+        }
+        p->value.init(ustring(), type, 1, val);
+        p->hints = hints;
+    }
+};
+
+
+
+/// Compiled work that several ShadingSystems in one process can share, so
+/// that once one of them has optimized and JITed a group, another making
+/// the very same group (with the same options, ray types and shaders) gets
+/// it without doing that work again. It holds, in memory, snapshots of
+/// optimized groups, as the "opt_snapshot_dir" option keeps them on disk,
+/// and JITed machine code, as "llvm_jit_cache_dir" does. Each entry is
+/// keyed by everything it depends on, so systems set up differently never
+/// pick up each other's work. Attach it to each system with
+/// ShadingSystem::attach_registry(); it lasts as long as any of them (or
+/// anyone else) holds it, and any number of threads may use it at once.
+///
+/// Shader masters themselves aren't shared: each belongs to the system
+/// that loaded it (its ray types, range checking and statistics).
+class OSLEXECPUBLIC ShaderRegistry {
+public:
+    ShaderRegistry();
+    ~ShaderRegistry();
+    ShaderRegistry(const ShaderRegistry&)            = delete;
+    ShaderRegistry& operator=(const ShaderRegistry&) = delete;
+
+    /// The data stored under key, or nullptr if there is none. It stays
+    /// good while it's held, even if the registry is cleared.
+    std::shared_ptr<const std::string> find(string_view key) const;
+
+    /// Store data under key, unless something already is.
+    void add(string_view key, string_view data);
+
+    /// Forget everything stored.
+    void clear();
+
+    /// The number of entries, and the bytes of data they hold.
+    size_t size() const;
+    size_t memory_used() const;
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> m_impl;
+};
+
+
+
 class OSLEXECPUBLIC ShadingSystem {
 public:
     ShadingSystem(RendererServices* renderer   = NULL,
@@ -179,8 +315,15 @@ public:
     /// Documented attributes are as follows:
     /// 1. Attributes that should be exposed to users:
     ///    int statistics:level   Automatically print OSL statistics (0).
+    ///    int statistics:slowest_groups  How many of the groups that took
+    ///                              longest to compile are listed by the
+    ///                              statistics and "stat:slowest_groups" (5).
     ///    string searchpath:shader  Colon-separated path to search for .oso
     ///                                files ("", meaning test "." only)
+    ///    string searchpath:bundle  Colon-separated list of shader bundle
+    ///                                files (see write_shader_bundle), which
+    ///                                are mapped and searched, in order,
+    ///                                before searchpath:shader ("").
     ///    string colorspace      Name of RGB color space ("Rec709")
     ///    int range_checking     Generate extra code for component & array
     ///                              range checking (1)
@@ -192,18 +335,107 @@ public:
     ///                              every shader compiled (0).
     ///    int max_warnings_per_thread  Number of warning calls that should be
     ///                              processed per thread (100).
+    ///    int closure_pool_max_KB  If nonzero, a context's closure memory
+    ///                              grown past this by an outlier shade is
+    ///                              freed back to this size (0).
+    ///    int context_heap_presize  If nonzero, get_context sizes the heap
+    ///                              of each context for the largest group
+    ///                              JITed so far, so that after
+    ///                              optimize_all_groups no shade needs to
+    ///                              reallocate it (0).
+    ///    int telemetry_interval  If nonzero, count the texture lookups and
+    ///                              closures of every Nth scalar shade of
+    ///                              each context, retrievable per group as
+    ///                              "stat:telemetry" (0).
+    ///    int pmu_interval       If nonzero, read the hardware counters
+    ///                              (cycles, instructions, cache misses,
+    ///                              branch misses) over every Nth scalar
+    ///                              shade of each context, reported per
+    ///                              group by getstats and as "stat:pmu".
+    ///                              Linux only, and needs perf events to
+    ///                              be allowed (perf_event_paranoid) (0).
+    ///    float stats_interval   Seconds between the calls of the
+    ///                              set_stats_callback() function (10).
     ///    int buffer_printf      Buffer printf output from shaders and
     ///                              output atomically, to prevent threads
     ///                              from interleaving lines. (1)
+    ///    int defer_printf       With buffer_printf, record the encoded
+    ///                              arguments of errors, warnings and
+    ///                              printfs, and only format them when the
+    ///                              context is released instead of at the
+    ///                              end of every shade. (0)
     ///    int profile            Perform some rudimentary profiling (0)
     ///    int no_noise           Replace noise with constant value. (0)
+    ///    string noise_hash      Lattice hash used by constant-named,
+    ///                              non-periodic perlin noise: "inthash"
+    ///                              (the default) or "pcg", a cheaper
+    ///                              PCG-style integer hash that suits GPUs
+    ///                              and SIMD.  Values differ between the
+    ///                              two. ("inthash")
     ///    int no_pointcloud      Skip pointcloud lookups. (0)
+    ///    string math_precision  Implementations of exp, log, pow, sin,
+    ///                              cos and atan2 that shaders get:
+    ///                              "precise" (the system math library),
+    ///                              "fast" (OIIO's fast_* functions,
+    ///                              within a few ulp), or "approx" (good
+    ///                              to about 4 digits, for looks that
+    ///                              tolerate it). Groups may override it.
+    ///                              ("fast", or "precise" if OSL was
+    ///                              built without USE_FAST_MATH)
+    ///    string pointcloud_index  Spatial index that pointcloud_search
+    ///                              uses for clouds it reads: "partio"
+    ///                              (Partio's KD-tree, the default) or
+    ///                              "kdtree" (OSL's own, built in parallel,
+    ///                              with batched searches). Chosen when a
+    ///                              cloud is first read. ("partio")
     ///    int exec_repeat        How many times to run each group (1).
+    ///    int raytype_variants   Keep up to this many (at most 8) copies of
+    ///                              each group, each specialized on the
+    ///                              ray types the group queries, and have
+    ///                              execute() run the copy that matches
+    ///                              ShaderGlobals::raytype. Each is made,
+    ///                              optimized and JITed on first use, and
+    ///                              ReParameter updates them all. The layers
+    ///                              are kept unoptimized for this, as with
+    ///                              reparam_rebuild. Results should be read
+    ///                              through symlocs or the ShadingContext,
+    ///                              whose group() is the copy that ran. Not
+    ///                              for OptiX or batched shading. (0)
+    ///    int userdata_variants  If nonzero, look at the userdata of the
+    ///                              first N scalar shades of each group.
+    ///                              Userdata that had one value in all of
+    ///                              them (and needs no derivatives) become
+    ///                              constants in a copy of the group, made,
+    ///                              optimized and JITed as for
+    ///                              raytype_variants. Later shades check
+    ///                              those userdata with one get_userdata_all
+    ///                              call, and run the copy if they still
+    ///                              match, the general group if not. Not
+    ///                              for OptiX or batched shading. (0)
+    ///    int debug_sample_interval  If nonzero, every Nth scalar shade of
+    ///                              each context runs a copy of the group
+    ///                              compiled with the checks of debug_nan
+    ///                              and debug_uninit, so that they can be
+    ///                              left on for a small fraction of a
+    ///                              production render. The copy is made,
+    ///                              optimized and JITed on first use, from
+    ///                              layers kept unoptimized as with
+    ///                              reparam_rebuild; its reports are
+    ///                              errors like any other. Results should
+    ///                              be read as for raytype_variants. Not
+    ///                              for OptiX or batched shading. (0)
+    ///    string debug_sample_raytype  Name of a ray type (see "raytypes")
+    ///                              whose shades always run the checked
+    ///                              copy, letting a renderer pick points to
+    ///                              check by tagging their rays. ("")
     ///    int opt_warnings       Warn on failure to runtime-optimize certain
     ///                              shader constructs. (0)
     ///    int gpu_opt_error      Issue a hard error if certain shader
     ///                              constructs cannot be optimized away, which
     ///                              have no way to run on GPU. (0)
+    ///    int opt_report         Keep a report of what the optimizer left of
+    ///                              each group, and why, for the group's
+    ///                              "optimization_report" attribute. (0)
     /// 2. Attributes that should be set by applications/renderers that
     /// incorporate OSL:
     ///    string commonspace     Name of "common" coord system ("world")
@@ -230,12 +462,57 @@ public:
     ///                              ops after optimization (1).
     ///    int lazytrace          Run layers lazily even if they have trace
     ///                              operations (1). Recommend 0 for OptiX.
-    ///    int lazy_userdata      Retrieve userdata lazily (0).
+    ///    int lazy_userdata      Retrieve userdata lazily (0). Otherwise
+    ///                              it's all fetched at the start of each
+    ///                              execution with one call to
+    ///                              RendererServices::get_userdata_all.
     ///    int userdata_isconnected  Should interpolated=1 params (that may
     ///                              receive userdata) return true from
     ///                              isconnected()? (0)
+    ///    int opt_share_groups   Let groups with the same layers,
+    ///                              connections and non-interactive
+    ///                              parameter values share one optimized
+    ///                              and JITed copy of their code, each
+    ///                              keeping its own interactive parameter
+    ///                              values. Not for OptiX or batched
+    ///                              shading. (0)
+    ///    string opt_snapshot_dir  If set, directory where the runtime
+    ///                              optimizer saves the optimized layers
+    ///                              of each group it optimizes, and from
+    ///                              which a later optimization of an
+    ///                              identical group (with the same shaders
+    ///                              and options), even by another process,
+    ///                              loads them instead of optimizing. With
+    ///                              llvm_jit_cache_dir, this lets many
+    ///                              processes share one compile of each
+    ///                              group. ("", meaning no snapshots)
+    ///    int reparam_rebuild    Allow ReParameter to change any parameter
+    ///                              of an already optimized group, which is
+    ///                              then optimized and JITed again the next
+    ///                              time it runs, if the change can affect
+    ///                              it. Costs a copy of each layer's
+    ///                              unoptimized state. Not for OptiX. (0)
+    ///    float memory_budget    Megabytes of memory (instances, masters and
+    ///                              JITed code) the shading system may hold
+    ///                              before enforce_memory_budget() evicts
+    ///                              the groups run least recently, to be
+    ///                              compiled again on their next use.
+    ///                              Costs, like reparam_rebuild, a copy of
+    ///                              each layer's unoptimized state. Not for
+    ///                              OptiX. (0, meaning no limit)
     ///    int greedyjit          Optimize and compile all shaders up front,
     ///                              versus only as needed (0).
+    ///    int texture_prefetch   After optimize_all_groups, resolve the
+    ///                              handles of, and open, all the textures
+    ///                              with constant names that the groups
+    ///                              use, in parallel, so that no lookup
+    ///                              during the render waits on that. (0)
+    ///    int udim_tile_cache    Find the tile of each UDIM texture lookup
+    ///                              in a table of the texture's tiles made
+    ///                              on its first use, rather than having
+    ///                              the TextureSystem resolve it every
+    ///                              time. Batched lookups are also sorted
+    ///                              by tile. (1)
     ///    int llvm_target_host   Target the specific host architecture for
     ///                              LLVM IR generation. (1)
     ///    int llvm_jit_fma       Allow fused mul/add (0). This can increase
@@ -245,15 +522,137 @@ public:
     ///    string llvm_jit_target  JIT to a specific ISA: "" or "none" means
     ///                              no special ops, "x64", "SSE4.2", "AVX",
     ///                              "AVX2", "AVX2_noFMA", "AVX512",
-    ///                              "AVX512_noFMA", or "host" means to
+    ///                              "AVX512_noFMA", "NEON", or "host" means to
     ///                              figure out what the host can do. ("")
     ///    int llvm_jit_aggressive  Use LLVM "aggressive" JIT mode. (0)
+    ///    string llvm_jit_cache_dir  If set, directory where the machine
+    ///                              code JITed for each CPU shader group is
+    ///                              saved, and reused (skipping LLVM opt and
+    ///                              codegen) when the identical group is
+    ///                              compiled again, even by a later
+    ///                              process. ("", meaning no caching)
+    ///                              Each ISA's code is kept as a variant
+    ///                              of the group's entry, and a host
+    ///                              lacking its own loads that of the most
+    ///                              capable lesser ISA it can run.
+    ///                              Entries are keyed by the group's LLVM
+    ///                              IR, which for some groups holds host
+    ///                              addresses (of texture handles resolved
+    ///                              while optimizing, of the renderer
+    ///                              services, of closure callbacks), so
+    ///                              those groups are only reused by a
+    ///                              process where the addresses came out
+    ///                              the same.
+    ///    string llvm_jit_isas   Comma-separated list of other ISAs (as
+    ///                              for llvm_jit_target) whose code
+    ///                              for each group JITed is also put in
+    ///                              the cache, so that a build node can
+    ///                              warm it for every kind of host of a
+    ///                              farm. Only ISAs of the host's
+    ///                              architecture can be generated. ("")
+    ///    int llvm_jit_tiered    If nonzero, the first JIT of each group is
+    ///                              done without LLVM optimization so that
+    ///                              shading can start at once, and this many
+    ///                              background threads then re-JIT it with
+    ///                              full optimization and swap it in. Not
+    ///                              used for OptiX or batched shading. (0)
+    ///    int llvm_jit_threads   Number of threads to use for generating
+    ///                              the machine code of a single group,
+    ///                              which is split into that many pieces
+    ///                              after LLVM optimization. The pieces
+    ///                              are compiled through the executor of
+    ///                              set_task_executor(), if there is
+    ///                              one. (1)
+    ///    int llvm_jit_lazy_entry  If nonzero, the entry layers of groups
+    ///                              that have them are left out of the
+    ///                              group's JIT, and each is compiled by
+    ///                              itself the first time execute_layer()
+    ///                              runs it. Layers called by other layers
+    ///                              are always compiled with the group. (0)
+    ///    int llvm_jit_group_memory  If nonzero, JIT each CPU group into
+    ///                              memory of its own, which is freed as
+    ///                              soon as the last reference to the group
+    ///                              (or to a group sharing its code) goes
+    ///                              away, rather than into memory shared by
+    ///                              all groups and only freed when the
+    ///                              shading system is. Costs a few pages
+    ///                              per group. On with "memory_budget". (0)
+    ///    int llvm_jit_huge_pages  If nonzero, place JITed code and
+    ///                              read-only data in 2MB slabs, backed by
+    ///                              huge pages where the OS allows, so that
+    ///                              shading many different groups takes
+    ///                              fewer iTLB entries. This applies to the
+    ///                              whole process, not just this shading
+    ///                              system. (0)
+    ///    int llvm_pgo           Profile-guided optimization of CPU groups.
+    ///                              1 makes the compiled code count how
+    ///                              often each function is entered and each
+    ///                              branch goes either way (recording into
+    ///                              llvm_pgo_dir when the shading system is
+    ///                              destroyed); 2 gives those counts to the
+    ///                              LLVM optimizer when an identical group
+    ///                              is compiled again, in this run or a
+    ///                              later one. Counting groups point at
+    ///                              this process's counters, so they are
+    ///                              never put in or taken from the JIT
+    ///                              cache. (0)
+    ///    string llvm_pgo_dir    Directory of the branch profiles saved or
+    ///                              used by llvm_pgo. ("")
+    ///    int llvm_layer_inline  Layers whose estimated cost (roughly, op
+    ///                              count with texture and noise weighted
+    ///                              heavier) is at most this are always
+    ///                              inlined into the layers calling them.
+    ///                              0 leaves it to LLVM. (40)
+    ///    int llvm_layer_noinline  Layers called from more than one place
+    ///                              whose estimated cost is at least this
+    ///                              are never inlined, but called. 0 leaves
+    ///                              it to LLVM. (2000)
+    ///    int llvm_shared_ops    If nonzero, shadeops library functions of
+    ///                              at least this many LLVM instructions
+    ///                              (e.g., 200) are JITed once per process
+    ///                              and target and called by every group,
+    ///                              instead of being inlined or compiled
+    ///                              into each group. (0)
+    ///    int llvm_shared_constants  Constant arrays of at least this many
+    ///                              bytes are kept once per process, shared
+    ///                              by every instance and group using the
+    ///                              same values, instead of being copied
+    ///                              into each group's JITed code. 0 turns
+    ///                              this off. Not used for OptiX or with
+    ///                              llvm_jit_cache_dir. (256)
     ///    int vector_width       Vector width to allow for SIMD ops (4).
+    ///    int batch_autoselect   For each group, a BatchFormer times this
+    ///                              many batches shaded with the batched
+    ///                              JIT and as many shaded point by point
+    ///                              with the scalar JIT, then uses
+    ///                              whichever cost less per point. 0 always
+    ///                              uses the batched JIT. (4)
+    ///    int batch_uniform_scalar  If nonzero, a batch whose lanes all
+    ///                              have identical shader globals and
+    ///                              shade index is shaded once with the
+    ///                              scalar JIT and its Ci broadcast to
+    ///                              every lane. Not done for groups with
+    ///                              renderer outputs unless an output
+    ///                              buffer is passed. (0)
+    ///    int batched_attribute_cache  If nonzero, a batched execution
+    ///                              fetches the attributes its group
+    ///                              needs with one gather call to the
+    ///                              BatchedRendererServices and answers
+    ///                              repeated getattribute calls from
+    ///                              that cache. Off by default, because
+    ///                              it assumes attributes do not change
+    ///                              during the execution. (0)
     ///    int llvm_debugging_symbols  When JITing, generate debug symbols
     ///                             that associate machine code with shader
     ///                             source and lines. (0)
     ///    int llvm_profiling_events  When JITing, generate events to enable
-    ///                             full profiling of shaders. (0)
+    ///                             full profiling of shaders, a bitfield:
+    ///                             1 = Intel JIT events for VTune,
+    ///                             2 = function names and addresses in
+    ///                             /tmp/perf-<pid>.map for Linux perf,
+    ///                             4 = jitdump files for `perf inject
+    ///                             --jit` (needs LLVM built with
+    ///                             LLVM_USE_PERF). (0)
     ///    int lockgeom           Default 'lockgeom' value for shader params
     ///                              that don't specify it (1).  Lockgeom
     ///                              means a param CANNOT be overridden by
@@ -268,6 +667,49 @@ public:
     ///                              groupdata buffer when targeting OptiX (0).
     ///                              OSL expects a pointer to a buffer when
     ///                              requirements exceed max allocation.
+    ///    int optix_wavefront    Also generate, for each group, a CUDA
+    ///                              kernel that shades a whole array of
+    ///                              points, one per thread, to launch per
+    ///                              material instead of calling the group
+    ///                              from a megakernel (0). See the group
+    ///                              attribute "group_wavefront_name".
+    ///    int device_arena_size  If nonzero, allocate the per-group device
+    ///                              data of an OptiX renderer from blocks
+    ///                              of this many bytes rather than one
+    ///                              device_alloc per group, and copy its
+    ///                              changes to the device only when the
+    ///                              renderer calls upload_device_data (0).
+    ///    int async_device_copies  Rather than copying interactive
+    ///                              parameter changes to the device as they
+    ///                              are made, keep track of the bytes that
+    ///                              changed in each group and copy just
+    ///                              those, with copy_to_device_async, when
+    ///                              the renderer calls upload_device_data
+    ///                              (0).
+    ///    int optix_split_threshold  If a group's PTX needs more than this
+    ///                              many bytes of local memory per thread,
+    ///                              generate it again with its most
+    ///                              expensive layers kept out of line,
+    ///                              until it fits (0 = never).
+    ///    int optix_host_jit        For a hybrid renderer that shades on
+    ///                              the CPU too, also JIT each group for
+    ///                              the host, from the same optimized
+    ///                              group as its PTX, so that execute()
+    ///                              can run it (0).
+    ///    string optix_target_arch  The GPU architecture (such as "sm_80")
+    ///                              to generate PTX for, if not the one OSL
+    ///                              was built for. The "shadeops_cuda_ptx"
+    ///                              attribute then gives the shadeops
+    ///                              library compiled (once) for it, to be
+    ///                              made into one module that all groups
+    ///                              link against rather than each group
+    ///                              carrying its own copy of the ops (see
+    ///                              "optix_no_inline_thresh").
+    ///    string coherence_param  The name of a shader parameter whose value
+    ///                              goes into the upper bits of each group's
+    ///                              "coherence_key" (see getattribute), so
+    ///                              that groups running the same code sort
+    ///                              further by, say, their texture ("").
     /// 3. Attributes that that are intended for developers debugging
     /// liboslexec itself:
     /// These attributes may be helpful for liboslexec developers or
@@ -281,9 +723,37 @@ public:
     ///         opt_elide_useless_ops, opt_elide_unconnected_outputs,
     ///         opt_peephole, opt_coalesce_temps, opt_assign, opt_mix
     ///         opt_merge_instances, opt_merge_instance_with_userdata,
-    ///         opt_fold_getattribute, opt_middleman, opt_texture_handle
-    ///         opt_seed_bblock_aliases, opt_groupdata
+    ///         opt_fold_getattribute, opt_fold_dict, opt_middleman,
+    ///         opt_texture_handle, opt_texture_fusion, opt_hoist_transforms,
+    ///         opt_seed_bblock_aliases, opt_groupdata, opt_groupdata_hot,
+    ///         opt_groupdata_share, opt_readonly_params, opt_sccp, opt_licm,
+    ///         opt_deriv_demand, opt_noise_memo
     ///    int opt_passes         Number of optimization passes per layer (10)
+    ///    int opt_loop_unroll    Unroll 'for' loops with a constant trip
+    ///                              count if the unrolled code has at most
+    ///                              this many ops, so that each iteration
+    ///                              can be constant folded; 0 disables
+    ///                              unrolling. (256)
+    ///    int opt_fold_memo      Remember up to this many layers without
+    ///                              incoming connections after their first
+    ///                              optimization pass, so that identical
+    ///                              layers (same shader, parameter values
+    ///                              and outgoing connections) of later
+    ///                              groups start from the result instead of
+    ///                              constant folding again. (0)
+    ///    int opt_batched_analysis_memo  Remember the batched analysis
+    ///                              (which symbols are varying, which ops
+    ///                              need masking) of up to this many
+    ///                              layers, so that a layer whose optimized
+    ///                              code and upstream varying-ness match
+    ///                              one analyzed before -- re-optimized
+    ///                              after an edit, or the same material in
+    ///                              another group -- isn't analyzed
+    ///                              again. (256)
+    ///    int opt_threads        Threads used to optimize the layers of one
+    ///                              group; layers that aren't connected to
+    ///                              each other are optimized at the same
+    ///                              time. 0 means one per core. (1)
     ///    int llvm_optimize      Which of several LLVM optimize strategies (1)
     ///    int llvm_debug         Set LLVM extra debug level (0)
     ///    int llvm_debug_layers  Extra printfs upon entering and leaving
@@ -344,6 +814,17 @@ public:
     ///                                 be elided, but nor will they be
     ///                                 called unconditionally.
     ///    int exec_repeat            How many times to run the group (1).
+    ///    string math_precision      The group's own "math_precision"
+    ///                                 (see above), if set before it's
+    ///                                 optimized.
+    ///    int gpu_registers          For OptiX, the registers per thread
+    ///                                 that the group's final GPU code
+    ///                                 uses, as the renderer learned it.
+    ///    int gpu_spill_bytes        ... and its bytes of spill stores.
+    ///    string gpu_compile_log     Set the two above from the log of the
+    ///                                 renderer's compile of the group's
+    ///                                 PTX (ptxas "Used N registers" and
+    ///                                 "N bytes spill stores" lines).
     ///
     bool attribute(ShaderGroup* group, string_view name, TypeDesc type,
                    const void* val);
@@ -394,6 +875,11 @@ public:
     ///   library build dependencies and their versions (for example,
     ///   "OIIO-2.3.0,LLVM-10.0.0,OpenEXR-2.5.0").
     ///
+    /// - `string stat:json` : The main statistics as a JSON object: the
+    ///   time spent in each phase of loading and compiling shaders, counts
+    ///   of shaders, groups and layers, and per group, the compile time
+    ///   and (with "profile" on) the number of executes and their time.
+    ///
     bool getattribute(string_view name, TypeDesc type, void* val);
 
     /// Shortcut getattribute() for retrieving a single integer.
@@ -515,7 +1001,68 @@ public:
     ///   string entry_layers[]      List of entry point layers.
     ///   string pickle              Retrieves a serialized representation
     ///                                 of the shader group declaration.
+    ///   string optimization_report  With "opt_report" on, what is left
+    ///                                 of each layer after optimization
+    ///                                 and why: layers not elided, ops not
+    ///                                 folded and the varying globals,
+    ///                                 userdata or interactive params they
+    ///                                 depend on, texture names not made
+    ///                                 handles, and the users of the
+    ///                                 derivatives still carried.
+    ///   string stat:compile_breakdown  A table of how long each phase of
+    ///                                 compiling the group took, overall
+    ///                                 and per layer.
+    ///   float[7] stat:compile_times  Seconds spent loading the .oso files,
+    ///                                 in the runtime optimizer, in its
+    ///                                 batched analysis, in LLVM setup, IR
+    ///                                 generation, optimization and JIT.
+    ///   float[] stat:layer_optimize_times  Runtime optimizer time per layer.
+    ///   float[] stat:layer_irgen_times  LLVM IR generation time per layer.
+    ///   long long[32] stat:exec_histogram  With "profile" on, the number
+    ///                                 of executes whose time in timer ticks
+    ///                                 fell in each log2 bucket [2^i,2^(i+1)).
+    ///   long long[3] stat:telemetry  With "telemetry_interval" set, the
+    ///                                 sampled shades and their texture
+    ///                                 lookups and closures.
+    ///   long long[5] stat:pmu      With "pmu_interval" set, the sampled
+    ///                                 shades and their cycles,
+    ///                                 instructions, cache misses and
+    ///                                 branch misses.
     ///   int llvm_groupdata_size    Size of the GroupData struct.
+    ///   int coherence_key          A key for sorting shading work by the
+    ///                                 group it will run, such as the hint
+    ///                                 for OptiX Shader Execution
+    ///                                 Reordering (optixReorder). The low
+    ///                                 16 bits hash the group's code (its
+    ///                                 shaders and connections), so that
+    ///                                 groups differing only in parameter
+    ///                                 values share them, and the high 16
+    ///                                 bits hash the value of the
+    ///                                 "coherence_param" parameter, if set.
+    ///                                 The place to reorder is once the hit
+    ///                                 is known and before the shading
+    ///                                 globals are set up and the group run.
+    ///   int coherence_key_bits     How many low bits of the key are worth
+    ///                                 passing as the hint: 16, or 32 with
+    ///                                 "coherence_param" set.
+    ///   int64 memory_used          Bytes of memory held for the group: its
+    ///                                 optimized and pristine layers, JITed
+    ///                                 code and data, PTX and interactive
+    ///                                 parameters.
+    ///   int64 jit_memory_used      ... of which JITed code and data.
+    ///   int ptx_registers          For OptiX, the most virtual registers
+    ///                                 any function of the group's PTX
+    ///                                 declares, an early sign of register
+    ///                                 pressure.
+    ///   int ptx_local_bytes        ... and the most local memory (stack)
+    ///                                 per thread that any of them declares.
+    ///   int gpu_registers          The registers and spill store bytes of
+    ///   int gpu_spill_bytes           the final GPU code, if the renderer
+    ///                                 set them (-1 otherwise).
+    ///   int num_device_strings     For OptiX, the number of strings whose
+    ///                                 hashes the group's PTX uses.
+    ///   ptr device_strings         Retrieves a pointer to the ustring
+    ///                                 array of them.
     ///   ptr interactive_params     Pointer to the memory block containing
     ///                                 host-side interactive parameter values
     ///                                 for this shader group.
@@ -565,7 +1112,8 @@ public:
 
 
     /// Load compiled shader (oso) from a memory buffer, overriding
-    /// shader lookups in the shader search path
+    /// shader lookups in the shader search path. Loading the same oso
+    /// again under the same name succeeds without parsing it again.
     bool LoadMemoryCompiledShader(string_view shadername, string_view buffer);
 
     // The basic sequence for declaring a shader group looks like this:
@@ -706,7 +1254,11 @@ public:
     /// This is meant to called after the ShaderGroupBegin/End, but will
     /// fail if the shader has already been irrevocably optimized/compiled,
     /// unless the particular parameter is marked as either interpolated=1
-    /// or interactive=1.
+    /// or interactive=1, or the "reparam_rebuild" attribute was set when
+    /// the group was optimized. In the latter case, any other parameter
+    /// may be changed too, making the group optimize again the next time it
+    /// executes -- unless the layer and everything downstream of it were
+    /// found to be unused -- so it must not be executing at the time.
     bool ReParameter(ShaderGroup& group, string_view layername,
                      string_view paramname, TypeDesc type, const void* val);
     // Shortcuts for param passing a single int, float, or string.
@@ -733,6 +1285,50 @@ public:
                            (const char**)&val);
     }
 
+    /// Bracket a series of ReParameter calls on the group, for edits that
+    /// change many parameters at once (switching a material preset, say).
+    /// The values change as each ReParameter is made, but the work that
+    /// follows is left until ReParameterEnd. The group, and each of its
+    /// variants, is optimized again at most once. The interactive
+    /// parameters that changed are copied to the device as one span,
+    /// rather than one copy per parameter. Pairs may nest, and only the
+    /// outermost ReParameterEnd does the work. ReParameterEnd returns
+    /// false if the group was not between a ReParameterBegin and End.
+    void ReParameterBegin(ShaderGroup& group);
+    bool ReParameterEnd(ShaderGroup& group);
+
+    /// Return a variant of a complete shader group that only needs to
+    /// produce the named renderer outputs (each either "param" or
+    /// "layer.param"), for render passes that consume fewer outputs and
+    /// AOVs than the group was declared with. Every other output is
+    /// treated as a non-renderer output, so the optimizer strips the code
+    /// that only feeds those, all the way up the connection graph. The
+    /// variant is an ordinary group that optimizes and JITs on its own the
+    /// first time it executes, and it is cached on the original group, so
+    /// asking again for the same set of outputs (in any order) returns the
+    /// same variant. ReParameter calls on the original also update its
+    /// variants. Returns an empty ref and reports an error if the group
+    /// is not yet complete, or if it has already been optimized without
+    /// the "reparam_rebuild" attribute having been set (since its
+    /// unoptimized layers are then gone).
+    ShaderGroupRef specialize_outputs(ShaderGroup& group,
+                                      cspan<ustring> outputs);
+
+    /// Return the index of the named parameter of a shader (loading the
+    /// shader if it hasn't been already), for use in a ShaderGroupDesc, or
+    /// -1 if the shader can't be found or has no such parameter. The index
+    /// stays valid for as long as the shader is loaded.
+    int find_param(string_view shadername, string_view paramname);
+
+    /// Build a complete shader group from a descriptor in one call,
+    /// equivalent to ShaderGroupBegin, the Parameter, Shader, and
+    /// ConnectShaders calls it describes, and ShaderGroupEnd, but without
+    /// looking up any parameter or layer by name. It is thread-safe and
+    /// does not disturb the "current" group. Returns an empty ref and
+    /// reports an error if a shader can't be loaded, or if a layer or
+    /// parameter index is out of range or a connection is invalid.
+    ShaderGroupRef build_shader_group(const ShaderGroupDesc& desc);
+
     // Non-threadsafe versions of Parameter, Shader, ConnectShaders, and
     // ShaderGroupEnd. These depend on some persistent state about which
     // shader group is the "current" one being amended. It's fine to use
@@ -766,6 +1362,13 @@ public:
     /// destroyed).
     PerThreadInfo* create_thread_info();
 
+    /// Create the per-thread data for a thread that runs on the given NUMA
+    /// node, keeping the memory of the shading contexts made from it (their
+    /// heaps, closure and scratch pools) on that node, so a thread on one
+    /// socket doesn't shade out of another socket's memory. Where NUMA
+    /// placement isn't supported this is the same as create_thread_info().
+    PerThreadInfo* create_thread_info(int numa_node);
+
     /// Destroy a PerThreadInfo that was allocated by
     /// create_thread_info().
     void destroy_thread_info(PerThreadInfo* threadinfo);
@@ -805,6 +1408,41 @@ public:
                  void* output_base_ptr, bool run = true);
 #endif
 
+    /// Execute the shader group in this context on each of a span of
+    /// shading points, as if by calling execute() for each in turn, with
+    /// the i-th getting shade index `shadeindex_begin + i`. The group is
+    /// bound (and optimized and JITed if need be) once rather than per
+    /// point, messages and errors are collected once at the end, and
+    /// after each point the outputs named by `outputs` are copied to their
+    /// strided destinations. This is worth it for small groups, such as
+    /// displacement or opacity, where the per-call setup of execute() is a
+    /// large part of the cost. Return true if the group ran for every
+    /// point, false if it did not (for example, if it does nothing).
+    bool execute_many(ShadingContext& ctx, ShaderGroup& group,
+                      int thread_index, int shadeindex_begin,
+                      span<ShaderGlobals> globals, void* userdata_base_ptr,
+                      void* output_base_ptr,
+                      cspan<OutputBinding> outputs = {});
+
+    /// Like execute_many(), but with the shaders' trace() calls deferred,
+    /// so that the renderer can trace the rays of all the points together
+    /// rather than one at a time from inside shading. The group is first
+    /// run on every point with trace() just noting the ray asked for (and
+    /// reporting a miss); then the renderer's trace_deferred() traces all
+    /// of them; and then the points that called trace() are run again,
+    /// each trace() being answered from those results (by the renderer's
+    /// trace_resume()). A trace() call that doesn't match the first run,
+    /// because the shader took another path once it saw a hit, is traced
+    /// on the spot. The errors and printfs of a point that is run again
+    /// come from its second run only, but other side effects (such as
+    /// pointcloud_write) happen in both. Renderers that don't support
+    /// "trace_deferred" get plain execute_many().
+    bool execute_deferred_trace(ShadingContext& ctx, ShaderGroup& group,
+                                int thread_index, int shadeindex_begin,
+                                span<ShaderGlobals> globals,
+                                void* userdata_base_ptr, void* output_base_ptr,
+                                cspan<OutputBinding> outputs = {});
+
     // DEPRECATED(2.0): no shadeindex or base pointers
     bool execute(ShadingContext& ctx, ShaderGroup& group,
                  ShaderGlobals& globals, bool run = true)
@@ -878,6 +1516,14 @@ public:
     /// execute_layer.
     bool execute_cleanup(ShadingContext& ctx);
 
+    /// Retain (or release) the closure memory of the context.  While
+    /// retained, later executions in ctx allocate closures after those of
+    /// earlier shades instead of reusing that memory, so a renderer may
+    /// hold on to closure trees (for example across a bounce) without
+    /// copying them.  Release once all retained closures are consumed;
+    /// the next execution then recycles the whole closure pool.
+    void retain_closures(ShadingContext& ctx, bool retain);
+
     /// Find the named layer within a group and return its index, or -1
     /// if no such named layer exists.
     int find_layer(const ShaderGroup& group, ustring layername) const;
@@ -992,6 +1638,77 @@ public:
     {
         return BatchedExecutor<WidthT>(*this);
     }
+
+    /// A BatchFormer gathers individual shading points, bins them by
+    /// shader group and raytype, and runs each bin through the batched
+    /// executor as soon as it holds WidthT points, so renderers that
+    /// produce points one at a time need not do their own binning and
+    /// compaction.  Points in one batch share the renderstate, tracedata
+    /// and objdata of the first of them; a point whose pointers differ
+    /// sends the pending batch of its bin off first.  Call flush() when
+    /// done to shade the partially filled batches.  Groups that turn out
+    /// to run faster with the scalar JIT are shaded point by point
+    /// instead (see the "batch_autoselect" option).  A BatchFormer, like
+    /// the ShadingContext it uses, belongs to a single thread.
+    template<int WidthT> class OSLEXECPUBLIC BatchFormer {
+    public:
+        /// Called after each batch is shaded, with the globals (including
+        /// the output closures in varying.Ci), the number of points, and
+        /// their shade indices.
+        typedef std::function<void(BatchedShaderGlobals<WidthT>& globals,
+                                   int batch_size, const int* shadeindex)>
+            ShadedCallback;
+
+        BatchFormer(ShadingSystem& ss, ShadingContext& ctx,
+                    void* userdata_base_ptr = nullptr,
+                    void* output_base_ptr   = nullptr,
+                    ShadedCallback shaded   = ShadedCallback());
+        BatchFormer(const BatchFormer&) = delete;
+        ~BatchFormer();
+
+        /// Add the point described by sg to the bin for (group,
+        /// sg.raytype), shading that bin if it becomes full.  Return
+        /// false if a batch was shaded and its execution failed.
+        bool push(ShaderGroup& group, const ShaderGlobals& sg,
+                  int shadeindex);
+
+        /// Shade every partially filled batch, so that no points remain
+        /// pending.  Return false if any execution failed.
+        bool flush();
+
+        /// The number of points pushed but not yet shaded.
+        int pending() const;
+
+    private:
+        struct Impl;
+        std::unique_ptr<Impl> m_impl;
+    };
+
+    /// Structure-of-arrays form of the output closures of a batch whose
+    /// lanes all share one closure structure.  Each component holds the
+    /// closure id, its weight (the component weight times all enclosing
+    /// mul weights) for every lane, and its parameter struct transposed
+    /// into 4-byte words, params[word * WidthT + lane], so that batched
+    /// BSDF evaluation can read a parameter for all lanes contiguously
+    /// instead of chasing a ClosureColor tree per lane.
+    template<int WidthT> struct ClosureSoA {
+        struct Component {
+            int id;
+            int param_size;            ///< Parameter struct size in bytes
+            float weight[3][WidthT];   ///< weight[channel][lane]
+            std::vector<float> params; ///< params[word * WidthT + lane]
+        };
+        int batch_size = 0;
+        std::vector<Component> components;
+    };
+
+    /// Flatten the closure trees ci[0..batch_size) into soa.  Succeeds
+    /// only when every lane yields the same sequence of closure ids once
+    /// the add and mul nodes are folded away; otherwise return false and
+    /// leave the renderer to walk the per-lane trees as usual.
+    template<int WidthT>
+    bool closures_to_soa(const ClosureColor* const* ci, int batch_size,
+                         ClosureSoA<WidthT>& soa) const;
 #endif
 
 
@@ -999,6 +1716,28 @@ public:
     ///
     std::string getstats(int level = 1) const;
 
+    /// Called with one statistic at a time: its name, its type (TypeInt,
+    /// TypeDesc::INT64 for counts and bytes, or TypeDesc::DOUBLE for
+    /// seconds) and a pointer to its value, valid only during the call.
+    typedef std::function<void(string_view name, TypeDesc type,
+                               const void* value)>
+        StatsFunc;
+
+    /// Call `func` with each of the main statistics -- groups compiled,
+    /// time spent compiling, JIT memory, executes, texture lookups,
+    /// closure memory and so on -- for a renderer feeding a metrics
+    /// system rather than parsing getstats(). The names are stable
+    /// identifiers, the same as the "stat:" attributes where one exists.
+    void enumerate_stats(const StatsFunc& func) const;
+
+    /// Have enumerate_stats(func) called every "stats_interval" seconds,
+    /// from a thread of the shading system's own, until it is destroyed or
+    /// set_stats_callback is called again. An empty `func` stops the
+    /// calls. A change of "stats_interval" takes effect from the next
+    /// call on. `func` may itself call set_stats_callback, for instance
+    /// to stop the calls.
+    void set_stats_callback(StatsFunc func);
+
     void register_closure(string_view name, int id, const ClosureParam* params,
                           PrepareClosureFunc prepare, SetupClosureFunc setup);
 
@@ -1065,6 +1804,118 @@ public:
     /// specified number of threads (0 means use all available HW cores).
     void optimize_all_groups(int nthreads = 0, bool do_jit = true);
 
+    /// With option "llvm_jit_tiered", block until the background threads
+    /// have swapped in the fully optimized code of every group queued for
+    /// them so far, e.g. before timing a render.
+    void wait_for_background_jit();
+
+    /// Runs task(0) through task(ntasks-1), in any order and on any
+    /// threads, returning only when all of them are done.
+    typedef std::function<void(int ntasks,
+                               const std::function<void(int)>& task)>
+        TaskExecutor;
+
+    /// Have all the parallel compile work -- optimize_all_groups,
+    /// BatchedExecutor::jit_all_groups, ptx_compile_groups, the split
+    /// codegen of "llvm_jit_threads" and texture prefetch -- run its tasks through the renderer's own scheduler
+    /// (a TBB arena, say) rather than on threads OSL creates, so that it
+    /// honors the renderer's priorities and doesn't oversubscribe the
+    /// machine. The tasks of one call may block each other only through
+    /// the locks of the groups they compile, so the executor may run them
+    /// with any amount of concurrency, including serially on the calling
+    /// thread. An empty executor restores OSL's own threads.
+    void set_task_executor(TaskExecutor executor);
+
+    /// Called by ptx_compile_groups as soon as the PTX of groups[index] is
+    /// ready, from whichever thread generated it.
+    typedef std::function<void(size_t index, const std::string& ptx)>
+        PTXReadyFunc;
+
+    /// For an OptiX renderer (option "use_optix"), optimize and generate
+    /// the PTX of all the given groups, using up to nthreads threads (0
+    /// means one per core), and return the PTX of each, in the order of
+    /// `groups`. The PTX of a group that failed to compile is empty. If
+    /// `ready` is given, it is also called with each group's PTX as soon
+    /// as it is done, so that the renderer can create its module while
+    /// other groups are still being compiled; it must be thread-safe.
+    std::vector<std::string>
+    ptx_compile_groups(cspan<ShaderGroupRef> groups, int nthreads = 0,
+                       const PTXReadyFunc& ready = PTXReadyFunc());
+
+    /// For an OptiX renderer, make the minimal perfect hash table (see
+    /// OSL/stringtable.h) of every string that the PTX of the given
+    /// (compiled) groups uses, plus the `extra` strings the renderer's
+    /// own device code dispatches on, and return its number of buckets.
+    /// Once `seeds` and `keys` are copied to the device, the renderer can
+    /// turn any string hash its shaders pass it into a table index, or -1,
+    /// with StringTable::index().
+    uint32_t make_string_table(cspan<ShaderGroupRef> groups,
+                               cspan<ustring> extra,
+                               std::vector<int32_t>& seeds,
+                               std::vector<uint64_t>& keys);
+
+    /// Shade a grid of npoints points with the group on the GPU, as a
+    /// plain CUDA kernel with no OptiX pipeline or SBT, for renderers
+    /// that just need patterns evaluated (baking, compositing). Requires
+    /// the "use_optix" and "optix_wavefront" options; the group is
+    /// optimized and compiled first if it hasn't been, and its wavefront
+    /// kernel is launched through RendererServices::launch_device_kernel.
+    /// The pointers are all device memory: npoints ShaderGlobals, the
+    /// groupdata of each point (unless it fits in
+    /// "max_optix_groupdata_alloc"), and the userdata and output arrays
+    /// addressed by the symlocs. Returns false (with an error) if the
+    /// kernel could not be launched.
+    bool shade_grid_device(ShaderGroup& group, int npoints, void* sg,
+                           void* groupdata, void* userdata_base,
+                           void* output_base, void* stream = nullptr);
+
+    /// Called by device_program to compile PTX to a program (such as a
+    /// cubin) for one GPU architecture, returning it, or an empty string
+    /// on failure.
+    typedef std::function<std::string(const std::string& ptx,
+                                      string_view arch)>
+        DeviceCompileFunc;
+
+    /// For a renderer using several GPUs, return the group's program for
+    /// the GPU architecture `arch` (such as "sm_86"). The group's PTX is
+    /// generated once for all devices, and `compile` is called only for
+    /// the first request of each unique (PTX, arch) pair: requests for
+    /// other devices of the same architecture, or for groups with the
+    /// same PTX, get the same program, waiting for it if another thread
+    /// is compiling it. Returns nullptr if the group has no PTX or the
+    /// compile failed.
+    std::shared_ptr<const std::string>
+    device_program(ShaderGroup& group, string_view arch,
+                   const DeviceCompileFunc& compile);
+
+    /// Pack the code of every loaded shader into a compact form, until a
+    /// new instance of the shader next needs it, and return the number of
+    /// bytes this saved. Optimized groups don't use their shaders' code,
+    /// so a long-running process can call this once its groups are
+    /// optimized, to shrink its footprint. It is always safe to call.
+    size_t compact_shader_code();
+
+    /// If the "memory_budget" option is set and the shading system holds
+    /// more memory than that, evict the optimized layers and JITed code of
+    /// the groups that have run least recently, until it is back within
+    /// budget, and return the number of bytes this freed. An evicted group
+    /// is optimized and JITed again, transparently, the next time it runs.
+    /// Only groups that have not run since the previous call are evicted.
+    /// No group may be executing during the call, just as for ReParameter.
+    size_t enforce_memory_budget();
+
+    /// With the "device_arena_size" or "async_device_copies" options, copy
+    /// the per-group device data (such as interactive parameters) set or
+    /// changed since the last call to the device, in one copy per arena
+    /// block or changed group, and return the number of bytes copied. An
+    /// OptiX renderer using the options calls this once per frame, before
+    /// launching. The copies are made with
+    /// RendererServices::copy_to_device_async on `stream`, from host
+    /// memory kept unchanged until the next call, so the renderer must
+    /// have synchronized with the stream by then. Without the options,
+    /// device data is copied as it changes, and this does nothing.
+    size_t upload_device_data(void* stream = nullptr);
+
     /// Return a pointer to the TextureSystem being used.
     TextureSystem* texturesys() const;
 
@@ -1072,12 +1923,30 @@ public:
     RendererServices* renderer() const;
 
     /// Archive the entire shader group so that it can be reconstituted
-    /// later.
+    /// later. An ".oslbundle" filename instead writes just the group's
+    /// shaders, as a bundle (see write_shader_bundle).
     bool archive_shadergroup(ShaderGroup& group, string_view filename);
 
     // DEPRECATED(2.0)
     bool archive_shadergroup(ShaderGroup* group, string_view filename);
 
+    /// Write a shader bundle: the compiled code of many shaders in one
+    /// file, indexed by shader name. Each of the shadernames is found
+    /// along searchpath:shader, or may be the path of its .oso file.
+    /// Mounting bundles with the "searchpath:bundle" attribute lets shaders
+    /// be loaded without searching the file system for them. Return true
+    /// on success, false (with an error reported) on failure.
+    bool write_shader_bundle(string_view filename,
+                             cspan<std::string> shadernames);
+
+    /// Share optimized groups and JITed code with the other ShadingSystems
+    /// attached to the same registry (see ShaderRegistry), or with none if
+    /// registry is null. Attach it before any groups are compiled.
+    void attach_registry(std::shared_ptr<ShaderRegistry> registry);
+
+    /// The registry attached by attach_registry(), if any.
+    std::shared_ptr<ShaderRegistry> registry() const;
+
     /// Construct and return an OSLQuery initialized with an existing
     /// ShaderGroup. For a shader group already loaded by the ShadingSystem,
     /// this is much less expensive than constructing an OSLQuery by reading
@@ -1129,6 +1998,33 @@ private:
 
 
 
+/// Compile the XML dictionary `xml` (a filename or xml text, just as for
+/// dict_find) into a binary dictionary file `odictfile`, by convention
+/// named with an ".odict" extension. Given such a file, dict_find reads it
+/// directly in place, with its values already parsed and the nodes for
+/// every absolute element path ("/a/b/c") and element name ("//c")
+/// indexed. Return true on success, or false and set `errmessage`.
+OSLEXECPUBLIC
+bool
+compile_dictionary(string_view xml, string_view odictfile,
+                   std::string& errmessage);
+
+
+
+/// Convert the point cloud file `infile` (any format Partio reads) into
+/// an OSL point cloud file `opcfile`, by convention named with an ".opc"
+/// extension, as is also written by pointcloud_write to such a name.  Such
+/// files are memory mapped, with a prebuilt spatial index that searches
+/// use in place and each attribute stored separately, so that only the
+/// attributes that pointcloud_get reads are paged in.  Return true on
+/// success, or false and set `errmessage`.
+OSLEXECPUBLIC
+bool
+compile_pointcloud(string_view infile, string_view opcfile,
+                   std::string& errmessage);
+
+
+
 #ifdef OPENIMAGEIO_IMAGEBUFALGO_H
 // To keep from polluting all OSL clients with ImageBuf & ROI, only expose
 // the following declarations if they have included OpenImageIO/imagebufalgo.h.
@@ -1167,6 +2063,27 @@ shade_image(ShadingSystem& shadingsys, ShaderGroup& group,
             ShadeImageLocations shadelocations = ShadePixelCenters,
             OIIO::ROI roi = OIIO::ROI(), OIIO::paropt popt = 0);
 
+/// The same, but if batch_width is 4, 8, or 16, shade that many pixels of
+/// a scanline at a time with the batched JIT. The shading system must
+/// already be configured for batched execution at that width (see
+/// configure_batch_execution_at()), and the renderer must provide
+/// BatchedRendererServices of that width. Otherwise (or when batched
+/// execution isn't built), this is the same as above.
+///
+/// For either version, outputs that have a SymArena::Outputs symloc (see
+/// add_symlocs()) are written by the shader straight into the pixels of
+/// buf, instead of being copied there after each shade: the arena base is
+/// buf.localpixels() and the shadeindex is the pixel's index within buf's
+/// data window, so such a symloc's offset is its first channel times
+/// sizeof(float) and its stride is the pixel size. That needs buf to have
+/// local, packed pixels.
+OSLEXECPUBLIC
+bool
+shade_image(ShadingSystem& shadingsys, ShaderGroup& group,
+            const ShaderGlobals* defaultsg, OIIO::ImageBuf& buf,
+            cspan<ustring> outputs, ShadeImageLocations shadelocations,
+            OIIO::ROI roi, OIIO::paropt popt, int batch_width);
+
 #endif
 
 
@@ -180,6 +180,46 @@ bjfinal(const vint4& a_, const vint4& b_, const vint4& c_)
 }
 #endif
 
+// When built for AVX2 (or better), perlin noise hashes and takes the
+// gradients of all 8 corners of a 3D lattice cell at once, and of a 4D
+// cell in two sets of 8, rather than in sets of 4.
+#if !defined(__CUDA_ARCH__) && OIIO_SIMD_AVX >= 2
+#    define OSL_NOISE_SIMD8 1
+#else
+#    define OSL_NOISE_SIMD8 0
+#endif
+
+#if OSL_NOISE_SIMD8
+// Perform a bjmix (see OpenImageIO/hash.h) on 8 sets of values at once.
+OSL_FORCEINLINE void
+bjmix(vint8& a, vint8& b, vint8& c)
+{
+    using OIIO::simd::rotl;
+    a -= c;  a ^= rotl(c, 4);  c += b;
+    b -= a;  b ^= rotl(a, 6);  a += c;
+    c -= b;  c ^= rotl(b, 8);  b += a;
+    a -= c;  a ^= rotl(c,16);  c += b;
+    b -= a;  b ^= rotl(a,19);  a += c;
+    c -= b;  c ^= rotl(b, 4);  b += a;
+}
+
+// Perform a bjfinal (see OpenImageIO/hash.h) on 8 sets of values at once.
+OSL_FORCEINLINE vint8
+bjfinal(const vint8& a_, const vint8& b_, const vint8& c_)
+{
+    using OIIO::simd::rotl;
+    vint8 a(a_), b(b_), c(c_);
+    c ^= b; c -= rotl(b,14);
+    a ^= c; a -= rotl(c,11);
+    b ^= a; b -= rotl(a,25);
+    c ^= b; c -= rotl(b,16);
+    a ^= c; a -= rotl(c,4);
+    b ^= a; b -= rotl(a,14);
+    c ^= b; c -= rotl(b,24);
+    return c;
+}
+#endif
+
 #ifndef __OSL_USE_REFERENCE_INT_HASH
 	// Warning the reference hash may cause incorrect results when
 	// used inside a SIMD loop due to its complexity
@@ -329,6 +369,94 @@ inthash_simd (const vint4& key_x, const vint4& key_y, const vint4& key_z, const
 }
 #endif
 
+#if OSL_NOISE_SIMD8
+// Do eight 3D hashes simultaneously.
+inline vint8
+inthash_simd (const vint8& key_x, const vint8& key_y, const vint8& key_z)
+{
+    const int len = 3;
+    const int seed_ = (0xdeadbeef + (len << 2) + 13);
+    const vint8 seed (seed_);
+    vint8 a = seed+key_x, b = seed+key_y, c = seed+key_z;
+    return bjfinal (a, b, c);
+}
+
+// Do eight 4D hashes simultaneously.
+inline vint8
+inthash_simd (const vint8& key_x, const vint8& key_y, const vint8& key_z, const vint8& key_w)
+{
+    const int len = 4;
+    const int seed_ = (0xdeadbeef + (len << 2) + 13);
+    const vint8 seed (seed_);
+    vint8 a = seed+key_x, b = seed+key_y, c = seed+key_z;
+    bjmix (a, b, c);
+    a += key_w;
+    return bjfinal(a, b, c);
+}
+#endif
+
+
+// PCG-style lattice hashes (pcg3d/pcg4d from Jarzynski & Olano, "Hash
+// Functions for GPU Rendering", JCGT 2020).  A handful of multiplies, adds
+// and xors with a single constant shift and no table lookups, so the same
+// code runs well on GPUs and SIMD lanes.  Templated so one definition
+// covers unsigned int, vint4 and vint8; only the x channel is returned.
+OSL_FORCEINLINE OSL_HOSTDEVICE unsigned int
+pcg_xorshift16 (unsigned int v)
+{
+    return v ^ (v >> 16);
+}
+
+#ifndef __CUDA_ARCH__
+OSL_FORCEINLINE vint4
+pcg_xorshift16 (const vint4& v)
+{
+    return v ^ srl(v, 16);
+}
+#endif
+
+#if OSL_NOISE_SIMD8
+OSL_FORCEINLINE vint8
+pcg_xorshift16 (const vint8& v)
+{
+    return v ^ srl(v, 16);
+}
+#endif
+
+template<typename I>
+OSL_FORCEINLINE OSL_HOSTDEVICE I
+pcg3d_hash (I x, I y, I z)
+{
+    x = x * I(1664525) + I(1013904223);
+    y = y * I(1664525) + I(1013904223);
+    z = z * I(1664525) + I(1013904223);
+    x += y * z;
+    y += z * x;
+    z += x * y;
+    x = pcg_xorshift16(x);
+    y = pcg_xorshift16(y);
+    z = pcg_xorshift16(z);
+    return x + y * z;
+}
+
+template<typename I>
+OSL_FORCEINLINE OSL_HOSTDEVICE I
+pcg4d_hash (I x, I y, I z, I w)
+{
+    x = x * I(1664525) + I(1013904223);
+    y = y * I(1664525) + I(1013904223);
+    z = z * I(1664525) + I(1013904223);
+    w = w * I(1664525) + I(1013904223);
+    x += y * w;
+    y += z * x;
+    z += x * y;
+    w += y * z;
+    x = pcg_xorshift16(x);
+    y = pcg_xorshift16(y);
+    w = pcg_xorshift16(w);
+    return x + y * w;
+}
+
 
 // Cell and Hash noise only differ in how they transform their inputs from
 // float to unsigned int for use in the inthash function.
@@ -698,6 +826,15 @@ OSL_FORCEINLINE Dual2<vfloat4> select (const vint4& b, const Dual2<vfloat4>& t,
 }
 #endif
 
+#if OSL_NOISE_SIMD8
+OSL_FORCEINLINE Dual2<vfloat8>
+select (const vbool8& b, const Dual2<vfloat8>& t, const Dual2<vfloat8>& f) {
+    return Dual2<vfloat8>(blend (f.val(), t.val(), b),
+                          blend (f.dx(),  t.dx(),  b),
+                          blend (f.dy(),  t.dy(),  b));
+}
+#endif
+
 
 
 // Define negate_if(value,bool) that will work for both scalars and vectors,
@@ -775,6 +912,20 @@ OSL_FORCEINLINE Dual2<vfloat4> negate_if (const Dual2<vfloat4>& val, const vint4
 }
 #endif
 
+#if OSL_NOISE_SIMD8
+OSL_FORCEINLINE vfloat8 negate_if (const vfloat8& val, const vint8& b) {
+    vint8 highbit (0x80000000);
+    return bitcast_to_float (bitcast_to_int(val) ^ (blend0 (highbit, b != vint8::Zero())));
+}
+
+OSL_FORCEINLINE Dual2<vfloat8> negate_if (const Dual2<vfloat8>& val, const vint8& b)
+{
+    return Dual2<vfloat8> (negate_if(val.val(), b),
+                           negate_if(val.dx(),  b),
+                           negate_if(val.dy(),  b));
+}
+#endif
+
 
 #ifndef __CUDA_ARCH__
 // Define shuffle<> template that works with Dual2<vfloat4> analogously to
@@ -866,6 +1017,14 @@ inline vint4 imod(const vint4& a, int b) {
 }
 #endif
 
+#if OSL_NOISE_SIMD8
+// imod eight values at once
+inline vint8 imod(const vint8& a, int b) {
+    vint8 c = a % b;
+    return c + select(c < 0, vint8(b), vint8::Zero());
+}
+#endif
+
 // floorfrac return ifloor as well as the fractional remainder
 // FIXME: already implemented inside OIIO but can't easily override it for duals
 //        inside a different namespace
@@ -1090,6 +1249,18 @@ struct HashScalar {
     }
 #endif
 
+#if OSL_NOISE_SIMD8
+    // 8 3D hashes at once
+    OSL_FORCEINLINE vint8 operator() (const vint8& x, const vint8& y, const vint8& z) const {
+        return inthash_simd (x, y, z);
+    }
+
+    // 8 4D hashes at once
+    OSL_FORCEINLINE vint8 operator() (const vint8& x, const vint8& y, const vint8& z, const vint8& w) const {
+        return inthash_simd (x, y, z, w);
+    }
+#endif
+
 };
 
 
@@ -1155,6 +1326,115 @@ struct HashVector {
 };
 
 
+// Drop-in replacements for HashScalar/HashVector that use the PCG-style
+// hashes rather than Bob Jenkins' inthash.  Lower dimensional lattices
+// pad out the pcg3d key with zeros.
+struct HashScalarPCG {
+
+    OSL_FORCEINLINE OSL_HOSTDEVICE int operator() (int x) const {
+        return static_cast<int>(pcg3d_hash(static_cast<unsigned int>(x),
+                                           0u, 0u));
+    }
+
+    OSL_FORCEINLINE OSL_HOSTDEVICE int operator() (int x, int y) const {
+        return static_cast<int>(pcg3d_hash(static_cast<unsigned int>(x),
+                                           static_cast<unsigned int>(y),
+                                           0u));
+    }
+
+    OSL_FORCEINLINE OSL_HOSTDEVICE int operator() (int x, int y, int z) const {
+        return static_cast<int>(pcg3d_hash(static_cast<unsigned int>(x),
+                                           static_cast<unsigned int>(y),
+                                           static_cast<unsigned int>(z)));
+    }
+
+    OSL_FORCEINLINE OSL_HOSTDEVICE int operator() (int x, int y, int z, int w) const {
+        return static_cast<int>(pcg4d_hash(static_cast<unsigned int>(x),
+                                           static_cast<unsigned int>(y),
+                                           static_cast<unsigned int>(z),
+                                           static_cast<unsigned int>(w)));
+    }
+
+#ifndef __CUDA_ARCH__
+    // 4 2D hashes at once!
+    OSL_FORCEINLINE vint4 operator() (const vint4& x, const vint4& y) const {
+        return pcg3d_hash(x, y, vint4::Zero());
+    }
+
+    // 4 3D hashes at once!
+    OSL_FORCEINLINE vint4 operator() (const vint4& x, const vint4& y, const vint4& z) const {
+        return pcg3d_hash(x, y, z);
+    }
+
+    // 4 4D hashes at once!
+    OSL_FORCEINLINE vint4 operator() (const vint4& x, const vint4& y, const vint4& z, const vint4& w) const {
+        return pcg4d_hash(x, y, z, w);
+    }
+#endif
+
+#if OSL_NOISE_SIMD8
+    // 8 3D hashes at once
+    OSL_FORCEINLINE vint8 operator() (const vint8& x, const vint8& y, const vint8& z) const {
+        return pcg3d_hash(x, y, z);
+    }
+
+    // 8 4D hashes at once
+    OSL_FORCEINLINE vint8 operator() (const vint8& x, const vint8& y, const vint8& z, const vint8& w) const {
+        return pcg4d_hash(x, y, z, w);
+    }
+#endif
+
+};
+
+
+struct HashVectorPCG {
+    static OSL_FORCEINLINE OSL_HOSTDEVICE HashScalarPCG convertToScalar() { return HashScalarPCG(); }
+
+    OSL_FORCEINLINE OSL_HOSTDEVICE Vec3i operator() (int x) const {
+        return sliceup(HashScalarPCG()(x));
+    }
+
+    OSL_FORCEINLINE OSL_HOSTDEVICE Vec3i operator() (int x, int y) const {
+        return sliceup(HashScalarPCG()(x, y));
+    }
+
+    OSL_FORCEINLINE OSL_HOSTDEVICE Vec3i operator() (int x, int y, int z) const {
+        return sliceup(HashScalarPCG()(x, y, z));
+    }
+
+    OSL_FORCEINLINE OSL_HOSTDEVICE Vec3i operator() (int x, int y, int z, int w) const {
+        return sliceup(HashScalarPCG()(x, y, z, w));
+    }
+
+#ifndef __CUDA_ARCH__
+    // Vector hash of 4 2D points at once
+    OSL_FORCEINLINE void operator() (vint4 *result, const vint4& x, const vint4& y) const {
+        vint4 h = HashScalarPCG()(x, y);
+        result[0] = (h        ) & 0xFF;
+        result[1] = (srl(h,8 )) & 0xFF;
+        result[2] = (srl(h,16)) & 0xFF;
+    }
+
+    // Vector hash of 4 3D points at once
+    OSL_FORCEINLINE void operator() (vint4 *result, const vint4& x, const vint4& y, const vint4& z) const {
+        vint4 h = HashScalarPCG()(x, y, z);
+        result[0] = (h        ) & 0xFF;
+        result[1] = (srl(h,8 )) & 0xFF;
+        result[2] = (srl(h,16)) & 0xFF;
+    }
+
+    // Vector hash of 4 4D points at once
+    OSL_FORCEINLINE void operator() (vint4 *result, const vint4& x, const vint4& y, const vint4& z, const vint4& w) const {
+        vint4 h = HashScalarPCG()(x, y, z, w);
+        result[0] = (h        ) & 0xFF;
+        result[1] = (srl(h,8 )) & 0xFF;
+        result[2] = (srl(h,16)) & 0xFF;
+    }
+#endif
+
+};
+
+
 struct HashScalarPeriodic {
 private:
     friend struct HashVectorPeriodic;
@@ -1228,6 +1508,18 @@ public:
     }
 #endif
 
+#if OSL_NOISE_SIMD8
+    // 8 3D hashes at once
+    vint8 operator() (const vint8& x, const vint8& y, const vint8& z) const {
+        return inthash_simd (imod(x,m_px), imod(y,m_py), imod(z,m_pz));
+    }
+
+    // 8 4D hashes at once
+    vint8 operator() (const vint8& x, const vint8& y, const vint8& z, const vint8& w) const {
+        return inthash_simd (imod(x,m_px), imod(y,m_py), imod(z,m_pz), imod(w,m_pw));
+    }
+#endif
+
 };
 
 struct HashVectorPeriodic {
@@ -1383,6 +1675,25 @@ OSL_FORCEINLINE OSL_HOSTDEVICE void perlin (float &result, const H &hash,
 #if OIIO_SIMD
     if (CGPolicyT::allowSIMD)
     {
+#if OSL_NOISE_SIMD8
+    int X; float fx = floorfrac(x, &X);
+    int Y; float fy = floorfrac(y, &Y);
+    int Z; float fz = floorfrac(z, &Z);
+    vfloat4 uvw = fade (vfloat4(fx, fy, fz));
+
+    // Compute the hashes and gradients at all 8 lattice corners at once
+    vint8 cornerx = X + vint8(0,1,0,1,0,1,0,1);
+    vint8 cornery = Y + vint8(0,0,1,1,0,0,1,1);
+    vint8 cornerz = Z + vint8(0,0,0,0,1,1,1,1);
+    vint8 corner_hash = hash (cornerx, cornery, cornerz);
+
+    vfloat8 remainderx = fx - vfloat8(0,1,0,1,0,1,0,1);
+    vfloat8 remaindery = fy - vfloat8(0,0,1,1,0,0,1,1);
+    vfloat8 remainderz = fz - vfloat8(0,0,0,0,1,1,1,1);
+    vfloat8 corner_grad = grad (corner_hash, remainderx, remaindery, remainderz);
+
+    result = scale3 (trilerp (corner_grad.lo(), corner_grad.hi(), uvw));
+#else
 #if 0
     // You'd think it would be faster to do the floorfrac in parallel, but
     // according to my timings, it is not. I don't understand exactly why.
@@ -1428,6 +1739,7 @@ OSL_FORCEINLINE OSL_HOSTDEVICE void perlin (float &result, const H &hash,
     vfloat4 corner_grad_z1 = grad (corner_hash_z1, remainderx, remaindery, remainderz-vfloat4::One());
 
     result = scale3 (trilerp (corner_grad_z0, corner_grad_z1, uvw));
+#endif
     } else
 #endif
     {
@@ -1460,7 +1772,33 @@ OSL_FORCEINLINE OSL_HOSTDEVICE void perlin (float &result, const H &hash,
 #if OIIO_SIMD
     if (CGPolicyT::allowSIMD)
     {
-
+#if OSL_NOISE_SIMD8
+    int X; float fx = floorfrac(x, &X);
+    int Y; float fy = floorfrac(y, &Y);
+    int Z; float fz = floorfrac(z, &Z);
+    int W; float fw = floorfrac(w, &W);
+    vfloat4 uvts = fade (vfloat4(fx, fy, fz, fw));
+
+    // Compute the hashes and gradients at the 16 lattice corners in two
+    // sets of 8, one for each w.
+    vint8 cornerx = X + vint8(0,1,0,1,0,1,0,1);
+    vint8 cornery = Y + vint8(0,0,1,1,0,0,1,1);
+    vint8 cornerz = Z + vint8(0,0,0,0,1,1,1,1);
+    vint8 cornerw (W);
+    vint8 corner_hash_w0 = hash (cornerx, cornery, cornerz, cornerw);
+    vint8 corner_hash_w1 = hash (cornerx, cornery, cornerz, cornerw+vint8::One());
+
+    vfloat8 remainderx = fx - vfloat8(0,1,0,1,0,1,0,1);
+    vfloat8 remaindery = fy - vfloat8(0,0,1,1,0,0,1,1);
+    vfloat8 remainderz = fz - vfloat8(0,0,0,0,1,1,1,1);
+    vfloat8 remainderw (fw);
+    vfloat8 corner_grad_w0 = grad (corner_hash_w0, remainderx, remaindery, remainderz, remainderw);
+    vfloat8 corner_grad_w1 = grad (corner_hash_w1, remainderx, remaindery, remainderz, remainderw-vfloat8::One());
+
+    result = scale4 (OIIO::lerp (trilerp (corner_grad_w0.lo(), corner_grad_w0.hi(), uvts),
+                                 trilerp (corner_grad_w1.lo(), corner_grad_w1.hi(), uvts),
+                                 OIIO::simd::extract<3>(uvts)));
+#else
     vint4 XYZW;
     vfloat4 fxyzw = floorfrac (vfloat4(x,y,z,w), &XYZW);
     vfloat4 uvts = fade (fxyzw);
@@ -1499,6 +1837,7 @@ OSL_FORCEINLINE OSL_HOSTDEVICE void perlin (float &result, const H &hash,
     result = scale4 (OIIO::lerp (trilerp (corner_grad_z0, corner_grad_z1, uvts),
                                  trilerp (corner_grad_z2, corner_grad_z3, uvts),
                                  OIIO::simd::extract<3>(uvts)));
+#endif
     } else
 #endif
     {
@@ -1597,6 +1936,20 @@ OSL_FORCEINLINE OSL_HOSTDEVICE void perlin (Dual2<float> &result, const H &hash,
                         vfloat4(fx.dy(), fy.dy(), fz.dy()));
     Dual2<vfloat4> uvw = fade (fxyz);
 
+#if OSL_NOISE_SIMD8
+    // Compute the hashes and gradients at all 8 lattice corners at once
+    vint8 cornerx = X + vint8(0,1,0,1,0,1,0,1);
+    vint8 cornery = Y + vint8(0,0,1,1,0,0,1,1);
+    vint8 cornerz = Z + vint8(0,0,0,0,1,1,1,1);
+    vint8 corner_hash = hash (cornerx, cornery, cornerz);
+
+    Dual2<vfloat8> remainderx (fx.val() - vfloat8(0,1,0,1,0,1,0,1), vfloat8(fx.dx()), vfloat8(fx.dy()));
+    Dual2<vfloat8> remaindery (fy.val() - vfloat8(0,0,1,1,0,0,1,1), vfloat8(fy.dx()), vfloat8(fy.dy()));
+    Dual2<vfloat8> remainderz (fz.val() - vfloat8(0,0,0,0,1,1,1,1), vfloat8(fz.dx()), vfloat8(fz.dy()));
+    Dual2<vfloat8> corner_grad = grad (corner_hash, remainderx, remaindery, remainderz);
+    Dual2<vfloat4> corner_grad_z0 (corner_grad.val().lo(), corner_grad.dx().lo(), corner_grad.dy().lo());
+    Dual2<vfloat4> corner_grad_z1 (corner_grad.val().hi(), corner_grad.dx().hi(), corner_grad.dy().hi());
+#else
     // We parallelize primarily by computing the hashes and gradients at the
     // integer lattice corners simultaneously. We need 8 total (for 3D), so
     // we do two sets of 4. (Future opportunity to do all 8 simultaneously
@@ -1617,6 +1970,7 @@ OSL_FORCEINLINE OSL_HOSTDEVICE void perlin (Dual2<float> &result, const H &hash,
 
     Dual2<vfloat4> corner_grad_z0 = grad (corner_hash_z0, remainderx, remaindery, remainderz);
     Dual2<vfloat4> corner_grad_z1 = grad (corner_hash_z1, remainderx, remaindery, remainderz-vfloat4::One());
+#endif
 
     // Interpolate along the z axis first
     Dual2<vfloat4> xy = OIIO::lerp (corner_grad_z0, corner_grad_z1, shuffle<2>(uvw));
@@ -1664,6 +2018,27 @@ OSL_FORCEINLINE OSL_HOSTDEVICE void perlin (Dual2<float> &result, const H &hash,
                          vfloat4(fx.dy (), fy.dy (), fz.dy (), fw.dy ()));
     Dual2<vfloat4> uvts = fade (fxyzw);
 
+#if OSL_NOISE_SIMD8
+    // Compute the hashes and gradients at the 16 lattice corners in two
+    // sets of 8, one for each w.
+    vint8 cornerx = X + vint8(0,1,0,1,0,1,0,1);
+    vint8 cornery = Y + vint8(0,0,1,1,0,0,1,1);
+    vint8 cornerz = Z + vint8(0,0,0,0,1,1,1,1);
+    vint8 cornerw (W);
+    vint8 corner_hash_w0 = hash (cornerx, cornery, cornerz, cornerw);
+    vint8 corner_hash_w1 = hash (cornerx, cornery, cornerz, cornerw+vint8::One());
+
+    Dual2<vfloat8> remainderx (fx.val() - vfloat8(0,1,0,1,0,1,0,1), vfloat8(fx.dx()), vfloat8(fx.dy()));
+    Dual2<vfloat8> remaindery (fy.val() - vfloat8(0,0,1,1,0,0,1,1), vfloat8(fy.dx()), vfloat8(fy.dy()));
+    Dual2<vfloat8> remainderz (fz.val() - vfloat8(0,0,0,0,1,1,1,1), vfloat8(fz.dx()), vfloat8(fz.dy()));
+    Dual2<vfloat8> remainderw (vfloat8(fw.val()), vfloat8(fw.dx()), vfloat8(fw.dy()));
+    Dual2<vfloat8> corner_grad_w0 = grad (corner_hash_w0, remainderx, remaindery, remainderz, remainderw);
+    Dual2<vfloat8> corner_grad_w1 = grad (corner_hash_w1, remainderx, remaindery, remainderz, remainderw-vfloat8::One());
+    Dual2<vfloat4> corner_grad_z0 (corner_grad_w0.val().lo(), corner_grad_w0.dx().lo(), corner_grad_w0.dy().lo());
+    Dual2<vfloat4> corner_grad_z1 (corner_grad_w0.val().hi(), corner_grad_w0.dx().hi(), corner_grad_w0.dy().hi());
+    Dual2<vfloat4> corner_grad_z2 (corner_grad_w1.val().lo(), corner_grad_w1.dx().lo(), corner_grad_w1.dy().lo());
+    Dual2<vfloat4> corner_grad_z3 (corner_grad_w1.val().hi(), corner_grad_w1.dx().hi(), corner_grad_w1.dy().hi());
+#else
     // We parallelize primarily by computing the hashes and gradients at the
     // integer lattice corners simultaneously. We need 8 total (for 3D), so
     // we do two sets of 4. (Future opportunity to do all 8 simultaneously
@@ -1694,6 +2069,7 @@ OSL_FORCEINLINE OSL_HOSTDEVICE void perlin (Dual2<float> &result, const H &hash,
     Dual2<vfloat4> corner_grad_z1 = grad (corner_hash_z1, remainderx, remaindery, remainderz1, remainderw);
     Dual2<vfloat4> corner_grad_z2 = grad (corner_hash_z2, remainderx, remaindery, remainderz,  remainderw1);
     Dual2<vfloat4> corner_grad_z3 = grad (corner_hash_z3, remainderx, remaindery, remainderz1, remainderw1);
+#endif
 
     // Interpolate along the w axis first
     Dual2<vfloat4> xyz0 = OIIO::lerp (corner_grad_z0, corner_grad_z2, shuffle<3>(uvts));
@@ -2281,61 +2657,62 @@ OSL_FORCEINLINE OSL_HOSTDEVICE void perlin (Dual2<Vec3> &result, const H &hash,
 
 
 
-template<typename CGPolicyT = CGDefault>
+template<typename CGPolicyT = CGDefault, typename HashScalarT = HashScalar,
+         typename HashVectorT = HashVector>
 struct NoiseImpl {
 	OSL_FORCEINLINE OSL_HOSTDEVICE NoiseImpl () { }
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (float &result, float x) const {
-        HashScalar h;
+        HashScalarT h;
         float perlin_result;
         perlin<CGPolicyT>(perlin_result, h, x);
         result = 0.5f * (perlin_result + 1.0f);
     }
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (float &result, float x, float y) const {
-        HashScalar h;
+        HashScalarT h;
         float perlin_result;
         perlin<CGPolicyT>(perlin_result, h, x, y);
         result = 0.5f * (perlin_result + 1.0f);
     }
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (float &result, const Vec3 &p) const {
-        HashScalar h;
+        HashScalarT h;
         float perlin_result;
         perlin<CGPolicyT>(perlin_result, h, p.x, p.y, p.z);
         result = 0.5f * (perlin_result + 1.0f);
     }
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (float &result, const Vec3 &p, float t) const {
-        HashScalar h;
+        HashScalarT h;
         float perlin_result;
         perlin<CGPolicyT>(perlin_result, h, p.x, p.y, p.z, t);
         result = 0.5f * (perlin_result + 1.0f);
     }
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Vec3 &result, float x) const {
-        HashVector h;
+        HashVectorT h;
         Vec3 perlin_result;
         perlin<CGPolicyT>(perlin_result, h, x);
         result = 0.5f * (perlin_result + Vec3(1.0f, 1.0f, 1.0f));
     }
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Vec3 &result, float x, float y) const {
-        HashVector h;
+        HashVectorT h;
         Vec3 perlin_result;
         perlin<CGPolicyT>(perlin_result, h, x, y);
         result = 0.5f * (perlin_result + Vec3(1.0f, 1.0f, 1.0f));
     }
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Vec3 &result, const Vec3 &p) const {
-        HashVector h;
+        HashVectorT h;
         Vec3 perlin_result;
         perlin<CGPolicyT>(perlin_result, h, p.x, p.y, p.z);
         result = 0.5f * (perlin_result + Vec3(1.0f, 1.0f, 1.0f));
     }
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Vec3 &result, const Vec3 &p, float t) const {
-        HashVector h;
+        HashVectorT h;
         Vec3 perlin_result;
         perlin<CGPolicyT>(perlin_result, h, p.x, p.y, p.z, t);
         result = 0.5f * (perlin_result + Vec3(1.0f, 1.0f, 1.0f));
@@ -2345,21 +2722,21 @@ struct NoiseImpl {
     // dual versions
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Dual2<float> &result, const Dual2<float> &x) const {
-        HashScalar h;
+        HashScalarT h;
         Dual2<float> perlin_result;
         perlin<CGPolicyT>(perlin_result, h, x);
         result = 0.5f * (perlin_result + 1.0f);
     }
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Dual2<float> &result, const Dual2<float> &x, const Dual2<float> &y) const {
-        HashScalar h;
+        HashScalarT h;
         Dual2<float> perlin_result;
         perlin<CGPolicyT>(perlin_result, h, x, y);
         result = 0.5f * (perlin_result + 1.0f);
     }
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Dual2<float> &result, const Dual2<Vec3> &p) const {
-        HashScalar h;
+        HashScalarT h;
         Dual2<float> px(p.val().x, p.dx().x, p.dy().x);
         Dual2<float> py(p.val().y, p.dx().y, p.dy().y);
         Dual2<float> pz(p.val().z, p.dx().z, p.dy().z);
@@ -2369,7 +2746,7 @@ struct NoiseImpl {
     }
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Dual2<float> &result, const Dual2<Vec3> &p, const Dual2<float> &t) const {
-        HashScalar h;        
+        HashScalarT h;        
         Dual2<float> px(p.val().x, p.dx().x, p.dy().x);
         Dual2<float> py(p.val().y, p.dx().y, p.dy().y);
         Dual2<float> pz(p.val().z, p.dx().z, p.dy().z);
@@ -2379,21 +2756,21 @@ struct NoiseImpl {
     }
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Dual2<Vec3> &result, const Dual2<float> &x) const {
-        HashVector h;
+        HashVectorT h;
         Dual2<Vec3> perlin_result;
         perlin<CGPolicyT>(perlin_result, h, x);
         result = Vec3(0.5f, 0.5f, 0.5f) * (perlin_result + Vec3(1, 1, 1));
     }
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Dual2<Vec3> &result, const Dual2<float> &x, const Dual2<float> &y) const {
-        HashVector h;
+        HashVectorT h;
         Dual2<Vec3> perlin_result;
         perlin<CGPolicyT>(perlin_result, h, x, y);
         result = Vec3(0.5f, 0.5f, 0.5f) * (perlin_result + Vec3(1, 1, 1));
     }
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Dual2<Vec3> &result, const Dual2<Vec3> &p) const {
-        HashVector h;
+        HashVectorT h;
         Dual2<float> px(p.val().x, p.dx().x, p.dy().x);
         Dual2<float> py(p.val().y, p.dx().y, p.dy().y);
         Dual2<float> pz(p.val().z, p.dx().z, p.dy().z);
@@ -2403,7 +2780,7 @@ struct NoiseImpl {
     }
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Dual2<Vec3> &result, const Dual2<Vec3> &p, const Dual2<float> &t) const {
-        HashVector h;
+        HashVectorT h;
         Dual2<float> px(p.val().x, p.dx().x, p.dy().x);
         Dual2<float> py(p.val().y, p.dx().y, p.dy().y);
         Dual2<float> pz(p.val().z, p.dx().z, p.dy().z);
@@ -2418,48 +2795,53 @@ struct Noise : NoiseImpl<CGDefault> {};
 // inlined inside of a SIMD loops
 struct NoiseScalar : NoiseImpl<CGScalar> {};
 
+// Noise using the PCG-style lattice hash (ShadingSystem "noise_hash" "pcg")
+struct NoisePCG : NoiseImpl<CGDefault, HashScalarPCG, HashVectorPCG> {};
+struct NoisePCGScalar : NoiseImpl<CGScalar, HashScalarPCG, HashVectorPCG> {};
 
-template<typename CGPolicyT = CGDefault>
+
+template<typename CGPolicyT = CGDefault, typename HashScalarT = HashScalar,
+         typename HashVectorT = HashVector>
 struct SNoiseImpl {
 	OSL_FORCEINLINE OSL_HOSTDEVICE SNoiseImpl () { }
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (float &result, float x) const {
-        HashScalar h;
+        HashScalarT h;
         perlin<CGPolicyT>(result, h, x);
     }
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (float &result, float x, float y) const {
-        HashScalar h;
+        HashScalarT h;
         perlin<CGPolicyT>(result, h, x, y);
     }
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (float &result, const Vec3 &p) const {
-        HashScalar h;
+        HashScalarT h;
         perlin<CGPolicyT>(result, h, p.x, p.y, p.z);
     }
     
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (float &result, const Vec3 &p, float t) const {
-        HashScalar h;
+        HashScalarT h;
         perlin<CGPolicyT>(result, h, p.x, p.y, p.z, t);
     }
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Vec3 &result, float x) const {
-        HashVector h;
+        HashVectorT h;
         perlin<CGPolicyT>(result, h, x);
     }
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Vec3 &result, float x, float y) const {
-        HashVector h;
+        HashVectorT h;
         perlin<CGPolicyT>(result, h, x, y);
     }
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Vec3 &result, const Vec3 &p) const {
-        HashVector h;
+        HashVectorT h;
         perlin<CGPolicyT>(result, h, p.x, p.y, p.z);
     }
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Vec3 &result, const Vec3 &p, float t) const {
-        HashVector h;
+        HashVectorT h;
         perlin<CGPolicyT>(result, h, p.x, p.y, p.z, t);
     }
 
@@ -2467,17 +2849,17 @@ struct SNoiseImpl {
     // dual versions
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Dual2<float> &result, const Dual2<float> &x) const {
-        HashScalar h;
+        HashScalarT h;
         perlin<CGPolicyT>(result, h, x);
     }
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Dual2<float> &result, const Dual2<float> &x, const Dual2<float> &y) const {
-        HashScalar h;
+        HashScalarT h;
         perlin<CGPolicyT>(result, h, x, y);
     }
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Dual2<float> &result, const Dual2<Vec3> &p) const {
-        HashScalar h;
+        HashScalarT h;
         Dual2<float> px(p.val().x, p.dx().x, p.dy().x);
         Dual2<float> py(p.val().y, p.dx().y, p.dy().y);
         Dual2<float> pz(p.val().z, p.dx().z, p.dy().z);
@@ -2485,7 +2867,7 @@ struct SNoiseImpl {
     }
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Dual2<float> &result, const Dual2<Vec3> &p, const Dual2<float> &t) const {
-        HashScalar h;
+        HashScalarT h;
         Dual2<float> px(p.val().x, p.dx().x, p.dy().x);
         Dual2<float> py(p.val().y, p.dx().y, p.dy().y);
         Dual2<float> pz(p.val().z, p.dx().z, p.dy().z);
@@ -2493,18 +2875,18 @@ struct SNoiseImpl {
     }
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Dual2<Vec3> &result, const Dual2<float> &x) const {
-        HashVector h;
+        HashVectorT h;
         perlin<CGPolicyT>(result, h, x);
     }
 
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Dual2<Vec3> &result, const Dual2<float> &x, const Dual2<float> &y) const {
-        HashVector h;
+        HashVectorT h;
         perlin<CGPolicyT>(result, h, x, y);
     }
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Dual2<Vec3> &result, const Dual2<Vec3> &p) const {
-        HashVector h;
+        HashVectorT h;
         Dual2<float> px(p.val().x, p.dx().x, p.dy().x);
         Dual2<float> py(p.val().y, p.dx().y, p.dy().y);
         Dual2<float> pz(p.val().z, p.dx().z, p.dy().z);
@@ -2512,7 +2894,7 @@ struct SNoiseImpl {
     }
 
     OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Dual2<Vec3> &result, const Dual2<Vec3> &p, const Dual2<float> &t) const {
-        HashVector h;
+        HashVectorT h;
         Dual2<float> px(p.val().x, p.dx().x, p.dy().x);
         Dual2<float> py(p.val().y, p.dx().y, p.dy().y);
         Dual2<float> pz(p.val().z, p.dx().z, p.dy().z);
@@ -2525,6 +2907,10 @@ struct SNoise : SNoiseImpl<CGDefault> {};
 // inlined inside of a SIMD loops
 struct SNoiseScalar : SNoiseImpl<CGScalar> {};
 
+// SNoise using the PCG-style lattice hash (ShadingSystem "noise_hash" "pcg")
+struct SNoisePCG : SNoiseImpl<CGDefault, HashScalarPCG, HashVectorPCG> {};
+struct SNoisePCGScalar : SNoiseImpl<CGScalar, HashScalarPCG, HashVectorPCG> {};
+
 
 
 template<typename CGPolicyT = CGDefault>
@@ -3245,6 +3631,199 @@ struct USimplexNoiseScalar {
     }
 
 };
+
+
+
+// Worley (cellular) noise, with one jittered feature point in every unit
+// cell.  The float variety returns F1, the distance to the nearest feature
+// point; the Vec3 variety returns (F1, F2, id), where F2 is the distance to
+// the second nearest feature point and id is a [0,1) hash of the cell that
+// owns the nearest one.  1D and 2D domains search a 1D or 2D lattice; the
+// 4D variety searches the 3D lattice with a pattern selected by floor(t).
+// The same code serves scalar and batched execution.
+struct VoronoiNoise {
+    OSL_FORCEINLINE OSL_HOSTDEVICE VoronoiNoise () { }
+
+    OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (float &result, float x) const {
+        eval<1, false>(result, Vec3(x, 0.0f, 0.0f), 0.0f);
+    }
+
+    OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (float &result, float x, float y) const {
+        eval<2, false>(result, Vec3(x, y, 0.0f), 0.0f);
+    }
+
+    OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (float &result, const Vec3 &p) const {
+        eval<3, false>(result, p, 0.0f);
+    }
+
+    OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (float &result, const Vec3 &p, float t) const {
+        eval<3, true>(result, p, t);
+    }
+
+    OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Vec3 &result, float x) const {
+        eval<1, false>(result, Vec3(x, 0.0f, 0.0f), 0.0f);
+    }
+
+    OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Vec3 &result, float x, float y) const {
+        eval<2, false>(result, Vec3(x, y, 0.0f), 0.0f);
+    }
+
+    OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Vec3 &result, const Vec3 &p) const {
+        eval<3, false>(result, p, 0.0f);
+    }
+
+    OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Vec3 &result, const Vec3 &p, float t) const {
+        eval<3, true>(result, p, t);
+    }
+
+    // dual versions -- F1 and F2 carry the derivatives of the distance to
+    // their (fixed) feature points, the cell id has none.  The pattern is
+    // piecewise constant in t, so t contributes no derivatives either.
+    OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Dual2<float> &result, const Dual2<float> &x) const {
+        eval<1, false>(result, make_Vec3(x, Dual2<float>(0.0f), Dual2<float>(0.0f)), 0.0f);
+    }
+
+    OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Dual2<float> &result, const Dual2<float> &x,
+                            const Dual2<float> &y) const {
+        eval<2, false>(result, make_Vec3(x, y, Dual2<float>(0.0f)), 0.0f);
+    }
+
+    OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Dual2<float> &result, const Dual2<Vec3> &p) const {
+        eval<3, false>(result, p, 0.0f);
+    }
+
+    OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Dual2<float> &result, const Dual2<Vec3> &p,
+                            const Dual2<float> &t) const {
+        eval<3, true>(result, p, t.val());
+    }
+
+    OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Dual2<Vec3> &result, const Dual2<float> &x) const {
+        eval<1, false>(result, make_Vec3(x, Dual2<float>(0.0f), Dual2<float>(0.0f)), 0.0f);
+    }
+
+    OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Dual2<Vec3> &result, const Dual2<float> &x,
+                            const Dual2<float> &y) const {
+        eval<2, false>(result, make_Vec3(x, y, Dual2<float>(0.0f)), 0.0f);
+    }
+
+    OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Dual2<Vec3> &result, const Dual2<Vec3> &p) const {
+        eval<3, false>(result, p, 0.0f);
+    }
+
+    OSL_FORCEINLINE OSL_HOSTDEVICE void operator() (Dual2<Vec3> &result, const Dual2<Vec3> &p,
+                            const Dual2<float> &t) const {
+        eval<3, true>(result, p, t.val());
+    }
+
+private:
+    template<int DimsT, bool TimeT, typename R>
+    OSL_FORCEINLINE OSL_HOSTDEVICE void eval (R &result, const Vec3 &p, float t) const {
+        Vec3 f1, f2;
+        float id;
+        search<DimsT, TimeT>(p, t, f1, f2, id);
+        finish(result, p, f1, f2, id);
+    }
+
+    template<int DimsT, bool TimeT, typename R>
+    OSL_FORCEINLINE OSL_HOSTDEVICE void eval (R &result, const Dual2<Vec3> &p, float t) const {
+        Vec3 f1, f2;
+        float id;
+        search<DimsT, TimeT>(p.val(), t, f1, f2, id);
+        finish(result, p, f1, f2, id);
+    }
+
+    static OSL_FORCEINLINE OSL_HOSTDEVICE void
+    finish (float &result, const Vec3 &p, const Vec3 &f1, const Vec3 & /*f2*/, float /*id*/) {
+        result = (p - f1).length();
+    }
+
+    static OSL_FORCEINLINE OSL_HOSTDEVICE void
+    finish (Vec3 &result, const Vec3 &p, const Vec3 &f1, const Vec3 &f2, float id) {
+        result = Vec3((p - f1).length(), (p - f2).length(), id);
+    }
+
+    static OSL_FORCEINLINE OSL_HOSTDEVICE void
+    finish (Dual2<float> &result, const Dual2<Vec3> &p, const Vec3 &f1, const Vec3 & /*f2*/, float /*id*/) {
+        result = distance(p, f1);
+    }
+
+    static OSL_FORCEINLINE OSL_HOSTDEVICE void
+    finish (Dual2<Vec3> &result, const Dual2<Vec3> &p, const Vec3 &f1, const Vec3 &f2, float id) {
+        result = make_Vec3(distance(p, f1), distance(p, f2), Dual2<float>(id));
+    }
+
+    // Visit order of the neighbor offsets along each axis: home cell first.
+    static OSL_FORCEINLINE OSL_HOSTDEVICE int
+    cell_offset (int i) {
+        return i == 0 ? 0 : (i == 1 ? -1 : 1);
+    }
+
+    // Squared distance along one axis from a point at fractional cell
+    // coordinate f to the neighboring cell at offset o (-1, 0, 1).
+    static OSL_FORCEINLINE OSL_HOSTDEVICE float
+    cell_dist2 (int o, float f) {
+        float d = o < 0 ? f : (o > 0 ? 1.0f - f : 0.0f);
+        return d * d;
+    }
+
+    // Find the nearest (f1) and second nearest (f2) feature points to p in
+    // the 3^DimsT neighborhood of p's cell.  The home cell is visited first
+    // and any neighbor whose cell is already farther away than the current
+    // F2 is skipped without hashing, since its feature point can't be
+    // closer.
+    template<int DimsT, bool TimeT>
+    static OSL_FORCEINLINE OSL_HOSTDEVICE void
+    search (const Vec3 &p, float t, Vec3 &f1, Vec3 &f2, float &id) {
+        const int ix = OIIO::ifloor(p.x);
+        const int iy = OIIO::ifloor(p.y);
+        const int iz = OIIO::ifloor(p.z);
+        const Vec3 frac(p.x - float(ix), p.y - float(iy), p.z - float(iz));
+        CellNoise hash;
+        float d1 = std::numeric_limits<float>::max();
+        float d2 = std::numeric_limits<float>::max();
+        f1 = p;
+        f2 = p;
+        id = 0.0f;
+        for (int k = 0; k < (DimsT >= 3 ? 3 : 1); ++k) {
+            const int oz = cell_offset(k);
+            const float bz = cell_dist2(oz, frac.z);
+            for (int j = 0; j < (DimsT >= 2 ? 3 : 1); ++j) {
+                const int oy = cell_offset(j);
+                const float byz = bz + cell_dist2(oy, frac.y);
+                for (int i = 0; i < 3; ++i) {
+                    const int ox = cell_offset(i);
+                    if (byz + cell_dist2(ox, frac.x) >= d2)
+                        continue;
+                    const Vec3 c(float(ix + ox), float(iy + oy), float(iz + oz));
+                    Vec3 jitter;
+                    if (TimeT)
+                        hash(jitter, c, t);
+                    else
+                        hash(jitter, c);
+                    if (DimsT < 3)
+                        jitter.z = 0.0f;
+                    if (DimsT < 2)
+                        jitter.y = 0.0f;
+                    const Vec3 f = c + jitter;
+                    const float d = (f - p).length2();
+                    if (d < d1) {
+                        d2 = d1;
+                        f2 = f1;
+                        d1 = d;
+                        f1 = f;
+                        if (TimeT)
+                            hash(id, c, t);
+                        else
+                            hash(id, c);
+                    } else if (d < d2) {
+                        d2 = d;
+                        f2 = f;
+                    }
+                }
+            }
+        }
+    }
+};
 } // anonymous namespace
 
 
@@ -139,6 +139,22 @@ public:
     };
     /// </code>
 
+    /// Static estimates oslc records of what the shader costs: how many
+    /// ops it has in all, how many of those are arithmetic, texture
+    /// lookups, noise calls, ray traces, and loops, and how many take
+    /// derivatives of their arguments. For shaders compiled before oslc
+    /// recorded these, `known` is false and the counts are all 0.
+    struct CostEstimate {
+        bool known  = false;
+        int ops     = 0;
+        int arith   = 0;
+        int texture = 0;
+        int noise   = 0;
+        int trace   = 0;
+        int loops   = 0;
+        int derivs  = 0;
+    };
+
     /// OSLQuery methods
     /// ----------------
 
@@ -182,6 +198,21 @@ public:
     /// it's own side and wants to get shader info on runtime without
     /// creating a temporary file.
 
+    static std::vector<OSLQuery>
+    query_all(string_view path, string_view cachefile = string_view(),
+              int nthreads = 0, std::string* err = nullptr);
+    ///< Query every shader in `path`, which may be a directory (each
+    /// `.oso` file in it) or a shader bundle (each shader in it), in name
+    /// order, reading them in parallel with `nthreads` threads (0 means
+    /// one per core). Errors for a single shader are held by its
+    /// `OSLQuery`. If `path` can't be read, return an empty list and set
+    /// `*err` (if given).
+    ///
+    /// If `cachefile` is given, the parameter and metadata part of each
+    /// text `.oso` in a directory is kept in that file, and reused by
+    /// later queries until the `.oso` file's modification time changes,
+    /// so that they needn't open unchanged shaders at all.
+
     bool init(const ShaderGroup* group, int layernum);
     ///< Meant to be called at runtime from an app with a full ShadingSystem,
     /// fill out an OSLQuery structure for the given layer of the group.
@@ -213,6 +244,9 @@ public:
     const std::vector<Parameter>& metadata(void) const { return m_meta; }
     ///< Retrieve a reference to the metadata about the shader.
 
+    const CostEstimate& cost() const { return m_cost; }
+    ///< Retrieve the static cost estimates oslc recorded for the shader.
+
     ///> Return error string, empty if there was no error, and reset the
     /// error string.
     std::string geterror(bool clear_error = true)
@@ -241,6 +275,7 @@ private:
     mutable std::string m_error;      //< Error message
     std::vector<Parameter> m_params;  //< Params to the shader
     std::vector<Parameter> m_meta;    //< Meta-data about the shader
+    CostEstimate m_cost;              //< Static cost estimates
     friend class pvt::OSOReaderQuery;
 
     // Internal error reporting routine, with std::format-like arguments.
@@ -56,6 +56,14 @@ enum class InterpolatedSpecBuiltinArg {
 using InterpolatedSpecArg    = ArgVariant<InterpolatedSpecBuiltinArg>;
 using InterpolatedGetterSpec = FunctionSpec<InterpolatedSpecArg>;
 
+/// How long the value of a renderer attribute stays the same, as declared
+/// by RendererServices::attribute_constancy().
+enum class AttributeConstancy {
+    Varying,    // May differ from point to point (the default)
+    PerObject,  // Fixed for the object being shaded
+    PerFrame,   // Fixed for the whole frame, whatever is being shaded
+};
+
 // Turn off warnings about unused params for this file, since we have lots
 // of declarations with stub function bodies.
 OSL_PRAGMA_WARNING_PUSH
@@ -80,6 +88,7 @@ public:
     ///    "OptiX"
     ///    "build_attribute_getter"
     ///    "build_interpolated_getter"
+    ///    "trace_deferred"
     ///
     /// This allows some customization of JIT generated code based on the
     /// facilities and features of a particular renderer. It also allows
@@ -285,6 +294,22 @@ public:
                                      ustringhash object, TypeDesc type,
                                      ustringhash name, int index, void* val);
 
+    /// Declare how long the value of the named attribute (of the named
+    /// object, or of object == ustring() for a lookup without one) stays
+    /// the same, which lets the runtime optimizer specialize getattribute
+    /// calls for it. A PerFrame attribute (camera resolution, frame
+    /// number) is fetched once, with sg == NULL, when the shader group is
+    /// optimized, and folded to a constant. A PerObject attribute (an
+    /// object ID) is fetched from the renderer the first time the shader
+    /// asks for it at each point, and the result is reused for the rest of
+    /// that execution, including in loops. The default, Varying, makes no
+    /// promise, and every getattribute calls get_attribute.
+    virtual AttributeConstancy attribute_constancy(ustringhash object,
+                                                   ustringhash name) const
+    {
+        return AttributeConstancy::Varying;
+    }
+
     /// Builds a free function to provide a value for a given interpolated value.
     /// This occurs at shader compile time, not at execution time.
     ///
@@ -318,6 +343,27 @@ public:
     virtual bool get_userdata(bool derivatives, ustringhash name, TypeDesc type,
                               ShaderGlobals* sg, void* val);
 
+    /// One request of a get_userdata_all() gather: the name, type and
+    /// derivatives wanted, where to write the value (as for get_userdata),
+    /// and whether it was found.
+    struct UserdataGather {
+        ustringhash name;
+        TypeDesc type;
+        bool derivs;
+        void* val;
+        bool found;
+    };
+
+    /// Fetch several user-data of the current object at once, setting the
+    /// found flag of each request. Unless the "lazy_userdata" option is
+    /// on (or the renderer supports "build_interpolated_getter"), this is
+    /// called once per execution with all the user-data the shader group
+    /// binds to its parameters. Renderers can override it to look up the
+    /// primitive's data once for all of them; the default simply calls
+    /// get_userdata() for each request.
+    virtual void get_userdata_all(ShaderGlobals* sg,
+                                  span<UserdataGather> requests);
+
     /// Given the name of a texture, return an opaque handle that can be used
     /// with texture calls to avoid the name lookups. The `options`, if not
     /// null, may be used in renderer-specific ways to specialize a handle
@@ -512,6 +558,36 @@ public:
                        const OSL::Vec3& R, const OSL::Vec3& dRdx,
                        const OSL::Vec3& dRdy);
 
+    /// A ray that a shader's trace() asked for while being run by
+    /// ShadingSystem::execute_deferred_trace().
+    struct TraceRequest {
+        int point;                      ///< Index of the shade's globals
+        TraceOpt options;               ///< As passed to trace()
+        OSL::Vec3 P, dPdx, dPdy;        ///< Ray origin (and derivs)
+        OSL::Vec3 R, dRdx, dRdy;        ///< Ray direction (and derivs)
+        bool hit            = false;    ///< Set by trace_deferred()
+        void* renderer_data = nullptr;  ///< The renderer's own hit record
+    };
+
+    /// Trace all at once the rays asked for by the shades run by
+    /// ShadingSystem::execute_deferred_trace(), setting each request's
+    /// hit, and renderer_data to whatever trace_resume() will need to
+    /// answer the shader's later getmessage("trace", ...) calls. globals
+    /// are those of the shades, as their first run left them. Only called
+    /// if supports("trace_deferred"); the default calls trace() for each
+    /// request in turn.
+    virtual void trace_deferred(span<TraceRequest> requests,
+                                span<ShaderGlobals> globals);
+
+    /// Answer a trace() call from the result of the trace_deferred() of
+    /// its request, when the shade is run again. Return true if the ray
+    /// hit anything, and be ready for the getmessage("trace", ...) calls
+    /// that go with it, just as after trace(). The default returns hit.
+    virtual bool trace_resume(const TraceRequest& request, ShaderGlobals* sg)
+    {
+        return request.hit;
+    }
+
     /// Get the named message from the renderer and if found then
     /// write it into 'val'.  Otherwise, return false.  This is only
     /// called for "sourced" messages, not ordinary intra-group messages.
@@ -563,6 +639,49 @@ public:
         //     return dst_device;
     }
 
+    /// Like `copy_to_device()`, but the copy may be asynchronous, ordered
+    /// on `stream` (for CUDA, a cudaStream_t, with nullptr meaning the
+    /// default stream). The shading system keeps `src_host` unchanged
+    /// until its next upload_device_data(), by which time the renderer
+    /// must have synchronized with the stream. The default just calls
+    /// `copy_to_device()`.
+    virtual void* copy_to_device_async(void* dst_device, const void* src_host,
+                                       size_t size, void* stream)
+    {
+        return copy_to_device(dst_device, src_host, size);
+        // Note: for an OptiX-based renderer, this method should be overriden
+        // with something like:
+        //
+        //     auto r = cudaMemcpyAsync(dst_device, src_host, size,
+        //                              cudaMemcpyHostToDevice,
+        //                              (cudaStream_t)stream);
+        //     return dst_device;
+    }
+
+    /// Launch the CUDA kernel `kernel_name`, of the module with the given
+    /// PTX, with one thread per point (`nthreads` in all) and the
+    /// given kernel arguments, on `stream`, returning true if it was
+    /// launched. The renderer links the PTX with its own device code (as
+    /// for an OptiX module) and is free to cache the module by name. This
+    /// is how ShadingSystem::shade_grid_device runs a group without an
+    /// OptiX pipeline; the default can't launch anything.
+    virtual bool launch_device_kernel(string_view ptx, string_view kernel_name,
+                                      int nthreads, void** args, void* stream)
+    {
+        return false;
+        // Note: for a CUDA renderer, this method should be overridden with
+        // something like:
+        //
+        //     CUmodule module = /* linked and loaded from ptx, cached */;
+        //     CUfunction func;
+        //     cuModuleGetFunction(&func, module,
+        //                         std::string(kernel_name).c_str());
+        //     int block = 256;
+        //     return cuLaunchKernel(func, (nthreads + block - 1) / block, 1, 1,
+        //                           block, 1, 1, 0, (CUstream)stream, args,
+        //                           nullptr) == CUDA_SUCCESS;
+    }
+
     /// Options we use for noise calls.
     struct NoiseOpt {
         int anisotropic;
@@ -107,15 +107,32 @@ STRDECL("genericpnoise", genericpnoise)
 STRDECL("gabor", gabor)
 STRDECL("gabornoise", gabornoise)
 STRDECL("gaborpnoise", gaborpnoise)
+STRDECL("fbm", fbm)
+STRDECL("turbulence", turbulence)
+STRDECL("ridged", ridged)
+STRDECL("fractalnoise", fractalnoise)
+STRDECL("baked", baked)
+STRDECL("bakednoise", bakednoise)
 STRDECL("simplex", simplex)
 STRDECL("usimplex", usimplex)
 STRDECL("simplexnoise", simplexnoise)
 STRDECL("usimplexnoise", usimplexnoise)
+STRDECL("voronoi", voronoi)
+STRDECL("worley", worley)
+STRDECL("voronoinoise", voronoinoise)
+STRDECL("pcg", pcg)
+STRDECL("noise_pcg", noise_pcg)
+STRDECL("snoise_pcg", snoise_pcg)
 STRDECL("anisotropic", anisotropic)
 STRDECL("direction", direction)
 STRDECL("do_filter", do_filter)
 STRDECL("bandwidth", bandwidth)
 STRDECL("impulses", impulses)
+STRDECL("octaves", octaves)
+STRDECL("lacunarity", lacunarity)
+STRDECL("gain", gain)
+STRDECL("bake_type", bake_type)
+STRDECL("bake_res", bake_res)
 STRDECL("dowhile", op_dowhile)
 STRDECL("for", op_for)
 STRDECL("while", op_while)
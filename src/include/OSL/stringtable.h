@@ -0,0 +1,71 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#ifndef __CUDACC__
+#    include <vector>
+#endif
+
+#include <OSL/oslconfig.h>
+
+
+OSL_NAMESPACE_BEGIN
+
+/// A minimal perfect hash of a fixed set of string hashes (the
+/// ustringhash values that shaders pass around on the GPU). index() maps
+/// each string of the set to its own index in [0,size), and any other
+/// string to -1, with one probe and one compare, so device code can
+/// dispatch on a string -- an attribute name, say -- with a switch on its
+/// index instead of a chain of compares.
+///
+/// The renderer makes the tables on the host, with make_string_table()
+/// (or ShadingSystem::make_string_table() for the strings its shaders
+/// use), copies `seeds` and `keys` to the device, and points a
+/// StringTable at them there. The same StringTable, pointing at the host
+/// vectors, gives the index of any string on the host.
+struct StringTable {
+    const int32_t* seeds = nullptr;  ///< Per bucket: mix seed, or -slot-1
+    const uint64_t* keys = nullptr;  ///< The string hash at each index
+    uint32_t nbuckets    = 0;
+    uint32_t size        = 0;
+
+    static OSL_HOSTDEVICE uint32_t bucket(uint64_t h, uint32_t nbuckets)
+    {
+        return uint32_t(h >> 32) % nbuckets;
+    }
+
+    static OSL_HOSTDEVICE uint32_t mix(uint64_t h, uint32_t seed)
+    {
+        h ^= uint64_t(seed) * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return uint32_t(h);
+    }
+
+    /// Index of the string with hash h, or -1 if it's not in the table.
+    OSL_HOSTDEVICE int index(uint64_t h) const
+    {
+        if (!size)
+            return -1;
+        int32_t seed  = seeds[bucket(h, nbuckets)];
+        uint32_t slot = seed < 0 ? uint32_t(-(seed + 1))
+                                 : mix(h, uint32_t(seed)) % size;
+        return keys[slot] == h ? int(slot) : -1;
+    }
+};
+
+
+#ifndef __CUDACC__
+/// Make the minimal perfect hash of the given string hashes (duplicates
+/// are ignored): fill `seeds` with one entry per bucket and `keys` with
+/// the hash at each index, and return the number of buckets, for a
+/// StringTable{ seeds.data(), keys.data(), nbuckets, keys.size() }.
+OSLEXECPUBLIC uint32_t
+make_string_table(const uint64_t* hashes, size_t n,
+                  std::vector<int32_t>& seeds, std::vector<uint64_t>& keys);
+#endif
+
+OSL_NAMESPACE_END
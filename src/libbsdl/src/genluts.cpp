@@ -21,7 +21,9 @@ using BSDLConfig = bsdl::BSDLDefaultConfig;
 #include "parallel.h"
 
 #include <algorithm>
+#include <cstdarg>
 #include <cstdio>
+#include <string>
 #include <tuple>
 #include <vector>
 
@@ -145,6 +147,42 @@ compute_E(float cos_theta, const BSDF& bsdf, uint32_t fresnel_index,
     return std::min(E, 1.0f);
 }
 
+// printf to the end of a string
+static void
+appendf(std::string& s, const char* fmt, ...)
+{
+    char buf[256];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    s.append(buf, std::min(n, int(sizeof(buf)) - 1));
+}
+
+// Write the file unless it already has these contents, leaving its time
+// stamp alone so that what includes it doesn't rebuild every time the
+// tables are generated. Returns false if it can't be written.
+static bool
+write_if_changed(const std::string& path, const std::string& contents)
+{
+    if (FILE* inf = fopen(path.c_str(), "rb")) {
+        std::string old(contents.size() + 1, '\0');
+        size_t n = fread(&old[0], 1, old.size(), inf);
+        fclose(inf);
+        if (n == contents.size() && !old.compare(0, n, contents)) {
+            printf("LUTs in %s are up to date\n", path.c_str());
+            return true;
+        }
+    }
+    FILE* outf = fopen(path.c_str(), "wb");
+    if (!outf)
+        return false;
+    fwrite(contents.data(), 1, contents.size(), outf);
+    fclose(outf);
+    printf("Wrote LUTs to %s\n", path.c_str());
+    return true;
+}
+
 template<typename BSDF>
 BSDL_INLINE void
 bake_emiss_tables(const std::string& output_dir)
@@ -153,53 +191,52 @@ bake_emiss_tables(const std::string& output_dir)
 
     printf("Generating LUTs for %s ...\n", BSDF::struct_name());
 
-    parallel_for(0, BSDF::Nf, [&](unsigned f) {
+    // One job per (fresnel, roughness) row, some tables have a single
+    // fresnel entry and would otherwise run on one thread.
+    parallel_for(0, BSDF::Nf * BSDF::Nr, [&](unsigned fr) {
+        const int f = fr / BSDF::Nr, r = fr % BSDF::Nr;
         const float fresnel_index = float(f)
                                     * (1.0f / std::max(1, BSDF::Nf - 1));
-        for (int r = 0; r < BSDF::Nr; r++) {
-            const float roughness_index
-                = BSDF::Nr > 1 ? float(r) * (1.0f / (BSDF::Nr - 1)) : 0.0f;
-            for (int c = 0; c < BSDF::Nc; c++) {
-                int idx = f * BSDF::Nr * BSDF::Nc + r * BSDF::Nc + c;
-                const BSDF bsdf(BSDF::get_cosine(c), roughness_index,
-                                fresnel_index);
-                storedE[idx] = 1 - compute_E(BSDF::get_cosine(c), bsdf, f, r);
-            }
+        const float roughness_index
+            = BSDF::Nr > 1 ? float(r) * (1.0f / (BSDF::Nr - 1)) : 0.0f;
+        for (int c = 0; c < BSDF::Nc; c++) {
+            int idx = f * BSDF::Nr * BSDF::Nc + r * BSDF::Nc + c;
+            const BSDF bsdf(BSDF::get_cosine(c), roughness_index,
+                            fresnel_index);
+            storedE[idx] = 1 - compute_E(BSDF::get_cosine(c), bsdf, f, r);
         }
     });
 
-    std::string out_file = output_dir + "/" + BSDF::lut_header();
-    FILE* outf           = fopen(out_file.c_str(), "wb");
-    if (!outf) {
-        printf("Failed to open %s for writing\n", out_file.c_str());
-        exit(-1);
-    }
-
-    fprintf(outf, "#pragma once\n\n");
-    fprintf(outf, "BSDL_ENTER_NAMESPACE\n\n");
-    fprintf(outf, "namespace %s {\n\n", BSDF::NS);
-    fprintf(outf, "BSDL_INLINE_METHOD %s::Energy& %s::get_energy()\n",
+    std::string out;
+    appendf(out, "#pragma once\n\n");
+    appendf(out, "BSDL_ENTER_NAMESPACE\n\n");
+    appendf(out, "namespace %s {\n\n", BSDF::NS);
+    appendf(out, "BSDL_INLINE_METHOD %s::Energy& %s::get_energy()\n",
             BSDF::struct_name(), BSDF::struct_name());
-    fprintf(outf, "{\n");
-    fprintf(outf, "    static Energy energy = {{\n");
+    appendf(out, "{\n");
+    appendf(out, "    static Energy energy = {{\n");
     for (int f = 0, idx = 0; f < BSDF::Nf; f++) {
         for (int r = 0; r < BSDF::Nr; r++) {
-            fprintf(outf, "       ");
+            appendf(out, "       ");
             for (int c = 0; c < BSDF::Nc; c++, idx++)
                 if (storedE[idx] == int(storedE[idx]))
-                    fprintf(outf, " %12d.0f,", int(storedE[idx]));
+                    appendf(out, " %12d.0f,", int(storedE[idx]));
                 else
-                    fprintf(outf, " %14.9gf,", storedE[idx]);
-            fprintf(outf, "\n");
+                    appendf(out, " %14.9gf,", storedE[idx]);
+            appendf(out, "\n");
         }
     }
-    fprintf(outf, "    }};\n");
-    fprintf(outf, "    return energy;\n");
-    fprintf(outf, "}\n\n");
-    fprintf(outf, "} // namespace %s \n\n", BSDF::NS);
-    fprintf(outf, "BSDL_LEAVE_NAMESPACE\n");
-    fclose(outf);
-    printf("Wrote LUTs to %s\n", out_file.c_str());
+    appendf(out, "    }};\n");
+    appendf(out, "    return energy;\n");
+    appendf(out, "}\n\n");
+    appendf(out, "} // namespace %s \n\n", BSDF::NS);
+    appendf(out, "BSDL_LEAVE_NAMESPACE\n");
+
+    std::string out_file = output_dir + "/" + BSDF::lut_header();
+    if (!write_if_changed(out_file, out)) {
+        printf("Failed to open %s for writing\n", out_file.c_str());
+        exit(-1);
+    }
 }
 
 int
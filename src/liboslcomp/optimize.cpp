@@ -0,0 +1,254 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <climits>
+#include <unordered_map>
+#include <vector>
+
+#include "oslcomp_pvt.h"
+
+
+OSL_NAMESPACE_BEGIN
+
+namespace pvt {  // OSL::pvt
+
+
+// The optimizations below are all local and conservative: the runtime
+// optimizer does the thorough job, knowing the instance values, but
+// every process that loads the shader pays for it, so whatever can be
+// done once here makes for smaller .oso files and less runtime work.
+// oslc already inlines every user function call.
+
+
+
+// Ops with no effect but writing their first argument, which can be
+// dropped if nothing reads it.
+static bool
+op_is_pure(ustring opname)
+{
+    static const ustring pure[]
+        = { ustring("assign"), ustring("add"),   ustring("sub"),
+            ustring("mul"),    ustring("div"),   ustring("mod"),
+            ustring("neg"),    ustring("eq"),    ustring("neq"),
+            ustring("lt"),     ustring("gt"),    ustring("le"),
+            ustring("ge"),     ustring("and"),   ustring("or"),
+            ustring("bitand"), ustring("bitor"), ustring("xor"),
+            ustring("compl"),  ustring("shl"),   ustring("shr") };
+    for (auto&& p : pure)
+        if (opname == p)
+            return true;
+    return false;
+}
+
+
+
+// Ops that write only some of their first argument, which therefore
+// can't simply be redirected to write somewhere else instead.
+static bool
+op_writes_part(ustring opname)
+{
+    static ustring aassign("aassign"), compassign("compassign"),
+        mxcompassign("mxcompassign");
+    return opname == aassign || opname == compassign
+           || opname == mxcompassign;
+}
+
+
+
+bool
+OSLCompilerImpl::fold_constant_op(Opcode& op)
+{
+    static ustring add("add"), sub("sub"), mul("mul"), div("div"),
+        neg("neg"), assign("assign");
+    ustring opname = op.opname();
+    bool binary    = (opname == add || opname == sub || opname == mul
+                   || opname == div);
+    if (!(binary || opname == neg) || op.nargs() != (binary ? 3 : 2))
+        return false;
+    Symbol* R = m_opargs[op.firstarg()];
+    Symbol* A = m_opargs[op.firstarg() + 1];
+    Symbol* B = binary ? m_opargs[op.firstarg() + 2] : A;
+    // Only scalars of the result's own type, so that no conversion rules
+    // come into it.
+    const TypeSpec& t(R->typespec());
+    if (!(t.is_float() || t.is_int()) || A->symtype() != SymTypeConst
+        || B->symtype() != SymTypeConst || A->typespec() != t
+        || B->typespec() != t)
+        return false;
+
+    Symbol* result = nullptr;
+    if (t.is_float()) {
+        float a = A->get_float(), b = B->get_float(), r;
+        if (opname == neg)
+            r = -a;
+        else if (opname == add)
+            r = a + b;
+        else if (opname == sub)
+            r = a - b;
+        else if (opname == mul)
+            r = a * b;
+        else if (b != 0.0f)
+            r = a / b;
+        else
+            return false;  // Leave the runtime's rule for x/0 to the runtime
+        result = make_constant(r);
+    } else {
+        // Wrap around on overflow, as the generated code does
+        unsigned int a = unsigned(A->get_int()), b = unsigned(B->get_int()),
+                     r;
+        if (opname == neg)
+            r = 0u - a;
+        else if (opname == add)
+            r = a + b;
+        else if (opname == sub)
+            r = a - b;
+        else if (opname == mul)
+            r = a * b;
+        else if (b != 0 && !(int(a) == INT_MIN && int(b) == -1))
+            r = unsigned(int(a) / int(b));
+        else
+            return false;
+        result = make_constant(int(r));
+    }
+
+    // Becomes "assign R result", with arguments of its own
+    int firstarg = int(m_opargs.size());
+    m_opargs.push_back(R);
+    m_opargs.push_back(result);
+    op.reset(assign, 2);
+    op.set_args(firstarg, 2);
+    return true;
+}
+
+
+
+void
+OSLCompilerImpl::remove_ops(const std::vector<char>& dead)
+{
+    // Where each op ends up; a jump to a removed op lands on the next one
+    // that is kept.
+    int nops = int(m_ircode.size());
+    std::vector<int> newindex(nops + 1);
+    int kept = 0;
+    for (int i = 0; i < nops; ++i) {
+        newindex[i] = kept;
+        if (!dead[i])
+            ++kept;
+    }
+    newindex[nops] = kept;
+    if (kept == nops)
+        return;
+
+    for (auto& op : m_ircode)
+        for (int j = 0; j < (int)Opcode::max_jumps && op.jump(j) >= 0; ++j)
+            op.jump(j) = newindex[op.jump(j)];
+    for (auto&& s : symtab()) {
+        if (s->symtype() == SymTypeParam
+            || s->symtype() == SymTypeOutputParam) {
+            s->initbegin(newindex[s->initbegin()]);
+            s->initend(newindex[s->initend()]);
+        }
+    }
+    if (m_main_method_start >= 0)
+        m_main_method_start = newindex[m_main_method_start];
+
+    OpcodeVec code;
+    code.reserve(kept);
+    for (int i = 0; i < nops; ++i)
+        if (!dead[i])
+            code.push_back(m_ircode[i]);
+    m_ircode.swap(code);
+}
+
+
+
+void
+OSLCompilerImpl::optimize_ircode()
+{
+    static ustring assign("assign");
+    for (bool changed = true; changed;) {
+        changed  = false;
+        int nops = int(m_ircode.size());
+
+        for (auto& op : m_ircode)
+            changed |= fold_constant_op(op);
+
+        // How many times each symbol is read and written, and which ops
+        // something jumps to.
+        std::unordered_map<const Symbol*, int> reads, writes;
+        std::vector<char> target(nops + 1, 0);
+        for (auto& op : m_ircode) {
+            for (int a = 0; a < op.nargs(); ++a) {
+                const Symbol* s = m_opargs[op.firstarg() + a];
+                if (op.argread(a))
+                    ++reads[s];
+                if (op.argwrite(a))
+                    ++writes[s];
+            }
+            for (int j = 0; j < (int)Opcode::max_jumps && op.jump(j) >= 0; ++j)
+                target[op.jump(j)] = 1;
+        }
+        // Does the op write its first argument and nothing else, without
+        // reading it, and carry on to the next op?
+        auto writes_first_only = [&](const Opcode& op) {
+            if (op.nargs() < 1 || !op.argwrite(0) || op.argread(0)
+                || op.jump(0) >= 0)
+                return false;
+            for (int a = 1; a < op.nargs(); ++a)
+                if (op.argwrite(a))
+                    return false;
+            return true;
+        };
+
+        std::vector<char> dead(nops, 0);
+        for (int i = 0; i < nops; ++i) {
+            if (dead[i])
+                continue;
+            Opcode& op(m_ircode[i]);
+            if (!writes_first_only(op))
+                continue;
+            Symbol* R = m_opargs[op.firstarg()];
+
+            // A temporary nobody reads needn't be computed.
+            if (R->symtype() == SymTypeTemp && !reads[R]
+                && op_is_pure(op.opname())) {
+                for (int a = 1; a < op.nargs(); ++a)
+                    --reads[m_opargs[op.firstarg() + a]];
+                dead[i] = 1;
+                changed = true;
+                continue;
+            }
+
+            // "op $tmp ...; assign x $tmp", where that's all $tmp is for,
+            // becomes "op x ...".
+            if (i + 1 >= nops || target[i + 1] || op_writes_part(op.opname()))
+                continue;
+            Opcode& next(m_ircode[i + 1]);
+            if (next.opname() != assign || next.nargs() != 2
+                || next.method() != op.method()
+                || m_opargs[next.firstarg() + 1] != R
+                || R->symtype() != SymTypeTemp || reads[R] != 1
+                || writes[R] != 1)
+                continue;
+            Symbol* X = m_opargs[next.firstarg()];
+            if (X->symtype() == SymTypeConst || X->typespec() != R->typespec())
+                continue;
+            bool aliased = false;
+            for (int a = 1; a < op.nargs(); ++a)
+                aliased |= (m_opargs[op.firstarg() + a] == X);
+            if (aliased)
+                continue;
+            m_opargs[op.firstarg()] = X;
+            reads[R] = writes[R] = 0;
+            dead[i + 1]          = 1;
+            changed              = true;
+        }
+        remove_ops(dead);
+    }
+}
+
+
+};  // namespace pvt
+
+OSL_NAMESPACE_END
@@ -3,9 +3,16 @@
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
 
+#include <algorithm>
 #include <cerrno>
 #include <cstdio>
+#include <cstdlib>
+#include <ctime>
 #include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <streambuf>
 #include <string>
 #include <vector>
@@ -139,6 +146,204 @@ OSLCompilerImpl::preprocess_file(const std::string& filename,
 
 
 
+namespace {
+
+// Reads lines from the front of a cached file's contents.
+string_view
+next_line(string_view& rest)
+{
+    size_t eol       = std::min(rest.find('\n'), rest.size());
+    string_view line = rest.substr(0, eol);
+    rest.remove_prefix(std::min(eol + 1, rest.size()));
+    return line;
+}
+
+
+
+// Write then rename, so that concurrent compiles never see half a file.
+bool
+write_cache_file(const std::string& filename, const std::string& contents)
+{
+    std::string err;
+    std::string dir = OIIO::Filesystem::parent_path(filename);
+    if (dir.size() && !OIIO::Filesystem::is_directory(dir))
+        OIIO::Filesystem::create_directory(dir, err);
+    std::string tmp = OIIO::Filesystem::unique_path(filename + ".%%%%%%%%");
+    OIIO::ofstream out;
+    OIIO::Filesystem::open(out, tmp,
+                           std::ios_base::out | std::ios_base::binary);
+    out << contents;
+    out.close();
+    return out.good() && OIIO::Filesystem::rename(tmp, filename, err);
+}
+
+}  // namespace
+
+
+
+// The files a cached result was made from, with their modification
+// times, so that it can tell whether it is still current.
+struct FileStamps {
+    std::vector<std::pair<std::time_t, std::string>> files;  // mtime, path
+
+    void add(const std::string& path)
+    {
+        files.emplace_back(OIIO::Filesystem::last_write_time(path), path);
+    }
+
+    // Are all the files unchanged?
+    bool current() const
+    {
+        for (auto& f : files)
+            if (OIIO::Filesystem::last_write_time(f.second) != f.first)
+                return false;
+        return true;
+    }
+
+    // As text: "<nfiles>" then "<mtime> <path>" for each file, one a line.
+    std::string serialize() const
+    {
+        std::string s = OIIO::Strutil::fmt::format("{}\n", files.size());
+        for (auto& f : files)
+            s += OIIO::Strutil::fmt::format("{} {}\n", int64_t(f.first),
+                                            f.second);
+        return s;
+    }
+
+    bool deserialize(string_view& rest)
+    {
+        string_view count = next_line(rest);
+        int nfiles        = 0;
+        if (!OIIO::Strutil::parse_int(count, nfiles))
+            return false;
+        for (int i = 0; i < nfiles; ++i) {
+            string_view line = next_line(rest);
+            size_t space     = line.find(' ');
+            if (space == string_view::npos)
+                return false;
+            std::string mtime(line.substr(0, space));
+            files.emplace_back(std::time_t(strtoll(mtime.c_str(), nullptr, 10)),
+                               std::string(line.substr(space + 1)));
+        }
+        return true;
+    }
+};
+
+
+
+// The preprocessed prefix headers of a compile (stdosl.h and any -include
+// files), with the macros they leave defined and the files they read, so
+// that later compiles with the same prefix preprocess only the shader's
+// own source.
+struct PreprocessedHeaders {
+    std::string text;                 // Preprocessed output
+    std::vector<std::string> macros;  // In order, "-DNAME=body" or "-UNAME"
+    FileStamps files;
+
+    // Sort the output of preprocessing with macros shown into text and
+    // macros, and note the files named by its line markers.
+    void split(string_view preprocessed)
+    {
+        using OIIO::Strutil::fmt::format;
+        std::set<std::string> seen;
+        bool predefined = false;  // In <built-in> or <command line>?
+        for (string_view line : OIIO::Strutil::splitsv(preprocessed, "\n")) {
+            string_view rest = line;
+            if (predefined
+                && (OIIO::Strutil::starts_with(rest, "#define ")
+                    || OIIO::Strutil::starts_with(rest, "#undef ")))
+                continue;  // Clang predefines these again, and so do we
+            if (OIIO::Strutil::parse_prefix(rest, "#define ")) {
+                // "NAME body" or "NAME(args) body" becomes "-DNAME=body"
+                size_t end   = std::min(rest.find(' '), rest.size());
+                size_t paren = rest.find('(');
+                if (paren < end && rest.find(')') != string_view::npos)
+                    end = rest.find(')') + 1;
+                string_view body = rest.substr(std::min(end + 1, rest.size()));
+                macros.push_back(format("-D{}={}", rest.substr(0, end), body));
+                continue;
+            }
+            if (OIIO::Strutil::parse_prefix(rest, "#undef ")) {
+                macros.push_back(format("-U{}", rest));
+                continue;
+            }
+            text += line;
+            text += '\n';
+            // Line markers look like: # 12 "path" flags
+            size_t open = line.find('"'), close = line.rfind('"');
+            if (OIIO::Strutil::starts_with(line, "# ") && open < close) {
+                std::string path = OIIO::Strutil::unescape_chars(
+                    line.substr(open + 1, close - open - 1));
+                predefined = path.size() && path[0] == '<'
+                             && path != "<headers>";
+                if (path.size() && path[0] != '<' && seen.insert(path).second)
+                    files.add(path);
+            }
+        }
+    }
+
+    // Save to, or load from, a cache file: the file stamps, "<nmacros>",
+    // each macro on a line, then the text.
+    bool write(const std::string& filename) const
+    {
+        std::string contents = files.serialize();
+        contents += OIIO::Strutil::fmt::format("{}\n", macros.size());
+        for (auto& m : macros)
+            contents += m + "\n";
+        contents += text;
+        return write_cache_file(filename, contents);
+    }
+
+    bool read(const std::string& filename)
+    {
+        std::string contents;
+        if (!OIIO::Filesystem::read_text_file(filename, contents))
+            return false;
+        string_view rest  = contents;
+        string_view count = (files.deserialize(rest) ? next_line(rest)
+                                                     : string_view());
+        int nmacros       = 0;
+        if (!OIIO::Strutil::parse_int(count, nmacros))
+            return false;
+        for (int i = 0; i < nmacros; ++i)
+            macros.emplace_back(next_line(rest));
+        text = rest;
+        return true;
+    }
+};
+
+
+
+// The result of a successful compile_buffer(), with the files it read.
+struct CompiledBuffer {
+    std::string output_filename;
+    std::string oso;
+    FileStamps files;
+
+    // Save to, or load from, a cache file: the file stamps, the output
+    // filename on a line, then the oso.
+    bool write(const std::string& filename) const
+    {
+        return write_cache_file(filename, files.serialize() + output_filename
+                                              + "\n" + oso);
+    }
+
+    bool read(const std::string& filename)
+    {
+        std::string contents;
+        if (!OIIO::Filesystem::read_text_file(filename, contents))
+            return false;
+        string_view rest = contents;
+        if (!files.deserialize(rest))
+            return false;
+        output_filename = next_line(rest);
+        oso             = rest;
+        return oso.size() > 0;
+    }
+};
+
+
+
 bool
 OSLCompilerImpl::preprocess_buffer(const std::string& buffer,
                                    const std::string& filename,
@@ -148,19 +353,106 @@ OSLCompilerImpl::preprocess_buffer(const std::string& buffer,
                                    std::string& result)
 {
     using OIIO::Strutil::fmt::format;
-    std::string instring;
+    // The prefix: stdosl.h, then any -include files.
+    std::string prefix;
     if (!stdoslpath.empty()) {
-        instring = format("#include \"{}\"\n",
-                          OIIO::Strutil::escape_chars(stdoslpath));
+        prefix = format("#include \"{}\"\n",
+                        OIIO::Strutil::escape_chars(stdoslpath));
         // Note: because we're turning this from a regular string into a
         // double-quoted string injected into the OSL parse stream, we need
         // to fully escape any backslashes used in Windows file paths. We
         // don't want "c:\path\to\new\osl" to be interpreted as
         // "c:\path<tab>o<newline>ew\osl" !
-    } else {
-        instring = "\n";
     }
-    instring += buffer;
+    for (auto&& inc : m_prefix_includes)
+        prefix += format("#include \"{}\"\n",
+                         OIIO::Strutil::escape_chars(inc));
+    if (m_prefix_includes.size())
+        prefix += "#line 2\n";  // as if after just stdosl.h (see osllex.l)
+
+    if (prefix.empty() || m_header_cache_dir.empty())
+        return run_preprocessor((prefix.size() ? prefix : "\n") + buffer,
+                                filename, defines, includepaths, false,
+                                result);
+
+    // Preprocess just the shader's own source, starting from the macros
+    // left by the (cached) preprocessed prefix.
+    std::string directory = OIIO::Filesystem::parent_path(filename);
+    if (directory.empty())
+        directory = OIIO::Filesystem::current_path();
+    std::shared_ptr<const PreprocessedHeaders> headers
+        = prefix_headers(prefix, directory, defines, includepaths);
+    if (!headers)
+        return false;
+    std::vector<std::string> macros = defines;
+    macros.insert(macros.end(), headers->macros.begin(),
+                  headers->macros.end());
+    std::string own;
+    if (!run_preprocessor("\n" + buffer, filename, macros, includepaths,
+                          false, own))
+        return false;
+    result = headers->text + own;
+    return true;
+}
+
+
+
+// Find the preprocessed prefix headers, from memory if this process has
+// already seen them, else from the header cache directory, else by
+// preprocessing them (and saving that to the cache).
+std::shared_ptr<const PreprocessedHeaders>
+OSLCompilerImpl::prefix_headers(const std::string& prefix,
+                                const std::string& directory,
+                                const std::vector<std::string>& defines,
+                                const std::vector<std::string>& includepaths)
+{
+    using OIIO::Strutil::fmt::format;
+    static std::mutex memo_mutex;
+    static std::map<std::string, std::shared_ptr<const PreprocessedHeaders>>
+        memo;
+
+    // Includes relative to the shader's directory are among the paths.
+    std::vector<std::string> paths(1, directory);
+    paths.insert(paths.end(), includepaths.begin(), includepaths.end());
+    std::string key = format("{}\n{}\n{}\n{}", OSL_LIBRARY_VERSION_STRING,
+                             prefix, OIIO::Strutil::join(defines, "\n"),
+                             OIIO::Strutil::join(paths, "\n"));
+    {
+        std::lock_guard<std::mutex> lock(memo_mutex);
+        auto found = memo.find(key);
+        if (found != memo.end() && found->second->files.current())
+            return found->second;
+    }
+
+    std::string cachefile = format("{}/{:016x}.oslh", m_header_cache_dir,
+                                   uint64_t(OIIO::Strutil::strhash(key)));
+    auto headers = std::make_shared<PreprocessedHeaders>();
+    if (!headers->read(cachefile) || !headers->files.current()) {
+        headers = std::make_shared<PreprocessedHeaders>();
+        std::string preprocessed;
+        if (!run_preprocessor(prefix, "<headers>", defines, paths, true,
+                              preprocessed))
+            return nullptr;
+        headers->split(preprocessed);
+        if (!headers->write(cachefile))
+            warningfmt(ustring(), 0, "Could not write header cache \"{}\"",
+                       cachefile);
+    }
+    std::lock_guard<std::mutex> lock(memo_mutex);
+    memo[key] = headers;
+    return headers;
+}
+
+
+
+bool
+OSLCompilerImpl::run_preprocessor(const std::string& instring,
+                                  const std::string& filename,
+                                  const std::vector<std::string>& defines,
+                                  const std::vector<std::string>& includepaths,
+                                  bool show_macros, std::string& result)
+{
+    using OIIO::Strutil::fmt::format;
     std::unique_ptr<llvm::MemoryBuffer> mbuf(
         llvm::MemoryBuffer::getMemBuffer(instring, filename));
 
@@ -210,7 +502,7 @@ OSLCompilerImpl::preprocess_buffer(const std::string& buffer,
     sm.setMainFileID(sm.createFileID(std::move(mbuf), clang::SrcMgr::C_User));
 
     inst.getPreprocessorOutputOpts().ShowCPP               = 1;
-    inst.getPreprocessorOutputOpts().ShowMacros            = 0;
+    inst.getPreprocessorOutputOpts().ShowMacros            = show_macros;
     inst.getPreprocessorOutputOpts().ShowComments          = 0;
     inst.getPreprocessorOutputOpts().ShowLineMarkers       = 1;
     inst.getPreprocessorOutputOpts().ShowMacroComments     = 0;
@@ -274,6 +566,9 @@ OSLCompilerImpl::read_compile_options(const std::vector<std::string>& options,
                                       std::vector<std::string>& includepaths)
 {
     m_output_filename.clear();
+    m_header_cache_dir.clear();
+    m_prefix_includes.clear();
+    m_compile_cache_dir.clear();
     m_preprocess_only = false;
     for (size_t i = 0; i < options.size(); ++i) {
         if (options[i] == "-v") {
@@ -323,6 +618,12 @@ OSLCompilerImpl::read_compile_options(const std::vector<std::string>& options,
             m_preprocess_only = true;
             if (m_deps_filename.empty())
                 m_deps_filename = "stdout";
+        } else if (options[i] == "-include" && i < options.size() - 1) {
+            m_prefix_includes.push_back(options[++i]);
+        } else if (options[i] == "-header-cache" && i < options.size() - 1) {
+            m_header_cache_dir = options[++i];
+        } else if (options[i] == "-compile-cache" && i < options.size() - 1) {
+            m_compile_cache_dir = options[++i];
         } else if (options[i] == "-MF") {
             m_deps_filename = options[++i];
         } else if (OIIO::Strutil::starts_with(options[i], "-MF")) {
@@ -343,10 +644,9 @@ OSLCompilerImpl::read_compile_options(const std::vector<std::string>& options,
 
 
 
-// Guess the path for stdosl.h. This is only called if no explicit
-// stdoslpath is given to the compile command.
+// Guess the path for stdosl.h.
 static string_view
-find_stdoslpath(const std::vector<std::string>& includepaths)
+search_stdoslpath(const std::vector<std::string>& includepaths)
 {
     // Try the user-supplied include paths first
     for (auto& dir : includepaths) {
@@ -416,6 +716,32 @@ find_stdoslpath(const std::vector<std::string>& includepaths)
 
 
 
+// Find the path for stdosl.h. This is only called if no explicit
+// stdoslpath is given to the compile command. The search probes many
+// files, so its answer for each set of include paths is remembered for
+// the next shader compiled by this process.
+static string_view
+find_stdoslpath(const std::vector<std::string>& includepaths)
+{
+    static std::mutex found_mutex;
+    static std::map<std::vector<std::string>, ustring> found;
+    std::lock_guard<std::mutex> lock(found_mutex);
+    auto f = found.find(includepaths);
+    if (f == found.end())
+        f = found.emplace(includepaths, ustring(search_stdoslpath(includepaths)))
+                .first;
+    return f->second;
+}
+
+
+
+// Past preprocessing, the compiler shares global state (such as the
+// registry of struct types), so shaders being compiled by several threads
+// at once take turns there.
+static std::mutex frontend_mutex;
+
+
+
 bool
 OSLCompilerImpl::compile(string_view filename,
                          const std::vector<std::string>& options,
@@ -451,6 +777,7 @@ OSLCompilerImpl::compile(string_view filename,
                          preprocess_result)) {
         return false;
     }
+    std::lock_guard<std::mutex> frontend_lock(frontend_mutex);
 
     if (m_preprocess_only && !m_generate_deps) {
         std::cout << preprocess_result;
@@ -475,6 +802,8 @@ OSLCompilerImpl::compile(string_view filename,
 
         if (!error_encountered()) {
             shader()->codegen();
+            if (m_optimizelevel >= 2)
+                optimize_ircode();
             track_variable_dependencies();
             track_variable_lifetimes();
             check_for_illegal_writes();
@@ -526,8 +855,25 @@ OSLCompilerImpl::compile_buffer(string_view sourcecode, std::string& osobuffer,
     std::vector<std::string> includepaths;
     read_compile_options(options, defines, includepaths);
 
+    // The same source compiled the same way, with unchanged headers,
+    // gives the same oso, so an earlier result may stand in for it. Only
+    // compiles without warnings are kept, so a hit is not missing any.
+    bool cacheable = !m_preprocess_only && !m_debug && !m_generate_deps;
+    std::string cachekey;
+    if (cacheable) {
+        cachekey = OIIO::Strutil::fmt::format(
+            "{}\n{}\n{}\n{}\n{}", OSL_LIBRARY_VERSION_STRING, filename,
+            stdoslpath, OIIO::Strutil::join(options, "\n"), sourcecode);
+        if (auto compiled = find_compiled_buffer(cachekey)) {
+            m_output_filename = compiled->output_filename;
+            osobuffer         = compiled->oso;
+            return true;
+        }
+    }
+
     m_cwd           = OIIO::Filesystem::current_path();
     m_main_filename = ustring(filename);
+    m_nwarnings     = 0;
     clear_filecontents_cache();
 
     // Determine where the installed shader include directory is, and
@@ -543,6 +889,7 @@ OSLCompilerImpl::compile_buffer(string_view sourcecode, std::string& osobuffer,
                            includepaths, preprocess_result)) {
         return false;
     }
+    std::lock_guard<std::mutex> frontend_lock(frontend_mutex);
 
     if (m_preprocess_only) {
         std::cout << preprocess_result;
@@ -564,6 +911,8 @@ OSLCompilerImpl::compile_buffer(string_view sourcecode, std::string& osobuffer,
 
         if (!error_encountered()) {
             shader()->codegen();
+            if (m_optimizelevel >= 2)
+                optimize_ircode();
             track_variable_dependencies();
             track_variable_lifetimes();
             check_for_illegal_writes();
@@ -584,6 +933,8 @@ OSLCompilerImpl::compile_buffer(string_view sourcecode, std::string& osobuffer,
                            preprocess_result);
             osobuffer = oso_output.str();
             OSL_DASSERT(m_osofile == nullptr);
+            if (cacheable && !m_nwarnings && !error_encountered())
+                save_compiled_buffer(cachekey, osobuffer);
         }
     }
 
@@ -592,6 +943,64 @@ OSLCompilerImpl::compile_buffer(string_view sourcecode, std::string& osobuffer,
 
 
 
+namespace {
+std::mutex compiled_buffers_mutex;
+std::map<uint64_t, std::shared_ptr<const CompiledBuffer>> compiled_buffers;
+}  // namespace
+
+
+
+std::shared_ptr<const CompiledBuffer>
+OSLCompilerImpl::find_compiled_buffer(const std::string& key)
+{
+    uint64_t hash = OIIO::Strutil::strhash(key);
+    {
+        std::lock_guard<std::mutex> lock(compiled_buffers_mutex);
+        auto found = compiled_buffers.find(hash);
+        if (found != compiled_buffers.end()) {
+            if (found->second->files.current())
+                return found->second;
+            compiled_buffers.erase(found);
+        }
+    }
+    if (m_compile_cache_dir.empty())
+        return nullptr;
+    auto compiled = std::make_shared<CompiledBuffer>();
+    if (!compiled->read(OIIO::Strutil::fmt::format("{}/{:016x}.osocache",
+                                                   m_compile_cache_dir, hash))
+        || !compiled->files.current())
+        return nullptr;
+    std::lock_guard<std::mutex> lock(compiled_buffers_mutex);
+    compiled_buffers[hash] = compiled;
+    return compiled;
+}
+
+
+
+void
+OSLCompilerImpl::save_compiled_buffer(const std::string& key,
+                                      const std::string& osobuffer)
+{
+    auto compiled             = std::make_shared<CompiledBuffer>();
+    compiled->output_filename = m_output_filename;
+    compiled->oso             = osobuffer;
+    for (ustring dep : m_file_dependencies)
+        if (!OIIO::Strutil::starts_with(dep, "<"))
+            compiled->files.add(dep.string());
+    uint64_t hash = OIIO::Strutil::strhash(key);
+    if (m_compile_cache_dir.size()) {
+        std::string cachefile = OIIO::Strutil::fmt::format(
+            "{}/{:016x}.osocache", m_compile_cache_dir, hash);
+        if (!compiled->write(cachefile))
+            warningfmt(ustring(), 0, "Could not write compile cache \"{}\"",
+                       cachefile);
+    }
+    std::lock_guard<std::mutex> lock(compiled_buffers_mutex);
+    compiled_buffers[hash] = compiled;
+}
+
+
+
 void
 OSLCompilerImpl::write_dependency_file(string_view filename)
 {
@@ -706,6 +1115,58 @@ OSLCompilerImpl::write_oso_metadata(const ASTNode* metanode) const
 
 
 
+// Static estimates of what the shader costs to run and to compile, for
+// tools that want to know without reading the code, and for the runtime
+// to order its compiles by. Written as "%cost{name=value,...}"; readers
+// skip names they don't know, so more can be added.
+void
+OSLCompilerImpl::write_oso_cost() const
+{
+    static const ustring arith[]
+        = { ustring("add"),         ustring("sub"),      ustring("mul"),
+            ustring("div"),         ustring("mod"),      ustring("neg"),
+            ustring("abs"),         ustring("fabs"),     ustring("sqrt"),
+            ustring("inversesqrt"), ustring("exp"),      ustring("exp2"),
+            ustring("log"),         ustring("log2"),     ustring("pow"),
+            ustring("sin"),         ustring("cos"),      ustring("tan"),
+            ustring("asin"),        ustring("acos"),     ustring("atan"),
+            ustring("atan2"),       ustring("sincos"),   ustring("floor"),
+            ustring("ceil"),        ustring("fmod"),     ustring("min"),
+            ustring("max"),         ustring("clamp"),    ustring("mix"),
+            ustring("step"),        ustring("smoothstep"), ustring("dot"),
+            ustring("cross"),       ustring("length"),   ustring("distance"),
+            ustring("normalize") };
+    static ustring texture("texture"), texture3d("texture3d"),
+        environment("environment"), trace("trace"), u_for("for"),
+        u_while("while"), dowhile("dowhile");
+
+    int narith = 0, ntexture = 0, nnoise = 0, ntrace = 0, nloops = 0;
+    int nderivs = 0;
+    for (auto& op : m_ircode) {
+        ustring opname = op.opname();
+        for (auto&& a : arith)
+            if (opname == a) {
+                ++narith;
+                break;
+            }
+        if (opname == texture || opname == texture3d || opname == environment)
+            ++ntexture;
+        else if (OIIO::Strutil::contains(opname, "noise"))
+            ++nnoise;
+        else if (opname == trace)
+            ++ntrace;
+        else if (opname == u_for || opname == u_while || opname == dowhile)
+            ++nloops;
+        if (op.argtakesderivs_all())
+            ++nderivs;
+    }
+    osofmt("%cost{{ops={},arith={},texture={},noise={},trace={},loops={},"
+           "derivs={}}} ",
+           m_ircode.size(), narith, ntexture, nnoise, ntrace, nloops, nderivs);
+}
+
+
+
 void
 OSLCompilerImpl::write_oso_const_value(const ConstantSymbol* sym) const
 {
@@ -869,12 +1330,10 @@ OSLCompilerImpl::write_oso_file(string_view options,
     osofmt("{} {}", shaderdecl->shadertypename(), shaderdecl->shadername());
 
     // output global hints and metadata
-    int hints = 0;
-    for (ASTNode::ref m = shaderdecl->metadata(); m; m = m->next()) {
-        if (hints++ == 0)
-            osofmt("\t");
+    osofmt("\t");
+    for (ASTNode::ref m = shaderdecl->metadata(); m; m = m->next())
         write_oso_metadata(m.get());
-    }
+    write_oso_cost();
 
     osofmt("\n");
 
@@ -5,8 +5,10 @@
 #pragma once
 
 #include <map>
+#include <memory>
 #include <set>
 #include <stack>
+#include <unordered_map>
 #include <vector>
 
 #include <OSL/genclosure.h>
@@ -31,6 +33,9 @@ typedef std::set<const Symbol*> SymPtrSet;
 /// depends on it).
 typedef std::map<const Symbol*, SymPtrSet> SymDependencyMap;
 
+struct PreprocessedHeaders;
+struct CompiledBuffer;
+
 
 
 class OSLCompilerImpl {
@@ -106,6 +111,7 @@ public:
             errorfmt(filename, line, "{}", msg);
             return;
         }
+        ++m_nwarnings;
         if (filename.size())
             m_errhandler->warningfmt("{}:{}: warning: {}", filename, line, msg);
         else
@@ -165,6 +171,30 @@ public:
                            const std::vector<std::string>& includepaths,
                            std::string& result);
 
+    /// Run the preprocessor over instring, optionally leaving the macro
+    /// definitions in the output.
+    bool run_preprocessor(const std::string& instring,
+                          const std::string& filename,
+                          const std::vector<std::string>& defines,
+                          const std::vector<std::string>& includepaths,
+                          bool show_macros, std::string& result);
+
+    /// The preprocessed form of the prefix headers (stdosl.h and any
+    /// -include files), or nullptr if they fail to preprocess.
+    std::shared_ptr<const PreprocessedHeaders>
+    prefix_headers(const std::string& prefix, const std::string& directory,
+                   const std::vector<std::string>& defines,
+                   const std::vector<std::string>& includepaths);
+
+    /// A still-current earlier compile_buffer() result for the key, from
+    /// memory or the compile cache directory, or nullptr.
+    std::shared_ptr<const CompiledBuffer>
+    find_compiled_buffer(const std::string& key);
+
+    /// Remember a successful compile_buffer() result for the key.
+    void save_compiled_buffer(const std::string& key,
+                              const std::string& osobuffer);
+
     /// Has a shader already been defined?
     bool shader_is_defined() const { return (bool)m_shader; }
 
@@ -181,6 +211,14 @@ public:
     SymbolTable& symtab() { return m_symtab; }
     const SymbolTable& symtab() const { return m_symtab; }
 
+    /// Function calls resolved so far to a single overload, keyed by the
+    /// overload set, expected return type and argument types (see
+    /// ASTfunction_call::typecheck).
+    typedef std::unordered_map<std::string,
+                               std::pair<FunctionSymbol*, TypeSpec>>
+        ResolvedOverloads;
+    ResolvedOverloads& resolved_overloads() { return m_overloads; }
+
     TypeSpec current_typespec() const { return m_current_typespec; }
     void current_typespec(TypeSpec t) { m_current_typespec = t; }
     bool current_output() const { return m_current_output; }
@@ -359,6 +397,7 @@ private:
     void write_oso_const_value(const ConstantSymbol* sym) const;
     void write_oso_symbol(const Symbol* sym);
     void write_oso_metadata(const ASTNode* metanode) const;
+    void write_oso_cost() const;
     void write_dependency_file(string_view filename);
 
     // Output text to the osofile, using std::format formatting conventions.
@@ -377,6 +416,19 @@ private:
     void track_variable_dependencies();
     void coalesce_temporaries() { coalesce_temporaries(m_symtab.allsyms()); }
 
+    /// With -O2, clean up the generated code before writing it out:
+    /// constant folding, dead code elimination and copy propagation of
+    /// temporaries, repeated until none of them find anything more.
+    void optimize_ircode();
+
+    /// If op is arithmetic on constants, turn it into an assign of the
+    /// result and return true.
+    bool fold_constant_op(Opcode& op);
+
+    /// Remove the ops marked in dead, renumbering jumps and param init
+    /// ranges to match.
+    void remove_ops(const std::vector<char>& dead);
+
     /// Scan through all the ops and make sure none of them write to
     /// things that are illegal (consts, non-output params, etc.).
     /// Must be called AFTER track_variable_lifetimes.
@@ -434,6 +486,7 @@ private:
     ASTNode::ref m_shader;                   ///< The shader's syntax tree
     ErrorHandler* m_errhandler;              ///< Error handler
     mutable bool m_err;                      ///< Has an error occurred?
+    mutable int m_nwarnings = 0;             ///< Warnings this compile
     SymbolTable m_symtab;                    ///< Symbol table
     std::vector<ASTNode::ref> m_func_decls;  ///< Ref-counted function decls
     TypeSpec m_current_typespec;             ///< Currently-declared type
@@ -445,6 +498,9 @@ private:
     bool m_generate_deps = false;  ///< Generate dependencies? -MD or -MMD?
     bool m_generate_system_deps = false;  ///< Generate system header deps? -MD
     bool m_embed_source         = false;  ///< Embed preprocessed source in oso?
+    std::string m_header_cache_dir;  ///< Where to cache prefix headers
+    std::vector<std::string> m_prefix_includes;  ///< -include files
+    std::string m_compile_cache_dir;  ///< Where to cache compile_buffer oso
     bool m_err_on_warning;                ///< Treat warnings as errors?
     int m_optimizelevel;                  ///< Optimization level
     OpcodeVec m_ircode;                   ///< Generated IR code
@@ -472,6 +528,7 @@ private:
     std::string m_deps_target;              ///< Custom target: -MF
     std::set<ustring> m_file_dependencies;  ///< All include file dependencies
     std::stack<TypeSpec> m_typespec_stack;  ///< Just for function_declaration
+    ResolvedOverloads m_overloads;          ///< See resolved_overloads()
 };
 
 
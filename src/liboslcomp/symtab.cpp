@@ -2,6 +2,7 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -173,25 +174,22 @@ Symbol::print(std::ostream& out, int maxvals) const
 Symbol*
 SymbolTable::find(ustring name, Symbol* last) const
 {
-    ScopeTableStack::const_reverse_iterator scopelevel;
-    scopelevel = m_scopetables.rbegin();
+    // m_visible holds, for each name, the symbol of every active scope
+    // that has one, innermost last, so that the lookup doesn't have to
+    // search every scope in turn.
+    VisibleTable::const_iterator v = m_visible.find(name);
+    if (v == m_visible.end())
+        return NULL;  // not found
+    const SymbolPtrVec& syms(v->second);
+    SymbolPtrVec::const_reverse_iterator s = syms.rbegin();
     if (last) {
         // We only want to match OUTSIDE the scope of 'last'.  So first
         // search for last.  Then advance to the next outer scope.
-        for (; scopelevel != m_scopetables.rend(); ++scopelevel) {
-            ScopeTable::const_iterator s = scopelevel->find(name);
-            if (s != scopelevel->end() && s->second == last) {
-                ++scopelevel;
-                break;
-            }
-        }
-    }
-    for (; scopelevel != m_scopetables.rend(); ++scopelevel) {
-        ScopeTable::const_iterator s = scopelevel->find(name);
-        if (s != scopelevel->end())
-            return s->second;
+        s = std::find(syms.rbegin(), syms.rend(), last);
+        if (s != syms.rend())
+            ++s;
     }
-    return NULL;  // not found
+    return s != syms.rend() ? *s : NULL;
 }
 
 
@@ -219,7 +217,17 @@ SymbolTable::insert(Symbol* sym)
 {
     OSL_DASSERT(sym != NULL);
     sym->scope(scopeid());
-    m_scopetables.back()[sym->name()] = sym;
+    Symbol*& slot         = m_scopetables.back()[sym->name()];
+    SymbolPtrVec& visible = m_visible[sym->name()];
+    if (slot) {
+        // Replacing a symbol of the inner scope, necessarily the
+        // innermost visible one.
+        OSL_DASSERT(!visible.empty() && visible.back() == slot);
+        visible.back() = sym;
+    } else {
+        visible.push_back(sym);
+    }
+    slot = sym;
     m_allsyms.push_back(sym);
     m_allmangled[ustring(sym->mangled())] = sym;
 }
@@ -267,6 +275,13 @@ SymbolTable::push()
 void
 SymbolTable::pop()
 {
+    for (auto& s : m_scopetables.back()) {
+        VisibleTable::iterator v = m_visible.find(s.first);
+        OSL_DASSERT(v != m_visible.end() && v->second.back() == s.second);
+        v->second.pop_back();
+        if (v->second.empty())
+            m_visible.erase(v);
+    }
     m_scopetables.resize(m_scopetables.size() - 1);
     OSL_DASSERT(!m_scopestack.empty());
     m_scopeid = m_scopestack.top();
@@ -185,6 +185,7 @@ class SymbolTable {
 public:
     typedef std::unordered_map<ustring, Symbol*> ScopeTable;
     typedef std::vector<ScopeTable> ScopeTableStack;
+    typedef std::unordered_map<ustring, SymbolPtrVec> VisibleTable;
     typedef SymbolPtrVec::iterator iterator;
     typedef SymbolPtrVec::const_iterator const_iterator;
 
@@ -259,6 +260,7 @@ private:
     OSLCompilerImpl& m_comp;        ///< Back-reference to compiler
     SymbolPtrVec m_allsyms;         ///< Master list of all symbols
     ScopeTableStack m_scopetables;  ///< Stack of symbol scopes
+    VisibleTable m_visible;         ///< Active syms by name, innermost last
     std::stack<int> m_scopestack;   ///< Stack of current scope IDs
     ScopeTable m_allmangled;        ///< All syms, mangled, in a hash table
     int m_scopeid;                  ///< Current scope ID
@@ -1367,9 +1367,15 @@ ASTfunction_call::typecheck_builtin_specialcase()
                 ASTliteral* lit = (arg->nodetype() == ASTNode::literal_node)
                                       ? (ASTliteral*)arg
                                       : NULL;
-                if (!lit || (lit->ustrval() == "gabor")) {
+                if (!lit || lit->ustrval() == "gabor"
+                    || lit->ustrval() == "fbm"
+                    || lit->ustrval() == "turbulence"
+                    || lit->ustrval() == "ridged"
+                    || lit->ustrval() == "baked") {
                     // unspecified (not a string literal), or known to be
-                    // gabor -- take derivs of positional arguments
+                    // a type that filters or differentiates its lookups
+                    // (gabor, fractal, baked) -- take derivs of positional
+                    // arguments
                     arg = arg->nextptr();  // advance to position
                     for (int n = 2; arg && !arg->typespec().is_string(); ++n) {
                         argtakesderivs(n, true);
@@ -1875,6 +1881,9 @@ public:
 
     // Remove when LegacyOverload checking is removed.
     bool hadinitlist() const { return m_had_initlist; }
+
+    // Was there a single best candidate, chosen without any ambiguity?
+    bool unambiguous() const { return m_candidates.size() == 1; }
 };
 
 
@@ -1999,37 +2008,67 @@ ASTfunction_call::typecheck(TypeSpec expected)
     // Save the currently chosen symbol for error reporting later
     FunctionSymbol* poly = func();
 
-    CandidateFunctions candidates(m_compiler, expected, args(), poly);
-    std::tie(m_sym, m_typespec) = candidates.best(this, m_name);
-
-    // Check resolution against prior versions of OSL.
-    // Skip the check if any arguments used initializer list syntax.
+    // Generated shaders make the same calls over and over, so remember
+    // each unambiguous resolution by everything it depends on: the
+    // overloads, the expected return type and the argument types. Not for
+    // initializer lists, which are bound as they are resolved, nor when
+    // checking against the legacy resolution.
     static const char* OSL_LEGACY = ::getenv("OSL_LEGACY_FUNCTION_RESOLUTION");
-    if (!candidates.hadinitlist() && OSL_LEGACY && strcmp(OSL_LEGACY, "0")) {
-        auto* legacy = LegacyOverload(m_compiler, this, poly,
-                                      &ASTfunction_call::check_arglist)(
-            expected);
-        if (m_sym != legacy) {
-            bool as_warning = true;
-            if (Strutil::iequals(OSL_LEGACY, "err"))
-                as_warning = false;  // full error
-            std::string errmsg = "  Current overload is\n";
-            if (m_sym)
-                errmsg += candidates.reportFunction(
-                    static_cast<FunctionSymbol*>(m_sym));
-            else
-                errmsg += "<none>";
-            errmsg += "\n  Prior overload was ";
-            if (legacy)
-                errmsg += candidates.reportFunction(legacy);
-            else
-                errmsg += "<none>";
-            if (Strutil::iequals(OSL_LEGACY, "use"))
-                m_sym = legacy;
-            if (as_warning)
-                warningfmt("overload chosen differs from OSL 1.9\n{}", errmsg);
-            else
-                errorfmt("overload chosen differs from OSL 1.9\n{}", errmsg);
+    std::string overload_key;
+    if (!any_args_are_compound_initializers
+        && !(OSL_LEGACY && strcmp(OSL_LEGACY, "0"))) {
+        overload_key = Strutil::fmt::format("{} {}:{}", (const void*)poly,
+                                            expected.string(),
+                                            expected.structure());
+        for (ref arg = args(); arg; arg = arg->next())
+            overload_key += Strutil::fmt::format(" {}:{}",
+                                                 arg->typespec().string(),
+                                                 arg->typespec().structure());
+    }
+    auto& resolved = m_compiler->resolved_overloads();
+    auto found     = overload_key.empty() ? resolved.end()
+                                          : resolved.find(overload_key);
+    if (found != resolved.end()) {
+        std::tie(m_sym, m_typespec) = found->second;
+    } else {
+        CandidateFunctions candidates(m_compiler, expected, args(), poly);
+        std::tie(m_sym, m_typespec) = candidates.best(this, m_name);
+        if (!overload_key.empty() && m_sym && candidates.unambiguous())
+            resolved.emplace(overload_key,
+                             std::make_pair(static_cast<FunctionSymbol*>(m_sym),
+                                            m_typespec));
+
+        // Check resolution against prior versions of OSL.
+        // Skip the check if any arguments used initializer list syntax.
+        if (!candidates.hadinitlist() && OSL_LEGACY
+            && strcmp(OSL_LEGACY, "0")) {
+            auto* legacy = LegacyOverload(m_compiler, this, poly,
+                                          &ASTfunction_call::check_arglist)(
+                expected);
+            if (m_sym != legacy) {
+                bool as_warning = true;
+                if (Strutil::iequals(OSL_LEGACY, "err"))
+                    as_warning = false;  // full error
+                std::string errmsg = "  Current overload is\n";
+                if (m_sym)
+                    errmsg += candidates.reportFunction(
+                        static_cast<FunctionSymbol*>(m_sym));
+                else
+                    errmsg += "<none>";
+                errmsg += "\n  Prior overload was ";
+                if (legacy)
+                    errmsg += candidates.reportFunction(legacy);
+                else
+                    errmsg += "<none>";
+                if (Strutil::iequals(OSL_LEGACY, "use"))
+                    m_sym = legacy;
+                if (as_warning)
+                    warningfmt("overload chosen differs from OSL 1.9\n{}",
+                               errmsg);
+                else
+                    errorfmt("overload chosen differs from OSL 1.9\n{}",
+                             errmsg);
+            }
         }
     }
 
@@ -2,6 +2,10 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+
 #include <OSL/accum.h>
 #include <OSL/oslclosure.h>
 #include "lpeparse.h"
@@ -12,10 +16,8 @@ OSL_NAMESPACE_BEGIN
 
 
 void
-AovOutput::flush(void* flush_data)
+AovOutput::resolve()
 {
-    if (!aov)
-        return;
     if (neg_color) {
         color.setValue(1.0f - color.x, 1.0f - color.y, 1.0f - color.z);
         has_color = true;
@@ -24,12 +26,115 @@ AovOutput::flush(void* flush_data)
         alpha     = 1.0f - alpha;
         has_alpha = true;
     }
+}
 
+
+
+void
+AovOutput::flush(void* flush_data)
+{
+    if (!aov)
+        return;
+    resolve();
     aov->write(flush_data, color, alpha, has_color, has_alpha);
 }
 
 
 
+// As many outputs as the rules of an automata need
+static int
+num_outputs(const AccumAutomata* accauto)
+{
+    int maxouts = 0;
+    for (const auto& i : accauto->getRuleList())
+        maxouts = std::max(i.getOutputIndex(), maxouts);
+    return maxouts + 1;
+}
+
+
+
+AovBuffers::AovBuffers(const AccumAutomata* accauto, int npixels,
+                       int nthreads)
+    : m_npixels(npixels)
+    , m_aovs(num_outputs(accauto), nullptr)
+    , m_threads(nthreads)
+{
+    // Each thread's buffer is allocated on its own, so threads don't
+    // share cache lines except at the very ends.
+    for (auto& t : m_threads)
+        t.resize(size_t(npixels) * m_aovs.size());
+    m_reduced.resize(size_t(npixels) * m_aovs.size());
+}
+
+
+
+void
+AovBuffers::setAov(int outidx, Aov* aov)
+{
+    OSL_ASSERT(0 <= outidx && outidx < (int)m_aovs.size());
+    m_aovs[outidx] = aov;
+}
+
+
+
+void
+AovBuffers::clear()
+{
+    for (auto& t : m_threads)
+        std::fill(t.begin(), t.end(), Value());
+    std::fill(m_reduced.begin(), m_reduced.end(), Value());
+}
+
+
+
+void
+AovBuffers::add(int thread, int pixel, int outidx, const AovOutput& output)
+{
+    AovOutput resolved(output);
+    resolved.resolve();
+    Value& v = m_threads[thread][size_t(pixel) * m_aovs.size() + outidx];
+    v.color += resolved.color;
+    v.alpha += resolved.alpha;
+    v.has_color |= resolved.has_color;
+    v.has_alpha |= resolved.has_alpha;
+}
+
+
+
+void
+AovBuffers::reduce(int begin, int end)
+{
+    size_t first = size_t(begin) * m_aovs.size();
+    size_t last  = size_t(end) * m_aovs.size();
+    for (size_t i = first; i < last; ++i) {
+        Value sum;
+        // Always in the same order, so the sums come out the same
+        for (const auto& t : m_threads) {
+            sum.color += t[i].color;
+            sum.alpha += t[i].alpha;
+            sum.has_color |= t[i].has_color;
+            sum.has_alpha |= t[i].has_alpha;
+        }
+        m_reduced[i] = sum;
+    }
+}
+
+
+
+void
+AovBuffers::flush(int pixel, void* flush_data)
+{
+    for (size_t o = 0; o < m_aovs.size(); ++o) {
+        if (!m_aovs[o])
+            continue;
+        Value v = m_reduced[size_t(pixel) * m_aovs.size() + o];
+        m_aovs[o]->write(flush_data, v.color, v.alpha, v.has_color,
+                         v.has_alpha);
+    }
+}
+
+
+
 void
 AccumRule::accum(const Color3& color, std::vector<AovOutput>& outputs) const
 {
@@ -68,24 +173,67 @@ AccumAutomata::addRule(const char* pattern, int outidx, bool toalpha)
     // it is a list, so as long as we don't remove it from there, the pointer is valid
     void* rule = (void*)&(m_accumrules.back());
     m_rules.push_back(new lpexp::Rule(e, rule));
+    m_rules_key += fmtformat("{}\n{} {}\n", pattern, outidx, int(toalpha));
     return &(m_accumrules.back());
 }
 
 
 
+// Compiled automata by the key of their rules, with the rules as their
+// index (plus one) in the rule list instead of pointers.
+static std::unordered_map<std::string, DfOptimizedAutomata> automata_cache;
+static std::mutex automata_cache_mutex;
+// Start over rather than grow without bound when rules keep changing
+static const size_t automata_cache_max = 64;
+
+
+
 void
 AccumAutomata::compile()
 {
-    NdfAutomata ndfautomata;
-    for (auto& r : m_rules) {
-        r->genAuto(ndfautomata);
-        delete r;
+    std::string key = m_rules_key;
+    for (auto&& s : m_user_events)
+        key += fmtformat("event {}\n", s);
+    for (auto&& s : m_user_scatterings)
+        key += fmtformat("scattering {}\n", s);
+    std::vector<AccumRule*> rules;
+    for (auto& r : m_accumrules)
+        rules.push_back(&r);
+
+    bool cached = false;
+    {
+        std::lock_guard<std::mutex> lock(automata_cache_mutex);
+        auto found = automata_cache.find(key);
+        if (found != automata_cache.end()) {
+            m_dfoptautomata = found->second;
+            cached          = true;
+        }
+    }
+    if (cached) {
+        m_dfoptautomata.mapRules(
+            [&](void* r) -> void* { return rules[size_t(r) - 1]; });
+    } else {
+        NdfAutomata ndfautomata;
+        for (auto& r : m_rules)
+            r->genAuto(ndfautomata);
+        DfAutomata dfautomata;
+        ndfautoToDfauto(ndfautomata, dfautomata);
+        m_dfoptautomata.compileFrom(dfautomata);
+
+        std::unordered_map<void*, size_t> index;
+        for (size_t i = 0; i < rules.size(); ++i)
+            index[rules[i]] = i + 1;
+        DfOptimizedAutomata indexed = m_dfoptautomata;
+        indexed.mapRules([&](void* r) -> void* { return (void*)index[r]; });
+        std::lock_guard<std::mutex> lock(automata_cache_mutex);
+        if (automata_cache.size() >= automata_cache_max)
+            automata_cache.clear();
+        automata_cache.emplace(key, std::move(indexed));
     }
     // Nuke the compiled regexps, we don't need them anymore
+    for (auto& r : m_rules)
+        delete r;
     m_rules.clear();
-    DfAutomata dfautomata;
-    ndfautoToDfauto(ndfautomata, dfautomata);
-    m_dfoptautomata.compileFrom(dfautomata);
 }
 
 
@@ -108,12 +256,8 @@ AccumAutomata::accum(int state, const Color3& color,
 Accumulator::Accumulator(const AccumAutomata* accauto)
     : m_accum_automata(accauto)
 {
-    const auto& rules = m_accum_automata->getRuleList();
     // Make sure we have as many outputs as the rules need
-    int maxouts = 0;
-    for (const auto& i : rules)
-        maxouts = std::max(i.getOutputIndex(), maxouts);
-    m_outputs.resize(maxouts + 1);
+    m_outputs.resize(num_outputs(m_accum_automata));
 
     // 0 is our initial state always
     m_state = 0;
@@ -201,4 +345,163 @@ Accumulator::end(void* flush_data)
         m_outputs[i].flush(flush_data);
 }
 
+
+
+void
+Accumulator::end(AovBuffers& buffers, int thread, int pixel)
+{
+    for (size_t i = 0; i < m_outputs.size(); ++i)
+        buffers.add(thread, pixel, int(i), m_outputs[i]);
+}
+
+
+
+
+BatchedAccumulator::BatchedAccumulator(const AccumAutomata* accauto, int size)
+    : m_accum_automata(accauto), m_size(size)
+{
+    m_outputs.resize(num_outputs(m_accum_automata));
+    m_color.resize(m_outputs.size() * 3 * size);
+    m_alpha.resize(m_outputs.size() * size);
+    m_has_color.resize(m_outputs.size() * size);
+    m_has_alpha.resize(m_outputs.size() * size);
+    m_states.assign(size, 0);
+}
+
+
+
+void
+BatchedAccumulator::setAov(int outidx, Aov* aov, bool neg_color,
+                           bool neg_alpha)
+{
+    OSL_ASSERT(0 <= outidx && outidx < (int)m_outputs.size());
+    m_outputs[outidx].aov       = aov;
+    m_outputs[outidx].neg_color = neg_color;
+    m_outputs[outidx].neg_alpha = neg_alpha;
+}
+
+
+
+void
+BatchedAccumulator::pushState()
+{
+    m_stack.insert(m_stack.end(), m_states.begin(), m_states.end());
+}
+
+
+
+void
+BatchedAccumulator::popState()
+{
+    OSL_ASSERT(m_stack.size() >= m_states.size());
+    std::copy(m_stack.end() - m_size, m_stack.end(), m_states.begin());
+    m_stack.resize(m_stack.size() - m_size);
+}
+
+
+
+void
+BatchedAccumulator::moveId(int symbol_id)
+{
+    const int* trans = m_accum_automata->getTransitionTable();
+    const int stride = m_accum_automata->numSymbols() + 1;
+    int* states      = m_states.data();
+    // Without branches, so that this can vectorize as gathers
+    for (int i = 0; i < m_size; ++i) {
+        int s     = states[i];
+        int next  = trans[std::max(s, 0) * stride + symbol_id];
+        states[i] = s < 0 ? s : next;
+    }
+}
+
+
+
+void
+BatchedAccumulator::moveIds(const int* symbol_ids)
+{
+    const int* trans = m_accum_automata->getTransitionTable();
+    const int stride = m_accum_automata->numSymbols() + 1;
+    int* states      = m_states.data();
+    for (int i = 0; i < m_size; ++i) {
+        int s     = states[i];
+        int id    = symbol_ids[i];
+        int next  = trans[std::max(s, 0) * stride + std::max(id, 0)];
+        states[i] = (s < 0 || id < 0) ? s : next;
+    }
+}
+
+
+
+void
+BatchedAccumulator::begin()
+{
+    std::fill(m_color.begin(), m_color.end(), 0.0f);
+    std::fill(m_alpha.begin(), m_alpha.end(), 0.0f);
+    std::fill(m_has_color.begin(), m_has_color.end(), 0);
+    std::fill(m_has_alpha.begin(), m_has_alpha.end(), 0);
+    std::fill(m_states.begin(), m_states.end(), 0);
+    m_stack.clear();
+}
+
+
+
+void
+BatchedAccumulator::accum(const Color3* colors)
+{
+    for (int i = 0; i < m_size; ++i) {
+        if (m_states[i] < 0)
+            continue;
+        int nrules         = 0;
+        void* const* rules = m_accum_automata->getRulesInState(m_states[i],
+                                                               nrules);
+        for (int r = 0; r < nrules; ++r) {
+            const AccumRule* rule = (const AccumRule*)rules[r];
+            size_t out            = size_t(rule->getOutputIndex()) * m_size + i;
+            if (rule->toAlpha()) {
+                m_alpha[out] += (colors[i].x + colors[i].y + colors[i].z)
+                                * 1.0f / 3.0f;
+                m_has_alpha[out] = true;
+            } else {
+                size_t c = size_t(rule->getOutputIndex()) * 3 * m_size + i;
+                m_color[c] += colors[i].x;
+                m_color[c + m_size] += colors[i].y;
+                m_color[c + 2 * m_size] += colors[i].z;
+                m_has_color[out] = true;
+            }
+        }
+    }
+}
+
+
+
+AovOutput
+BatchedAccumulator::getOutput(int path, int outidx) const
+{
+    AovOutput output(m_outputs[outidx]);
+    const float* c   = getColor(outidx, 0) + path;
+    output.color     = Color3(c[0], c[m_size], c[2 * m_size]);
+    output.alpha     = getAlpha(outidx)[path];
+    output.has_color = m_has_color[size_t(outidx) * m_size + path];
+    output.has_alpha = m_has_alpha[size_t(outidx) * m_size + path];
+    return output;
+}
+
+
+
+void
+BatchedAccumulator::end(int path, void* flush_data)
+{
+    for (size_t o = 0; o < m_outputs.size(); ++o)
+        getOutput(path, int(o)).flush(flush_data);
+}
+
+
+
+void
+BatchedAccumulator::end(int path, AovBuffers& buffers, int thread, int pixel)
+{
+    for (size_t o = 0; o < m_outputs.size(); ++o)
+        buffers.add(thread, pixel, int(o), getOutput(path, int(o)));
+}
+
 OSL_NAMESPACE_END
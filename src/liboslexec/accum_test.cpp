@@ -58,9 +58,13 @@ protected:
     std::vector<bool> m_received;
 };
 
-// Simulate the tracing of a path with the accumulator
+// Simulate the tracing of a path with the accumulator, moving by the
+// symbol ids from the automata if given one, and ending in a thread's
+// buffer (the test number is the pixel) if given them
 void
-simulate(Accumulator& accum, const char** events, size_t testno)
+simulate(Accumulator& accum, const char** events, size_t testno,
+         const AccumAutomata* ids = nullptr, AovBuffers* buffers = nullptr,
+         int thread = 0)
 {
     accum.begin();
     accum.pushState();
@@ -71,18 +75,62 @@ simulate(Accumulator& accum, const char** events, size_t testno)
         while (*e) {
             ustring sym(e, 1);
             // advance our state with the label
-            accum.move(sym);
+            if (ids)
+                accum.moveId(ids->getSymbolId(sym));
+            else
+                accum.move(sym);
             e++;
         }
         // always finish the hit with a stop label
-        accum.move(Labels::STOP);
+        if (ids)
+            accum.moveId(ids->getSymbolId(Labels::STOP));
+        else
+            accum.move(Labels::STOP);
         events++;
     }
     // Here is were we have reached a light, accumulate color
     accum.accum(Color3(1, 1, 1));
     // Restore state and flush
     accum.popState();
-    accum.end(reinterpret_cast<void*>(testno));
+    if (buffers)
+        accum.end(*buffers, thread, int(testno));
+    else
+        accum.end(reinterpret_cast<void*>(testno));
+}
+
+// Simulate tracing all the paths at once with a batched accumulator
+void
+simulate_batch(BatchedAccumulator& accum, const AccumAutomata& automata,
+               const TestPath* test)
+{
+    // The label ids of each path, a STOP after each hit
+    std::vector<std::vector<int>> ids(accum.size());
+    for (int i = 0; i < accum.size(); ++i) {
+        for (const char* const* events = test[i].path; *events; ++events) {
+            for (const char* e = *events; *e; ++e)
+                ids[i].push_back(automata.getSymbolId(ustring(e, 1)));
+            ids[i].push_back(automata.getSymbolId(Labels::STOP));
+        }
+    }
+    accum.begin();
+    accum.pushState();
+    // Move all paths a label at a time, the ones that are done stay put
+    std::vector<int> step(accum.size());
+    for (size_t n = 0;; ++n) {
+        bool any = false;
+        for (int i = 0; i < accum.size(); ++i) {
+            step[i] = n < ids[i].size() ? ids[i][n] : -1;
+            any |= step[i] >= 0;
+        }
+        if (!any)
+            break;
+        accum.moveIds(step.data());
+    }
+    std::vector<Color3> colors(accum.size(), Color3(1, 1, 1));
+    accum.accum(colors.data());
+    accum.popState();
+    for (int i = 0; i < accum.size(); ++i)
+        accum.end(i, reinterpret_cast<void*>(size_t(i)));
 }
 
 int
@@ -134,22 +182,23 @@ main()
         aovs.emplace_back(test, i);
 
     // Create the automata and add the rules
-    AccumAutomata automata;
-
-    automata.addEventType(ustring("U"));
-    automata.addScatteringType(ustring("Y"));
-
-    OIIO_CHECK_ASSERT(automata.addRule("C[SG]*D*L", beauty));
-    OIIO_CHECK_ASSERT(automata.addRule("C[SG]*D{2,3}L", diffuse2_3));
-    OIIO_CHECK_ASSERT(automata.addRule("C[SG]*D*<L.'3'>", light3));
-    OIIO_CHECK_ASSERT(automata.addRule("C[SG]*<.D'1'>D*L", object_1));
-    OIIO_CHECK_ASSERT(automata.addRule("C<.[SG]>+D*L", specular));
-    OIIO_CHECK_ASSERT(automata.addRule("CD+L", diffuse));
-    OIIO_CHECK_ASSERT(automata.addRule("CD+<Ts>L", transpshadow));
-    OIIO_CHECK_ASSERT(automata.addRule("C<R[^D]>+D*L", reflections));
-    OIIO_CHECK_ASSERT(automata.addRule("C([SG]*D){1,2}L", nocaustic));
-    OIIO_CHECK_ASSERT(automata.addRule("CDY+U", custom));
+    auto add_rules = [&](AccumAutomata& automata) {
+        automata.addEventType(ustring("U"));
+        automata.addScatteringType(ustring("Y"));
 
+        OIIO_CHECK_ASSERT(automata.addRule("C[SG]*D*L", beauty));
+        OIIO_CHECK_ASSERT(automata.addRule("C[SG]*D{2,3}L", diffuse2_3));
+        OIIO_CHECK_ASSERT(automata.addRule("C[SG]*D*<L.'3'>", light3));
+        OIIO_CHECK_ASSERT(automata.addRule("C[SG]*<.D'1'>D*L", object_1));
+        OIIO_CHECK_ASSERT(automata.addRule("C<.[SG]>+D*L", specular));
+        OIIO_CHECK_ASSERT(automata.addRule("CD+L", diffuse));
+        OIIO_CHECK_ASSERT(automata.addRule("CD+<Ts>L", transpshadow));
+        OIIO_CHECK_ASSERT(automata.addRule("C<R[^D]>+D*L", reflections));
+        OIIO_CHECK_ASSERT(automata.addRule("C([SG]*D){1,2}L", nocaustic));
+        OIIO_CHECK_ASSERT(automata.addRule("CDY+U", custom));
+    };
+    AccumAutomata automata;
+    add_rules(automata);
     automata.compile();
 
     // now create the accumulator
@@ -175,6 +224,56 @@ main()
     OIIO_CHECK_ASSERT(aovs[reflections].check());
     OIIO_CHECK_ASSERT(aovs[nocaustic].check());
 
+    // The same again, stepping by symbol ids
+    for (int i = 0; test[i].path[0]; ++i)
+        simulate(accum, test[i].path, i, &automata);
+    for (int i = beauty; i <= nocaustic; ++i)
+        OIIO_CHECK_ASSERT(aovs[i].check());
+
+    // And with all of them at once in a batch
+    int ntests = 0;
+    while (test[ntests].path[0])
+        ++ntests;
+    BatchedAccumulator batch(&automata, ntests);
+    for (int i = 0; i < naovs; ++i)
+        batch.setAov(i, &aovs[i], false, false);
+    simulate_batch(batch, automata, test);
+    for (int i = beauty; i <= nocaustic; ++i)
+        OIIO_CHECK_ASSERT(aovs[i].check());
+
+    // And into per-thread buffers: every path goes to both threads, so
+    // the reduced colors are twice a path's
+    {
+        AovBuffers buffers(&automata, ntests, 2);
+        for (int i = 0; i < naovs; ++i)
+            buffers.setAov(i, &aovs[i]);
+        for (int thread = 0; thread < buffers.threads(); ++thread)
+            for (int i = 0; i < ntests; ++i)
+                simulate(accum, test[i].path, i, nullptr, &buffers, thread);
+        buffers.reduce(0, ntests);
+        for (int i = 0; i < ntests; ++i)
+            buffers.flush(i, reinterpret_cast<void*>(size_t(i)));
+        for (int i = beauty; i <= nocaustic; ++i)
+            OIIO_CHECK_ASSERT(aovs[i].check());
+        OIIO_CHECK_EQUAL(buffers.getColor(beauty, 0).x, 2.0f);
+        OIIO_CHECK_EQUAL(buffers.getColor(beauty, 1).x, 0.0f);
+    }
+
+    // Automata compiled again from the same rules come from the cache,
+    // pointing at their own rules
+    {
+        AccumAutomata cached;
+        add_rules(cached);
+        cached.compile();
+        Accumulator accum(&cached);
+        for (int i = 0; i < naovs; ++i)
+            accum.setAov(i, &aovs[i], false, false);
+        for (int i = 0; test[i].path[0]; ++i)
+            simulate(accum, test[i].path, i);
+        for (int i = beauty; i <= nocaustic; ++i)
+            OIIO_CHECK_ASSERT(aovs[i].check());
+    }
+
     std::cout << "Light expressions check OK" << std::endl;
     return unit_test_failures;
 }
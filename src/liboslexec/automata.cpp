@@ -639,50 +639,38 @@ ndfautoToDfauto(const NdfAutomata& ndfautomata, DfAutomata& dfautomata)
 
 
 
-bool
-DfOptimizedAutomata::Transition::trans_comp(
-    const DfOptimizedAutomata::Transition& a,
-    const DfOptimizedAutomata::Transition& b)
-{
-    return a.symbol.data() < b.symbol.data();
-}
-
-
-
 void
 DfOptimizedAutomata::compileFrom(const DfAutomata& dfautomata)
 {
-    m_states.resize(dfautomata.m_states.size());
-    size_t totaltrans = 0;
+    // Gather the alphabet, sorted like getSymbolId searches it
+    m_symbols.clear();
+    for (auto&& state : dfautomata.m_states)
+        for (auto&& t : state->m_symbol_trans)
+            m_symbols.push_back(t.first);
+    std::sort(m_symbols.begin(), m_symbols.end(),
+              [](ustring a, ustring b) { return a.data() < b.data(); });
+    m_symbols.erase(std::unique(m_symbols.begin(), m_symbols.end()),
+                    m_symbols.end());
+
+    const size_t nstates = dfautomata.m_states.size();
+    const size_t stride  = m_symbols.size() + 1;
+    m_states.resize(nstates);
+    m_trans.resize(nstates * stride);
     size_t totalrules = 0;
-    for (size_t s = 0; s < m_states.size(); ++s) {
-        totaltrans += dfautomata.m_states[s]->m_symbol_trans.size();
+    for (size_t s = 0; s < nstates; ++s)
         totalrules += dfautomata.m_states[s]->m_rules.size();
-    }
-    m_trans.resize(totaltrans);
     m_rules.resize(totalrules);
-    size_t trans_offset = 0;
     size_t rules_offset = 0;
-    for (size_t s = 0; s < m_states.size(); ++s) {
-        m_states[s].begin_trans = trans_offset;
+    for (size_t s = 0; s < nstates; ++s) {
+        const DfAutomata::State& state(*dfautomata.m_states[s]);
+        int* trans = &m_trans[s * stride];
+        std::fill(trans, trans + stride, state.m_wildcard_trans);
+        for (auto&& t : state.m_symbol_trans)
+            trans[getSymbolId(t.first)] = t.second;
         m_states[s].begin_rules = rules_offset;
-        for (SymbolToInt::const_iterator i
-             = dfautomata.m_states[s]->m_symbol_trans.begin();
-             i != dfautomata.m_states[s]->m_symbol_trans.end();
-             ++i, ++trans_offset) {
-            m_trans[trans_offset].symbol = i->first;
-            m_trans[trans_offset].state  = i->second;
-        }
-        for (RuleSet::const_iterator i = dfautomata.m_states[s]->m_rules.begin();
-             i != dfautomata.m_states[s]->m_rules.end(); ++i, ++rules_offset)
-            m_rules[rules_offset] = *i;
-        m_states[s].ntrans = dfautomata.m_states[s]->m_symbol_trans.size();
-        m_states[s].nrules = dfautomata.m_states[s]->m_rules.size();
-        std::sort(m_trans.begin() + m_states[s].begin_trans,
-                  m_trans.begin() + m_states[s].begin_trans
-                      + m_states[s].ntrans,
-                  DfOptimizedAutomata::Transition::trans_comp);
-        m_states[s].wildcard_trans = dfautomata.m_states[s]->m_wildcard_trans;
+        m_states[s].nrules      = state.m_rules.size();
+        for (void* rule : state.m_rules)
+            m_rules[rules_offset++] = rule;
     }
 }
 
@@ -30,6 +30,7 @@ BackendLLVM::BackendLLVM(ShadingSystemImpl& shadingsys, ShaderGroup& group,
     m_use_optix      = shadingsys.use_optix();
     m_use_rs_bitcode = !shadingsys.m_rs_bitcode.empty();
     m_name_llvm_syms = shadingsys.m_llvm_output_bitcode;
+    m_llvm_optimize  = shadingsys.llvm_optimize();
 
     // Select the appropriate ustring representation
     ll.ustring_rep(LLVM_Util::UstringRep::hash);
@@ -220,12 +221,41 @@ BackendLLVM::llvm_global_symbol_ptr(ustring name)
 
 
 
+const SymLocationDesc*
+BackendLLVM::global_symloc(const Symbol& sym)
+{
+    // Only the geometric globals, which the renderer provides and the
+    // shadeops don't read from ShaderGlobals behind the shader's back.
+    static const ustring relocatable[]
+        = { Strings::P,    Strings::I,     Strings::N,       Strings::Ng,
+            Strings::u,    Strings::v,     Strings::dPdu,    Strings::dPdv,
+            Strings::time, Strings::dtime, Strings::dPdtime, Strings::Ps };
+    if (std::find(std::begin(relocatable), std::end(relocatable), sym.name())
+        == std::end(relocatable))
+        return nullptr;
+    // A symloc of the wrong type, or without derivs for a global that
+    // needs them, leaves the global in ShaderGlobals.
+    const SymLocationDesc* symloc
+        = group().find_symloc(sym.name(), SymArena::ShaderGlobals);
+    if (!symloc || !symloc->type.equivalent(sym.typespec().simpletype())
+        || (sym.has_derivs() && !symloc->derivs))
+        return nullptr;
+    return symloc;
+}
+
+
+
 llvm::Value*
 BackendLLVM::getLLVMSymbolBase(const Symbol& sym)
 {
     Symbol* dealiased = sym.dealias();
 
     if (sym.symtype() == SymTypeGlobal) {
+        // Read straight from the renderer's per-point records, when it has
+        // said where they are, relative to the userdata arena.
+        if (const SymLocationDesc* symloc = global_symloc(sym))
+            return ll.ptr_to_cast(symloc_ptr(symloc, m_llvm_userdata_base_ptr),
+                                  llvm_type(sym.typespec().elementtype()));
         llvm::Value* result = llvm_global_symbol_ptr(sym.name());
         OSL_ASSERT(result);
         result = ll.ptr_to_cast(result,
@@ -241,6 +271,11 @@ BackendLLVM::getLLVMSymbolBase(const Symbol& sym)
         return ll.offset_ptr(m_llvm_interactive_params_ptr, offset,
                              llvm_ptr_type(sym.typespec().elementtype()));
     }
+    if (is_readonly_param(sym)) {
+        // Parameters that never change live in the module's constants
+        return llvm_ptr_cast(llvm_readonly_param(sym),
+                             sym.typespec().elementtype());
+    }
 
     if (sym.symtype() == SymTypeParam
         || (sym.symtype() == SymTypeOutputParam
@@ -288,6 +323,27 @@ BackendLLVM::can_treat_param_as_local(const Symbol& sym)
            && !sym.typespec().is_closure_based() && !sym.connected();
 }
 
+
+
+bool
+BackendLLVM::is_readonly_param(const Symbol& sym)
+{
+    if (!shadingsys().m_opt_readonly_params || use_optix())
+        return false;
+
+    // An input parameter with a default or instance value that nothing
+    // writes -- not a connection, userdata, an interactive edit, init ops,
+    // or the shader's own code -- is the same for every shade.
+    return sym.symtype() == SymTypeParam
+           && (sym.valuesource() == Symbol::DefaultVal
+               || sym.valuesource() == Symbol::InstanceVal)
+           && !sym.connected() && !sym.interactive() && !sym.interpolated()
+           && !sym.renderer_output() && !sym.everwritten()
+           && !sym.typespec().is_closure_based()
+           && !sym.typespec().is_structure()
+           && !(sym.has_init_ops() && sym.valuesource() == Symbol::DefaultVal);
+}
+
 llvm::Value*
 BackendLLVM::getOrAllocateLLVMSymbol(const Symbol& sym)
 {
@@ -682,6 +738,15 @@ BackendLLVM::userdata_initialized_ref(int userdata_index)
 
 
 
+llvm::Value*
+BackendLLVM::noise_memo_flag_ref(int slot)
+{
+    return ll.GEP(llvm_type_groupdata(), groupdata_ptr(), 0,
+                  m_noise_memo_field, slot, llnamefmt("noise_memo_flag_ref"));
+}
+
+
+
 llvm::Value*
 BackendLLVM::llvm_call_function(const char* name, cspan<const Symbol*> args,
                                 bool deriv_ptrs)
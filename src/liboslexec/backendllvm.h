@@ -5,6 +5,7 @@
 #pragma once
 
 #include <map>
+#include <set>
 #include <vector>
 
 #include "oslexec_pvt.h"
@@ -44,6 +45,30 @@ public:
     /// Set additional Module/Function options for the CUDA/OptiX target.
     void prepare_module_for_cuda_jit();
 
+    /// The LLVM optimization strategy to use (taken from the shading
+    /// system's "llvm_optimize" unless overridden).
+    int llvm_optimize() const { return m_llvm_optimize; }
+    void llvm_optimize(int level) { m_llvm_optimize = level; }
+
+    /// Note that we are replacing a JIT already done for this group, so
+    /// that the shading system stats don't count the group twice.
+    void recompiling(bool val) { m_recompiling = val; }
+
+    /// Keep the n most expensive layers that other layers call out of line
+    /// in the PTX, rather than inlined into their callers, to relieve the
+    /// register pressure of large groups.
+    void optix_split_layers(int n) { m_optix_split_layers = n; }
+
+    /// The number of layers called by other layers, which
+    /// optix_split_layers chooses among (known after run()).
+    int num_called_layers() const
+    {
+        int n = 0;
+        for (int sites : m_layer_call_sites)
+            n += (sites > 0);
+        return n;
+    }
+
 
 
     /// What LLVM debug level are we at?
@@ -59,22 +84,50 @@ public:
     /// This will end up being the group entry if 'groupentry' is true.
     llvm::Function* build_llvm_instance(bool groupentry);
 
+    /// Estimate how much code the current shader instance turns into,
+    /// weighting texture, noise, and spline ops (which expand into large
+    /// calls) more heavily than simple ops, and ops with derivatives
+    /// more than those without.
+    int layer_cost_estimate();
+
+    /// Mark the layer functions that are cheap enough to inline into
+    /// every caller, or expensive and shared enough that they should
+    /// stay out of line, based on their estimated costs and call sites.
+    void set_layer_inlining(const std::vector<llvm::Function*>& funcs);
+
+    /// Mark the optix_split_layers most expensive called layers to stay
+    /// out of line in prepare_module_for_cuda_jit.
+    void split_heavy_layers(const std::vector<llvm::Function*>& funcs);
+
     /// Create an llvm function for group initialization code.
     llvm::Function* build_llvm_init();
 
     // Create llvm functions for OptiX callables
     std::vector<llvm::Function*> build_llvm_optix_callables();
     llvm::Function* build_llvm_fused_callable();
+    llvm::Function* build_llvm_wavefront_kernel();
 
     /// Build up LLVM IR code for the given range [begin,end) or
     /// opcodes, putting them (initially) into basic block bb (or the
     /// current basic block if bb==NULL).
     bool build_llvm_code(int beginop, int endop, llvm::BasicBlock* bb = NULL);
 
+    /// Return the groupdata slot shared by noise op opnum of the current
+    /// layer (see ShaderGroup::m_noise_memos), or -1 if it has none.
+    int noise_memo_slot(int opnum) const;
+
+    /// Generate the noise op opnum so that it is only computed if no
+    /// layer has stored the result in the given slot yet for this shade.
+    bool build_llvm_noise_memo(int opnum, int slot, const OpDescriptor* opd);
+
     typedef std::map<std::string, llvm::Value*> AllocationMap;
 
     void llvm_create_constant(const Symbol& sym);
 
+    /// Return the constant global holding the value (and zero derivs) of
+    /// a read-only parameter, making it the first time it's asked for.
+    llvm::Value* llvm_readonly_param(const Symbol& sym);
+
     void llvm_assign_initial_value(const Symbol& sym, bool force = false);
     llvm::LLVMContext& llvm_context() const { return ll.context(); }
     AllocationMap& named_values() { return m_named_values; }
@@ -142,6 +195,8 @@ public:
 
     llvm::Value* llvm_const_hash(ustring str)
     {
+        if (use_optix())
+            m_device_strings.insert(str);
         return ll.constant64((uint64_t)str.hash());
     }
 
@@ -217,6 +272,11 @@ public:
     /// stack instead of in GroupData
     bool can_treat_param_as_local(const Symbol& sym);
 
+    /// Checks if a symbol is a parameter whose value is the same for every
+    /// shade, so that it can be read from a constant in the module instead
+    /// of being copied into GroupData by each shade.
+    bool is_readonly_param(const Symbol& sym);
+
     /// Given the OSL symbol, return the llvm::Value* corresponding to the
     /// address of the start of that symbol (first element, first component,
     /// and just the plain value if it has derivatives).  This is retrieved
@@ -248,6 +308,10 @@ public:
     /// Retrieve the named global ("P", "N", etc.).
     llvm::Value* llvm_global_symbol_ptr(ustring name);
 
+    /// The SymArena::ShaderGlobals symloc that relocates the global sym
+    /// into the renderer's memory, or nullptr if it's in ShaderGlobals.
+    const SymLocationDesc* global_symloc(const Symbol& sym);
+
     /// Test whether val is nonzero, return the llvm::Value* that's the
     /// result of a CreateICmpNE or CreateFCmpUNE (depending on the
     /// type).  If test_derivs is true, it it also tests whether the
@@ -360,7 +424,9 @@ public:
     // For a symloc, compute the llvm::Value of the pointer to its true,
     // offset location from the base pointer for shade index `sindex`
     // (which should already be a i64, or if nullptr, then use
-    // m_llvm_shadeindex and convert it to i64).
+    // m_llvm_shadeindex and convert it to i64).  An indirect symloc
+    // instead reads its data pointer and stride from the
+    // SymLocationBinding at that offset, at execute time.
     llvm::Value* symloc_ptr(const SymLocationDesc* symloc,
                             llvm::Value* base_ptr,
                             llvm::Value* sindex = nullptr)
@@ -369,6 +435,17 @@ public:
         llvm::Value* stride = ll.constanti64(symloc->stride);
         if (!sindex)
             sindex = ll.op_int_to_longlong(m_llvm_shadeindex);
+        if (symloc->indirect) {
+            llvm::Value* binding = ll.offset_ptr(base_ptr, offset);
+            base_ptr = ll.op_load(ll.type_void_ptr(),
+                                  ll.ptr_to_cast(binding, ll.type_void_ptr()));
+            stride   = ll.op_load(
+                ll.type_longlong(),
+                ll.offset_ptr(binding,
+                              int(offsetof(SymLocationBinding, stride)),
+                              ll.type_ptr(ll.type_longlong())));
+            return ll.offset_ptr(base_ptr, ll.op_mul(stride, sindex));
+        }
         llvm::Value* fulloffset = ll.op_add(offset, ll.op_mul(stride, sindex));
         return ll.offset_ptr(base_ptr, fulloffset);
     }
@@ -381,6 +458,10 @@ public:
     /// stored for the specified userdata index.
     llvm::Value* userdata_initialized_ref(int userdata_index = 0);
 
+    /// Return a ref to the flag telling if the shared noise result slot
+    /// has been computed yet.
+    llvm::Value* noise_memo_flag_ref(int slot);
+
     /// Generate LLVM code to zero out the variable (including derivs)
     ///
     void llvm_assign_zero(const Symbol& sym);
@@ -509,21 +590,32 @@ public:
     /// Call this when JITing a texture-like call, to track how many.
     void generated_texture_call(bool handle)
     {
+        if (m_recompiling)
+            return;
         shadingsys().m_stat_tex_calls_codegened += 1;
         if (handle)
             shadingsys().m_stat_tex_calls_as_handles += 1;
     }
 
-    void increment_useparam_ops() { shadingsys().m_stat_useparam_ops++; }
+    void increment_useparam_ops()
+    {
+        if (!m_recompiling)
+            shadingsys().m_stat_useparam_ops++;
+    }
 
-    /// Return the mapping from symbol names to GlobalVariables.
-    std::map<std::string, llvm::GlobalVariable*>& get_const_map()
+    /// Return the mapping from symbol names to the addresses of their
+    /// values: a GlobalVariable, or a pointer into the shared constants.
+    std::map<std::string, llvm::Value*>& get_const_map()
     {
         return m_const_map;
     }
 
     /// Return whether or not we are compiling for an OptiX-based renderer.
     bool use_optix() { return m_use_optix; }
+
+    /// Compile for the host CPU even for an OptiX-based renderer (see the
+    /// "optix_host_jit" option). Call before run().
+    void host_target() { m_use_optix = false; }
     bool use_optix_cache() { return shadingsys().use_optix_cache(); }
 
     /// Return if we should compile against free function versions of Renderer Service.
@@ -557,12 +649,19 @@ private:
     std::vector<int> m_layer_remap;      ///< Remapping of layer ordering
     std::set<int> m_layers_already_run;  ///< List of layers run
     int m_num_used_layers;               ///< Number of layers actually used
+    int m_noise_memo_field = -1;         ///< Groupdata field of noise flags
 
     double m_stat_total_llvm_time;  ///<   total time spent on LLVM
     double m_stat_llvm_setup_time;  ///<     llvm setup time
     double m_stat_llvm_irgen_time;  ///<     llvm IR generation time
     double m_stat_llvm_opt_time;    ///<     llvm IR optimization time
     double m_stat_llvm_jit_time;    ///<     llvm JIT time
+    std::vector<double> m_layer_irgen_time;  ///< IR generation per layer
+    std::vector<int> m_layer_cost;           ///< Estimated cost per layer
+    std::vector<int> m_layer_call_sites;     ///< Calls made to each layer
+    std::vector<char> m_layer_inlining;      ///< 'i'nline, 'c'all, or 0
+    int m_optix_split_layers = 0;            ///< Called layers kept apart
+    std::set<ustring> m_device_strings;      ///< Strings the GPU code uses
 
     // LLVM stuff
     AllocationMap m_named_values;
@@ -589,13 +688,15 @@ private:
     bool m_name_llvm_syms;  // Whether to name LLVM symbols
 
     // A mapping from symbol names to llvm::GlobalVariables
-    std::map<std::string, llvm::GlobalVariable*> m_const_map;
+    std::map<std::string, llvm::Value*> m_const_map;
 
     // Name of each indexed field in the groupdata, mostly for debugging.
     std::vector<std::string> m_groupdata_field_names;
 
     bool m_use_optix;  ///< Compile for OptiX?
     bool m_use_rs_bitcode;  /// To use free function versions of Renderer Service functions.
+    int m_llvm_optimize;        ///< LLVM optimization strategy
+    bool m_recompiling = false;  ///< Replacing an earlier JIT of the group?
 
     friend class ShadingSystemImpl;
 };
@@ -2325,7 +2325,7 @@ struct Analyzer {
                     || s.typespec().is_string_based()
                     || ((s.symtype() == SymTypeLocal
                          || s.symtype() == SymTypeTemp)
-                        && m_ba.shadingsys().debug_uninit()))) {
+                        && m_ba.debug_uninit()))) {
                 if (s.has_init_ops() && s.valuesource() == Symbol::DefaultVal) {
                     // Handle init ops.
                     discover_symbols_between(s.initbegin(), s.initend());
@@ -2888,6 +2888,40 @@ BatchedAnalysis::analyze_layer(ShaderInstance* inst)
     OSL_ASSERT(!is_shader_global_uniform_by_name(Strings::object2common));
     OSL_ASSERT(!is_shader_global_uniform_by_name(Strings::time));
 
+    // A layer analyzed before -- the same layer re-optimized to the same
+    // code, or one shared by other groups -- takes the earlier analysis.
+    // Not when asked to dump what the analysis finds, which is then found
+    // anew.
+    std::string key;
+    if (shadingsys().m_opt_batched_analysis_memo > 0
+        && !shadingsys().dump_forced_llvm_bool_symbols()
+        && !shadingsys().dump_uniform_symbols()
+        && !shadingsys().dump_varying_symbols()) {
+        key = memo_key(inst);
+        std::shared_ptr<const BatchedLayerAnalysis> memo;
+        if (key.size())
+            memo = shadingsys().find_batched_analysis(key);
+        if (memo) {
+            SymbolVec& symbols(inst->symbols());
+            for (size_t i = 0, e = symbols.size(); i < e; ++i) {
+                uint8_t flags = memo->symbol_flags[i];
+                if (flags & BatchedLayerAnalysis::Varying)
+                    symbols[i].make_varying();
+                if (flags & BatchedLayerAnalysis::ForcedLLVMBool)
+                    symbols[i].forced_llvm_bool(true);
+            }
+            OpcodeVec& ops(inst->ops());
+            for (size_t i = 0, e = ops.size(); i < e; ++i) {
+                using Flags   = BatchedLayerAnalysis;
+                uint8_t flags = memo->op_flags[i];
+                ops[i].requires_masking(flags & Flags::RequiresMasking);
+                ops[i].analysis_flag(flags & Flags::AnalysisFlag);
+            }
+            shadingsys().m_stat_batched_analysis_memo_hits += 1;
+            return;
+        }
+    }
+
     Analyzer analyzer(*this, inst);
 
     analyzer.discover_init_symbols();
@@ -2914,6 +2948,22 @@ BatchedAnalysis::analyze_layer(ShaderInstance* inst)
     analyzer.push_varying_of_implicitly_varying_ops();
 
     analyzer.process_deferred_masking();
+
+    if (key.size()) {
+        auto memo = std::make_shared<BatchedLayerAnalysis>();
+        for (const Symbol& s : inst->symbols())
+            memo->symbol_flags.push_back(
+                (s.is_varying() ? BatchedLayerAnalysis::Varying : 0)
+                | (s.forced_llvm_bool() ? BatchedLayerAnalysis::ForcedLLVMBool
+                                        : 0));
+        for (const Opcode& op : inst->ops())
+            memo->op_flags.push_back(
+                (op.requires_masking() ? BatchedLayerAnalysis::RequiresMasking
+                                       : 0)
+                | (op.analysis_flag() ? BatchedLayerAnalysis::AnalysisFlag
+                                      : 0));
+        shadingsys().add_batched_analysis(key, std::move(memo));
+    }
 #ifdef OSL_DEV
     dump_symbol_uniformity(inst);
     dump_layer(inst);
@@ -2947,6 +2997,96 @@ BatchedAnalysis::analyze_layer(ShaderInstance* inst)
 
 
 
+// Append the bytes of a value to a memo key.
+template<typename T>
+static void
+append_key(std::string& key, const T& val)
+{
+    key.append((const char*)&val, sizeof(T));
+}
+
+
+
+std::string
+BatchedAnalysis::memo_key(ShaderInstance* inst) const
+{
+    std::string key;
+    const SymbolVec& symbols(inst->symbols());
+
+    // Options that change which initial assignments are mimicked
+    append_key(key, shadingsys().lazy_userdata());
+    append_key(key, debug_uninit());
+    append_key(key, shadingsys().commonspace_synonym());
+
+    // The code
+    append_key(key, inst->maincodebegin());
+    append_key(key, inst->maincodeend());
+    append_key(key, int(inst->ops().size()));
+    for (const Opcode& op : inst->ops()) {
+        append_key(key, op.opname());
+        append_key(key, op.firstarg());
+        append_key(key, op.nargs());
+        for (int j = 0; j < (int)Opcode::max_jumps; ++j)
+            append_key(key, op.jump(j));
+        append_key(key, op.argread_bits());
+        append_key(key, op.argwrite_bits());
+        append_key(key, op.argtakesderivs_all());
+        int flags = op.requires_masking() | (op.analysis_flag() << 1);
+        append_key(key, flags);
+    }
+    append_key(key, int(inst->args().size()));
+    key.append((const char*)inst->args().data(),
+               inst->args().size() * sizeof(int));
+
+    // The symbols, how they are used, and what they start out as. Constant
+    // values decide getattribute queries (strings are ustrings, so their
+    // bytes identify them too).
+    append_key(key, int(symbols.size()));
+    for (const Symbol& s : symbols) {
+        if (s.dealias() != &s)
+            return std::string();
+        append_key(key, s.name());
+        append_key(key, s.typespec().simpletype());
+        append_key(key, s.typespec().structure());
+        int flags = s.symtype() | (s.valuesource() << 4)
+                    | (s.typespec().is_closure_based() << 6)
+                    | (s.connected_down() << 7) | (s.renderer_output() << 8)
+                    | (s.interpolated() << 9) | (s.interactive() << 10)
+                    | (s.has_derivs() << 11) | (s.is_uniform() << 12)
+                    | (s.forced_llvm_bool() << 13);
+        append_key(key, flags);
+        append_key(key, s.initbegin());
+        append_key(key, s.initend());
+        append_key(key, s.firstread());
+        append_key(key, s.lastread());
+        append_key(key, s.firstwrite());
+        append_key(key, s.lastwrite());
+        if (s.is_constant() && s.data())
+            key.append((const char*)s.data(), s.size());
+        if (s.interpolated() && !s.typespec().is_closure()) {
+            bool placed = group().find_symloc(s.name(), inst->layername(),
+                                              SymArena::UserData)
+                          != nullptr;
+            append_key(key, placed);
+        }
+    }
+
+    // What feeds the connected parameters
+    append_key(key, inst->nconnections());
+    for (int c = 0, e = inst->nconnections(); c < e; ++c) {
+        const Connection& con(inst->connection(c));
+        const Symbol* srcsym(group()[con.srclayer]->symbol(con.src.param));
+        append_key(key, con.srclayer);
+        append_key(key, con.src.param);
+        append_key(key, con.dst.param);
+        int flags = srcsym->is_varying() | (srcsym->forced_llvm_bool() << 1);
+        append_key(key, flags);
+    }
+    return key;
+}
+
+
+
 void
 BatchedAnalysis::dump_symbol_uniformity(ShaderInstance* inst)
 {
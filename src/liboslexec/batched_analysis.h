@@ -12,6 +12,18 @@ namespace pvt {
 
 
 
+/// The outcome of analyzing one layer for batched execution, one entry per
+/// symbol and per op of the layer, kept so that a layer whose analysis
+/// would read exactly the same things can take it rather than redo it.
+struct BatchedLayerAnalysis {
+    enum SymbolFlags : uint8_t { Varying = 1, ForcedLLVMBool = 2 };
+    enum OpFlags : uint8_t { RequiresMasking = 1, AnalysisFlag = 2 };
+    std::vector<uint8_t> symbol_flags;
+    std::vector<uint8_t> op_flags;
+};
+
+
+
 class BatchedAnalysis {
 public:
     using ShaderGroup = OSL::ShaderGroup;
@@ -23,11 +35,21 @@ public:
 
     void analyze_layer(ShaderInstance* inst);
 
+    /// Key to the memoized analysis of the layer, made of everything the
+    /// analysis reads, or empty if the layer can't be memoized.
+    std::string memo_key(ShaderInstance* inst) const;
+
     void dump_layer(ShaderInstance* inst);
     void dump_symbol_uniformity(ShaderInstance* inst);
 
     ShaderGroup& group() const { return m_group; }
 
+    /// Is the group compiled to check for use of uninitialized values?
+    bool debug_uninit() const
+    {
+        return shadingsys().debug_uninit() || group().debug_checks();
+    }
+
 protected:
     ShadingSystemImpl& m_shadingsys;
     ShaderGroup& m_group;
@@ -633,9 +633,16 @@ BatchedBackendLLVM::llvm_get_pointer(const Symbol& sym, int deriv,
 
     llvm::Value* result = NULL;
     if (sym.symtype() == SymTypeConst) {
-        // For constants, start with *OUR* pointer to the constant values.
+        // For constants, start with *OUR* pointer to the constant values,
+        // or the process-wide shared copy of them for large arrays.
+        void* data    = sym.data();
+        size_t size   = sym.typespec().simpletype().size();
+        int sharedmin = shadingsys().llvm_shared_constants();
+        if (sharedmin > 0 && sym.typespec().is_array()
+            && size >= size_t(sharedmin))
+            data = const_cast<void*>(shadingsys().shared_constant(data, size));
         result
-            = ll.ptr_cast(ll.constant_ptr(sym.data()),
+            = ll.ptr_cast(ll.constant_ptr(data),
                           // Constants by definition should always be UNIFORM
                           ll.type_ptr(llvm_type(sym.typespec().elementtype())));
 
@@ -437,6 +437,19 @@ public:
     /// Return the output base pointer.
     llvm::Value* output_base_ptr() const { return m_llvm_output_base_ptr; }
 
+    /// Return the location of shade index 0 of a symloc within the arena at
+    /// base_ptr, loading it from its SymLocationBinding if indirect.
+    llvm::Value* symloc_base_ptr(const SymLocationDesc* symloc,
+                                 llvm::Value* base_ptr)
+    {
+        llvm::Value* ptr = ll.offset_ptr(base_ptr,
+                                         ll.constanti64(symloc->offset));
+        if (symloc->indirect)
+            ptr = ll.op_load(ll.type_void_ptr(),
+                             ll.ptr_to_cast(ptr, ll.type_void_ptr()));
+        return ptr;
+    }
+
     /// Return a pointer to an WideMatrix that was previously alloca
     /// on the stack, meant for generator to reuse as a temporary
     llvm::Value* temp_wide_matrix_ptr();
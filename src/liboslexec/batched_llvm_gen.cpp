@@ -825,7 +825,7 @@ LLVMGEN(llvm_gen_generic)
             || op.opname() == op_sign)
             any_deriv_args = false;
 
-    FuncSpec func_spec(op.opname().c_str());
+    FuncSpec func_spec(rop.math_opname(op.opname()));
     if (uniformFormOfFunction) {
         func_spec.unbatch();
     }
@@ -1551,8 +1551,19 @@ LLVMGEN(llvm_gen_div)
             func_spec.unbatch();
         func_spec.arg(Result, false, op_is_uniform);
         func_spec.arg(A, false, op_is_uniform);
-        func_spec.arg(B, false, op_is_uniform);
-        {
+        // A matrix divisor that's uniform across the batch (a matrix for a
+        // named space, say) is passed as is, to be inverted just once:
+        // osl_div_w16mw16mm, osl_div_w16mw16fm
+        bool uniform_divisor = !op_is_uniform && B.typespec().is_matrix()
+                               && B.is_uniform();
+        func_spec.arg(B, false, op_is_uniform || uniform_divisor);
+        if (uniform_divisor) {
+            func_spec.mask();
+            llvm::Value* args[] = { rop.llvm_void_ptr(Result),
+                                    rop.llvm_void_ptr(A), rop.llvm_void_ptr(B),
+                                    rop.ll.mask_as_int(rop.ll.current_mask()) };
+            rop.ll.call_function(rop.build_name(func_spec), args);
+        } else {
             LLVM_Util::ScopedMasking require_mask_be_passed;
             if (!op_is_uniform && B.typespec().is_matrix()) {
                 // We choose to only support masked version of these functions:
@@ -3087,6 +3098,8 @@ LLVMGEN(llvm_gen_regex)
     OSL_ASSERT(!do_match_results
                || (Match.typespec().is_array()
                    && Match.typespec().elementtype().is_int()));
+    if (Pattern.is_constant())
+        rop.shadingsys().precompile_regex(Pattern.get_string());
 
     bool op_is_uniform     = Subject.is_uniform() && Pattern.is_uniform();
     bool result_is_uniform = Result.is_uniform();
@@ -5832,6 +5845,9 @@ llvm_batched_noise_options(BatchedBackendLLVM& rop, int opnum,
     bool is_bandwidth_uniform   = true;
     bool is_impulses_uniform    = true;
     bool is_do_filter_uniform   = true;
+    bool is_octaves_uniform     = true;
+    bool is_lacunarity_uniform  = true;
+    bool is_gain_uniform        = true;
 
     OSL_DASSERT(loc_wide_direction == nullptr);
 
@@ -5901,6 +5917,31 @@ llvm_batched_noise_options(BatchedBackendLLVM& rop, int opnum,
             rop.ll.call_function("osl_noiseparams_set_impulses", opt,
                                  rop.llvm_load_value(Val, 0, NULL, 0,
                                                      TypeFloat));
+        } else if (name == Strings::octaves && Val.typespec().is_int()) {
+            if (!Val.is_uniform()) {
+                is_octaves_uniform = false;
+                continue;  // We are only setting uniform options here
+            }
+            rop.ll.call_function("osl_noiseparams_set_octaves", opt,
+                                 rop.llvm_load_value(Val));
+        } else if (name == Strings::lacunarity
+                   && (Val.typespec().is_float() || Val.typespec().is_int())) {
+            if (!Val.is_uniform()) {
+                is_lacunarity_uniform = false;
+                continue;  // We are only setting uniform options here
+            }
+            rop.ll.call_function("osl_noiseparams_set_lacunarity", opt,
+                                 rop.llvm_load_value(Val, 0, NULL, 0,
+                                                     TypeFloat));
+        } else if (name == Strings::gain
+                   && (Val.typespec().is_float() || Val.typespec().is_int())) {
+            if (!Val.is_uniform()) {
+                is_gain_uniform = false;
+                continue;  // We are only setting uniform options here
+            }
+            rop.ll.call_function("osl_noiseparams_set_gain", opt,
+                                 rop.llvm_load_value(Val, 0, NULL, 0,
+                                                     TypeFloat));
         } else {
             rop.shadingcontext()->errorfmt(
                 "Unknown {} optional argument: \"{}\", <{}> ({}:{})",
@@ -5910,7 +5951,9 @@ llvm_batched_noise_options(BatchedBackendLLVM& rop, int opnum,
 
     // NOTE: may have been previously set to false if name wasn't uniform
     all_options_are_uniform &= is_anisotropic_uniform && is_bandwidth_uniform
-                               && is_impulses_uniform && is_do_filter_uniform;
+                               && is_impulses_uniform && is_do_filter_uniform
+                               && is_octaves_uniform && is_lacunarity_uniform
+                               && is_gain_uniform;
 
     return opt;
 }
@@ -6004,6 +6047,48 @@ llvm_batched_noise_varying_options(BatchedBackendLLVM& rop, int opnum,
                                                               remainingMask);
             rop.ll.call_function("osl_noiseparams_set_impulses", opt,
                                  scalar_impulses);
+        } else if (name == Strings::octaves && Val.typespec().is_int()) {
+            OSL_DEV_ONLY(std::cout << "Varying octaves" << std::endl);
+            llvm::Value* wide_octaves
+                = rop.llvm_load_value(Val,
+                                      /*deriv=*/0, /*component=*/0,
+                                      /*cast=*/TypeDesc::UNKNOWN,
+                                      /*op_is_uniform=*/false);
+            llvm::Value* scalar_octaves = rop.ll.op_extract(wide_octaves,
+                                                            leadLane);
+            remainingMask = rop.ll.op_lanes_that_match_masked(scalar_octaves,
+                                                              wide_octaves,
+                                                              remainingMask);
+            rop.ll.call_function("osl_noiseparams_set_octaves", opt,
+                                 scalar_octaves);
+        } else if (name == Strings::lacunarity
+                   && (Val.typespec().is_float() || Val.typespec().is_int())) {
+            OSL_DEV_ONLY(std::cout << "Varying lacunarity" << std::endl);
+            llvm::Value* wide_lacunarity
+                = rop.llvm_load_value(Val,
+                                      /*deriv=*/0, /*component=*/0,
+                                      /*cast=*/TypeFloat,
+                                      /*op_is_uniform=*/false);
+            llvm::Value* scalar_lacunarity = rop.ll.op_extract(wide_lacunarity,
+                                                               leadLane);
+            remainingMask = rop.ll.op_lanes_that_match_masked(scalar_lacunarity,
+                                                              wide_lacunarity,
+                                                              remainingMask);
+            rop.ll.call_function("osl_noiseparams_set_lacunarity", opt,
+                                 scalar_lacunarity);
+        } else if (name == Strings::gain
+                   && (Val.typespec().is_float() || Val.typespec().is_int())) {
+            OSL_DEV_ONLY(std::cout << "Varying gain" << std::endl);
+            llvm::Value* wide_gain
+                = rop.llvm_load_value(Val,
+                                      /*deriv=*/0, /*component=*/0,
+                                      /*cast=*/TypeFloat,
+                                      /*op_is_uniform=*/false);
+            llvm::Value* scalar_gain = rop.ll.op_extract(wide_gain, leadLane);
+            remainingMask = rop.ll.op_lanes_that_match_masked(scalar_gain,
+                                                              wide_gain,
+                                                              remainingMask);
+            rop.ll.call_function("osl_noiseparams_set_gain", opt, scalar_gain);
         } else if (name == Strings::direction && Val.typespec().is_triple()) {
             OSL_DEV_ONLY(std::cout << "Varying direction" << std::endl);
             // As we passed the pointer to the varying direction along
@@ -6117,6 +6202,9 @@ LLVMGEN(llvm_gen_noise)
         name = Strings::simplexnoise;
     } else if (name == Strings::usimplex && !periodic) {
         name = Strings::usimplexnoise;
+    } else if ((name == Strings::voronoi || name == Strings::worley)
+               && !periodic) {
+        name = Strings::voronoinoise;
     } else if (name == Strings::gabor) {
         // already named
         pass_name    = true;
@@ -6124,6 +6212,16 @@ LLVMGEN(llvm_gen_noise)
         pass_options = true;
         derivs       = true;
         name         = periodic ? Strings::gaborpnoise : Strings::gabornoise;
+    } else if ((name == Strings::fbm || name == Strings::turbulence
+                || name == Strings::ridged)
+               && !periodic) {
+        // All the octaves are summed by one call, which takes the name
+        // of the fractal type and its options
+        pass_name    = true;
+        pass_sg      = true;
+        pass_options = true;
+        derivs       = true;
+        name         = Strings::fractalnoise;
     } else {
         rop.shadingcontext()->errorfmt(
             "{}noise type \"{}\" is unknown, called from ({}:{})",
@@ -6150,6 +6248,15 @@ LLVMGEN(llvm_gen_noise)
         pass_options = false;
     }
 
+    if (!periodic && rop.shadingsys().noise_hash() == Strings::pcg) {
+        // Renderer selected the PCG lattice hash, which only the
+        // non-periodic perlin flavors offer
+        if (name == Strings::noise)
+            name = Strings::noise_pcg;
+        else if (name == Strings::snoise)
+            name = Strings::snoise_pcg;
+    }
+
     llvm::Value* opt                = NULL;
     llvm::Value* loc_wide_direction = nullptr;
     if (pass_options) {
@@ -7411,7 +7518,8 @@ LLVMGEN(llvm_gen_closure)
 
         // If the closure has a "prepare" method, call
         // prepare(renderer, id, memptr).  If there is no prepare method, just
-        // zero out the closure parameter memory.
+        // zero out the closure parameter memory, unless the params are
+        // about to overwrite all of it anyway.
         if (clentry->prepare) {
             // Call clentry->prepare(renderservices *, int id, void *mem)
             llvm::Value* funct_ptr
@@ -7419,7 +7527,7 @@ LLVMGEN(llvm_gen_closure)
                                       rop.llvm_type_prepare_closure_func());
             llvm::Value* args[] = { render_ptr, id_int, mem_void_ptr };
             rop.ll.call_function(funct_ptr, args);
-        } else {
+        } else if (!clentry->formals_fill_struct) {
             rop.ll.op_memset(mem_void_ptr, 0, clentry->struct_size,
                              4 /*align*/);
         }
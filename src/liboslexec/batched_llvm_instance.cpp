@@ -4,6 +4,7 @@
 
 //#define OSL_DEV 1
 
+#include <algorithm>
 #include <bitset>
 #include <cmath>
 #include <cstddef>
@@ -566,6 +567,33 @@ const char*
     = "b4_SSE2_";
 #endif
 
+#ifdef __OSL_SUPPORTS_b4_NEON
+template<>
+const NameAndSignature
+    ConcreteTargetLibraryHelper<4, TargetISA::NEON>::library_functions[]
+    = {
+#    define DECL_INDIRECT(name, signature) \
+        NameAndSignature { #name, signature },
+#    define DECL(name, signature) DECL_INDIRECT(name, signature)
+#    define __OSL_WIDTH           4
+#    define __OSL_TARGET_ISA      NEON
+// Don't allow order of xmacro includes be rearranged
+// clang-format off
+#    include "wide/define_opname_macros.h"
+#    include "builtindecl_wide_xmacro.h"
+#    include "wide/undef_opname_macros.h"
+// clang-format on
+#    undef __OSL_TARGET_ISA
+#    undef __OSL_WIDTH
+#    undef DECL
+#    undef DECL_INDIRECT
+      };
+template<>
+const char*
+    ConcreteTargetLibraryHelper<4, TargetISA::NEON>::library_selector_string
+    = "b4_NEON_";
+#endif
+
 
 
 std::unique_ptr<BatchedBackendLLVM::TargetLibraryHelper>
@@ -627,6 +655,11 @@ BatchedBackendLLVM::TargetLibraryHelper::build(ShadingContext* context,
         case TargetISA::x64:
             return RetType(
                 new ConcreteTargetLibraryHelper<4, TargetISA::x64>());
+#endif
+#ifdef __OSL_SUPPORTS_b4_NEON
+        case TargetISA::NEON:
+            return RetType(
+                new ConcreteTargetLibraryHelper<4, TargetISA::NEON>());
 #endif
         default: break;
         }
@@ -869,6 +902,11 @@ BatchedBackendLLVM::llvm_type_noise_options()
     comp_types.push_back(ll.type_triple());  // direction;
     comp_types.push_back(ll.type_float());   // bandwidth;
     comp_types.push_back(ll.type_float());   // impulses;
+    comp_types.push_back(ll.type_int());     // octaves;
+    comp_types.push_back(ll.type_float());   // lacunarity;
+    comp_types.push_back(ll.type_float());   // gain;
+    comp_types.push_back(ll.type_ustring()); // bake_type;
+    comp_types.push_back(ll.type_int());     // bake_res;
 
     m_llvm_type_noise_options = ll.type_struct(comp_types, "NoiseOptions");
 
@@ -878,6 +916,11 @@ BatchedBackendLLVM::llvm_type_noise_options()
     offset_by_index.push_back(offsetof(NoiseParams, direction));
     offset_by_index.push_back(offsetof(NoiseParams, bandwidth));
     offset_by_index.push_back(offsetof(NoiseParams, impulses));
+    offset_by_index.push_back(offsetof(NoiseParams, octaves));
+    offset_by_index.push_back(offsetof(NoiseParams, lacunarity));
+    offset_by_index.push_back(offsetof(NoiseParams, gain));
+    offset_by_index.push_back(offsetof(NoiseParams, bake_type));
+    offset_by_index.push_back(offsetof(NoiseParams, bake_res));
     ll.validate_struct_data_layout(m_llvm_type_noise_options, offset_by_index);
 
     return m_llvm_type_noise_options;
@@ -986,10 +1029,16 @@ BatchedBackendLLVM::llvm_type_groupdata()
         }
     }
 
-    // For each layer in the group, add entries for all params that are
-    // connected or interpolated, and output params.  Also mark those
-    // symbols with their offset within the group struct.
-    m_param_order_map.clear();
+    // For each layer in the group, gather all params that are connected
+    // or interpolated, and output params, most referenced first with
+    // opt_groupdata_hot (see BackendLLVM::llvm_type_groupdata).
+    struct GroupdataParam {
+        int layer;
+        Symbol* sym;
+        int refs;
+    };
+    std::vector<GroupdataParam> params;
+    std::vector<int> refs;
     for (int layer = 0; layer < group().nlayers(); ++layer) {
         ShaderInstance* inst = group()[layer];
         // TODO:  Does anything bad happen from not skipping unused layers?
@@ -999,46 +1048,62 @@ BatchedBackendLLVM::llvm_type_groupdata()
         // just to broadcast out the scalar default value.
         // TODO: Optimize to only run unused layers once, shouldn't
         // need to be run again as nothing should overwrite the values.
+        if (shadingsys().m_opt_groupdata_hot)
+            inst->count_symbol_refs(refs);
         FOREACH_PARAM(Symbol & sym, inst)
         {
-            TypeSpec ts = sym.typespec();
-            if (ts.is_structure())  // skip the struct symbol itself
+            if (sym.typespec().is_structure())  // skip the struct symbol
                 continue;
-
             if (can_treat_param_as_local(sym))
                 continue;
-
-            const int arraylen  = std::max(1, sym.typespec().arraylength());
-            const int derivSize = (sym.has_derivs() ? 3 : 1);
-            ts.make_array(arraylen * derivSize);
-            llvm::Type* fieldType;
-            if (sym.is_uniform()) {
-                fieldType = sym.forced_llvm_bool() ? ll.type_bool()
-                                                   : llvm_type(ts);
-            } else {
-                fieldType = sym.forced_llvm_bool() ? ll.type_native_mask()
-                                                   : llvm_wide_type(ts);
-            }
-            fields.push_back(fieldType);
-            m_groupdata_field_names.emplace_back(
-                fmtformat("lay{}param_{}_", layer, sym.name()));
-
-            // Alignment
-            size_t align = ll.llvm_alignmentof(fields.back());
-            if (offset & (align - 1))
-                offset += align - (offset & (align - 1));
-            if (llvm_debug() >= 2)
-                print("  {} ({}) {} {}, field {}, size {}, offset {}{}{}\n",
-                      inst->layername(), inst->id(), sym.mangled(), ts.c_str(),
-                      order, derivSize * int(sym.size()), offset,
-                      sym.interpolated() ? " (interpolated)" : "",
-                      sym.interactive() ? " (interactive)" : "");
-            sym.wide_dataoffset((int)offset);
-            offset += ll.llvm_sizeof(fields.back());
-            m_param_order_map[&sym] = order;
-            ++order;
+            int r = refs.size() ? refs[inst->symbolindex(&sym)] : 0;
+            params.push_back({ layer, &sym, r });
         }
     }
+    if (shadingsys().m_opt_groupdata_hot)
+        std::stable_sort(params.begin(), params.end(),
+                         [](const GroupdataParam& a, const GroupdataParam& b) {
+                             return a.refs > b.refs;
+                         });
+
+    // Add the entries and mark those symbols with their offset within the
+    // group struct.
+    m_param_order_map.clear();
+    for (const GroupdataParam& param : params) {
+        int layer            = param.layer;
+        ShaderInstance* inst = group()[layer];
+        Symbol& sym(*param.sym);
+        TypeSpec ts = sym.typespec();
+
+        const int arraylen  = std::max(1, sym.typespec().arraylength());
+        const int derivSize = (sym.has_derivs() ? 3 : 1);
+        ts.make_array(arraylen * derivSize);
+        llvm::Type* fieldType;
+        if (sym.is_uniform()) {
+            fieldType = sym.forced_llvm_bool() ? ll.type_bool() : llvm_type(ts);
+        } else {
+            fieldType = sym.forced_llvm_bool() ? ll.type_native_mask()
+                                               : llvm_wide_type(ts);
+        }
+        fields.push_back(fieldType);
+        m_groupdata_field_names.emplace_back(
+            fmtformat("lay{}param_{}_", layer, sym.name()));
+
+        // Alignment
+        size_t align = ll.llvm_alignmentof(fields.back());
+        if (offset & (align - 1))
+            offset += align - (offset & (align - 1));
+        if (llvm_debug() >= 2)
+            print("  {} ({}) {} {}, field {}, size {}, offset {}{}{}\n",
+                  inst->layername(), inst->id(), sym.mangled(), ts.c_str(),
+                  order, derivSize * int(sym.size()), offset,
+                  sym.interpolated() ? " (interpolated)" : "",
+                  sym.interactive() ? " (interactive)" : "");
+        sym.wide_dataoffset((int)offset);
+        offset += ll.llvm_sizeof(fields.back());
+        m_param_order_map[&sym] = order;
+        ++order;
+    }
     group().llvm_groupdata_wide_size(offset);
     if (llvm_debug() >= 2)
         OSL::print(" Group struct had {} fields, total size {}\n\n", order,
@@ -1121,7 +1186,7 @@ BatchedBackendLLVM::llvm_assign_initial_value(
 
     bool isarray = sym.typespec().is_array();
     if ((sym.symtype() == SymTypeLocal || sym.symtype() == SymTypeTemp)
-        && shadingsys().debug_uninit()) {
+        && debug_uninit()) {
         // Handle the "debug uninitialized values" case
         int alen       = isarray ? sym.typespec().arraylength() : 1;
         llvm::Value* u = NULL;
@@ -1205,10 +1270,8 @@ BatchedBackendLLVM::llvm_assign_initial_value(
             const int deriv_count = (symloc->derivs && sym.has_derivs()) ? 3
                                                                          : 1;
 
-            llvm::Value* sym_offset = ll.constanti64(symloc->offset);
             llvm::Value* userdata_sym_base_ptr
-                = ll.ptr_cast(ll.offset_ptr(m_llvm_userdata_base_ptr,
-                                            sym_offset),
+                = ll.ptr_cast(symloc_base_ptr(symloc, m_llvm_userdata_base_ptr),
                               type.scalartype());
             llvm::Type* userdata_type = ll.llvm_type(type.scalartype());
             bool isBase32bit          = (symloc->type != TypeDesc::STRING);
@@ -1278,7 +1341,7 @@ BatchedBackendLLVM::llvm_assign_initial_value(
                 = ll.call_function(build_name("bind_interpolated_param"), args);
         }
 
-        if (shadingsys().debug_nan() && type.basetype == TypeDesc::FLOAT) {
+        if (debug_nan() && type.basetype == TypeDesc::FLOAT) {
             // check for NaN/Inf for float-based types
             int ncomps          = type.numelements() * type.aggregate;
             llvm::Value* args[] = { ll.mask_as_int(ll.current_mask()),
@@ -1872,7 +1935,7 @@ BatchedBackendLLVM::build_llvm_code(int beginop, int endop,
         const Opcode& op        = inst()->ops()[opnum];
         const OpDescriptor* opd = shadingsys().op_descriptor(op.opname());
         if (opd && opd->llvmgenwide) {
-            if (shadingsys().debug_uninit() /* debug uninitialized vals */)
+            if (debug_uninit() /* debug uninitialized vals */)
                 llvm_generate_debug_uninit(op);
             if (shadingsys().llvm_debug_ops())
                 llvm_generate_debug_op_printf(op);
@@ -1895,7 +1958,7 @@ BatchedBackendLLVM::build_llvm_code(int beginop, int endop,
                 if (!ok)
                     return false;
             }
-            if (shadingsys().debug_nan() /* debug NaN/Inf */
+            if (debug_nan() /* debug NaN/Inf */
                 && op.farthest_jump() < 0 /* Jumping ops don't need it */) {
                 llvm_generate_debugnan(op);
             }
@@ -1989,18 +2052,18 @@ BatchedBackendLLVM::build_llvm_init()
 #endif
 
     // Group init clears all the "layer_run" and "userdata_initialized" flags.
-    if (m_num_used_layers > 1) {
-        // Round up to a 64 bit boundary
-        int sz = 16 * ((m_num_used_layers + 15) / 16) * sizeof(int);
-
-        ll.op_memset(ll.void_ptr(layer_run_ref(0)), 0, sz, 4 /*align*/);
-    }
+    // They are adjacent at the start of groupdata, so a single memset
+    // covers both.  Params need no clearing: each layer writes its own.
+    // Round up to a 64 bit boundary
+    int runflags_sz  = 16 * ((m_num_used_layers + 15) / 16) * sizeof(int);
     int num_userdata = (int)group().m_userdata_names.size();
-    if (num_userdata) {
-        int sz = num_userdata * sizeof(int);
-        ll.op_memset(ll.void_ptr(userdata_initialized_ref(0)), 0, sz,
+    int userdata_sz  = num_userdata * sizeof(int);
+    if (num_userdata)
+        ll.op_memset(ll.void_ptr(layer_run_ref(0)), 0,
+                     runflags_sz + userdata_sz, 4 /*align*/);
+    else if (m_num_used_layers > 1)
+        ll.op_memset(ll.void_ptr(layer_run_ref(0)), 0, runflags_sz,
                      4 /*align*/);
-    }
 
     // Group init also needs to allot space for ALL layers' params
     // that are closures (to avoid weird order of layer eval problems).
@@ -2220,10 +2283,10 @@ BatchedBackendLLVM::build_llvm_instance(bool groupentry)
             && (s.is_constant() || s.typespec().is_closure_based()
                 || s.typespec().is_string_based()
                 || ((s.symtype() == SymTypeLocal || s.symtype() == SymTypeTemp)
-                    && shadingsys().debug_uninit())))
+                    && debug_uninit())))
             llvm_assign_initial_value(s, llvm_initial_shader_mask_value);
         // If debugnan is turned on, globals check that their values are ok
-        if (s.symtype() == SymTypeGlobal && shadingsys().debug_nan()) {
+        if (s.symtype() == SymTypeGlobal && debug_nan()) {
             TypeDesc t = s.typespec().simpletype();
             if (t.basetype == TypeDesc::FLOAT) {
                 // just check float-based types
@@ -2434,9 +2497,8 @@ BatchedBackendLLVM::build_llvm_instance(bool groupentry)
         const int output_deriv_count = symloc->derivs ? 3 : 1;
         const int s_deriv_count      = s.has_derivs() ? 3 : 1;
 
-        llvm::Value* sym_offset = ll.constanti64(symloc->offset);
         llvm::Value* output_sym_base_ptr
-            = ll.ptr_cast(ll.offset_ptr(m_llvm_output_base_ptr, sym_offset),
+            = ll.ptr_cast(symloc_base_ptr(symloc, m_llvm_output_base_ptr),
                           type.scalartype());
         auto sym_base_ptr_type = ll.llvm_type(type.scalartype());
         bool isBase32bit       = (symloc->type != TypeDesc::STRING);
@@ -2788,6 +2850,9 @@ BatchedBackendLLVM::run()
             shadingcontext()->errorfmt("ParseBitcodeFile returned '{}'\n", err);
         OSL_ASSERT(ll.module());
 #endif
+        if (shadingsys().jit_group_memory(group()))
+            group().add_jit_memory(ll.private_jit_memory());
+
         // Create the ExecutionEngine
         if (!ll.make_jit_execengine(
                 &err, ll.lookup_isa_by_name(shadingsys().m_llvm_jit_target),
@@ -3002,6 +3067,7 @@ BatchedBackendLLVM::run()
 
     // N.B. Destroying the EE should have destroyed the module as well.
     ll.module(NULL);
+    group().add_jit_bytes(ll.jit_bytes());
 
     m_stat_llvm_jit_time += timer.lap();
 
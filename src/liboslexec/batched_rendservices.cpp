@@ -115,6 +115,20 @@ BatchedRendererServices<WidthT>::get_inverse_matrix(BatchedShaderGlobals* bsg,
 
 
 
+template<int WidthT>
+void
+BatchedRendererServices<WidthT>::get_attributes(BatchedShaderGlobals* bsg,
+                                                Mask mask,
+                                                span<AttributeGather> requests)
+{
+    for (auto& r : requests)
+        r.found = get_attribute(bsg, r.object, r.name,
+                                MaskedData(r.type, r.derivs, mask,
+                                           r.wide_data));
+}
+
+
+
 template<int WidthT>
 TextureSystem*
 BatchedRendererServices<WidthT>::texturesys() const
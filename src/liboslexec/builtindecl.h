@@ -125,6 +125,7 @@ DECL(osl_gen_filefmt, "xXhhiXiX")
 DECL(osl_gen_errorfmt, "xXhiXiX")
 DECL(osl_gen_warningfmt, "xXhiXiX")
 DECL(osl_formatfmt, "hXhiXiX")
+DECL(osl_formatfmt_plan, "hXXX")
 DECL(osl_split, "ihXhii")
 DECL(osl_incr_layers_executed, "xX")
 
@@ -145,8 +146,16 @@ NOISE_IMPL(simplexnoise)
 NOISE_DERIV_IMPL(simplexnoise)
 NOISE_IMPL(usimplexnoise)
 NOISE_DERIV_IMPL(usimplexnoise)
+NOISE_IMPL(voronoinoise)
+NOISE_DERIV_IMPL(voronoinoise)
+NOISE_IMPL(noise_pcg)
+NOISE_DERIV_IMPL(noise_pcg)
+NOISE_IMPL(snoise_pcg)
+NOISE_DERIV_IMPL(snoise_pcg)
 GENERIC_NOISE_DERIV_IMPL(gabornoise)
 GENERIC_NOISE_DERIV_IMPL(genericnoise)
+GENERIC_NOISE_DERIV_IMPL(fractalnoise)
+GENERIC_NOISE_DERIV_IMPL(bakednoise)
 NOISE_IMPL(nullnoise)
 NOISE_DERIV_IMPL(nullnoise)
 NOISE_IMPL(unullnoise)
@@ -165,6 +174,11 @@ DECL(osl_noiseparams_set_do_filter, "xXi")
 DECL(osl_noiseparams_set_direction, "xXv")
 DECL(osl_noiseparams_set_bandwidth, "xXf")
 DECL(osl_noiseparams_set_impulses, "xXf")
+DECL(osl_noiseparams_set_octaves, "xXi")
+DECL(osl_noiseparams_set_lacunarity, "xXf")
+DECL(osl_noiseparams_set_gain, "xXf")
+DECL(osl_noiseparams_set_bake_type, "xXh")
+DECL(osl_noiseparams_set_bake_res, "xXi")
 DECL(osl_count_noise, "xX")
 DECL(osl_hash_ii, "ii")
 DECL(osl_hash_if, "if")
@@ -220,8 +234,10 @@ DECL(osl_range_check_err, "iiihXhihihh")
 DECL(osl_naninf_check, "xiXiXhihiih")
 DECL(osl_uninit_check, "xLXXhihihhihihii")
 DECL(osl_get_attribute, "iXihhiiLX")
+DECL(osl_get_attribute_per_object, "iXihhiiLX")
 DECL(osl_bind_interpolated_param, "iXhLiXiXiXi")
 DECL(osl_incr_get_userdata_calls, "xX")
+DECL(osl_gather_userdata, "xXXX")
 DECL(osl_init_texture_options, "xXX");
 DECL(osl_init_noise_options, "xXX");
 DECL(osl_init_trace_options, "xXX");
@@ -275,6 +291,41 @@ UNARY_OP_IMPL(cbrt)
 DECL(osl_logb_ff, "ff")
 DECL(osl_logb_vv, "xXX")
 
+// Other "math_precision" tiers than the build's default
+#if OSL_FAST_MATH
+UNARY_OP_IMPL(precise_sin)
+UNARY_OP_IMPL(precise_cos)
+BINARY_OP_IMPL(precise_atan2)
+UNARY_OP_IMPL(precise_exp)
+UNARY_OP_IMPL(precise_log)
+BINARY_OP_IMPL(precise_pow)
+DECL(osl_precise_pow_vvf, "xXXf")
+DECL(osl_precise_pow_dvdvdf, "xXXX")
+DECL(osl_precise_pow_dvvdf, "xXXX")
+DECL(osl_precise_pow_dvdvf, "xXXf")
+#else
+UNARY_OP_IMPL(fast_sin)
+UNARY_OP_IMPL(fast_cos)
+BINARY_OP_IMPL(fast_atan2)
+UNARY_OP_IMPL(fast_exp)
+UNARY_OP_IMPL(fast_log)
+BINARY_OP_IMPL(fast_pow)
+DECL(osl_fast_pow_vvf, "xXXf")
+DECL(osl_fast_pow_dvdvdf, "xXXX")
+DECL(osl_fast_pow_dvvdf, "xXXX")
+DECL(osl_fast_pow_dvdvf, "xXXf")
+#endif
+UNARY_OP_IMPL(approx_sin)
+UNARY_OP_IMPL(approx_cos)
+BINARY_OP_IMPL(approx_atan2)
+UNARY_OP_IMPL(approx_exp)
+UNARY_OP_IMPL(approx_log)
+BINARY_OP_IMPL(approx_pow)
+DECL(osl_approx_pow_vvf, "xXXf")
+DECL(osl_approx_pow_dvdvdf, "xXXX")
+DECL(osl_approx_pow_dvvdf, "xXXX")
+DECL(osl_approx_pow_dvdvf, "xXXf")
+
 DECL(osl_floor_ff, "ff")
 DECL(osl_floor_vv, "xXX")
 DECL(osl_ceil_ff, "ff")
@@ -351,6 +402,8 @@ DECL(osl_endswith_iss, "ihh")
 DECL(osl_stoi_is, "ih")
 DECL(osl_stof_fs, "fh")
 DECL(osl_substr_ssii, "hhii")
+DECL(osl_concat_memo, "hXhh")
+DECL(osl_substr_memo, "hXhii")
 DECL(osl_regex_impl, "iXhXihi")
 
 // Used by wide code generator, but are uniform calls
@@ -206,6 +206,15 @@ WIDE_NOISE_DERIV_IMPL(simplexnoise)
 WIDE_NOISE_IMPL(usimplexnoise)
 WIDE_NOISE_DERIV_IMPL(usimplexnoise)
 
+WIDE_NOISE_IMPL(voronoinoise)
+WIDE_NOISE_DERIV_IMPL(voronoinoise)
+
+WIDE_NOISE_IMPL(noise_pcg)
+WIDE_NOISE_DERIV_IMPL(noise_pcg)
+
+WIDE_NOISE_IMPL(snoise_pcg)
+WIDE_NOISE_DERIV_IMPL(snoise_pcg)
+
 
 WIDE_PNOISE_IMPL(pnoise)
 WIDE_PNOISE_DERIV_IMPL(pnoise)
@@ -225,6 +234,8 @@ WIDE_PNOISE_IMPL(phashnoise)
 WIDE_GENERIC_NOISE_DERIV_IMPL(gabornoise)
 WIDE_GENERIC_PNOISE_DERIV_IMPL(gaborpnoise)
 
+WIDE_GENERIC_NOISE_DERIV_IMPL(fractalnoise)
+
 WIDE_GENERIC_NOISE_DERIV_IMPL(genericnoise)
 WIDE_GENERIC_PNOISE_DERIV_IMPL(genericpnoise)
 
@@ -450,6 +461,32 @@ WIDE_UNARY_OP_IMPL(sqrt)
 WIDE_UNARY_OP_IMPL(inversesqrt)
 WIDE_UNARY_OP_IMPL(cbrt)
 
+// Other "math_precision" tiers than the build's default
+#if OSL_FAST_MATH
+WIDE_UNARY_OP_IMPL(precise_sin)
+WIDE_UNARY_OP_IMPL(precise_cos)
+WIDE_BINARY_OP_IMPL(precise_atan2)
+WIDE_UNARY_OP_IMPL(precise_exp)
+WIDE_UNARY_OP_IMPL(precise_log)
+WIDE_BINARY_OP_MASKED_IMPL(precise_pow)
+WIDE_BINARY_VF_OP_MASKED_IMPL(precise_pow)
+#else
+WIDE_UNARY_OP_IMPL(fast_sin)
+WIDE_UNARY_OP_IMPL(fast_cos)
+WIDE_BINARY_OP_IMPL(fast_atan2)
+WIDE_UNARY_OP_IMPL(fast_exp)
+WIDE_UNARY_OP_IMPL(fast_log)
+WIDE_BINARY_OP_MASKED_IMPL(fast_pow)
+WIDE_BINARY_VF_OP_MASKED_IMPL(fast_pow)
+#endif
+WIDE_UNARY_OP_IMPL(approx_sin)
+WIDE_UNARY_OP_IMPL(approx_cos)
+WIDE_BINARY_OP_IMPL(approx_atan2)
+WIDE_UNARY_OP_IMPL(approx_exp)
+WIDE_UNARY_OP_IMPL(approx_log)
+WIDE_BINARY_OP_MASKED_IMPL(approx_pow)
+WIDE_BINARY_VF_OP_MASKED_IMPL(approx_pow)
+
 WIDE_UNARY_F_OR_V_OP_IMPL(logb)
 WIDE_UNARY_F_OR_V_OP_IMPL(floor)
 
@@ -588,6 +625,8 @@ DECL(__OSL_MASKED_OP3(div, Wm, Wm, Wm), "xXXXi")
 DECL(__OSL_OP3(div, Wm, Wm, Wf), "xXXX")
 DECL(__OSL_MASKED_OP3(div, Wm, Wm, Wf), "xXXXi")
 DECL(__OSL_MASKED_OP3(div, Wm, Wf, Wm), "xXXXi")
+DECL(__OSL_MASKED_OP3(div, Wm, Wm, m), "xXXXi")
+DECL(__OSL_MASKED_OP3(div, Wm, Wf, m), "xXXXi")
 
 // forced masked version only
 DECL(__OSL_MASKED_OP3(get_from_to_matrix, Wm, s, s), "iXXssi")
@@ -4,7 +4,10 @@
 
 #pragma once
 
+#include <cstring>
 #include <list>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 #include <OpenImageIO/thread.h>
@@ -70,5 +73,58 @@ private:
 
 
 
+/// A SharedConstantPool keeps a single read-only copy of each distinct
+/// block of constant data it is given, so that every instance and group
+/// using the same constant array (spline knots, lookup tables, color
+/// ramps) can refer to it by address instead of carrying its own copy.
+/// Blocks are 8-byte aligned, never move, and are never freed until the
+/// pool is destroyed.  All methods are thread-safe.
+class SharedConstantPool {
+public:
+    SharedConstantPool() {}
+
+    /// Return the address of a shared copy of the size bytes at data,
+    /// adding one if no identical block is already in the pool.
+    const void* insert(const void* data, size_t size)
+    {
+        size_t hash = std::hash<std::string_view>()(
+            std::string_view((const char*)data, size));
+        OIIO::lock_guard lock(m_mutex);
+        auto range = m_index.equal_range(hash);
+        for (auto i = range.first; i != range.second; ++i)
+            if (i->second.second == size
+                && !memcmp(i->second.first, data, size))
+                return i->second.first;
+        uint64_t* copy = m_pool.alloc((size + 7) / 8);
+        memcpy(copy, data, size);
+        m_index.emplace(hash, std::make_pair((const void*)copy, size));
+        m_bytes += size;
+        return copy;
+    }
+
+    /// Number of distinct blocks in the pool.
+    size_t blocks() const
+    {
+        OIIO::lock_guard lock(m_mutex);
+        return m_index.size();
+    }
+
+    /// Total bytes of distinct constant data in the pool.
+    size_t bytes() const
+    {
+        OIIO::lock_guard lock(m_mutex);
+        return m_bytes;
+    }
+
+private:
+    typedef std::pair<const void*, size_t> block_t;  ///< Data and its size
+    ConstantPool<uint64_t> m_pool { 1 << 16 };  ///< Storage for the copies
+    std::unordered_multimap<size_t, block_t> m_index;  ///< Hash -> block
+    size_t m_bytes = 0;          ///< Total distinct bytes held
+    mutable OIIO::mutex m_mutex;  ///< Thread-safe lock
+};
+
+
+
 };  // namespace pvt
 OSL_NAMESPACE_END
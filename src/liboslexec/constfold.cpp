@@ -26,6 +26,7 @@ static ustring u_cbrt("cbrt");
 static ustring u_cell("cell");
 static ustring u_cellnoise("cellnoise");
 static ustring u_compassign("compassign");
+static ustring u_compref("compref");
 static ustring u_eq("eq");
 static ustring u_error("error");
 static ustring u_fmt_range_check(
@@ -200,6 +201,45 @@ DECLFOLDER(constfold_mul)
             return 1;
         }
     }
+
+    // Closure mix() is not an op, but inlined as c1*(1-x) + c2*x, so the
+    // 'mix' special sauce in constfold_mix doesn't see it. In layered
+    // materials x is usually a mask that is 0 or 1 at most points, and a
+    // closure weighted by zero needlessly runs the whole upstream network
+    // it is connected to. So when a connected closure is scaled by a
+    // weight that isn't constant, turn it into:
+    //    if (weight == 0)
+    //        R = 0;   // The null closure, without touching the closure
+    //    else
+    //        R = closure * weight;
+    // The useparam that runs the upstream layer, added after optimization,
+    // then lands in the 'else' clause alone.
+    int Rind = rop.oparg(op, 0);
+    int Cind = rop.oparg(op, A.typespec().is_closure() ? 1 : 2);
+    int Wind = rop.oparg(op, A.typespec().is_closure() ? 2 : 1);
+    Symbol& C(*rop.inst()->symbol(Cind));
+    Symbol& W(*rop.inst()->symbol(Wind));
+    if (rop.opt_mix() && rop.optimization_pass() > 1 && C.connected()
+        && C.typespec().is_closure() && !W.is_constant()
+        && (W.typespec().is_float() || W.typespec().is_triple())
+        // Not if this mul is already the 'else' of such a test
+        && !(opnum >= 2 && rop.op(opnum - 2).opname() == u_if
+             && rop.op(opnum - 2).jump(0) == opnum)) {
+        int cond  = rop.add_temp(TypeInt);
+        int fzero = rop.add_constant(0.0f);
+        int izero = rop.add_constant(0);
+        rop.insert_code(opnum++, u_eq, RuntimeOptimizer::GroupWithNext, cond,
+                        Wind, fzero);
+        int ifop = opnum;
+        rop.insert_code(opnum++, u_if, RuntimeOptimizer::GroupWithNext, cond);
+        rop.op(ifop).argreadonly(0);
+        rop.symbol(cond)->mark_rw(ifop, true, false);
+        rop.insert_code(opnum++, u_assign, RuntimeOptimizer::GroupWithNext,
+                        Rind, izero);
+        // The 'else' is the original mul, now at opnum
+        rop.op(ifop).set_jump(opnum, opnum + 1);
+        return 1;
+    }
     return 0;
 }
 
@@ -1448,8 +1488,7 @@ DECLFOLDER(constfold_regex_search)
         OSL_DASSERT(Subj.typespec().is_string() && Reg.typespec().is_string());
         ustring s(Subj.get_string());
         ustring r(Reg.get_string());
-        std::regex reg(r.string());
-        int result = std::regex_search(s.string(), reg);
+        int result = find_regex(r).match(s, false);
         int cind   = rop.add_constant(result);
         rop.turn_into_assign(op, cind, "const fold regex_search");
         return 1;
@@ -2213,6 +2252,69 @@ DECLFOLDER(constfold_transformc)
                                  "transformc => constant");
             return 1;
         }
+        // Most transforms between linear spaces, built in or OCIO, are
+        // affine, R = C*M + offset, so do that arithmetic inline rather
+        // than call transformc (and maybe OCIO) for every color.
+        Matrix33 M;
+        Color3 offset;
+        if (!rop.shadingsys().colorsystem().affine_transform(
+                from, to, rop.shaderglobals()->context, M, offset))
+            return 0;
+        int Rind       = rop.inst()->arg(op.firstarg() + 0);
+        int Cind       = rop.inst()->arg(op.firstarg() + 3);
+        bool no_offset = offset == Color3(0.0f);
+        bool diagonal  = M[0][1] == 0.0f && M[0][2] == 0.0f
+                        && M[1][0] == 0.0f && M[1][2] == 0.0f
+                        && M[2][0] == 0.0f && M[2][1] == 0.0f;
+        if (diagonal && no_offset) {
+            rop.turn_into_new_op(op, u_mul, Rind, Cind,
+                                 rop.add_constantc(Color3(M[0][0], M[1][1],
+                                                          M[2][2])),
+                                 "transformc => scale");
+            return 1;
+        }
+        int sum = -1;  // Sum so far
+        if (diagonal) {
+            sum = rop.add_temp(TypeColor);
+            rop.insert_code(opnum++, u_mul, RuntimeOptimizer::GroupWithNext,
+                            sum, Cind,
+                            rop.add_constantc(
+                                Color3(M[0][0], M[1][1], M[2][2])));
+        } else {
+            // C[0]*M[0] + C[1]*M[1] + C[2]*M[2], by rows of the matrix
+            for (int i = 0; i < 3; ++i) {
+                Color3 row(M[i][0], M[i][1], M[i][2]);
+                if (row == Color3(0.0f))
+                    continue;
+                int comp = rop.add_temp(TypeFloat);
+                int term = rop.add_temp(TypeColor);
+                rop.insert_code(opnum++, u_compref,
+                                RuntimeOptimizer::GroupWithNext, comp, Cind,
+                                rop.add_constant(i));
+                rop.insert_code(opnum++, u_mul, RuntimeOptimizer::GroupWithNext,
+                                term, rop.add_constantc(row), comp);
+                if (sum >= 0) {
+                    int newsum = rop.add_temp(TypeColor);
+                    rop.insert_code(opnum++, u_add,
+                                    RuntimeOptimizer::GroupWithNext, newsum,
+                                    sum, term);
+                    sum = newsum;
+                } else {
+                    sum = term;
+                }
+            }
+        }
+        // The next op is the original transformc
+        if (sum < 0)
+            rop.turn_into_assign(rop.op(opnum), rop.add_constantc(offset),
+                                 "transformc => offset");
+        else if (no_offset)
+            rop.turn_into_assign(rop.op(opnum), sum, "transformc => matrix");
+        else
+            rop.turn_into_new_op(rop.op(opnum), u_add, Rind, sum,
+                                 rop.add_constantc(offset),
+                                 "transformc => matrix and offset");
+        return 1;
     }
     return 0;
 }
@@ -2330,11 +2432,14 @@ DECLFOLDER(constfold_getattribute)
         // If the object name is not supplied, it implies that we are
         // supposed to search the shaded object first, then if that fails,
         // the scene-wide namespace.  We can't do that yet, have to wait
-        // until shade time.
+        // until shade time -- unless the renderer has promised that the
+        // attribute is the same for the whole frame.
         ustring obj_name;
         if (object_lookup)
             obj_name = ObjectName.get_string();
-        if (obj_name.empty())
+        if (obj_name.empty()
+            && rop.renderer()->attribute_constancy(obj_name, attr_name)
+                   != AttributeConstancy::PerFrame)
             return 0;
 
         found = array_lookup
@@ -2375,6 +2480,95 @@ DECLFOLDER(constfold_getattribute)
 
 
 
+DECLFOLDER(constfold_dict_find)
+{
+    if (!rop.shadingsys().fold_dict())
+        return 0;
+
+    // dict_find (string dict, string query)
+    // dict_find (int nodeID, string query)
+    Opcode& op(rop.inst()->ops()[opnum]);
+    Symbol& Source(*rop.opargsym(op, 1));
+    Symbol& Query(*rop.opargsym(op, 2));
+    if (!Source.is_constant() || !Query.is_constant())
+        return 0;
+
+    // Only the dictionary store's node IDs mean the same thing in every
+    // context, so those are the only ones we can fold to, or start from.
+    int nodeID = 0;
+    if (Source.typespec().is_int()) {
+        nodeID = Source.get_int();
+        if (nodeID != 0 && nodeID < ShadingSystemImpl::dict_shared_base())
+            return 0;
+    }
+    int result = 0;  // dict_find(0, query) never matches
+    if (Source.typespec().is_string())
+        result = rop.shadingsys().dict_find_shared(Source.get_string(), 0,
+                                                   Query.get_string());
+    else if (nodeID)
+        result = rop.shadingsys().dict_find_shared(ustring(), nodeID,
+                                                   Query.get_string());
+    if (result < 0)
+        return 0;  // Bad dictionary or query -- let it report at runtime
+    rop.turn_into_assign(op, rop.add_constant(result),
+                         "const fold dict_find");
+    return 1;
+}
+
+
+
+DECLFOLDER(constfold_dict_value)
+{
+    if (!rop.shadingsys().fold_dict())
+        return 0;
+
+    // int dict_value (int nodeID, string attribname, output TYPE value)
+    Opcode& op(rop.inst()->ops()[opnum]);
+    Symbol& NodeID(*rop.opargsym(op, 1));
+    Symbol& Name(*rop.opargsym(op, 2));
+    Symbol& Destination(*rop.opargsym(op, 3));
+    if (!NodeID.is_constant() || !Name.is_constant())
+        return 0;
+    int nodeID = NodeID.get_int();
+    if (nodeID == 0) {
+        // Not a node, so it fails and leaves the value alone
+        rop.turn_into_assign_zero(op, "const fold dict_value of no node");
+        return 1;
+    }
+    if (nodeID < ShadingSystemImpl::dict_shared_base())
+        return 0;  // not one of the store's node IDs
+    if (Destination.typespec().is_array())
+        return 0;  // Punt on arrays for now
+
+    const size_t maxbufsize = 1024;
+    char buf[maxbufsize];
+    TypeDesc type = Destination.typespec().simpletype();
+    if (type.size() > maxbufsize)
+        return 0;  // Don't constant fold humongous things
+    if (!rop.shadingcontext()->dict_value(nodeID, Name.get_string(), type,
+                                          buf, false)) {
+        rop.turn_into_assign_zero(op, "const fold dict_value not found");
+        return 1;
+    }
+
+    // Turn it into this, just as for getattribute:
+    //       assign result 1
+    //       assign value [retrieved value]
+    int oldresultarg = rop.inst()->args()[op.firstarg() + 0];
+    int dataarg      = rop.inst()->args()[op.firstarg() + 3];
+    rop.inst()->args()[op.firstarg() + 0] = dataarg;
+    int cind = rop.add_constant(type, &buf);
+    rop.turn_into_assign(op, cind, "const fold dict_value");
+    const int one           = 1;
+    const int args_to_add[] = { oldresultarg, rop.add_constant(TypeInt, &one) };
+    rop.insert_code(opnum, u_assign, args_to_add,
+                    RuntimeOptimizer::RecomputeRWRanges,
+                    RuntimeOptimizer::GroupWithNext);
+    return 1;
+}
+
+
+
 DECLFOLDER(constfold_gettextureinfo)
 {
     Opcode& op(rop.inst()->ops()[opnum]);
@@ -2817,14 +3011,18 @@ DECLFOLDER(constfold_noise)
 
     // Noise with name that is not a constant at osl-compile-time was marked
     // as taking the derivs of its coordinate arguments. If at this point we
-    // can determine that the name is known and not "gabor", when we can
-    // turn its derivative taking off.
-    if (op.argtakesderivs_all() && name.length() && name != "gabor")
+    // can determine that the name is known and not one that uses the
+    // derivs (gabor, the fractal types, baked), we can turn its derivative
+    // taking off.
+    if (op.argtakesderivs_all() && name.length() && name != "gabor"
+        && name != "fbm" && name != "turbulence" && name != "ridged"
+        && name != "baked")
         op.argtakesderivs_all(0);
 
-    // Gabor noise is the only one that takes optional arguments, so
-    // optimize them away for other noise types.
-    if (name.length() && name != "gabor") {
+    // Gabor, the fractal and the baked noises are the only ones that take
+    // optional arguments, so optimize them away for other noise types.
+    if (name.length() && name != "gabor" && name != "fbm"
+        && name != "turbulence" && name != "ridged" && name != "baked") {
         for (int a = arg; a < op.nargs(); ++a) {
             // Advance until we hit a string argument, which will be the
             // first optional token/value pair. Then just turn all arguments
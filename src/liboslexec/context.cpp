@@ -4,9 +4,16 @@
 
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <string>
 #include <vector>
 
+#ifdef __linux__
+#    include <sys/syscall.h>
+#    include <unistd.h>
+#endif
+
+#include <OpenImageIO/strutil.h>
 #include <OpenImageIO/sysutil.h>
 #include <OpenImageIO/thread.h>
 #include <OpenImageIO/timer.h>
@@ -40,6 +47,30 @@ is_aligned(const T* pointer)
     return (ptrAsUint % ByteAlignmentT == 0);
 }
 
+
+
+void
+numa_prefer_node(void* ptr, size_t size, int node)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+    if (node < 0 || node >= 64)
+        return;
+    // Only whole pages can be placed
+    uintptr_t page  = uintptr_t(sysconf(_SC_PAGESIZE));
+    uintptr_t begin = (uintptr_t(ptr) + page - 1) & ~(page - 1);
+    uintptr_t end   = (uintptr_t(ptr) + size) & ~(page - 1);
+    if (end <= begin)
+        return;
+    // mbind(MPOL_PREFERRED, MPOL_MF_MOVE) without needing libnuma. The
+    // kernel reads one bit fewer than maxnode, hence the + 1.
+    const int mpol_preferred    = 1;
+    const unsigned mpol_mf_move = 1 << 1;
+    unsigned long nodemask      = 1UL << node;
+    syscall(SYS_mbind, begin, end - begin, mpol_preferred, &nodemask,
+            sizeof(nodemask) * 8 + 1, mpol_mf_move);
+#endif
+}
+
 }  // namespace pvt
 
 ShadingContext::ShadingContext(ShadingSystemImpl& shadingsys,
@@ -54,6 +85,10 @@ ShadingContext::ShadingContext(ShadingSystemImpl& shadingsys,
 {
     m_shadingsys.m_stat_contexts += 1;
     m_texture_thread_info = NULL;
+    if (threadinfo && threadinfo->numa_node >= 0) {
+        m_closure_pool.numa_node(threadinfo->numa_node);
+        m_scratch_pool.numa_node(threadinfo->numa_node);
+    }
 }
 
 
@@ -65,9 +100,37 @@ ShadingContext::~ShadingContext()
     process_file_output();
 #endif
     m_shadingsys.m_stat_contexts -= 1;
+    if (m_closure_pool_reported) {
+        spin_lock lock(m_shadingsys.m_stat_mutex);
+        m_shadingsys.m_stat_mem_closures -= m_closure_pool_reported;
+    }
     free_dict_resources();
 }
 
+
+
+void
+ShadingContext::reset_closure_pool()
+{
+    if (m_retain_closures)
+        return;
+    m_closure_pool.clear();
+    // A pathological shade may have grown the pool far beyond what others
+    // need; give that memory back rather than holding it forever.
+    size_t max_bytes = size_t(shadingsys().m_closure_pool_max_KB) * 1024;
+    if (max_bytes && m_closure_pool.capacity() > max_bytes) {
+        m_closure_pool.trim(max_bytes / m_closure_pool.blocksize());
+        shadingsys().m_stat_closure_pool_trims += 1;
+    }
+    size_t capacity = m_closure_pool.capacity();
+    if (capacity != m_closure_pool_reported) {
+        spin_lock lock(shadingsys().m_stat_mutex);
+        shadingsys().m_stat_mem_closures += off_t(capacity)
+                                            - off_t(m_closure_pool_reported);
+        m_closure_pool_reported = capacity;
+    }
+}
+
 ShadingContext::RestoreState
 ShadingContext::repurposeForJit()
 {
@@ -90,20 +153,45 @@ ShadingContext::restoreFromJit(const RestoreState& restore_state)
 
 
 bool
-ShadingContext::execute_init(ShaderGroup& sgroup, int threadindex,
+ShadingContext::execute_init(ShaderGroup& group_, int threadindex,
                              int shadeindex, ShaderGlobals& ssg,
                              void* userdata_base_ptr, void* output_base_ptr,
                              bool run)
 {
     if (m_group)
         execute_cleanup();
+    // Run the copy of the group with this point's userdata folded in, if
+    // it has the values the copy was made for, and of that the copy
+    // specialized for this ray's type, if the shading system keeps them.
+    ShaderGroup* rgroup = shadingsys().userdata_variants()
+                              ? &shadingsys().userdata_variant(group_, ssg)
+                              : &group_;
+    if (shadingsys().raytype_variants())
+        rgroup = &shadingsys().raytype_variant(*rgroup, ssg.raytype);
+    // Every "debug_sample_interval" shades, and for rays of the
+    // "debug_sample_raytype" type, run instead the copy of that group
+    // compiled with NaN and uninitialized-value checks.
+    m_debug_sampling = false;
+    if (shadingsys().debug_sampling()) {
+        int interval     = shadingsys().m_debug_sample_interval;
+        m_debug_sampling = (interval > 0 && ++m_debug_shades >= interval)
+                           || (ssg.raytype & debug_sample_raytypes());
+        if (m_debug_sampling) {
+            m_debug_shades = 0;
+            rgroup         = &shadingsys().debug_variant(*rgroup);
+        }
+    }
+    ShaderGroup& sgroup = *rgroup;
     batch_size_executed = 0;
     m_group             = &sgroup;
+    m_compiled          = nullptr;
     m_ticks             = 0;
 
     // Optimize if we haven't already
     if (sgroup.nlayers()) {
         sgroup.start_running();
+        if (shadingsys().memory_budget() > 0)
+            sgroup.mark_used(shadingsys().memory_epoch());
         if (!sgroup.jitted()) {
             auto restore_state = repurposeForJit();
             shadingsys().optimize_group(sgroup, this, true /*do_jit*/);
@@ -116,6 +204,10 @@ ShadingContext::execute_init(ShaderGroup& sgroup, int threadindex,
         }
         if (sgroup.does_nothing())
             return false;
+        // The code this shade runs, even if a re-JIT replaces it meanwhile
+        m_compiled = sgroup.llvm_compiled();
+        if (!m_compiled)
+            return false;
     } else {
         // empty shader - nothing to do!
         return false;
@@ -126,14 +218,14 @@ ShadingContext::execute_init(ShaderGroup& sgroup, int threadindex,
                               : OIIO::Timer::DontStartNow);
 
     // Allocate enough space on the heap
-    size_t heap_size_needed = sgroup.llvm_groupdata_size();
+    size_t heap_size_needed = m_compiled->groupdata_size;
     reserve_heap(heap_size_needed);
     // Zero out the heap memory we will be using
     if (shadingsys().m_clearmemory)
         memset(m_heap.get(), 0, heap_size_needed);
 
     // Set up closure storage
-    m_closure_pool.clear();
+    reset_closure_pool();
 
     // Clear the message blackboard
     m_messages.clear();
@@ -141,11 +233,33 @@ ShadingContext::execute_init(ShaderGroup& sgroup, int threadindex,
     // Clear miscellaneous scratch space
     m_scratch_pool.clear();
 
+    // Matrices and attributes fetched for the last point don't apply to
+    // this one
+    m_matrix_cache_count    = 0;
+    m_attribute_cache_count = 0;
+
     // Zero out stats for this execution
     clear_runtime_stats();
 
+    // Decide whether this shade is one sampled for telemetry
+    int interval         = shadingsys().m_telemetry_interval;
+    m_telemetry_sampling = interval > 0 && ++m_telemetry_shades >= interval;
+    if (m_telemetry_sampling) {
+        m_telemetry_shades   = 0;
+        m_telemetry_textures = 0;
+        m_telemetry_closures = 0;
+    }
+
+    // Decide whether to read the hardware counters over this shade
+    int pmu_interval = shadingsys().m_pmu_interval;
+    m_pmu_sampling   = pmu_interval > 0 && ++m_pmu_shades >= pmu_interval;
+    if (m_pmu_sampling) {
+        m_pmu_shades   = 0;
+        m_pmu_sampling = pmu_read(m_pmu_start);
+    }
+
     if (run) {
-        RunLLVMGroupFunc run_func = sgroup.llvm_compiled_init();
+        RunLLVMGroupFunc run_func = m_compiled->init;
         if (!run_func)
             return false;
         ssg.context             = this;
@@ -171,7 +285,8 @@ ShadingContext::execute_layer(int threadindex, int shadeindex,
                               ShaderGlobals& ssg, void* userdata_base_ptr,
                               void* output_base_ptr, int layernumber)
 {
-    if (!group() || group()->nlayers() == 0 || group()->does_nothing())
+    if (!group() || group()->nlayers() == 0 || group()->does_nothing()
+        || !m_compiled)
         return false;
     OSL_DASSERT(ssg.context == this && ssg.renderer == renderer());
 
@@ -179,7 +294,10 @@ ShadingContext::execute_layer(int threadindex, int shadeindex,
     OIIO::Timer timer(profile ? OIIO::Timer::StartNow
                               : OIIO::Timer::DontStartNow);
 
-    RunLLVMGroupFunc run_func = group()->llvm_compiled_layer(layernumber);
+    RunLLVMGroupFunc run_func = m_compiled->layer(layernumber);
+    if (!run_func)
+        run_func = shadingsys().jit_deferred_layer(*group(), *m_compiled,
+                                                   layernumber);
     if (!run_func)
         return false;
 
@@ -202,16 +320,42 @@ ShadingContext::execute_cleanup()
         return false;
     }
 
-    // Process any queued up error messages, warnings, printfs from shaders
-    process_errors();
+    // Before the error processing, which isn't the shader's own work
+    if (m_pmu_sampling) {
+        uint64_t counts[PmuNumCounters];
+        if (pmu_read(counts)) {
+            group()->m_pmu[0] += 1;
+            for (int i = 0; i < PmuNumCounters; ++i)
+                group()->m_pmu[1 + i] += (long long)(counts[i]
+                                                     - m_pmu_start[i]);
+        }
+        m_pmu_sampling = false;
+    }
+
+    // Process any queued up error messages, warnings, printfs from shaders,
+    // unless scalar formatting is deferred until the context is released
+    // (bounded, so that a chatty shader can't grow the buffer forever).
+    if (!defer_formatting() || execution_is_batched()
+        || m_buffered_errors.size() > 4096)
+        process_errors();
 #if OSL_USE_BATCHED
     process_file_output();
 #endif
 
     if (shadingsys().m_profile) {
         record_runtime_stats();  // Transfer runtime stats to the shadingsys
-        shadingsys().m_stat_total_shading_time_ticks += m_ticks;
-        group()->m_stat_total_shading_time_ticks += m_ticks;
+        // Times go to this thread's profile, merged into the totals when
+        // they're read, rather than straight into the shared counters.
+        if (!m_threadinfo->profile)
+            m_threadinfo->profile.reset(new ThreadProfile(shadingsys()));
+        m_threadinfo->profile->record(*group(), m_ticks);
+    }
+
+    if (m_telemetry_sampling) {
+        group()->m_telemetry[0] += 1;
+        group()->m_telemetry[1] += m_telemetry_textures;
+        group()->m_telemetry[2] += m_telemetry_closures;
+        m_telemetry_sampling = false;
     }
 
     return true;
@@ -259,6 +403,235 @@ ShadingContext::execute(ShaderGroup& sgroup, int threadindex, int shadeindex,
 }
 
 
+
+// Start fetching the next point's globals while this one shades. They are
+// about to be written as well as read.
+static inline void
+prefetch_globals(const ShaderGlobals* sg)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    for (size_t b = 0; b < sizeof(ShaderGlobals); b += 64)
+        __builtin_prefetch((const char*)sg + b, 1);
+#endif
+}
+
+
+
+bool
+ShadingContext::execute_many(ShaderGroup& sgroup, int threadindex,
+                             int shadeindex_begin, span<ShaderGlobals> globals,
+                             void* userdata_base_ptr, void* output_base_ptr,
+                             cspan<OutputBinding> outputs)
+{
+    int telemetry_interval = shadingsys().m_telemetry_interval;
+    int pmu_interval       = shadingsys().m_pmu_interval;
+    bool variants          = shadingsys().raytype_variants();
+    bool userdata_variants = shadingsys().userdata_variants();
+    int debug_interval     = shadingsys().m_debug_sample_interval;
+    int debug_raytypes     = debug_sample_raytypes();
+    bool profile           = shadingsys().m_profile;
+    bool result            = true;
+    bool began             = false;  // Any execute_init at all?
+    bool bound             = false;  // Ready to run the group on a point?
+    int raytype            = 0;
+    for (size_t i = 0, n = globals.size(); i < n; ++i) {
+        if (i + 1 < n)
+            prefetch_globals(&globals[i + 1]);
+        ShaderGlobals& ssg = globals[i];
+        int shadeindex     = shadeindex_begin + int(i);
+
+        // Running the shades again, only those that asked for a ray
+        if (m_trace_pass == TracePass::Replay
+            && m_trace_begin[i] == m_trace_begin[i + 1])
+            continue;
+
+        // Another ray type may run another variant of the group, as may
+        // another point's userdata, and as does a shade sampled for debug
+        // checks and the one after it. Shades that are profiled or sampled
+        // for telemetry or hardware counters, or that follow one that was,
+        // get the whole of execute_init and execute_cleanup so that their
+        // stats are recorded per shade, as does a point that would
+        // overflow the buffered errors.
+        bool full = !bound || profile || m_telemetry_sampling
+                    || m_pmu_sampling || (variants && ssg.raytype != raytype)
+                    || userdata_variants
+                    || m_debug_sampling || (ssg.raytype & debug_raytypes)
+                    || (debug_interval > 0
+                        && m_debug_shades + 1 >= debug_interval)
+                    || (telemetry_interval > 0
+                        && m_telemetry_shades + 1 >= telemetry_interval)
+                    || (pmu_interval > 0 && m_pmu_shades + 1 >= pmu_interval)
+                    || m_buffered_errors.size() > 4096;
+        if (full) {
+            began   = true;
+            raytype = ssg.raytype;
+            bound   = execute_init(sgroup, threadindex, shadeindex, ssg,
+                                   userdata_base_ptr, output_base_ptr, true);
+            if (!bound) {
+                result = false;
+                continue;
+            }
+        } else {
+            // Reset only what execute_init resets between shades; the
+            // group, its heap and the runtime stats carry over.
+            if (debug_interval > 0)
+                ++m_debug_shades;
+            if (telemetry_interval > 0)
+                ++m_telemetry_shades;
+            if (pmu_interval > 0)
+                ++m_pmu_shades;
+            if (shadingsys().m_clearmemory)
+                memset(m_heap.get(), 0, m_compiled->groupdata_size);
+            reset_closure_pool();
+            m_messages.clear();
+            m_scratch_pool.clear();
+            m_matrix_cache_count    = 0;
+            m_attribute_cache_count = 0;
+
+            ssg.context             = this;
+            ssg.shadingStateUniform = &(shadingsys().m_shading_state_uniform);
+            ssg.renderer            = renderer();
+            ssg.Ci                  = NULL;
+            ssg.thread_index        = threadindex;
+            ssg.shade_index         = shadeindex;
+
+            RunLLVMGroupFunc run_func = m_compiled->init;
+            run_func(&ssg, m_heap.get(), userdata_base_ptr, output_base_ptr,
+                     shadeindex, group()->interactive_arena_ptr());
+        }
+        if (m_trace_pass != TracePass::Now)
+            begin_trace_point(int(i));
+        execute_layer(threadindex, shadeindex, ssg, userdata_base_ptr,
+                      output_base_ptr, group()->nlayers() - 1);
+        m_trace_quiet = false;
+
+        for (const OutputBinding& b : outputs) {
+            const Symbol& sym = *(const Symbol*)b.symbol;
+            if (const void* src = symbol_data(sym))
+                memcpy((char*)b.data + int64_t(i) * b.stride, src,
+                       sym.size());
+        }
+    }
+    if (began && !execute_cleanup())
+        result = false;
+    return result;
+}
+
+
+
+bool
+ShadingContext::execute_deferred_trace(ShaderGroup& sgroup, int threadindex,
+                                       int shadeindex_begin,
+                                       span<ShaderGlobals> globals,
+                                       void* userdata_base_ptr,
+                                       void* output_base_ptr,
+                                       cspan<OutputBinding> outputs)
+{
+    if (!renderer()->supports("trace_deferred"))
+        return execute_many(sgroup, threadindex, shadeindex_begin, globals,
+                            userdata_base_ptr, output_base_ptr, outputs);
+
+    // Run every shade, noting the rays they ask for. Shades that ask for
+    // none are done, and those that do are run again once the renderer
+    // has traced the rays, with each trace() then answered from them.
+    // The first run may move P and N, as execute()'s repeats allow for.
+    size_t n = globals.size();
+    m_trace_saved.resize(n);
+    for (size_t i = 0; i < n; ++i)
+        m_trace_saved[i] = { globals[i].P, globals[i].N };
+    m_trace_requests.clear();
+    m_trace_pass = TracePass::Gather;
+    bool result  = execute_many(sgroup, threadindex, shadeindex_begin, globals,
+                                userdata_base_ptr, output_base_ptr, outputs);
+    if (m_trace_requests.size()) {
+        // Where each shade's requests start (they're in order of shade)
+        m_trace_begin.assign(n + 1, 0);
+        for (const RendererServices::TraceRequest& r : m_trace_requests)
+            ++m_trace_begin[r.point + 1];
+        for (size_t i = 0; i < n; ++i)
+            m_trace_begin[i + 1] += m_trace_begin[i];
+        renderer()->trace_deferred(m_trace_requests, globals);
+        shadingsys().m_stat_traces_deferred
+            += (long long)m_trace_requests.size();
+        for (size_t i = 0; i < n; ++i) {
+            if (m_trace_begin[i] < m_trace_begin[i + 1]) {
+                globals[i].P = m_trace_saved[i].first;
+                globals[i].N = m_trace_saved[i].second;
+            }
+        }
+        m_trace_pass = TracePass::Replay;
+        if (!execute_many(sgroup, threadindex, shadeindex_begin, globals,
+                          userdata_base_ptr, output_base_ptr, outputs))
+            result = false;
+    }
+    m_trace_pass = TracePass::Now;
+    return result;
+}
+
+
+
+void
+ShadingContext::begin_trace_point(int point)
+{
+    m_trace_point  = point;
+    m_trace_errors = m_buffered_errors.size();
+    m_trace_args   = m_deferred_args.size();
+    if (m_trace_pass == TracePass::Replay)
+        m_trace_next = m_trace_begin[point];
+}
+
+
+
+bool
+ShadingContext::deferred_trace(const TraceOpt& options, ShaderGlobals* sg,
+                               const Vec3& P, const Vec3& dPdx,
+                               const Vec3& dPdy, const Vec3& R,
+                               const Vec3& dRdx, const Vec3& dRdy, bool& hit)
+{
+    if (m_trace_pass == TracePass::Gather) {
+        if (!m_trace_quiet) {
+            // The shade's first ray: it will be run again, and say all it
+            // has said so far (and will say from here on) then.
+            m_buffered_errors.erase(m_buffered_errors.begin() + m_trace_errors,
+                                    m_buffered_errors.end());
+            m_deferred_args.resize(m_trace_args);
+            m_trace_quiet = true;
+        }
+        RendererServices::TraceRequest request;
+        request.point   = m_trace_point;
+        request.options = options;
+        request.P       = P;
+        request.dPdx    = dPdx;
+        request.dPdy    = dPdy;
+        request.R       = R;
+        request.dRdx    = dRdx;
+        request.dRdy    = dRdy;
+        m_trace_requests.push_back(request);
+        hit = false;
+        return true;
+    }
+
+    // Replaying: answer from the next request, if it's for the same ray.
+    // Once the shade strays from its first run, the rest of its requests
+    // can't be matched up, and its rays are traced as they come.
+    if (m_trace_next < 0 || m_trace_next >= m_trace_begin[m_trace_point + 1])
+        return false;
+    const RendererServices::TraceRequest& r = m_trace_requests[m_trace_next];
+    if (r.options.mindist != options.mindist
+        || r.options.maxdist != options.maxdist
+        || r.options.shade != options.shade
+        || r.options.traceset != options.traceset || r.P != P || r.dPdx != dPdx
+        || r.dPdy != dPdy || r.R != R || r.dRdx != dRdx || r.dRdy != dRdy) {
+        m_trace_next = -1;
+        shadingsys().m_stat_traces_strayed += 1;
+        return false;
+    }
+    ++m_trace_next;
+    hit = renderer()->trace_resume(r, sg);
+    return true;
+}
+
+
 #if OSL_USE_BATCHED
 
 template<int WidthT>
@@ -270,6 +643,8 @@ ShadingContext::Batched<WidthT>::execute_init(
 {
     if (context().m_group)
         context().execute_cleanup();
+    // Deferred output of earlier scalar shades must not be replayed per lane
+    context().process_errors();
 
     context().batch_size_executed = batch_size;
     context().m_group             = &sgroup;
@@ -278,6 +653,8 @@ ShadingContext::Batched<WidthT>::execute_init(
     // Optimize if we haven't already
     if (sgroup.nlayers()) {
         sgroup.start_running();
+        if (shadingsys().memory_budget() > 0)
+            sgroup.mark_used(shadingsys().memory_epoch());
         if (!sgroup.batch_jitted()) {
             auto restore_state = context().repurposeForJit();
             shadingsys().template batched<WidthT>().jit_group(sgroup,
@@ -316,17 +693,20 @@ ShadingContext::Batched<WidthT>::execute_init(
         memset(context().m_heap.get(), 0, heap_size_needed);
 
     // Set up closure storage
-    context().m_closure_pool.clear();
+    context().reset_closure_pool();
 
     // Clear the message blackboard
     context().m_messages.clear();
     context().batched_messages_buffer().clear();
+    context().batched_attribute_cache().clear();
 
     // Clear miscellaneous scratch space
     context().m_scratch_pool.clear();
 
     // Zero out stats for this execution
     context().clear_runtime_stats();
+    context().m_telemetry_sampling = false;  // only scalar shades are sampled
+    context().m_pmu_sampling       = false;
 
     if (run) {
         bsg.uniform.context  = &context();
@@ -392,6 +772,39 @@ ShadingContext::Batched<WidthT>::execute_layer(
 }
 
 
+// Do the first batch_size lanes of the globals and shade indices all
+// hold the same values?
+template<int WidthT>
+static bool
+batch_lanes_identical(const BatchedShaderGlobals<WidthT>& bsg, int batch_size,
+                      Wide<const int, WidthT> wide_shadeindex)
+{
+    auto same = [batch_size](const auto& block) -> bool {
+        auto first = block.get(0);
+        for (int lane = 1; lane < batch_size; ++lane)
+            if (!(block.get(lane) == first))
+                return false;
+        return true;
+    };
+    int shadeindex = wide_shadeindex[0];
+    for (int lane = 1; lane < batch_size; ++lane)
+        if (wide_shadeindex[lane] != shadeindex)
+            return false;
+    const auto& vsg(bsg.varying);
+    return same(vsg.P) && same(vsg.I) && same(vsg.N) && same(vsg.Ng)
+           && same(vsg.u) && same(vsg.v) && same(vsg.dPdx) && same(vsg.dPdy)
+           && same(vsg.dPdz) && same(vsg.dIdx) && same(vsg.dIdy)
+           && same(vsg.dudx) && same(vsg.dudy) && same(vsg.dvdx)
+           && same(vsg.dvdy) && same(vsg.dPdu) && same(vsg.dPdv)
+           && same(vsg.time) && same(vsg.dtime) && same(vsg.dPdtime)
+           && same(vsg.Ps) && same(vsg.dPsdx) && same(vsg.dPsdy)
+           && same(vsg.object2common) && same(vsg.shader2common)
+           && same(vsg.surfacearea) && same(vsg.flipHandedness)
+           && same(vsg.backfacing);
+}
+
+
+
 template<int WidthT>
 bool
 ShadingContext::Batched<WidthT>::execute(
@@ -400,6 +813,65 @@ ShadingContext::Batched<WidthT>::execute(
     void* userdata_base_ptr, void* output_base_ptr, bool run)
 {
     OSL_ASSERT(is_aligned<64>(&bsg));
+
+    // When every lane is the same shading point (flat shaded geometry,
+    // background rays, ...) the full width batched code would compute
+    // one answer WidthT times; shade it once with the scalar JIT and
+    // broadcast the closure instead.  Renderer outputs left in the
+    // heap would not be where batched callers look for them, so only
+    // do this when there are none or they go to an output buffer.
+    if (run && batch_size > 1 && shadingsys().batch_uniform_scalar()
+        && sgroup.m_exec_repeat == 1
+        && (output_base_ptr || sgroup.m_renderer_outputs.empty())
+        && batch_lanes_identical(bsg, batch_size, wide_shadeindex)) {
+        const auto& usg(bsg.uniform);
+        const auto& vsg(bsg.varying);
+        ShaderGlobals sg;
+        memset((void*)&sg, 0, sizeof(ShaderGlobals));
+        sg.P              = vsg.P.get(0);
+        sg.dPdx           = vsg.dPdx.get(0);
+        sg.dPdy           = vsg.dPdy.get(0);
+        sg.dPdz           = vsg.dPdz.get(0);
+        sg.I              = vsg.I.get(0);
+        sg.dIdx           = vsg.dIdx.get(0);
+        sg.dIdy           = vsg.dIdy.get(0);
+        sg.N              = vsg.N.get(0);
+        sg.Ng             = vsg.Ng.get(0);
+        sg.u              = vsg.u.get(0);
+        sg.dudx           = vsg.dudx.get(0);
+        sg.dudy           = vsg.dudy.get(0);
+        sg.v              = vsg.v.get(0);
+        sg.dvdx           = vsg.dvdx.get(0);
+        sg.dvdy           = vsg.dvdy.get(0);
+        sg.dPdu           = vsg.dPdu.get(0);
+        sg.dPdv           = vsg.dPdv.get(0);
+        sg.time           = vsg.time.get(0);
+        sg.dtime          = vsg.dtime.get(0);
+        sg.dPdtime        = vsg.dPdtime.get(0);
+        sg.Ps             = vsg.Ps.get(0);
+        sg.dPsdx          = vsg.dPsdx.get(0);
+        sg.dPsdy          = vsg.dPsdy.get(0);
+        sg.renderstate    = usg.renderstate;
+        sg.tracedata      = usg.tracedata;
+        sg.objdata        = usg.objdata;
+        sg.context        = &context();
+        sg.renderer       = context().renderer();
+        sg.object2common  = vsg.object2common.get(0);
+        sg.shader2common  = vsg.shader2common.get(0);
+        sg.surfacearea    = vsg.surfacearea.get(0);
+        sg.raytype        = usg.raytype;
+        sg.flipHandedness = vsg.flipHandedness.get(0);
+        sg.backfacing     = vsg.backfacing.get(0);
+        bool result = context().execute(sgroup, 0, wide_shadeindex[0], sg,
+                                        userdata_base_ptr, output_base_ptr,
+                                        run);
+        bsg.uniform.context  = &context();
+        bsg.uniform.renderer = context().renderer();
+        assign_all(bsg.varying.Ci, sg.Ci);
+        shadingsys().m_stat_uniform_batches += 1;
+        return result;
+    }
+
     int n = sgroup.m_exec_repeat;
 
     Block<Vec3, WidthT> Psave, Nsave;  // for repeats
@@ -435,6 +907,107 @@ ShadingContext::Batched<WidthT>::execute(
     return result;
 }
 
+
+
+// Copy the first nslices wide slices (values, then derivs) of the lanes
+// in mask from src to dst; each slice holds basesize bytes per lane.
+template<int WidthT>
+static void
+copy_wide_lanes(void* dst, const void* src, TypeDesc type, bool derivs,
+                Mask<WidthT> mask)
+{
+    size_t basesize = type.basesize();
+    size_t nslices  = (type.size() / basesize) * (derivs ? 3 : 1);
+    mask.foreach ([&](ActiveLane lane) {
+        for (size_t slice = 0; slice < nslices; ++slice) {
+            size_t offset = (slice * WidthT + lane.value()) * basesize;
+            memcpy((char*)dst + offset, (const char*)src + offset, basesize);
+        }
+    });
+}
+
+
+
+template<int WidthT>
+Mask<WidthT>
+ShadingContext::Batched<WidthT>::get_attribute_cached(
+    BatchedShaderGlobals<WidthT>* bsg, ustring object, ustring name,
+    TypeDesc type, bool derivs, void* wide_data, Mask<WidthT> mask)
+{
+    auto& cache(context().batched_attribute_cache());
+    auto data_size = [](TypeDesc t, bool d) -> size_t {
+        return t.size() * (d ? 3 : 1) * WidthT;
+    };
+    auto fits = [&](TypeDesc t, bool d) -> bool {
+        return data_size(t, d) + VecReg<WidthT>::alignment
+               <= BatchedAttributeCache::BlockSize;
+    };
+    auto* rs = renderer();
+
+    if (!cache.prefetched && group()) {
+        // Gather everything the group may ask for in one call, over all
+        // the lanes of the batch.
+        cache.prefetched = true;
+        ShaderGroup& g(*group());
+        std::vector<typename BatchedRendererServices<WidthT>::AttributeGather>
+            requests;
+        for (size_t i = 0, e = g.m_attributes_needed.size(); i < e; ++i) {
+            TypeDesc t = g.m_attribute_types[i];
+            bool d     = g.m_attribute_derivs[i];
+            if (t == TypeUnknown || !fits(t, d))
+                continue;
+            void* data = cache.data.alloc(data_size(t, d),
+                                          VecReg<WidthT>::alignment);
+            requests.push_back({ g.m_attribute_scopes[i],
+                                 g.m_attributes_needed[i], t, d, data,
+                                 Mask<WidthT>(false) });
+        }
+        if (requests.size()) {
+            Mask<WidthT> batch_mask(false);
+            batch_mask.set_count_on(context().batch_size_executed);
+            rs->get_attributes(bsg, batch_mask, requests);
+            shadingsys().m_stat_attribute_gathers += 1;
+            for (auto& r : requests)
+                cache.entries.push_back(
+                    { ustring_from(r.object), ustring_from(r.name), r.type,
+                      r.derivs,
+                      static_cast<Mask<MaxSupportedSimdLaneCount>>(batch_mask),
+                      static_cast<Mask<MaxSupportedSimdLaneCount>>(r.found),
+                      r.wide_data });
+        }
+    }
+
+    for (auto& entry : cache.entries) {
+        if (entry.name != name || entry.object != object
+            || !equivalent(entry.type, type) || (derivs && !entry.derivs))
+            continue;
+        Mask<WidthT> requested(entry.requested);
+        if ((mask & ~requested).any_on())
+            continue;
+        Mask<WidthT> found = Mask<WidthT>(entry.found) & mask;
+        copy_wide_lanes<WidthT>(wide_data, entry.data, type, derivs, found);
+        shadingsys().m_stat_attribute_cache_hits += 1;
+        return found;
+    }
+
+    Mask<WidthT> found = rs->get_attribute(bsg, object, name,
+                                           MaskedData<WidthT>(type, derivs,
+                                                              mask,
+                                                              wide_data));
+    if (fits(type, derivs)) {
+        void* data = cache.data.alloc(data_size(type, derivs),
+                                      VecReg<WidthT>::alignment);
+        copy_wide_lanes<WidthT>(data, wide_data, type, derivs, found);
+        cache.entries.push_back(
+            { object, name, type, derivs,
+              static_cast<Mask<MaxSupportedSimdLaneCount>>(mask),
+              static_cast<Mask<MaxSupportedSimdLaneCount>>(found), data });
+    }
+    return found;
+}
+
+
+
 void
 ShadingContext::record_error(ErrorHandler::ErrCode code,
                              const std::string& text,
@@ -459,13 +1032,38 @@ void
 ShadingContext::record_error(ErrorHandler::ErrCode code,
                              const std::string& text) const
 {
+    if (m_trace_quiet)
+        return;  // The shade will say it again when it's run again
     m_buffered_errors.emplace_back(code, text);
-    // If we aren't buffering, just process immediately
-    if (!shadingsys().m_buffer_printf)
+    // If we aren't buffering, just process immediately (but not while
+    // gathering rays, when what a shade has said may yet be dropped)
+    if (!shadingsys().m_buffer_printf && m_trace_pass != TracePass::Gather)
         process_errors();
 }
 
 
+
+void
+ShadingContext::record_encoded(ErrorHandler::ErrCode code, ustringhash fmt,
+                               int32_t arg_count, const EncodedType* arg_types,
+                               uint32_t arg_values_size,
+                               const uint8_t* arg_values) const
+{
+    if (m_trace_quiet)
+        return;
+    ErrorItem item(code, std::string());
+    item.fmt_hash        = fmt.hash();
+    item.arg_count       = arg_count;
+    item.arg_offset      = m_deferred_args.size();
+    const uint8_t* types = reinterpret_cast<const uint8_t*>(arg_types);
+    m_deferred_args.insert(m_deferred_args.end(), types,
+                           types + arg_count * sizeof(EncodedType));
+    m_deferred_args.insert(m_deferred_args.end(), arg_values,
+                           arg_values + arg_values_size);
+    m_buffered_errors.push_back(std::move(item));
+}
+
+
 // separate declaration from definition of template function
 // to ensure noinline is respected
 template<typename ErrorsT, typename TestFunctorT>
@@ -516,6 +1114,19 @@ ShadingContext::process_errors() const
     if (!nerrors)
         return;
 
+    // Format any deferred items now, before taking the output lock.
+    for (auto& item : m_buffered_errors) {
+        if (item.fmt_hash) {
+            const uint8_t* args = m_deferred_args.data() + item.arg_offset;
+            OSL::decode_message(item.fmt_hash, item.arg_count,
+                                reinterpret_cast<const EncodedType*>(args),
+                                args + item.arg_count * sizeof(EncodedType),
+                                item.msgString);
+            item.fmt_hash = 0;
+        }
+    }
+    m_deferred_args.clear();
+
     // Use a mutex to make sure output from different threads stays
     // together, at least for one shader invocation, rather than being
     // interleaved with other threads.
@@ -630,17 +1241,37 @@ ShadingContext::symbol_data(const Symbol& sym) const
 
 
 
-const std::regex&
+const CompiledRegex&
 ShadingContext::find_regex(ustring r)
 {
     RegexMap::const_iterator found = m_regex_map.find(r);
     if (found != m_regex_map.end())
         return *found->second;
-    // otherwise, it wasn't found, add it
-    m_regex_map[r].reset(new std::regex(r.c_str()));
-    m_shadingsys.m_stat_regexes += 1;
-    // std::cerr << "Made new regex for " << r << "\n";
-    return *m_regex_map[r];
+    // otherwise, get it from the shared cache and remember it here
+    bool compiled              = false;
+    const CompiledRegex& regex = pvt::find_regex(r, &compiled);
+    if (compiled)
+        m_shadingsys.m_stat_regexes += 1;
+    m_regex_map[r] = &regex;
+    return regex;
+}
+
+
+
+ustringhash_pod
+ShadingContext::format(const FormatPlan& plan, const uint8_t* arg_values)
+{
+    string_view args((const char*)arg_values, plan.arg_values_size());
+    size_t slot = (OIIO::Strutil::strhash(args) ^ size_t(&plan))
+                  % (sizeof(m_format_memo) / sizeof(m_format_memo[0]));
+    FormatMemo& memo(m_format_memo[slot]);
+    if (memo.plan == &plan && memo.arg_values == args)
+        return memo.result;
+    plan.format(arg_values, m_format_buffer);
+    memo.plan       = &plan;
+    memo.arg_values = args;
+    memo.result     = ustring(m_format_buffer).hash();
+    return memo.result;
 }
 
 
@@ -679,6 +1310,77 @@ ShadingContext::osl_get_attribute(ShaderGlobals* sg, void* objdata,
 
 
 
+void
+ShadingContext::gather_userdata(ShaderGlobals* sg, char* groupdata,
+                                char* userdata_initialized)
+{
+    const ShaderGroup& g(*group());
+    int n = int(g.m_userdata_gathered.size());
+    RendererServices::UserdataGather* requests
+        = OSL_ALLOCA(RendererServices::UserdataGather, n);
+    for (int r = 0; r < n; ++r) {
+        int i       = g.m_userdata_gathered[r];
+        requests[r] = { g.m_userdata_names[i], g.m_userdata_types[i],
+                        bool(g.m_userdata_derivs[i]),
+                        groupdata + g.m_userdata_offsets[i], false };
+    }
+    renderer()->get_userdata_all(sg, { requests, n });
+    for (int r = 0; r < n; ++r) {
+        // 1 = not found, 2 = found, as osl_bind_interpolated_param sets
+        userdata_initialized[g.m_userdata_gathered[r]] = 1 + requests[r].found;
+    }
+    m_stat_get_userdata_calls += n;
+}
+
+
+
+bool
+ShadingContext::osl_get_attribute_per_object(ShaderGlobals* sg,
+                                             int dest_derivs,
+                                             ustringhash obj_name,
+                                             ustringhash attr_name,
+                                             int array_lookup, int index,
+                                             TypeDesc attr_type,
+                                             void* attr_dest)
+{
+    size_t size = attr_type.size() * (dest_derivs ? 3 : 1);
+    if (size > sizeof(CachedAttribute::value))
+        return osl_get_attribute(sg, sg->objdata, dest_derivs, obj_name,
+                                 attr_name, array_lookup, index, attr_type,
+                                 attr_dest);
+
+    for (int i = 0; i < m_attribute_cache_count; ++i) {
+        const CachedAttribute& c(m_attribute_cache[i]);
+        if (c.object == obj_name && c.name == attr_name && c.type == attr_type
+            && c.index == index && c.array_lookup == bool(array_lookup)
+            && c.derivs == bool(dest_derivs)) {
+            if (c.ok)
+                memcpy(attr_dest, c.value, size);
+            return c.ok;
+        }
+    }
+
+    bool ok = osl_get_attribute(sg, sg->objdata, dest_derivs, obj_name,
+                                attr_name, array_lookup, index, attr_type,
+                                attr_dest);
+    int i   = m_attribute_cache_count < attribute_cache_size
+                  ? m_attribute_cache_count++
+                  : (m_attribute_cache_next++ % attribute_cache_size);
+    CachedAttribute& c(m_attribute_cache[i]);
+    c.object       = obj_name;
+    c.name         = attr_name;
+    c.type         = attr_type;
+    c.index        = index;
+    c.array_lookup = array_lookup;
+    c.derivs       = dest_derivs;
+    c.ok           = ok;
+    if (ok)
+        memcpy(c.value, attr_dest, size);
+    return ok;
+}
+
+
+
 OSL_SHADEOP void
 osl_incr_layers_executed(ShaderGlobals* sg)
 {
@@ -0,0 +1,136 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <algorithm>
+#include <cstring>
+
+#include <OSL/rendererservices.h>
+
+#include "devicearena.h"
+
+OSL_NAMESPACE_BEGIN
+namespace pvt {
+
+static const size_t device_arena_align = 16;
+
+
+
+DeviceArena::DeviceArena(RendererServices* renderer, size_t blocksize)
+    : m_renderer(renderer), m_blocksize(blocksize)
+{
+}
+
+
+
+DeviceArena::~DeviceArena()
+{
+    for (auto&& b : m_blocks)
+        m_renderer->device_free(b.device);
+}
+
+
+
+uint8_t*
+DeviceArena::alloc(size_t size)
+{
+    size = (size + device_arena_align - 1) & ~(device_arena_align - 1);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto&& b : m_blocks) {
+        if (b.size - b.used >= size) {
+            uint8_t* dptr = b.device + b.used;
+            b.used += size;
+            b.live += 1;
+            return dptr;
+        }
+    }
+    // None has room, so add a block (big enough, if this is larger than
+    // the usual block size).
+    Block b;
+    b.size   = std::max(size, m_blocksize);
+    b.device = reinterpret_cast<uint8_t*>(m_renderer->device_alloc(b.size));
+    if (!b.device)
+        return nullptr;
+    b.host.reset(new uint8_t[b.size]);
+    b.used = size;
+    b.live = 1;
+    m_blocks.push_back(std::move(b));
+    return m_blocks.back().device;
+}
+
+
+
+DeviceArena::Block*
+DeviceArena::find_block(const uint8_t* dptr)
+{
+    for (auto&& b : m_blocks)
+        if (dptr >= b.device && dptr < b.device + b.size)
+            return &b;
+    return nullptr;
+}
+
+
+
+void
+DeviceArena::free(const uint8_t* dptr)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Block* b = find_block(dptr);
+    if (b && --b->live == 0) {
+        b->used        = 0;
+        b->dirty_begin = 0;
+        b->dirty_end   = 0;
+    }
+}
+
+
+
+void
+DeviceArena::write(uint8_t* dptr, const void* src, size_t size)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Block* b = find_block(dptr);
+    if (!b || !size)
+        return;
+    size_t begin = dptr - b->device;
+    memcpy(b->host.get() + begin, src, size);
+    if (b->dirty_begin == b->dirty_end) {
+        b->dirty_begin = begin;
+        b->dirty_end   = begin + size;
+    } else {
+        b->dirty_begin = std::min(b->dirty_begin, begin);
+        b->dirty_end   = std::max(b->dirty_end, begin + size);
+    }
+}
+
+
+
+void
+DeviceArena::take_changes(std::vector<DeviceCopy>& copies)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto&& b : m_blocks) {
+        if (b.dirty_begin == b.dirty_end)
+            continue;
+        copies.push_back({ b.device + b.dirty_begin,
+                           b.host.get() + b.dirty_begin,
+                           b.dirty_end - b.dirty_begin });
+        b.dirty_begin = 0;
+        b.dirty_end   = 0;
+    }
+}
+
+
+
+size_t
+DeviceArena::capacity() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size_t total = 0;
+    for (auto&& b : m_blocks)
+        total += b.size;
+    return total;
+}
+
+}  // namespace pvt
+OSL_NAMESPACE_END
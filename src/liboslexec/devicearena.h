@@ -0,0 +1,72 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <OSL/oslconfig.h>
+
+OSL_NAMESPACE_BEGIN
+class RendererServices;
+
+namespace pvt {
+
+// A range of host memory to be copied to the device.
+struct DeviceCopy {
+    uint8_t* dst;
+    const uint8_t* src;
+    size_t size;
+};
+
+// Device memory for the per-group data of an OptiX renderer, such as the
+// interactive parameters. Rather than asking the renderer for a small
+// allocation per group, this sub-allocates from a few large blocks that
+// it allocates, keeping a host copy of each. Writes go to the host copy
+// and mark the range changed, and take_changes() gives what changed in
+// each block as one copy, to be sent to the device once per frame rather
+// than once per group or parameter.
+class DeviceArena {
+public:
+    DeviceArena(RendererServices* renderer, size_t blocksize);
+    ~DeviceArena();
+
+    /// Allocate size bytes of device memory, 16-byte aligned, or return
+    /// nullptr if the renderer couldn't allocate a block.
+    uint8_t* alloc(size_t size);
+
+    /// Free an allocation. A block is reused once all of its allocations
+    /// are freed.
+    void free(const uint8_t* dptr);
+
+    /// Set size bytes at dptr (within an allocation) on the next upload.
+    void write(uint8_t* dptr, const void* src, size_t size);
+
+    /// Add to `copies` what was written since the last call, as one copy
+    /// per block, from the blocks' host copies.
+    void take_changes(std::vector<DeviceCopy>& copies);
+
+    /// Total device memory of the blocks.
+    size_t capacity() const;
+
+private:
+    struct Block {
+        uint8_t* device = nullptr;
+        std::unique_ptr<uint8_t[]> host;
+        size_t size = 0, used = 0;
+        int live    = 0;  // Allocations not yet freed
+        size_t dirty_begin = 0, dirty_end = 0;
+    };
+    Block* find_block(const uint8_t* dptr);
+
+    RendererServices* m_renderer;
+    size_t m_blocksize;
+    std::vector<Block> m_blocks;
+    mutable std::mutex m_mutex;
+};
+
+}  // namespace pvt
+OSL_NAMESPACE_END
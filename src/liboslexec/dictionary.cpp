@@ -2,13 +2,19 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
 #include <cctype>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+#include <OpenImageIO/filesystem.h>
 #include <OpenImageIO/strutil.h>
 
 #include <pugixml.hpp>
@@ -18,6 +24,7 @@ namespace pugi = OIIO::pugi;
 #endif
 
 
+#include "mappedfile.h"
 #include "oslexec_pvt.h"
 #include <OSL/fmt_util.h>
 
@@ -26,6 +33,726 @@ OSL_NAMESPACE_BEGIN
 namespace pvt {  // OSL::pvt
 
 
+// Binary dictionaries, as written by compile_dictionary().
+//
+// An ".odict" file is a header followed by flat tables -- nodes,
+// attributes, the floats and ints their values parse as, a hash index of
+// query paths, the node lists of that index, and the string table -- all
+// made of 32 bit words, so that it is used in place from a memory mapping
+// with no parsing at all.  Nodes are numbered in document order, node 0
+// being the document itself, so the descendants of any node are the run
+// of nodes following it.
+//
+static const char odict_magic[8] = { 'O', 'S', 'L', 'D', 'I', 'C', 'T', 0 };
+static constexpr uint32_t odict_version = 1;
+
+struct OdictHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nnodes, nattribs, nfloats, nints, nbuckets, nlist, nchars;
+};
+
+// The value of a node or attribute: its text, and the numbers it parses as
+// when asked for as floats or ints.
+struct OdictValue {
+    uint32_t text;             // offset in the string table
+    uint32_t floats, nfloats;  // range of the float table
+    uint32_t ints, nints;      // range of the int table
+};
+
+struct OdictNode {
+    uint32_t type;  // pugi::xml_node_type
+    uint32_t name;  // offset in the string table
+    OdictValue value;
+    uint32_t parent, first_child, next_sibling;  // 0 means none
+    uint32_t attribs, nattribs;                  // range of attribs table
+};
+
+struct OdictAttrib {
+    uint32_t name;  // offset in the string table
+    OdictValue value;
+};
+
+// Open addressed hash table entry of the index, keyed by the query.
+struct OdictBucket {
+    uint32_t hash;
+    uint32_t query;        // offset in the string table, 0 means empty
+    uint32_t list, nlist;  // range of the node list table
+};
+
+
+
+static uint32_t
+odict_hash(string_view s)
+{
+    // FNV-1a, rather than the ustring hash, so files don't depend on the
+    // version of OIIO that wrote them.
+    uint32_t h = 2166136261u;
+    for (unsigned char c : s)
+        h = (h ^ c) * 16777619u;
+    return h;
+}
+
+
+
+// Flatten a parsed XML document into the tables of an ".odict" file.
+class OdictWriter {
+public:
+    OdictWriter()
+    {
+        m_chars.push_back(0);  // string offset 0 is ""
+    }
+
+    void add_document(const pugi::xml_document& doc)
+    {
+        add_node(doc, 0, std::string());
+    }
+
+    bool write(string_view filename, std::string& err);
+
+private:
+    uint32_t add_string(string_view s);
+    OdictValue add_value(const char* s);
+    uint32_t add_node(const pugi::xml_node& n, uint32_t parent,
+                      const std::string& path);
+
+    std::vector<OdictNode> m_nodes;
+    std::vector<OdictAttrib> m_attribs;
+    std::vector<float> m_floats;
+    std::vector<int> m_ints;
+    std::vector<char> m_chars;
+    std::unordered_map<std::string, uint32_t> m_strings;
+    // The matches for each indexed query, in document order.
+    std::map<std::string, std::vector<uint32_t>> m_paths;
+};
+
+
+
+uint32_t
+OdictWriter::add_string(string_view s)
+{
+    if (s.empty())
+        return 0;
+    auto found = m_strings.emplace(std::string(s), uint32_t(m_chars.size()));
+    if (found.second) {
+        m_chars.insert(m_chars.end(), s.begin(), s.end());
+        m_chars.push_back(0);
+    }
+    return found.first->second;
+}
+
+
+
+OdictValue
+OdictWriter::add_value(const char* s)
+{
+    OdictValue v;
+    v.text   = add_string(s);
+    v.floats = uint32_t(m_floats.size());
+    string_view str(s);
+    float f;
+    while (Strutil::parse_float(str, f)) {
+        m_floats.push_back(f);
+        Strutil::parse_char(str, ',');
+    }
+    v.nfloats = uint32_t(m_floats.size()) - v.floats;
+    v.ints    = uint32_t(m_ints.size());
+    str       = s;
+    int i;
+    while (Strutil::parse_int(str, i)) {
+        m_ints.push_back(i);
+        Strutil::parse_char(str, ',');
+    }
+    v.nints = uint32_t(m_ints.size()) - v.ints;
+    return v;
+}
+
+
+
+uint32_t
+OdictWriter::add_node(const pugi::xml_node& n, uint32_t parent,
+                      const std::string& path)
+{
+    uint32_t index = uint32_t(m_nodes.size());
+    OdictNode node;
+    node.type         = uint32_t(n.type());
+    node.name         = add_string(n.name());
+    node.value        = add_value(n.value());
+    node.parent       = parent;
+    node.first_child  = 0;
+    node.next_sibling = 0;
+    node.attribs      = uint32_t(m_attribs.size());
+    for (auto&& a : n.attributes())
+        m_attribs.push_back({ add_string(a.name()), add_value(a.value()) });
+    node.nattribs = uint32_t(m_attribs.size()) - node.attribs;
+    m_nodes.push_back(node);
+
+    std::string nodepath = path;
+    if (n.type() == pugi::node_element) {
+        nodepath += "/";
+        nodepath += n.name();
+        m_paths[nodepath].push_back(index);
+        m_paths[std::string("//") + n.name()].push_back(index);
+    }
+    uint32_t prev = 0;
+    for (auto&& c : n.children()) {
+        uint32_t child = add_node(c, index, nodepath);
+        if (prev)
+            m_nodes[prev].next_sibling = child;
+        else
+            m_nodes[index].first_child = child;
+        prev = child;
+    }
+    return index;
+}
+
+
+
+bool
+OdictWriter::write(string_view filename, std::string& err)
+{
+    uint32_t nbuckets = 1;
+    while (nbuckets < 2 * m_paths.size())
+        nbuckets *= 2;
+    std::vector<OdictBucket> buckets(nbuckets, OdictBucket { 0, 0, 0, 0 });
+    std::vector<uint32_t> lists;
+    for (auto&& p : m_paths) {
+        uint32_t hash = odict_hash(p.first);
+        uint32_t b    = hash & (nbuckets - 1);
+        while (buckets[b].query)
+            b = (b + 1) & (nbuckets - 1);
+        buckets[b] = { hash, add_string(p.first), uint32_t(lists.size()),
+                       uint32_t(p.second.size()) };
+        lists.insert(lists.end(), p.second.begin(), p.second.end());
+    }
+    while (m_chars.size() % 4)
+        m_chars.push_back(0);
+
+    OdictHeader header;
+    memcpy(header.magic, odict_magic, sizeof(header.magic));
+    header.version  = odict_version;
+    header.nnodes   = uint32_t(m_nodes.size());
+    header.nattribs = uint32_t(m_attribs.size());
+    header.nfloats  = uint32_t(m_floats.size());
+    header.nints    = uint32_t(m_ints.size());
+    header.nbuckets = nbuckets;
+    header.nlist    = uint32_t(lists.size());
+    header.nchars   = uint32_t(m_chars.size());
+
+    OIIO::ofstream out;
+    OIIO::Filesystem::open(out, filename,
+                           std::ios_base::out | std::ios_base::binary);
+    auto put = [&](const void* data, size_t size) {
+        out.write((const char*)data, std::streamsize(size));
+    };
+    put(&header, sizeof(header));
+    put(m_nodes.data(), m_nodes.size() * sizeof(OdictNode));
+    put(m_attribs.data(), m_attribs.size() * sizeof(OdictAttrib));
+    put(m_floats.data(), m_floats.size() * sizeof(float));
+    put(m_ints.data(), m_ints.size() * sizeof(int));
+    put(buckets.data(), buckets.size() * sizeof(OdictBucket));
+    put(lists.data(), lists.size() * sizeof(uint32_t));
+    put(m_chars.data(), m_chars.size());
+    if (!out) {
+        err = fmtformat("Could not write dictionary \"{}\"", filename);
+        return false;
+    }
+    return true;
+}
+
+
+
+// A read-only ".odict" file, memory mapped where possible.
+class OdictFile {
+public:
+    OdictFile() {}
+    OdictFile(const OdictFile&) = delete;
+
+    bool open(const std::string& filename, std::string& err);
+
+    // Find the nodes matching the query, searching from node root, in
+    // document order.  Queries of indexed paths are a single hash lookup;
+    // others are evaluated if they are paths of element names, "*",
+    // "text()", "." or "..", each optionally with an [@attrib] or
+    // [@attrib='value'] predicate.  If the query is anything fancier,
+    // return false and set err.
+    bool select(uint32_t root, string_view query,
+                std::vector<uint32_t>& matches, std::string& err) const;
+
+    // The value of the named attribute of the node, or of the node itself
+    // if attribname is empty, or nullptr if it has no such attribute.
+    const OdictValue* value(uint32_t node, string_view attribname) const;
+
+    const char* text(const OdictValue& v) const { return m_chars + v.text; }
+    const float* floats(const OdictValue& v) const
+    {
+        return m_floats + v.floats;
+    }
+    const int* ints(const OdictValue& v) const { return m_ints + v.ints; }
+
+    // An address unique to node n, for keying caches.
+    const void* node_identity(uint32_t n) const { return m_nodes + n; }
+
+private:
+    const OdictBucket* lookup(string_view query) const;
+    bool step_matches(uint32_t n, string_view step, string_view attrib,
+                      const string_view* attribvalue) const;
+    // One past the last descendant of node n.
+    uint32_t subtree_end(uint32_t n) const;
+
+    MappedFile m_file;
+    const OdictHeader* m_header  = nullptr;
+    const OdictNode* m_nodes     = nullptr;
+    const OdictAttrib* m_attribs = nullptr;
+    const float* m_floats        = nullptr;
+    const int* m_ints            = nullptr;
+    const OdictBucket* m_buckets = nullptr;
+    const uint32_t* m_lists      = nullptr;
+    const char* m_chars          = nullptr;
+};
+
+
+
+bool
+OdictFile::open(const std::string& filename, std::string& err)
+{
+    if (!m_file.open(filename)) {
+        err = fmtformat("Could not read dictionary \"{}\"", filename);
+        return false;
+    }
+    const char* data = m_file.data();
+    size_t filesize  = m_file.size();
+
+    m_header    = (const OdictHeader*)data;
+    size_t size = sizeof(OdictHeader);
+    if (filesize >= size) {
+        size += m_header->nnodes * sizeof(OdictNode)
+                + m_header->nattribs * sizeof(OdictAttrib)
+                + m_header->nfloats * sizeof(float)
+                + m_header->nints * sizeof(int)
+                + m_header->nbuckets * sizeof(OdictBucket)
+                + m_header->nlist * sizeof(uint32_t) + m_header->nchars;
+    }
+    if (filesize < sizeof(OdictHeader)
+        || memcmp(m_header->magic, odict_magic, sizeof(odict_magic))
+        || m_header->version != odict_version || size != filesize
+        || !m_header->nnodes || !m_header->nbuckets || !m_header->nchars
+        || data[filesize - 1]) {
+        err = fmtformat("\"{}\" is not a valid dictionary", filename);
+        return false;
+    }
+    m_nodes   = (const OdictNode*)(m_header + 1);
+    m_attribs = (const OdictAttrib*)(m_nodes + m_header->nnodes);
+    m_floats  = (const float*)(m_attribs + m_header->nattribs);
+    m_ints    = (const int*)(m_floats + m_header->nfloats);
+    m_buckets = (const OdictBucket*)(m_ints + m_header->nints);
+    m_lists   = (const uint32_t*)(m_buckets + m_header->nbuckets);
+    m_chars   = (const char*)(m_lists + m_header->nlist);
+    return true;
+}
+
+
+
+const OdictBucket*
+OdictFile::lookup(string_view query) const
+{
+    uint32_t hash = odict_hash(query);
+    uint32_t mask = m_header->nbuckets - 1;
+    for (uint32_t b = hash & mask; m_buckets[b].query; b = (b + 1) & mask) {
+        if (m_buckets[b].hash == hash && query == m_chars + m_buckets[b].query)
+            return m_buckets + b;
+    }
+    return nullptr;
+}
+
+
+
+const OdictValue*
+OdictFile::value(uint32_t node, string_view attribname) const
+{
+    const OdictNode& n(m_nodes[node]);
+    if (attribname.empty())
+        return &n.value;
+    for (uint32_t a = n.attribs; a < n.attribs + n.nattribs; ++a)
+        if (attribname == m_chars + m_attribs[a].name)
+            return &m_attribs[a].value;
+    return nullptr;
+}
+
+
+
+uint32_t
+OdictFile::subtree_end(uint32_t n) const
+{
+    for (; n; n = m_nodes[n].parent)
+        if (m_nodes[n].next_sibling)
+            return m_nodes[n].next_sibling;
+    return m_header->nnodes;
+}
+
+
+
+bool
+OdictFile::step_matches(uint32_t n, string_view step, string_view attrib,
+                        const string_view* attribvalue) const
+{
+    uint32_t type = m_nodes[n].type;
+    if (step == "text()")
+        return type == uint32_t(pugi::node_pcdata)
+               || type == uint32_t(pugi::node_cdata);
+    if (type != uint32_t(pugi::node_element)
+        || (step != "*" && step != m_chars + m_nodes[n].name))
+        return false;
+    if (attrib.size()) {
+        const OdictValue* v = value(n, attrib);
+        return v && (!attribvalue || *attribvalue == text(*v));
+    }
+    return true;
+}
+
+
+
+bool
+OdictFile::select(uint32_t root, string_view query,
+                  std::vector<uint32_t>& matches, std::string& err) const
+{
+    matches.clear();
+    if (Strutil::starts_with(query, "/")) {
+        if (const OdictBucket* b = lookup(query)) {
+            matches.assign(m_lists + b->list, m_lists + b->list + b->nlist);
+            return true;
+        }
+        root = 0;  // absolute paths start from the document
+    }
+
+    std::vector<uint32_t> from { root };
+    string_view q = query;
+    bool first    = true;
+    while (first || q.size()) {
+        bool descendant = Strutil::parse_prefix(q, "//");
+        if (!descendant && !Strutil::parse_prefix(q, "/") && !first)
+            break;
+        first = false;
+
+        // The step, and its optional predicate
+        size_t len       = std::min(q.find_first_of("/["), q.size());
+        string_view step = q.substr(0, len);
+        q.remove_prefix(len);
+        string_view attrib, attribvalue;
+        bool has_value = false;
+        if (q.size() && q[0] == '[') {
+            q.remove_prefix(1);
+            if (!Strutil::parse_char(q, '@', false))
+                break;
+            attrib = Strutil::parse_until(q, "=]");
+            if (Strutil::parse_char(q, '=', false)) {
+                char quote = q.size() ? q[0] : 0;
+                size_t end = q.find(quote, 1);
+                if ((quote != '\'' && quote != '"') || end == q.npos)
+                    break;
+                attribvalue = q.substr(1, end - 1);
+                has_value   = true;
+                q.remove_prefix(end + 1);
+            }
+            if (attrib.empty() || !Strutil::parse_char(q, ']', false))
+                break;
+        }
+        bool self_or_parent = (step == "." || step == "..");
+        if (step.empty() || (self_or_parent && (descendant || attrib.size())))
+            break;
+        if (step != "*" && step != "text()"
+            && std::any_of(step.begin(), step.end(), [](char c) {
+                   return !isalnum((unsigned char)c) && !strchr("_-.:", c);
+               }))
+            break;  // function calls, axes, etc.
+
+        for (uint32_t n : from) {
+            if (step == ".")
+                matches.push_back(n);
+            else if (step == "..") {
+                if (n)
+                    matches.push_back(m_nodes[n].parent);
+            } else if (descendant) {
+                for (uint32_t d = n + 1, end = subtree_end(n); d < end; ++d)
+                    if (step_matches(d, step, attrib,
+                                     has_value ? &attribvalue : nullptr))
+                        matches.push_back(d);
+            } else {
+                for (uint32_t c = m_nodes[n].first_child; c;
+                     c = m_nodes[c].next_sibling)
+                    if (step_matches(c, step, attrib,
+                                     has_value ? &attribvalue : nullptr))
+                        matches.push_back(c);
+            }
+        }
+        // Keep the matches in document order, without duplicates
+        std::sort(matches.begin(), matches.end());
+        matches.erase(std::unique(matches.begin(), matches.end()),
+                      matches.end());
+        if (q.empty())
+            return true;
+        from.swap(matches);
+        matches.clear();
+    }
+    matches.clear();
+    err = fmtformat("dict_find query '{}' is not supported for .odict files",
+                    query);
+    return false;
+}
+
+
+
+// Parsed XML documents and the nodes matching queries within them, shared
+// by the Dictionary of every ShadingContext of a ShadingSystem.
+//
+// The documents are parsed once per process rather than once per thread,
+// and are never modified after that, so any number of threads may query
+// them at once.  Query results are keyed by the node the search starts
+// from and the query string, and are never removed, so a hit only takes
+// the read side of a lock.
+//
+class DictionaryStore {
+public:
+    typedef std::vector<pugi::xml_node> NodeList;
+
+    // A dictionary: parsed xml, or an opened ".odict" file.
+    struct Document {
+        pugi::xml_document doc;
+        std::unique_ptr<OdictFile> odict;  // if it's a binary dictionary
+        std::string error;                 // if it didn't parse
+    };
+
+    // Return the parsed document given its xml or filename, parsing it on
+    // first use.  If it fails to parse, return nullptr and set err.
+    const Document* document(ustring dictionaryname, std::string& err);
+
+    // Return the nodes matching the query, starting the search from root
+    // of an xml document.  If the query is not valid xpath, return nullptr
+    // and set err.  (Binary dictionaries are searched directly.)
+    std::shared_ptr<const NodeList> select(const pugi::xml_node& root,
+                                           ustring query, std::string& err);
+
+    // Node IDs from shared_base up are numbered by the store rather than
+    // by a context, so that they mean the same node in every context and
+    // the runtime optimizer may fold dict_find calls to them.
+    static constexpr int shared_base = ShadingSystemImpl::dict_shared_base();
+
+    // A node numbered by the store.
+    struct SharedNode {
+        ustring dictionary;   // name of its document
+        const Document* doc;  // its document
+        pugi::xml_node node;  // which node within the dictionary
+        uint32_t onode;       // ... or within a binary dictionary
+        int next;             // next node for the same query
+    };
+
+    // Look up a query, from the root of the named dictionary if nodeID is
+    // 0, or else from shared node nodeID.  Return the ID of the first
+    // shared node matching, or 0 if nothing matched, or -1 if the
+    // dictionary or query is bad (which is left for the shader to report
+    // when it runs).
+    int find(ustring dictionaryname, int nodeID, ustring query);
+
+    // Retrieve shared node nodeID, returning false if there's no such.
+    bool shared_node(int nodeID, SharedNode& node);
+
+private:
+    struct Query {
+        const void* root;  // pugi node the search starts from
+        ustring name;      // the xpath query
+        bool operator==(const Query& q) const
+        {
+            return root == q.root && name == q.name;
+        }
+    };
+
+    struct QueryHash {
+        size_t operator()(const Query& key) const
+        {
+            return key.name.hash() + 17 * std::hash<const void*>()(key.root);
+        }
+    };
+
+    // Documents by xml string or filename, protected by m_documents_mutex.
+    // Parsing can be slow, so that is a blocking mutex rather than a spin.
+    std::unordered_map<ustring, std::unique_ptr<Document>> m_documents;
+    std::mutex m_documents_mutex;
+
+    // Cache of query results, protected by m_queries_mutex.
+    std::unordered_map<Query, std::shared_ptr<const NodeList>, QueryHash>
+        m_queries;
+    OIIO::spin_rw_mutex m_queries_mutex;
+
+    // Shared nodes, numbered from shared_base, and the first shared node
+    // for each query, protected by m_shared_mutex.
+    std::vector<SharedNode> m_shared;
+    std::unordered_map<Query, int, QueryHash> m_shared_queries;
+    OIIO::spin_rw_mutex m_shared_mutex;
+};
+
+
+
+const DictionaryStore::Document*
+DictionaryStore::document(ustring dictionaryname, std::string& err)
+{
+    std::lock_guard<std::mutex> lock(m_documents_mutex);
+    std::unique_ptr<Document>& d(m_documents[dictionaryname]);
+    if (!d) {
+        d.reset(new Document);
+        if (Strutil::ends_with(dictionaryname, ".odict")) {
+            // binary dictionary -- no parsing needed, just open it
+            d->odict.reset(new OdictFile);
+            if (!d->odict->open(dictionaryname.string(), d->error))
+                d->odict.reset();
+        } else {
+            pugi::xml_parse_result parse_result;
+            if (Strutil::ends_with(dictionaryname, ".xml")) {
+                // xml file -- read it
+                parse_result = d->doc.load_file(dictionaryname.c_str());
+            } else {
+                // load xml directly from the string
+                parse_result = d->doc.load_string(dictionaryname.c_str());
+            }
+            if (!parse_result)
+                d->error = fmtformat("XML parsed with errors: {}, at offset {}",
+                                     parse_result.description(),
+                                     parse_result.offset);
+        }
+    }
+    if (!d->error.empty()) {
+        err = d->error;
+        return nullptr;
+    }
+    return d.get();
+}
+
+
+
+std::shared_ptr<const DictionaryStore::NodeList>
+DictionaryStore::select(const pugi::xml_node& root, ustring query,
+                        std::string& err)
+{
+    Query q { root.internal_object(), query };
+    {
+        OIIO::spin_rw_read_lock lock(m_queries_mutex);
+        auto found = m_queries.find(q);
+        if (found != m_queries.end())
+            return found->second;
+    }
+
+    // Query was not found.  Do the expensive lookup outside the lock --
+    // the documents are never modified, so concurrent searches are safe.
+    pugi::xpath_node_set matches;
+    try {
+        matches = root.select_nodes(query.c_str());
+    } catch (const pugi::xpath_exception& e) {
+        err = fmtformat("Invalid dict_find query '{}': {}", query, e.what());
+        return nullptr;
+    }
+    std::shared_ptr<NodeList> nodes(new NodeList);
+    nodes->reserve(matches.size());
+    for (auto&& m : matches)
+        nodes->push_back(m.node());
+
+    // If another thread beat us to it, use theirs.
+    OIIO::spin_rw_write_lock lock(m_queries_mutex);
+    return m_queries.emplace(q, std::move(nodes)).first->second;
+}
+
+
+
+bool
+DictionaryStore::shared_node(int nodeID, SharedNode& node)
+{
+    OIIO::spin_rw_read_lock lock(m_shared_mutex);
+    if (nodeID < shared_base || nodeID - shared_base >= (int)m_shared.size())
+        return false;
+    node = m_shared[nodeID - shared_base];
+    return true;
+}
+
+
+
+int
+DictionaryStore::find(ustring dictionaryname, int nodeID, ustring query)
+{
+    SharedNode root;
+    if (nodeID) {
+        if (!shared_node(nodeID, root))
+            return -1;
+    } else {
+        std::string err;
+        root.dictionary = dictionaryname;
+        root.doc        = document(dictionaryname, err);
+        if (!root.doc)
+            return -1;
+        root.node  = root.doc->doc;
+        root.onode = 0;
+    }
+    const OdictFile* odict = root.doc->odict.get();
+    Query q { odict ? odict->node_identity(root.onode)
+                    : root.node.internal_object(),
+              query };
+    {
+        OIIO::spin_rw_read_lock lock(m_shared_mutex);
+        auto found = m_shared_queries.find(q);
+        if (found != m_shared_queries.end())
+            return found->second;
+    }
+
+    // Search outside the lock, then number the matches.
+    std::string err;
+    std::vector<uint32_t> omatches;
+    std::shared_ptr<const NodeList> matches;
+    if (odict) {
+        if (!odict->select(root.onode, query, omatches, err))
+            return -1;
+    } else {
+        matches = select(root.node, query, err);
+        if (!matches)
+            return -1;
+    }
+    size_t nmatches = odict ? omatches.size() : matches->size();
+
+    OIIO::spin_rw_write_lock lock(m_shared_mutex);
+    auto found = m_shared_queries.find(q);
+    if (found != m_shared_queries.end())
+        return found->second;  // another thread beat us to it
+    int first = nmatches ? shared_base + (int)m_shared.size() : 0;
+    for (size_t i = 0; i < nmatches; ++i) {
+        SharedNode n(root);
+        n.node  = odict ? pugi::xml_node() : (*matches)[i];
+        n.onode = odict ? omatches[i] : 0;
+        n.next  = i + 1 < nmatches ? shared_base + (int)m_shared.size() + 1
+                                   : 0;
+        m_shared.push_back(n);
+    }
+    m_shared_queries.emplace(q, first);
+    return first;
+}
+
+
+
+DictionaryStore&
+ShadingSystemImpl::dictionary_store()
+{
+    spin_lock lock(m_dictionary_store_mutex);
+    if (!m_dictionary_store)
+        m_dictionary_store = std::make_shared<DictionaryStore>();
+    return *m_dictionary_store;
+}
+
+
+
+int
+ShadingSystemImpl::dict_find_shared(ustring dictionaryname, int nodeID,
+                                    ustring query)
+{
+    return dictionary_store().find(dictionaryname, nodeID, query);
+}
+
+
+
 // Helper class to manage the dictionaries.
 //
 // Shaders are written as if they parse arbitrary things from whole
@@ -35,29 +762,27 @@ namespace pvt {  // OSL::pvt
 // But that is expensive, so we really cache all this stuff at several
 // levels.
 //
-// We have parsed xml (as pugi::xml_document *'s) cached in a hash table,
-// looked up by the xml and/or dictionary name.  Either will do, if it
+// The parsed xml documents, looked up by the xml and/or dictionary name,
+// and the nodes matching each query live in the ShadingSystem's
+// DictionaryStore, shared by all contexts.  Either name will do, if it
 // looks like a filename, it will read the XML from the file, otherwise it
 // will interpret it as xml directly.
 //
-// Also, individual queries are cached in a hash table.  The key is a
-// tuple of (nodeID, query_string, type_requested), so that asking for a
-// particular query to return a string is a totally different cache
-// entry than asking for it to be converted to a matrix, say.
+// Each context then numbers the nodes it has been handed, and caches
+// individual queries in a hash table of its own, so that repeated queries
+// never touch the shared store.  The key is a tuple of (nodeID,
+// query_string, type_requested), so that asking for a particular query to
+// return a string is a totally different cache entry than asking for it
+// to be converted to a matrix, say.
 //
 class Dictionary {
 public:
-    Dictionary(ShadingContext* ctx) : m_context(ctx)
+    Dictionary(ShadingContext* ctx)
+        : m_context(ctx), m_store(ctx->shadingsys().dictionary_store())
     {
         // Create placeholder element 0 == 'not found'
         m_nodes.emplace_back(0, pugi::xml_node());
     }
-    ~Dictionary()
-    {
-        // Free all the documents.
-        for (auto& doc : m_documents)
-            delete doc;
-    }
 
     int dict_find(ExecContextPtr ec, ustring dictionaryname, ustring query);
     int dict_find(ExecContextPtr ec, int nodeID, ustring query);
@@ -112,17 +837,23 @@ private:
     struct Node {
         int document;         // which document the node belongs to
         pugi::xml_node node;  // which node within the dictionary
+        uint32_t onode;       // ... or within a binary dictionary
         int next;             // next node for the same query
-        Node(int d, const pugi::xml_node& n) : document(d), node(n), next(0) {}
+        Node(int d, const pugi::xml_node& n)
+            : document(d), node(n), onode(0), next(0)
+        {
+        }
+        Node(int d, uint32_t n) : document(d), onode(n), next(0) {}
     };
 
     typedef std::unordered_map<Query, QueryResult, QueryHash> QueryMap;
     typedef std::unordered_map<ustring, int> DocMap;
 
     ShadingContext* m_context;  // back-pointer to shading context
+    DictionaryStore& m_store;   // documents shared by all contexts
 
-    // List of XML documents we've read in.
-    std::vector<pugi::xml_document*> m_documents;
+    // List of documents we've used, owned by m_store.
+    std::vector<const DictionaryStore::Document*> m_documents;
 
     // Map xml strings and/or filename to indices in m_documents.
     DocMap m_document_map;
@@ -133,6 +864,9 @@ private:
     // List of all the nodes we've found by queries.
     std::vector<Dictionary::Node> m_nodes;
 
+    // Map the store's shared node IDs to ours.
+    std::unordered_map<int, int> m_imported;
+
     // m_floatdata, m_intdata, and m_stringdata hold the decoded data
     // results (including type conversion) of cached queries.
     std::vector<float> m_floatdata;
@@ -141,42 +875,53 @@ private:
 
     // Helper function: return the document index given dictionary name.
     int get_document_index(ExecContextPtr ec, ustring dictionaryname);
+
+    // Helper function: look up the query from the root node, number the
+    // matching nodes, and cache the first under q.
+    int find_nodes(ExecContextPtr ec, Node root, const Query& q);
+
+    // Helper function: return our node ID given one of ours or a shared
+    // one, numbering the shared node (and the rest of its matches) as ours
+    // the first time it is seen.  Return 0 for an invalid one.
+    int local_node(ExecContextPtr ec, int nodeID);
+
+    // Helper function: report an error for the shader being run.
+    void report_error(ExecContextPtr ec, const std::string& err);
 };
 
 
 
+void
+Dictionary::report_error(ExecContextPtr ec, const std::string& err)
+{
+    // Batched case doesn't support error customization yet,
+    // so continue to report through the context when ec is null
+    if (ec == nullptr) {
+        m_context->errorfmt("{}", err);
+    } else {
+        OSL::errorfmt(ec, "{}", err);
+    }
+}
+
+
+
 int
 Dictionary::get_document_index(ExecContextPtr ec, ustring dictionaryname)
 {
     DocMap::iterator dm = m_document_map.find(dictionaryname);
     int dindex;
     if (dm == m_document_map.end()) {
-        dindex                         = m_documents.size();
-        m_document_map[dictionaryname] = dindex;
-        pugi::xml_document* doc        = new pugi::xml_document;
-        m_documents.push_back(doc);
-        pugi::xml_parse_result parse_result;
-        if (Strutil::ends_with(dictionaryname, ".xml")) {
-            // xml file -- read it
-            parse_result = doc->load_file(dictionaryname.c_str());
-        } else {
-            // load xml directly from the string
-            parse_result = doc->load_string(dictionaryname.c_str());
-        }
-        if (!parse_result) {
-            // Batched case doesn't support error customization yet,
-            // so continue to report through the context when ec is null
-            if (ec == nullptr) {
-                m_context->errorfmt("XML parsed with errors: {}, at offset {}",
-                                    parse_result.description(),
-                                    parse_result.offset);
-            } else {
-                OSL::errorfmt(ec, "XML parsed with errors: {}, at offset {}",
-                              parse_result.description(), parse_result.offset);
-            }
+        std::string err;
+        const DictionaryStore::Document* doc = m_store.document(dictionaryname,
+                                                                err);
+        if (!doc) {
+            report_error(ec, err);
             m_document_map[dictionaryname] = -1;
             return -1;
         }
+        dindex                         = m_documents.size();
+        m_document_map[dictionaryname] = dindex;
+        m_documents.push_back(doc);
     } else {
         dindex = dm->second;
     }
@@ -188,110 +933,111 @@ Dictionary::get_document_index(ExecContextPtr ec, ustring dictionaryname)
 
 
 int
-Dictionary::dict_find(ExecContextPtr ec, ustring dictionaryname, ustring query)
+Dictionary::find_nodes(ExecContextPtr ec, Node root, const Query& q)
 {
-    int dindex = get_document_index(ec, dictionaryname);
-    if (dindex < 0)
-        return dindex;
-
-    Query q(dindex, 0, query);
     QueryMap::iterator qfound = m_cache.find(q);
     if (qfound != m_cache.end()) {
         return qfound->second.valueoffset;
     }
 
-    pugi::xml_document* doc = m_documents[dindex];
-
-    // Query was not found.  Do the expensive lookup and cache it
-    pugi::xpath_node_set matches;
-
-    try {
-        matches = doc->select_nodes(query.c_str());
-    } catch (const pugi::xpath_exception& e) {
-        // Batched case doesn't support error customization yet,
-        // so continue to report through the context when ec is null
-        if (ec == nullptr) {
-            m_context->errorfmt("Invalid dict_find query '{}': {}", query,
-                                e.what());
-        } else {
-            OSL::errorfmt(ec, "Invalid dict_find query '{}': {}", query,
-                          e.what());
+    // Query was not found here.  Search for it (for xml, asking the
+    // shared store) and number the matches.
+    const DictionaryStore::Document* doc = m_documents[root.document];
+    int firstmatch                       = (int)m_nodes.size();
+    std::string err;
+    if (doc->odict) {
+        std::vector<uint32_t> matches;
+        if (!doc->odict->select(root.onode, q.name, matches, err)) {
+            report_error(ec, err);
+            return 0;
         }
-        return 0;
+        for (uint32_t m : matches)
+            m_nodes.emplace_back(root.document, m);
+    } else {
+        auto matches = m_store.select(root.node, q.name, err);
+        if (!matches) {
+            report_error(ec, err);
+            return 0;
+        }
+        for (auto&& m : *matches)
+            m_nodes.emplace_back(root.document, m);
     }
 
-    if (matches.empty()) {
+    if ((int)m_nodes.size() == firstmatch) {
         m_cache[q] = QueryResult(false);  // mark invalid
         return 0;                         // Not found
     }
-    int firstmatch = (int)m_nodes.size();
-    int last       = -1;
-    for (auto&& m : matches) {
-        m_nodes.emplace_back(dindex, m.node());
-        int nodeid = (int)m_nodes.size() - 1;
-        if (last < 0) {
-            // If this is the first match, add a cache entry for it
-            m_cache[q] = QueryResult(true /* it's a node */, nodeid);
-        } else {
-            // If this is a subsequent match, set the last match's 'next'
-            m_nodes[last].next = nodeid;
-        }
-        last = nodeid;
-    }
+    // Each match's 'next' is the following match
+    for (int nodeid = firstmatch; nodeid < (int)m_nodes.size() - 1; ++nodeid)
+        m_nodes[nodeid].next = nodeid + 1;
+    m_cache[q] = QueryResult(true /* it's a node */, firstmatch);
     return firstmatch;
 }
 
 
 
 int
-Dictionary::dict_find(ExecContextPtr ec, int nodeID, ustring query)
+Dictionary::dict_find(ExecContextPtr ec, ustring dictionaryname, ustring query)
 {
-    if (nodeID <= 0 || nodeID >= (int)m_nodes.size())
-        return 0;  // invalid node ID
+    int dindex = get_document_index(ec, dictionaryname);
+    if (dindex < 0)
+        return dindex;
 
-    int document = m_nodes[nodeID].document;
-    Query q(document, nodeID, query);
-    QueryMap::iterator qfound = m_cache.find(q);
-    if (qfound != m_cache.end()) {
-        return qfound->second.valueoffset;
-    }
+    return find_nodes(ec, Node(dindex, m_documents[dindex]->doc),
+                      Query(dindex, 0, query));
+}
 
-    // Query was not found.  Do the expensive lookup and cache it
-    pugi::xpath_node_set matches;
-    try {
-        matches = m_nodes[nodeID].node.select_nodes(query.c_str());
-    } catch (const pugi::xpath_exception& e) {
-        // Batched case doesn't support error customization yet,
-        // so continue to report through the context when ec is null
-        if (ec == nullptr) {
-            m_context->errorfmt("Invalid dict_find query '{}': {}", query,
-                                e.what());
-        } else {
-            OSL::errorfmt(ec, "Invalid dict_find query '{}': {}", query,
-                          e.what());
-        }
-        return 0;
-    }
 
-    if (matches.empty()) {
-        m_cache[q] = QueryResult(false);  // mark invalid
-        return 0;                         // Not found
-    }
-    int firstmatch = (int)m_nodes.size();
-    int last       = -1;
-    for (auto&& m : matches) {
-        m_nodes.emplace_back(document, m.node());
-        int nodeid = (int)m_nodes.size() - 1;
-        if (last < 0) {
-            // If this is the first match, add a cache entry for it
-            m_cache[q] = QueryResult(true /* it's a node */, nodeid);
-        } else {
-            // If this is a subsequent match, set the last match's 'next'
-            m_nodes[last].next = nodeid;
+
+int
+Dictionary::local_node(ExecContextPtr ec, int nodeID)
+{
+    if (nodeID < DictionaryStore::shared_base)
+        return nodeID;
+    auto found = m_imported.find(nodeID);
+    if (found != m_imported.end())
+        return found->second;
+
+    DictionaryStore::SharedNode s;
+    if (!m_store.shared_node(nodeID, s))
+        return 0;  // invalid node ID
+    int dindex = get_document_index(ec, s.dictionary);
+    if (dindex < 0)
+        return 0;
+    int first = (int)m_nodes.size();
+    for (;;) {
+        int nodeid         = (int)m_nodes.size();
+        m_imported[nodeID] = nodeid;
+        if (s.doc->odict)
+            m_nodes.emplace_back(dindex, s.onode);
+        else
+            m_nodes.emplace_back(dindex, s.node);
+        if (!s.next)
+            break;
+        auto next = m_imported.find(s.next);
+        if (next != m_imported.end()) {
+            // The rest of the matches were numbered already
+            m_nodes[nodeid].next = next->second;
+            break;
         }
-        last = nodeid;
+        m_nodes[nodeid].next = nodeid + 1;
+        nodeID               = s.next;
+        m_store.shared_node(nodeID, s);
     }
-    return firstmatch;
+    return first;
+}
+
+
+
+int
+Dictionary::dict_find(ExecContextPtr ec, int nodeID, ustring query)
+{
+    nodeID = local_node(ec, nodeID);
+    if (nodeID <= 0 || nodeID >= (int)m_nodes.size())
+        return 0;  // invalid node ID
+
+    return find_nodes(ec, m_nodes[nodeID],
+                      Query(m_nodes[nodeID].document, nodeID, query));
 }
 
 
@@ -299,6 +1045,7 @@ Dictionary::dict_find(ExecContextPtr ec, int nodeID, ustring query)
 int
 Dictionary::dict_next(int nodeID)
 {
+    nodeID = local_node(nullptr, nodeID);
     if (nodeID <= 0 || nodeID >= (int)m_nodes.size())
         return 0;  // invalid node ID
     return m_nodes[nodeID].next;
@@ -310,6 +1057,7 @@ int
 Dictionary::dict_value(int nodeID, ustring attribname, TypeDesc type,
                        void* data, bool treat_ustrings_as_hash)
 {
+    nodeID = local_node(nullptr, nodeID);
     if (nodeID <= 0 || nodeID >= (int)m_nodes.size())
         return 0;  // invalid node ID
 
@@ -345,7 +1093,14 @@ Dictionary::dict_value(int nodeID, ustring attribname, TypeDesc type,
     // OK, the entry wasn't in the cache, we need to decode it and cache it.
 
     const char* val = NULL;
-    if (attribname.empty()) {
+    // Binary dictionaries hold their values already parsed
+    const OdictFile* odict   = m_documents[node.document]->odict.get();
+    const OdictValue* parsed = nullptr;
+    if (odict) {
+        parsed = odict->value(node.onode, attribname);
+        if (parsed)
+            val = odict->text(*parsed);
+    } else if (attribname.empty()) {
         val = node.node.value();
     } else {
         for (pugi::xml_attribute_iterator ait = node.node.attributes_begin();
@@ -378,8 +1133,12 @@ Dictionary::dict_value(int nodeID, ustring attribname, TypeDesc type,
         string_view valstr(val);
         for (int i = 0; i < n; ++i) {
             int v;
-            OIIO::Strutil::parse_int(valstr, v);
-            OIIO::Strutil::parse_char(valstr, ',');
+            if (parsed) {
+                v = uint32_t(i) < parsed->nints ? odict->ints(*parsed)[i] : 0;
+            } else {
+                OIIO::Strutil::parse_int(valstr, v);
+                OIIO::Strutil::parse_char(valstr, ',');
+            }
             m_intdata.push_back(v);
             ((int*)data)[i] = v;
         }
@@ -391,8 +1150,13 @@ Dictionary::dict_value(int nodeID, ustring attribname, TypeDesc type,
         string_view valstr(val);
         for (int i = 0; i < n; ++i) {
             float v;
-            OIIO::Strutil::parse_float(valstr, v);
-            OIIO::Strutil::parse_char(valstr, ',');
+            if (parsed) {
+                v = uint32_t(i) < parsed->nfloats ? odict->floats(*parsed)[i]
+                                                  : 0.0f;
+            } else {
+                OIIO::Strutil::parse_float(valstr, v);
+                OIIO::Strutil::parse_char(valstr, ',');
+            }
             m_floatdata.push_back(v);
             ((float*)data)[i] = v;
         }
@@ -435,8 +1199,11 @@ ShadingContext::dict_find(ExecContextPtr ec, int nodeID, ustring query)
 int
 ShadingContext::dict_next(int nodeID)
 {
-    if (!m_dictionary)
-        return 0;
+    // Shared node IDs may have come from a constant folded dict_find,
+    // so even a context that never called dict_find may see them.
+    if (!m_dictionary) {
+        m_dictionary = new Dictionary(this);
+    }
     return m_dictionary->dict_next(nodeID);
 }
 
@@ -446,8 +1213,9 @@ int
 ShadingContext::dict_value(int nodeID, ustring attribname, TypeDesc type,
                            void* data, bool treat_ustrings_as_hash)
 {
-    if (!m_dictionary)
-        return 0;
+    if (!m_dictionary) {
+        m_dictionary = new Dictionary(this);
+    }
     return m_dictionary->dict_value(nodeID, attribname, type, data,
                                     treat_ustrings_as_hash);
 }
@@ -462,6 +1230,32 @@ ShadingContext::free_dict_resources()
 
 
 
+bool
+compile_dictionary(string_view xml, string_view odictfile,
+                   std::string& errmessage)
+{
+    pugi::xml_document doc;
+    pugi::xml_parse_result parse_result;
+    if (Strutil::ends_with(xml, ".xml")) {
+        // xml file -- read it
+        parse_result = doc.load_file(std::string(xml).c_str());
+    } else {
+        // load xml directly from the string
+        parse_result = doc.load_buffer(xml.data(), xml.size());
+    }
+    if (!parse_result) {
+        errmessage = fmtformat("XML parsed with errors: {}, at offset {}",
+                               parse_result.description(),
+                               parse_result.offset);
+        return false;
+    }
+    pvt::OdictWriter writer;
+    writer.add_document(doc);
+    return writer.write(odictfile, errmessage);
+}
+
+
+
 OSL_SHADEOP int
 osl_dict_find_iis(OpaqueExecContextPtr oec, int nodeID, ustringhash_pod query_)
 {
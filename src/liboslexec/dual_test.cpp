@@ -5,6 +5,7 @@
 #include <type_traits>
 
 #include <OSL/dual.h>
+#include <OSL/dual_simd.h>
 #include <OSL/dual_vec.h>
 #include <OSL/oslconfig.h>
 
@@ -117,12 +118,58 @@ test_metaprogramming()
 
 
 
+// Dual2f4 should compute the same values and partials as Dual2<float>.
+#define CHECK_SAME_DUAL(packed, unpacked)                                   \
+    {                                                                       \
+        Dual2f p = (packed).dual2(), u = (unpacked);                        \
+        OIIO_CHECK_EQUAL_THRESH(p.val(), u.val(), 1e-6f);                   \
+        OIIO_CHECK_EQUAL_THRESH(p.dx(), u.dx(), 1e-5f);                     \
+        OIIO_CHECK_EQUAL_THRESH(p.dy(), u.dy(), 1e-5f);                     \
+    }
+
+void
+test_packed()
+{
+    static Dual2f domain[] = { Dual2f(0.25f, 1.0f, 0.0f),
+                               Dual2f(0.91f, 0.0f, 1.0f),
+                               Dual2f(1.5f, 0.01f, -0.02f),
+                               Dual2f(-2.0f, 0.5f, 0.25f) };
+    for (auto a : domain) {
+        Dual2f4 ap(a);
+        CHECK_SAME_DUAL(ap, a);
+        CHECK_SAME_DUAL(-ap, -a);
+        CHECK_SAME_DUAL(ap * 3.0f, a * 3.0f);
+        CHECK_SAME_DUAL(ap / 3.0f, a / 3.0f);
+        CHECK_SAME_DUAL(3.0f / ap, 3.0f / a);
+        CHECK_SAME_DUAL(2.0f - ap, 2.0f - a);
+        CHECK_SAME_DUAL(sqrt(ap), sqrt(a));
+        CHECK_SAME_DUAL(exp(ap), exp(a));
+        CHECK_SAME_DUAL(safe_log(ap), safe_log(a));
+        CHECK_SAME_DUAL(sin(ap), sin(a));
+        CHECK_SAME_DUAL(fast_cos(ap), fast_cos(a));
+        for (auto b : domain) {
+            Dual2f4 bp(b);
+            CHECK_SAME_DUAL(ap + bp, a + b);
+            CHECK_SAME_DUAL(ap - bp, a - b);
+            CHECK_SAME_DUAL(ap * bp, a * b);
+            CHECK_SAME_DUAL(ap / bp, a / b);
+            CHECK_SAME_DUAL(safe_pow(ap, bp), safe_pow(a, b));
+            CHECK_SAME_DUAL(atan2(ap, bp), atan2(a, b));
+            CHECK_SAME_DUAL(smoothstep(Dual2f4(-1.0f), Dual2f4(1.0f), ap * bp),
+                            smoothstep(Dual2f(-1.0f), Dual2f(1.0f), a * b));
+        }
+    }
+}
+
+
+
 int
 main(int /*argc*/, char* /*argv*/[])
 {
     test_metaprogramming();
     test_derivs1();
     test_derivs2();
+    test_packed();
 
     // Some benchmarking
     std::cout << "\nBenchmarks:\n";
@@ -138,6 +185,25 @@ main(int /*argc*/, char* /*argv*/[])
     bench(
         "log2(Dual2f)",
         [&](const Dual2f& v) { return DoNotOptimize(fast_log2(v)); }, v);
+    Dual2f4 vp(v);
+    bench(
+        "Dual2f * Dual2f", [&](const Dual2f& v) { return DoNotOptimize(v * v); },
+        v);
+    bench(
+        "Dual2f4 * Dual2f4",
+        [&](const Dual2f4& v) { return DoNotOptimize(v * v); }, vp);
+    bench(
+        "smoothstep(Dual2f)",
+        [&](const Dual2f& v) {
+            return DoNotOptimize(smoothstep(Dual2f(1.0f), Dual2f(2.0f), v));
+        },
+        v);
+    bench(
+        "smoothstep(Dual2f4)",
+        [&](const Dual2f4& v) {
+            return DoNotOptimize(smoothstep(Dual2f4(1.0f), Dual2f4(2.0f), v));
+        },
+        vp);
 
     // FIXME: Some day, expand to more exhaustive tests of Dual
 
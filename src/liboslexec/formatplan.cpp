@@ -0,0 +1,159 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include <OpenImageIO/ustring.h>
+
+#include "formatplan.h"
+
+OSL_NAMESPACE_BEGIN
+namespace pvt {
+
+// Longest replacement field, as for decode_message(); anything longer is
+// taken as literal text.
+static const size_t format_plan_max_field = 128;
+
+
+
+FormatPlan::FormatPlan(string_view spec, const EncodedType* arg_types,
+                       int arg_count)
+{
+    // Split the specification the same way decode_message() walks it:
+    // "{...}" is a replacement field taking the next argument, "{{" and
+    // "}}" are a literal brace, and everything else is literal text.
+    std::string literal;
+    auto flush_literal = [&]() {
+        if (literal.size()) {
+            m_chunks.push_back({ literal, EncodedType::kCount, -1 });
+            literal.clear();
+        }
+    };
+    int arg_index = 0;
+    size_t len    = spec.size();
+    for (size_t j = 0; j < len;) {
+        char c = spec[j++];
+        if (c != '{') {
+            literal += c;
+            if (c == '}' && j < len && spec[j] == '}')
+                ++j;
+            continue;
+        }
+        std::string field(1, c);
+        bool complete = false;
+        while (!complete && j < len && field.size() < format_plan_max_field) {
+            char next = spec[j++];
+            if (field.size() == 1 && next == '{')
+                break;  // An escaped {
+            field += next;
+            complete = (next == '}');
+        }
+        if (!complete) {
+            literal += field;
+        } else if (arg_index < arg_count) {
+            flush_literal();
+            EncodedType type = arg_types[arg_index++];
+            m_chunks.push_back({ field, type, int(m_arg_values_size) });
+            m_arg_values_size += size_of_encoded_type(type);
+        }
+        // A field past the last argument formats to nothing
+    }
+    flush_literal();
+}
+
+
+
+template<typename T>
+static T
+load_arg(const uint8_t* p)
+{
+    T v;
+    memcpy(&v, p, sizeof(T));
+    return v;
+}
+
+
+
+void
+FormatPlan::format(const uint8_t* arg_values, std::string& out) const
+{
+    out.clear();
+    for (const Chunk& c : m_chunks) {
+        if (c.offset < 0) {
+            out += c.text;
+            continue;
+        }
+        const uint8_t* v = arg_values + c.offset;
+        switch (c.type) {
+        case EncodedType::kUstringHash:
+            out += fmtformat(c.text,
+                             ustring::from_hash(load_arg<uint64_t>(v)).c_str());
+            break;
+        case EncodedType::kInt32:
+            out += fmtformat(c.text, load_arg<int32_t>(v));
+            break;
+        case EncodedType::kFloat:
+            out += fmtformat(c.text, load_arg<float>(v));
+            break;
+        case EncodedType::kInt64:
+            out += fmtformat(c.text, load_arg<int64_t>(v));
+            break;
+        case EncodedType::kDouble:
+            out += fmtformat(c.text, load_arg<double>(v));
+            break;
+        case EncodedType::kUInt32:
+            out += fmtformat(c.text, load_arg<uint32_t>(v));
+            break;
+        case EncodedType::kUInt64:
+            out += fmtformat(c.text, load_arg<uint64_t>(v));
+            break;
+        case EncodedType::kPointer:
+            out += fmtformat(c.text, load_arg<const void*>(v));
+            break;
+        case EncodedType::kTypeDesc:
+            out += fmtformat(c.text,
+                             bitcast<TypeDesc>(load_arg<uint64_t>(v)));
+            break;
+        default: OSL_ASSERT(0 && "unhandled EncodedType");
+        }
+    }
+}
+
+
+
+namespace {
+struct FormatPlanCache {
+    std::mutex mutex;
+    // Keyed by the specification followed by the argument type codes
+    std::unordered_map<std::string, std::unique_ptr<FormatPlan>> plans;
+};
+}  // namespace
+
+
+
+const FormatPlan&
+find_format_plan(ustring spec, const std::vector<EncodedType>& arg_types)
+{
+    std::string key = spec.string();
+    key += '\0';
+    for (EncodedType t : arg_types)
+        key += char('a' + int(t));
+
+    // Entries are never removed or changed, so the references handed out
+    // stay good after the lock is released.
+    static FormatPlanCache cache;
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    auto found = cache.plans.find(key);
+    if (found != cache.plans.end())
+        return *found->second;
+    std::unique_ptr<FormatPlan> plan(
+        new FormatPlan(spec, arg_types.data(), int(arg_types.size())));
+    return *(cache.plans[key] = std::move(plan));
+}
+
+}  // namespace pvt
+OSL_NAMESPACE_END
@@ -0,0 +1,51 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <OSL/encodedtypes.h>
+#include <OSL/oslconfig.h>
+
+OSL_NAMESPACE_BEGIN
+namespace pvt {
+
+// A fmtlib format specification (as the printf family's code generation
+// makes from a shader's printf-style format), split once into runs of
+// literal text and the conversions for each argument, with the type and
+// offset of each argument in the packed values already worked out. Formatting
+// with it needn't re-scan the specification or walk the encoded types the
+// way decode_message() does, and gives the same result. Once made it's
+// never changed, so any thread may use it.
+class FormatPlan {
+public:
+    FormatPlan(string_view spec, const EncodedType* arg_types, int arg_count);
+
+    /// Format the packed argument values into out (which is overwritten).
+    void format(const uint8_t* arg_values, std::string& out) const;
+
+    /// Bytes of packed argument values that format() reads.
+    uint32_t arg_values_size() const { return m_arg_values_size; }
+
+private:
+    struct Chunk {
+        std::string text;  // Literal text, or the replacement field
+        EncodedType type;  // Argument type, for a replacement field
+        int offset;        // Argument offset, or -1 for literal text
+    };
+    std::vector<Chunk> m_chunks;
+    uint32_t m_arg_values_size = 0;
+};
+
+
+
+/// The plan for a format specification and argument types, from a cache
+/// shared by the whole process, making it if this is its first use.
+const FormatPlan&
+find_format_plan(ustring spec, const std::vector<EncodedType>& arg_types);
+
+}  // namespace pvt
+OSL_NAMESPACE_END
@@ -0,0 +1,140 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <OSL/oslconfig.h>
+
+#include <OSL/dual_vec.h>
+
+#include <OpenImageIO/fmath.h>
+
+#include "oslexec_pvt.h"
+
+OSL_NAMESPACE_BEGIN
+namespace pvt {
+
+
+// Fold a signed noise value for the fractal noise types: |n| for
+// "turbulence", (1-|n|)^2 for "ridged".
+OSL_HOSTDEVICE inline Dual2<float>
+fractal_fold(const Dual2<float>& n, bool ridged)
+{
+    Dual2<float> a = n.val() < 0.0f ? -n : n;
+    return ridged ? (1.0f - a) * (1.0f - a) : a;
+}
+
+OSL_HOSTDEVICE inline Dual2<Vec3>
+fractal_fold(const Dual2<Vec3>& n, bool ridged)
+{
+    return make_Vec3(fractal_fold(comp_x(n), ridged),
+                     fractal_fold(comp_y(n), ridged),
+                     fractal_fold(comp_z(n), ridged));
+}
+
+
+
+// Filter width of a fractal noise input: the larger of its x and y
+// derivatives, in noise space.
+OSL_HOSTDEVICE inline float
+fractal_footprint(const Dual2<float>& s)
+{
+    return std::max(fabsf(s.dx()), fabsf(s.dy()));
+}
+
+OSL_HOSTDEVICE inline float
+fractal_footprint(const Dual2<Vec3>& s)
+{
+    return sqrtf(std::max(s.dx().length2(), s.dy().length2()));
+}
+
+
+
+// Weight of an octave whose features are "w" times the filter width:
+// full weight up to a quarter period per footprint, fading to nothing at
+// the Nyquist limit of half a period.
+OSL_HOSTDEVICE inline float
+fractal_octave_weight(float w)
+{
+    return OIIO::clamp(2.0f - 4.0f * w, 0.0f, 1.0f);
+}
+
+
+
+// Sum of "octaves" octaves of signed Perlin noise, each "lacunarity" times
+// the frequency and "gain" times the amplitude of the one before, computed
+// in a single call instead of one noise call per octave in the shader.
+// Each octave is folded first if "fold" (turbulence, and ridged if
+// "ridged"). With "do_filter" (the default), the input derivatives give
+// the filter footprint, and octaves above the Nyquist limit fade out and
+// are not evaluated at all. SNoiseT is the signed noise to sum: SNoise for
+// the scalar shadeops, SNoiseScalar for the lanes of the batched ones.
+template<class SNoiseT> struct FractalSum {
+    OSL_HOSTDEVICE FractalSum() {}
+
+    template<class R, class S>
+    OSL_HOSTDEVICE inline void operator()(bool fold, bool ridged,
+                                          Dual2<R>& result, const Dual2<S>& s,
+                                          const NoiseParams* opt) const
+    {
+        int octaves = OIIO::clamp(opt->octaves, 0, 16);
+        float fw    = opt->do_filter ? fractal_footprint(s) : 0.0f;
+        SNoiseT snoise;
+        Dual2<S> p = s;
+        float amp  = 1.0f;
+        float freq = 1.0f;
+        result     = Dual2<R>(R(0.0f));
+        for (int o = 0; o < octaves; ++o) {
+            float weight = fw > 0.0f ? fractal_octave_weight(fw * freq) : 1.0f;
+            if (weight == 0.0f && opt->lacunarity >= 1.0f)
+                break;  // this and all higher octaves are filtered out
+            if (weight > 0.0f) {
+                Dual2<R> n;
+                snoise(n, p);
+                result += (fold ? fractal_fold(n, ridged) : n)
+                          * (amp * weight);
+            }
+            p = p * opt->lacunarity;
+            freq *= opt->lacunarity;
+            amp *= opt->gain;
+        }
+    }
+
+    template<class R, class S, class T>
+    OSL_HOSTDEVICE inline void operator()(bool fold, bool ridged,
+                                          Dual2<R>& result, const Dual2<S>& s,
+                                          const Dual2<T>& t,
+                                          const NoiseParams* opt) const
+    {
+        int octaves = OIIO::clamp(opt->octaves, 0, 16);
+        float fw    = 0.0f;
+        if (opt->do_filter)
+            fw = std::max(fractal_footprint(s), fractal_footprint(t));
+        SNoiseT snoise;
+        Dual2<S> p = s;
+        Dual2<T> q = t;
+        float amp  = 1.0f;
+        float freq = 1.0f;
+        result     = Dual2<R>(R(0.0f));
+        for (int o = 0; o < octaves; ++o) {
+            float weight = fw > 0.0f ? fractal_octave_weight(fw * freq) : 1.0f;
+            if (weight == 0.0f && opt->lacunarity >= 1.0f)
+                break;  // this and all higher octaves are filtered out
+            if (weight > 0.0f) {
+                Dual2<R> n;
+                snoise(n, p, q);
+                result += (fold ? fractal_fold(n, ridged) : n)
+                          * (amp * weight);
+            }
+            p = p * opt->lacunarity;
+            q = q * opt->lacunarity;
+            freq *= opt->lacunarity;
+            amp *= opt->gain;
+        }
+    }
+};
+
+
+}  // namespace pvt
+OSL_NAMESPACE_END
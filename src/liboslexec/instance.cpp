@@ -9,6 +9,7 @@
 
 #include <OpenImageIO/strutil.h>
 
+#include "devicearena.h"
 #include "oslexec_pvt.h"
 
 
@@ -69,6 +70,56 @@ ShaderInstance::ShaderInstance(ShaderMaster::ref master, string_view layername)
 
 
 
+ShaderInstance::ShaderInstance(const ShaderInstance& copy)
+    : m_master(copy.m_master)
+    , m_instoverrides(copy.m_instoverrides)
+    , m_layername(copy.m_layername)
+    , m_iparams(copy.m_iparams)
+    , m_fparams(copy.m_fparams)
+    , m_sparams(copy.m_sparams)
+    , m_writes_globals(copy.m_writes_globals)
+    , m_userdata_params(copy.m_userdata_params)
+    , m_outgoing_connections(copy.m_outgoing_connections)
+    , m_renderer_outputs(copy.m_renderer_outputs)
+    , m_has_error_op(copy.m_has_error_op)
+    , m_has_trace_op(copy.m_has_trace_op)
+    , m_merged_unused(copy.m_merged_unused)
+    , m_last_layer(copy.m_last_layer)
+    , m_entry_layer(copy.m_entry_layer)
+    , m_connections(copy.m_connections)
+    , m_firstparam(copy.m_firstparam)
+    , m_lastparam(copy.m_lastparam)
+    , m_maincodebegin(copy.m_maincodebegin)
+    , m_maincodeend(copy.m_maincodeend)
+    , m_Psym(copy.m_Psym)
+    , m_Nsym(copy.m_Nsym)
+{
+    // Once optimized, an instance has its own symbols and code, and is
+    // too specialized to be worth copying.
+    OSL_ASSERT(copy.m_instsymbols.empty() && copy.m_instops.empty());
+    m_id = ++(*(atomic_int*)&next_id);
+    shadingsys().m_stat_instances += 1;
+
+    // Adjust statistics
+    ShadingSystemImpl& ss(shadingsys());
+    off_t symmem   = vectorbytes(m_instoverrides);
+    off_t parammem = vectorbytes(m_iparams) + vectorbytes(m_fparams)
+                     + vectorbytes(m_sparams);
+    off_t connectionmem = vectorbytes(m_connections);
+    off_t totalmem      = (symmem + parammem + connectionmem
+                      + sizeof(ShaderInstance));
+    {
+        spin_lock lock(ss.m_stat_mutex);
+        ss.m_stat_mem_inst_syms += symmem;
+        ss.m_stat_mem_inst_paramvals += parammem;
+        ss.m_stat_mem_inst_connections += connectionmem;
+        ss.m_stat_mem_inst += totalmem;
+        ss.m_stat_memory += totalmem;
+    }
+}
+
+
+
 ShaderInstance::~ShaderInstance()
 {
     shadingsys().m_stat_instances -= 1;
@@ -187,6 +238,15 @@ compatible_param(const TypeDesc& a, const TypeDesc& b)
 void
 ShaderInstance::parameters(const ParamValueList& params,
                            cspan<ParamHints> hints)
+{
+    parameters(params, hints, cspan<int>());
+}
+
+
+
+void
+ShaderInstance::parameters(const ParamValueList& params,
+                           cspan<ParamHints> hints, cspan<int> paramindex)
 {
     // Seed the params with the master's defaults
     m_iparams = m_master->m_idefaults;
@@ -206,9 +266,17 @@ ShaderInstance::parameters(const ParamValueList& params,
 
     for (size_t pi = 0; pi < params.size(); ++pi) {
         const ParamValue& p(params[pi]);
-        if (p.name().size() == 0)
-            continue;  // skip empty names
-        int i = findparam(p.name());
+        int i = pi < paramindex.size() ? paramindex[pi] : -1;
+        if (i < 0) {
+            if (p.name().size() == 0)
+                continue;  // skip empty names
+            i = findparam(p.name());
+        } else if (i < firstparam() || i >= lastparam()) {
+            shadingsys().warningfmt(
+                "attempting to set nonexistent parameter #{} of {}", i,
+                shadername());
+            continue;
+        }
         if (i >= 0) {
             // if (shadingsys().debug())
             //     shadingsys().info (" PARAMETER %s %s", p.name(), p.type());
@@ -366,6 +434,59 @@ ShaderInstance::parameters(const ParamValueList& params,
 
 
 
+bool
+ShaderInstance::set_param_value(int i, TypeDesc type, const void* val,
+                                bool* changed)
+{
+    OSL_ASSERT(m_instsymbols.empty() && "instance is already optimized");
+    if (changed)
+        *changed = false;
+    if (i < 0 || i >= (int)m_instoverrides.size())
+        return false;
+    const Symbol* sm    = master()->symbol(i);
+    SymOverrideInfo* so = &m_instoverrides[i];
+    if (so->valuesource() == Symbol::ConnectedVal)
+        return true;  // The upstream layer provides the value anyway
+    TypeDesc paramtype = sm->typespec().simpletype();
+    if (paramtype.is_unsized_array()) {
+        if (!so->arraylen())
+            return false;  // don't know how much room the default takes
+        paramtype.arraylen = so->arraylen();
+    }
+    size_t nvals = paramtype.numelements() * paramtype.aggregate;
+    if (type.basetype != paramtype.basetype || type.basevalues() != nvals)
+        return false;
+
+    // A parameter that had its default value may have gotten it from init
+    // ops, so becoming an instance value is a change no matter what.
+    bool diff  = (so->valuesource() != Symbol::InstanceVal);
+    int offset = so->dataoffset();
+    if (paramtype.basetype == TypeDesc::INT) {
+        int* dst = &m_iparams[offset];
+        diff |= memcmp(dst, val, nvals * sizeof(int)) != 0;
+        memcpy(dst, val, nvals * sizeof(int));
+    } else if (paramtype.basetype == TypeDesc::FLOAT) {
+        float* dst = &m_fparams[offset];
+        diff |= memcmp(dst, val, nvals * sizeof(float)) != 0;
+        memcpy(dst, val, nvals * sizeof(float));
+    } else if (paramtype.basetype == TypeDesc::STRING) {
+        ustring* dst       = &m_sparams[offset];
+        const ustring* src = static_cast<const ustring*>(val);
+        for (size_t v = 0; v < nvals; ++v) {
+            diff |= (dst[v] != src[v]);
+            dst[v] = src[v];
+        }
+    } else {
+        return false;
+    }
+    so->valuesource(Symbol::InstanceVal);
+    if (changed)
+        *changed = diff;
+    return true;
+}
+
+
+
 void
 ShaderInstance::make_symbol_room(size_t moresyms)
 {
@@ -466,19 +587,30 @@ ShaderInstance::evaluate_writes_globals_and_userdata_params()
 
 
 
+void
+ShaderInstance::count_symbol_refs(std::vector<int>& refs) const
+{
+    refs.assign(symbols().size(), 0);
+    for (const Opcode& op : ops())
+        for (int a = 0; a < op.nargs(); ++a)
+            ++refs[arg(op.firstarg() + a)];
+}
+
+
+
 void
 ShaderInstance::copy_code_from_master(ShaderGroup& group)
 {
     OSL_ASSERT(m_instops.empty() && m_instargs.empty());
     // reserve with enough room for a few insertions
-    m_instops.reserve(master()->m_ops.size() + 10);
-    m_instargs.reserve(master()->m_args.size() + 10);
-    m_instops  = master()->m_ops;
-    m_instargs = master()->m_args;
+    master()->copy_code(m_instops, m_instargs, 10);
 
     // Copy the symbols from the master
     OSL_ASSERT(m_instsymbols.size() == 0
                && "should not have copied m_instsymbols yet");
+    // Leave the same headroom for the constants and temps the optimizer
+    // will add, so the first few don't reallocate the whole symbol table.
+    m_instsymbols.reserve(m_master->m_symbols.size() + 10);
     m_instsymbols = m_master->m_symbols;
 
     // Copy the instance override data
@@ -731,6 +863,52 @@ ShaderInstance::mergeable(const ShaderInstance& b,
 }
 
 
+
+uint64_t
+ShaderInstance::merge_hash() const
+{
+    std::string key;
+    auto add = [&](const void* data, size_t size) {
+        key.append((const char*)data, size);
+    };
+    const ShaderMaster* m = master();
+    add(&m, sizeof(m));
+    bool lazy = run_lazily();
+    add(&lazy, sizeof(lazy));
+
+    for (const Connection& c : m_connections) {
+        int fields[] = { c.srclayer,        c.src.param, c.src.arrayindex,
+                         c.src.channel,     c.dst.param, c.dst.arrayindex,
+                         c.dst.channel };
+        add(fields, sizeof(fields));
+    }
+
+    bool optimized = (m_instsymbols.size() != 0 || m_instops.size() != 0);
+    if (!optimized) {
+        // The same parameter values that mergeable() compares. Before
+        // optimization they're judged by the master's symbols, which
+        // both instances share, so both hash the same parameters.
+        for (int i = firstparam(); i < lastparam(); ++i) {
+            const Symbol* sym = mastersymbol(i);
+            if (!sym->everused_in_group() || sym->typespec().is_closure())
+                continue;
+            if (sym->valuesource() == Symbol::InstanceVal
+                || sym->valuesource() == Symbol::DefaultVal)
+                add(param_storage(i), sym->typespec().simpletype().size());
+        }
+    } else {
+        // After optimization the symbol tables and code must match, which
+        // at least means their sizes and ranges do.
+        int sizes[] = { int(m_instsymbols.size()), int(m_instops.size()),
+                        int(m_instargs.size()),    m_firstparam,
+                        m_lastparam,               m_maincodebegin,
+                        m_maincodeend };
+        add(sizes, sizeof(sizes));
+    }
+    return Strutil::strhash(key);
+}
+
+
 };  // namespace pvt
 
 
@@ -765,9 +943,22 @@ ShaderGroup::~ShaderGroup()
 #endif
 
     // Free any GPU memory associated with this group
-    if (m_device_interactive_arena)
+    free_device_interactive_arena();
+}
+
+
+
+void
+ShaderGroup::free_device_interactive_arena()
+{
+    if (!m_device_interactive_arena)
+        return;
+    if (DeviceArena* arena = shadingsys().device_arena())
+        arena->free(m_device_interactive_arena.d_get());
+    else
         shadingsys().renderer()->device_free(
             m_device_interactive_arena.d_get());
+    m_device_interactive_arena.reset();
 }
 
 
@@ -829,7 +1020,15 @@ ShaderGroup::setup_interactive_arena(cspan<uint8_t> paramblock)
         m_interactive_arena.reset(new uint8_t[m_interactive_arena_size]);
         memcpy(m_interactive_arena.get(), paramblock.data(),
                m_interactive_arena_size);
-        if (shadingsys().use_optix()) {
+        free_device_interactive_arena();
+        if (DeviceArena* arena = shadingsys().device_arena()) {
+            // GPU side, from the pool, sent with the next upload
+            m_device_interactive_arena.reset(
+                arena->alloc(m_interactive_arena_size));
+            if (m_device_interactive_arena)
+                arena->write(m_device_interactive_arena.d_get(),
+                             paramblock.data(), m_interactive_arena_size);
+        } else if (shadingsys().use_optix()) {
             // GPU side
             RendererServices* rs = shadingsys().renderer();
             m_device_interactive_arena.reset(reinterpret_cast<uint8_t*>(
@@ -842,8 +1041,145 @@ ShaderGroup::setup_interactive_arena(cspan<uint8_t> paramblock)
     } else {
         m_interactive_arena_size = 0;
         m_interactive_arena.reset();
-        m_device_interactive_arena.reset();
+        free_device_interactive_arena();
+    }
+}
+
+
+
+void
+ShaderGroup::save_pristine_layers()
+{
+    m_pristine_layers.clear();
+    m_pristine_layers.reserve(m_layers.size());
+    for (auto&& layer : m_layers)
+        m_pristine_layers.emplace_back(new ShaderInstance(*layer));
+}
+
+
+
+size_t
+ShaderGroup::memory_used() const
+{
+    // The JIT bytes of a group sharing a twin's code are the twin's.
+    size_t mem = sizeof(ShaderGroup) + m_llvm_jit_bytes
+                 + m_interactive_arena_size
+                 + m_llvm_ptx_compiled_version.capacity();
+    for (auto&& layer : m_layers)
+        mem += layer->memory_used();
+    for (auto&& layer : m_pristine_layers)
+        mem += layer->memory_used();
+    return mem;
+}
+
+
+
+void
+ShaderGroup::restore_pristine_layers()
+{
+    OSL_ASSERT(m_pristine_layers.size() == m_layers.size());
+    for (size_t i = 0, e = m_layers.size(); i < e; ++i)
+        m_layers[i].reset(new ShaderInstance(*m_pristine_layers[i]));
+
+    m_optimized    = 0;
+    m_jitted       = 0;
+    m_batch_jitted = 0;
+    m_does_nothing = false;
+    m_needs_rejit  = false;
+
+    // The code published so far stays in m_llvm_compiled_kept, since a
+    // shade may still be running it.
+    m_llvm_groupdata_size      = 0;
+    m_llvm_groupdata_wide_size = 0;
+    m_llvm_compiled.store(nullptr, std::memory_order_release);
+#if OSL_USE_BATCHED
+    m_llvm_compiled_wide_version = nullptr;
+    m_llvm_compiled_wide_init    = nullptr;
+    m_llvm_compiled_wide_layers.clear();
+#endif
+    m_llvm_jit_memory.clear();
+    m_llvm_jit_bytes = 0;
+    m_llvm_ptx_compiled_version.clear();
+    m_ptx_registers   = 0;
+    m_ptx_local_bytes = 0;
+    m_gpu_registers   = -1;
+    m_gpu_spill_bytes = -1;
+    m_device_strings.clear();
+    m_optix_cache_key.clear();
+
+    m_raytype_queries = -1;
+    m_globals_read    = 0;
+    m_globals_write   = 0;
+    m_textures_needed.clear();
+    m_closures_needed.clear();
+    m_globals_needed.clear();
+    m_userdata_names.clear();
+    m_userdata_types.clear();
+    m_userdata_offsets.clear();
+    m_userdata_derivs.clear();
+    m_userdata_layers.clear();
+    m_userdata_init_vals.clear();
+    m_userdata_gathered.clear();
+    m_noise_memos.clear();
+    m_noise_memo_types.clear();
+    m_noise_memo_derivs.clear();
+    m_attributes_needed.clear();
+    m_attribute_scopes.clear();
+    m_attribute_types.clear();
+    m_attribute_derivs.clear();
+    m_unknown_textures_needed   = false;
+    m_unknown_closures_needed   = false;
+    m_unknown_attributes_needed = false;
+
+    m_interactive_params.clear();
+    setup_interactive_arena({});
+    m_compile_times = CompileTimes();
+}
+
+
+
+bool
+ShaderGroup::record_exec_route(bool batched, int npoints, long long ns,
+                               int trials)
+{
+    m_exec_route_points[batched] += npoints;
+    m_exec_route_ns[batched] += ns;
+    if (++m_exec_route_trials[batched] < trials
+        || m_exec_route_trials[!batched] < trials)
+        return false;
+    // Compare ns per point by cross multiplying, so no division is needed.
+    double batched_cost = double(m_exec_route_ns[1]) * m_exec_route_points[0];
+    double scalar_cost  = double(m_exec_route_ns[0]) * m_exec_route_points[1];
+    int route     = batched_cost <= scalar_cost ? RouteBatched : RouteScalar;
+    int measuring = RouteMeasuring;
+    return m_exec_route.compare_exchange_strong(measuring, route);
+}
+
+
+
+std::string
+ShaderGroup::compile_breakdown() const
+{
+    const CompileTimes& t(m_compile_times);
+    auto tf = [](double s) { return Strutil::timeintervalformat(s, 2); };
+    std::string out = fmtformat("Shader group \"{}\" compile times:\n",
+                                name().size() ? name().c_str()
+                                              : "<unnamed group>");
+    out += fmtformat("  OSO load:           {}\n", tf(t.oso_load));
+    out += fmtformat("  Runtime optimize:   {}\n", tf(t.runtime_opt));
+    out += fmtformat("    Batched analysis: {}\n", tf(t.batched_analysis));
+    out += fmtformat("  LLVM setup:         {}\n", tf(t.llvm_setup));
+    out += fmtformat("  LLVM IR gen:        {}\n", tf(t.llvm_irgen));
+    out += fmtformat("  LLVM optimize:      {}\n", tf(t.llvm_opt));
+    out += fmtformat("  LLVM JIT:           {}\n", tf(t.llvm_jit));
+    out += "  Per layer (runtime optimize, LLVM IR gen):\n";
+    for (int i = 0, nl = nlayers(); i < nl; ++i) {
+        double opt   = i < (int)t.layer_opt.size() ? t.layer_opt[i] : 0.0;
+        double irgen = i < (int)t.layer_irgen.size() ? t.layer_irgen[i] : 0.0;
+        out += fmtformat("    {}: {}, {}\n", m_layers[i]->layername(), tf(opt),
+                         tf(irgen));
     }
+    return out;
 }
 
 
@@ -873,11 +1209,19 @@ ShaderGroup::generate_optix_cache_key(string_view code)
 
 std::string
 ShaderGroup::serialize() const
+{
+    lock_guard lock(m_mutex);
+    return serialize_unlocked(true);
+}
+
+
+
+std::string
+ShaderGroup::serialize_unlocked(bool interactive_values) const
 {
     std::ostringstream out;
     out.imbue(std::locale::classic());  // force C locale
     out.precision(9);
-    lock_guard lock(m_mutex);
     for (int i = 0, nl = nlayers(); i < nl; ++i) {
         const ShaderInstance* inst = m_layers[i].get();
 
@@ -904,9 +1248,14 @@ ShaderGroup::serialize() const
                     type.arraylen = inst->instoverride(p)->arraylen();
                     offset        = inst->instoverride(p)->dataoffset();
                 }
+                bool interactive = dstsyms_exist
+                                       ? s->interactive()
+                                       : inst->instoverride(p)->interactive();
                 out << "param " << type << ' ' << s->name();
                 int nvals = type.numelements() * type.aggregate;
-                if (type.basetype == TypeDesc::INT) {
+                if (interactive && !interactive_values) {
+                    // Leave the value out
+                } else if (type.basetype == TypeDesc::INT) {
                     const int* vals = &inst->m_iparams[offset];
                     for (int i = 0; i < nvals; ++i)
                         out << ' ' << vals[i];
@@ -926,8 +1275,7 @@ ShaderGroup::serialize() const
                 if (dstsyms_exist ? s->interpolated()
                                   : inst->instoverride(p)->interpolated())
                     print(out, " [[int interpolated=1]]");
-                if (dstsyms_exist ? s->interactive()
-                                  : inst->instoverride(p)->interactive())
+                if (interactive)
                     print(out, " [[int interactive=1]]");
                 out << " ;\n";
             }
@@ -960,4 +1308,129 @@ ShaderGroup::serialize() const
 }
 
 
+
+void
+ShaderGroup::compute_canonical_hash(bool keep_text)
+{
+    std::string text = serialize_unlocked(false);
+    m_layers_hash    = Strutil::strhash(text);
+    if (keep_text)
+        m_layers_text = std::move(text);
+    else
+        m_layers_text.clear();
+}
+
+
+
+std::string
+ShaderGroup::canonical_attribs() const
+{
+    // Group attributes that may still change after ShaderGroupEnd.
+    std::string attribs = fmtformat("{} {} {}", m_raytypes_on,
+                                    m_raytypes_off, m_group_use);
+    for (auto&& r : m_renderer_outputs)
+        attribs += fmtformat(" out {}", r);
+    if (m_has_pass_outputs) {
+        attribs += " pass";
+        for (auto&& r : m_pass_outputs)
+            attribs += fmtformat(" {}", r);
+    }
+    for (int i = 0, nl = nlayers(); i < nl; ++i)
+        if (m_layers[i]->entry_layer())
+            attribs += fmtformat(" entry {}", i);
+    if (m_debug_checks)
+        attribs += " debug";
+    for (auto&& s : m_symlocs)
+        attribs += fmtformat(" sym {} {} {} {} {} {} {}", s.name,
+                             s.type.c_str(), (int)s.arena, s.offset, s.stride,
+                             s.derivs, s.indirect);
+    return attribs;
+}
+
+
+
+uint64_t
+ShaderGroup::canonical_hash() const
+{
+    if (!m_layers_hash)
+        return 0;
+    uint64_t h = Strutil::strhash(
+        fmtformat("{} {}", m_layers_hash, canonical_attribs()));
+    return h ? h : 1;
+}
+
+
+
+bool
+ShaderGroup::same_canonical_code(const ShaderGroup& other) const
+{
+    return m_layers_text.size() && m_layers_text == other.m_layers_text
+           && canonical_attribs() == other.canonical_attribs();
+}
+
+
+
+void
+ShaderGroup::share_compiled(const ShaderGroup& twin)
+{
+    // Same layout of the interactive parameter block as the twin, but with
+    // the values from our own (still unoptimized) layers.
+    std::vector<uint8_t> interactive_data(twin.m_interactive_arena.get(),
+                                          twin.m_interactive_arena.get()
+                                              + twin.m_interactive_arena_size);
+    for (auto&& ip : twin.m_interactive_params) {
+        const ShaderInstance* inst = m_layers[ip.layer].get();
+        int p                      = inst->findparam(ip.name);
+        OSL_DASSERT(p >= 0);
+        if (p < 0)
+            continue;
+        TypeDesc type     = inst->mastersymbol(p)->typespec().simpletype();
+        const void* value = inst->param_storage(p);
+        ustringhash string_hash;
+        if (type.basetype == TypeDesc::STRING) {
+            string_hash = ustringhash(*(const ustring*)value);
+            value       = &string_hash;
+        }
+        memcpy(&interactive_data[ip.offset], value, type.size());
+    }
+    setup_interactive_arena(interactive_data);
+    m_interactive_params = twin.m_interactive_params;
+
+    // The optimized layers are only read from now on, so one set of them
+    // can serve both groups.
+    m_layers                    = twin.m_layers;
+    m_does_nothing              = twin.m_does_nothing;
+    m_num_entry_layers          = twin.m_num_entry_layers;
+    m_globals_read              = twin.m_globals_read;
+    m_globals_write             = twin.m_globals_write;
+    m_textures_needed           = twin.m_textures_needed;
+    m_closures_needed           = twin.m_closures_needed;
+    m_globals_needed            = twin.m_globals_needed;
+    m_userdata_names            = twin.m_userdata_names;
+    m_userdata_types            = twin.m_userdata_types;
+    m_userdata_offsets          = twin.m_userdata_offsets;
+    m_userdata_derivs           = twin.m_userdata_derivs;
+    m_userdata_layers           = twin.m_userdata_layers;
+    m_userdata_init_vals        = twin.m_userdata_init_vals;
+    m_userdata_gathered         = twin.m_userdata_gathered;
+    m_noise_memos               = twin.m_noise_memos;
+    m_noise_memo_types          = twin.m_noise_memo_types;
+    m_noise_memo_derivs         = twin.m_noise_memo_derivs;
+    m_attributes_needed         = twin.m_attributes_needed;
+    m_attribute_scopes          = twin.m_attribute_scopes;
+    m_attribute_types           = twin.m_attribute_types;
+    m_attribute_derivs          = twin.m_attribute_derivs;
+    m_unknown_textures_needed   = twin.m_unknown_textures_needed;
+    m_unknown_closures_needed   = twin.m_unknown_closures_needed;
+    m_unknown_attributes_needed = twin.m_unknown_attributes_needed;
+    m_llvm_groupdata_size       = twin.m_llvm_groupdata_size;
+    m_llvm_jit_memory           = twin.m_llvm_jit_memory;
+    for (auto& code : twin.m_llvm_compiled_kept)
+        if (code.get() == twin.llvm_compiled())
+            llvm_compiled(code);
+    m_optimized = true;
+    m_jitted    = true;
+}
+
+
 OSL_NAMESPACE_END
@@ -7,8 +7,14 @@
 #include <OSL/journal.h>
 #include <OSL/oslconfig.h>
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <fstream>
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 OSL_NAMESPACE_BEGIN
 
@@ -230,6 +236,26 @@ initialize_buffer(uint8_t* const buffer, uint32_t buf_size, uint32_t page_size,
     return true;
 }
 
+float
+buffer_usage(const uint8_t* const buffer)
+{
+    using namespace journal::pvt;
+    const auto& org = *(reinterpret_cast<const Organization*>(buffer));
+    uint32_t start  = org.calc_end_of_page_infos();
+    uint32_t used   = std::min(org.free_pos.load(), org.buf_size) - start;
+    return float(used) / float(org.buf_size - start);
+}
+
+bool
+drain_buffer(uint8_t* const buffer, Reporter& reporter)
+{
+    using namespace journal::pvt;
+    Reader(buffer, reporter).process();
+    const auto& org = *(reinterpret_cast<const Organization*>(buffer));
+    return initialize_buffer(buffer, org.buf_size, org.page_size,
+                             org.thread_count);
+}
+
 TrackRecentlyReported::TrackRecentlyReported(bool limit_errors,
                                              int error_history_capacity,
                                              bool limit_warnings,
@@ -328,13 +354,112 @@ Reader::Reader(const uint8_t* buffer_, Reporter& reporter)
 {
 }
 
+// The messages decoded from one thread's pages, concatenated in text, to
+// be handed to the Reporter later.
+struct Reader::DecodedEntries {
+    struct Entry {
+        pvt::Content content;
+        int shade_index;
+        uint64_t filename_hash;
+        size_t begin, end;  // range of the message within text
+    };
+    std::vector<Entry> entries;
+    std::string text;
+
+    void clear()
+    {
+        entries.clear();
+        text.clear();
+    }
+};
+
 void
 Reader::process()
 {
+    DecodedEntries decoded;
     const int tc = m_org.thread_count;
     for (int thread_index = 0; thread_index < tc; ++thread_index) {
-        process_entries_for_thread(thread_index);
+        decode_entries_for_thread(thread_index, decoded);
+        report_entries(thread_index, decoded);
     }
+    report_journal_limits();
+}
+
+void
+Reader::process(int nthreads, bool stream)
+{
+    const int tc = m_org.thread_count;
+    if (nthreads <= 0)
+        nthreads = std::max(1u, std::thread::hardware_concurrency());
+    nthreads = std::min(nthreads, tc);
+    if (nthreads <= 1) {
+        process();
+        return;
+    }
+
+    std::vector<DecodedEntries> decoded(tc);
+    std::vector<char> ready(tc, 0);
+    std::mutex ready_mutex;
+    std::condition_variable ready_cv;
+    std::atomic<int> next_thread_index(0);
+
+    // Claim the next undecoded thread, in order, returning false when
+    // there are none left.
+    auto decode_next = [&]() -> bool {
+        int thread_index = next_thread_index++;
+        if (thread_index >= tc)
+            return false;
+        decode_entries_for_thread(thread_index, decoded[thread_index]);
+        {
+            std::lock_guard<std::mutex> lock(ready_mutex);
+            ready[thread_index] = 1;
+        }
+        ready_cv.notify_all();
+        return true;
+    };
+
+    std::vector<std::thread> workers;
+    for (int i = 1; i < nthreads; ++i)
+        workers.emplace_back([&]() {
+            while (decode_next())
+                ;
+        });
+
+    if (stream) {
+        // The calling thread helps decode until the next thread to report
+        // is ready, and frees each thread's messages once reported.
+        for (int thread_index = 0; thread_index < tc; ++thread_index) {
+            bool is_ready = false;
+            while (!is_ready) {
+                {
+                    std::lock_guard<std::mutex> lock(ready_mutex);
+                    is_ready = ready[thread_index];
+                }
+                if (!is_ready && !decode_next()) {
+                    std::unique_lock<std::mutex> lock(ready_mutex);
+                    ready_cv.wait(lock, [&] { return ready[thread_index]; });
+                    is_ready = true;
+                }
+            }
+            report_entries(thread_index, decoded[thread_index]);
+            decoded[thread_index] = DecodedEntries();
+        }
+        for (auto& w : workers)
+            w.join();
+    } else {
+        while (decode_next())
+            ;
+        for (auto& w : workers)
+            w.join();
+        for (int thread_index = 0; thread_index < tc; ++thread_index)
+            report_entries(thread_index, decoded[thread_index]);
+    }
+    report_journal_limits();
+}
+
+void
+Reader::report_journal_limits()
+{
     if (m_org.additional_bytes_required != 0) {
         std::string overfill_message = OSL::fmtformat(
             "Journal sized {} bytes couldn't capture all prints, warnings, and errors.  Additional {} bytes would be required",
@@ -350,8 +475,10 @@ Reader::process()
 }
 
 void
-Reader::process_entries_for_thread(int thread_index)
+Reader::decode_entries_for_thread(int thread_index,
+                                  DecodedEntries& decoded) const
 {
+    decoded.clear();
     uint32_t read_pos = m_org.calc_head_pos(thread_index);
     const auto& info  = m_pageinfo_by_thread_index[thread_index];
     // We are done processing entries when our read_pos reaches the end_pos;
@@ -387,6 +514,12 @@ Reader::process_entries_for_thread(int thread_index)
                     + sizeof(arg_count) + sizeof(EncodedType) * arg_count
                     + arg_values_size;
     };
+    auto addEntry = [&](Content content, uint64_t filename_hash) -> void {
+        size_t begin = decoded.text.size();
+        decoded.text += message;
+        decoded.entries.push_back({ content, shade_index, filename_hash, begin,
+                                    decoded.text.size() });
+    };
 
     while (read_pos != end_pos) {
         const uint8_t* src_ptr = m_buffer + read_pos;
@@ -402,21 +535,11 @@ Reader::process_entries_for_thread(int thread_index)
             break;
         }
 
-        case Content::Error: {
-            decodeMessage(src_ptr);
-            m_reporter.report_error(thread_index, shade_index, message);
-            break;
-        }
-
-        case Content::Warning: {
-            decodeMessage(src_ptr);
-            m_reporter.report_warning(thread_index, shade_index, message);
-            break;
-        }
-
+        case Content::Error:
+        case Content::Warning:
         case Content::Print: {
             decodeMessage(src_ptr);
-            m_reporter.report_print(thread_index, shade_index, message);
+            addEntry(content, 0);
             break;
         }
 
@@ -425,15 +548,42 @@ Reader::process_entries_for_thread(int thread_index)
             uint64_t filname_hash;
             memcpy(&filname_hash, m_buffer + read_pos, sizeof(filname_hash));
             read_pos += sizeof(filname_hash);
-            m_reporter.report_file_print(thread_index, shade_index,
-                                         OSL::ustring::from_hash(filname_hash),
-                                         message);
+            addEntry(content, filname_hash);
             break;
         }
         };
     }
 }
 
+void
+Reader::report_entries(int thread_index, const DecodedEntries& decoded)
+{
+    using pvt::Content;
+
+    for (const auto& e : decoded.entries) {
+        OSL::string_view message(decoded.text.data() + e.begin,
+                                 e.end - e.begin);
+        switch (e.content) {
+        case Content::Error:
+            m_reporter.report_error(thread_index, e.shade_index, message);
+            break;
+        case Content::Warning:
+            m_reporter.report_warning(thread_index, e.shade_index, message);
+            break;
+        case Content::Print:
+            m_reporter.report_print(thread_index, e.shade_index, message);
+            break;
+        case Content::FilePrint:
+            m_reporter.report_file_print(thread_index, e.shade_index,
+                                         OSL::ustring::from_hash(
+                                             e.filename_hash),
+                                         message);
+            break;
+        default: break;
+        }
+    }
+}
+
 }  //namespace journal
 
 OSL_NAMESPACE_END
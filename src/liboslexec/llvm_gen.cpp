@@ -168,7 +168,10 @@ BackendLLVM::llvm_call_layer(int layer, bool unconditional)
     if (!unconditional)
         ll.op_branch(after_block);  // also moves insert point
 
-    shadingsys().m_stat_call_layers_inserted++;
+    if (layer < (int)m_layer_call_sites.size())
+        m_layer_call_sites[layer] += 1;
+    if (!m_recompiling)
+        shadingsys().m_stat_call_layers_inserted++;
 }
 
 
@@ -726,9 +729,17 @@ LLVMGEN(llvm_gen_print_fmt)
     int arg_count = static_cast<int>(encodedtypes.size());
     call_args.push_back(rop.ll.constant(arg_count));
 
+    // format() on the host turns the specification into a FormatPlan now,
+    // so the call needs just the packed values, not their types. (The plan
+    // is found by address, so not when the code is cached for later.)
+    const FormatPlan* plan = nullptr;
+    if (op.opname() == op_format && !rop.use_optix_cache())
+        plan = &find_format_plan(s_ustring, encodedtypes);
+
     llvm::Value* encodedtypes_on_stack
-        = rop.ll.op_alloca(rop.ll.type_int8(), arg_count,
-                           std::string("encodedtypes"));
+        = plan ? nullptr
+               : rop.ll.op_alloca(rop.ll.type_int8(), arg_count,
+                                  std::string("encodedtypes"));
     llvm::Value* loaded_arg_values_on_stack
         = rop.ll.op_alloca(rop.ll.type_int8(), arg_values_size,
                            std::string("argValues"));
@@ -736,9 +747,10 @@ LLVMGEN(llvm_gen_print_fmt)
     int bytesToArg = 0;
     for (int argindex = 0; argindex < arg_count; ++argindex) {
         EncodedType et = encodedtypes[argindex];
-        rop.ll.op_store(rop.ll.constant8(static_cast<uint8_t>(et)),
-                        rop.ll.GEP(rop.ll.type_int8(), encodedtypes_on_stack,
-                                   argindex));
+        if (!plan)
+            rop.ll.op_store(rop.ll.constant8(static_cast<uint8_t>(et)),
+                            rop.ll.GEP(rop.ll.type_int8(),
+                                       encodedtypes_on_stack, argindex));
 
         llvm::Value* loadedArgValue = loaded_arg_values[argindex];
 
@@ -773,6 +785,15 @@ LLVMGEN(llvm_gen_print_fmt)
         bytesToArg += pvt::size_of_encoded_type(et);
     }
 
+    if (plan) {
+        llvm::Value* args[] = { rop.sg_void_ptr(),
+                                rop.ll.constant_ptr((void*)plan),
+                                rop.ll.void_ptr(loaded_arg_values_on_stack) };
+        llvm::Value* ret = rop.ll.call_function("osl_formatfmt_plan", args);
+        rop.llvm_store_value(ret, *rop.opargsym(op, 0));
+        return true;
+    }
+
     call_args.push_back(rop.ll.void_ptr(encodedtypes_on_stack));
     call_args.push_back(rop.ll.constant(arg_values_size));
     call_args.push_back(rop.ll.void_ptr(loaded_arg_values_on_stack));
@@ -1507,8 +1528,7 @@ LLVMGEN(llvm_gen_compref)
 
     llvm::Value* c = rop.llvm_load_value(Index);
     if (rop.inst()->master()->range_checking()) {
-        if (!(Index.is_constant() && Index.get_int() >= 0
-              && Index.get_int() < 3)) {
+        if (!rop.index_in_range(opnum, 2, 3)) {
             llvm::Value* args[]
                 = { c,
                     rop.ll.constant(3),
@@ -1552,8 +1572,7 @@ LLVMGEN(llvm_gen_compassign)
 
     llvm::Value* c = rop.llvm_load_value(Index);
     if (rop.inst()->master()->range_checking()) {
-        if (!(Index.is_constant() && Index.get_int() >= 0
-              && Index.get_int() < 3)) {
+        if (!rop.index_in_range(opnum, 1, 3)) {
             llvm::Value* args[]
                 = { c,
                     rop.ll.constant(3),
@@ -1598,9 +1617,9 @@ LLVMGEN(llvm_gen_mxcompref)
     llvm::Value* row = rop.llvm_load_value(Row);
     llvm::Value* col = rop.llvm_load_value(Col);
     if (rop.inst()->master()->range_checking()) {
-        if (!(Row.is_constant() && Col.is_constant() && Row.get_int() >= 0
-              && Row.get_int() < 4 && Col.get_int() >= 0
-              && Col.get_int() < 4)) {
+        bool row_in_range = rop.index_in_range(opnum, 2, 4);
+        bool col_in_range = rop.index_in_range(opnum, 3, 4);
+        if (!(row_in_range && col_in_range)) {
             llvm::Value* args[]
                 = { row,
                     rop.ll.constant(4),
@@ -1612,12 +1631,10 @@ LLVMGEN(llvm_gen_mxcompref)
                     rop.ll.constant(rop.layer()),
                     rop.llvm_const_hash(rop.inst()->layername()),
                     rop.llvm_const_hash(rop.inst()->shadername()) };
-            if (!(Row.is_constant() && Row.get_int() >= 0
-                  && Row.get_int() < 4)) {
+            if (!row_in_range) {
                 row = rop.ll.call_function("osl_range_check", args);
             }
-            if (!(Col.is_constant() && Col.get_int() >= 0
-                  && Col.get_int() < 4)) {
+            if (!col_in_range) {
                 args[0] = col;
                 col     = rop.ll.call_function("osl_range_check", args);
             }
@@ -1655,9 +1672,9 @@ LLVMGEN(llvm_gen_mxcompassign)
     llvm::Value* row = rop.llvm_load_value(Row);
     llvm::Value* col = rop.llvm_load_value(Col);
     if (rop.inst()->master()->range_checking()) {
-        if (!(Row.is_constant() && Col.is_constant() && Row.get_int() >= 0
-              && Row.get_int() < 4 && Col.get_int() >= 0
-              && Col.get_int() < 4)) {
+        bool row_in_range = rop.index_in_range(opnum, 1, 4);
+        bool col_in_range = rop.index_in_range(opnum, 2, 4);
+        if (!(row_in_range && col_in_range)) {
             llvm::Value* args[]
                 = { row,
                     rop.ll.constant(4),
@@ -1669,12 +1686,10 @@ LLVMGEN(llvm_gen_mxcompassign)
                     rop.ll.constant(rop.layer()),
                     rop.llvm_const_hash(rop.inst()->layername()),
                     rop.llvm_const_hash(rop.inst()->shadername()) };
-            if (!(Row.is_constant() && Row.get_int() >= 0
-                  && Row.get_int() < 4)) {
+            if (!row_in_range) {
                 row = rop.ll.call_function("osl_range_check", args);
             }
-            if (!(Col.is_constant() && Col.get_int() >= 0
-                  && Col.get_int() < 4)) {
+            if (!col_in_range) {
                 args[0] = col;
                 col     = rop.ll.call_function("osl_range_check", args);
             }
@@ -1727,8 +1742,7 @@ LLVMGEN(llvm_gen_aref)
     if (!index)
         return false;
     if (rop.inst()->master()->range_checking()) {
-        if (!(Index.is_constant() && Index.get_int() >= 0
-              && Index.get_int() < Src.typespec().arraylength())) {
+        if (!rop.index_in_range(opnum, 2, Src.typespec().arraylength())) {
             llvm::Value* args[]
                 = { index,
                     rop.ll.constant(Src.typespec().arraylength()),
@@ -1772,8 +1786,7 @@ LLVMGEN(llvm_gen_aassign)
     if (!index)
         return false;
     if (rop.inst()->master()->range_checking()) {
-        if (!(Index.is_constant() && Index.get_int() >= 0
-              && Index.get_int() < Result.typespec().arraylength())) {
+        if (!rop.index_in_range(opnum, 1, Result.typespec().arraylength())) {
             llvm::Value* args[]
                 = { index,
                     rop.ll.constant(Result.typespec().arraylength()),
@@ -2291,6 +2304,8 @@ LLVMGEN(llvm_gen_regex)
     OSL_DASSERT(!do_match_results
                 || (Match.typespec().is_array()
                     && Match.typespec().elementtype().is_int()));
+    if (Pattern.is_constant())
+        rop.shadingsys().precompile_regex(Pattern.get_string());
 
     llvm::Value* call_args[] = {
         rop.sg_void_ptr(),             // First arg is ShaderGlobals ptr
@@ -2356,7 +2371,8 @@ LLVMGEN(llvm_gen_generic)
             || op.opname() == op_sign)
             any_deriv_args = false;
 
-    std::string name = std::string("osl_") + op.opname().string() + "_";
+    std::string name = std::string("osl_") + rop.math_opname(op.opname())
+                       + "_";
     for (int i = 0; i < op.nargs(); ++i) {
         Symbol* s(rop.opargsym(op, i));
         if (any_deriv_args && Result.has_derivs() && s->has_derivs()
@@ -2376,6 +2392,21 @@ LLVMGEN(llvm_gen_generic)
             OSL_ASSERT(0);
     }
 
+    // Special case: on the CPU, strings made by concat and substr go
+    // through the context's memo of recent results, so that making the
+    // same string again doesn't go back to the global ustring table.
+    if (!rop.use_optix()
+        && (name == "osl_concat_sss" || name == "osl_substr_ssii")) {
+        llvm::Value* call_args[4] = { rop.sg_void_ptr() };
+        for (int i = 1; i < op.nargs(); ++i)
+            call_args[i] = rop.llvm_load_value(*args[i]);
+        llvm::Value* r = rop.ll.call_function(
+            name == "osl_concat_sss" ? "osl_concat_memo" : "osl_substr_memo",
+            cspan<llvm::Value*>(call_args, op.nargs()));
+        rop.llvm_store_value(r, Result);
+        return true;
+    }
+
     if (!Result.has_derivs() || !any_deriv_args) {
         // Don't compute derivs -- either not needed or not provided in args
         if (Result.typespec().aggregate() == TypeDesc::SCALAR) {
@@ -3133,6 +3164,25 @@ llvm_gen_noise_options(BackendLLVM& rop, int opnum, int first_optional_arg)
             rop.ll.call_function("osl_noiseparams_set_impulses", opt,
                                  rop.llvm_load_value(Val, 0, NULL, 0,
                                                      TypeFloat));
+        } else if (name == Strings::octaves && Val.typespec().is_int()) {
+            rop.ll.call_function("osl_noiseparams_set_octaves", opt,
+                                 rop.llvm_load_value(Val));
+        } else if (name == Strings::lacunarity
+                   && (Val.typespec().is_float() || Val.typespec().is_int())) {
+            rop.ll.call_function("osl_noiseparams_set_lacunarity", opt,
+                                 rop.llvm_load_value(Val, 0, NULL, 0,
+                                                     TypeFloat));
+        } else if (name == Strings::gain
+                   && (Val.typespec().is_float() || Val.typespec().is_int())) {
+            rop.ll.call_function("osl_noiseparams_set_gain", opt,
+                                 rop.llvm_load_value(Val, 0, NULL, 0,
+                                                     TypeFloat));
+        } else if (name == Strings::bake_type && Val.typespec().is_string()) {
+            rop.ll.call_function("osl_noiseparams_set_bake_type", opt,
+                                 rop.llvm_load_value(Val));
+        } else if (name == Strings::bake_res && Val.typespec().is_int()) {
+            rop.ll.call_function("osl_noiseparams_set_bake_res", opt,
+                                 rop.llvm_load_value(Val));
         } else {
             rop.shadingcontext()->errorfmt(
                 "Unknown {} optional argument: \"{}\", <{}> ({}:{})",
@@ -3226,6 +3276,9 @@ LLVMGEN(llvm_gen_noise)
         name = Strings::simplexnoise;
     } else if (name == Strings::usimplex && !periodic) {
         name = Strings::usimplexnoise;
+    } else if ((name == Strings::voronoi || name == Strings::worley)
+               && !periodic) {
+        name = Strings::voronoinoise;
     } else if (name == Strings::gabor) {
         // already named
         pass_name    = true;
@@ -3233,6 +3286,23 @@ LLVMGEN(llvm_gen_noise)
         pass_options = true;
         derivs       = true;
         name         = periodic ? Strings::gaborpnoise : Strings::gabornoise;
+    } else if ((name == Strings::fbm || name == Strings::turbulence
+                || name == Strings::ridged)
+               && !periodic) {
+        // All the octaves are summed by one call, which takes the name
+        // of the fractal type and its options
+        pass_name    = true;
+        pass_sg      = true;
+        pass_options = true;
+        derivs       = true;
+        name         = Strings::fractalnoise;
+    } else if (name == Strings::baked && !periodic) {
+        // Lookups into a cached volume of the "bake_type" noise
+        pass_name    = true;
+        pass_sg      = true;
+        pass_options = true;
+        derivs       = true;
+        name         = Strings::bakednoise;
     } else {
         rop.shadingcontext()->errorfmt(
             "{}noise type \"{}\" is unknown, called from ({}:{})",
@@ -3259,6 +3329,15 @@ LLVMGEN(llvm_gen_noise)
         pass_options = false;
     }
 
+    if (!periodic && rop.shadingsys().noise_hash() == Strings::pcg) {
+        // Renderer selected the PCG lattice hash, which only the
+        // non-periodic perlin flavors offer
+        if (name == Strings::noise)
+            name = Strings::noise_pcg;
+        else if (name == Strings::snoise)
+            name = Strings::snoise_pcg;
+    }
+
     llvm::Value* opt = NULL;
     if (pass_options) {
         opt = llvm_gen_noise_options(rop, opnum, arg);
@@ -3455,6 +3534,16 @@ LLVMGEN(llvm_gen_getattribute)
             rop.llvm_store_value(rop.ll.constant(0), Result);
         }
     } else {
+        // An attribute the renderer declares fixed for the shaded object
+        // need only be fetched once per execution, however many times
+        // (or loop iterations) the shader asks for it.
+        bool per_object = !rop.use_optix()
+                          && rop.shadingsys().fold_getattribute()
+                          && attribute_name_ptr
+                          && (!object_lookup || object_name_ptr)
+                          && rop.renderer()->attribute_constancy(object_name,
+                                                                 attribute_name)
+                                 == AttributeConstancy::PerObject;
         llvm::Value* args[] = {
             rop.sg_void_ptr(),
             rop.ll.constant((int)Destination.has_derivs()),
@@ -3465,7 +3554,9 @@ LLVMGEN(llvm_gen_getattribute)
             rop.ll.constant(dest_type),
             rop.llvm_void_ptr(Destination),
         };
-        llvm::Value* r = rop.ll.call_function("osl_get_attribute", args);
+        llvm::Value* r = rop.ll.call_function(
+            per_object ? "osl_get_attribute_per_object" : "osl_get_attribute",
+            args);
         rop.llvm_store_value(r, Result);
     }
 
@@ -3882,7 +3973,8 @@ LLVMGEN(llvm_gen_closure)
 
     // If the closure has a "prepare" method, call
     // prepare(renderer, id, memptr).  If there is no prepare method, just
-    // zero out the closure parameter memory.
+    // zero out the closure parameter memory, unless the params are about
+    // to overwrite all of it anyway.
     if (clentry->prepare) {
         // Call clentry->prepare(renderservices *, int id, void *mem)
         llvm::Value* funct_ptr
@@ -3890,7 +3982,7 @@ LLVMGEN(llvm_gen_closure)
                                   rop.llvm_type_prepare_closure_func());
         llvm::Value* args[] = { render_ptr, id_int, mem_void_ptr };
         rop.ll.call_function(funct_ptr, args);
-    } else {
+    } else if (!clentry->formals_fill_struct) {
         rop.ll.op_memset(mem_void_ptr, 0, clentry->struct_size, 4 /*align*/);
     }
 
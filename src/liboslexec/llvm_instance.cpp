@@ -2,6 +2,7 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
 #include <bitset>
 #include <cmath>
 #include <iostream>
@@ -226,6 +227,84 @@ fused_function_name(const ShaderGroup& group)
                      inst->layername());
 }
 
+std::string
+wavefront_function_name(const ShaderGroup& group)
+{
+    int nlayers          = group.nlayers();
+    ShaderInstance* inst = group[nlayers - 1];
+
+    return fmtformat("__osl_wavefront_{}_name_{}", group.name(),
+                     inst->layername());
+}
+
+void
+ptx_resource_usage(string_view ptx, int& registers, int& local_bytes)
+{
+    // Each function declares its virtual registers, in lines like
+    // ".reg .f32 %f<123>;", and its stack, ".local .align 8 .b8
+    // __local_depot4[48];". Virtual registers are not what ptxas will
+    // allocate, but the count of them follows the pressure it will face.
+    registers   = 0;
+    local_bytes = 0;
+    int func_registers = 0, func_local_bytes = 0;
+    while (ptx.size()) {
+        string_view line = Strutil::parse_line(ptx);
+        string_view s    = line;
+        Strutil::skip_whitespace(s);
+        if (Strutil::starts_with(s, ".reg")) {
+            size_t lt = s.find('<');
+            int n;
+            if (lt != string_view::npos) {
+                s.remove_prefix(lt + 1);
+                if (Strutil::parse_int(s, n))
+                    func_registers += n;
+            }
+        } else if (Strutil::starts_with(s, ".local")) {
+            size_t bracket = s.find('[');
+            int n;
+            if (bracket != string_view::npos) {
+                s.remove_prefix(bracket + 1);
+                if (Strutil::parse_int(s, n))
+                    func_local_bytes += n;
+            }
+        } else if (Strutil::starts_with(s, "}")) {
+            registers        = std::max(registers, func_registers);
+            local_bytes      = std::max(local_bytes, func_local_bytes);
+            func_registers   = 0;
+            func_local_bytes = 0;
+        }
+    }
+}
+
+bool
+compile_shadeops_ptx(const LLVM_Util::PerThreadInfo& thread_info,
+                     string_view arch, std::string& ptx)
+{
+#if OSL_USE_OPTIX && defined(OSL_LLVM_CUDA_BITCODE)
+    // The same bitcode that groups link in, compiled on its own, as the
+    // build does for CUDA_TARGET_ARCH.
+    LLVM_Util ll(thread_info);
+    std::string err;
+    llvm::Module* module = ll.module_from_bitcode(
+        (char*)shadeops_cuda_llvm_compiled_ops_block,
+        shadeops_cuda_llvm_compiled_ops_size, "llvm_ops", &err);
+    if (!module || err.length())
+        return false;
+    module->setDataLayout(
+        "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-i128:128:128-f32:32:32-f64:64:64-v16:16:16-v32:32:32-v64:64:64-v128:128:128-n16:32:64");
+#    if OSL_LLVM_VERSION < 210
+    module->setTargetTriple("nvptx64-nvidia-cuda");
+#    else
+    module->setTargetTriple(llvm::Triple("nvptx64-nvidia-cuda"));
+#    endif
+    ll.module(module);
+    ll.nvptx_target_arch(arch);
+    return ll.ptx_compile_group(nullptr, "shadeops_cuda", ptx) && ptx.size();
+#else
+    return false;
+#endif
+}
+
 llvm::Type*
 BackendLLVM::llvm_type_sg()
 {
@@ -351,59 +430,199 @@ BackendLLVM::llvm_type_groupdata()
         }
     }
 
-    // For each layer in the group, add entries for all params that are
-    // connected or interpolated, and output params.  Also mark those
-    // symbols with their offset within the group struct.
-    m_param_order_map.clear();
+    // Next, the flags and values of the noise results that several layers
+    // share (see RuntimeOptimizer::find_shared_noise).
+    m_noise_memo_field = -1;
+    int nmemos         = (int)group().m_noise_memo_types.size();
+    if (nmemos) {
+        if (llvm_debug() >= 2)
+            std::cout << "  noise memo flags: " << nmemos << " at offset "
+                      << offset << ", field " << order << "\n";
+        m_noise_memo_field = order;
+        int sz             = (nmemos + 3) & (~3);
+        fields.push_back(ll.type_array(ll.type_int8(), sz));
+        m_groupdata_field_names.emplace_back("noise_memo_flags");
+        offset += sz * sizeof(int8_t);
+        ++order;
+        for (int i = 0; i < nmemos; ++i) {
+            TypeSpec ts   = group().m_noise_memo_types[i];
+            int derivSize = group().m_noise_memo_derivs[i] ? 3 : 1;
+            ts.make_array(derivSize);
+            fields.push_back(llvm_type(ts));
+            m_groupdata_field_names.emplace_back(fmtformat("noisememo{}_", i));
+            int align     = (int)sizeof(float);
+            offset = OIIO::round_to_multiple_of_pow2(offset, align);
+            offset += derivSize * int(ts.elementtype().simpletype().size());
+            ++order;
+        }
+    }
+
+    // For each layer in the group, gather all params that are connected
+    // or interpolated, and output params.  With opt_groupdata_hot, the
+    // params most referenced by ops are laid out first, so the values a
+    // shade touches most share the few cache lines after the run flags
+    // and cold params trail at the end.
+    struct GroupdataParam {
+        int layer;
+        Symbol* sym;
+        int refs;
+    };
+    std::vector<GroupdataParam> params;
+    std::vector<int> refs;
     for (int layer = 0; layer < group().nlayers(); ++layer) {
         ShaderInstance* inst = group()[layer];
         if (inst->unused())
             continue;
+        if (shadingsys().m_opt_groupdata_hot)
+            inst->count_symbol_refs(refs);
         FOREACH_PARAM(Symbol & sym, inst)
         {
-            TypeSpec ts = sym.typespec();
-            if (ts.is_structure())  // skip the struct symbol itself
+            if (sym.typespec().is_structure())  // skip the struct symbol
                 continue;
-
             if (can_treat_param_as_local(sym))
                 continue;
-
-            const int arraylen  = std::max(1, sym.typespec().arraylength());
-            const int derivSize = (sym.has_derivs() ? 3 : 1);
-            ts.make_array(arraylen * derivSize);
-            fields.push_back(llvm_type(ts));
-            m_groupdata_field_names.emplace_back(
-                fmtformat("lay{}param_{}_", layer, sym.name()));
-
-            // FIXME(arena) -- temporary debugging
-            if (debug() && sym.symtype() == SymTypeOutputParam
-                && !sym.connected_down()) {
-                auto found = group().find_symloc(sym.name());
-                if (found)
-                    print("layer {} \"{}\" : OUTPUT {}\n", layer,
-                          inst->layername(), found->name);
+            if (is_readonly_param(sym)) {
+                sym.dataoffset(-1);  // Not in the heap; see symbol_data()
+                continue;
+            }
+            int r = refs.size() ? refs[inst->symbolindex(&sym)] : 0;
+            params.push_back({ layer, &sym, r });
+        }
+    }
+    if (shadingsys().m_opt_groupdata_hot)
+        std::stable_sort(params.begin(), params.end(),
+                         [](const GroupdataParam& a, const GroupdataParam& b) {
+                             return a.refs > b.refs;
+                         });
+
+    // With opt_groupdata_share, an input param whose value only lives
+    // while its own layer runs may share its field with params of the same
+    // type belonging to layers that never run at the same time. A layer
+    // runs nested only within layers downstream of it, and the group entry
+    // runs every layer, so two layers are apart if neither is upstream of
+    // the other and neither is the entry. A connected param is written
+    // when its upstream layer finishes, which is only within its own
+    // layer's run if that upstream layer is lazy, isn't an entry layer the
+    // app may run itself, and feeds nothing else.
+    int nlayers = group().nlayers();
+    std::vector<std::vector<char>> upstream;  // [layer][maybe upstream]
+    std::vector<int> consumer(nlayers, -1);   // sole downstream, or -2
+    if (shadingsys().m_opt_groupdata_share) {
+        upstream.assign(nlayers, std::vector<char>(nlayers, 0));
+        for (int layer = 0; layer < nlayers; ++layer) {
+            ShaderInstance* inst = group()[layer];
+            for (int c = 0, nc = inst->nconnections(); c < nc; ++c) {
+                int src = inst->connection(c).srclayer;
+                upstream[layer][src] = 1;
+                for (int u = 0; u < src; ++u)
+                    upstream[layer][u] |= upstream[src][u];
+                if (consumer[src] == -1)
+                    consumer[src] = layer;
+                else if (consumer[src] != layer)
+                    consumer[src] = -2;
             }
+        }
+    }
+    auto shareable = [&](int layer, const Symbol& sym) {
+        if (upstream.empty() || layer == nlayers - 1
+            || sym.symtype() != SymTypeParam || sym.connected_down()
+            || sym.renderer_output() || sym.interactive()
+            || sym.typespec().is_closure_based())
+            return false;
+        ShaderInstance* inst = group()[layer];
+        for (int c = 0, nc = inst->nconnections(); c < nc; ++c) {
+            const Connection& con(inst->connection(c));
+            if (inst->symbol(con.dst.param) == &sym
+                && (consumer[con.srclayer] != layer
+                    || !group()[con.srclayer]->run_lazily()
+                    || group()[con.srclayer]->entry_layer()))
+                return false;
+        }
+        return true;
+    };
+    struct SharedField {
+        TypeSpec type;
+        int order;
+        size_t offset;
+        std::vector<int> layers;
+    };
+    std::vector<SharedField> shared;
 
-            // Alignment
-            size_t align = sym.typespec().is_closure_based()
-                               ? sizeof(void*)
-                               : sym.typespec().simpletype().basesize();
-            if (offset & (align - 1))
-                offset += align - (offset & (align - 1));
-            if (llvm_debug() >= 2)
-                print("  {} ({}) {} {}, field {}, size {}, offset {}{}{}\n",
-                      inst->layername(), inst->id(), sym.mangled(), ts.c_str(),
-                      order, derivSize * int(sym.size()), offset,
-                      sym.interpolated() ? " (interpolated)" : "",
-                      sym.interactive() ? " (interactive)" : "");
-            sym.dataoffset((int)offset);
-            // TODO(arenas): sym.set_dataoffset(SymArena::Heap, offset);
-            offset += derivSize * sym.size();
-            m_param_order_map[&sym] = order;
-            ++order;
+    // Add the entries and mark those symbols with their offset within the
+    // group struct.
+    m_param_order_map.clear();
+    for (const GroupdataParam& param : params) {
+        int layer            = param.layer;
+        ShaderInstance* inst = group()[layer];
+        Symbol& sym(*param.sym);
+        TypeSpec ts = sym.typespec();
+
+        const int arraylen  = std::max(1, sym.typespec().arraylength());
+        const int derivSize = (sym.has_derivs() ? 3 : 1);
+        ts.make_array(arraylen * derivSize);
+
+        bool share = shareable(layer, sym);
+        if (share) {
+            auto apart = [&](const SharedField& field) {
+                for (int other : field.layers)
+                    if (other == layer || upstream[layer][other]
+                        || upstream[other][layer])
+                        return false;
+                return true;
+            };
+            auto f = std::find_if(shared.begin(), shared.end(),
+                                  [&](const SharedField& field) {
+                                      return field.type == ts && apart(field);
+                                  });
+            if (f != shared.end()) {
+                if (llvm_debug() >= 2)
+                    print("  {} ({}) {} {}, shares field {}, offset {}\n",
+                          inst->layername(), inst->id(), sym.mangled(),
+                          ts.c_str(), f->order, f->offset);
+                f->layers.push_back(layer);
+                sym.dataoffset((int)f->offset);
+                m_param_order_map[&sym] = f->order;
+                continue;
+            }
+        }
+        fields.push_back(llvm_type(ts));
+        m_groupdata_field_names.emplace_back(
+            fmtformat("lay{}param_{}_", layer, sym.name()));
+
+        // FIXME(arena) -- temporary debugging
+        if (debug() && sym.symtype() == SymTypeOutputParam
+            && !sym.connected_down()) {
+            auto found = group().find_symloc(sym.name());
+            if (found)
+                print("layer {} \"{}\" : OUTPUT {}\n", layer,
+                      inst->layername(), found->name);
         }
+
+        // Alignment
+        size_t align = sym.typespec().is_closure_based()
+                           ? sizeof(void*)
+                           : sym.typespec().simpletype().basesize();
+        if (offset & (align - 1))
+            offset += align - (offset & (align - 1));
+        if (llvm_debug() >= 2)
+            print("  {} ({}) {} {}, field {}, size {}, offset {}{}{}\n",
+                  inst->layername(), inst->id(), sym.mangled(), ts.c_str(),
+                  order, derivSize * int(sym.size()), offset,
+                  sym.interpolated() ? " (interpolated)" : "",
+                  sym.interactive() ? " (interactive)" : "");
+        sym.dataoffset((int)offset);
+        // TODO(arenas): sym.set_dataoffset(SymArena::Heap, offset);
+        if (share)
+            shared.push_back({ ts, order, offset, { layer } });
+        offset += derivSize * sym.size();
+        m_param_order_map[&sym] = order;
+        ++order;
     }
-    group().llvm_groupdata_size(offset);
+    // A re-JIT lays the groupdata out as the first JIT did, and leaves the
+    // group's size alone since shades may be reading it.
+    OSL_DASSERT(!m_recompiling || offset == group().llvm_groupdata_size());
+    if (!m_recompiling)
+        group().llvm_groupdata_size(offset);
     if (llvm_debug() >= 2)
         print(" Group struct had {} fields, total size {}\n\n", order, offset);
 
@@ -603,6 +822,11 @@ BackendLLVM::llvm_type_noise_options()
     comp_types.push_back(ll.type_triple());  // direction;
     comp_types.push_back(ll.type_float());   // bandwidth;
     comp_types.push_back(ll.type_float());   // impulses;
+    comp_types.push_back(ll.type_int());     // octaves;
+    comp_types.push_back(ll.type_float());   // lacunarity;
+    comp_types.push_back(ll.type_float());   // gain;
+    comp_types.push_back(ll.type_ustring()); // bake_type;
+    comp_types.push_back(ll.type_int());     // bake_res;
 
     m_llvm_type_noise_options = ll.type_struct(comp_types, "NoiseOptions");
 
@@ -613,6 +837,11 @@ BackendLLVM::llvm_type_noise_options()
     offset_by_index.push_back(offsetof(NoiseParams, direction));
     offset_by_index.push_back(offsetof(NoiseParams, bandwidth));
     offset_by_index.push_back(offsetof(NoiseParams, impulses));
+    offset_by_index.push_back(offsetof(NoiseParams, octaves));
+    offset_by_index.push_back(offsetof(NoiseParams, lacunarity));
+    offset_by_index.push_back(offsetof(NoiseParams, gain));
+    offset_by_index.push_back(offsetof(NoiseParams, bake_type));
+    offset_by_index.push_back(offsetof(NoiseParams, bake_res));
     ll.validate_struct_data_layout(m_llvm_type_noise_options, offset_by_index);
 #endif
 
@@ -697,7 +926,33 @@ BackendLLVM::llvm_create_constant(const Symbol& sym)
     // Initialize entire array
     const int num_elements = t.numelements();
 
-    const int array_len = num_elements * num_components;
+    const int array_len        = num_elements * num_components;
+    std::string unique_symname = global_unique_symname(sym);
+
+    // Large constant arrays are referenced by address in the process-wide
+    // pool, so identical tables in many groups are stored only once.
+    int shared_min = shadingsys().llvm_shared_constants();
+    if (shared_min > 0 && sym.typespec().is_array()
+        && t.size() >= size_t(shared_min) && !use_optix()
+        && shadingsys().llvm_jit_cache_dir().empty()) {
+        std::vector<uint64_t> buf((t.size() + 7) / 8);
+        for (int i = 0; i < array_len; ++i) {
+            if (sym.typespec().is_float_based())
+                ((float*)buf.data())[i] = sym.get_float(i);
+            else if (sym.typespec().is_int_based())
+                ((int*)buf.data())[i] = sym.get_int(i);
+            else if (sym.typespec().is_string_based())
+                buf[i] = ustring(sym.get_string(i)).hash();
+        }
+        const void* shared = shadingsys().shared_constant(buf.data(),
+                                                          t.size());
+        m_const_map[unique_symname] = ll.constant_ptr(
+            const_cast<void*>(shared));
+        if (!m_recompiling)
+            shadingsys().m_stat_shared_constants += 1;
+        return;
+    }
+
     std::vector<llvm::Constant*> elements;
     elements.reserve(array_len);
     for (int a = 0; a < num_elements; ++a) {
@@ -725,8 +980,7 @@ BackendLLVM::llvm_create_constant(const Symbol& sym)
 
     // NOTE: even if type is not an array, it could be aggregate 3 or 16
     // we always just linearize it all for constants.
-    auto const_array           = ll.constant_array(elements);
-    std::string unique_symname = global_unique_symname(sym);
+    auto const_array = ll.constant_array(elements);
 
     auto global_var = ll.create_global_constant(const_array, unique_symname);
 
@@ -734,6 +988,46 @@ BackendLLVM::llvm_create_constant(const Symbol& sym)
     m_const_map[unique_symname] = global_var;
 }
 
+
+
+llvm::Value*
+BackendLLVM::llvm_readonly_param(const Symbol& sym)
+{
+    // Keyed like constants, by a name unique to the group and layer, so
+    // that later layers reading it through a connection find the same one.
+    std::string unique_symname = global_unique_symname(sym);
+    auto found                 = m_const_map.find(unique_symname);
+    if (found != m_const_map.end())
+        return found->second;
+
+    // Laid out as in GroupData: the values, then the derivs (all zero).
+    TypeDesc t           = sym.typespec().simpletype();
+    const int array_len  = t.numelements() * t.aggregate;
+    const int num_derivs = sym.has_derivs() ? 2 * array_len : 0;
+    TypeSpec elemtype    = sym.typespec().elementtype();
+    std::vector<llvm::Constant*> elements;
+    elements.reserve(array_len + num_derivs);
+    for (int i = 0; i < array_len; ++i) {
+        if (elemtype.is_float_based())
+            elements.push_back(ll.constant(sym.get_float(i)));
+        else if (elemtype.is_int_based())
+            elements.push_back(ll.constant(sym.get_int(i)));
+        else if (elemtype.is_string_based())
+            elements.push_back(reinterpret_cast<llvm::Constant*>(
+                ll.constant_ptr(OSL::bitcast<char*>(
+                                    ustring(sym.get_string(i)).hash()),
+                                ll.type_char_ptr())));
+    }
+    OSL_ASSERT(int(elements.size()) == array_len && "unhandled type");
+    for (int i = 0; i < num_derivs; ++i)
+        elements.push_back(ll.constant(0.0f));
+
+    auto global_var = ll.create_global_constant(ll.constant_array(elements),
+                                                unique_symname);
+    m_const_map[unique_symname] = global_var;
+    return global_var;
+}
+
 void
 BackendLLVM::llvm_assign_initial_value(const Symbol& sym, bool force)
 {
@@ -760,7 +1054,7 @@ BackendLLVM::llvm_assign_initial_value(const Symbol& sym, bool force)
     // we store special values in the variable to make it easier to detect
     // uninitialized use.
     if ((sym.symtype() == SymTypeLocal || sym.symtype() == SymTypeTemp)
-        && shadingsys().debug_uninit()) {
+        && debug_uninit()) {
         bool isarray   = sym.typespec().is_array();
         int alen       = isarray ? sym.typespec().arraylength() : 1;
         llvm::Value* u = NULL;
@@ -955,7 +1249,7 @@ BackendLLVM::llvm_assign_initial_value(const Symbol& sym, bool force)
             got_userdata = ll.call_function("osl_bind_interpolated_param",
                                             args);
         }
-        if (shadingsys().debug_nan() && type.basetype == TypeDesc::FLOAT) {
+        if (debug_nan() && type.basetype == TypeDesc::FLOAT) {
             // check for NaN/Inf for float-based types
             int ncomps          = type.numelements() * type.aggregate;
             llvm::Value* args[] = { ll.constant(ncomps),
@@ -1250,17 +1544,19 @@ BackendLLVM::build_llvm_code(int beginop, int endop, llvm::BasicBlock* bb)
         const Opcode& op        = inst()->ops()[opnum];
         const OpDescriptor* opd = shadingsys().op_descriptor(op.opname());
         if (opd && opd->llvmgen) {
-            if (shadingsys().debug_uninit() /* debug uninitialized vals */)
+            if (debug_uninit() /* debug uninitialized vals */)
                 llvm_generate_debug_uninit(op);
             if (shadingsys().llvm_debug_ops())
                 llvm_generate_debug_op_printf(op);
             if (ll.debug_is_enabled())
                 ll.debug_set_location(op.sourcefile(),
                                       std::max(op.sourceline(), 1));
-            bool ok = (*opd->llvmgen)(*this, opnum);
+            int memo = noise_memo_slot(opnum);
+            bool ok  = memo >= 0 ? build_llvm_noise_memo(opnum, memo, opd)
+                                 : (*opd->llvmgen)(*this, opnum);
             if (!ok)
                 return false;
-            if (shadingsys().debug_nan() /* debug NaN/Inf */
+            if (debug_nan() /* debug NaN/Inf */
                 && op.farthest_jump() < 0 /* Jumping ops don't need it */) {
                 llvm_generate_debugnan(op);
             }
@@ -1284,6 +1580,54 @@ BackendLLVM::build_llvm_code(int beginop, int endop, llvm::BasicBlock* bb)
 
 
 
+int
+BackendLLVM::noise_memo_slot(int opnum) const
+{
+    for (auto&& m : group().m_noise_memos)
+        if (m.layer == layer() && m.opnum == opnum)
+            return m.slot;
+    return -1;
+}
+
+
+
+bool
+BackendLLVM::build_llvm_noise_memo(int opnum, int slot,
+                                   const OpDescriptor* opd)
+{
+    // if (noise_memo_flags[slot])
+    //     Result = noisememo[slot];
+    // else {
+    //     Result = noise(...);
+    //     noisememo[slot] = Result;  noise_memo_flags[slot] = 1;
+    // }
+    const Opcode& op       = inst()->ops()[opnum];
+    const Symbol& Result   = *opargsym(op, 0);
+    int size               = (int)Result.derivsize();
+    llvm::Value* flag_ref  = noise_memo_flag_ref(slot);
+    llvm::Value* value_ptr = ll.void_ptr(
+        groupdata_field_ref(m_noise_memo_field + 1 + slot));
+    llvm::Value* done = ll.op_ne(ll.op_int8_to_int(
+                                     ll.op_load(ll.type_int8(), flag_ref)),
+                                 ll.constant(0));
+    llvm::BasicBlock* copy_block    = ll.new_basic_block("noise_memo_copy");
+    llvm::BasicBlock* compute_block = ll.new_basic_block("noise_memo_compute");
+    llvm::BasicBlock* after_block   = ll.new_basic_block("noise_memo_after");
+    ll.op_branch(done, copy_block, compute_block);
+    ll.op_memcpy(llvm_void_ptr(Result), value_ptr, size, 4);
+    ll.op_branch(after_block);
+
+    ll.set_insert_point(compute_block);
+    if (!(*opd->llvmgen)(*this, opnum))
+        return false;
+    ll.op_memcpy(value_ptr, llvm_void_ptr(Result), size, 4);
+    ll.op_store(ll.constant8((int8_t)1), flag_ref);
+    ll.op_branch(after_block);
+    return true;
+}
+
+
+
 llvm::Function*
 BackendLLVM::build_llvm_init()
 {
@@ -1338,16 +1682,44 @@ BackendLLVM::build_llvm_init()
 #endif
 
     // Group init clears all the "layer_run" and "userdata_initialized" flags.
-    if (m_num_used_layers > 1) {
-        int sz = (m_num_used_layers + 3) & (~3);  // round up to 32 bits
-        ll.op_memset(ll.void_ptr(layer_run_ref(0)), 0, sz, 4 /*align*/);
-    }
+    // They are adjacent at the start of groupdata, so a single memset
+    // covers both.  Params need no clearing: each layer writes its own.
+    int runflags_sz  = (m_num_used_layers + 3) & (~3);  // round up to 32 bits
     int num_userdata = (int)group().m_userdata_names.size();
-    if (num_userdata) {
-        int sz = (num_userdata + 3) & (~3);  // round up to 32 bits
-        ll.op_memset(ll.void_ptr(userdata_initialized_ref(0)), 0, sz,
+    int userdata_sz  = (num_userdata + 3) & (~3);  // round up to 32 bits
+    if (num_userdata)
+        ll.op_memset(ll.void_ptr(layer_run_ref(0)), 0,
+                     runflags_sz + userdata_sz, 4 /*align*/);
+    else if (m_num_used_layers > 1)
+        ll.op_memset(ll.void_ptr(layer_run_ref(0)), 0, runflags_sz,
                      4 /*align*/);
+
+    // Unless userdata is retrieved lazily, fetch all of it that the
+    // layers will bind to parameters with one call to the renderer, so
+    // that binding each parameter only copies it. Userdata with a
+    // pre-placement record, or from renderer-built getters, is left to
+    // the parameter binding.
+    group().m_userdata_gathered.clear();
+    if (num_userdata && !shadingsys().lazy_userdata() && !use_optix()
+        && !renderer()->supports("build_interpolated_getter")) {
+        for (int i = 0; i < num_userdata; ++i) {
+            ShaderInstance* layer = group()[group().m_userdata_layers[i]];
+            if (!group().find_symloc(group().m_userdata_names[i],
+                                     layer->layername(), SymArena::UserData))
+                group().m_userdata_gathered.push_back(i);
+        }
     }
+    if (group().m_userdata_gathered.size()) {
+        llvm::Value* args[] = { sg_void_ptr(), ll.void_ptr(groupdata_ptr()),
+                                ll.void_ptr(userdata_initialized_ref(0)) };
+        ll.call_function("osl_gather_userdata", args);
+    }
+
+    // The shared noise results are recomputed for every shade, too.
+    int num_noise_memos = (int)group().m_noise_memo_types.size();
+    if (num_noise_memos)
+        ll.op_memset(ll.void_ptr(noise_memo_flag_ref(0)), 0,
+                     (num_noise_memos + 3) & (~3), 4 /*align*/);
 
     // Group init also needs to allot space for ALL layers' params
     // that are closures (to avoid weird order of layer eval problems).
@@ -1477,6 +1849,8 @@ BackendLLVM::build_llvm_optix_callables()
     }
 
     funcs.push_back(build_llvm_fused_callable());
+    if (shadingsys().optix_wavefront())
+        funcs.push_back(build_llvm_wavefront_kernel());
     return funcs;
 }
 
@@ -1544,6 +1918,87 @@ BackendLLVM::build_llvm_fused_callable(void)
     return ll.current_function();
 }
 
+//
+// Wavefront kernel:
+//  Alternative OptiX API to the callables, for renderers that sort their
+//  rays by material and launch one kernel per group instead of calling the
+//  group from a megakernel.
+//
+//  It takes arrays of what the fused callable takes for a single point:
+//  one ShaderGlobals per point and (unless the groupdata fits in
+//  max_optix_groupdata_alloc) one groupdata per point, plus the number of
+//  points. Thread i shades point i with shadeindex i, so outputs and
+//  userdata placed with symlocs are read and written as arrays (SoA) at
+//  output_base_ptr and userdata_base_ptr.
+//
+//      __global__ void kernel(ShaderGlobals* sg, void* groupdata,
+//                             void* userdata_base_ptr, void* output_base_ptr,
+//                             int npoints, void* interactive_params);
+//
+llvm::Function*
+BackendLLVM::build_llvm_wavefront_kernel()
+{
+    std::string kernel_name = wavefront_function_name(group());
+
+    llvm::Function* kernel = ll.make_function(
+        kernel_name, false,
+        ll.type_void(),  // return type
+        {
+            llvm_type_sg_ptr(), llvm_type_groupdata_ptr(),
+            ll.type_void_ptr(),  // userdata_base_ptr
+            ll.type_void_ptr(),  // output_base_ptr
+            ll.type_int(),       // number of points
+            ll.type_void_ptr(),  // interactive params
+        });
+    ll.current_function(kernel);
+    ll.make_cuda_kernel(kernel);
+
+    llvm::BasicBlock* entry_bb = ll.new_basic_block(kernel_name);
+    llvm::BasicBlock* shade_bb = ll.new_basic_block("shade");
+    llvm::BasicBlock* done_bb  = ll.new_basic_block("done");
+    ll.new_builder(entry_bb);
+
+    // Threads past the last point have nothing to do
+    llvm::Value* index = ll.cuda_thread_index();
+    ll.op_branch(ll.op_lt(index, ll.current_function_arg(4)), shade_bb,
+                 done_bb);
+
+    ll.set_insert_point(shade_bb);
+    llvm::Value* sg = ll.GEP(llvm_type_sg(), ll.current_function_arg(0),
+                             index);
+    llvm::Value* groupdata;
+    if ((int)group().llvm_groupdata_size()
+        <= shadingsys().m_max_optix_groupdata_alloc)
+        groupdata = ll.op_alloca(m_llvm_type_groupdata, 1, "groupdata_buffer",
+                                 8);
+    else
+        groupdata = ll.GEP(m_llvm_type_groupdata, ll.current_function_arg(1),
+                           index);
+
+    llvm::Value* args[] = {
+        sg,    groupdata, ll.current_function_arg(2), ll.current_function_arg(3),
+        index, ll.current_function_arg(5),
+    };
+
+    // Call init
+    std::string init_name = init_function_name(shadingsys(), group());
+    ll.call_function(init_name.c_str(), args);
+
+    int nlayers          = group().nlayers();
+    ShaderInstance* inst = group()[nlayers - 1];
+
+    // Call entry
+    std::string layer_name = layer_function_name(group(), *inst);
+    ll.call_function(layer_name.c_str(), args);
+    ll.op_branch(done_bb);
+
+    ll.set_insert_point(done_bb);
+    ll.op_return();
+    ll.end_builder();
+
+    return kernel;
+}
+
 llvm::Function*
 BackendLLVM::build_llvm_instance(bool groupentry)
 {
@@ -1660,10 +2115,10 @@ BackendLLVM::build_llvm_instance(bool groupentry)
             && (s.is_constant() || s.typespec().is_closure_based()
                 || s.typespec().is_string_based()
                 || ((s.symtype() == SymTypeLocal || s.symtype() == SymTypeTemp)
-                    && shadingsys().debug_uninit())))
+                    && debug_uninit())))
             llvm_assign_initial_value(s);
         // If debugnan is turned on, globals check that their values are ok
-        if (s.symtype() == SymTypeGlobal && shadingsys().debug_nan()) {
+        if (s.symtype() == SymTypeGlobal && debug_nan()) {
             TypeDesc t = s.typespec().simpletype();
             if (t.basetype
                 == TypeDesc::FLOAT) {  // just check float-based types
@@ -1702,6 +2157,9 @@ BackendLLVM::build_llvm_instance(bool groupentry)
             && (s.interactive()
                 || (s.interpolated() && shadingsys().lazy_userdata())))
             continue;
+        // Read-only params are already in place as constants
+        if (is_readonly_param(s))
+            continue;
         // Set initial value for params (may contain init ops)
         llvm_assign_initial_value(s);
     }
@@ -1723,6 +2181,7 @@ BackendLLVM::build_llvm_instance(bool groupentry)
     // records for each.
     find_basic_blocks();
     find_conditionals();
+    find_loop_counters();
     m_call_layers_inserted.clear();
 
     build_llvm_code(inst()->maincodebegin(), inst()->maincodeend());
@@ -1871,6 +2330,76 @@ BackendLLVM::build_llvm_instance(bool groupentry)
 
 
 
+int
+BackendLLVM::layer_cost_estimate()
+{
+    int cost = 0;
+    for (const Opcode& op : inst()->ops()) {
+        ustring opname = op.opname();
+        if (opname == op_nop || opname == op_end || opname == op_useparam)
+            continue;
+        const OpDescriptor* opd = shadingsys().op_descriptor(opname);
+        int opcost              = 1;
+        if ((opd && (opd->flags & OpDescriptor::Tex)) || opname == op_spline
+            || opname == op_splineinverse || opname == Strings::noise
+            || opname == Strings::snoise || opname == Strings::pnoise
+            || opname == Strings::psnoise || opname == Strings::cellnoise
+            || opname == Strings::hashnoise)
+            opcost = 25;
+        if (op.nargs() && opargsym(op, 0)->has_derivs())
+            opcost *= 3;
+        cost += opcost;
+    }
+    return cost;
+}
+
+
+
+void
+BackendLLVM::set_layer_inlining(const std::vector<llvm::Function*>& funcs)
+{
+    int inline_cost   = shadingsys().llvm_layer_inline();
+    int noinline_cost = shadingsys().llvm_layer_noinline();
+    m_layer_inlining.assign(funcs.size(), 0);
+    for (size_t layer = 0; layer < funcs.size(); ++layer) {
+        // Entry layers are called from outside, so what matters is only
+        // whether their copies inside other layers are inlined.
+        llvm::Function* f = funcs[layer];
+        if (!f || group()[layer]->entry_layer() || !m_layer_call_sites[layer])
+            continue;
+        if (inline_cost > 0 && m_layer_cost[layer] <= inline_cost) {
+            f->addFnAttr(llvm::Attribute::AlwaysInline);
+            m_layer_inlining[layer] = 'i';
+        } else if (noinline_cost > 0 && m_layer_cost[layer] >= noinline_cost
+                   && m_layer_call_sites[layer] > 1) {
+            f->addFnAttr(llvm::Attribute::NoInline);
+            m_layer_inlining[layer] = 'c';
+        }
+    }
+}
+
+
+
+void
+BackendLLVM::split_heavy_layers(const std::vector<llvm::Function*>& funcs)
+{
+    // Of the layers that are called from others (and so would be inlined
+    // there), keep the most expensive m_optix_split_layers out of line.
+    std::vector<int> called;
+    for (int layer = 0; layer < (int)funcs.size(); ++layer)
+        if (funcs[layer] && m_layer_call_sites[layer])
+            called.push_back(layer);
+    std::sort(called.begin(), called.end(), [&](int a, int b) {
+        return m_layer_cost[a] > m_layer_cost[b];
+    });
+    if ((int)called.size() > m_optix_split_layers)
+        called.resize(m_optix_split_layers);
+    for (int layer : called)
+        funcs[layer]->addFnAttr("osl-split-layer");
+}
+
+
+
 void
 BackendLLVM::initialize_llvm_group()
 {
@@ -1883,7 +2412,7 @@ BackendLLVM::initialize_llvm_group()
 
     // Set up optimization passes. Don't target the host if we're building
     // for OptiX.
-    ll.setup_optimization_passes(shadingsys().llvm_optimize(),
+    ll.setup_optimization_passes(llvm_optimize(),
                                  shadingsys().llvm_target_host()
                                      && !use_optix());
 
@@ -2008,6 +2537,12 @@ BackendLLVM::prepare_module_for_cuda_jit()
             continue;
 #endif
 
+        // Layers split off to relieve register pressure stay out of line
+        if (fn.hasFnAttribute("osl-split-layer")) {
+            fn.addFnAttr(llvm::Attribute::NoInline);
+            continue;
+        }
+
         // Merge layer functions which are only called from one place
         if (merge_layer_funcs && !fn.hasFnAttribute("osl-lib-function")
             && fn.hasOneUse()) {
@@ -2083,8 +2618,11 @@ void
 BackendLLVM::run()
 {
     if (group().does_nothing()) {
-        group().llvm_compiled_init((RunLLVMGroupFunc)empty_group_func);
-        group().llvm_compiled_version((RunLLVMGroupFunc)empty_group_func);
+        auto code = std::make_shared<ShaderGroup::CompiledCode>(
+            group().nlayers());
+        code->init    = (RunLLVMGroupFunc)empty_group_func;
+        code->version = (RunLLVMGroupFunc)empty_group_func;
+        group().llvm_compiled(std::move(code));
         return;
     }
 
@@ -2277,6 +2815,9 @@ BackendLLVM::run()
         // Create the ExecutionEngine. We don't create an ExecutionEngine in the
         // OptiX case, because we are using the NVPTX backend and not MCJIT. However,
         // it's still useful to set the target ISA to facilitate PTX-specific codegen.
+        if (shadingsys().jit_group_memory(group()))
+            group().add_jit_memory(ll.private_jit_memory());
+
         if (use_optix()) {
             ll.set_target_isa(TargetISA::NVPTX);
         } else if (!ll.make_jit_execengine(
@@ -2316,7 +2857,8 @@ BackendLLVM::run()
             m_layer_remap[layer] = m_num_used_layers++;
         }
     }
-    shadingsys().m_stat_empty_instances += nlayers - m_num_used_layers;
+    if (!m_recompiling)
+        shadingsys().m_stat_empty_instances += nlayers - m_num_used_layers;
 
     initialize_llvm_group();
 
@@ -2324,17 +2866,30 @@ BackendLLVM::run()
     m_llvm_local_mem          = 0;
     llvm::Function* init_func = build_llvm_init();
     std::vector<llvm::Function*> funcs(nlayers, NULL);
+    m_layer_irgen_time.assign(nlayers, 0.0);
+    m_layer_cost.assign(nlayers, 0);
+    m_layer_call_sites.assign(nlayers, 0);
     for (int layer = 0; layer < nlayers; ++layer) {
         set_inst(layer);
         if (m_layer_remap[layer] != -1) {
+            OIIO::Timer layer_timer;
             // If no entry points were specified, the last layer is special,
             // it's the single entry point for the whole group.
-            bool is_single_entry = (layer == (nlayers - 1)
+            bool is_single_entry      = (layer == (nlayers - 1)
                                     && group().num_entry_layers() == 0);
-            funcs[layer]         = build_llvm_instance(is_single_entry);
+            funcs[layer]              = build_llvm_instance(is_single_entry);
+            m_layer_irgen_time[layer] = layer_timer();
+            m_layer_cost[layer]       = layer_cost_estimate();
         }
     }
 
+    // OptiX makes its own inlining choices in prepare_module_for_cuda_jit,
+    // apart from the layers we were asked to keep out of line.
+    if (!use_optix())
+        set_layer_inlining(funcs);
+    else if (m_optix_split_layers > 0)
+        split_heavy_layers(funcs);
+
     std::vector<llvm::Function*> optix_externals;
     if (use_optix())
         optix_externals = build_llvm_optix_callables();
@@ -2349,6 +2904,49 @@ BackendLLVM::run()
             group().name(), m_llvm_local_mem / 1024);
     }
 
+    // Profile-guided optimization: either make the layers count which way
+    // their branches go, or tell the optimizer what an identical group
+    // counted before. Profiles are found by the group's canonical hash plus
+    // the counter count, which guards against differing IR.
+    bool pgo_counting = false;
+    if (shadingsys().llvm_pgo() && !use_optix() && group().canonical_hash()) {
+        std::vector<llvm::Function*> pgo_funcs(funcs);
+        pgo_funcs.push_back(init_func);
+        size_t ncounters = ll.branch_profile_size(pgo_funcs);
+        if (shadingsys().llvm_pgo() == 1) {
+            auto profile = shadingsys().branch_profile(group().canonical_hash(),
+                                                       ncounters, true);
+            ll.instrument_branch_profile(pgo_funcs, profile->data());
+            pgo_counting = true;
+            if (!m_recompiling)
+                shadingsys().m_stat_pgo_instrumented += 1;
+        } else {
+            auto profile = shadingsys().branch_profile(group().canonical_hash(),
+                                                       ncounters, false);
+            if (profile && ll.apply_branch_profile(pgo_funcs, *profile)
+                && !m_recompiling)
+                shadingsys().m_stat_pgo_applied += 1;
+        }
+    }
+
+#ifndef OSL_LLVM_NO_BITCODE
+    // Call the larger library functions in the copy of the shadeops that
+    // is JITed once for everybody, rather than compiling them yet again.
+    if (shadingsys().llvm_shared_ops() > 0 && !use_optix()
+        && !use_rs_bitcode()) {
+        std::string shared_err;
+        int nlinked = ll.link_shared_library(
+            (const char*)osl_llvm_compiled_ops_block,
+            osl_llvm_compiled_ops_size, "llvm_ops",
+            shadingsys().llvm_shared_ops(), &shared_err);
+        if (shared_err.length())
+            shadingcontext()->errorfmt("Could not build shared llvm_ops: {}",
+                                       shared_err);
+        if (!m_recompiling)
+            shadingsys().m_stat_shared_ops_linked += nlinked;
+    }
+#endif
+
     // The module contains tons of "library" functions that our generated IR
     // might call. But probably not. We don't want to incur the overhead of
     // fully compiling those, so we want to get rid of all functions not
@@ -2430,11 +3028,53 @@ BackendLLVM::run()
     }
 #endif
 
+    // If there is a JIT object cache, look for machine code that an earlier
+    // run produced from this exact pre-optimization IR, in which case we
+    // can skip both LLVM optimization and codegen. Keying on the full
+    // module text (rather than the OSL IR) also captures any host pointers
+    // that were baked into the IR as constants, so a cached object is
+    // never reused where those differ. Code counting branches for PGO is
+    // left out all the same: its counters live in this shading system, and
+    // another process could easily have something else at that address.
+    bool use_jit_cache = !use_optix() && !pgo_counting
+                         && (shadingsys().llvm_jit_cache_dir().size()
+                             || shadingsys().registry());
+    bool jit_cache_hit = false;
+    if (use_jit_cache) {
+        std::string key = fmtformat("{}|{}|{}|{}|{}|{}|{}\n{}",
+                                    OSL_LIBRARY_VERSION_STRING,
+                                    shadingsys().llvm_jit_target(),
+                                    llvm_optimize(),
+                                    shadingsys().llvm_jit_fma(),
+                                    shadingsys().m_llvm_jit_aggressive,
+                                    shadingsys().llvm_debugging_symbols(),
+                                    shadingsys().llvm_profiling_events(),
+                                    ll.module_string());
+        jit_cache_hit = ll.jit_object_cache(shadingsys().llvm_jit_cache_dir(),
+                                            key, shadingsys().registry().get());
+    }
+
     // Optimize the LLVM IR unless it's a do-nothing group.
-    if (!group().does_nothing()) {
+    if (!group().does_nothing() && !jit_cache_hit) {
         ll.do_optimize();
     }
 
+    // A build node may also generate the code for the farm's other ISAs,
+    // so that hosts of every kind find it in the cache.
+    if (use_jit_cache && !jit_cache_hit
+        && shadingsys().llvm_jit_isas().size()) {
+        std::vector<TargetISA> isas;
+        for (auto name : Strutil::splitsv(shadingsys().llvm_jit_isas(), ","))
+            isas.push_back(LLVM_Util::lookup_isa_by_name(Strutil::strip(name)));
+        std::string err;
+        shadingsys().m_stat_jit_cache_variants
+            += ll.jit_object_cache_populate(isas, &err);
+        if (err.size())
+            shadingcontext()->warningfmt(
+                "Could not cache group {} for all ISAs: {}", group().name(),
+                err);
+    }
+
 #if OSL_USE_OPTIX
     if (use_optix()) {
         // Drop everything but the init and group entry functions and generated
@@ -2480,7 +3120,7 @@ BackendLLVM::run()
                                   safegroup.substr(safegroup.size() - 235),
                                   group().id());
         std::string name = fmtformat("{}_O{}.ll", safegroup,
-                                     shadingsys().llvm_optimize());
+                                     llvm_optimize());
         OIIO::ofstream out;
         OIIO::Filesystem::open(out, name);
         if (out) {
@@ -2493,29 +3133,90 @@ BackendLLVM::run()
 
 #if OSL_USE_OPTIX
     if (use_optix()) {
+        ll.nvptx_target_arch(shadingsys().optix_target_arch());
         ll.ptx_compile_group(nullptr, group().name().string(),
                              group().m_llvm_ptx_compiled_version);
         if (group().m_llvm_ptx_compiled_version.empty()) {
             OSL_ASSERT(0 && "Unable to generate PTX");
         }
+        ptx_resource_usage(group().m_llvm_ptx_compiled_version,
+                           group().m_ptx_registers, group().m_ptx_local_bytes);
+        group().m_device_strings.assign(m_device_strings.begin(),
+                                        m_device_strings.end());
     } else
 #endif
     {
+        // Optionally leave the entry layers out of the JIT, to be compiled
+        // the first time each is executed (the cached object would be
+        // incomplete, so not when using the JIT cache). Only layers that
+        // no other layer calls can be left out.
+        auto code = std::make_shared<ShaderGroup::CompiledCode>(nlayers);
+        std::vector<std::string> deferred_names(nlayers);
+        if (shadingsys().llvm_jit_lazy_entry() && group().num_entry_layers()
+            && !use_jit_cache) {
+            std::vector<std::string> names;
+            for (int layer = 0; layer < nlayers; ++layer) {
+                llvm::Function* f = funcs[layer];
+                if (f && group().is_entry_layer(layer) && f->use_empty()) {
+                    deferred_names[layer] = f->getName().str();
+                    names.push_back(deferred_names[layer]);
+                }
+            }
+            if (names.size())
+                code->deferred_code = ll.defer_functions(names);
+            if (code->deferred_code) {
+                code->deferred_names = deferred_names;
+                shadingsys().m_stat_lazy_layers_deferred += int(names.size());
+            } else {
+                std::fill(deferred_names.begin(), deferred_names.end(),
+                          std::string());
+            }
+        }
+
+        // Optionally split the optimized module and generate its machine
+        // code on several threads (the cached object would be incomplete,
+        // so not when using the JIT cache). If that isn't possible, the
+        // JIT below just compiles the module as usual.
+        if (shadingsys().llvm_jit_threads() > 1 && !use_jit_cache) {
+            // The partitions go through the same task executor as the
+            // parallel compile of many groups, so with a renderer's pool
+            // the codegen of this group shares the machine with the IR
+            // generation of others instead of oversubscribing it.
+            ShadingSystemImpl& ss = shadingsys();
+            std::string codegen_err;
+            if (ll.parallel_codegen(
+                    ss.llvm_jit_threads(), &codegen_err,
+                    [&](int ntasks, const std::function<void(int)>& task) {
+                        ss.run_tasks(ntasks, task);
+                    }))
+                ss.m_stat_parallel_codegens += 1;
+            else if (codegen_err.size())
+                shadingcontext()->warningfmt(
+                    "Parallel codegen of group {} failed ({}), JITing it serially",
+                    group().name(), codegen_err);
+        }
+
         // Force the JIT to happen now and retrieve the JITed function pointers
-        // for the initialization and all public entry points.
-        group().llvm_compiled_init(
-            (RunLLVMGroupFunc)ll.getPointerToFunction(init_func));
+        // for the initialization and all public entry points. They are
+        // published together, only once all of them are ready.
+        code->init = (RunLLVMGroupFunc)ll.getPointerToFunction(init_func);
         for (int layer = 0; layer < nlayers; ++layer) {
             llvm::Function* f = funcs[layer];
-            if (f && group().is_entry_layer(layer))
-                group().llvm_compiled_layer(
-                    layer, (RunLLVMGroupFunc)ll.getPointerToFunction(f));
+            if (f && group().is_entry_layer(layer)
+                && deferred_names[layer].empty())
+                code->layers[layer] = (RunLLVMGroupFunc)
+                    ll.getPointerToFunction(f);
+        }
+        if (!group().num_entry_layers())
+            code->version = code->layer(nlayers - 1);
+        code->groupdata_size = group().llvm_groupdata_size();
+        group().llvm_compiled(std::move(code));
+        if (use_jit_cache && !m_recompiling) {
+            if (ll.jit_object_cache_hit())
+                shadingsys().m_stat_jit_cache_hits += 1;
+            else
+                shadingsys().m_stat_jit_cache_misses += 1;
         }
-        if (group().num_entry_layers())
-            group().llvm_compiled_version(NULL);
-        else
-            group().llvm_compiled_version(
-                group().llvm_compiled_layer(nlayers - 1));
     }
 
     if (shadingsys().use_optix_cache()) {
@@ -2546,6 +3247,7 @@ BackendLLVM::run()
 
     // N.B. Destroying the EE should have destroyed the module as well.
     ll.module(NULL);
+    group().add_jit_bytes(ll.jit_bytes());
 
     m_stat_llvm_jit_time += timer.lap();
 
@@ -2558,6 +3260,17 @@ BackendLLVM::run()
             m_stat_total_llvm_time, m_stat_llvm_setup_time,
             m_stat_llvm_irgen_time, m_stat_llvm_opt_time, m_stat_llvm_jit_time,
             m_llvm_local_mem / 1024);
+        for (int layer = 0; layer < (int)m_layer_inlining.size(); ++layer) {
+            if (m_layer_remap[layer] == -1 || !m_layer_call_sites[layer])
+                continue;
+            char how = m_layer_inlining[layer];
+            shadingcontext()->infofmt(
+                "    layer {} {}: cost {}, {} call site{}, {}", layer,
+                group()[layer]->layername(), m_layer_cost[layer],
+                m_layer_call_sites[layer],
+                m_layer_call_sites[layer] == 1 ? "" : "s",
+                how == 'i' ? "inlined" : how == 'c' ? "called" : "llvm decides");
+        }
     }
 }
 
@@ -77,7 +77,9 @@ typedef long double max_align_t;
 #include <cstddef>
 #include <iostream>
 
+#include <OSL/approxmath.h>
 #include <OSL/dual.h>
+#include <OSL/dual_simd.h>
 #include <OSL/dual_vec.h>
 #include <OSL/oslconfig.h>
 #include <OSL/shaderglobals.h>
@@ -531,6 +533,37 @@ MAKE_UNARY_PERCOMPONENT_OP     (sqrt       , OIIO::safe_sqrt      , sqrt)
 MAKE_UNARY_PERCOMPONENT_OP     (inversesqrt, OIIO::safe_inversesqrt, inversesqrt)
 // clang-format on
 
+// The other tiers of the "math_precision" option for the ops it covers.
+// The build's default tier is the plain-named ops above; the JIT calls
+// these, named with the tier as a prefix, for the other tiers (see
+// OSOProcessorBase::math_opname).
+// clang-format off
+#if OSL_FAST_MATH
+MAKE_UNARY_PERCOMPONENT_OP     (precise_sin  , sinf                 , sin)
+MAKE_UNARY_PERCOMPONENT_OP     (precise_cos  , cosf                 , cos)
+MAKE_BINARY_PERCOMPONENT_OP    (precise_atan2, atan2f               , atan2)
+MAKE_UNARY_PERCOMPONENT_OP     (precise_exp  , expf                 , exp)
+MAKE_UNARY_PERCOMPONENT_OP     (precise_log  , OIIO::safe_log       , safe_log)
+MAKE_BINARY_PERCOMPONENT_OP    (precise_pow  , OIIO::safe_pow       , safe_pow)
+MAKE_BINARY_PERCOMPONENT_VF_OP (precise_pow  , OIIO::safe_pow       , safe_pow)
+#else
+MAKE_UNARY_PERCOMPONENT_OP     (fast_sin     , OIIO::fast_sin       , fast_sin)
+MAKE_UNARY_PERCOMPONENT_OP     (fast_cos     , OIIO::fast_cos       , fast_cos)
+MAKE_BINARY_PERCOMPONENT_OP    (fast_atan2   , OIIO::fast_atan2     , fast_atan2)
+MAKE_UNARY_PERCOMPONENT_OP     (fast_exp     , OIIO::fast_exp       , fast_exp)
+MAKE_UNARY_PERCOMPONENT_OP     (fast_log     , OIIO::fast_log       , fast_log)
+MAKE_BINARY_PERCOMPONENT_OP    (fast_pow     , OIIO::fast_safe_pow  , fast_safe_pow)
+MAKE_BINARY_PERCOMPONENT_VF_OP (fast_pow     , OIIO::fast_safe_pow  , fast_safe_pow)
+#endif
+MAKE_UNARY_PERCOMPONENT_OP     (approx_sin   , approx_sin           , approx_sin)
+MAKE_UNARY_PERCOMPONENT_OP     (approx_cos   , approx_cos           , approx_cos)
+MAKE_BINARY_PERCOMPONENT_OP    (approx_atan2 , approx_atan2         , approx_atan2)
+MAKE_UNARY_PERCOMPONENT_OP     (approx_exp   , approx_exp           , approx_exp)
+MAKE_UNARY_PERCOMPONENT_OP     (approx_log   , approx_log           , approx_log)
+MAKE_BINARY_PERCOMPONENT_OP    (approx_pow   , approx_safe_pow      , approx_safe_pow)
+MAKE_BINARY_PERCOMPONENT_VF_OP (approx_pow   , approx_safe_pow      , approx_safe_pow)
+// clang-format on
+
 
 OSL_SHADEOP float
 osl_logb_ff(float x)
@@ -711,6 +744,19 @@ osl_safe_div_iii(int a, int b)
     return (b != 0) ? (a / b) : 0;
 }
 
+// The derivative form of smoothstep is all dual arithmetic, which does the
+// value and both partials at once when packed into a Dual2f4.
+static OSL_FORCEINLINE Dual2<float>
+dual_smoothstep(const Dual2<float>& e0, const Dual2<float>& e1,
+                const Dual2<float>& x)
+{
+#if OSL_DUAL2_PACKED
+    return smoothstep(Dual2f4(e0), Dual2f4(e1), Dual2f4(x)).dual2();
+#else
+    return smoothstep(e0, e1, x);
+#endif
+}
+
 OSL_SHADEOP float
 osl_smoothstep_ffff(float e0, float e1, float x)
 {
@@ -724,7 +770,7 @@ osl_smoothstep_dfffdf(void* result, float e0_, float e1_, void* x_)
     Dual2<float> e1(e1_);
     Dual2<float> x = DFLOAT(x_);
 
-    DFLOAT(result) = smoothstep(e0, e1, x);
+    DFLOAT(result) = dual_smoothstep(e0, e1, x);
 }
 
 OSL_SHADEOP void
@@ -734,7 +780,7 @@ osl_smoothstep_dffdff(void* result, float e0_, void* e1_, float x_)
     Dual2<float> e1 = DFLOAT(e1_);
     Dual2<float> x(x_);
 
-    DFLOAT(result) = smoothstep(e0, e1, x);
+    DFLOAT(result) = dual_smoothstep(e0, e1, x);
 }
 
 OSL_SHADEOP void
@@ -744,7 +790,7 @@ osl_smoothstep_dffdfdf(void* result, float e0_, void* e1_, void* x_)
     Dual2<float> e1 = DFLOAT(e1_);
     Dual2<float> x  = DFLOAT(x_);
 
-    DFLOAT(result) = smoothstep(e0, e1, x);
+    DFLOAT(result) = dual_smoothstep(e0, e1, x);
 }
 
 OSL_SHADEOP void
@@ -754,7 +800,7 @@ osl_smoothstep_dfdfff(void* result, void* e0_, float e1_, float x_)
     Dual2<float> e1(e1_);
     Dual2<float> x(x_);
 
-    DFLOAT(result) = smoothstep(e0, e1, x);
+    DFLOAT(result) = dual_smoothstep(e0, e1, x);
 }
 
 OSL_SHADEOP void
@@ -764,7 +810,7 @@ osl_smoothstep_dfdffdf(void* result, void* e0_, float e1_, void* x_)
     Dual2<float> e1(e1_);
     Dual2<float> x = DFLOAT(x_);
 
-    DFLOAT(result) = smoothstep(e0, e1, x);
+    DFLOAT(result) = dual_smoothstep(e0, e1, x);
 }
 
 OSL_SHADEOP void
@@ -774,7 +820,7 @@ osl_smoothstep_dfdfdff(void* result, void* e0_, void* e1_, float x_)
     Dual2<float> e1 = DFLOAT(e1_);
     Dual2<float> x(x_);
 
-    DFLOAT(result) = smoothstep(e0, e1, x);
+    DFLOAT(result) = dual_smoothstep(e0, e1, x);
 }
 
 OSL_SHADEOP void
@@ -784,7 +830,7 @@ osl_smoothstep_dfdfdfdf(void* result, void* e0_, void* e1_, void* x_)
     Dual2<float> e1 = DFLOAT(e1_);
     Dual2<float> x  = DFLOAT(x_);
 
-    DFLOAT(result) = smoothstep(e0, e1, x);
+    DFLOAT(result) = dual_smoothstep(e0, e1, x);
 }
 
 // Vector ops
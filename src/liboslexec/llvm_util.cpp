@@ -3,14 +3,24 @@
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
 
+#include <atomic>
 #include <cinttypes>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <thread>
+
+#ifdef __linux__
+#    include <sys/mman.h>
+#endif
 
 #include <OpenImageIO/fmath.h>
+#include <OpenImageIO/strutil.h>
 #include <OpenImageIO/thread.h>
 
 #include <OSL/llvm_util.h>
 #include <OSL/oslconfig.h>
+#include <OSL/oslexec.h>
 #include <OSL/wide.h>
 
 #if OSL_LLVM_VERSION < 140
@@ -24,6 +34,7 @@ OSL_GCC_PRAGMA(GCC diagnostic ignored "-Wmaybe-uninitialized")
 
 #include "llvm_passes.h"
 
+#include <llvm/Config/llvm-config.h>
 #include <llvm/InitializePasses.h>
 #include <llvm/Pass.h>
 
@@ -37,13 +48,16 @@ OSL_GCC_PRAGMA(GCC diagnostic ignored "-Wmaybe-uninitialized")
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/IntrinsicsNVPTX.h>
 #include <llvm/IR/IntrinsicsX86.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/MDBuilder.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/ValueSymbolTable.h>
 #include <llvm/Linker/Linker.h>
 #include <llvm/Support/CommandLine.h>
+#include <llvm/ADT/StringExtras.h>
 #include <llvm/Support/ErrorOr.h>
 #include <llvm/Support/FileSystem.h>
 #if OSL_LLVM_VERSION < 160
@@ -52,6 +66,8 @@ OSL_GCC_PRAGMA(GCC diagnostic ignored "-Wmaybe-uninitialized")
 #    include <llvm/TargetParser/Host.h>
 #endif
 #include <llvm/MC/TargetRegistry.h>
+#include <llvm/Object/ObjectFile.h>
+#include <llvm/Object/SymbolSize.h>
 #include <llvm/Support/raw_os_ostream.h>
 
 #include <llvm/Analysis/BasicAliasAnalysis.h>
@@ -62,12 +78,15 @@ OSL_GCC_PRAGMA(GCC diagnostic ignored "-Wmaybe-uninitialized")
 #include <llvm/ExecutionEngine/GenericValue.h>
 #include <llvm/ExecutionEngine/JITEventListener.h>
 #include <llvm/ExecutionEngine/MCJIT.h>
+#include <llvm/ExecutionEngine/ObjectCache.h>
 #include <llvm/ExecutionEngine/SectionMemoryManager.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/Verifier.h>
 #include <llvm/Support/ManagedStatic.h>
 #include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/PrettyStackTrace.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/SHA1.h>
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Target/TargetMachine.h>
@@ -120,6 +139,7 @@ OSL_GCC_PRAGMA(GCC diagnostic ignored "-Wmaybe-uninitialized")
 #include <llvm/Analysis/TargetLibraryInfo.h>
 #include <llvm/Analysis/TargetTransformInfo.h>
 #include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/SplitModule.h>
 #include <llvm/Transforms/Utils/SymbolRewriter.h>
 
 OSL_PRAGMA_WARNING_POP
@@ -180,12 +200,211 @@ struct DefaultMMapper final : public llvm::SectionMemoryManager::MemoryMapper {
 };
 static DefaultMMapper llvm_default_mapper;
 
+// Whether to carve code and read-only data out of SlabMapper's slabs, see
+// LLVM_Util::jit_huge_pages().
+static std::atomic<bool> jit_use_huge_pages(false);
+
+// Maps the JIT's code and read-only data into 2MB slabs, one being filled
+// for each, which Linux may back with huge pages, rather than mapping each
+// block separately: the code of many groups, placed one after the other in
+// the order they are JITed, then takes far fewer iTLB entries. Everything
+// else (and everything, unless jit_use_huge_pages is set) goes straight to
+// llvm_default_mapper. A slab is unmapped once all of its blocks have been
+// released. Like llvm_default_mapper, this must outlive jitmm_hold.
+class SlabMapper final : public llvm::SectionMemoryManager::MemoryMapper {
+public:
+    using AllocationPurpose = llvm::SectionMemoryManager::AllocationPurpose;
+    static constexpr size_t SlabSize = size_t(2) << 20;
+
+    llvm::sys::MemoryBlock
+    allocateMappedMemory(AllocationPurpose Purpose, size_t NumBytes,
+                         const llvm::sys::MemoryBlock* const NearBlock,
+                         unsigned Flags, std::error_code& EC) override
+    {
+        size_t pagesize = llvm::sys::Process::getPageSizeEstimate();
+        size_t bytes    = (NumBytes + pagesize - 1) / pagesize * pagesize;
+        // Large blocks gain little from sharing a slab.
+        if (!jit_use_huge_pages || Purpose == AllocationPurpose::RWData
+            || bytes > SlabSize / 4)
+            return llvm_default_mapper.allocateMappedMemory(Purpose, NumBytes,
+                                                            NearBlock, Flags,
+                                                            EC);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Slab*& current = m_current[Purpose == AllocationPurpose::Code ? 0 : 1];
+        if (!current || current->used + bytes > SlabSize) {
+            Slab* slab = new_slab();
+            if (!slab)  // Fall back to mapping it on its own
+                return llvm_default_mapper.allocateMappedMemory(Purpose,
+                                                                NumBytes,
+                                                                NearBlock,
+                                                                Flags, EC);
+            if (current && !current->live)
+                release_slab(current);
+            current = slab;
+        }
+        uint8_t* ptr = current->base + current->used;
+        current->used += bytes;
+        current->live += bytes;
+        m_used += bytes;
+        EC = std::error_code();
+        // Slabs are mapped read/write, which is all the memory manager
+        // asks for until it finalizes the block's permissions.
+        return llvm::sys::MemoryBlock(ptr, bytes);
+    }
+
+    std::error_code protectMappedMemory(const llvm::sys::MemoryBlock& Block,
+                                        unsigned Flags) override
+    {
+        return llvm::sys::Memory::protectMappedMemory(Block, Flags);
+    }
+
+    std::error_code releaseMappedMemory(llvm::sys::MemoryBlock& M) override
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        // The slab, if any, starting at or before M
+        auto s = m_slabs.upper_bound(static_cast<uint8_t*>(M.base()));
+        if (s == m_slabs.begin()) {
+            lock.unlock();
+            return llvm_default_mapper.releaseMappedMemory(M);
+        }
+        Slab& slab(std::prev(s)->second);
+        if (static_cast<uint8_t*>(M.base()) >= slab.base + SlabSize) {
+            lock.unlock();
+            return llvm_default_mapper.releaseMappedMemory(M);
+        }
+        slab.live -= M.allocatedSize();
+        m_used -= M.allocatedSize();
+        M = llvm::sys::MemoryBlock();
+        if (!slab.live && &slab != m_current[0] && &slab != m_current[1])
+            release_slab(&slab);
+        return std::error_code();
+    }
+
+    // Bytes of slabs mapped, and how many of them are in use.
+    void stats(size_t& reserved, size_t& used)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        reserved = m_slabs.size() * SlabSize;
+        used     = m_used;
+    }
+
+private:
+    struct Slab {
+        uint8_t* base;
+        size_t used;  // bytes handed out, from base on
+        size_t live;  // of which not yet released
+    };
+
+    // Map a new slab, on a 2MB boundary so that it can be a huge page.
+    Slab* new_slab()
+    {
+        uint8_t* base = nullptr;
+#ifdef __linux__
+        void* p = mmap(nullptr, 2 * SlabSize, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            return nullptr;
+        uintptr_t start   = reinterpret_cast<uintptr_t>(p);
+        uintptr_t aligned = (start + SlabSize - 1) & ~(SlabSize - 1);
+        if (aligned > start)
+            munmap(p, aligned - start);
+        if (aligned + SlabSize < start + 2 * SlabSize)
+            munmap(reinterpret_cast<void*>(aligned + SlabSize),
+                   start + SlabSize - aligned);
+        base = reinterpret_cast<uint8_t*>(aligned);
+#    ifdef MADV_HUGEPAGE
+        madvise(base, SlabSize, MADV_HUGEPAGE);
+#    endif
+#else
+        // Still packs the blocks together, but without huge pages.
+        std::error_code ec;
+        llvm::sys::MemoryBlock block = llvm::sys::Memory::allocateMappedMemory(
+            SlabSize, nullptr,
+            llvm::sys::Memory::MF_READ | llvm::sys::Memory::MF_WRITE, ec);
+        if (ec)
+            return nullptr;
+        base = static_cast<uint8_t*>(block.base());
+#endif
+        return &(m_slabs[base] = Slab { base, 0, 0 });
+    }
+
+    void release_slab(Slab* slab)
+    {
+        uint8_t* base = slab->base;
+#ifdef __linux__
+        munmap(base, SlabSize);
+#else
+        llvm::sys::MemoryBlock block(base, SlabSize);
+        llvm::sys::Memory::releaseMappedMemory(block);
+#endif
+        m_slabs.erase(base);
+    }
+
+    std::mutex m_mutex;
+    std::map<uint8_t*, Slab> m_slabs;  // by base address
+    Slab* m_current[2] = { nullptr, nullptr };  // code, read-only data
+    size_t m_used      = 0;
+};
+static SlabMapper llvm_slab_mapper;
+
+// Bytes allocated by all the JIT memory managers that are still alive.
+static std::atomic<size_t> jit_memory_held(0);
+
+// The memory manager for all the code we JIT: counts what is allocated
+// from it in jit_memory_held, and takes that off again when it's destroyed
+// (freeing the memory itself).
+class CountedMemoryManager final : public LLVMMemoryManager {
+public:
+    CountedMemoryManager()
+        : LLVMMemoryManager(&llvm_slab_mapper)
+    {
+    }
+    ~CountedMemoryManager() override { jit_memory_held -= m_bytes; }
+
+    uint8_t* allocateCodeSection(uintptr_t Size, unsigned Alignment,
+                                 unsigned SectionID,
+                                 llvm::StringRef SectionName) override
+    {
+        m_bytes += Size;
+        jit_memory_held += Size;
+        return LLVMMemoryManager::allocateCodeSection(Size, Alignment,
+                                                      SectionID, SectionName);
+    }
+    uint8_t* allocateDataSection(uintptr_t Size, unsigned Alignment,
+                                 unsigned SectionID,
+                                 llvm::StringRef SectionName,
+                                 bool IsReadOnly) override
+    {
+        m_bytes += Size;
+        jit_memory_held += Size;
+        return LLVMMemoryManager::allocateDataSection(Size, Alignment,
+                                                      SectionID, SectionName,
+                                                      IsReadOnly);
+    }
+
+private:
+    size_t m_bytes = 0;
+};
+
 static OIIO::spin_mutex llvm_global_mutex;
 static bool setup_done = false;
 static std::unique_ptr<std::vector<std::shared_ptr<LLVMMemoryManager>>>
     jitmm_hold;
 static int jit_mem_hold_users = 0;
 
+// The larger functions of a library module, JITed once into their own
+// ExecutionEngine so that every group can call them instead of compiling
+// private copies. Keyed by library name and target machine, and released
+// along with the rest of the JIT memory.
+struct SharedLibrary {
+    std::unique_ptr<llvm::LLVMContext> context;  // N.B. must outlive exec
+    std::unique_ptr<llvm::ExecutionEngine> exec;
+    std::unordered_map<std::string, uint64_t> functions;
+    std::string error;
+};
+static std::mutex shared_library_mutex;
+static std::map<std::string, std::shared_ptr<SharedLibrary>> shared_libraries;
+
 
 llvm::raw_os_ostream raw_cout(std::cout);
 
@@ -208,11 +427,19 @@ LLVM_Util::ScopedJitMemoryUser::ScopedJitMemoryUser()
 
 LLVM_Util::ScopedJitMemoryUser::~ScopedJitMemoryUser()
 {
-    OIIO::spin_lock lock(llvm_global_mutex);
-    OSL_ASSERT(jit_mem_hold_users > 0);
-    --jit_mem_hold_users;
-    if (jit_mem_hold_users == 0) {
-        jitmm_hold.reset();
+    bool last_user = false;
+    {
+        OIIO::spin_lock lock(llvm_global_mutex);
+        OSL_ASSERT(jit_mem_hold_users > 0);
+        --jit_mem_hold_users;
+        if (jit_mem_hold_users == 0) {
+            jitmm_hold.reset();
+            last_user = true;
+        }
+    }
+    if (last_user) {
+        std::lock_guard<std::mutex> lock(shared_library_mutex);
+        shared_libraries.clear();
     }
 }
 
@@ -257,11 +484,23 @@ LLVM_Util::PerThreadInfo::get() const
 size_t
 LLVM_Util::total_jit_memory_held()
 {
-    // FIXME: This can't possibly be correct. It will always return 0,
-    // since jitmem is a local variable.
-    size_t jitmem = 0;
-    OIIO::spin_lock lock(llvm_global_mutex);
-    return jitmem;
+    return jit_memory_held;
+}
+
+
+
+void
+LLVM_Util::jit_huge_pages(bool on)
+{
+    jit_use_huge_pages = on;
+}
+
+
+
+void
+LLVM_Util::jit_slab_memory(size_t& reserved, size_t& used)
+{
+    llvm_slab_mapper.stats(reserved, used);
 }
 
 
@@ -272,8 +511,13 @@ LLVM_Util::total_jit_memory_held()
 class LLVM_Util::MemoryManager final : public LLVMMemoryManager {
 protected:
     LLVMMemoryManager* mm;  // the real one
+    size_t* bytes;          // where to count the bytes allocated
 public:
-    MemoryManager(LLVMMemoryManager* realmm) : mm(realmm) {}
+    MemoryManager(LLVMMemoryManager* realmm, size_t* bytes)
+        : mm(realmm)
+        , bytes(bytes)
+    {
+    }
 
     void notifyObjectLoaded(llvm::ExecutionEngine* EE,
                             const llvm::object::ObjectFile& oi) override
@@ -338,6 +582,7 @@ public:
                                  unsigned SectionID,
                                  llvm::StringRef SectionName) override
     {
+        *bytes += Size;
         return mm->allocateCodeSection(Size, Alignment, SectionID, SectionName);
     }
     uint8_t* allocateDataSection(uintptr_t Size, unsigned Alignment,
@@ -345,6 +590,7 @@ public:
                                  llvm::StringRef SectionName,
                                  bool IsReadOnly) override
     {
+        *bytes += Size;
         return mm->allocateDataSection(Size, Alignment, SectionID, SectionName,
                                        IsReadOnly);
     }
@@ -368,6 +614,219 @@ public:
 
 
 
+/// ObjectCache - Hold the relocatable object code that MCJIT produces for
+/// a module in a file whose name is derived from a caller-supplied key, and
+/// hand back the saved object instead of running codegen when a module
+/// with the same key is JITed again, possibly by a later process. The code
+/// for each ISA is a variant of its own, in a file named from the same
+/// stem, so that the hosts of a mixed farm can share the cache. The stem
+/// is only a short hash of the key, so each file (and each copy in a
+/// ShaderRegistry) starts with a header holding a digest of the whole key,
+/// and an object whose header doesn't match is never used.
+class LLVM_Util::ObjectCache final : public llvm::ObjectCache {
+public:
+    // Either of dir (the cache directory) and registry (shared in memory,
+    // where each object is stored under "jit:" and its file name) may be
+    // empty. Code compiled here is stored as the variant for isa.
+    ObjectCache(std::string dir, ShaderRegistry* registry, std::string stem,
+                std::string isa, string_view digest)
+        : m_dir(std::move(dir))
+        , m_registry(registry)
+        , m_stem(std::move(stem))
+        , m_isa(std::move(isa))
+        , m_header(fmtformat("OSL JIT object {}\n", digest))
+    {
+    }
+
+    std::string filename(string_view isa) const
+    {
+        return fmtformat("{}.{}.o", m_stem, isa);
+    }
+    std::string path(string_view isa) const
+    {
+        return m_dir.size() ? fmtformat("{}/{}", m_dir, filename(isa))
+                            : std::string();
+    }
+
+    // Choose the first of the ISA variants that the cache holds as the
+    // one to load, returning whether there was any.
+    bool choose(cspan<std::string> isas)
+    {
+        for (auto&& isa : isas) {
+            m_shared.reset();
+            if (m_registry) {
+                m_shared = m_registry->find("jit:" + filename(isa));
+                if (m_shared && !matches(*m_shared))
+                    m_shared.reset();
+            }
+            if (m_shared || (m_dir.size() && load(path(isa)))) {
+                m_read_isa = isa;
+                return true;
+            }
+        }
+        return false;
+    }
+    bool hit() const { return m_hit; }
+
+    // Store obj as the variant for isa.
+    void store(string_view isa, llvm::StringRef obj)
+    {
+        if (m_registry)
+            m_registry->add("jit:" + filename(isa),
+                            m_header + std::string(obj.data(), obj.size()));
+        std::string dst = path(isa);
+        if (dst.empty())
+            return;
+        // Write to a uniquely named temporary and rename it into place, so
+        // that other threads or processes sharing the cache directory
+        // never see a partially written object.
+        int fd = -1;
+        llvm::SmallString<256> tmppath;
+        if (llvm::sys::fs::createUniqueFile(dst + ".tmp-%%%%%%%%", fd, tmppath))
+            return;
+        {
+            llvm::raw_fd_ostream out(fd, true /* shouldClose */);
+            out << m_header << obj;
+            out.close();
+            if (out.has_error()) {
+                out.clear_error();
+                llvm::sys::fs::remove(tmppath);
+                return;
+            }
+        }
+        if (llvm::sys::fs::rename(tmppath, dst))
+            llvm::sys::fs::remove(tmppath);
+    }
+
+    void notifyObjectCompiled(const llvm::Module* /*M*/,
+                              llvm::MemoryBufferRef Obj) override
+    {
+        store(m_isa, Obj.getBuffer());
+    }
+
+    std::unique_ptr<llvm::MemoryBuffer>
+    getObject(const llvm::Module* /*M*/) override
+    {
+        if (m_read_isa.empty())
+            return nullptr;
+        if (m_shared) {
+            m_hit = true;
+            return llvm::MemoryBuffer::getMemBufferCopy(
+                llvm::StringRef(*m_shared).drop_front(m_header.size()),
+                filename(m_read_isa));
+        }
+        if (!m_file)
+            return nullptr;
+        llvm::StringRef file = m_file->getBuffer();
+        m_hit                = true;
+        if (m_registry)
+            m_registry->add("jit:" + filename(m_read_isa),
+                            string_view(file.data(), file.size()));
+        auto buf = llvm::MemoryBuffer::getMemBufferCopy(
+            file.drop_front(m_header.size()), filename(m_read_isa));
+        m_file.reset();
+        return buf;
+    }
+
+private:
+    // Does the cached object start with our header?
+    bool matches(llvm::StringRef cached) const
+    {
+        return cached.substr(0, m_header.size()) == m_header;
+    }
+
+    // Read the object file at path, keeping it if its header matches our
+    // key. The whole file is read here, rather than when MCJIT asks for
+    // it, so that a mismatch is found while the module can still be
+    // optimized and compiled instead.
+    bool load(const std::string& path)
+    {
+        auto buf = llvm::MemoryBuffer::getFile(path, false /* IsText */,
+                                               false /* NullTerminate */);
+        if (!buf || !matches((*buf)->getBuffer()))
+            return false;
+        m_file = std::move(*buf);
+        return true;
+    }
+
+    std::string m_dir;
+    ShaderRegistry* m_registry;
+    std::string m_stem;
+    std::string m_isa;       // Variant to store compiled code as
+    std::string m_read_isa;  // Variant to load, if any
+    std::string m_header;    // Precedes each cached object
+    std::shared_ptr<const std::string> m_shared;  // From the registry
+    std::unique_ptr<llvm::MemoryBuffer> m_file;   // From the directory
+    bool m_hit = false;
+};
+
+
+
+/// PerfMapListener - Append the address, size and name of each function
+/// that MCJIT loads to /tmp/perf-<pid>.map, where Linux `perf report`
+/// looks to symbolize samples in JITed code. The names are the group and
+/// layer function names. The map is for the whole process, so there is
+/// one listener, shared by all engines. Since we keep the JIT memory after
+/// the engine is gone, loaded code is never unmapped, and nothing is
+/// removed from the map.
+class PerfMapListener final : public llvm::JITEventListener {
+public:
+    static PerfMapListener* instance()
+    {
+        static PerfMapListener listener;
+        return &listener;
+    }
+
+    void
+    notifyObjectLoaded(ObjectKey /*K*/, const llvm::object::ObjectFile& Obj,
+                       const llvm::RuntimeDyld::LoadedObjectInfo& L) override
+    {
+        // The copy "for debug" has the sections at their loaded addresses.
+        llvm::object::OwningBinary<llvm::object::ObjectFile> debugobj
+            = L.getObjectForDebug(Obj);
+        const llvm::object::ObjectFile& obj(
+            debugobj.getBinary() ? *debugobj.getBinary() : Obj);
+        std::string lines;
+        for (const auto& p : llvm::object::computeSymbolSizes(obj)) {
+            const llvm::object::SymbolRef& sym(p.first);
+            auto type = sym.getType();
+            if (!type || *type != llvm::object::SymbolRef::ST_Function) {
+                llvm::consumeError(type.takeError());
+                continue;
+            }
+            auto name = sym.getName();
+            auto addr = sym.getAddress();
+            if (!name || !addr || !p.second) {
+                llvm::consumeError(name.takeError());
+                llvm::consumeError(addr.takeError());
+                continue;
+            }
+            lines += fmtformat("{:x} {:x} {}\n", *addr, p.second,
+                               name->str());
+        }
+        if (lines.empty())
+            return;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_file) {
+            std::string filename
+                = fmtformat("/tmp/perf-{}.map",
+                            int(llvm::sys::Process::getProcessId()));
+            m_file = fopen(filename.c_str(), "a");
+            if (!m_file)
+                return;
+        }
+        fwrite(lines.data(), 1, lines.size(), m_file);
+        fflush(m_file);
+    }
+
+private:
+    PerfMapListener() = default;
+    std::mutex m_mutex;
+    FILE* m_file = nullptr;
+};
+
+
+
 class LLVM_Util::IRBuilder final
     : public llvm::IRBuilder<llvm::ConstantFolder,
                              llvm::IRBuilderDefaultInserter> {
@@ -428,6 +887,7 @@ LLVM_Util::LLVM_Util(const PerThreadInfo& per_thread_info, int debuglevel,
     , mSubTypeForInlinedFunction(nullptr)
     , m_ModuleIsFinalized(false)
     , m_ModuleIsPruned(false)
+    , m_ModuleIsSplit(false)
     , m_is_masking_required(false)
     , m_masked_exit_count(0)
 {
@@ -444,7 +904,7 @@ LLVM_Util::LLVM_Util(const PerThreadInfo& per_thread_info, int debuglevel,
         }
 
         if (!m_thread->llvm_jitmm) {
-            m_thread->llvm_jitmm = new LLVMMemoryManager(&llvm_default_mapper);
+            m_thread->llvm_jitmm = new CountedMemoryManager;
             OSL_DASSERT(m_thread->llvm_jitmm);
             OSL_ASSERT(
                 jitmm_hold
@@ -1186,7 +1646,8 @@ initCpuFeatures()
 // for any of the wide libraries, please update here to match
 static const char* target_isa_names[]
     = { "UNKNOWN", "none",       "x64",    "SSE4.2",       "AVX",
-        "AVX2",    "AVX2_noFMA", "AVX512", "AVX512_noFMA", "host" };
+        "AVX2",    "AVX2_noFMA", "AVX512", "AVX512_noFMA", "NEON",
+        "host" };
 
 
 // clang: default
@@ -1289,6 +1750,10 @@ static const char* required_cpu_features_by_AVX512_noFMA[] = {
     // , "xsave", "xsavec", "xsaveopt", "xsaves" // Save Processor Extended States, we don't use
 };
 
+// clang: -march=armv8-a
+// gcc: -march=armv8-a
+static const char* required_cpu_features_by_NEON[] = { "neon" };
+
 
 static cspan<const char*>
 get_required_cpu_features_for(TargetISA target)
@@ -1303,6 +1768,7 @@ get_required_cpu_features_for(TargetISA target)
     case TargetISA::AVX2_noFMA: return required_cpu_features_by_AVX2_noFMA;
     case TargetISA::AVX512: return required_cpu_features_by_AVX512;
     case TargetISA::AVX512_noFMA: return required_cpu_features_by_AVX512_noFMA;
+    case TargetISA::NEON: return required_cpu_features_by_NEON;
     default:
         OSL_ASSERT(
             0
@@ -1425,6 +1891,15 @@ LLVM_Util::detect_cpu_features(TargetISA requestedISA, bool no_fma)
             m_target_isa = TargetISA::x64;
             break;
         }
+        OSL_FALLTHROUGH;
+    case TargetISA::NEON:
+        // 128 bit AArch64 SIMD, comparisons produce 32 bit lane masks
+        // like SSE, but there is no movmsk, so masks are converted to
+        // integers with generic LLVM IR (see mask_as_int).
+        if (supports_isa(TargetISA::NEON)) {
+            m_target_isa = TargetISA::NEON;
+            break;
+        }
         break;
     case TargetISA::NONE: m_target_isa = TargetISA::NONE; break;
     default: OSL_ASSERT(0 && "Unknown TargetISA");
@@ -1495,11 +1970,23 @@ LLVM_Util::supports_isa(TargetISA target)
 
 
 
+LLVM_Util::JitMemoryRef
+LLVM_Util::private_jit_memory()
+{
+    if (!m_private_jitmm) {
+        m_private_jitmm = std::make_shared<CountedMemoryManager>();
+        m_llvm_jitmm = m_private_jitmm.get();
+    }
+    return m_private_jitmm;
+}
+
+
+
 // N.B. This method is never called for PTX generation, so don't be alarmed
 // if it's doing x86 specific things.
 llvm::ExecutionEngine*
 LLVM_Util::make_jit_execengine(std::string* err, TargetISA requestedISA,
-                               bool debugging_symbols, bool profiling_events)
+                               bool debugging_symbols, int profiling_events)
 {
     execengine(NULL);  // delete and clear any existing engine
     if (err)
@@ -1516,7 +2003,7 @@ LLVM_Util::make_jit_execengine(std::string* err, TargetISA requestedISA,
     // We are actually holding a LLVMMemoryManager
     engine_builder.setMCJITMemoryManager(
         std::unique_ptr<llvm::RTDyldMemoryManager>(
-            new MemoryManager(m_llvm_jitmm)));
+            new MemoryManager(m_llvm_jitmm, &m_jit_bytes)));
 
 #if OSL_LLVM_VERSION >= 180
     engine_builder.setOptLevel(jit_aggressive()
@@ -1649,7 +2136,7 @@ LLVM_Util::make_jit_execengine(std::string* err, TargetISA requestedISA,
             llvm::JITEventListener::createGDBRegistrationListener());
     }
 
-    if (profiling_events) {
+    if (profiling_events & ProfileVTune) {
         // These magic lines will make it so that enough symbol information
         // is injected so that running vtune will kinda tell you which shaders
         // you're in, and sometimes which function (only for functions that don't
@@ -1665,6 +2152,19 @@ LLVM_Util::make_jit_execengine(std::string* err, TargetISA requestedISA,
             m_llvm_exec->RegisterJITEventListener(mVTuneNotifier);
         }
     }
+    if (profiling_events & ProfilePerfMap) {
+        mPerfMapNotifier = PerfMapListener::instance();
+        m_llvm_exec->RegisterJITEventListener(mPerfMapNotifier);
+    }
+    if (profiling_events & ProfileJitDump) {
+        // Writes jit-<pid>.dump in the current directory, for `perf record
+        // -k 1` and `perf inject --jit`, with the code bytes of each
+        // function. Like the Intel listener, it's a stub that returns
+        // nullptr unless LLVM was built with -DLLVM_USE_PERF=ON.
+        mPerfNotifier = llvm::JITEventListener::createPerfJITEventListener();
+        if (mPerfNotifier)
+            m_llvm_exec->RegisterJITEventListener(mPerfNotifier);
+    }
 
     // Force it to JIT as soon as we ask it for the code pointer,
     // don't take any chances that it might JIT lazily, since we
@@ -1781,6 +2281,16 @@ LLVM_Util::execengine(llvm::ExecutionEngine* exec)
             delete mVTuneNotifier;
             mVTuneNotifier = nullptr;
         }
+        // The perf listeners are static, and their maps and dumps keep
+        // describing the code we hold on to, so just stop notifying them.
+        if (mPerfMapNotifier) {
+            m_llvm_exec->UnregisterJITEventListener(mPerfMapNotifier);
+            mPerfMapNotifier = nullptr;
+        }
+        if (mPerfNotifier) {
+            m_llvm_exec->UnregisterJITEventListener(mPerfNotifier);
+            mPerfNotifier = nullptr;
+        }
 
         if (debug_is_enabled()) {
             // We explicitly remove the GDB listener, so it can't be notified of the object's release.
@@ -1795,6 +2305,647 @@ LLVM_Util::execengine(llvm::ExecutionEngine* exec)
         delete m_llvm_exec;
     }
     m_llvm_exec = exec;
+    // The object cache is only referenced by the engine it was attached to.
+    delete m_object_cache;
+    m_object_cache = nullptr;
+}
+
+
+
+// The CPU ISAs, from most to least capable within each architecture, for
+// picking the best cached variant a host can run.
+static const TargetISA isa_preference[]
+    = { TargetISA::AVX512, TargetISA::AVX512_noFMA, TargetISA::AVX2,
+        TargetISA::AVX2_noFMA, TargetISA::AVX, TargetISA::SSE4_2,
+        TargetISA::x64, TargetISA::NEON };
+
+
+
+bool
+LLVM_Util::jit_object_cache(string_view cachedir, string_view key,
+                            ShaderRegistry* registry)
+{
+    llvm::ExecutionEngine* exec = execengine();
+    ObjectCache* oldcache       = m_object_cache;
+    m_object_cache              = nullptr;
+    bool found                  = false;
+    if (cachedir.size() || registry) {
+        // The same IR yields different machine code for different targets
+        // and LLVM releases, so fold those into the file name; the ISA
+        // names the variant.
+        const llvm::TargetMachine* tm = exec->getTargetMachine();
+        std::string fullkey = fmtformat("{}|{}|{}|{}", key,
+                                        tm->getTargetTriple().str(),
+                                        tm->getTargetCPU().str(),
+                                        LLVM_VERSION_STRING);
+        std::string stem    = fmtformat("osl_{:016x}_{:x}",
+                                        OIIO::Strutil::strhash(fullkey),
+                                        fullkey.size());
+        std::string digest;
+        for (uint8_t b : llvm::SHA1::hash(llvm::arrayRefFromStringRef(fullkey)))
+            digest += fmtformat("{:02x}", b);
+        m_object_cache = new ObjectCache(cachedir, registry, stem,
+                                         target_isa_name(m_target_isa), digest);
+
+        // Our own ISA's code is best, but that of any lesser ISA this host
+        // can run beats compiling.
+        std::vector<std::string> isas { target_isa_name(m_target_isa) };
+        auto own = std::find(std::begin(isa_preference),
+                             std::end(isa_preference), m_target_isa);
+        if (own != std::end(isa_preference))
+            for (auto isa = own + 1; isa != std::end(isa_preference); ++isa)
+                if (supports_isa(*isa))
+                    isas.emplace_back(target_isa_name(*isa));
+        found = m_object_cache->choose(isas);
+    }
+    exec->setObjectCache(m_object_cache);
+    delete oldcache;
+    return found;
+}
+
+
+
+int
+LLVM_Util::jit_object_cache_populate(cspan<TargetISA> isas, std::string* err)
+{
+    llvm::ExecutionEngine* exec = execengine();
+    if (!m_object_cache || !exec || !m_llvm_module || m_ModuleIsFinalized
+        || m_ModuleIsSplit)
+        return 0;
+    const llvm::TargetMachine* tm = exec->getTargetMachine();
+    const llvm::Triple& triple(tm->getTargetTriple());
+    int stored = 0;
+    for (TargetISA isa : isas) {
+        // Only ISAs of this target's architecture, and not our own, whose
+        // code the JIT will store anyway.
+        bool arm = (isa == TargetISA::NEON);
+        if (isa == m_target_isa || isa <= TargetISA::NONE
+            || isa >= TargetISA::HOST
+            || (arm ? !triple.isAArch64() : !triple.isX86()))
+            continue;
+        std::string features;
+        for (auto f : get_required_cpu_features_for(isa))
+            features += fmtformat("{}+{}", features.size() ? "," : "", f);
+        std::unique_ptr<llvm::TargetMachine> isa_tm(
+            tm->getTarget().createTargetMachine(
+#if OSL_LLVM_VERSION >= 210
+                triple,
+#else
+                triple.str(),
+#endif
+                tm->getTargetCPU(), features, tm->Options,
+                tm->getRelocationModel(), tm->getCodeModel(),
+                tm->getOptLevel(), true /* JIT */));
+        if (!isa_tm) {
+            if (err)
+                *err = fmtformat("could not create a TargetMachine for {}",
+                                 target_isa_name(isa));
+            continue;
+        }
+        // Codegen changes the module, so each ISA gets a copy.
+        std::unique_ptr<llvm::Module> module(llvm::CloneModule(*m_llvm_module));
+        llvm::SmallString<0> object;
+        llvm::raw_svector_ostream out(object);
+        llvm::legacy::PassManager pm;
+#if OSL_LLVM_VERSION >= 180
+        bool failed = isa_tm->addPassesToEmitFile(
+            pm, out, nullptr, llvm::CodeGenFileType::ObjectFile);
+#else
+        bool failed = isa_tm->addPassesToEmitFile(pm, out, nullptr,
+                                                  llvm::CGFT_ObjectFile);
+#endif
+        if (failed) {
+            if (err)
+                *err = fmtformat("{} can't emit an object file",
+                                 target_isa_name(isa));
+            continue;
+        }
+        pm.run(*module);
+        m_object_cache->store(target_isa_name(isa), object.str());
+        ++stored;
+    }
+    return stored;
+}
+
+
+
+bool
+LLVM_Util::jit_object_cache_hit() const
+{
+    return m_object_cache && m_object_cache->hit();
+}
+
+
+
+// Make a new TargetMachine configured just like tm, for use by a
+// different thread or ExecutionEngine.
+static llvm::TargetMachine*
+clone_target_machine(const llvm::TargetMachine* tm)
+{
+    return tm->getTarget().createTargetMachine(
+#if OSL_LLVM_VERSION >= 210
+        tm->getTargetTriple(),
+#else
+        tm->getTargetTriple().str(),
+#endif
+        tm->getTargetCPU(), tm->getTargetFeatureString(), tm->Options,
+        tm->getRelocationModel(), tm->getCodeModel(), tm->getOptLevel(),
+        true /* JIT */);
+}
+
+
+
+bool
+LLVM_Util::parallel_codegen(int nthreads, std::string* err,
+                            const TaskRunner& run_tasks)
+{
+    llvm::ExecutionEngine* exec = execengine();
+    llvm::Module* module        = m_llvm_module;
+    // An attached cache would save the emptied module below, debug info
+    // must be finalized against the one module, and we can't split a
+    // module that is partly compiled already.
+    if (nthreads < 2 || !module || m_object_cache || debug_is_enabled()
+        || m_ModuleIsFinalized || m_ModuleIsSplit || !module->alias_empty())
+        return false;
+    int ndefined = 0;
+    for (auto&& func : module->functions())
+        if (!func.isDeclaration())
+            ++ndefined;
+    nthreads = std::min(nthreads, ndefined);
+    if (nthreads < 2)
+        return false;
+
+    // Split a copy of the module -- SplitModule externalizes the local
+    // symbols that partitions share, so the module itself stays as it was
+    // in case we have to JIT it after all. Each partition is serialized to
+    // bitcode, to be read back into a private LLVMContext on its own
+    // thread.
+    std::vector<llvm::SmallString<0>> partitions;
+    std::unique_ptr<llvm::Module> copy(llvm::CloneModule(*module));
+    llvm::SplitModule(*copy, unsigned(nthreads),
+                      [&](std::unique_ptr<llvm::Module> part) {
+                          partitions.emplace_back();
+                          llvm::raw_svector_ostream out(partitions.back());
+                          llvm::WriteBitcodeToFile(*part, out);
+                      });
+    copy.reset();
+
+    // Each thread builds its own TargetMachine, configured just like the
+    // one the ExecutionEngine uses, and emits a relocatable object.
+    const llvm::TargetMachine* tm = exec->getTargetMachine();
+    std::vector<llvm::SmallString<0>> objects(partitions.size());
+    std::vector<std::string> errors(partitions.size());
+    auto compile = [&](size_t i) {
+        llvm::LLVMContext context;
+        auto part = llvm::parseBitcodeFile(
+            llvm::MemoryBufferRef(partitions[i].str(), "osl_partition"),
+            context);
+        if (!part) {
+            errors[i] = llvm::toString(part.takeError());
+            return;
+        }
+        std::unique_ptr<llvm::TargetMachine> part_tm(
+            clone_target_machine(tm));
+        if (!part_tm) {
+            errors[i] = "could not create TargetMachine";
+            return;
+        }
+        (*part)->setDataLayout(part_tm->createDataLayout());
+        llvm::legacy::PassManager pm;
+        llvm::raw_svector_ostream out(objects[i]);
+#if OSL_LLVM_VERSION >= 180
+        bool failed = part_tm->addPassesToEmitFile(
+            pm, out, nullptr, llvm::CodeGenFileType::ObjectFile);
+#else
+        bool failed = part_tm->addPassesToEmitFile(pm, out, nullptr,
+                                                   llvm::CGFT_ObjectFile);
+#endif
+        if (failed) {
+            errors[i] = "target can't emit an object file";
+            return;
+        }
+        pm.run(**part);
+    };
+    if (run_tasks) {
+        run_tasks(int(partitions.size()), [&](int i) { compile(size_t(i)); });
+    } else {
+        OIIO::thread_group threads;
+        for (size_t i = 1; i < partitions.size(); ++i)
+            threads.add_thread(new std::thread(compile, i));
+        compile(0);
+        threads.join_all();
+    }
+    for (auto&& e : errors) {
+        if (e.size()) {
+            // Only the copy was split, so the module can still be JITed
+            // the ordinary way.
+            if (err)
+                *err = e;
+            return false;
+        }
+    }
+
+    // All the code now lives in the objects. Reduce the module to bare
+    // declarations, so MCJIT has nothing left to compile for it and its
+    // function lookups resolve to the symbols the objects define.
+    for (auto&& func : module->functions())
+        if (!func.isDeclaration())
+            func.deleteBody();
+    for (auto&& global : module->globals()) {
+        if (global.hasInitializer()) {
+            global.setInitializer(nullptr);
+            global.setLinkage(llvm::GlobalValue::ExternalLinkage);
+        }
+    }
+    for (auto&& obj : objects) {
+        std::unique_ptr<llvm::MemoryBuffer> buf
+            = llvm::MemoryBuffer::getMemBufferCopy(obj.str(), "osl_partition");
+        auto objfile = llvm::object::ObjectFile::createObjectFile(
+            buf->getMemBufferRef());
+        OSL_ASSERT(objfile && "could not read back JITed partition");
+        exec->addObjectFile(llvm::object::OwningBinary<llvm::object::ObjectFile>(
+            std::move(*objfile), std::move(buf)));
+    }
+    m_ModuleIsSplit = true;
+    return true;
+}
+
+
+
+// Erase the internal functions and globals that nothing uses any more,
+// repeating until erasing some doesn't leave others unused.
+static void
+erase_unused_locals(llvm::Module& M)
+{
+    for (bool erased = true; erased;) {
+        erased = false;
+        for (auto f = M.begin(); f != M.end();) {
+            llvm::Function& func = *f++;
+            if (func.hasLocalLinkage() && func.use_empty()) {
+                func.eraseFromParent();
+                erased = true;
+            }
+        }
+        for (auto g = M.global_begin(); g != M.global_end();) {
+            llvm::GlobalVariable& global = *g++;
+            if (global.hasLocalLinkage() && global.use_empty()) {
+                global.eraseFromParent();
+                erased = true;
+            }
+        }
+    }
+}
+
+
+
+// JIT the functions of the library bitcode[0..size-1] that have at least
+// min_insts instructions (and aren't marked always-inline) into lib, along
+// with the internal functions and globals they need, for target machine tm.
+static void
+build_shared_library(SharedLibrary& lib, const char* bitcode, size_t size,
+                     string_view name, const llvm::TargetMachine* tm,
+                     int min_insts)
+{
+    lib.context.reset(new llvm::LLVMContext);
+    auto module = llvm::parseBitcodeFile(
+        llvm::MemoryBufferRef(llvm::StringRef(bitcode, size),
+                              llvm::StringRef(name.data(), name.size())),
+        *lib.context);
+    if (!module) {
+        lib.error = llvm::toString(module.takeError());
+        return;
+    }
+    std::unique_ptr<llvm::TargetMachine> libtm(clone_target_machine(tm));
+    if (!libtm) {
+        lib.error = "could not create TargetMachine";
+        return;
+    }
+    llvm::Module& M = *module.get();
+    M.setDataLayout(libtm->createDataLayout());
+
+    // Like the groups, we never run the library's global constructors.
+    if (auto ctors = M.getGlobalVariable("llvm.global_ctors"))
+        ctors->eraseFromParent();
+    if (auto dtors = M.getGlobalVariable("llvm.global_dtors"))
+        dtors->eraseFromParent();
+
+    std::vector<std::string> shared;
+    for (llvm::Function& func : M) {
+        if (func.isDeclaration())
+            continue;
+        if (func.hasExternalLinkage() && !func.isVarArg()
+            && !func.hasFnAttribute(llvm::Attribute::AlwaysInline)
+            && func.getInstructionCount() >= unsigned(min_insts))
+            shared.push_back(func.getName().str());
+        else
+            func.setLinkage(llvm::GlobalValue::InternalLinkage);
+    }
+    // Drop everything that the shared functions don't need.
+    erase_unused_locals(M);
+
+    llvm::EngineBuilder engine_builder(std::move(module.get()));
+    engine_builder.setEngineKind(llvm::EngineKind::JIT);
+    engine_builder.setErrorStr(&lib.error);
+    engine_builder.setMCJITMemoryManager(
+        std::unique_ptr<llvm::RTDyldMemoryManager>(
+            new CountedMemoryManager));
+    lib.exec.reset(engine_builder.create(libtm.release()));
+    if (!lib.exec) {
+        if (lib.error.empty())
+            lib.error = "could not create ExecutionEngine";
+        return;
+    }
+    lib.exec->finalizeObject();
+    for (auto&& fname : shared) {
+        if (uint64_t addr = lib.exec->getFunctionAddress(fname))
+            lib.functions[fname] = addr;
+    }
+}
+
+
+
+int
+LLVM_Util::link_shared_library(const char* bitcode, size_t size,
+                               string_view name, int min_insts,
+                               std::string* err)
+{
+    if (!m_llvm_module || !bitcode || min_insts <= 0 || debug_is_enabled())
+        return 0;
+    llvm::ExecutionEngine* exec   = execengine();
+    const llvm::TargetMachine* tm = exec->getTargetMachine();
+    std::string key               = fmtformat(
+        "{}/{}/{}/{}/{}/{}/{}", name, tm->getTargetTriple().str(),
+        tm->getTargetCPU().str(), tm->getTargetFeatureString().str(),
+        int(tm->Options.AllowFPOpFusion), int(tm->getOptLevel()), min_insts);
+
+    std::shared_ptr<SharedLibrary> lib;
+    {
+        // Building the library takes a while, but the other threads that
+        // want it would only be building it too.
+        std::lock_guard<std::mutex> lock(shared_library_mutex);
+        auto& entry = shared_libraries[key];
+        if (!entry) {
+            entry = std::make_shared<SharedLibrary>();
+            build_shared_library(*entry, bitcode, size, name, tm, min_insts);
+        }
+        lib = entry;
+    }
+    if (!lib->exec) {
+        if (err)
+            *err = lib->error;
+        return 0;
+    }
+
+    // Turn our copies of the shared functions into declarations, resolved
+    // by the JIT to the library's code. Doing this before pruning also
+    // spares us from materializing whatever only they call.
+    int nlinked = 0;
+    for (llvm::Function& func : *m_llvm_module) {
+        if (func.isDeclaration())
+            continue;
+        auto found = lib->functions.find(func.getName().str());
+        if (found == lib->functions.end())
+            continue;
+        func.deleteBody();
+        exec->addGlobalMapping(&func, reinterpret_cast<void*>(found->second));
+        ++nlinked;
+    }
+    return nlinked;
+}
+
+
+
+class LLVM_Util::DeferredCode {
+public:
+    llvm::SmallString<0> bitcode;  // The whole module, before deferral
+    // Addresses the ExecutionEngine had been given for declarations.
+    std::unordered_map<std::string, void*> mappings;
+    void* (*lazy_function_creator)(const std::string&) = nullptr;
+    std::unique_ptr<llvm::TargetMachine> tm;  // Template for each JIT
+    std::mutex mutex;  // Guards functions and libraries
+    std::unordered_map<std::string, void*> functions;  // Already JITed
+    // The engines holding the functions JITed so far, freed with the
+    // deferred code.
+    std::vector<std::unique_ptr<SharedLibrary>> libraries;
+};
+
+
+
+LLVM_Util::DeferredCodeRef
+LLVM_Util::defer_functions(cspan<std::string> names)
+{
+    llvm::Module* module = m_llvm_module;
+    if (!module || names.empty() || m_object_cache || debug_is_enabled()
+        || m_ModuleIsFinalized || m_ModuleIsSplit)
+        return nullptr;
+    std::vector<llvm::Function*> funcs;
+    for (auto&& name : names) {
+        llvm::Function* func = module->getFunction(name);
+        if (!func || func->isDeclaration() || !func->use_empty())
+            return nullptr;
+        funcs.push_back(func);
+    }
+
+    llvm::ExecutionEngine* exec = execengine();
+    auto code                   = std::make_shared<DeferredCode>();
+    code->tm.reset(clone_target_machine(exec->getTargetMachine()));
+    if (!code->tm)
+        return nullptr;
+    {
+        llvm::raw_svector_ostream out(code->bitcode);
+        llvm::WriteBitcodeToFile(*module, out);
+    }
+    for (llvm::Function& func : *module) {
+        if (func.isDeclaration())
+            if (void* addr = exec->getPointerToGlobalIfAvailable(&func))
+                code->mappings[func.getName().str()] = addr;
+    }
+    code->lazy_function_creator = m_lazy_function_creator;
+
+    for (auto func : funcs)
+        func->eraseFromParent();
+    erase_unused_locals(*module);
+    return code;
+}
+
+
+
+void*
+LLVM_Util::jit_deferred_function(DeferredCode& code, string_view name,
+                                 std::string* err)
+{
+    std::string fname(name);
+    std::lock_guard<std::mutex> lock(code.mutex);
+    auto found = code.functions.find(fname);
+    if (found != code.functions.end())
+        return found->second;
+
+    std::unique_ptr<SharedLibrary> lib(new SharedLibrary);
+    lib->context.reset(new llvm::LLVMContext);
+    auto module = llvm::parseBitcodeFile(
+        llvm::MemoryBufferRef(code.bitcode.str(), "osl_deferred"),
+        *lib->context);
+    if (!module) {
+        if (err)
+            *err = llvm::toString(module.takeError());
+        return nullptr;
+    }
+    llvm::Module& M      = *module.get();
+    llvm::Function* func = M.getFunction(fname);
+    if (!func || func->isDeclaration()) {
+        if (err)
+            *err = fmtformat("no function {} in the deferred code", fname);
+        return nullptr;
+    }
+    // Keep just the one function, and whatever it calls.
+    for (llvm::Function& f : M)
+        if (!f.isDeclaration() && &f != func)
+            f.setLinkage(llvm::GlobalValue::InternalLinkage);
+    erase_unused_locals(M);
+
+    std::unique_ptr<llvm::TargetMachine> tm(
+        clone_target_machine(code.tm.get()));
+    if (!tm) {
+        if (err)
+            *err = "could not create TargetMachine";
+        return nullptr;
+    }
+    llvm::EngineBuilder engine_builder(std::move(module.get()));
+    engine_builder.setEngineKind(llvm::EngineKind::JIT);
+    engine_builder.setErrorStr(&lib->error);
+    engine_builder.setMCJITMemoryManager(
+        std::unique_ptr<llvm::RTDyldMemoryManager>(
+            new CountedMemoryManager));
+    lib->exec.reset(engine_builder.create(tm.release()));
+    if (!lib->exec) {
+        if (err)
+            *err = lib->error.size() ? lib->error
+                                     : "could not create ExecutionEngine";
+        return nullptr;
+    }
+    if (code.lazy_function_creator)
+        lib->exec->InstallLazyFunctionCreator(code.lazy_function_creator);
+    for (llvm::Function& f : M) {
+        if (!f.isDeclaration())
+            continue;
+        auto mapped = code.mappings.find(f.getName().str());
+        if (mapped != code.mappings.end())
+            lib->exec->addGlobalMapping(&f, mapped->second);
+    }
+    lib->exec->finalizeObject();
+    void* addr = reinterpret_cast<void*>(lib->exec->getFunctionAddress(fname));
+    if (!addr) {
+        if (err)
+            *err = fmtformat("could not JIT {}", fname);
+        return nullptr;
+    }
+    code.libraries.push_back(std::move(lib));
+    code.functions[fname] = addr;
+    return addr;
+}
+
+
+
+// Call visit(func, nullptr) for the entry of each of the defined funcs,
+// then visit(func, br) for each of its conditional branches, all in a
+// fixed order.
+template<typename Visitor>
+static void
+visit_profiled_branches(cspan<llvm::Function*> funcs, Visitor&& visit)
+{
+    for (llvm::Function* func : funcs) {
+        if (!func || func->isDeclaration())
+            continue;
+        visit(func, (llvm::BranchInst*)nullptr);
+        std::vector<llvm::BranchInst*> branches;
+        for (llvm::BasicBlock& bb : *func) {
+            auto br = llvm::dyn_cast_or_null<llvm::BranchInst>(
+                bb.getTerminator());
+            if (br && br->isConditional())
+                branches.push_back(br);
+        }
+        for (auto br : branches)
+            visit(func, br);
+    }
+}
+
+
+
+size_t
+LLVM_Util::branch_profile_size(cspan<llvm::Function*> funcs)
+{
+    size_t size = 0;
+    visit_profiled_branches(funcs, [&](llvm::Function*, llvm::BranchInst* br) {
+        size += br ? 2 : 1;
+    });
+    return size;
+}
+
+
+
+void
+LLVM_Util::instrument_branch_profile(cspan<llvm::Function*> funcs,
+                                     uint64_t* counters)
+{
+    llvm::Type* i64   = llvm::Type::getInt64Ty(context());
+    llvm::Value* base = llvm::ConstantExpr::getIntToPtr(
+        llvm::ConstantInt::get(i64, uint64_t(uintptr_t(counters))),
+        llvm::PointerType::getUnqual(i64));
+    uint64_t index = 0;
+    auto count     = [&](llvm::IRBuilder<>& b, llvm::Value* offset) {
+        llvm::Value* ptr = b.CreateGEP(i64, base, offset);
+        b.CreateAtomicRMW(llvm::AtomicRMWInst::Add, ptr,
+                          llvm::ConstantInt::get(i64, 1), llvm::MaybeAlign(8),
+                          llvm::AtomicOrdering::Monotonic);
+    };
+    visit_profiled_branches(funcs, [&](llvm::Function* func,
+                                       llvm::BranchInst* br) {
+        if (!br) {
+            llvm::IRBuilder<> b(&*func->getEntryBlock().getFirstInsertionPt());
+            count(b, llvm::ConstantInt::get(i64, index));
+            index += 1;
+        } else {
+            // One counter for each way the branch goes.
+            llvm::IRBuilder<> b(br);
+            count(b, b.CreateSelect(br->getCondition(),
+                                    llvm::ConstantInt::get(i64, index),
+                                    llvm::ConstantInt::get(i64, index + 1)));
+            index += 2;
+        }
+    });
+}
+
+
+
+bool
+LLVM_Util::apply_branch_profile(cspan<llvm::Function*> funcs,
+                                cspan<uint64_t> counts)
+{
+    if (size_t(counts.size()) != branch_profile_size(funcs))
+        return false;
+    llvm::MDBuilder mdbuilder(context());
+    size_t index = 0;
+    visit_profiled_branches(funcs, [&](llvm::Function* func,
+                                       llvm::BranchInst* br) {
+        if (!br) {
+            func->setEntryCount(counts[index]);
+            index += 1;
+            return;
+        }
+        uint64_t taken = counts[index], nottaken = counts[index + 1];
+        index += 2;
+        if (!taken && !nottaken)
+            return;  // never reached, nothing learned
+        // Branch weights are 32 bits, only their ratio matters.
+        while (std::max(taken, nottaken) > 0xffffffffULL) {
+            taken >>= 1;
+            nottaken >>= 1;
+        }
+        br->setMetadata(llvm::LLVMContext::MD_prof,
+                        mdbuilder.createBranchWeights(uint32_t(taken),
+                                                      uint32_t(nottaken)));
+    });
+    return true;
 }
 
 
@@ -1841,7 +2992,9 @@ LLVM_Util::nvptx_target_machine()
 #else
             ModuleTriple.str(),
 #endif
-            CUDA_TARGET_ARCH, "+ptx50", options, llvm::Reloc::Static,
+            m_nvptx_target_arch.size() ? m_nvptx_target_arch.c_str()
+                                       : CUDA_TARGET_ARCH,
+            "+ptx50", options, llvm::Reloc::Static,
             llvm::CodeModel::Small,
 #if OSL_LLVM_VERSION >= 180
             llvm::CodeGenOptLevel::Default
@@ -1858,6 +3011,18 @@ LLVM_Util::nvptx_target_machine()
 
 
 
+void
+LLVM_Util::nvptx_target_arch(string_view arch)
+{
+    if (arch != m_nvptx_target_arch) {
+        delete m_nvptx_target_machine;
+        m_nvptx_target_machine = nullptr;
+        m_nvptx_target_arch    = arch;
+    }
+}
+
+
+
 void*
 LLVM_Util::getPointerToFunction(llvm::Function* func)
 {
@@ -1895,6 +3060,7 @@ LLVM_Util::InstallLazyFunctionCreator(void* (*P)(const std::string&))
 {
     llvm::ExecutionEngine* exec = execengine();
     exec->InstallLazyFunctionCreator(P);
+    m_lazy_function_creator = P;
 }
 
 
@@ -2424,68 +3590,60 @@ LLVM_Util::prune_and_internalize_module(
 #    define __OSL_PRUNE_ONLY(...)
 #endif
 
-    bool materialized_at_least_once;
-    __OSL_PRUNE_ONLY(int materialization_pass_count = 0);
-    do {
-        // Materializing a function may caused other unmaterialized
-        // functions to be used, so we will continue to check for used
-        // functions that need to be materialized until none are.
-        //
-        // An alternative algorithm could scan the instructions of a
-        // materialized function and recursively look for calls to
-        // non-materialized functions. We think the top end of the current
-        // approach to be 2-3 passes and its simple.
-        materialized_at_least_once = false;
-        __OSL_PRUNE_ONLY(
-            std::cout
-            << ">>>>>>>>>>>>>>>>>>materialize used globals & funcs pass#: "
-            << ++materialization_pass_count << std::endl);
-        for (llvm::Function& func : *m_llvm_module) {
-            if (func.isMaterializable()) {
-                if (anyMaterializedUses(func)) {
-                    __OSL_PRUNE_ONLY(std::cout << "materialized function "
-                                               << func.getName().data()
-                                               << " for "
-                                               << numberOfMaterializedUses(func)
-                                               << " uses" << std::endl);
-                    LLVMErr err = func.materialize();
-                    if (error_string(std::move(err), out_err))
-                        return;
-                    materialized_at_least_once = true;
-                }
-            }
-        }
-        for (llvm::GlobalAlias& global_alias : m_llvm_module->aliases()) {
-            if (global_alias.isMaterializable()) {
-                if (anyMaterializedUses(global_alias)) {
-                    __OSL_PRUNE_ONLY(std::cout
-                                     << "materialized global alias"
-                                     << global_alias.getName().data() << " for "
-                                     << numberOfMaterializedUses(global_alias)
-                                     << " uses" << std::endl);
-                    LLVMErr err = global_alias.materialize();
-                    if (error_string(std::move(err), out_err))
-                        return;
-                    materialized_at_least_once = true;
-                }
-            }
-        }
-        for (llvm::GlobalVariable& global : m_llvm_module->globals()) {
-            if (global.isMaterializable()) {
-                if (anyMaterializedUses(global)) {
-                    __OSL_PRUNE_ONLY(std::cout
-                                     << "materialized global "
-                                     << global.getName().data() << " for "
-                                     << numberOfMaterializedUses(global)
-                                     << " uses" << std::endl);
-                    LLVMErr err = global.materialize();
-                    if (error_string(std::move(err), out_err))
-                        return;
-                    materialized_at_least_once = true;
-                }
+    // The module was loaded lazily, so only the group's own functions have
+    // bodies so far. Deserialize just what they reach: each function,
+    // global or alias we find referenced is materialized once, and then
+    // its own references are followed, with no rescans of the (large)
+    // shadeops library for uses until nothing changes.
+    std::vector<llvm::Constant*> pending;
+    std::unordered_set<llvm::Constant*> seen;
+    auto reference = [&](llvm::Value* val) {
+        llvm::Constant* c = llvm::dyn_cast<llvm::Constant>(val);
+        if (c && seen.insert(c).second)
+            pending.push_back(c);
+    };
+    auto reference_body = [&](llvm::Function& func) {
+        if (func.hasPersonalityFn())
+            reference(func.getPersonalityFn());
+        for (llvm::BasicBlock& bb : func)
+            for (llvm::Instruction& inst : bb)
+                for (llvm::Value* operand : inst.operands())
+                    reference(operand);
+    };
+    for (llvm::Function& func : *m_llvm_module)
+        if (!func.isMaterializable() && !func.isDeclaration())
+            reference_body(func);
+    while (!pending.empty()) {
+        llvm::Constant* c = pending.back();
+        pending.pop_back();
+        if (auto* global_value = llvm::dyn_cast<llvm::GlobalValue>(c)) {
+            bool materialize = global_value->isMaterializable();
+            if (materialize) {
+                __OSL_PRUNE_ONLY(std::cout << "materialized "
+                                           << global_value->getName().data()
+                                           << std::endl);
+                LLVMErr err = global_value->materialize();
+                if (error_string(std::move(err), out_err))
+                    return;
             }
+            if (auto* func = llvm::dyn_cast<llvm::Function>(global_value)) {
+                // Bodies we already had were referenced up front
+                if (materialize)
+                    reference_body(*func);
+            } else if (auto* global = llvm::dyn_cast<llvm::GlobalVariable>(
+                           global_value)) {
+                if (global->hasInitializer())
+                    reference(global->getInitializer());
+            } else if (auto* alias = llvm::dyn_cast<llvm::GlobalAlias>(
+                           global_value))
+                reference(alias->getAliasee());
+        } else {
+            // A constant expression or aggregate, which may refer to
+            // globals or functions in turn
+            for (llvm::Value* operand : c->operands())
+                reference(operand);
         }
-    } while (materialized_at_least_once);
+    }
 
     __OSL_PRUNE_ONLY(
         std::cout
@@ -3347,6 +4505,14 @@ LLVM_Util::mask_as_int(llvm::Value* mask)
 
         llvm::Value* result = builder().CreateBitCast(mask, intMaskType);
         return builder().CreateZExt(result, type_int());
+    } else if (m_target_isa == TargetISA::NEON) {
+        // There is no horizontal sign extraction instruction on NEON,
+        // reinterpret cast the <W x i1> to a W bit integer and let LLVM's
+        // AArch64 backend lower it (AND with lane bits + horizontal add).
+        llvm::Type* intMaskType = llvm::IntegerType::get(context(),
+                                                         m_vector_width);
+        llvm::Value* result     = builder().CreateBitCast(mask, intMaskType);
+        return builder().CreateZExt(result, type_int());
     } else if (m_supports_avx) {
         switch (m_vector_width) {
         case 16: {
@@ -3588,6 +4754,11 @@ LLVM_Util::mask4_as_int8(llvm::Value* mask)
             = llvm::ConstantDataVector::getSplat(4, constant_bool(false));
         return builder().CreateBitCast(op_combine_4x_vectors(mask, zero_mask4),
                                        type_int8());
+    } else if (m_target_isa == TargetISA::NEON) {
+        // No movmsk on NEON, use a generic reinterpret cast to i4
+        llvm::Value* int4 = builder().CreateBitCast(
+            mask, llvm::IntegerType::get(context(), 4));
+        return builder().CreateZExt(int4, type_int8());
     } else {
         // Convert <4 x i1> -> <4 x i32>
         llvm::Value* w4_int_mask = builder().CreateSExt(mask, type_wide_int());
@@ -6455,6 +7626,33 @@ LLVM_Util::ptx_compile_group(llvm::Module*, const std::string& name,
 
 
 
+void
+LLVM_Util::make_cuda_kernel(llvm::Function* func)
+{
+    // NVPTX finds its kernels through the module's nvvm.annotations.
+    llvm::Metadata* md[] = { llvm::ValueAsMetadata::get(func),
+                             llvm::MDString::get(context(), "kernel"),
+                             llvm::ValueAsMetadata::get(constant(1)) };
+    module()
+        ->getOrInsertNamedMetadata("nvvm.annotations")
+        ->addOperand(llvm::MDNode::get(context(), md));
+}
+
+
+
+llvm::Value*
+LLVM_Util::cuda_thread_index()
+{
+    auto sreg = [&](llvm::Intrinsic::ID id) -> llvm::Value* {
+        return builder().CreateCall(getIntrinsicDeclaration(module(), id));
+    };
+    return op_add(op_mul(sreg(llvm::Intrinsic::nvvm_read_ptx_sreg_ctaid_x),
+                         sreg(llvm::Intrinsic::nvvm_read_ptx_sreg_ntid_x)),
+                  sreg(llvm::Intrinsic::nvvm_read_ptx_sreg_tid_x));
+}
+
+
+
 std::string
 LLVM_Util::bitcode_string(llvm::Function* func)
 {
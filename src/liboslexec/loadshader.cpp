@@ -9,6 +9,7 @@
 
 #include "oslexec_pvt.h"
 #include "osoreader.h"
+#include "shaderbundle.h"
 
 #include <OpenImageIO/filesystem.h>
 #include <OpenImageIO/hash.h>
@@ -38,6 +39,7 @@ public:
     virtual ~OSOReaderToMaster() {}
     virtual bool parse_file(const std::string& filename);
     virtual bool parse_memory(const std::string& oso);
+    bool parse_bundled(string_view oso, const std::string& filename);
     virtual void version(const char* specid, int major, int minor);
     virtual void shader(const char* shadertype, const char* name);
     virtual void symbol(SymType symtype, TypeSpec typespec, const char* name);
@@ -104,6 +106,24 @@ OSOReaderToMaster::parse_memory(const std::string& oso)
 
 
 
+// Parse the code of a shader held in a mounted bundle.
+bool
+OSOReaderToMaster::parse_bundled(string_view oso, const std::string& filename)
+{
+    m_master->m_osofilename   = filename;
+    m_master->m_maincodebegin = 0;
+    m_master->m_maincodeend   = 0;
+    m_codesection.clear();
+    m_codesym = -1;
+    // Binary code is read in place from the bundle's mapping.
+    bool ok = is_binary(oso.data(), oso.size())
+                  ? parse_binary(oso.data(), oso.size(), filename)
+                  : OSOReader::parse_memory(std::string(oso));
+    return ok && !m_errors;
+}
+
+
+
 void
 OSOReaderToMaster::version(const char* /*specid*/, int major, int minor)
 {
@@ -327,6 +347,9 @@ OSOReaderToMaster::hint(string_view hintstring)
         Strutil::parse_int(h, m_sourceline);
         return;
     }
+    if (m_master->m_symbols.empty()
+        && OSOReader::parse_cost_hint(h, m_master->m_cost))
+        return;
     if (Strutil::parse_prefix(h, "%structfields{")
         && m_master->m_symbols.size()) {
         Symbol& sym(m_master->m_symbols.back());
@@ -558,31 +581,78 @@ ShadingSystemImpl::loadshader(string_view cname)
     }
     ++m_stat_shaders_requested;
     ustring name(cname);
-    lock_guard guard(m_mutex);  // Thread safety
-    ShaderNameMap::const_iterator found = m_shader_masters.find(name);
-    if (found != m_shader_masters.end()) {
-        // if (debug())
-        //     infofmt("Found {} in shader_masters", name);
-        // Already loaded this shader, return its reference
-        return (*found).second;
+
+    // Only the first request for a shader loads it, and without holding
+    // m_mutex, so that different shaders load in parallel. Other requests
+    // for it meanwhile wait for that load to finish.
+    std::promise<ShaderMaster::ref> loaded;
+    std::shared_future<ShaderMaster::ref> pending;
+    std::vector<std::string> searchpath_dirs;
+    std::vector<std::shared_ptr<ShaderBundle>> bundles;
+    {
+        lock_guard guard(m_mutex);  // Thread safety
+        ShaderNameMap::const_iterator found = m_shader_masters.find(name);
+        if (found != m_shader_masters.end()) {
+            // if (debug())
+            //     infofmt("Found {} in shader_masters", name);
+            // Already loaded this shader, return its reference
+            return (*found).second;
+        }
+        auto loading = m_shader_masters_loading.find(name);
+        if (loading != m_shader_masters_loading.end()) {
+            pending = loading->second;
+        } else {
+            m_shader_masters_loading[name] = loaded.get_future().share();
+            searchpath_dirs                = m_searchpath_dirs;
+            bundles                        = m_bundles;
+        }
     }
+    if (pending.valid())
+        return pending.get();
+
+    ShaderMaster::ref r;
+    // Record the result (unless no file was found, so that later requests
+    // look again) and wake the waiters, however we leave.
+    auto finish = [&](bool record) {
+        {
+            lock_guard guard(m_mutex);
+            // A LoadMemoryCompiledShader of the same name in the meantime
+            // takes precedence.
+            if (record)
+                r = m_shader_masters.emplace(name, r).first->second;
+            m_shader_masters_loading.erase(name);
+        }
+        loaded.set_value(r);
+        return r;
+    };
 
-    // Not found in the map
+    // Not found in the map. Mounted bundles come first, needing no file
+    // system access to find the shader.
     OSOReaderToMaster oso(*this);
-    bool testcwd
-        = m_searchpath_dirs.empty();  // test "." if there's no searchpath
-    std::string filename
-        = OIIO::Filesystem::searchpath_find(name.string() + ".oso",
-                                            m_searchpath_dirs, testcwd);
+    std::string filename;
+    string_view bundled;
+    for (const auto& bundle : bundles) {
+        bundled = bundle->find(name);
+        if (bundled.size()) {
+            filename = bundle->filename() + ":" + name.string();
+            break;
+        }
+    }
+    if (filename.empty()) {
+        bool testcwd
+            = searchpath_dirs.empty();  // test "." if there's no searchpath
+        filename = OIIO::Filesystem::searchpath_find(name.string() + ".oso",
+                                                     searchpath_dirs, testcwd);
+    }
     if (filename.empty()) {
         errorfmt("No .oso file could be found for shader \"{}\"", name);
-        return NULL;
+        return finish(false);
     }
     OIIO::Timer timer;
-    bool ok                = oso.parse_file(filename);
-    ShaderMaster::ref r    = ok ? oso.master() : nullptr;
-    m_shader_masters[name] = r;
-    double loadtime        = timer();
+    bool ok         = bundled.size() ? oso.parse_bundled(bundled, filename)
+                                     : oso.parse_file(filename);
+    r               = ok ? oso.master() : nullptr;
+    double loadtime = timer();
     {
         spin_lock lock(m_stat_mutex);
         m_stat_master_load_time += loadtime;
@@ -593,6 +663,7 @@ ShadingSystemImpl::loadshader(string_view cname)
             infofmt("Loaded \"{}\" (took {})", filename,
                     Strutil::timeintervalformat(loadtime, 2));
         OSL_DASSERT(r);
+        r->load_time(loadtime);
         r->resolve_syms();
         // if (debug()) {
         //     std::string s = r->print ();
@@ -603,7 +674,7 @@ ShadingSystemImpl::loadshader(string_view cname)
         errorfmt("Unable to read \"{}\"", filename);
     }
 
-    return r;
+    return finish(true);
 }
 
 
@@ -623,9 +694,18 @@ ShadingSystemImpl::LoadMemoryCompiledShader(string_view shadername,
     }
 
     ustring name(shadername);
+    uint64_t osohash = Strutil::strhash(buffer);
     lock_guard guard(m_mutex);  // Thread safety
     ShaderNameMap::const_iterator found = m_shader_masters.find(name);
-    if (found != m_shader_masters.end() && !allow_shader_replacement()) {
+    if (found != m_shader_masters.end() && found->second
+        && found->second->oso_hash() == osohash) {
+        // The same oso is already loaded under this name; nothing to do.
+        if (debug())
+            infofmt("Preload shader {} is unchanged", name);
+        return true;
+    }
+    if ((found != m_shader_masters.end() || m_shader_masters_loading.count(name))
+        && !allow_shader_replacement()) {
         if (debug())
             infofmt("Preload shader {} already exists in shader_masters", name);
         return false;
@@ -648,6 +728,8 @@ ShadingSystemImpl::LoadMemoryCompiledShader(string_view shadername,
             infofmt("Loaded \"{}\" (took {})", shadername,
                     Strutil::timeintervalformat(loadtime, 2));
         OSL_DASSERT(r);
+        r->load_time(loadtime);
+        r->oso_hash(osohash);
         r->resolve_syms();
         // if (debug()) {
         //     std::string s = r->print ();
@@ -0,0 +1,84 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <OpenImageIO/filesystem.h>
+
+#ifndef _WIN32
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+#include <OSL/oslconfig.h>
+
+OSL_NAMESPACE_BEGIN
+
+namespace pvt {
+
+// The read-only contents of a file, memory mapped where possible (so that
+// only the parts that are used are paged in, and processes reading the
+// same file share its pages), else read into memory.
+class MappedFile {
+public:
+    MappedFile() {}
+    MappedFile(const MappedFile&)            = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile()
+    {
+#ifndef _WIN32
+        if (m_mapped)
+            munmap((void*)m_data, m_size);
+#endif
+    }
+
+    /// Map or read the whole file, returning false if it can't be read or
+    /// is empty.
+    bool open(const std::string& filename)
+    {
+#ifndef _WIN32
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* p = mmap(nullptr, size_t(st.st_size), PROT_READ,
+                           MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                m_data   = (const char*)p;
+                m_size   = size_t(st.st_size);
+                m_mapped = true;
+            }
+        }
+        if (fd >= 0)
+            close(fd);
+#endif
+        if (!m_data) {
+            m_size = size_t(OIIO::Filesystem::file_size(filename));
+            if (!m_size)
+                return false;
+            m_buffer.reset(new char[m_size]);
+            if (OIIO::Filesystem::read_bytes(filename, m_buffer.get(), m_size)
+                != m_size)
+                return false;
+            m_data = m_buffer.get();
+        }
+        return true;
+    }
+
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    const char* m_data = nullptr;
+    size_t m_size      = 0;
+    bool m_mapped      = false;
+    std::unique_ptr<char[]> m_buffer;  // file contents, if not mapped
+};
+
+}  // namespace pvt
+OSL_NAMESPACE_END
@@ -2,10 +2,12 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
 #include <cstdio>
 #include <limits>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <OpenImageIO/strutil.h>
@@ -25,7 +27,8 @@ ShaderMaster::ShaderMaster(ShadingSystemImpl& shadingsys)
 ShaderMaster::~ShaderMaster()
 {
     // Adjust statistics
-    size_t opmem      = vectorbytes(m_ops);
+    size_t opmem      = vectorbytes(m_ops) + m_packed_code.capacity()
+                        + vectorbytes(m_packed_strings);
     size_t argmem     = vectorbytes(m_args);
     size_t symmem     = vectorbytes(m_symbols);
     size_t defaultmem = vectorbytes(m_idefaults) + vectorbytes(m_fdefaults)
@@ -157,6 +160,8 @@ ShaderMaster::resolve_syms()
         ++i;
     }
 
+    m_nops = int(m_ops.size());
+
     // Re-track variable lifetimes
     SymbolPtrVec oparg_ptrs;
     oparg_ptrs.reserve(m_args.size());
@@ -203,9 +208,195 @@ ShaderMaster::resolve_syms()
 
 
 
+namespace {
+
+// The compact code is a sequence of unsigned LEB128 varints.
+void
+pack(std::string& out, uint32_t v)
+{
+    while (v >= 0x80) {
+        out += char(v | 0x80);
+        v >>= 7;
+    }
+    out += char(v);
+}
+
+uint32_t
+unpack(const char*& p)
+{
+    uint32_t v = 0;
+    for (int shift = 0;; shift += 7) {
+        unsigned char c = *p++;
+        v |= uint32_t(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            return v;
+    }
+}
+
+// Mostly small signed values (jump targets are -1 when unused).
+void
+pack_signed(std::string& out, int v)
+{
+    pack(out, uint32_t(v + 1));
+}
+
+int
+unpack_signed(const char*& p)
+{
+    return int(unpack(p)) - 1;
+}
+
+// The bits an op has when it reads all args but the first and writes
+// only the first, which most ops do.
+const uint32_t usual_argread  = ~1u;
+const uint32_t usual_argwrite = 1u;
+
+}  // namespace
+
+
+
+size_t
+ShaderMaster::compact_code()
+{
+    lock_guard lock(m_code_mutex);
+    if (m_ops.empty() && m_args.empty())
+        return 0;  // Already compacted, or no code
+
+    // Each op refers to its strings (opname, method, source file) by
+    // their index in m_packed_strings.
+    std::unordered_map<ustring, uint32_t> string_index;
+    auto string_ref = [&](ustring s) {
+        auto found = string_index.find(s);
+        if (found != string_index.end())
+            return found->second;
+        uint32_t i = uint32_t(m_packed_strings.size());
+        m_packed_strings.push_back(s);
+        string_index[s] = i;
+        return i;
+    };
+    std::string packed;
+    pack(packed, uint32_t(m_ops.size()));
+    pack(packed, uint32_t(m_args.size()));
+    for (const Opcode& op : m_ops) {
+        pack(packed, string_ref(op.opname()));
+        pack(packed, string_ref(op.method()));
+        pack(packed, string_ref(op.sourcefile()));
+        pack_signed(packed, op.sourceline());
+        pack(packed, uint32_t(op.firstarg()));
+        pack(packed, uint32_t(op.nargs()));
+        for (int j = 0; j < int(Opcode::max_jumps); ++j)
+            pack_signed(packed, op.jump(j));
+        pack(packed, op.argread_bits() ^ usual_argread);
+        pack(packed, op.argwrite_bits() ^ usual_argwrite);
+        pack(packed, op.argtakesderivs_all());
+        pack(packed, uint32_t(op.requires_masking())
+                         | (uint32_t(op.analysis_flag()) << 1));
+    }
+    for (int a : m_args)
+        pack(packed, uint32_t(a));
+    m_packed_code = packed;  // Copied to drop the excess capacity
+
+    size_t opmem     = vectorbytes(m_ops);
+    size_t argmem    = vectorbytes(m_args);
+    size_t packedmem = m_packed_code.capacity()
+                       + vectorbytes(m_packed_strings);
+    OpcodeVec().swap(m_ops);
+    std::vector<int>().swap(m_args);
+    size_t saved = opmem + argmem - std::min(opmem + argmem, packedmem);
+    {
+        ShadingSystemImpl& ss(shadingsys());
+        OIIO::spin_lock lock(ss.m_stat_mutex);
+        ss.m_stat_mem_master_ops += packedmem;
+        ss.m_stat_mem_master_ops -= opmem;
+        ss.m_stat_mem_master_args -= argmem;
+        ss.m_stat_mem_master -= opmem + argmem;
+        ss.m_stat_mem_master += packedmem;
+        ss.m_stat_memory -= opmem + argmem;
+        ss.m_stat_memory += packedmem;
+    }
+    return saved;
+}
+
+
+
+void
+ShaderMaster::copy_code(OpcodeVec& ops, std::vector<int>& args,
+                        size_t headroom)
+{
+    lock_guard lock(m_code_mutex);
+    unpack_code();
+    ops.reserve(m_ops.size() + headroom);
+    args.reserve(m_args.size() + headroom);
+    ops  = m_ops;
+    args = m_args;
+}
+
+
+
+// Restore m_ops and m_args from the compact code, if the code is
+// compacted. The caller must hold m_code_mutex.
+void
+ShaderMaster::unpack_code()
+{
+    if (m_packed_code.empty())
+        return;
+    const char* p = m_packed_code.data();
+    size_t nops  = unpack(p);
+    size_t nargs = unpack(p);
+    m_ops.reserve(nops);
+    m_args.reserve(nargs);
+    for (size_t i = 0; i < nops; ++i) {
+        ustring opname     = m_packed_strings[unpack(p)];
+        ustring method     = m_packed_strings[unpack(p)];
+        ustring sourcefile = m_packed_strings[unpack(p)];
+        int sourceline     = unpack_signed(p);
+        int firstarg       = int(unpack(p));
+        int nargs          = int(unpack(p));
+        m_ops.emplace_back(opname, method, firstarg, nargs);
+        Opcode& op(m_ops.back());
+        op.source(sourcefile, sourceline);
+        int jumps[Opcode::max_jumps];
+        for (int& j : jumps)
+            j = unpack_signed(p);
+        op.set_jump(jumps[0], jumps[1], jumps[2], jumps[3]);
+        uint32_t argread  = unpack(p) ^ usual_argread;
+        uint32_t argwrite = unpack(p) ^ usual_argwrite;
+        op.set_argbits(argread, argwrite, unpack(p));
+        uint32_t flags = unpack(p);
+        op.requires_masking(flags & 1);
+        op.analysis_flag(flags & 2);
+    }
+    for (size_t i = 0; i < nargs; ++i)
+        m_args.push_back(int(unpack(p)));
+
+    size_t packedmem = m_packed_code.capacity()
+                       + vectorbytes(m_packed_strings);
+    std::string().swap(m_packed_code);
+    std::vector<ustring>().swap(m_packed_strings);
+    size_t opmem  = vectorbytes(m_ops);
+    size_t argmem = vectorbytes(m_args);
+    {
+        ShadingSystemImpl& ss(shadingsys());
+        OIIO::spin_lock lock(ss.m_stat_mutex);
+        ss.m_stat_mem_master_ops -= packedmem;
+        ss.m_stat_mem_master_ops += opmem;
+        ss.m_stat_mem_master_args += argmem;
+        ss.m_stat_mem_master += opmem + argmem;
+        ss.m_stat_mem_master -= packedmem;
+        ss.m_stat_memory += opmem + argmem;
+        ss.m_stat_memory -= packedmem;
+    }
+}
+
+
+
 std::string
 ShaderMaster::print()
 {
+    {
+        lock_guard lock(m_code_mutex);
+        unpack_code();
+    }
     std::ostringstream out;
     out.imbue(std::locale::classic());  // force C locale
     out << "Shader " << m_shadername << " type=" << shadertypename() << "\n";
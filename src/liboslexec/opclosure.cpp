@@ -40,18 +40,23 @@ OSL_SHADEOP OSL_HOSTDEVICE const void*
 osl_mul_closure_color(OpaqueExecContextPtr oec, const void* a_, const void* w_)
 {
     const ClosureColor* a = (const ClosureColor*)a_;
-    const Color3* w       = (const Color3*)w_;
+    Color3 w              = *(const Color3*)w_;
     if (a == NULL)
         return NULL;
-    if (w->x == 0.0f && w->y == 0.0f && w->z == 0.0f)
+    // Scaling a scaled closure folds into a single mul
+    if (a->id == ClosureColor::MUL) {
+        w *= a->as_mul()->weight;
+        a = a->as_mul()->closure;
+    }
+    if (w.x == 0.0f && w.y == 0.0f && w.z == 0.0f)
         return NULL;
-    if (w->x == 1.0f && w->y == 1.0f && w->z == 1.0f)
+    if (w.x == 1.0f && w.y == 1.0f && w.z == 1.0f)
         return a;
     ClosureMul* mul = (ClosureMul*)rs_allocate_closure(oec, sizeof(ClosureMul),
                                                        alignof(ClosureMul));
     if (mul) {
         mul->id      = ClosureColor::MUL;
-        mul->weight  = *w;
+        mul->weight  = w;
         mul->closure = a;
     }
     return mul;
@@ -66,6 +71,10 @@ osl_mul_closure_float(OpaqueExecContextPtr oec, const void* a_, float w)
         return NULL;
     if (w == 0.0f)
         return NULL;
+    if (a->id == ClosureColor::MUL) {
+        Color3 cw(w);
+        return osl_mul_closure_color(oec, a, &cw);
+    }
     if (w == 1.0f)
         return a;
     ClosureMul* mul = (ClosureMul*)rs_allocate_closure(oec, sizeof(ClosureMul),
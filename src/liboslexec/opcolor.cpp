@@ -397,6 +397,63 @@ ColorSystem::transformc(ustringhash fromspace, ustringhash tospace,
     return transformc<Color3>(fromspace, tospace, color, ctx, ec);
 }
 
+
+
+#if !defined(__CUDA_ARCH__) && !defined(OSL_COMPILING_TO_BITCODE)
+
+bool
+ColorSystem::affine_transform(ustring fromspace, ustring tospace,
+                              ShadingContext* ctx, Matrix33& M,
+                              Color3& offset) const
+{
+    // Spaces that transformc knows itself; any other pair goes to OCIO,
+    // which must know it (we'd rather not report unknown spaces here).
+    auto builtin = [&](ustring space) {
+        return space == Strings::RGB || space == Strings::rgb
+               || space == Strings::linear
+               || space.hash() == m_colorspace.hash() || space == Strings::hsv
+               || space == Strings::hsl || space == Strings::YIQ
+               || space == Strings::XYZ || space == Strings::xyY
+               || space == Strings::sRGB;
+    };
+    Color3 C;
+    if ((!builtin(fromspace) || !builtin(tospace))
+        && !ctx->ocio_transform(fromspace, tospace, Color3(0.0f), C))
+        return false;
+
+    // Find the offset and the matrix rows from the images of the origin
+    // and the unit colors, then check that other colors, over a wide
+    // range and including negatives, land where the affine map says.
+    offset = transformc(fromspace, tospace, Color3(0.0f), ctx);
+    M      = Matrix33();
+    for (int i = 0; i < 3; ++i) {
+        Color3 e(0.0f);
+        e[i]       = 1.0f;
+        Color3 row = transformc(fromspace, tospace, e, ctx) - offset;
+        M[i][0]    = row[0];
+        M[i][1]    = row[1];
+        M[i][2]    = row[2];
+    }
+    static const Color3 probes[] = { Color3(0.18f, 0.18f, 0.18f),
+                                     Color3(0.9f, 0.05f, 0.4f),
+                                     Color3(2.5f, -0.3f, 0.7f),
+                                     Color3(0.02f, 4.0f, 1.3f),
+                                     Color3(50.0f, 0.5f, 10.0f),
+                                     Color3(0.001f, 0.002f, 0.0005f) };
+    for (const Color3& p : probes) {
+        Color3 expected = p * M + offset;
+        Color3 actual   = transformc(fromspace, tospace, p, ctx);
+        for (int c = 0; c < 3; ++c) {
+            float tol = 1.0e-4f * std::max(1.0f, std::abs(expected[c]));
+            if (!(std::abs(actual[c] - expected[c]) <= tol))
+                return false;
+        }
+    }
+    return true;
+}
+
+#endif
+
 }  // namespace pvt
 
 
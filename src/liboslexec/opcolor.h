@@ -116,6 +116,19 @@ public:
         return m_colorspace;
     }
 
+#ifndef __CUDACC__
+    /// If transformc from fromspace to tospace is affine, Cout = Cin * M +
+    /// offset, as the conversions among the built-in linear spaces and
+    /// most OCIO transforms between scene-linear spaces are, set M and
+    /// offset and return true, so that the runtime optimizer can do the
+    /// arithmetic inline instead of calling transformc. Return false for
+    /// nonlinear or unknown transforms (leaving unknown ones to report
+    /// their error when the shader runs).
+    bool affine_transform(ustring fromspace, ustring tospace,
+                          ShadingContext* ctx, Matrix33& M,
+                          Color3& offset) const;
+#endif
+
 private:
     template<typename Color>
     OSL_HOSTDEVICE inline Color
@@ -154,10 +167,15 @@ private:
     std::shared_ptr<OIIO::ColorConfig>
         m_colorconfig;  ///< OIIO/OCIO color configuration
 
-    // 1-item cache for the last requested custom color conversion processor
-    OIIO::ColorProcessorHandle m_last_colorproc;
-    ustring m_last_colorproc_fromspace;
-    ustring m_last_colorproc_tospace;
+    // Small cache of the last requested custom color conversion
+    // processors, most recent first, so that shaders alternating among a
+    // few transforms don't recreate processors.
+    static constexpr int colorproc_cache_size = 4;
+    struct CachedColorProcessor {
+        ustring fromspace, tospace;
+        OIIO::ColorProcessorHandle processor;
+    };
+    CachedColorProcessor m_colorprocs[colorproc_cache_size];
 #endif
 };
 
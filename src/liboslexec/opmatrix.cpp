@@ -137,6 +137,47 @@ osl_transformn_dvmdv(void* result, void* M_, void* v_)
 }
 
 #ifndef __CUDACC__
+// Fetch the matrix from (inverse=false) or to (inverse=true) common space
+// of a named space, "shader" or "object", from the renderer, or from the
+// context's cache if this execution already fetched it.
+static int
+get_space_matrix(OpaqueExecContextPtr oec, Matrix44& M, ustringhash space,
+                 bool inverse)
+{
+    ShadingContext* ctx = pvt::get_ec(oec)->context;
+    int ok              = true;
+    if (ctx->find_cached_matrix(space, inverse, M, ok))
+        return ok;
+    // With the matrix from the space already in hand, its inverse is one
+    // invert away, which is all the renderer would do by default.
+    int from_ok = false;
+    if (inverse && ctx->find_cached_matrix(space, false, M, from_ok)
+        && from_ok) {
+        M.invert();
+        ctx->cache_matrix(space, true, M, true);
+        return true;
+    }
+    float time = get_time(oec);
+    if (space == Hashes::shader || space == Hashes::object) {
+        TransformationPtr xform = space == Hashes::shader
+                                      ? get_shader2common(oec)
+                                      : get_object2common(oec);
+        if (inverse)
+            rs_get_inverse_matrix_xform_time(oec, M, xform, time);
+        else
+            rs_get_matrix_xform_time(oec, M, xform, time);
+    } else {
+        ok = inverse ? rs_get_inverse_matrix_space_time(oec, M, space, time)
+                     : rs_get_matrix_space_time(oec, M, space, time);
+        if (!ok)
+            M.makeIdentity();
+    }
+    ctx->cache_matrix(space, inverse, M, ok);
+    return ok;
+}
+
+
+
 OSL_SHADEOP int
 osl_get_matrix(OpaqueExecContextPtr oec, void* r, ustringhash_pod from_)
 {
@@ -145,19 +186,8 @@ osl_get_matrix(OpaqueExecContextPtr oec, void* r, ustringhash_pod from_)
         MAT(r).makeIdentity();
         return true;
     }
-    if (from == Hashes::shader) {
-        rs_get_matrix_xform_time(oec, MAT(r), get_shader2common(oec),
-                                 get_time(oec));
-        return true;
-    }
-    if (from == Hashes::object) {
-        rs_get_matrix_xform_time(oec, MAT(r), get_object2common(oec),
-                                 get_time(oec));
-        return true;
-    }
-    int ok = rs_get_matrix_space_time(oec, MAT(r), from, get_time(oec));
+    int ok = get_space_matrix(oec, MAT(r), from, false);
     if (!ok) {
-        MAT(r).makeIdentity();
         if (get_unknown_coordsys_error(oec)) {
             OSL::errorfmt(oec, "Unknown transformation \"{}\"", from);
         }
@@ -175,19 +205,8 @@ osl_get_inverse_matrix(OpaqueExecContextPtr oec, void* r, ustringhash_pod to_)
         MAT(r).makeIdentity();
         return true;
     }
-    if (to == Hashes::shader) {
-        rs_get_inverse_matrix_xform_time(oec, MAT(r), get_shader2common(oec),
-                                         get_time(oec));
-        return true;
-    }
-    if (to == Hashes::object) {
-        rs_get_inverse_matrix_xform_time(oec, MAT(r), get_object2common(oec),
-                                         get_time(oec));
-        return true;
-    }
-    int ok = rs_get_inverse_matrix_space_time(oec, MAT(r), to, get_time(oec));
+    int ok = get_space_matrix(oec, MAT(r), to, true);
     if (!ok) {
-        MAT(r).makeIdentity();
         if (get_unknown_coordsys_error(oec)) {
             OSL::errorfmt(oec, "Unknown transformation \"{}\"", to);
         }
@@ -3,7 +3,10 @@
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
 #include <limits>
+#include <memory>
+#include <unordered_map>
 
+#include "fractal_noise.h"
 #include "oslexec_pvt.h"
 #include <OSL/Imathx/Imathx.h>
 #include <OSL/dual_vec.h>
@@ -270,6 +273,12 @@ NOISE_IMPL (simplexnoise, SimplexNoise)
 NOISE_IMPL_DERIV (simplexnoise, SimplexNoise)
 NOISE_IMPL (usimplexnoise, USimplexNoise)
 NOISE_IMPL_DERIV (usimplexnoise, USimplexNoise)
+NOISE_IMPL (voronoinoise, VoronoiNoise)
+NOISE_IMPL_DERIV (voronoinoise, VoronoiNoise)
+NOISE_IMPL (noise_pcg, NoisePCG)
+NOISE_IMPL_DERIV (noise_pcg, NoisePCG)
+NOISE_IMPL (snoise_pcg, SNoisePCG)
+NOISE_IMPL_DERIV (snoise_pcg, SNoisePCG)
 
 
 
@@ -637,6 +646,271 @@ NOISE_IMPL_DERIV_OPT(gabornoise, GaborNoise)
 PNOISE_IMPL_DERIV_OPT(gaborpnoise, GaborPNoise)
 
 
+
+// The fractal noise types, summing the octaves with FractalSum.
+struct FractalNoise {
+    OSL_HOSTDEVICE FractalNoise() {}
+
+    // Like gabor, fractal noise takes options, so dual versions only
+
+    template<class R, class S>
+    OSL_HOSTDEVICE inline void operator()(ustringhash name, Dual2<R>& result,
+                                          const Dual2<S>& s,
+                                          ShaderGlobals* /*sg*/,
+                                          const NoiseParams* opt) const
+    {
+        FractalSum<SNoise> fsum;
+        fsum(name != Hashes::fbm, name == Hashes::ridged, result, s, opt);
+    }
+
+    template<class R, class S, class T>
+    OSL_HOSTDEVICE inline void operator()(ustringhash name, Dual2<R>& result,
+                                          const Dual2<S>& s, const Dual2<T>& t,
+                                          ShaderGlobals* /*sg*/,
+                                          const NoiseParams* opt) const
+    {
+        FractalSum<SNoise> fsum;
+        fsum(name != Hashes::fbm, name == Hashes::ridged, result, s, t, opt);
+    }
+};
+
+
+
+NOISE_IMPL_DERIV_OPT(fractalnoise, FractalNoise)
+
+
+
+// Evaluate the noise that "baked" caches: "bake_type" names uperlin (the
+// default), perlin or one of the fractal types.
+template<class R, class... S>
+OSL_HOSTDEVICE inline void
+baked_source(Dual2<R>& result, const NoiseParams* opt, const S&... s)
+{
+    ustringhash type = opt->bake_type;
+    if (type == Hashes::perlin || type == Hashes::snoise) {
+        SNoise snoise;
+        snoise(result, s...);
+    } else if (type == Hashes::fbm || type == Hashes::turbulence
+               || type == Hashes::ridged) {
+        FractalNoise fnoise;
+        fnoise(type, result, s..., nullptr, opt);
+    } else {
+        Noise noise;
+        noise(result, s...);
+    }
+}
+
+
+
+#ifndef __CUDA_ARCH__
+// Sparse cache of baked noise volumes.  Space is cut into tiles of
+// baked_tile_cells^3 cells of 1/bake_res, each holding the source noise at
+// its (baked_tile_cells+1)^3 corners, made on first touch and kept for the
+// life of the process, up to baked_max_tiles tiles.
+static constexpr int baked_tile_shift   = 4;
+static constexpr int baked_tile_cells   = 1 << baked_tile_shift;
+static constexpr int baked_tile_samples = baked_tile_cells + 1;
+static constexpr size_t baked_max_tiles = 4096;
+
+struct BakedTileKey {
+    ustringhash type;
+    int octaves;
+    float lacunarity, gain;
+    int res, channels;
+    int tx, ty, tz;
+
+    bool operator==(const BakedTileKey& k) const
+    {
+        return type == k.type && octaves == k.octaves
+               && lacunarity == k.lacunarity && gain == k.gain
+               && res == k.res && channels == k.channels && tx == k.tx
+               && ty == k.ty && tz == k.tz;
+    }
+};
+
+struct BakedTileKeyHasher {
+    size_t operator()(const BakedTileKey& k) const
+    {
+        unsigned int h = inthash(unsigned(k.tx), unsigned(k.ty),
+                                 unsigned(k.tz), unsigned(k.res));
+        h = inthash(h, unsigned(k.octaves), bitcast_to_uint(k.lacunarity),
+                    bitcast_to_uint(k.gain));
+        return size_t(k.type.hash()) ^ h ^ size_t(k.channels);
+    }
+};
+
+static OIIO::spin_rw_mutex baked_tiles_mutex;
+static std::unordered_map<BakedTileKey, std::unique_ptr<float[]>,
+                          BakedTileKeyHasher>
+    baked_tiles;
+
+
+
+// Find or bake the tile for key, or return nullptr if the cache is full.
+static const float*
+baked_tile(const BakedTileKey& key, const NoiseParams* opt)
+{
+    {
+        OIIO::spin_rw_read_lock lock(baked_tiles_mutex);
+        auto found = baked_tiles.find(key);
+        if (found != baked_tiles.end())
+            return found->second.get();
+        if (baked_tiles.size() >= baked_max_tiles)
+            return nullptr;
+    }
+
+    // Bake outside the lock; if another thread wins the race to insert,
+    // ours is simply discarded.  The corners have no derivatives, so the
+    // fractal types sum every octave.
+    const int n = baked_tile_samples;
+    std::unique_ptr<float[]> tile(new float[n * n * n * key.channels]);
+    float* t       = tile.get();
+    float cellsize = 1.0f / key.res;
+    for (int k = 0; k < n; ++k)
+        for (int j = 0; j < n; ++j)
+            for (int i = 0; i < n; ++i) {
+                Vec3 p((key.tx * baked_tile_cells + i) * cellsize,
+                       (key.ty * baked_tile_cells + j) * cellsize,
+                       (key.tz * baked_tile_cells + k) * cellsize);
+                if (key.channels == 1) {
+                    Dual2<float> r;
+                    baked_source(r, opt, Dual2<Vec3>(p));
+                    *t++ = r.val();
+                } else {
+                    Dual2<Vec3> r;
+                    baked_source(r, opt, Dual2<Vec3>(p));
+                    *t++ = r.val().x;
+                    *t++ = r.val().y;
+                    *t++ = r.val().z;
+                }
+            }
+
+    OIIO::spin_rw_write_lock lock(baked_tiles_mutex);
+    auto inserted = baked_tiles.emplace(key, std::move(tile));
+    return inserted.first->second.get();
+}
+
+
+
+inline void
+baked_assign(Dual2<float>& result, const Dual2<float>* c)
+{
+    result = c[0];
+}
+
+inline void
+baked_assign(Dual2<Vec3>& result, const Dual2<float>* c)
+{
+    result = make_Vec3(c[0], c[1], c[2]);
+}
+
+
+
+// Trilinear lookup of the baked volume at p, with derivatives carried
+// through the interpolation weights.  Returns false if p can't be served
+// from the cache.
+template<class R>
+inline bool
+baked_lookup(Dual2<R>& result, const Dual2<Vec3>& p, const NoiseParams* opt)
+{
+    constexpr int channels = std::is_same<R, float>::value ? 1 : 3;
+    if (opt->bake_res < 1)
+        return false;
+    Dual2<Vec3> q = p * float(opt->bake_res);
+    Dual2<float> qx = comp_x(q), qy = comp_y(q), qz = comp_z(q);
+    const float limit = float(1 << 30);
+    if (!(fabsf(qx.val()) < limit && fabsf(qy.val()) < limit
+          && fabsf(qz.val()) < limit))
+        return false;
+    int ix = OIIO::ifloor(qx.val());
+    int iy = OIIO::ifloor(qy.val());
+    int iz = OIIO::ifloor(qz.val());
+
+    BakedTileKey key { opt->bake_type,
+                       opt->octaves,
+                       opt->lacunarity,
+                       opt->gain,
+                       opt->bake_res,
+                       channels,
+                       ix >> baked_tile_shift,
+                       iy >> baked_tile_shift,
+                       iz >> baked_tile_shift };
+    const float* tile = baked_tile(key, opt);
+    if (!tile)
+        return false;
+
+    const int n         = baked_tile_samples;
+    const int mask      = baked_tile_cells - 1;
+    const float* corner = tile
+                          + (((iz & mask) * n + (iy & mask)) * n + (ix & mask))
+                                * channels;
+    Dual2<float> fx = qx - float(ix), fy = qy - float(iy), fz = qz - float(iz);
+    const int dx = channels, dy = n * channels, dz = n * n * channels;
+    Dual2<float> c[channels];
+    for (int ch = 0; ch < channels; ++ch) {
+        const float* v    = corner + ch;
+        Dual2<float> x00 = v[0] + (v[dx] - v[0]) * fx;
+        Dual2<float> x10 = v[dy] + (v[dy + dx] - v[dy]) * fx;
+        Dual2<float> x01 = v[dz] + (v[dz + dx] - v[dz]) * fx;
+        Dual2<float> x11 = v[dz + dy] + (v[dz + dy + dx] - v[dz + dy]) * fx;
+        Dual2<float> y0  = x00 + (x10 - x00) * fy;
+        Dual2<float> y1  = x01 + (x11 - x01) * fy;
+        c[ch]            = y0 + (y1 - y0) * fz;
+    }
+    baked_assign(result, c);
+    return true;
+}
+#endif
+
+
+
+// Noise whose 3D point lookups are trilinear fetches from a sparse volume
+// of the "bake_type" noise, sampled "bake_res" times per unit and baked on
+// first use.  For static objects whose noise coordinate doesn't change,
+// this trades a little accuracy for not re-evaluating the noise at every
+// shade.  Other input dimensions, and GPUs, evaluate the noise directly.
+struct BakedNoise {
+    OSL_HOSTDEVICE BakedNoise() {}
+
+    template<class R, class S>
+    OSL_HOSTDEVICE inline void operator()(ustringhash /*name*/,
+                                          Dual2<R>& result, const Dual2<S>& s,
+                                          ShaderGlobals* /*sg*/,
+                                          const NoiseParams* opt) const
+    {
+        baked_source(result, opt, s);
+    }
+
+    template<class R>
+    OSL_HOSTDEVICE inline void operator()(ustringhash /*name*/,
+                                          Dual2<R>& result,
+                                          const Dual2<Vec3>& p,
+                                          ShaderGlobals* /*sg*/,
+                                          const NoiseParams* opt) const
+    {
+#ifndef __CUDA_ARCH__
+        if (baked_lookup(result, p, opt))
+            return;
+#endif
+        baked_source(result, opt, p);
+    }
+
+    template<class R, class S, class T>
+    OSL_HOSTDEVICE inline void operator()(ustringhash /*name*/,
+                                          Dual2<R>& result, const Dual2<S>& s,
+                                          const Dual2<T>& t,
+                                          ShaderGlobals* /*sg*/,
+                                          const NoiseParams* opt) const
+    {
+        baked_source(result, opt, s, t);
+    }
+};
+
+
+
+NOISE_IMPL_DERIV_OPT(bakednoise, BakedNoise)
+
+
 // Turn off warnings about unused params, since the NullNoise methods are stubs.
 OSL_PRAGMA_WARNING_PUSH
 OSL_GCC_PRAGMA(GCC diagnostic ignored "-Wunused-parameter")
@@ -728,6 +1002,9 @@ struct GenericNoise {
                    || name == Hashes::usimplex) {
             USimplexNoise usimplexnoise;
             usimplexnoise(result, s);
+        } else if (name == Hashes::voronoi || name == Hashes::worley) {
+            VoronoiNoise voronoinoise;
+            voronoinoise(result, s);
         } else if (name == Hashes::cell) {
             CellNoise cellnoise;
             cellnoise(result.val(), s.val());
@@ -735,6 +1012,13 @@ struct GenericNoise {
         } else if (name == Hashes::gabor) {
             GaborNoise gnoise;
             gnoise(name, result, s, sg, opt);
+        } else if (name == Hashes::fbm || name == Hashes::turbulence
+                   || name == Hashes::ridged) {
+            FractalNoise fnoise;
+            fnoise(name, result, s, sg, opt);
+        } else if (name == Hashes::baked) {
+            BakedNoise bnoise;
+            bnoise(name, result, s, sg, opt);
         } else if (name == Hashes::null) {
             NullNoise noise;
             noise(result, s);
@@ -776,6 +1060,9 @@ struct GenericNoise {
                    || name == Hashes::usimplex) {
             USimplexNoise usimplexnoise;
             usimplexnoise(result, s, t);
+        } else if (name == Hashes::voronoi || name == Hashes::worley) {
+            VoronoiNoise voronoinoise;
+            voronoinoise(result, s, t);
         } else if (name == Hashes::cell) {
             CellNoise cellnoise;
             cellnoise(result.val(), s.val(), t.val());
@@ -783,6 +1070,13 @@ struct GenericNoise {
         } else if (name == Hashes::gabor) {
             GaborNoise gnoise;
             gnoise(name, result, s, t, sg, opt);
+        } else if (name == Hashes::fbm || name == Hashes::turbulence
+                   || name == Hashes::ridged) {
+            FractalNoise fnoise;
+            fnoise(name, result, s, t, sg, opt);
+        } else if (name == Hashes::baked) {
+            BakedNoise bnoise;
+            bnoise(name, result, s, t, sg, opt);
         } else if (name == Hashes::null) {
             NullNoise noise;
             noise(result, s, t);
@@ -935,6 +1229,46 @@ osl_noiseparams_set_impulses(void* opt, float i)
 
 
 
+OSL_SHADEOP OSL_HOSTDEVICE void
+osl_noiseparams_set_octaves(void* opt, int o)
+{
+    ((NoiseParams*)opt)->octaves = o;
+}
+
+
+
+OSL_SHADEOP OSL_HOSTDEVICE void
+osl_noiseparams_set_lacunarity(void* opt, float l)
+{
+    ((NoiseParams*)opt)->lacunarity = l;
+}
+
+
+
+OSL_SHADEOP OSL_HOSTDEVICE void
+osl_noiseparams_set_gain(void* opt, float g)
+{
+    ((NoiseParams*)opt)->gain = g;
+}
+
+
+
+OSL_SHADEOP OSL_HOSTDEVICE void
+osl_noiseparams_set_bake_type(void* opt, ustringhash_pod t)
+{
+    ((NoiseParams*)opt)->bake_type = ustringhash_from(t);
+}
+
+
+
+OSL_SHADEOP OSL_HOSTDEVICE void
+osl_noiseparams_set_bake_res(void* opt, int r)
+{
+    ((NoiseParams*)opt)->bake_res = r;
+}
+
+
+
 OSL_SHADEOP void
 osl_count_noise(void* sg_)
 {
@@ -132,6 +132,41 @@ osl_substr_ssii(ustringhash_pod s_, int start, int length)
 }
 
 
+
+// concat and substr as the CPU code calls them, through the context's memo
+// of recent results.
+OSL_SHADEOP ustringhash_pod
+osl_concat_memo(void* sg_, ustringhash_pod s_, ustringhash_pod t_)
+{
+    ShadingContext* ctx = ((ShaderGlobals*)sg_)->context;
+    using Memo          = ShadingContext::StringMemo;
+    Memo& memo          = ctx->string_memo(Memo::Concat, s_, t_);
+    if (!memo.holds(Memo::Concat, s_, t_)) {
+        memo.result = osl_concat_sss(s_, t_);
+        memo.op     = Memo::Concat;
+        memo.a      = s_;
+        memo.b      = t_;
+    }
+    return memo.result;
+}
+
+OSL_SHADEOP ustringhash_pod
+osl_substr_memo(void* sg_, ustringhash_pod s_, int start, int length)
+{
+    ShadingContext* ctx = ((ShaderGlobals*)sg_)->context;
+    using Memo          = ShadingContext::StringMemo;
+    uint64_t range      = (uint64_t(uint32_t(start)) << 32) | uint32_t(length);
+    Memo& memo          = ctx->string_memo(Memo::Substr, s_, range);
+    if (!memo.holds(Memo::Substr, s_, range)) {
+        memo.result = osl_substr_ssii(s_, start, length);
+        memo.op     = Memo::Substr;
+        memo.a      = s_;
+        memo.b      = range;
+    }
+    return memo.result;
+}
+
+
 OSL_SHADEOP int
 osl_regex_impl(void* sg_, ustringhash_pod subject_, void* results, int nresults,
                ustringhash_pod pattern_, int fullmatch)
@@ -143,28 +178,8 @@ osl_regex_impl(void* sg_, ustringhash_pod subject_, void* results, int nresults,
     const std::string& subject(subject_ustr.string());
     ustringhash pattern_hash = ustringhash_from(pattern_);
     ustring pattern          = ustring_from(pattern_hash);
-    std::match_results<std::string::const_iterator> mresults;
-    const std::regex& regex(ctx->find_regex(pattern));
-    if (nresults > 0) {
-        std::string::const_iterator start = subject.begin();
-        int res = fullmatch ? std::regex_match(subject, mresults, regex)
-                            : std::regex_search(subject, mresults, regex);
-        int* m  = (int*)results;
-        for (int r = 0; r < nresults; ++r) {
-            if (r / 2 < (int)mresults.size()) {
-                if ((r & 1) == 0)
-                    m[r] = mresults[r / 2].first - start;
-                else
-                    m[r] = mresults[r / 2].second - start;
-            } else {
-                m[r] = pattern.length();
-            }
-        }
-        return res;
-    } else {
-        return fullmatch ? std::regex_match(subject, regex)
-                         : std::regex_search(subject, regex);
-    }
+    return ctx->find_regex(pattern).match(subject, fullmatch, (int*)results,
+                                          nresults);
 }
 
 // TODO: transition format to from llvm_gen_printf_legacy
@@ -244,5 +259,17 @@ osl_formatfmt(OpaqueExecContextPtr exec_ctx,
 }
 
 
+
+// format() with a constant format, whose plan was made when generating the
+// code, formatted through the context's memo of recent results.
+OSL_RSOP OSL::ustringhash_pod
+osl_formatfmt_plan(OpaqueExecContextPtr exec_ctx, void* plan,
+                   uint8_t* arg_values)
+{
+    ShadingContext* ctx = pvt::get_ec(exec_ctx)->context;
+    return ctx->format(*reinterpret_cast<const FormatPlan*>(plan), arg_values);
+}
+
+
 }  // end namespace pvt
 OSL_NAMESPACE_END
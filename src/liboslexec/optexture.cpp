@@ -25,6 +25,45 @@ OSL_NAMESPACE_BEGIN
 namespace pvt {
 
 
+#ifndef __CUDA_ARCH__
+const UdimTileTable*
+ShadingSystemImpl::udim_tile_table(TextureSystem::TextureHandle* handle,
+                                   TextureSystem::Perthread* thread_info)
+{
+    {
+        spin_lock lock(m_udim_tables_mutex);
+        auto found = m_udim_tables.find(handle);
+        if (found != m_udim_tables.end())
+            return found->second.get();
+    }
+
+    // Resolve every tile, at its center, outside the lock. If another
+    // thread got there first, its table wins.
+    std::unique_ptr<UdimTileTable> table;
+    TextureSystem* ts = texturesys();
+    if (m_udim_tile_cache && ts && handle && ts->is_udim(handle)) {
+        std::vector<ustring> filenames;
+        int nutiles = 0, nvtiles = 0;
+        ts->inventory_udim(handle, thread_info, filenames, nutiles, nvtiles);
+        if (nutiles > 0 && nvtiles > 0) {
+            table.reset(new UdimTileTable);
+            table->nutiles = nutiles;
+            table->nvtiles = nvtiles;
+            table->tiles.resize(size_t(nutiles) * size_t(nvtiles));
+            for (int v = 0; v < nvtiles; ++v)
+                for (int u = 0; u < nutiles; ++u)
+                    table->tiles[v * nutiles + u]
+                        = ts->resolve_udim(handle, thread_info, u + 0.5f,
+                                           v + 0.5f);
+        }
+    }
+    spin_lock lock(m_udim_tables_mutex);
+    return m_udim_tables.emplace(handle, std::move(table)).first->second.get();
+}
+#endif
+
+
+
 OSL_SHADEOP OSL_HOSTDEVICE void
 osl_init_texture_options(OpaqueExecContextPtr oec, void* opt)
 {
@@ -299,6 +338,16 @@ osl_texture(OpaqueExecContextPtr oec, ustringhash_pod name_, void* handle,
     bool derivs                   = (dresultdx || dalphadx);
 #ifndef __CUDA_ARCH__
     ShaderGlobals* sg = (ShaderGlobals*)oec;
+    sg->context->incr_telemetry_textures();
+    // Look UDIM textures up in the tile (s,t) falls in directly.
+    if (handle) {
+        if (const UdimTileTable* udim = sg->context->udim_tile_table(
+                (TextureSystem::TextureHandle*)handle)) {
+            int tile = udim->tile(s, t);
+            if (tile >= 0)
+                handle = udim->tiles[tile];
+        }
+    }
 #endif
     // It's actually faster to ask for 4 channels (even if we need fewer)
     // and ensure that they're being put in aligned memory.
@@ -378,6 +427,7 @@ osl_texture3d(OpaqueExecContextPtr oec, ustringhash_pod name_, void* handle,
     bool derivs                   = (dresultdx || dalphadx);
 #ifndef __CUDA_ARCH__
     ShaderGlobals* sg = (ShaderGlobals*)oec;
+    sg->context->incr_telemetry_textures();
 #endif
     // It's actually faster to ask for 4 channels (even if we need fewer)
     // and ensure that they're being put in aligned memory.
@@ -454,6 +504,7 @@ osl_environment(OpaqueExecContextPtr oec, ustringhash_pod name_, void* handle,
     ustringhash_pod* errormessage = (ustringhash_pod*)errormessage_;
 #ifndef __CUDA_ARCH__
     ShaderGlobals* sg = (ShaderGlobals*)oec;
+    sg->context->incr_telemetry_textures();
 #endif
     // It's actually faster to ask for 4 channels (even if we need fewer)
     // and ensure that they're being put in aligned memory.
@@ -629,6 +680,15 @@ osl_trace(OpaqueExecContextPtr oec, void* opt_, void* Pos_, void* dPosdx_,
     const Vec3* Dir    = (Vec3*)Dir_;
     const Vec3* dDirdx = dDirdx_ ? (Vec3*)dDirdx_ : &Zero;
     const Vec3* dDirdy = dDirdy_ ? (Vec3*)dDirdy_ : &Zero;
+#ifndef __CUDA_ARCH__
+    // Noted for, or answered by, ShadingSystem::execute_deferred_trace
+    ShaderGlobals* sg = (ShaderGlobals*)oec;
+    bool hit;
+    if (sg->context->deferring_trace()
+        && sg->context->deferred_trace(*opt, sg, *Pos, *dPosdx, *dPosdy, *Dir,
+                                       *dDirdx, *dDirdy, hit))
+        return hit;
+#endif
     return rs_trace(oec, *opt, *Pos, *dPosdx, *dPosdy, *Dir, *dDirdx, *dDirdy);
 }
 
@@ -0,0 +1,746 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <algorithm>
+#include <cstring>
+#include <tuple>
+
+#include <OpenImageIO/filesystem.h>
+#include <OpenImageIO/strutil.h>
+
+#include "oslexec_pvt.h"
+#include "runtimeoptimize.h"
+using namespace OSL;
+using namespace OSL::pvt;
+
+
+// Snapshots of optimized groups (see the "opt_snapshot_dir" attribute).
+//
+// A snapshot holds, for each layer of a group, everything the optimizer
+// leaves in the instance for the backend: ops, args, symbols, parameter
+// values, overrides, connections and layer flags, plus the group's shared
+// noise slots. The summaries the group keeps of what it needs (textures,
+// userdata, attributes, the interactive parameter block, ...) are not
+// saved, since run() gathers them from the layers either way.
+//
+// The file is the key it was made for (which must match exactly, so a
+// hash collision can't load the wrong group) followed by the layers, in
+// 32-bit words in the byte order of the machine that wrote it. Strings are
+// a length and their characters, padded to a whole word. It is only ever
+// read by the same build of OSL that wrote it, since the OSL version is
+// part of the key.
+
+namespace {
+
+const char snapshot_magic[8] = { 'O', 'S', 'L', 'S', 'N', 'A', 'P', '\n' };
+const uint32_t endian_tag    = 0x01020304;
+
+// Where a symbol's value lives.
+enum DataKind : uint32_t {
+    NoData,      // No value (or not in the Absolute arena)
+    IntParams,   // At an index of the instance's int params
+    FloatParams, // ... float params
+    StringParams,// ... string params
+    Values       // Its own values, saved in the snapshot
+};
+
+
+
+class SnapshotWriter {
+public:
+    void u32(uint32_t v) { m_out.append((const char*)&v, sizeof(v)); }
+    void i32(int v) { u32(uint32_t(v)); }
+    void f32(float f)
+    {
+        uint32_t u;
+        memcpy(&u, &f, sizeof(u));
+        u32(u);
+    }
+    void str(string_view s)
+    {
+        u32(uint32_t(s.size()));
+        m_out.append(s.data(), s.size());
+        m_out.append((4 - s.size() % 4) % 4, '\0');
+    }
+    void typespec(const TypeSpec& t)
+    {
+        TypeDesc d = t.simpletype();
+        u32(d.basetype);
+        u32(d.aggregate);
+        u32(d.vecsemantics);
+        i32(d.arraylen);
+        u32(t.is_closure_based());
+        str(t.structure() ? t.structspec()->name().string() : std::string());
+    }
+    void connected_param(const ConnectedParam& c)
+    {
+        i32(c.param);
+        i32(c.arrayindex);
+        i32(c.channel);
+        typespec(c.type);
+    }
+    const std::string& out() const { return m_out; }
+
+private:
+    std::string m_out;
+};
+
+
+
+class SnapshotReader {
+public:
+    SnapshotReader(string_view data) : m_data(data) {}
+
+    bool ok() const { return m_ok; }
+    bool done() const { return m_ok && m_data.empty(); }
+
+    uint32_t u32()
+    {
+        uint32_t v = 0;
+        if (m_data.size() < sizeof(v))
+            m_ok = false;
+        else
+            memcpy(&v, m_data.data(), sizeof(v));
+        m_data.remove_prefix(std::min(m_data.size(), sizeof(v)));
+        return v;
+    }
+    int i32() { return int(u32()); }
+    float f32()
+    {
+        uint32_t u = u32();
+        float f;
+        memcpy(&f, &u, sizeof(f));
+        return f;
+    }
+    // A count of things no smaller than `size` bytes each, checked against
+    // what is left so that a corrupt count can't make us allocate wildly.
+    size_t count(size_t size = 4)
+    {
+        size_t n = u32();
+        if (n > m_data.size() / size)
+            m_ok = false;
+        return m_ok ? n : 0;
+    }
+    string_view str()
+    {
+        size_t n      = count(1);
+        size_t padded = (n + 3) / 4 * 4;
+        if (padded > m_data.size()) {
+            m_ok = false;
+            return {};
+        }
+        string_view s = m_data.substr(0, n);
+        m_data.remove_prefix(padded);
+        return s;
+    }
+    TypeSpec typespec()
+    {
+        TypeDesc d;
+        d.basetype         = (unsigned char)u32();
+        d.aggregate        = (unsigned char)u32();
+        d.vecsemantics     = (unsigned char)u32();
+        d.arraylen         = i32();
+        bool closure       = u32();
+        string_view sname  = str();
+        if (sname.size())
+            return TypeSpec(std::string(sname).c_str(), 0, d.arraylen);
+        if (closure) {
+            TypeSpec t(TypeDesc::UNKNOWN, true);
+            t.make_array(d.arraylen);
+            return t;
+        }
+        return TypeSpec(d);
+    }
+    ConnectedParam connected_param()
+    {
+        ConnectedParam c;
+        c.param      = i32();
+        c.arrayindex = i32();
+        c.channel    = i32();
+        c.type       = typespec();
+        return c;
+    }
+
+private:
+    string_view m_data;
+    bool m_ok = true;
+};
+
+
+
+// The symbol flags, one bit each.
+enum SymFlags : uint32_t {
+    HasDerivs      = 1 << 0,
+    ConnectedDown  = 1 << 1,
+    Initialized    = 1 << 2,
+    Interpolated   = 1 << 3,
+    Interactive    = 1 << 4,
+    Noninteractive = 1 << 5,
+    Allowconnect   = 1 << 6,
+    RendererOutput = 1 << 7,
+    Readonly       = 1 << 8,
+    Varying        = 1 << 9,
+    ForcedBool     = 1 << 10,
+    Absolute       = 1 << 11,
+};
+
+// The layer flags.
+enum LayerFlags : uint32_t {
+    WritesGlobals       = 1 << 0,
+    UserdataParams      = 1 << 1,
+    OutgoingConnections = 1 << 2,
+    RendererOutputs     = 1 << 3,
+    HasErrorOp          = 1 << 4,
+    HasTraceOp          = 1 << 5,
+    MergedUnused        = 1 << 6,
+    LastLayer           = 1 << 7,
+    EntryLayer          = 1 << 8,
+};
+
+}  // namespace
+
+
+
+std::string
+RuntimeOptimizer::snapshot_filename()
+{
+    // The optimized layers depend on the shaders themselves, on the
+    // group's layers, connections, parameter values and attributes (all in
+    // its canonical hash), on the ray types this optimization assumes, and
+    // on the options.
+    uint64_t grouphash = group().canonical_hash();
+    if (!grouphash)
+        return std::string();
+    m_snapshot_key = fmtformat("{}\n{:016x} {} {}\n{}\n", OSL_LIBRARY_VERSION_STRING,
+                               grouphash, m_raytypes_on, m_raytypes_off,
+                               shadingsys().options_summary());
+    for (auto&& o : group().pass_outputs())
+        m_snapshot_key += fmtformat("pass {}\n", o);
+    for (int i = 0, e = group().nlayers(); i < e; ++i) {
+        const ShaderMaster* m = group()[i]->master();
+        std::time_t mtime     = 0;
+        if (m->oso_hash() == 0)
+            mtime = OIIO::Filesystem::last_write_time(m->osofilename());
+        m_snapshot_key += fmtformat("shader {} {} {:016x} {}\n",
+                                    m->shadername(), m->osofilename(),
+                                    m->oso_hash(), (long long)mtime);
+    }
+    std::string name = fmtformat("{:016x}.oslsnap",
+                                 Strutil::strhash(m_snapshot_key));
+    if (shadingsys().opt_snapshot_dir().empty())
+        return name;  // Only kept in the registry
+    return fmtformat("{}/{}", shadingsys().opt_snapshot_dir(), name);
+}
+
+
+
+void
+RuntimeOptimizer::write_snapshot(const std::string& filename)
+{
+    SnapshotWriter w;
+    w.str(string_view(snapshot_magic, sizeof(snapshot_magic)));
+    w.u32(endian_tag);
+    w.str(m_snapshot_key);
+
+    int nlayers = group().nlayers();
+    w.u32(nlayers);
+    for (int layer = 0; layer < nlayers; ++layer) {
+        const ShaderInstance* in = group()[layer];
+        w.str(in->layername());
+        w.str(in->shadername());
+        w.u32((in->writes_globals() ? WritesGlobals : 0)
+              | (in->userdata_params() ? UserdataParams : 0)
+              | (in->outgoing_connections() ? OutgoingConnections : 0)
+              | (in->renderer_outputs() ? RendererOutputs : 0)
+              | (in->has_error_op() ? HasErrorOp : 0)
+              | (in->has_trace_op() ? HasTraceOp : 0)
+              | (in->merged_unused() ? MergedUnused : 0)
+              | (in->last_layer() ? LastLayer : 0)
+              | (in->entry_layer() ? EntryLayer : 0));
+        w.i32(in->m_firstparam);
+        w.i32(in->m_lastparam);
+        w.i32(in->m_maincodebegin);
+        w.i32(in->m_maincodeend);
+        w.i32(in->m_Psym);
+        w.i32(in->m_Nsym);
+
+        w.u32(in->m_iparams.size());
+        for (int v : in->m_iparams)
+            w.i32(v);
+        w.u32(in->m_fparams.size());
+        for (float v : in->m_fparams)
+            w.f32(v);
+        w.u32(in->m_sparams.size());
+        for (ustring v : in->m_sparams)
+            w.str(v);
+
+        w.u32(in->m_instoverrides.size());
+        for (auto&& o : in->m_instoverrides) {
+            w.u32(o.valuesource());
+            w.u32(o.connected_down());
+            w.u32(o.interpolated());
+            w.u32(o.interactive());
+            w.i32(o.arraylen());
+            w.i32(o.dataoffset());
+        }
+
+        w.u32(in->m_connections.size());
+        for (auto&& c : in->m_connections) {
+            w.i32(c.srclayer);
+            w.connected_param(c.src);
+            w.connected_param(c.dst);
+        }
+
+        w.u32(in->m_instops.size());
+        for (auto&& op : in->m_instops) {
+            w.str(op.opname());
+            w.str(op.method());
+            w.i32(op.firstarg());
+            w.i32(op.nargs());
+            for (unsigned int j = 0; j < Opcode::max_jumps; ++j)
+                w.i32(op.jump(j));
+            w.str(op.sourcefile());
+            w.i32(op.sourceline());
+            w.u32(op.argread_bits());
+            w.u32(op.argwrite_bits());
+            w.u32(op.argtakesderivs_all());
+            w.u32(op.requires_masking());
+            w.u32(op.analysis_flag());
+        }
+        w.u32(in->m_instargs.size());
+        for (int a : in->m_instargs)
+            w.i32(a);
+
+        // Parameter values are found again by their index in the param
+        // arrays, and other values are saved with the symbol.
+        auto index_in = [](const void* p, const void* base, size_t n,
+                           size_t size) -> int {
+            if (p >= base && p < (const char*)base + n * size)
+                return int(((const char*)p - (const char*)base) / size);
+            return -1;
+        };
+        w.u32(in->m_instsymbols.size());
+        for (auto&& s : in->m_instsymbols) {
+            if (s.arena() != SymArena::Absolute
+                && s.arena() != SymArena::Unknown)
+                return;  // Not expected after optimization
+            w.str(s.name());
+            w.typespec(s.typespec());
+            w.u32(s.symtype());
+            w.i32(s.size());
+            w.u32((s.has_derivs() ? HasDerivs : 0)
+                  | (s.connected_down() ? ConnectedDown : 0)
+                  | (s.initialized() ? Initialized : 0)
+                  | (s.interpolated() ? Interpolated : 0)
+                  | (s.interactive() ? Interactive : 0)
+                  | (s.noninteractive() ? Noninteractive : 0)
+                  | (s.allowconnect() ? Allowconnect : 0)
+                  | (s.renderer_output() ? RendererOutput : 0)
+                  | (s.readonly() ? Readonly : 0)
+                  | (s.is_varying() ? Varying : 0)
+                  | (s.forced_llvm_bool() ? ForcedBool : 0)
+                  | (s.arena() == SymArena::Absolute ? Absolute : 0));
+            w.u32(s.valuesource());
+            w.i32(s.fieldid());
+            w.i32(s.layer());
+            w.i32(s.scope());
+            w.i32(s.dataoffset());
+            w.i32(s.wide_dataoffset());
+            w.i32(s.initializers());
+            w.i32(s.initbegin());
+            w.i32(s.initend());
+            w.i32(s.firstread());
+            w.i32(s.lastread());
+            w.i32(s.firstwrite());
+            w.i32(s.lastwrite());
+
+            const void* data = s.data();
+            TypeDesc t       = s.typespec().simpletype();
+            int i;
+            if (!data || s.arena() != SymArena::Absolute) {
+                w.u32(NoData);
+            } else if ((i = index_in(data, in->m_iparams.data(),
+                                     in->m_iparams.size(), sizeof(int)))
+                       >= 0) {
+                w.u32(IntParams);
+                w.i32(i);
+            } else if ((i = index_in(data, in->m_fparams.data(),
+                                     in->m_fparams.size(), sizeof(float)))
+                       >= 0) {
+                w.u32(FloatParams);
+                w.i32(i);
+            } else if ((i = index_in(data, in->m_sparams.data(),
+                                     in->m_sparams.size(), sizeof(ustring)))
+                       >= 0) {
+                w.u32(StringParams);
+                w.i32(i);
+            } else if (!s.typespec().is_closure_based()
+                       && !s.typespec().is_structure_based()
+                       && t.arraylen >= 0
+                       && (t.basetype == TypeDesc::INT
+                           || t.basetype == TypeDesc::FLOAT
+                           || t.basetype == TypeDesc::STRING)) {
+                size_t n = t.numelements() * t.aggregate;
+                w.u32(Values);
+                w.u32(t.basetype);
+                w.u32(n);
+                for (size_t v = 0; v < n; ++v) {
+                    if (t.basetype == TypeDesc::INT)
+                        w.i32(((const int*)data)[v]);
+                    else if (t.basetype == TypeDesc::FLOAT)
+                        w.f32(((const float*)data)[v]);
+                    else
+                        w.str(((const ustring*)data)[v]);
+                }
+            } else {
+                return;  // A value we have no way to save
+            }
+        }
+    }
+
+    w.u32(group().m_noise_memos.size());
+    for (auto&& m : group().m_noise_memos) {
+        w.i32(m.layer);
+        w.i32(m.opnum);
+        w.i32(m.slot);
+    }
+    w.u32(group().m_noise_memo_types.size());
+    for (size_t i = 0; i < group().m_noise_memo_types.size(); ++i) {
+        w.typespec(group().m_noise_memo_types[i]);
+        w.u32(group().m_noise_memo_derivs[i]);
+    }
+
+    if (const auto& registry = shadingsys().registry())
+        registry->add("snap:" + OIIO::Filesystem::filename(filename),
+                      w.out());
+    if (shadingsys().opt_snapshot_dir().empty()) {
+        shadingsys().m_stat_snapshots_saved += 1;
+        return;
+    }
+
+    // Write to a temporary and rename it into place, so that a reader
+    // never sees a partial snapshot.
+    std::string dir = shadingsys().opt_snapshot_dir().string();
+    if (!OIIO::Filesystem::is_directory(dir)
+        && !OIIO::Filesystem::create_directory(dir)) {
+        shadingsys().errorfmt("Could not create opt_snapshot_dir \"{}\"", dir);
+        return;
+    }
+    std::string tmpname = OIIO::Filesystem::unique_path(filename
+                                                        + ".tmp-%%%%%%%%");
+    {
+        OIIO::ofstream out;
+        OIIO::Filesystem::open(out, tmpname,
+                               std::ios_base::out | std::ios_base::binary);
+        if (out)
+            out.write(w.out().data(), w.out().size());
+        if (!out.good()) {
+            shadingsys().errorfmt("Could not write snapshot \"{}\"", tmpname);
+            return;
+        }
+    }
+    std::string err;
+    if (OIIO::Filesystem::rename(tmpname, filename, err))
+        shadingsys().m_stat_snapshots_saved += 1;
+    else
+        OIIO::Filesystem::remove(tmpname, err);
+}
+
+
+
+bool
+RuntimeOptimizer::read_snapshot(const std::string& filename)
+{
+    // Another ShadingSystem sharing our registry may already have
+    // optimized the same group; failing that, look in the directory.
+    const auto& registry = shadingsys().registry();
+    std::string regkey   = "snap:" + OIIO::Filesystem::filename(filename);
+    std::shared_ptr<const std::string> shared;
+    if (registry)
+        shared = registry->find(regkey);
+    std::string contents;
+    if (!shared) {
+        if (shadingsys().opt_snapshot_dir().empty())
+            return false;
+        size_t size = size_t(OIIO::Filesystem::file_size(filename));
+        if (!OIIO::Filesystem::exists(filename) || !size)
+            return false;
+        contents.assign(size, '\0');
+        if (OIIO::Filesystem::read_bytes(filename, &contents[0], size)
+            != size)
+            return false;
+        if (registry)
+            registry->add(regkey, contents);
+    }
+
+    SnapshotReader r(shared ? string_view(*shared) : string_view(contents));
+    if (r.str() != string_view(snapshot_magic, sizeof(snapshot_magic))
+        || r.u32() != endian_tag || r.str() != m_snapshot_key)
+        return false;
+
+    // Read everything before touching the layers, so that a bad snapshot
+    // leaves them as they were.
+    struct Layer {
+        uint32_t flags;
+        int firstparam, lastparam, maincodebegin, maincodeend, Psym, Nsym;
+        std::vector<int> iparams;
+        std::vector<float> fparams;
+        std::vector<ustring> sparams;
+        ShaderInstance::SymOverrideInfoVec overrides;
+        ConnectionVec connections;
+        OpcodeVec ops;
+        std::vector<int> args;
+        SymbolVec symbols;
+        // Symbols holding parameter values, to point at the arrays above
+        // once they are in place: (symbol, kind, index).
+        std::vector<std::tuple<int, uint32_t, int>> paramdata;
+    };
+    int nlayers = group().nlayers();
+    if (r.count() != size_t(nlayers))
+        return false;
+    std::vector<Layer> layers(nlayers);
+    for (int layer = 0; layer < nlayers && r.ok(); ++layer) {
+        const ShaderInstance* in = group()[layer];
+        Layer& l(layers[layer]);
+        if (r.str() != in->layername().string()
+            || r.str() != in->shadername())
+            return false;
+        l.flags         = r.u32();
+        l.firstparam    = r.i32();
+        l.lastparam     = r.i32();
+        l.maincodebegin = r.i32();
+        l.maincodeend   = r.i32();
+        l.Psym          = r.i32();
+        l.Nsym          = r.i32();
+
+        l.iparams.resize(r.count());
+        for (int& v : l.iparams)
+            v = r.i32();
+        l.fparams.resize(r.count());
+        for (float& v : l.fparams)
+            v = r.f32();
+        l.sparams.resize(r.count());
+        for (ustring& v : l.sparams)
+            v = ustring(r.str());
+
+        l.overrides.resize(r.count(24));
+        for (auto&& o : l.overrides) {
+            o.valuesource(Symbol::ValueSource(r.u32() & 3));
+            o.connected_down(r.u32());
+            o.interpolated(r.u32());
+            o.interactive(r.u32());
+            o.arraylen(r.i32());
+            o.dataoffset(r.i32());
+        }
+
+        for (size_t i = 0, n = r.count(); i < n && r.ok(); ++i) {
+            int srclayer         = r.i32();
+            ConnectedParam src   = r.connected_param();
+            ConnectedParam dst   = r.connected_param();
+            l.connections.emplace_back(srclayer, src, dst);
+        }
+
+        for (size_t i = 0, n = r.count(); i < n && r.ok(); ++i) {
+            ustring opname(r.str());
+            ustring method(r.str());
+            int firstarg = r.i32();
+            int nargs    = r.i32();
+            Opcode op(opname, method, firstarg, nargs);
+            int jumps[Opcode::max_jumps];
+            for (int& j : jumps)
+                j = r.i32();
+            op.set_jump(jumps[0], jumps[1], jumps[2], jumps[3]);
+            ustring sourcefile(r.str());
+            op.source(sourcefile, r.i32());
+            unsigned int read  = r.u32();
+            unsigned int write = r.u32();
+            op.set_argbits(read, write, r.u32());
+            op.requires_masking(r.u32());
+            op.analysis_flag(r.u32());
+            l.ops.push_back(op);
+        }
+        l.args.resize(r.count());
+        for (int& a : l.args)
+            a = r.i32();
+
+        size_t nsyms = r.count();
+        l.symbols.reserve(nsyms);
+        for (size_t i = 0; i < nsyms && r.ok(); ++i) {
+            ustring name(r.str());
+            TypeSpec type   = r.typespec();
+            SymType symtype = SymType(r.u32());
+            l.symbols.emplace_back(name, type, symtype);
+            Symbol& s(l.symbols.back());
+            s.size(size_t(r.i32()));
+            uint32_t flags = r.u32();
+            s.has_derivs(flags & HasDerivs);
+            s.connected_down(flags & ConnectedDown);
+            s.initialized(flags & Initialized);
+            s.interpolated(flags & Interpolated);
+            s.interactive(flags & Interactive);
+            s.noninteractive(flags & Noninteractive);
+            s.allowconnect(flags & Allowconnect);
+            s.renderer_output(flags & RendererOutput);
+            s.readonly(flags & Readonly);
+            if (flags & Varying)
+                s.make_varying();
+            s.forced_llvm_bool(flags & ForcedBool);
+            s.valuesource(Symbol::ValueSource(r.u32() & 3));
+            s.fieldid(r.i32());
+            s.layer(r.i32());
+            s.scope(r.i32());
+            s.dataoffset(r.i32());
+            s.wide_dataoffset(r.i32());
+            s.initializers(r.i32());
+            int initbegin = r.i32();
+            s.set_initrange(initbegin, r.i32());
+            int firstread = r.i32();
+            s.set_read(firstread, r.i32());
+            int firstwrite = r.i32();
+            s.set_write(firstwrite, r.i32());
+            if (flags & Absolute)
+                s.set_dataptr(SymArena::Absolute, nullptr);
+
+            uint32_t kind = r.u32();
+            if (kind == IntParams || kind == FloatParams
+                || kind == StringParams) {
+                l.paramdata.emplace_back(int(i), kind, r.i32());
+            } else if (kind == Values) {
+                uint32_t basetype = r.u32();
+                size_t n          = r.count();
+                void* data        = nullptr;
+                if (basetype == TypeDesc::INT) {
+                    int* v = shadingsys().alloc_int_constants(n);
+                    for (size_t j = 0; j < n; ++j)
+                        v[j] = r.i32();
+                    data = v;
+                } else if (basetype == TypeDesc::FLOAT) {
+                    float* v = shadingsys().alloc_float_constants(n);
+                    for (size_t j = 0; j < n; ++j)
+                        v[j] = r.f32();
+                    data = v;
+                } else if (basetype == TypeDesc::STRING) {
+                    ustring* v = shadingsys().alloc_string_constants(n);
+                    for (size_t j = 0; j < n; ++j)
+                        v[j] = ustring(r.str());
+                    data = v;
+                } else {
+                    return false;
+                }
+                s.set_dataptr(SymArena::Absolute, data);
+            } else if (kind != NoData) {
+                return false;
+            }
+        }
+    }
+
+    std::vector<ShaderGroup::NoiseMemo> noise_memos(r.count(12));
+    for (auto&& m : noise_memos) {
+        m.layer = r.i32();
+        m.opnum = r.i32();
+        m.slot  = r.i32();
+    }
+    size_t nslots = r.count();
+    std::vector<TypeSpec> noise_memo_types;
+    std::vector<char> noise_memo_derivs;
+    for (size_t i = 0; i < nslots && r.ok(); ++i) {
+        noise_memo_types.push_back(r.typespec());
+        noise_memo_derivs.push_back(char(r.u32()));
+    }
+    if (!r.done())
+        return false;
+
+    // Check the indices before anything can follow them.
+    for (auto&& l : layers) {
+        int nsyms = (int)l.symbols.size();
+        for (int a : l.args)
+            if (a < 0 || a >= nsyms)
+                return false;
+        for (auto&& op : l.ops)
+            if (op.firstarg() < 0 || op.nargs() < 0
+                || size_t(op.firstarg() + op.nargs()) > l.args.size())
+                return false;
+        for (auto&& p : l.paramdata) {
+            int i = std::get<2>(p), n;
+            switch (std::get<1>(p)) {
+            case IntParams: n = (int)l.iparams.size(); break;
+            case FloatParams: n = (int)l.fparams.size(); break;
+            default: n = (int)l.sparams.size(); break;
+            }
+            if (i < 0 || i >= n)
+                return false;
+        }
+        for (auto&& c : l.connections)
+            if (c.srclayer < 0 || c.srclayer >= nlayers)
+                return false;
+    }
+
+    // Everything checks out, so make the layers what the snapshot says.
+    for (int layer = 0; layer < nlayers; ++layer) {
+        ShaderInstance* in = group()[layer];
+        Layer& l(layers[layer]);
+        // Interactive parameter values aren't part of the snapshot's key,
+        // so keep this group's own.
+        for (auto&& p : l.paramdata) {
+            const Symbol& s(l.symbols[std::get<0>(p)]);
+            if (!s.interactive())
+                continue;
+            int i = std::get<2>(p);
+            size_t n = s.typespec().simpletype().numelements()
+                       * s.typespec().simpletype().aggregate;
+            auto keep = [&](auto& mine, auto& theirs) {
+                for (size_t j = 0; j < n && i + j < mine.size()
+                                   && i + j < theirs.size();
+                     ++j)
+                    theirs[i + j] = mine[i + j];
+            };
+            if (std::get<1>(p) == IntParams)
+                keep(in->m_iparams, l.iparams);
+            else if (std::get<1>(p) == FloatParams)
+                keep(in->m_fparams, l.fparams);
+            else
+                keep(in->m_sparams, l.sparams);
+        }
+        in->m_iparams       = std::move(l.iparams);
+        in->m_fparams       = std::move(l.fparams);
+        in->m_sparams       = std::move(l.sparams);
+        in->m_instoverrides = std::move(l.overrides);
+        in->m_connections   = std::move(l.connections);
+        in->m_instops       = std::move(l.ops);
+        in->m_instargs      = std::move(l.args);
+        in->m_instsymbols   = std::move(l.symbols);
+        for (auto&& p : l.paramdata) {
+            Symbol& s(in->m_instsymbols[std::get<0>(p)]);
+            int i = std::get<2>(p);
+            void* data;
+            if (std::get<1>(p) == IntParams)
+                data = &in->m_iparams[i];
+            else if (std::get<1>(p) == FloatParams)
+                data = &in->m_fparams[i];
+            else
+                data = &in->m_sparams[i];
+            s.set_dataptr(SymArena::Absolute, data);
+        }
+        in->writes_globals(l.flags & WritesGlobals);
+        in->userdata_params(l.flags & UserdataParams);
+        in->outgoing_connections(l.flags & OutgoingConnections);
+        in->renderer_outputs(l.flags & RendererOutputs);
+        in->has_error_op(l.flags & HasErrorOp);
+        in->has_trace_op(l.flags & HasTraceOp);
+        in->m_merged_unused = (l.flags & MergedUnused) != 0;
+        in->last_layer(l.flags & LastLayer);
+        in->entry_layer(l.flags & EntryLayer);
+        in->m_firstparam    = l.firstparam;
+        in->m_lastparam     = l.lastparam;
+        in->m_maincodebegin = l.maincodebegin;
+        in->m_maincodeend   = l.maincodeend;
+        in->m_Psym          = l.Psym;
+        in->m_Nsym          = l.Nsym;
+    }
+    group().m_noise_memos       = std::move(noise_memos);
+    group().m_noise_memo_types  = std::move(noise_memo_types);
+    group().m_noise_memo_derivs = std::move(noise_memo_derivs);
+    shadingsys().m_stat_snapshots_loaded += 1;
+    return true;
+}
@@ -4,6 +4,11 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
 #include <list>
 #include <map>
 #include <memory>
@@ -37,6 +42,7 @@
 #include <OSL/device_ptr.h>
 #include <OSL/dual.h>
 #include <OSL/dual_vec.h>
+#include <OSL/encodedtypes.h>
 #include <OSL/genclosure.h>
 #include <OSL/llvm_util.h>
 #include <OSL/mask.h>
@@ -47,7 +53,10 @@
 
 #include "shading_state_uniform.h"
 #include "constantpool.h"
+#include "formatplan.h"
 #include "opcolor.h"
+#include "pmucounters.h"
+#include "regexcache.h"
 
 
 using namespace OSL;
@@ -61,26 +70,40 @@ using OIIO::ParamValueList;
 using OIIO::RefCnt;
 using OIIO::spin_lock;
 using OIIO::spin_mutex;
+using OIIO::spin_rw_mutex;
 namespace Strutil = OIIO::Strutil;
 
 
 OSL_NAMESPACE_BEGIN
 
+namespace pvt {
+struct ThreadProfile;
+}
+
 
 
 struct PerThreadInfo {
-    PerThreadInfo();
+    PerThreadInfo(int numa_node = -1);
     ~PerThreadInfo();
     ShadingContext* pop_context();  ///< Get the pool top and then pop
 
+    int numa_node;  ///< NUMA node to keep context memory on, or -1
     std::stack<ShadingContext*> context_pool;
     LLVM_Util::PerThreadInfo llvm_thread_info;
+    /// Execution profile of this thread's contexts, made on first use
+    std::unique_ptr<pvt::ThreadProfile> profile;
 };
 
 
 
 namespace pvt {
 
+/// Ask the OS to keep the whole pages within [ptr, ptr+size) on the given
+/// NUMA node, moving any already there. A no-op for node < 0, or where
+/// unsupported; the memory stays wherever it is if the request fails.
+void
+numa_prefer_node(void* ptr, size_t size, int node);
+
 void
 optix_cache_unwrap(string_view cache_value, std::string& ptx,
                    size_t& groupdata_size);
@@ -89,9 +112,14 @@ optix_cache_wrap(string_view ptx, size_t groupdata_size);
 
 // forward definitions
 class ShadingSystemImpl;
+struct FoldedLayer;
+struct BatchedLayerAnalysis;
 class ShaderInstance;
 typedef std::shared_ptr<ShaderInstance> ShaderInstanceRef;
 class Dictionary;
+class DictionaryStore;
+class ShaderBundle;
+class DeviceArena;
 class RuntimeOptimizer;
 class BackendLLVM;
 #if OSL_USE_BATCHED
@@ -119,6 +147,33 @@ typedef void (*RunLLVMGroupFuncWide)(void* batchedshaderglobals,
                                      void* interactive_params_ptr);
 #endif
 
+/// The tiles of a UDIM texture, each resolved to its own texture handle
+/// once, so that lookups find their tile without asking the
+/// TextureSystem to resolve it every time.
+struct UdimTileTable {
+    int nutiles = 0, nvtiles = 0;
+    /// Handle of tile (u,v) at [v*nutiles+u], nullptr for missing tiles.
+    std::vector<TextureSystem::TextureHandle*> tiles;
+
+    /// Return the index in tiles of the tile that (s,t) falls in, and
+    /// make s and t relative to that tile. Return -1, leaving s and t
+    /// alone, if there is no such tile.
+    int tile(float& s, float& t) const
+    {
+        if (!(s >= 0.0f && t >= 0.0f))  // also false for NaN
+            return -1;
+        float u = std::floor(s), v = std::floor(t);
+        if (u >= float(nutiles) || v >= float(nvtiles))
+            return -1;
+        int i = int(v) * nutiles + int(u);
+        if (!tiles[i])
+            return -1;
+        s -= u;
+        t -= v;
+        return i;
+    }
+};
+
 /// Signature of a constant-folding method
 typedef int (*OpFolder)(RuntimeOptimizer& rop, int opnum);
 
@@ -446,8 +501,37 @@ public:
 
     int num_params() const { return m_lastparam - m_firstparam; }
 
+    /// Is the symbol with the given index a parameter?
+    bool is_param(int index) const
+    {
+        return index >= m_firstparam && index < m_lastparam;
+    }
+
+    int num_ops() const { return m_nops; }
+
+    /// Pack the code (ops and args) into a compact form, freeing the
+    /// full form until an instance next needs it. Return the number of
+    /// bytes saved.
+    size_t compact_code();
+
+    /// Copy the code into ops and args, unpacking it if it was compacted,
+    /// leaving room for headroom more of each.
+    void copy_code(OpcodeVec& ops, std::vector<int>& args,
+                   size_t headroom = 0);
+
+    /// How long it took to read and parse the .oso (seconds).
+    double load_time() const { return m_load_time; }
+    void load_time(double t) { m_load_time = t; }
+
+    /// Hash of the oso it was loaded from memory with, or 0.
+    uint64_t oso_hash() const { return m_oso_hash; }
+    void oso_hash(uint64_t h) { m_oso_hash = h; }
+
     int raytype_queries() const { return m_raytype_queries; }
 
+    /// The static cost estimates oslc recorded in the .oso.
+    const OSLQuery::CostEstimate& cost() const { return m_cost; }
+
     bool range_checking() const { return m_range_checking; }
     void range_checking(bool b) { m_range_checking = b; }
 
@@ -470,6 +554,17 @@ private:
     int m_maincodebegin, m_maincodeend;  ///< Main shader code range
     int m_raytype_queries;               ///< Bitmask of raytypes queried
     bool m_range_checking;  ///< Is range checking enabled for this shader?
+    double m_load_time = 0;  ///< Time to load the .oso
+    uint64_t m_oso_hash = 0;  ///< Hash of the oso, if loaded from memory
+    int m_nops          = 0;  ///< Number of ops, compacted or not
+    OSLQuery::CostEstimate m_cost;  ///< Static estimates from oslc
+    // While compacted, m_ops and m_args are empty and the code is held
+    // in m_packed_code, with its strings in m_packed_strings.
+    std::string m_packed_code;
+    std::vector<ustring> m_packed_strings;
+    mutex m_code_mutex;  ///< Guards compacting and unpacking the code
+
+    void unpack_code();  // With m_code_mutex held
 
     friend class OSOReaderToMaster;
     friend class ShaderInstance;
@@ -494,6 +589,9 @@ public:
         std::vector<ClosureParam> params;
         // the needed size for the structure
         int struct_size;
+        // Whether the formal params together write every byte of the
+        // structure, so it needn't be zeroed first
+        bool formals_fill_struct;
         // Creation callbacks
         PrepareClosureFunc prepare;
         SetupClosureFunc setup;
@@ -569,6 +667,44 @@ public:
                                     string_view groupspec);
     bool ReParameter(ShaderGroup& group, string_view layername,
                      string_view paramname, TypeDesc type, const void* val);
+    void ReParameterBegin(ShaderGroup& group);
+    bool ReParameterEnd(ShaderGroup& group);
+    ShaderGroupRef specialize_outputs(ShaderGroup& group,
+                                      cspan<ustring> outputs);
+    int find_param(string_view shadername, string_view paramname);
+    ShaderGroupRef build_shader_group(const ShaderGroupDesc& desc);
+
+    /// The group to run for a ray of the given type: with the
+    /// "raytype_variants" option, a copy of `group` specialized on the ray
+    /// types it queries, made and cached on first use; otherwise, or when
+    /// no such copy can be made, `group` itself.
+    ShaderGroup& raytype_variant(ShaderGroup& group, int raytype);
+    bool raytype_variants() const
+    {
+        return m_raytype_variants > 0 && !use_optix();
+    }
+
+    /// The copy of `group` compiled with NaN and uninitialized-value
+    /// checks, that shades picked by "debug_sample_interval" or tagged
+    /// with the "debug_sample_raytype" ray type run instead of it. Made
+    /// and cached on first use; `group` itself if it can't be made.
+    ShaderGroup& debug_variant(ShaderGroup& group);
+
+    /// With the "userdata_variants" option, the copy of `group` in which
+    /// the userdata that had one value in all of its first shades are
+    /// constants, if the userdata at `sg` still have those values;
+    /// otherwise `group`. Until enough shades have run, each one records
+    /// its userdata, and the copy is made once they have.
+    ShaderGroup& userdata_variant(ShaderGroup& group, ShaderGlobals& sg);
+    bool userdata_variants() const
+    {
+        return m_userdata_variants > 0 && !use_optix();
+    }
+    bool debug_sampling() const
+    {
+        return (m_debug_sample_interval > 0 || !m_debug_sample_raytype.empty())
+               && !use_optix();
+    }
 
     // Internal error, warning, info, and message reporting routines that
     // take std::format-like arguments.
@@ -602,11 +738,30 @@ public:
 
     std::string getstats(int level = 1) const;
 
+    /// Add a ThreadProfile to those merge_profiles gathers from, or merge
+    /// it one last time and remove it.
+    void add_thread_profile(ThreadProfile* profile);
+    void remove_thread_profile(ThreadProfile* profile);
+
+    /// Move the execution times that threads have recorded in their
+    /// ThreadProfiles into the shading system's and groups' totals.
+    void merge_profiles() const;
+
+    /// The n groups that took the longest to compile, one per line.
+    std::string slowest_groups_report(int n) const;
+
+    /// The main stats, and each group's compile and execution time, as a
+    /// JSON object (the "stat:json" attribute).
+    std::string stats_json() const;
+
+    void enumerate_stats(const ShadingSystem::StatsFunc& func) const;
+    void set_stats_callback(ShadingSystem::StatsFunc func);
+
     ErrorHandler& errhandler() const { return *m_err; }
 
     ShaderMaster::ref loadshader(string_view name);
 
-    PerThreadInfo* create_thread_info();
+    PerThreadInfo* create_thread_info(int numa_node = -1);
 
     void destroy_thread_info(PerThreadInfo* threadinfo);
 
@@ -639,6 +794,9 @@ public:
 
     bool use_optix() const { return m_use_optix; }
     bool use_optix_cache() const { return m_use_optix_cache; }
+    bool optix_wavefront() const { return m_optix_wavefront; }
+    int optix_split_threshold() const { return m_optix_split_threshold; }
+    ustring optix_target_arch() const { return m_optix_target_arch; }
     bool debug_nan() const { return m_debugnan; }
     bool debug_uninit() const { return m_debug_uninit; }
     bool lockgeom_default() const { return m_lockgeom_default; }
@@ -667,8 +825,10 @@ public:
     bool dump_varying_symbols() const { return m_dump_varying_symbols; }
     ustring llvm_prune_ir_strategy() const { return m_llvm_prune_ir_strategy; }
     bool fold_getattribute() const { return m_opt_fold_getattribute; }
+    bool fold_dict() const { return m_opt_fold_dict; }
     bool opt_texture_handle() const { return m_opt_texture_handle; }
     int opt_passes() const { return m_opt_passes; }
+    int opt_threads() const { return m_opt_threads; }
     int max_warnings_per_thread() const
     {
         return m_shading_state_uniform.m_max_warnings_per_thread;
@@ -677,9 +837,15 @@ public:
     bool lazy_userdata() const { return m_lazy_userdata; }
     bool lazy_trace() const { return m_lazy_trace; }
     bool userdata_isconnected() const { return m_userdata_isconnected; }
+    bool reparam_rebuild() const { return m_reparam_rebuild; }
+    float memory_budget() const { return m_memory_budget; }
+    int memory_epoch() const { return m_memory_epoch; }
     int profile() const { return m_profile; }
     bool no_noise() const { return m_no_noise; }
+    ustring noise_hash() const { return m_noise_hash; }
+    ustring math_precision() const { return m_math_precision; }
     bool no_pointcloud() const { return m_no_pointcloud; }
+    ustring pointcloud_index() const { return m_pointcloud_index; }
     bool force_derivs() const { return m_force_derivs; }
     bool allow_shader_replacement() const { return m_allow_shader_replacement; }
     ustring commonspace_synonym() const
@@ -689,6 +855,32 @@ public:
 
     bool llvm_jit_fma() const { return m_llvm_jit_fma; }
     ustring llvm_jit_target() const { return m_llvm_jit_target; }
+    ustring llvm_jit_cache_dir() const { return m_llvm_jit_cache_dir; }
+    ustring llvm_jit_isas() const { return m_llvm_jit_isas; }
+    ustring opt_snapshot_dir() const { return m_opt_snapshot_dir; }
+
+    /// The settings of all the options, as "name=value" pairs separated by
+    /// spaces, for printing and for keying things that depend on them.
+    std::string options_summary() const;
+    int llvm_jit_tiered() const { return m_llvm_jit_tiered; }
+    int llvm_jit_threads() const { return m_llvm_jit_threads; }
+    int llvm_shared_ops() const { return m_llvm_shared_ops; }
+    int llvm_shared_constants() const { return m_llvm_shared_constants; }
+    int batch_autoselect() const { return m_batch_autoselect; }
+    bool batch_uniform_scalar() const { return m_batch_uniform_scalar; }
+    bool batched_attribute_cache() const { return m_batched_attribute_cache; }
+
+    /// Return the address of the process-wide read-only copy of the size
+    /// bytes at data, shared by everything using identical constants.
+    const void* shared_constant(const void* data, size_t size)
+    {
+        return m_shared_constants.insert(data, size);
+    }
+    bool llvm_jit_lazy_entry() const { return m_llvm_jit_lazy_entry; }
+    bool llvm_jit_group_memory() const { return m_llvm_jit_group_memory; }
+    int llvm_pgo() const { return m_llvm_pgo; }
+    int llvm_layer_inline() const { return m_llvm_layer_inline; }
+    int llvm_layer_noinline() const { return m_llvm_layer_noinline; }
 
     ustring debug_groupname() const { return m_debug_groupname; }
     ustring debug_layername() const { return m_debug_layername; }
@@ -709,11 +901,130 @@ public:
     /// (at least the ones that can't be overridden by the geometry).
     void optimize_group(ShaderGroup& group, ShadingContext* ctx, bool do_jit);
 
+    /// Optimize (and JIT, if do_jit) one complete group other than busy
+    /// that still needs it and that no other thread is working on. Return
+    /// false if there's no such group.
+    bool compile_idle_group(const ShaderGroup& busy, ShadingContext* ctx,
+                            bool do_jit);
+
     /// After doing all optimization and code JIT, we can clean up by
     /// deleting the instances' code and arguments, and paring their
     /// symbol tables down to just parameters.
     void group_post_jit_cleanup(ShaderGroup& group);
 
+    // ReParameter of just this group, not the variants made from it.
+    bool reparameter_group(ShaderGroup& group, string_view layername,
+                           string_view paramname, TypeDesc type,
+                           const void* val);
+
+    // ReParameter of a value that the optimizer may have specialized the
+    // group on: store it in the pristine copy of the layer and, if any
+    // layer that can see it is in use, make the group optimize again.
+    bool reparameter_rebuild(ShaderGroup& group, int layerindex,
+                             ustring paramname, TypeDesc type,
+                             const void* val);
+
+    // Replace the group's layers (it must be locked) with copies of the
+    // pristine ones, to be optimized again.
+    void rebuild_from_pristine(ShaderGroup& group);
+
+    // Copy bytes [begin,end) of the group's interactive arena to the
+    // device, or note them for the next upload_device_data.
+    void upload_interactive_params(ShaderGroup& group, size_t begin,
+                                   size_t end);
+
+    // Make a new, complete group from copies of the unoptimized layers of
+    // `group` (which must be locked), with the same group attributes.
+    // Returns an empty ref if the group was already optimized without
+    // keeping pristine copies of its layers.
+    ShaderGroupRef copy_group_layers(ShaderGroup& group, string_view name);
+
+    /// If a group with the same canonical hash as this one has already
+    /// been JITed, have this one share its optimized layers and code
+    /// instead of compiling its own. The group must be locked. Returns
+    /// true if it was shared.
+    bool share_twin_group(ShaderGroup& group);
+
+    /// Offer a freshly JITed group for others to share (see
+    /// "opt_share_groups").
+    void register_twin_group(ShaderGroup& group);
+
+    /// The memoized first optimization pass of a layer (see
+    /// "opt_fold_memo"), or nullptr if there is none for this key.
+    std::shared_ptr<const FoldedLayer> find_folded_layer(const std::string& key);
+
+    /// Memoize the first optimization pass of a layer, if there's room.
+    void add_folded_layer(const std::string& key,
+                          std::shared_ptr<const FoldedLayer> layer);
+
+    /// The memoized batched analysis of a layer (see
+    /// "opt_batched_analysis_memo"), or nullptr if there is none for
+    /// this key.
+    std::shared_ptr<const BatchedLayerAnalysis>
+    find_batched_analysis(const std::string& key);
+
+    /// Memoize the batched analysis of a layer, if there's room.
+    void add_batched_analysis(const std::string& key,
+                              std::shared_ptr<const BatchedLayerAnalysis> a);
+
+    /// The parsed dictionary documents and query results shared, read
+    /// only, by the dictionaries of all contexts. Made on first use.
+    DictionaryStore& dictionary_store();
+
+    /// The tile table of a UDIM texture handle, built on first use, or
+    /// nullptr if the texture isn't UDIM or udim_tile_cache is off.
+    const UdimTileTable* udim_tile_table(TextureSystem::TextureHandle* handle,
+                                         TextureSystem::Perthread* thread_info);
+
+    /// Save every point cloud that pointcloud_write added points to since
+    /// it was last saved, reporting any failure as an error. Only call it
+    /// when no shaders are running.
+    void save_pointclouds();
+
+    /// Look up a dict_find query in the dictionary store, from the root of
+    /// the named dictionary if nodeID is 0, else from that shared node.
+    /// Return the ID of the first match -- one from dict_shared_base() up,
+    /// which means the same node in every context -- or 0 if there's no
+    /// match, or -1 if the dictionary or query is bad.
+    int dict_find_shared(ustring dictionaryname, int nodeID, ustring query);
+
+    /// The lowest node ID numbered by the dictionary store rather than by
+    /// a context.
+    static constexpr int dict_shared_base() { return 1 << 30; }
+
+    /// JIT entry layer `layer` of the group's compiled code `code`, which
+    /// was left out of the group's JIT (see "llvm_jit_lazy_entry"), the
+    /// first time it is executed. Return its function, or nullptr if it
+    /// has none.
+    RunLLVMGroupFunc jit_deferred_layer(ShaderGroup& group,
+                                        ShaderGroup::CompiledCode& code,
+                                        int layer);
+
+    /// The branch profile of `size` counters for the group with canonical
+    /// hash `key` (see "llvm_pgo"). If there is none yet, make a zeroed one
+    /// if `create` is true, otherwise try to load it from llvm_pgo_dir, and
+    /// return nullptr if that fails. Profiles live as long as the shading
+    /// system, since JITed code may be counting into them.
+    std::shared_ptr<std::vector<uint64_t>> branch_profile(uint64_t key,
+                                                          size_t size,
+                                                          bool create);
+
+    /// Write the recorded branch profiles to llvm_pgo_dir.
+    void save_branch_profiles();
+
+    /// Queue a group that was given a quick low-optimization JIT (see the
+    /// "llvm_jit_tiered" attribute) to be re-JITed with full optimization
+    /// by the background compile threads, starting them if needed.
+    void schedule_background_jit(ShaderGroup& group);
+
+    /// Stop the background compile threads, abandoning any groups still
+    /// queued (they keep running their quick JIT code).
+    void stop_background_jit();
+
+    /// Block until the background compile threads are done with every
+    /// group queued for them.
+    void wait_for_background_jit();
+
     int* alloc_int_constants(size_t n) { return m_int_pool.alloc(n); }
     float* alloc_float_constants(size_t n) { return m_float_pool.alloc(n); }
     ustring* alloc_string_constants(size_t n) { return m_string_pool.alloc(n); }
@@ -750,14 +1061,72 @@ public:
     void optimize_all_groups(int nthreads = 0, int mythread = 0,
                              int totalthreads = 1, bool do_jit = true);
 
+    void set_task_executor(ShadingSystem::TaskExecutor executor);
+
+    /// Run task(0) through task(ntasks-1) and wait for them all, through
+    /// the renderer's task executor if it set one, otherwise each on a
+    /// thread of its own (or inline, if there is just one).
+    void run_tasks(int ntasks, const std::function<void(int)>& task);
+
+    size_t compact_shader_code();
+
+    size_t enforce_memory_budget();
+
+    /// Should the group's CPU code be JITed into memory of its own, freed
+    /// along with it, rather than the memory shared by all groups?
+    bool jit_group_memory(const ShaderGroup& group) const;
+
+    size_t upload_device_data(void* stream);
+
+    /// The pool for per-group device data, or nullptr if per-group data
+    /// gets its own device allocations.
+    DeviceArena* device_arena();
+
+    /// Compile a constant regex pattern into the shared cache, at JIT
+    /// time, so that shading needn't.
+    void precompile_regex(ustring pattern);
+
+    std::vector<std::string>
+    ptx_compile_groups(cspan<ShaderGroupRef> groups, int nthreads,
+                       const ShadingSystem::PTXReadyFunc& ready);
+
+    uint32_t make_string_table(cspan<ShaderGroupRef> groups,
+                               cspan<ustring> extra,
+                               std::vector<int32_t>& seeds,
+                               std::vector<uint64_t>& keys);
+
+    bool shade_grid_device(ShaderGroup& group, int npoints, void* sg,
+                           void* groupdata, void* userdata_base,
+                           void* output_base, void* stream);
+
+    std::shared_ptr<const std::string>
+    device_program(ShaderGroup& group, string_view arch,
+                   const ShadingSystem::DeviceCompileFunc& compile);
+
+    /// Return all complete groups that still need optimizing (and
+    /// JITing, if do_jit is true), most expensive to compile first.
+    std::vector<ShaderGroupRef> groups_to_compile_by_cost(bool do_jit);
+
+    /// Optimize (and optionally JIT) groups[i] for successive values of i
+    /// claimed from the shared counter `next`, until all are taken. Any
+    /// number of threads may work on the same list at once.
+    void optimize_group_list(cspan<ShaderGroupRef> groups,
+                             std::atomic<size_t>& next, bool do_jit);
+
+    /// Resolve the handle of, and open, every texture that any optimized
+    /// group is known to need, using up to nthreads threads (0 means one
+    /// per core), so that the first lookups of the render don't wait on
+    /// them.
+    void prefetch_textures(int nthreads);
+
     typedef std::unordered_map<ustring, OpDescriptor> OpDescriptorMap;
 
     /// Look up OpDescriptor for the named op, return NULL for unknown op.
     ///
     const OpDescriptor* op_descriptor(ustring opname)
     {
-        OpDescriptorMap::const_iterator i = m_op_descriptor.find(opname);
-        if (i != m_op_descriptor.end())
+        OpDescriptorMap::const_iterator i = m_op_descriptor->find(opname);
+        if (i != m_op_descriptor->end())
             return &(i->second);
         else
             return NULL;
@@ -782,6 +1151,22 @@ public:
     /// archive.
     bool archive_shadergroup(ShaderGroup& group, string_view filename);
 
+    /// Write a shader bundle of the named shaders (each found along the
+    /// shader searchpath, or given as the path of its .oso).
+    bool write_shader_bundle(string_view filename,
+                             cspan<std::string> shadernames);
+
+    /// The registry shared with other ShadingSystems (see ShaderRegistry),
+    /// or null.
+    const std::shared_ptr<ShaderRegistry>& registry() const
+    {
+        return m_registry;
+    }
+    void attach_registry(std::shared_ptr<ShaderRegistry> registry)
+    {
+        m_registry = std::move(registry);
+    }
+
     void count_noise(int number = 1) { m_stat_noise_calls += number; }
 
     ColorSystem& colorsystem() { return m_shading_state_uniform.m_colorsystem; }
@@ -848,6 +1233,20 @@ private:
     int find_named_layer_in_group(ShaderGroup& group, ustring layername,
                                   ShaderInstance*& inst);
 
+    /// Make a new group and enter it in the census of all groups, without
+    /// making it the current group. (A helper for ShaderGroupBegin and
+    /// build_shader_group.)
+    ShaderGroupRef new_shader_group(string_view groupname);
+
+    /// Make a connection whose layers and parameters have already been
+    /// found and decoded, checking that the types are compatible and the
+    /// destination allows it. (A helper for ConnectShaders and
+    /// build_shader_group.)
+    bool connect_decoded(ShaderGroup& group, int srcinstindex,
+                         const ConnectedParam& srccon, int dstinstindex,
+                         const ConnectedParam& dstcon, string_view srcparam,
+                         string_view dstparam);
+
     /// Turn a connectionname (such as "Kd" or "Cout[1]", etc.) into a
     /// ConnectedParam descriptor.  This routine is strictly a helper for
     /// ConnectShaders, and will issue error messages on its behalf.
@@ -873,12 +1272,37 @@ private:
 
     typedef std::map<ustring, ShaderMaster::ref> ShaderNameMap;
     ShaderNameMap m_shader_masters;  ///< name -> shader masters map
+    /// Masters being loaded from .oso files, by name, each finishing with
+    /// the master (or nullptr) for any other requests for it to wait on.
+    std::map<ustring, std::shared_future<ShaderMaster::ref>>
+        m_shader_masters_loading;
+    /// Mounted shader bundles, searched in order before the searchpath.
+    std::vector<std::shared_ptr<ShaderBundle>> m_bundles;
+    /// Optimized groups and JITed code shared with other ShadingSystems.
+    std::shared_ptr<ShaderRegistry> m_registry;
+    /// Pooled device memory for per-group data (see "device_arena_size").
+    std::unique_ptr<DeviceArena> m_device_arena;
+    std::mutex m_device_arena_mutex;
+    /// Host copies of the data being uploaded, alternating so that the
+    /// previous upload's stays put until the one after.
+    std::vector<uint8_t> m_device_staging[2];
+    int m_device_staging_next = 0;
+    /// Programs compiled from PTX for each GPU architecture, keyed by
+    /// arch and PTX hash, each finishing when its compile is done.
+    typedef std::shared_future<std::shared_ptr<const std::string>>
+        DeviceProgramFuture;
+    std::map<std::string, DeviceProgramFuture> m_device_programs;
+    std::mutex m_device_programs_mutex;
+    /// The shadeops library PTX for "optix_target_arch", made on demand.
+    std::string m_shadeops_ptx;
+    std::mutex m_shadeops_ptx_mutex;
 
     ConstantPool<int> m_int_pool;
     ConstantPool<Float> m_float_pool;
     ConstantPool<ustring> m_string_pool;
+    SharedConstantPool m_shared_constants;  ///< Deduplicated const arrays
 
-    OpDescriptorMap m_op_descriptor;
+    const OpDescriptorMap* m_op_descriptor;  ///< Shared by the whole process
 
     // Pre-compiled support library
     std::vector<char>
@@ -889,6 +1313,7 @@ private:
 
     // Options
     int m_statslevel;             ///< Statistics level
+    int m_stats_slowest_groups;   ///< How many slowest groups to report
     bool m_lazylayers;            ///< Evaluate layers on demand?
     bool m_lazyglobals;           ///< Run lazily even if globals write?
     bool m_lazyunconnected;       ///< Run lazily even if not connected?
@@ -896,6 +1321,7 @@ private:
     bool m_lazy_userdata;         ///< Retrieve userdata lazily?
     bool m_lazy_trace;            ///< Run lazily even if it has trace call
     bool m_userdata_isconnected;  ///< Userdata params isconnected()?
+    bool m_reparam_rebuild;       ///< ReParameter may re-optimize groups?
     bool m_clearmemory;           ///< Zero mem before running shader?
     bool m_debugnan;              ///< Root out NaN's?
     bool m_debug_uninit;          ///< Find use of uninitialized vars?
@@ -905,6 +1331,9 @@ private:
     bool m_range_checking;        ///< Range check arrays & components?
     bool m_connection_error;      ///< Error for ConnectShaders to fail?
     bool m_greedyjit;             ///< JIT as much as we can?
+    bool m_texture_prefetch;      ///< Open textures in optimize_all_groups?
+    float m_memory_budget;        ///< MB to hold before evicting idle groups
+    bool m_udim_tile_cache;       ///< Resolve UDIM tiles with tile tables?
     bool m_countlayerexecs;       ///< Count number of layer execs?
     bool m_relaxed_param_typecheck;  ///< Allow parameters to be set from isomorphic types (same data layout)
     int m_profile;                 ///< Level of profiling of shader execution
@@ -920,19 +1349,51 @@ private:
     bool m_opt_mix;                        ///< Special 'mix' optimizations
     char m_opt_merge_instances;            ///< Merge identical instances?
     bool m_opt_merge_instances_with_userdata;  ///< Merge identical instances if they have userdata?
+    bool m_opt_share_groups;         ///< Share code of identical groups?
     bool m_opt_fold_getattribute;    ///< Constant-fold getattribute()?
+    bool m_opt_fold_dict;            ///< Constant-fold dict_find/value?
     bool m_opt_middleman;            ///< Middle-man optimization?
+    bool m_opt_sccp;                 ///< Sparse constant propagation?
+    bool m_opt_licm;                 ///< Hoist loop-invariant ops?
+    int m_opt_loop_unroll;           ///< Max ops of an unrolled loop
+    bool m_opt_deriv_demand;         ///< Recompute derivs needed from scratch?
+    bool m_opt_noise_memo;           ///< Share noise calls across layers?
+    int m_opt_fold_memo;             ///< Max memoized folded layers
     bool m_opt_texture_handle;       ///< Use texture handles?
+    bool m_opt_texture_fusion;       ///< Fuse lookups of one texture?
+    bool m_opt_hoist_transforms;     ///< Fetch repeated space matrices once?
     bool m_opt_seed_bblock_aliases;  ///< Turn on basic block alias seeds
     bool m_opt_useparam;  ///< Perform extra useparam analysis for culling run layer calls
     bool m_opt_groupdata;  ///< Move eligible parameters out of groupdata into locals
+    bool m_opt_groupdata_hot;  ///< Lay out most-referenced groupdata params first
+    bool m_opt_groupdata_share;  ///< Layers not run together share groupdata
+    bool m_opt_readonly_params;  ///< Read unchanging params from constants
     bool m_opt_batched_analysis;  ///< Perform extra analysis required for batched execution?
+    int m_opt_batched_analysis_memo;  ///< Max memoized batched analyses
+    int m_batch_autoselect;  ///< Trial runs per group choosing batched/scalar
+    bool m_batch_uniform_scalar;  ///< Run lane-identical batches as scalar?
+    bool m_batched_attribute_cache;  ///< Cache getattribute per batch?
     bool m_llvm_jit_fma;         ///< Allow fused multiply/add in JIT
     bool m_llvm_jit_aggressive;  ///< Turn on llvm "aggressive" JIT
     bool m_optimize_nondebug;    ///< Fully optimize non-debug!
     ustring m_llvm_jit_target;   ///< ISA target for JIT
+    ustring m_llvm_jit_cache_dir;  ///< Directory for cached JIT objects
+    ustring m_llvm_jit_isas;       ///< Other ISAs to put in the cache
+    ustring m_opt_snapshot_dir;    ///< Directory for optimized snapshots
+    int m_llvm_jit_tiered;         ///< Background threads for tiered JIT
+    int m_llvm_jit_threads;        ///< Threads for one group's codegen
+    int m_llvm_shared_ops;         ///< Min size of shared shadeops funcs
+    int m_llvm_shared_constants;   ///< Min bytes of pooled constant arrays
+    bool m_llvm_jit_lazy_entry;    ///< JIT entry layers on first use?
+    bool m_llvm_jit_group_memory;  ///< JIT each group into its own memory?
+    bool m_llvm_jit_huge_pages;    ///< JIT into huge page slabs?
+    int m_llvm_pgo;                ///< Record (1) or use (2) branch profiles
+    ustring m_llvm_pgo_dir;        ///< Directory of saved branch profiles
+    int m_llvm_layer_inline;       ///< Max layer cost to always inline
+    int m_llvm_layer_noinline;     ///< Min shared layer cost to never inline
     int m_vector_width;          ///< SIMD width maximum (8)
     int m_opt_passes;            ///< Opt passes per layer
+    int m_opt_threads;           ///< Threads optimizing one group's layers
     int m_llvm_optimize;         ///< OSL optimization strategy
     int m_debug;                 ///< Debugging output
     int m_llvm_debug;            ///< More LLVM debugging output
@@ -955,6 +1416,7 @@ private:
     ustring m_archive_filename;        ///< Name of filename for group archive
     std::string m_searchpath;          ///< Shader search path
     std::vector<std::string> m_searchpath_dirs;  ///< All searchpath dirs
+    std::string m_bundle_searchpath;             ///< Shader bundle files
     std::string m_library_searchpath;            ///< Library search path
     std::vector<std::string>
         m_library_searchpath_dirs;            ///< All library searchpath dirs
@@ -962,18 +1424,39 @@ private:
     std::vector<ustring> m_renderer_outputs;  ///< Names of renderer outputs
     std::vector<SymLocationDesc> m_symlocs;
     int m_max_local_mem_KB;  ///< Local storage can a shader use
+    int m_closure_pool_max_KB;  ///< Trim closure pools bigger than this
+    bool m_context_heap_presize;  ///< Size new context heaps for all groups?
+    int m_telemetry_interval;     ///< Sample 1 in N shades for telemetry
+    int m_pmu_interval;           ///< Read PMU counters for 1 in N shades
+    float m_stats_interval;       ///< Seconds between stats callbacks
     int m_compile_report;    ///< Print compilation report?
     bool m_use_optix;        ///< This is an OptiX-based renderer
     bool m_use_optix_cache;  ///< Renderer-enabled caching for OptiX ptx
     int m_max_optix_groupdata_alloc;  ///< Maximum OptiX groupdata buffer allocation
+    bool m_optix_wavefront;           ///< Generate OptiX wavefront kernels?
+    int m_optix_split_threshold;      ///< Local bytes that split layers
+    bool m_optix_host_jit;            ///< Also JIT OptiX groups for the CPU?
+    ustring m_optix_target_arch;      ///< GPU arch for PTX, if not the build's
+    ustring m_coherence_param;        ///< Param hashed into coherence keys
+    int m_device_arena_size;          ///< Pooled device block size, or 0
+    bool m_async_device_copies;       ///< Defer interactive param copies?
     bool m_buffer_printf;             ///< Buffer/batch printf output?
+    bool m_defer_printf;              ///< Format buffered output later?
     bool m_no_noise;                  ///< Substitute trivial noise calls
+    ustring m_noise_hash;             ///< Lattice hash for perlin noise
+    ustring m_math_precision;         ///< Transcendental ops' precision
     bool m_no_pointcloud;             ///< Substitute trivial pointcloud calls
+    ustring m_pointcloud_index;       ///< Spatial index for point clouds
     bool m_force_derivs;              ///< Force derivs on everything
     bool m_allow_shader_replacement;  ///< Allow shader masters to replace
     int m_exec_repeat;                ///< How many times to execute group
+    int m_raytype_variants;           ///< Raytype-specialized copies/group
+    int m_userdata_variants;          ///< Shades profiled for userdata copy
+    int m_debug_sample_interval;      ///< Run checked copy 1 in N shades
+    ustring m_debug_sample_raytype;   ///< Ray type that runs checked copy
     int m_opt_warnings;               ///< Warn on inability to optimize
     int m_gpu_opt_error;              ///< Error on inability to optimize
+    int m_opt_report;                 ///< Keep each group's opt report?
                                       ///<   away things that can't GPU.
 
     /// Experimental attributes to help tuning OptiX optimization passes
@@ -991,8 +1474,11 @@ private:
     std::shared_ptr<OIIO::ColorConfig>
         m_colorconfig;  ///< OIIO/OCIO color configuration
 
-    // Thread safety
+    // Thread safety: m_mutex guards shader loading and group construction,
+    // m_options_mutex the setting of options (see getattribute).
     mutable mutex m_mutex;
+    mutable spin_rw_mutex m_options_mutex;
+    ShadingSystem::TaskExecutor m_task_executor;  // guarded by m_options_mutex
 
     // Stats
     atomic_int m_stat_shaders_loaded;      ///< Stat: shaders loaded
@@ -1004,6 +1490,28 @@ private:
     atomic_int m_stat_instances_compiled;  ///< Stat: instances compiled
     atomic_int m_stat_groups_compiled;     ///< Stat: groups compiled
     atomic_int m_stat_empty_instances;     ///< Stat: shaders empty after opt
+    atomic_int m_stat_jit_cache_hits;      ///< Stat: groups JITed from cache
+    atomic_int m_stat_jit_cache_misses;    ///< Stat: groups added to cache
+    atomic_int m_stat_jit_cache_variants;  ///< Stat: other ISAs' code cached
+    atomic_int m_stat_snapshots_loaded;    ///< Stat: groups not optimized
+    atomic_int m_stat_snapshots_saved;     ///< Stat: snapshots written
+    atomic_int m_stat_background_jits;     ///< Stat: groups re-JITed fully
+    atomic_int m_stat_optix_split_groups;  ///< Stat: PTX redone, layers split
+    atomic_int m_stat_optix_host_jits;     ///< Stat: OptiX groups host JITed
+    atomic_ll m_stat_device_upload_bytes;  ///< Stat: pooled bytes uploaded
+    atomic_int m_stat_device_uploads;      ///< Stat: pooled uploads done
+    atomic_int m_stat_device_programs_compiled;  ///< Stat: (PTX,arch) compiles
+    atomic_int m_stat_device_programs_shared;    ///< Stat: ... reused
+    atomic_int m_stat_shared_ops_linked;   ///< Stat: shared shadeops calls
+    atomic_int m_stat_shared_constants;    ///< Stat: pooled const arrays
+    atomic_int m_stat_groups_shared;       ///< Stat: groups using a twin's JIT
+    atomic_int m_stat_fold_memo_hits;      ///< Stat: layers not re-folded
+    atomic_int m_stat_batched_analysis_memo_hits;  ///< Stat: ...not re-analyzed
+    atomic_int m_stat_lazy_layers_deferred;  ///< Stat: entry layers not JITed
+    atomic_int m_stat_lazy_layers_jitted;  ///< Stat: ...JITed when first run
+    atomic_int m_stat_parallel_codegens;   ///< Stat: groups split to codegen
+    atomic_int m_stat_pgo_instrumented;    ///< Stat: groups counting branches
+    atomic_int m_stat_pgo_applied;         ///< Stat: groups given profiles
     atomic_int m_stat_merged_inst;         ///< Stat: number of merged instances
     atomic_int m_stat_merged_inst_opt;     ///< Stat: merged insts after opt
     atomic_int m_stat_empty_groups;        ///< Stat: groups empty after opt
@@ -1014,12 +1522,16 @@ private:
     atomic_int m_stat_preopt_ops;          ///< Stat: pre-optimization ops
     atomic_int m_stat_postopt_ops;         ///< Stat: post-optimization ops
     atomic_int m_stat_middlemen_eliminated;  ///< Stat: middlemen eliminated
+    atomic_int m_stat_sccp_constants;  ///< Stat: reads made constant by SCCP
+    atomic_int m_stat_noise_calls_shared;    ///< Stat: noise calls memoized
+    atomic_int m_stat_derivs_removed;  ///< Stat: syms no longer needing derivs
     atomic_int m_stat_const_connections;     ///< Stat: const connections elim'd
     atomic_int m_stat_global_connections;   ///< Stat: global connections elim'd
     atomic_int m_stat_tex_calls_codegened;  ///< Stat: total texture calls
     atomic_int m_stat_tex_calls_as_handles;  ///< Stat: texture calls with handles
     atomic_int m_stat_useparam_ops;  ///< Stat: pre-optimization useparam ops
     atomic_int m_stat_call_layers_inserted;  ///< Stat: post-opt layer calls
+    double m_stat_startup_time;              ///< Stat: time constructing
     double m_stat_master_load_time;          ///< Stat: time loading masters
     double m_stat_optimization_time;         ///< Stat: time spent optimizing
     double m_stat_opt_locking_time;          ///<   locking time
@@ -1030,6 +1542,7 @@ private:
     double m_stat_llvm_opt_time;             ///<     llvm IR optimization time
     double m_stat_llvm_jit_time;             ///<     llvm JIT time
     double m_stat_inst_merge_time;           ///< Stat: time merging instances
+    double m_stat_background_jit_time;       ///< Stat: background re-JIT time
     double m_stat_getattribute_time;       ///< Stat: time spent in getattribute
     double m_stat_getattribute_fail_time;  ///< Stat: time spent in getattribute
     atomic_ll m_stat_getattribute_calls;   ///< Stat: Number of getattribute
@@ -1042,13 +1555,36 @@ private:
     atomic_ll m_stat_pointcloud_gets;
     atomic_ll m_stat_pointcloud_writes;
     atomic_ll m_stat_layers_executed;           ///< Total layers executed
-    atomic_ll m_stat_total_shading_time_ticks;  ///< Total shading time (ticks)
+    /// Total shading time (ticks), mutable for merge_profiles
+    mutable atomic_ll m_stat_total_shading_time_ticks;
     atomic_ll m_stat_reparam_calls_total;
     atomic_ll m_stat_reparam_bytes_total;
     atomic_ll m_stat_reparam_calls_changed;
     atomic_ll m_stat_reparam_bytes_changed;
+    atomic_ll m_stat_reparam_rebuilds;  ///< Groups re-optimized by ReParameter
+    atomic_ll m_stat_groups_evicted;    ///< Idle groups evicted for budget
+    atomic_ll m_stat_memory_evicted;    ///< ...and the bytes that freed
+    // Incremented by each enforce_memory_budget(); a group running notes
+    // the current value (with the "memory_budget" option set).
+    std::atomic<int> m_memory_epoch { 1 };
+    atomic_int m_stat_output_variants;  ///< Groups made by specialize_outputs
+    atomic_int m_stat_raytype_variants;  ///< Raytype-specialized group copies
+    atomic_int m_stat_debug_variants;    ///< Groups copied with debug checks
+    atomic_int m_stat_userdata_variants;  ///< Userdata-specialized copies
+    atomic_ll m_stat_userdata_misses;     ///< Shades that failed their guard
+    atomic_ll m_stat_traces_deferred;    ///< Rays traced by trace_deferred
+    atomic_ll m_stat_traces_strayed;     ///< Replayed shades that strayed
+    atomic_ll m_stat_formed_batches;     ///< Batches shaded by a BatchFormer
+    atomic_ll m_stat_formed_points;      ///< Points in BatchFormer batches
+    atomic_int m_stat_routed_batched;    ///< Groups found faster batched
+    atomic_int m_stat_routed_scalar;     ///< Groups found faster scalar
+    atomic_ll m_stat_uniform_batches;    ///< Batches run once as scalar
+    atomic_ll m_stat_attribute_gathers;  ///< get_attributes calls
+    atomic_ll m_stat_attribute_cache_hits;  ///< Batched lookups from cache
+    atomic_ll m_stat_closure_pool_trims;  ///< Closure pools trimmed back
 
     int m_stat_max_llvm_local_mem;     ///< Stat: max LLVM local mem
+    size_t m_max_groupdata_size;       ///< Largest heap of any JITed group
     PeakCounter<off_t> m_stat_memory;  ///< Stat: all shading system memory
 
     PeakCounter<off_t> m_stat_mem_master;  ///< Stat: master-related mem
@@ -1061,11 +1597,46 @@ private:
     PeakCounter<off_t> m_stat_mem_inst_syms;
     PeakCounter<off_t> m_stat_mem_inst_paramvals;
     PeakCounter<off_t> m_stat_mem_inst_connections;
+    PeakCounter<off_t> m_stat_mem_closures;  ///< Stat: context closure pools
 
     mutable spin_mutex m_stat_mutex;  ///< Mutex for non-atomic stats
     ClosureRegistry m_closure_registry;
     std::vector<std::weak_ptr<ShaderGroup>> m_all_shader_groups;
     mutable spin_mutex m_all_shader_groups_mutex;
+    // Per-thread execution profiles not yet merged into the totals
+    std::vector<ThreadProfile*> m_thread_profiles;
+    mutable spin_mutex m_thread_profiles_mutex;
+    // JITed groups available to share with identical ones, by canonical
+    // hash, protected by m_twin_groups_mutex.
+    std::unordered_map<uint64_t, std::weak_ptr<ShaderGroup>> m_twin_groups;
+    spin_mutex m_twin_groups_mutex;
+    // Branch profiles, by group canonical hash and size, protected by
+    // m_branch_profiles_mutex.
+    std::map<std::pair<uint64_t, size_t>, std::shared_ptr<std::vector<uint64_t>>>
+        m_branch_profiles;
+    std::mutex m_branch_profiles_mutex;
+    // Layers after their first optimization pass, by everything that pass
+    // depends on (see RuntimeOptimizer::fold_memo_key), protected by
+    // m_folded_layers_mutex.
+    std::unordered_map<std::string, std::shared_ptr<const FoldedLayer>>
+        m_folded_layers;
+    spin_mutex m_folded_layers_mutex;
+    // Batched analyses of layers, by all the code and inputs they depend
+    // on (see BatchedAnalysis::memo_key), protected by
+    // m_batched_analyses_mutex.
+    std::unordered_map<std::string, std::shared_ptr<const BatchedLayerAnalysis>>
+        m_batched_analyses;
+    spin_mutex m_batched_analyses_mutex;
+    // Parsed dict_find documents shared by all contexts, made on first
+    // use and protected by m_dictionary_store_mutex.
+    std::shared_ptr<DictionaryStore> m_dictionary_store;
+    spin_mutex m_dictionary_store_mutex;
+    // UDIM tile tables by texture handle (nullptr for handles that aren't
+    // UDIM), protected by m_udim_tables_mutex.
+    std::unordered_map<TextureSystem::TextureHandle*,
+                       std::unique_ptr<UdimTileTable>>
+        m_udim_tables;
+    spin_mutex m_udim_tables_mutex;
 
     // State for entering shader groups -- this is only for the
     // non-threadsafe calls to Parameter/etc that don't take a group
@@ -1074,8 +1645,34 @@ private:
 
     atomic_int m_groups_to_compile_count;
     atomic_int m_threads_currently_compiling;
+
+    // Tiered JIT: groups awaiting their fully optimized JIT, and the
+    // threads that do it. All protected by m_background_jit_mutex.
+    void background_jit_worker();
+    void background_jit_group(ShaderGroup& group, ShadingContext* ctx);
+    std::deque<std::weak_ptr<ShaderGroup>> m_background_jit_queue;
+    std::mutex m_background_jit_mutex;
+    std::condition_variable m_background_jit_cv;
+    std::condition_variable m_background_jit_idle_cv;
+    OIIO::thread_group m_background_jit_threads;
+    int m_background_jit_nthreads = 0;
+    int m_background_jit_busy     = 0;  ///< Threads at work on a group
+    bool m_background_jit_stop    = false;
+
+    // The set_stats_callback function, and the thread calling it, all
+    // protected by m_stats_callback_mutex.
+    void stats_callback_worker();
+    ShadingSystem::StatsFunc m_stats_callback;
+    std::mutex m_stats_callback_mutex;
+    std::condition_variable m_stats_callback_cv;
+    std::unique_ptr<std::thread> m_stats_callback_thread;
+    bool m_stats_callback_stop = false;
     mutable std::map<ustring, long long> m_group_profile_times;
-    // N.B. group_profile_times is protected by m_stat_mutex.
+    // Seconds spent compiling each group, with its name for the reports,
+    // by group id -- distinct groups may well share a name.
+    std::map<int, std::pair<ustring, double>> m_group_compile_times;
+    // N.B. group_profile_times and group_compile_times are protected by
+    // m_stat_mutex.
 
     LLVM_Util::ScopedJitMemoryUser m_llvm_jit_memory_user;
 
@@ -1089,6 +1686,7 @@ private:
     friend class BackendLLVM;
 #if OSL_USE_BATCHED
     friend class BatchedBackendLLVM;
+    friend class BatchedAnalysis;
 #endif
 };
 
@@ -1181,7 +1779,10 @@ public:
     typedef ShaderInstanceRef ref;
     ShaderInstance(ShaderMaster::ref master,
                    string_view layername = string_view());
-    ShaderInstance(const ShaderInstance& copy);  // not defined
+    /// Copy an instance that has not been optimized yet (its code and
+    /// symbols still live only in the master) -- its parameter values,
+    /// hints, connections and layer flags.
+    ShaderInstance(const ShaderInstance& copy);
     ~ShaderInstance();
 
     /// Return the layer name of this instance
@@ -1202,6 +1803,17 @@ public:
 
     /// Apply pending parameters
     void parameters(const ParamValueList& params, cspan<ParamHints> hints);
+    /// Apply parameters whose indices are already known: params[i] sets
+    /// parameter paramindex[i], or is found by name if that is -1.
+    void parameters(const ParamValueList& params, cspan<ParamHints> hints,
+                    cspan<int> paramindex);
+
+    /// Before the instance is optimized, replace the instance value of
+    /// parameter i with val, whose type must have the parameter's base
+    /// type and number of values. Set *changed to whether the value is
+    /// different from before. Return false if the type doesn't fit.
+    bool set_param_value(int i, TypeDesc type, const void* val,
+                         bool* changed = nullptr);
 
     /// Find the named symbol, return its index in the symbol array, or
     /// -1 if not found.
@@ -1268,6 +1880,17 @@ public:
         return mem;
     }
 
+    /// Bytes of memory held by the instance: itself, its symbols, code,
+    /// parameter values and connections.
+    size_t memory_used() const
+    {
+        return sizeof(ShaderInstance) + vectorbytes(m_instoverrides)
+               + vectorbytes(m_instsymbols) + vectorbytes(m_instops)
+               + vectorbytes(m_instargs) + vectorbytes(m_iparams)
+               + vectorbytes(m_fparams) + vectorbytes(m_sparams)
+               + vectorbytes(m_connections);
+    }
+
     /// Return the unique ID of this instance.
     ///
     int id() const { return m_id; }
@@ -1464,6 +2087,10 @@ public:
     /// Sorry, can't think of a short name that isn't too cryptic.
     void evaluate_writes_globals_and_userdata_params();
 
+    /// Fill refs (resized to the number of symbols) with how many op
+    /// arguments reference each symbol, a static estimate of how hot it is.
+    void count_symbol_refs(std::vector<int>& refs) const;
+
     /// Small data structure to hold just the symbol info that the
     /// instance overrides from the master copy.
     struct SymOverrideInfo {
@@ -1528,6 +2155,14 @@ public:
     /// equivalent, in that they may be merged into a single instance?
     bool mergeable(const ShaderInstance& b, const ShaderGroup& g) const;
 
+    /// A hash of what mergeable() compares that is cheap to find: the
+    /// master, the incoming connections (with their source layers), and
+    /// before optimization, the parameter values. Instances that are
+    /// mergeable always have the same merge_hash(), so only instances
+    /// with the same hash need the full comparison. It changes whenever
+    /// the connections are rewired, so isn't kept.
+    uint64_t merge_hash() const;
+
 private:
     ShaderMaster::ref m_master;          ///< Reference to the master
     SymOverrideInfoVec m_instoverrides;  ///< Instance parameter info
@@ -1570,6 +2205,15 @@ public:
         m_current_block = 0;
     }
 
+    /// Keep the pool's blocks, current and future, on a NUMA node (see
+    /// numa_prefer_node).
+    void numa_node(int node)
+    {
+        m_numa_node = node;
+        for (auto& b : m_blocks)
+            numa_prefer_node(b.get(), BlockSize, node);
+    }
+
     // avoid 'attempting to reference a deleted function' of std::unique_ptr<char>s
     // in reference to those member variables of ShadingContext
     SimplePool(const SimplePool&)            = delete;
@@ -1596,8 +2240,11 @@ public:
         if (m_block_offset + size > BlockSize) {
             // the current block doesn't have enough room, make a new block
             m_current_block++;
-            if (m_blocks.size() == m_current_block)
+            if (m_blocks.size() == m_current_block) {
                 m_blocks.emplace_back(new char[BlockSize]);
+                numa_prefer_node(m_blocks.back().get(), BlockSize,
+                                 m_numa_node);
+            }
             m_block_offset
                 = alignment_offset_calc(m_blocks[m_current_block].get(),
                                         alignment);
@@ -1614,6 +2261,24 @@ public:
         m_block_offset  = 0;
     }
 
+    static constexpr size_t blocksize() { return BlockSize; }
+
+    /// Total bytes held in blocks, used or not.
+    size_t capacity() const { return m_blocks.size() * BlockSize; }
+
+    /// After a clear(), free all but the first max_blocks blocks (at least
+    /// one is always kept).  Returns the number of bytes released.
+    size_t trim(size_t max_blocks)
+    {
+        OSL_DASSERT(m_current_block == 0);
+        max_blocks = std::max(max_blocks, size_t(1));
+        if (m_blocks.size() <= max_blocks)
+            return 0;
+        size_t released = (m_blocks.size() - max_blocks) * BlockSize;
+        m_blocks.resize(max_blocks);
+        return released;
+    }
+
 private:
     static inline size_t alignment_offset_calc(void* ptr, size_t alignment)
     {
@@ -1628,6 +2293,7 @@ private:
         m_blocks;            ///< Hold blocks of BlockSize bytes
     size_t m_current_block;  ///< Index into the m_blocks array
     size_t m_block_offset;   ///< Offset from the start of the current block
+    int m_numa_node = -1;    ///< NUMA node for the blocks, or -1
 };
 
 /// Represents a single message for use by getmessage and setmessage opcodes
@@ -1661,7 +2327,9 @@ struct Message {
 
 
 /// Represents the list of messages set by a given shader using setmessage and
-/// getmessage.
+/// getmessage.  Names are unique within the list, so besides the linked list
+/// the messages are indexed by a small open-addressed hash on the name.  Once
+/// the table is too full to probe cheaply, find() reverts to walking the list.
 struct MessageList {
     MessageList() : list_head(nullptr), message_data() {}
 
@@ -1669,10 +2337,20 @@ struct MessageList {
     {
         list_head = nullptr;
         message_data.clear();
+        if (m_count)
+            std::fill(std::begin(m_table), std::end(m_table), nullptr);
+        m_count = 0;
     }
 
     const Message* find(ustringhash name) const
     {
+        if (m_count <= MaxHashed) {
+            size_t i = name.hash() & (HashSize - 1);
+            for (; m_table[i]; i = (i + 1) & (HashSize - 1))
+                if (m_table[i]->name == name)
+                    return m_table[i];
+            return nullptr;
+        }
         for (const Message* m = list_head; m; m = m->next)
             if (m->name == name)
                 return m;  // name matches
@@ -1688,17 +2366,35 @@ struct MessageList {
             list_head->data = message_data.alloc(type.size());
             memcpy(list_head->data, data, type.size());
         }
+        if (++m_count <= MaxHashed) {
+            size_t i = name.hash() & (HashSize - 1);
+            while (m_table[i])
+                i = (i + 1) & (HashSize - 1);
+            m_table[i] = list_head;
+        }
     }
 
 private:
+    static constexpr int HashSize  = 64;  ///< Must be a power of 2
+    static constexpr int MaxHashed = HashSize * 3 / 4;
+
     Message* list_head;
     SimplePool<1024> message_data;
+    Message* m_table[HashSize] = {};  ///< Open-addressed on name hash
+    int m_count                = 0;   ///< Messages in the list
 };
 
 
 #if OSL_USE_BATCHED
 
+/// Storage for the messages of a batched execution, which the
+/// width-specific BatchedMessageList manages.  As with MessageList, the
+/// linked list is also indexed by a small open-addressed hash on the name,
+/// until it holds too many messages to probe cheaply.
 struct BatchedMessageBuffer {
+    static constexpr int HashSize  = 64;  ///< Must be a power of 2
+    static constexpr int MaxHashed = HashSize * 3 / 4;
+
     BatchedMessageBuffer() : list_head(nullptr), message_data() {}
     BatchedMessageBuffer(const BatchedMessageBuffer&)            = delete;
     BatchedMessageBuffer& operator=(const BatchedMessageBuffer&) = delete;
@@ -1707,10 +2403,45 @@ struct BatchedMessageBuffer {
     {
         list_head = NULL;
         message_data.clear();
+        if (count)
+            std::fill(std::begin(table), std::end(table), nullptr);
+        count = 0;
     }
 
     void* list_head;
     SimplePool<16 * 1024> message_data;
+    void* table[HashSize] = {};  ///< Open-addressed on name hash
+    int count             = 0;   ///< Messages in the list
+};
+
+
+
+// Renderer attributes already retrieved during the current batched
+// execution (see the "batched_attribute_cache" option), along with the
+// lanes each was requested for and found on.
+struct BatchedAttributeCache {
+    static constexpr int BlockSize = 32 * 1024;
+
+    struct Entry {
+        ustring object;
+        ustring name;
+        TypeDesc type;
+        bool derivs;
+        Mask<MaxSupportedSimdLaneCount> requested;
+        Mask<MaxSupportedSimdLaneCount> found;
+        void* data;  ///< Wide value (and derivs) laid out as MaskedData
+    };
+
+    void clear()
+    {
+        entries.clear();
+        data.clear();
+        prefetched = false;
+    }
+
+    std::vector<Entry> entries;
+    SimplePool<BlockSize> data;
+    bool prefetched = false;  ///< Gathered the group's attributes yet?
 };
 
 
@@ -1722,7 +2453,7 @@ struct BatchedMessageBuffer {
 
 /// A ShaderGroup consists of one or more layers (each of which is a
 /// ShaderInstance), and the connections among them.
-class ShaderGroup {
+class ShaderGroup : public std::enable_shared_from_this<ShaderGroup> {
 public:
     ShaderGroup(string_view name, ShadingSystemImpl& shadingsys);
     ~ShaderGroup();
@@ -1757,14 +2488,30 @@ public:
     /// Return a reference to the shading system for this group.
     ShadingSystemImpl& shadingsys() const { return m_shadingsys; }
 
-    int optimized() const { return m_optimized; }
-    void optimized(int opt) { m_optimized = opt; }
+    // The optimized/jitted flags are read without the group's lock, to
+    // skip taking it once the work is done, so they're set (under the
+    // lock) only after everything they vouch for, and read with acquire
+    // ordering so a thread that sees them set also sees that work.
+    int optimized() const
+    {
+        return m_optimized.load(std::memory_order_acquire);
+    }
+    void optimized(int opt) { m_optimized.store(opt, std::memory_order_release); }
 
-    int jitted() const { return m_jitted; }
-    void jitted(int jitted) { m_jitted = jitted; }
+    int jitted() const { return m_jitted.load(std::memory_order_acquire); }
+    void jitted(int jitted)
+    {
+        m_jitted.store(jitted, std::memory_order_release);
+    }
 
-    int batch_jitted() const { return m_batch_jitted; }
-    void batch_jitted(int batch_jitted) { m_batch_jitted = batch_jitted; }
+    int batch_jitted() const
+    {
+        return m_batch_jitted.load(std::memory_order_acquire);
+    }
+    void batch_jitted(int batch_jitted)
+    {
+        m_batch_jitted.store(batch_jitted, std::memory_order_release);
+    }
 
     size_t llvm_groupdata_size() const { return m_llvm_groupdata_size; }
     void llvm_groupdata_size(size_t size) { m_llvm_groupdata_size = size; }
@@ -1778,30 +2525,49 @@ public:
         m_llvm_groupdata_wide_size = size;
     }
 
-    RunLLVMGroupFunc llvm_compiled_version() const
-    {
-        return m_llvm_compiled_version;
-    }
-    void llvm_compiled_version(RunLLVMGroupFunc func)
-    {
-        m_llvm_compiled_version = func;
-    }
-    RunLLVMGroupFunc llvm_compiled_init() const { return m_llvm_compiled_init; }
-    void llvm_compiled_init(RunLLVMGroupFunc func)
-    {
-        m_llvm_compiled_init = func;
-    }
-    RunLLVMGroupFunc llvm_compiled_layer(int layer) const
+    /// The entry points of one JIT of the group, and the size of the
+    /// groupdata they use. Each JIT of the group builds a new one and
+    /// publishes it whole, so that a shade which reads it once, before it
+    /// starts, sees a matching set of functions even while a background
+    /// re-JIT replaces them. Only the entry layers left out of the JIT
+    /// (see "llvm_jit_lazy_entry") change after that, each filled in
+    /// once, the first time it runs.
+    struct CompiledCode {
+        explicit CompiledCode(int nlayers) : layers(nlayers)
+        {
+            for (auto& f : layers)
+                f.store(nullptr, std::memory_order_relaxed);
+        }
+        RunLLVMGroupFunc init    = nullptr;
+        RunLLVMGroupFunc version = nullptr;  ///< Unless it has entry layers
+        /// Entry layers, by layer. Sized once, when the code is built.
+        std::vector<std::atomic<RunLLVMGroupFunc>> layers;
+        size_t groupdata_size = 0;
+        LLVM_Util::DeferredCodeRef deferred_code;  ///< Entry layers to JIT
+        std::vector<std::string> deferred_names;   ///< ...by layer, or ""
+
+        RunLLVMGroupFunc layer(int layer) const
+        {
+            return layer >= 0 && layer < (int)layers.size()
+                       ? layers[layer].load(std::memory_order_acquire)
+                       : nullptr;
+        }
+    };
+
+    /// The group's most recently published compiled code, or nullptr if
+    /// it hasn't been JITed.
+    CompiledCode* llvm_compiled() const
     {
-        return layer < (int)m_llvm_compiled_layers.size()
-                   ? m_llvm_compiled_layers[layer]
-                   : NULL;
+        return m_llvm_compiled.load(std::memory_order_acquire);
     }
-    void llvm_compiled_layer(int layer, RunLLVMGroupFunc func)
+    /// Publish new compiled code for the group (holding its lock). Earlier
+    /// code stays alive as long as the group does, since shades that read
+    /// it may still be running it.
+    void llvm_compiled(std::shared_ptr<CompiledCode> code)
     {
-        m_llvm_compiled_layers.resize((size_t)nlayers(), NULL);
-        if (layer < nlayers())
-            m_llvm_compiled_layers[layer] = func;
+        CompiledCode* ptr = code.get();
+        m_llvm_compiled_kept.push_back(std::move(code));
+        m_llvm_compiled.store(ptr, std::memory_order_release);
     }
 
 #if OSL_USE_BATCHED
@@ -1841,6 +2607,20 @@ public:
 
     long long int executions() const { return m_executions; }
 
+    /// Number of buckets of the execution time histogram; bucket i counts
+    /// the executes that took [2^i, 2^(i+1)) timer ticks (the last one
+    /// collects everything longer).
+    static constexpr int exec_histogram_buckets = 32;
+
+    /// The time histogram bucket of an execute that took `ticks`.
+    static int exec_histogram_bucket(long long ticks)
+    {
+        int b = 0;
+        while ((ticks >>= 1) && b < exec_histogram_buckets - 1)
+            ++b;
+        return b;
+    }
+
     void start_running()
     {
 #ifndef NDEBUG
@@ -1857,6 +2637,202 @@ public:
 
     std::string serialize() const;
 
+    /// Hash the layers, their connections and all their parameter values
+    /// except the interactive ones, which is what determines the code the
+    /// group compiles to, also keeping the text hashed if keep_text is
+    /// true. Must be called with the group complete, but not yet
+    /// optimized, and not while it is locked.
+    void compute_canonical_hash(bool keep_text = false);
+
+    /// Combine the hash of the layers with the group attributes that also
+    /// affect the compiled code. Two groups with equal canonical hashes
+    /// will almost surely compile to the same code. Returns 0 if the
+    /// layers were never hashed.
+    uint64_t canonical_hash() const;
+
+    /// Do this group and other surely compile to the same code, comparing
+    /// what their canonical hashes were computed from? False unless both
+    /// kept the text of their layers (see compute_canonical_hash).
+    bool same_canonical_code(const ShaderGroup& other) const;
+
+    /// Take on the optimized layers and compiled code of twin, a JITed
+    /// group that has the same canonical code, keeping our own interactive
+    /// parameter values. Both groups must be locked.
+    void share_compiled(const ShaderGroup& twin);
+
+    /// Wall clock times (in seconds) of the phases of compiling the group.
+    struct CompileTimes {
+        double oso_load         = 0;  ///< Loading the layers' .oso files
+        double runtime_opt      = 0;  ///< RuntimeOptimizer, in total
+        double batched_analysis = 0;  ///<   of which batched analysis
+        double llvm_setup       = 0;  ///< Preparing the LLVM module
+        double llvm_irgen       = 0;  ///< Generating the LLVM IR
+        double llvm_opt         = 0;  ///< LLVM optimization passes
+        double llvm_jit         = 0;  ///< Machine code generation
+        std::vector<double> layer_opt;    ///< RuntimeOptimizer per layer
+        std::vector<double> layer_irgen;  ///< LLVM IR generation per layer
+    };
+    const CompileTimes& compile_times() const { return m_compile_times; }
+
+    /// A human-readable table of compile_times().
+    std::string compile_breakdown() const;
+
+    /// Keep unoptimized copies of the layers, so that the group can later
+    /// be optimized again with different parameter values.
+    void save_pristine_layers();
+
+    /// Are there unoptimized copies of the layers to rebuild from?
+    bool has_pristine_layers() const { return !m_pristine_layers.empty(); }
+
+    /// The unoptimized copy of layer i.
+    ShaderInstance* pristine_layer(int i) const
+    {
+        return m_pristine_layers[i].get();
+    }
+
+    /// Replace the layers with fresh copies of the pristine ones and forget
+    /// everything learned by optimizing and JITing the group, so that the
+    /// next execution optimizes it again. The group must be locked, and
+    /// the ops of the current layers must already have been released.
+    void restore_pristine_layers();
+
+    /// Note that the group ran (or was compiled) during the given
+    /// enforce_memory_budget() epoch, which makes it the most recently
+    /// used. Only writes when the epoch changed, to keep the cache line
+    /// shared among the threads running the group.
+    void mark_used(int epoch)
+    {
+        if (m_last_used_epoch.load(std::memory_order_relaxed) != epoch)
+            m_last_used_epoch.store(epoch, std::memory_order_relaxed);
+    }
+    int last_used_epoch() const
+    {
+        return m_last_used_epoch.load(std::memory_order_relaxed);
+    }
+
+    /// Hold on to JIT memory that the group's code lives in, so that it is
+    /// freed when the group no longer needs it.
+    void add_jit_memory(LLVM_Util::JitMemoryRef memory)
+    {
+        m_llvm_jit_memory.push_back(std::move(memory));
+    }
+
+    /// Count bytes of JITed code and data as the group's.
+    void add_jit_bytes(size_t bytes) { m_llvm_jit_bytes += bytes; }
+    size_t jit_bytes() const { return m_llvm_jit_bytes; }
+
+    /// Bytes of memory held for the group: its layers (optimized and
+    /// pristine), its JITed code, PTX and interactive parameters.
+    size_t memory_used() const;
+
+    /// Is this a variant of another group that is only asked to produce
+    /// pass_outputs()?
+    bool has_pass_outputs() const { return m_has_pass_outputs; }
+
+    /// The sorted names ("param" or "layer.param") of the renderer outputs
+    /// this variant must produce. The others may be optimized away.
+    const std::vector<ustring>& pass_outputs() const { return m_pass_outputs; }
+
+    /// Most raytype-specialized variants kept per group.
+    static constexpr int max_raytype_variants = 8;
+
+    /// The variant specialized for the given (masked) ray types, if one
+    /// was made. Safe to call without locking the group.
+    ShaderGroup* find_raytype_variant(int raytypes) const
+    {
+        int n = m_num_raytype_variants.load(std::memory_order_acquire);
+        for (int i = 0; i < n; ++i)
+            if (m_raytype_variant_keys[i] == raytypes)
+                return m_raytype_variant_groups[i].get();
+        return nullptr;
+    }
+
+    int num_raytype_variants() const { return m_num_raytype_variants; }
+
+    /// Remember the variant for the given ray types. The group must be
+    /// locked, and have room for another variant.
+    void add_raytype_variant(int raytypes, ShaderGroupRef variant)
+    {
+        int n = m_num_raytype_variants.load(std::memory_order_relaxed);
+        OSL_ASSERT(n < max_raytype_variants);
+        m_raytype_variant_keys[n]   = raytypes;
+        m_raytype_variant_groups[n] = std::move(variant);
+        m_num_raytype_variants.store(n + 1, std::memory_order_release);
+    }
+
+    /// The variants made from this group by specialize_outputs so far.
+    std::vector<ShaderGroupRef> output_variants() const
+    {
+        std::vector<ShaderGroupRef> variants;
+        spin_lock lock(m_output_variants_mutex);
+        for (auto&& v : m_output_variants)
+            variants.push_back(v.second);
+        return variants;
+    }
+
+    /// The variants made from this group by raytype_variant so far.
+    std::vector<ShaderGroupRef> raytype_variants() const
+    {
+        int n = m_num_raytype_variants.load(std::memory_order_acquire);
+        return std::vector<ShaderGroupRef>(m_raytype_variant_groups,
+                                           m_raytype_variant_groups + n);
+    }
+
+    /// Is this the copy of a group made by debug_variant, compiled with
+    /// the checks of "debug_nan" and "debug_uninit" whatever those are set
+    /// to?
+    bool debug_checks() const { return m_debug_checks; }
+
+    /// The variant made by debug_variant, if one was. Safe to call
+    /// without locking the group.
+    ShaderGroup* find_debug_variant() const
+    {
+        return m_debug_variant_ptr.load(std::memory_order_acquire);
+    }
+
+    /// Remember the variant with debug checks. The group must be locked.
+    void set_debug_variant(ShaderGroupRef variant)
+    {
+        m_debug_variant = std::move(variant);
+        m_debug_variant_ptr.store(m_debug_variant.get(),
+                                  std::memory_order_release);
+    }
+
+    /// The variant made by userdata_variant, if one was. Safe to call
+    /// without locking the group.
+    ShaderGroup* find_userdata_variant() const
+    {
+        return m_userdata_variant_ptr.load(std::memory_order_acquire);
+    }
+
+    /// Remember the variant specialized on userdata. The group must be
+    /// locked, and m_userdata_profile hold what the variant assumes.
+    void set_userdata_variant(ShaderGroupRef variant)
+    {
+        m_userdata_variant = std::move(variant);
+        m_userdata_variant_ptr.store(m_userdata_variant.get(),
+                                     std::memory_order_release);
+    }
+
+    /// How a BatchFormer should shade this group.
+    enum ExecRoute { RouteMeasuring = 0, RouteBatched = 1, RouteScalar = 2 };
+
+    ExecRoute exec_route() const { return ExecRoute(int(m_exec_route)); }
+
+    /// While measuring, whether the next batch should be run batched
+    /// (otherwise point by point through the scalar JIT).
+    bool exec_route_try_batched() const
+    {
+        return m_exec_route_trials[1] <= m_exec_route_trials[0];
+    }
+
+    /// Account for nanoseconds spent shading npoints batched or not while
+    /// measuring. Once each has been tried 'trials' times, settle on the
+    /// one with the lower cost per point, and return true if this call
+    /// made that choice.
+    bool record_exec_route(bool batched, int npoints, long long ns,
+                           int trials);
+
     void lock() const { m_mutex.lock(); }
     void unlock() const { m_mutex.unlock(); }
 
@@ -1964,6 +2940,9 @@ public:
     // live with the group and copy the initial data.
     void setup_interactive_arena(cspan<uint8_t> paramblock);
 
+    // Release the device copy of the interactive params, if any.
+    void free_device_interactive_arena();
+
     uint8_t* interactive_arena_ptr() { return m_interactive_arena.get(); }
 
     device_ptr<uint8_t>& device_interactive_arena()
@@ -1971,6 +2950,32 @@ public:
         return m_device_interactive_arena;
     }
 
+    // Note that bytes [begin,end) of the interactive arena changed and
+    // are to be copied to the device on the next upload.
+    void mark_interactive_dirty(size_t begin, size_t end)
+    {
+        spin_lock lock(m_interactive_dirty_mutex);
+        if (m_interactive_dirty_begin == m_interactive_dirty_end) {
+            m_interactive_dirty_begin = begin;
+            m_interactive_dirty_end   = end;
+        } else {
+            m_interactive_dirty_begin = std::min(m_interactive_dirty_begin,
+                                                 begin);
+            m_interactive_dirty_end = std::max(m_interactive_dirty_end, end);
+        }
+    }
+
+    // Retrieve and clear the changed range of the interactive arena,
+    // returning false if nothing changed.
+    bool take_interactive_dirty(size_t& begin, size_t& end)
+    {
+        spin_lock lock(m_interactive_dirty_mutex);
+        begin = m_interactive_dirty_begin;
+        end   = m_interactive_dirty_end;
+        m_interactive_dirty_begin = m_interactive_dirty_end = 0;
+        return begin != end;
+    }
+
     struct InteractiveParamData {
         int layer;
         ustring name;
@@ -2006,31 +3011,43 @@ public:
     }
 
 private:
+    // serialize() without locking, optionally leaving out the values of
+    // interactive parameters.
+    std::string serialize_unlocked(bool interactive_values) const;
+
     // Put all the things that are read-only (after optimization) and
     // needed on every shade execution at the front of the struct, as much
     // together on one cache line as possible.
-    volatile int m_optimized = 0;  ///< Is it already optimized?
-    volatile int m_jitted    = 0;  ///< Is it already jitted?
+    std::atomic<int> m_optimized { 0 };  ///< Is it already optimized?
+    std::atomic<int> m_jitted { 0 };     ///< Is it already jitted?
     bool m_does_nothing
         = false;  ///< Is the shading group just func() { return; }
-    volatile int m_batch_jitted
-        = 0;  ///< Is it already jitted for batch execution?
+    std::atomic<int> m_batch_jitted { 0 };  ///< Jitted for batched execution?
+    bool m_needs_rejit = false;  ///< Running quick JIT, full one pending?
     size_t m_llvm_groupdata_size = 0;  ///< Heap size needed for its groupdata
     size_t m_llvm_groupdata_wide_size
         = 0;                     ///< Heap size needed for its wide groupdata
     int m_id;                    ///< Unique ID for the group
     int m_num_entry_layers = 0;  ///< Number of marked entry layers
-    RunLLVMGroupFunc m_llvm_compiled_version = nullptr;
-    RunLLVMGroupFunc m_llvm_compiled_init    = nullptr;
-    std::vector<RunLLVMGroupFunc> m_llvm_compiled_layers;
+    std::atomic<CompiledCode*> m_llvm_compiled { nullptr };  ///< Published
+    std::vector<std::shared_ptr<CompiledCode>> m_llvm_compiled_kept;
+    // JIT memory of its own holding its code, if it has any (see
+    // jit_group_memory), and the bytes JITed for it wherever they are.
+    std::vector<LLVM_Util::JitMemoryRef> m_llvm_jit_memory;
+    size_t m_llvm_jit_bytes = 0;
+    std::atomic<int> m_last_used_epoch { 0 };  ///< See mark_used()
 #if OSL_USE_BATCHED
     RunLLVMGroupFuncWide m_llvm_compiled_wide_version = nullptr;
     RunLLVMGroupFuncWide m_llvm_compiled_wide_init    = nullptr;
     std::vector<RunLLVMGroupFuncWide> m_llvm_compiled_wide_layers;
 #endif
     std::vector<ShaderInstanceRef> m_layers;
+    std::vector<ShaderInstanceRef> m_pristine_layers;  ///< Unoptimized copies
+    CompileTimes m_compile_times;  ///< How long compiling it took
+    std::string m_opt_report;      ///< See the "opt_report" option
     ustring m_name;
     int m_exec_repeat     = 1;   ///< How many times to execute group
+    ustring m_math_precision;    ///< Tier of the transcendental ops
     int m_raytype_queries = -1;  ///< Bitmask of raytypes queried
     int m_raytypes_on     = 0;   ///< Bitmask of raytypes we assume to be on
     int m_raytypes_off    = 0;   ///< Bitmask of raytypes we assume to be off
@@ -2046,22 +3063,79 @@ private:
     std::vector<char> m_userdata_derivs;
     std::vector<int> m_userdata_layers;
     std::vector<void*> m_userdata_init_vals;
+    // Userdata fetched all at once by the group init (indices into the
+    // m_userdata_* vectors), when it isn't retrieved lazily.
+    std::vector<int> m_userdata_gathered;
+    // Noise calls that compute the same value in more than one layer share
+    // a groupdata slot: whichever runs first stores its result there and
+    // the others copy it out.  One NoiseMemo per call, one type per slot.
+    struct NoiseMemo {
+        int layer;  ///< Layer of the noise op
+        int opnum;  ///< Index of the noise op within its layer
+        int slot;   ///< Shared result slot
+    };
+    std::vector<NoiseMemo> m_noise_memos;
+    std::vector<TypeSpec> m_noise_memo_types;  ///< Result type of each slot
+    std::vector<char> m_noise_memo_derivs;     ///< Does the slot hold derivs?
     std::vector<ustring> m_attributes_needed;
     std::vector<ustring> m_attribute_scopes;
     std::vector<TypeDesc> m_attribute_types;
     std::vector<char> m_attribute_derivs;
     std::vector<ustring> m_renderer_outputs;  ///< Names of renderer outputs
+    std::vector<ustring> m_pass_outputs;      ///< Outputs kept by a variant
+    bool m_has_pass_outputs = false;          ///< Is m_pass_outputs in use?
+    std::map<std::vector<ustring>, ShaderGroupRef> m_output_variants;
+    mutable spin_mutex m_output_variants_mutex;
+    atomic_int m_num_raytype_variants { 0 };
+    int m_raytype_variant_keys[max_raytype_variants];
+    ShaderGroupRef m_raytype_variant_groups[max_raytype_variants];
+    bool m_debug_checks = false;     ///< Compiled with NaN/uninit checks?
+    ShaderGroupRef m_debug_variant;  ///< Copy made by debug_variant
+    std::atomic<ShaderGroup*> m_debug_variant_ptr { nullptr };
+    // What each userdata (of those needing no derivs) was in the first
+    // shade profiled by userdata_variant, and whether any shade since has
+    // seen it differ. Once the variant is made, only the userdata it
+    // assumes are left.
+    struct UserdataProfile {
+        int index;                ///< Into the m_userdata_* vectors
+        bool found;               ///< Did the renderer have it?
+        bool varies;              ///< Has it differed since?
+        std::vector<char> value;  ///< What it was, if found
+    };
+    std::vector<UserdataProfile> m_userdata_profile;
+    int m_userdata_shades_profiled = 0;  ///< Shades recorded so far
+    std::atomic<bool> m_userdata_profiled { false };  ///< Done recording?
+    mutable spin_mutex m_userdata_profile_mutex;
+    ShaderGroupRef m_userdata_variant;  ///< Copy made by userdata_variant
+    std::atomic<ShaderGroup*> m_userdata_variant_ptr { nullptr };
+    atomic_int m_exec_route { RouteMeasuring };  ///< ExecRoute for batching
+    atomic_int m_exec_route_trials[2] = {};  ///< Runs measured [batched?]
+    atomic_ll m_exec_route_points[2]  = {};  ///< ...points shaded by them
+    atomic_ll m_exec_route_ns[2]      = {};  ///< ...and their time
     std::vector<SymLocationDesc> m_symlocs;   ///< SORTED!!
     bool m_unknown_textures_needed;
     bool m_unknown_closures_needed;
     bool m_unknown_attributes_needed;
     atomic_ll m_executions { 0 };  ///< Number of times the group executed
     atomic_ll m_stat_total_shading_time_ticks { 0 };  // Shading time (ticks)
+    atomic_ll m_telemetry[3] = {};  ///< Sampled [shades, textures, closures]
+    atomic_ll m_pmu[5] = {};  ///< Sampled [shades, cycles, instructions,
+                              ///<   cache misses, branch misses]
+    atomic_ll m_exec_histogram[exec_histogram_buckets] = {};  ///< Exec ticks
 
     std::string m_optix_cache_key;
 
     // PTX assembly for compiled ShaderGroup
     std::string m_llvm_ptx_compiled_version;
+    // Resources its functions need: the most virtual registers and local
+    // memory bytes (per thread) that any PTX function declares, and what
+    // the renderer reports the final GPU code uses (-1 if it hasn't).
+    int m_ptx_registers   = 0;
+    int m_ptx_local_bytes = 0;
+    int m_gpu_registers   = -1;
+    int m_gpu_spill_bytes = -1;
+    // Every string whose hash the PTX uses as a constant
+    std::vector<ustring> m_device_strings;
 
     ParamValueList m_pending_params;          // Pending Parameter() values
     std::vector<ParamHints> m_pending_hints;  // ParamHints of pending params
@@ -2069,12 +3143,26 @@ private:
     bool m_complete = false;                  // Successfully ShaderGroupEnd?
 
     ShadingSystemImpl& m_shadingsys;  // Back-ptr to the shading system
+    uint64_t m_layers_hash = 0;       // Canonical hash of the layers
+    std::string m_layers_text;        // ...and what it hashed, if kept
+
+    // The group attributes that go into canonical_hash()
+    std::string canonical_attribs() const;
 
     // Per-group home for interactively editable parameters
     std::vector<InteractiveParamData> m_interactive_params;
     std::unique_ptr<uint8_t[]> m_interactive_arena;
     size_t m_interactive_arena_size = 0;
     device_ptr<uint8_t> m_device_interactive_arena;
+    // Bytes of the interactive arena not yet copied to the device
+    size_t m_interactive_dirty_begin = 0, m_interactive_dirty_end = 0;
+    spin_mutex m_interactive_dirty_mutex;
+    // Between ReParameterBegin and End: how deeply nested, whether the
+    // group is to be optimized again, and the bytes of the interactive
+    // arena not yet copied to the device.
+    int m_reparam_batch            = 0;
+    bool m_reparam_rebuild_pending = false;
+    size_t m_reparam_dirty_begin = 0, m_reparam_dirty_end = 0;
 
     friend class OSL::pvt::ShadingSystemImpl;
     friend class OSL::pvt::BackendLLVM;
@@ -2086,6 +3174,39 @@ private:
 
 
 
+/// The execution times that one thread's contexts have recorded (with the
+/// "profile" option on) since they were last merged into the shading
+/// system's and groups' totals. Threads add to their own, so that they
+/// don't all contend for the shared counters after every execute; the
+/// totals are brought up to date by ShadingSystemImpl::merge_profiles
+/// whenever the stats are read, and when the thread's info is destroyed.
+struct ThreadProfile {
+    struct Group {
+        long long ticks = 0;
+        long long histogram[ShaderGroup::exec_histogram_buckets] = {};
+    };
+
+    ThreadProfile(ShadingSystemImpl& ss);
+    ~ThreadProfile();
+
+    /// Record an execute of the group that took `ticks`.
+    void record(const ShaderGroup& group, long long ticks)
+    {
+        spin_lock lock(mutex);
+        total_ticks += ticks;
+        Group& g(groups[group.id()]);
+        g.ticks += ticks;
+        g.histogram[ShaderGroup::exec_histogram_bucket(ticks)] += 1;
+    }
+
+    ShadingSystemImpl* shadingsys;  ///< Null once it's been destroyed
+    spin_mutex mutex;               ///< Uncontended except while merging
+    long long total_ticks = 0;
+    std::unordered_map<int, Group> groups;  ///< By group id
+};
+
+
+
 /// The full context for executing a shader group.
 ///
 class OSLEXECPUBLIC ShadingContext {
@@ -2123,6 +3244,34 @@ public:
                  ShaderGlobals& globals, void* userdata_base_ptr,
                  void* output_base_ptr, bool run);
 
+    /// Execute the shader group on each of a span of points, binding it
+    /// just once. (See similarly named method of ShadingSystem.)
+    bool execute_many(ShaderGroup& group, int threadindex,
+                      int shadeindex_begin, span<ShaderGlobals> globals,
+                      void* userdata_base_ptr, void* output_base_ptr,
+                      cspan<OutputBinding> outputs);
+
+    /// Execute the shader group on each of a span of points, tracing the
+    /// rays they ask for together. (See similarly named method of
+    /// ShadingSystem.)
+    bool execute_deferred_trace(ShaderGroup& group, int threadindex,
+                                int shadeindex_begin,
+                                span<ShaderGlobals> globals,
+                                void* userdata_base_ptr,
+                                void* output_base_ptr,
+                                cspan<OutputBinding> outputs);
+
+    /// Is trace() being deferred by execute_deferred_trace()?
+    bool deferring_trace() const { return m_trace_pass != TracePass::Now; }
+
+    /// Handle a trace() call while deferring_trace(): note the ray on the
+    /// first run, or answer from its result when the shade is run again.
+    /// Return false if the ray must be traced right away instead.
+    bool deferred_trace(const TraceOpt& options, ShaderGlobals* sg,
+                        const Vec3& P, const Vec3& dPdx, const Vec3& dPdy,
+                        const Vec3& R, const Vec3& dRdx, const Vec3& dRdy,
+                        bool& hit);
+
 #if OSL_USE_BATCHED
     // Group all batched methods behind a templated interface
     // so we can support multiple widths
@@ -2195,6 +3344,16 @@ public:
                 WidthT * sizeof(ClosureAdd), alignof(ClosureAdd));
         }
 
+        /// Non-array getattribute through the per-batch attribute cache:
+        /// copy the lanes of mask out of an earlier lookup of the same
+        /// attribute in this execution, or look it up and remember it.
+        /// The first call of a batch gathers every attribute the group
+        /// needs with one BatchedRendererServices::get_attributes call.
+        Mask<WidthT> get_attribute_cached(BatchedShaderGlobals<WidthT>* bsg,
+                                          ustring object, ustring name,
+                                          TypeDesc type, bool derivs,
+                                          void* wide_data, Mask<WidthT> mask);
+
         template<typename Str, typename... Args>
         inline void errorfmt(Mask<WidthT> mask, const Str& fmt,
                              Args&&... args) const
@@ -2244,9 +3403,17 @@ public:
 
     void* allocate_closure(size_t size, size_t alignment)
     {
+        m_telemetry_closures += m_telemetry_sampling;
         return m_closure_pool.alloc(size, alignment);
     }
 
+    /// While retained, executing a shader does not recycle the closure
+    /// memory of earlier shades, so the renderer may keep closure trees
+    /// (e.g., across a bounce) without copying them.  Releasing lets the
+    /// next execution reuse all of it.
+    void retain_closures(bool retain) { m_retain_closures = retain; }
+    bool retain_closures() const { return m_retain_closures; }
+
     /// Find the named symbol in the (already-executed!) stack of shaders of
     /// the given use. If a layer is given, search just that layer. If no
     /// layer is specified, priority is given to later laters over earlier
@@ -2262,9 +3429,39 @@ public:
     const void* symbol_data(const Symbol& sym) const;
 
     /// Return a reference to a compiled regular expression for the
-    /// given string, being careful to cache already-created ones so we
-    /// aren't constantly compiling new ones.
-    const std::regex& find_regex(ustring r);
+    /// given string, from the process-wide cache, keeping a local map of
+    /// the ones this context has used so it needn't lock the cache.
+    const CompiledRegex& find_regex(ustring r);
+
+    /// Return the string that the format plan makes of the packed
+    /// argument values, remembering recent results so that a format()
+    /// repeated with the same arguments needn't format or make a ustring.
+    ustringhash_pod format(const FormatPlan& plan, const uint8_t* arg_values);
+
+    /// A recent result of concat or substr: the string that op made of
+    /// operands a and b (for substr, b packs the start and length).
+    struct StringMemo {
+        enum Op { Concat, Substr };
+        Op op                  = Concat;
+        uint64_t a             = 0;
+        uint64_t b             = 0;
+        ustringhash_pod result = 0;  ///< concat("","") is "", hash 0
+
+        bool holds(Op o, uint64_t x, uint64_t y) const
+        {
+            return op == o && a == x && b == y;
+        }
+    };
+
+    /// The slot of the memo of recent concat and substr results in which
+    /// the string op makes of (a, b) belongs. The strings are ustrings, so
+    /// the memo is never invalidated; it just spares making the same
+    /// string again from going back to the global ustring table.
+    StringMemo& string_memo(StringMemo::Op op, uint64_t a, uint64_t b)
+    {
+        uint64_t h = (a ^ (b * 0x9e3779b97f4a7c15ULL)) + op;
+        return m_string_memo[(h ^ (h >> 29)) % string_memo_size];
+    }
 
     /// Return a pointer to the shading group for this context.
     ///
@@ -2280,6 +3477,10 @@ public:
     {
         return m_batched_messages_buffer;
     }
+    BatchedAttributeCache& batched_attribute_cache()
+    {
+        return m_batched_attribute_cache;
+    }
 #endif
 
     /// Look up a query from a dictionary (typically XML), staring the
@@ -2302,6 +3503,22 @@ public:
                            int array_lookup, int index, TypeDesc attr_type,
                            void* attr_dest);
 
+    /// osl_get_attribute for an attribute the renderer declared
+    /// AttributeConstancy::PerObject: only the first request for it in an
+    /// execution goes to the renderer, later ones reuse the result.
+    /// Fetch the group's m_userdata_gathered userdata with one call to
+    /// RendererServices::get_userdata_all, into the groupdata where the
+    /// layers' parameter binding will find it, setting their initialized
+    /// flags.
+    void gather_userdata(ShaderGlobals* sg, char* groupdata,
+                         char* userdata_initialized);
+
+    bool osl_get_attribute_per_object(ShaderGlobals* sg, int dest_derivs,
+                                      ustringhash obj_name,
+                                      ustringhash attr_name, int array_lookup,
+                                      int index, TypeDesc attr_type,
+                                      void* attr_dest);
+
     PerThreadInfo* thread_info() const { return m_threadinfo; }
 
     TextureSystem::Perthread* texture_thread_info() const
@@ -2317,6 +3534,19 @@ public:
         m_texture_thread_info = t;
     }
 
+    /// The UDIM tile table of a texture handle (see
+    /// ShadingSystemImpl::udim_tile_table), remembering the last one
+    /// asked for so that runs of lookups of one texture don't lock.
+    const UdimTileTable* udim_tile_table(TextureSystem::TextureHandle* handle)
+    {
+        if (handle != m_udim_handle) {
+            m_udim_table  = shadingsys().udim_tile_table(handle,
+                                                         texture_thread_info());
+            m_udim_handle = handle;
+        }
+        return m_udim_table;
+    }
+
     const LLVM_Util::PerThreadInfo& llvm_thread_info() const
     {
         return thread_info()->llvm_thread_info;
@@ -2331,10 +3561,52 @@ public:
     bool ocio_transform(ustring fromspace, ustring tospace, const Color& C,
                         Color& Cout);
 
+    /// Find the matrix to (inverse=false) or from (inverse=true) common
+    /// space of a named space, "shader" or "object", if it was fetched
+    /// from the renderer earlier in this execution, and the ok that the
+    /// fetch returned.
+    bool find_cached_matrix(ustringhash space, bool inverse, Matrix44& M,
+                            int& ok) const
+    {
+        for (int i = 0; i < m_matrix_cache_count; ++i) {
+            const CachedMatrix& c(m_matrix_cache[i]);
+            if (c.space == space && c.inverse == inverse) {
+                M  = c.M;
+                ok = c.ok;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /// Remember a matrix fetched from the renderer until the execution
+    /// ends (replacing the oldest entry if the cache is full).
+    void cache_matrix(ustringhash space, bool inverse, const Matrix44& M,
+                      int ok)
+    {
+        int i = m_matrix_cache_count < matrix_cache_size
+                    ? m_matrix_cache_count++
+                    : (m_matrix_cache_next++ % matrix_cache_size);
+        m_matrix_cache[i] = { space, inverse, ok, M };
+    }
+
+    /// Apply an OCIO transform in place to n packed colors with one call
+    /// to the processor, for the batched ops. Return false if OCIO doesn't
+    /// know the transform.
+    bool ocio_transform(ustring fromspace, ustring tospace, Color3* colors,
+                        int n);
+
     void incr_layers_executed() { ++m_stat_layers_executed; }
 
     void incr_get_userdata_calls() { ++m_stat_get_userdata_calls; }
 
+    // Count a texture lookup if this shade is sampled for telemetry
+    // (branchless, so it costs next to nothing when it isn't).
+    void incr_telemetry_textures()
+    {
+        m_telemetry_textures += m_telemetry_sampling;
+    }
+
     // Clear the stats we record per-execution in this context (unlocked)
     void clear_runtime_stats()
     {
@@ -2350,6 +3622,10 @@ public:
         shadingsys().m_stat_layers_executed += m_stat_layers_executed;
     }
 
+    // Recycle the closure pool for a new execution (unless closures are
+    // retained), trimming it back to "closure_pool_max_KB".
+    void reset_closure_pool();
+
     bool allow_warnings()
     {
         if (m_max_warnings > 0) {
@@ -2376,6 +3652,20 @@ public:
     // Process all the recorded errors, warnings, printfs
     void process_errors() const;
 
+    // Should encoded errors, warnings and printfs be recorded as is, and
+    // only formatted when they are processed (see "defer_printf")?
+    bool defer_formatting() const
+    {
+        return shadingsys().m_defer_printf && shadingsys().m_buffer_printf;
+    }
+
+    // Record the format and raw argument bytes of an error (or warning,
+    // printf, etc.), to be decoded by process_errors.
+    void record_encoded(ErrorHandler::ErrCode code, ustringhash fmt,
+                        int32_t arg_count, const EncodedType* arg_types,
+                        uint32_t arg_values_size,
+                        const uint8_t* arg_values) const;
+
     template<typename... Args>
     inline void errorfmt(const char* fmt, const Args&... args) const
     {
@@ -2403,39 +3693,132 @@ public:
     void reserve_heap(size_t size)
     {
         if (size > m_heapsize) {
-            m_heap.reset(
-                (char*)OIIO::aligned_malloc(size, OIIO_CACHE_LINE_SIZE));
+            // Grow in power of 2 buckets, so that alternating between
+            // groups of slowly increasing size doesn't reallocate each time.
+            size = std::max(OIIO::ceil2(size), size_t(4096));
+            // Page aligned, so a NUMA placement covers all of it
+            m_heap.reset((char*)OIIO::aligned_malloc(size, 4096));
             m_heapsize = size;
+            numa_prefer_node(m_heap.get(), size, m_threadinfo->numa_node);
         }
     }
 
 private:
     void free_dict_resources();
 
+    /// The ray type bits that always run a group's debug variant (see
+    /// "debug_sample_raytype").
+    int debug_sample_raytypes() const
+    {
+        ustring name = m_shadingsys.m_debug_sample_raytype;
+        return name.empty() ? 0 : m_shadingsys.raytype_bit(name);
+    }
+
+    // Note the shade about to run in an execute_deferred_trace() pass, and
+    // how many errors were buffered before it.
+    void begin_trace_point(int point);
+
     ShadingSystemImpl& m_shadingsys;  ///< Backpointer to shadingsys
     RendererServices* m_renderer;     ///< Ptr to renderer services
     PerThreadInfo* m_threadinfo;      ///< Ptr to our thread's info
     mutable TextureSystem::Perthread*
         m_texture_thread_info;  ///< Ptr to texture thread info
+    TextureSystem::TextureHandle* m_udim_handle = nullptr;  ///< Last handle
+    const UdimTileTable* m_udim_table = nullptr;  ///< ...and its UDIM tiles
     ShaderGroup* m_group;       ///< Ptr to shader group
+    ShaderGroup::CompiledCode* m_compiled = nullptr;  ///< ...its code, read
+                                                      ///< once per shade
     // Heap memory
     std::unique_ptr<char, decltype(&OIIO::aligned_free)> m_heap {
         nullptr, &OIIO::aligned_free
     };
     size_t m_heapsize = 0;
-    using RegexMap = std::unordered_map<ustring, std::unique_ptr<std::regex>>;
-    RegexMap m_regex_map;    ///< Compiled regex's
+    using RegexMap = std::unordered_map<ustring, const CompiledRegex*>;
+    RegexMap m_regex_map;    ///< Compiled regex's used by this context
+    struct FormatMemo {
+        const FormatPlan* plan = nullptr;
+        std::string arg_values;  ///< Packed argument values
+        ustringhash_pod result = 0;
+    };
+    FormatMemo m_format_memo[8];  ///< Recent format() results
+    static constexpr int string_memo_size = 16;
+    StringMemo m_string_memo[string_memo_size];  ///< See string_memo()
+    std::string m_format_buffer;  ///< Reused for formatting
     MessageList m_messages;  ///< Message blackboard
 #if OSL_USE_BATCHED
     BatchedMessageBuffer
         m_batched_messages_buffer;  ///< Buffer for Batched Message blackboard
+    BatchedAttributeCache
+        m_batched_attribute_cache;  ///< Attributes fetched by this batch
 #endif
     int m_max_warnings;             ///< To avoid processing too many warnings
     int m_stat_get_userdata_calls;  ///< Number of calls to get_userdata
     int m_stat_layers_executed;     ///< Number of layers executed
     long long m_ticks;              ///< Time executing the shader
+    int m_debug_shades        = 0;      ///< Shades since the last checked
+    bool m_debug_sampling     = false;  ///< Running the checked variant?
+    int m_telemetry_shades    = 0;      ///< Shades since the last sample
+    bool m_telemetry_sampling = false;  ///< Is this shade sampled?
+    int m_telemetry_textures  = 0;      ///< Sampled texture lookups
+    int m_telemetry_closures  = 0;      ///< Sampled closure allocations
+    int m_pmu_shades          = 0;      ///< Shades since the last PMU read
+    bool m_pmu_sampling       = false;  ///< Are counters read for this one?
+    uint64_t m_pmu_start[PmuNumCounters];  ///< Counters when it started
+
+    // The state of execute_deferred_trace(): which run of the shades it's
+    // in, the rays noted on the first, the P and N each shade started
+    // with, and where each shade's requests start.
+    enum class TracePass : uint8_t {
+        Now,     // Not deferring; trace() traces right away
+        Gather,  // First run: trace() notes the ray and misses
+        Replay   // Second run: trace() is answered from the results
+    };
+    TracePass m_trace_pass = TracePass::Now;
+    std::vector<RendererServices::TraceRequest> m_trace_requests;
+    std::vector<std::pair<Vec3, Vec3>> m_trace_saved;
+    std::vector<int> m_trace_begin;  ///< First request of each, and end
+    int m_trace_point     = 0;       ///< Shade running now
+    int m_trace_next      = -1;      ///< Its next request to replay, or -1
+    bool m_trace_quiet    = false;   ///< Dropping its errors and printfs?
+    size_t m_trace_errors = 0;       ///< Buffered errors before the shade
+    size_t m_trace_args   = 0;       ///< ...and their deferred args
+
+    // Matrices fetched from the renderer during this execution (the
+    // ShaderGlobals, and so the time and object, are fixed until it ends),
+    // so that layers transforming to the same spaces again and again
+    // fetch each one once. Emptied by execute_init.
+    struct CachedMatrix {
+        ustringhash space;
+        bool inverse;
+        int ok;
+        Matrix44 M;
+    };
+    static constexpr int matrix_cache_size = 8;
+    CachedMatrix m_matrix_cache[matrix_cache_size];
+    int m_matrix_cache_count = 0;  ///< Entries in use
+    int m_matrix_cache_next  = 0;  ///< Next to replace when full
+
+    // Per-object attributes (see AttributeConstancy) fetched from the
+    // renderer during this execution, likewise emptied by execute_init.
+    // Values bigger than the buffer aren't cached.
+    struct CachedAttribute {
+        ustringhash object;
+        ustringhash name;
+        TypeDesc type;
+        int index;
+        bool array_lookup;
+        bool derivs;
+        bool ok;
+        char value[64];
+    };
+    static constexpr int attribute_cache_size = 8;
+    CachedAttribute m_attribute_cache[attribute_cache_size];
+    int m_attribute_cache_count = 0;  ///< Entries in use
+    int m_attribute_cache_next  = 0;  ///< Next to replace when full
 
     SimplePool<20 * 1024> m_closure_pool;
+    size_t m_closure_pool_reported = 0;  ///< Pool bytes in m_stat_mem_closures
+    bool m_retain_closures         = false;  ///< Keep closures across shades?
     SimplePool<64 * 1024> m_scratch_pool;
 
     Dictionary* m_dictionary;
@@ -2455,8 +3838,14 @@ private:
         ErrorHandler::ErrCode err_code;
         std::string msgString;
         Mask<MaxSupportedSimdLaneCount> mask;
+        // For deferred formatting, msgString is left empty until decoded
+        // from the arg types and values at arg_offset in m_deferred_args.
+        uint64_t fmt_hash = 0;
+        int32_t arg_count = 0;
+        size_t arg_offset = 0;
     };
     mutable std::vector<ErrorItem> m_buffered_errors;
+    mutable std::vector<uint8_t> m_deferred_args;
 
 #if OSL_USE_BATCHED
     // Buffering of fprintf's so they can be output
@@ -2536,6 +3925,11 @@ struct NoiseParams {
     Vec3 direction;
     float bandwidth;
     float impulses;
+    int octaves;       // fractal noise types only
+    float lacunarity;  // ...frequency multiplier per octave
+    float gain;        // ...amplitude multiplier per octave
+    ustringhash bake_type;  // "baked" only: noise type to bake
+    int bake_res;           // ...samples per unit of the baked volume
 
     OSL_HOSTDEVICE NoiseParams()
         : anisotropic(0)
@@ -2543,6 +3937,10 @@ struct NoiseParams {
         , direction(1.0f, 0.0f, 0.0f)
         , bandwidth(1.0f)
         , impulses(16.0f)
+        , octaves(4)
+        , lacunarity(2.0f)
+        , gain(0.5f)
+        , bake_res(32)
     {
     }
 };
@@ -2563,6 +3961,19 @@ init_function_name(const ShadingSystemImpl& shadingsys,
 std::string
 fused_function_name(const ShaderGroup& group);
 
+std::string
+wavefront_function_name(const ShaderGroup& group);
+
+// Find the most virtual registers and local memory bytes that any function
+// of the PTX declares.
+void
+ptx_resource_usage(string_view ptx, int& registers, int& local_bytes);
+
+// Compile the CUDA shadeops library to PTX for the given GPU architecture.
+bool
+compile_shadeops_ptx(const LLVM_Util::PerThreadInfo& thread_info,
+                     string_view arch, std::string& ptx);
+
 /// Base class for objects that examine compiled shader groups (oso).
 /// This includes optimization passes, "back end" code generators, etc.
 /// The base class holds common data structures and methods that all
@@ -2598,6 +4009,12 @@ public:
     /// What debug level are we at?
     int debug() const { return m_debug; }
 
+    /// The name of the shadeops implementing op `opname` at the group's
+    /// "math_precision": for the ops it covers, at any but the build's
+    /// default precision, the op name prefixed with the tier ("approx_sin"
+    /// for sin), otherwise just the op name.
+    const char* math_opname(ustring opname) const;
+
     /// Set which instance (layer within the group) we are currently
     /// examining.  This lets you walk through the layers in turn.
     virtual void set_inst(int layer);
@@ -2665,6 +4082,30 @@ public:
     /// Return the basic block ID for the given instruction.
     int bblockid(int opnum) const { return m_bblockids[opnum]; }
 
+    /// Should the code check for NaN/Inf values ("debug_nan"), or for use
+    /// of uninitialized values ("debug_uninit")? Both are always on for a
+    /// group made by ShadingSystemImpl::debug_variant.
+    bool debug_nan() const
+    {
+        return shadingsys().debug_nan() || group().debug_checks();
+    }
+    bool debug_uninit() const
+    {
+        return shadingsys().debug_uninit() || group().debug_checks();
+    }
+
+    /// Set up m_loop_counters[] with the int counters of "for" loops that
+    /// start at a constant, change only in the loop's step by a constant,
+    /// and run while on the near side of a constant bound, along with the
+    /// range of values each takes within its loop's body.
+    void find_loop_counters();
+
+    /// Is the int index that is argument argnum of the given op sure to be
+    /// within [0,length)? True for constants in that range, and for loop
+    /// counters (see find_loop_counters()) used in the loop body, whose
+    /// every value is in that range.
+    bool index_in_range(int opnum, int argnum, int length);
+
 protected:
     ShadingSystemImpl& m_shadingsys;  ///< Backpointer to shading system
     ShaderGroup& m_group;             ///< Group we're processing
@@ -2679,6 +4120,13 @@ protected:
     std::vector<char> m_in_loop;         ///< Whether each op is in a loop
     int m_first_return;                  ///< Op number of first return or exit
 
+    struct LoopCounter {
+        int symbol;                 // Symbol index of the counter
+        int bodybegin, bodyend;     // The ops of the loop body
+        long long lowest, highest;  // Range of values in the body
+    };
+    std::vector<LoopCounter> m_loop_counters;  ///< From find_loop_counters
+
     struct CallLayerKey {
         int bblockid;
         int layerid;
@@ -0,0 +1,458 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <cstring>
+
+#include <OpenImageIO/fmath.h>
+
+#include "osoreader.h"
+
+
+
+OSL_NAMESPACE_BEGIN
+
+namespace pvt {  // OSL::pvt
+
+namespace {
+
+// Layout of a binary .oso. Everything after the 8-byte signature is 32-bit
+// words in the byte order of the machine that wrote it (as recorded by the
+// endian tag), except for the string characters, which come last:
+//
+//     Header
+//     uint32 stringoffsets[nstrings]     Offset of each string in chars
+//     SymbolRecord symbols[nsymbols]
+//     OpRecord ops[nops]                 Instructions and code markers
+//     uint32 words[nwords]               Defaults, args, jumps, hints
+//     char chars[nchars]                 NUL-terminated strings
+//
+// Names, string defaults and hints are string table indices; variable
+// length lists are (count, first) ranges of words.
+
+const char binary_magic[8]        = { 'O', 'S', 'O', 'B', 'I', 'N', '\n', 0 };
+const uint32_t endian_tag         = 0x01020304;
+const uint32_t binary_format      = 1;
+const uint32_t no_string          = ~uint32_t(0);
+enum DefaultKind : uint32_t { DefaultInt, DefaultFloat, DefaultString };
+
+struct Header {
+    char magic[8];
+    uint32_t endian;
+    uint32_t format;
+    int32_t oso_major, oso_minor;
+    uint32_t specid, shadertype, shadername;
+    uint32_t nshaderhints, firstshaderhint;
+    uint32_t nstrings, nsymbols, nops, nwords, nchars;
+};
+
+struct SymbolRecord {
+    int32_t symtype;
+    uint32_t name;
+    uint32_t basetype, aggregate, vecsemantics;
+    int32_t arraylen;
+    uint32_t closure, structname;
+    uint32_t ndefaults, firstdefault;  // (DefaultKind, value) word pairs
+    uint32_t nhints, firsthint;
+};
+
+struct OpRecord {
+    int32_t label;
+    uint32_t marker;  // Nonzero for a code marker named by `name`
+    uint32_t name;
+    uint32_t nargs, firstarg;
+    uint32_t njumps, firstjump;
+    uint32_t nhints, firsthint;
+};
+
+static_assert(sizeof(Header) % 4 == 0 && sizeof(SymbolRecord) % 4 == 0
+                  && sizeof(OpRecord) % 4 == 0,
+              "binary OSO records must be whole words");
+
+
+
+inline uint32_t
+float_bits(float f)
+{
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+
+inline float
+bits_float(uint32_t u)
+{
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+}  // namespace
+
+
+
+bool
+OSOReader::is_binary(const char* data, size_t size)
+{
+    return size >= sizeof(binary_magic)
+           && !memcmp(data, binary_magic, sizeof(binary_magic));
+}
+
+
+
+bool
+OSOReader::parse_binary(const char* data, size_t size, string_view what)
+{
+    if (!is_binary(data, size) || size < sizeof(Header)) {
+        m_err.errorfmt("{} is not a binary OSO file", what);
+        return false;
+    }
+    const Header* header = (const Header*)data;
+    if (header->endian != endian_tag) {
+        uint32_t tag = header->endian;
+        OIIO::swap_endian(&tag);
+        if (tag != endian_tag) {
+            m_err.errorfmt("{} has a corrupt binary OSO header", what);
+            return false;
+        }
+        // Written on a machine of the other byte order: swap all the words
+        // (but not the strings) of a copy, and parse that.
+        std::vector<uint32_t> swapped((size + 3) / 4);
+        memcpy(swapped.data(), data, size);
+        Header* h = (Header*)swapped.data();
+        uint32_t* words = swapped.data() + sizeof(h->magic) / 4;
+        OIIO::swap_endian(words, int((sizeof(Header) - sizeof(h->magic)) / 4));
+        if (h->nchars > size - sizeof(Header)) {
+            m_err.errorfmt("{} is truncated", what);
+            return false;
+        }
+        OIIO::swap_endian(swapped.data() + sizeof(Header) / 4,
+                          int((size - sizeof(Header) - h->nchars) / 4));
+        return parse_binary((const char*)swapped.data(), size, what);
+    }
+    if (header->format != binary_format) {
+        m_err.errorfmt(
+            "{} is binary OSO format {}, but only format {} is supported; "
+            "please recompile it",
+            what, header->format, binary_format);
+        return false;
+    }
+
+    // Locate the tables, and check that they fit in the file.
+    uint64_t needed = sizeof(Header) + 4 * uint64_t(header->nstrings)
+                      + sizeof(SymbolRecord) * uint64_t(header->nsymbols)
+                      + sizeof(OpRecord) * uint64_t(header->nops)
+                      + 4 * uint64_t(header->nwords) + header->nchars;
+    if (needed > size) {
+        m_err.errorfmt("{} is truncated", what);
+        return false;
+    }
+    const uint32_t* stringoffsets = (const uint32_t*)(header + 1);
+    const SymbolRecord* symbols   = (const SymbolRecord*)(stringoffsets
+                                                        + header->nstrings);
+    const OpRecord* ops   = (const OpRecord*)(symbols + header->nsymbols);
+    const uint32_t* words = (const uint32_t*)(ops + header->nops);
+    const char* chars     = (const char*)(words + header->nwords);
+    if (header->nchars && chars[header->nchars - 1]) {
+        m_err.errorfmt("{} has a corrupt string table", what);
+        return false;
+    }
+
+    bool ok = true;
+    auto str = [&](uint32_t index) -> const char* {
+        if (index < header->nstrings
+            && stringoffsets[index] < header->nchars)
+            return chars + stringoffsets[index];
+        ok = false;
+        return "";
+    };
+    auto range = [&](uint64_t n, uint32_t first) -> const uint32_t* {
+        if (first + n <= header->nwords)
+            return words + first;
+        ok = false;
+        return words;
+    };
+    auto hints = [&](uint32_t n, uint32_t first) {
+        const uint32_t* h = range(n, first);
+        for (uint32_t i = 0; ok && i < n; ++i)
+            hint(str(h[i]));
+    };
+
+    version(str(header->specid), header->oso_major, header->oso_minor);
+    shader(str(header->shadertype), str(header->shadername));
+    hints(header->nshaderhints, header->firstshaderhint);
+
+    for (uint32_t s = 0; ok && s < header->nsymbols; ++s) {
+        const SymbolRecord& rec = symbols[s];
+        if ((SymType)rec.symtype == SymTypeTemp
+            && stop_parsing_at_temp_symbols())
+            return true;
+        TypeSpec typespec;
+        if (rec.structname != no_string)
+            typespec = TypeSpec(str(rec.structname), 0);
+        else
+            typespec = TypeSpec(TypeDesc(TypeDesc::BASETYPE(rec.basetype),
+                                         TypeDesc::AGGREGATE(rec.aggregate),
+                                         TypeDesc::VECSEMANTICS(
+                                             rec.vecsemantics)),
+                                rec.closure != 0);
+        if (rec.arraylen)
+            typespec.make_array(rec.arraylen);
+        symbol((SymType)rec.symtype, typespec, str(rec.name));
+        const uint32_t* defaults = range(2 * uint64_t(rec.ndefaults),
+                                         rec.firstdefault);
+        for (uint32_t d = 0; ok && d < rec.ndefaults; ++d) {
+            uint32_t value = defaults[2 * d + 1];
+            switch (defaults[2 * d]) {
+            case DefaultInt: symdefault(int(value)); break;
+            case DefaultFloat: symdefault(bits_float(value)); break;
+            case DefaultString: symdefault(str(value)); break;
+            default: ok = false;
+            }
+        }
+        hints(rec.nhints, rec.firsthint);
+        parameter_done();
+    }
+
+    for (uint32_t o = 0; ok && o < header->nops; ++o) {
+        const OpRecord& rec = ops[o];
+        if (rec.marker) {
+            if (!parse_code_section())
+                return true;
+            codemarker(str(rec.name));
+            continue;
+        }
+        instruction(rec.label, str(rec.name));
+        const uint32_t* args = range(rec.nargs, rec.firstarg);
+        for (uint32_t a = 0; ok && a < rec.nargs; ++a)
+            instruction_arg(str(args[a]));
+        const uint32_t* jumps = range(rec.njumps, rec.firstjump);
+        for (uint32_t j = 0; ok && j < rec.njumps; ++j)
+            instruction_jump(int(jumps[j]));
+        hints(rec.nhints, rec.firsthint);
+        instruction_end();
+    }
+
+    if (!ok) {
+        m_err.errorfmt("{} has a corrupt binary OSO table", what);
+        return false;
+    }
+    codeend();
+    return true;
+}
+
+
+
+uint32_t
+OSOBinaryWriter::str(string_view s)
+{
+    auto found = m_stringmap.find(std::string(s));
+    if (found != m_stringmap.end())
+        return found->second;
+    uint32_t index = uint32_t(m_strings.size());
+    m_strings.emplace_back(s);
+    m_stringmap.emplace(m_strings.back(), index);
+    return index;
+}
+
+
+
+std::vector<uint32_t>&
+OSOBinaryWriter::hints()
+{
+    if (m_in_code)
+        return m_ops.back().hints;
+    if (m_symbols.size())
+        return m_symbols.back().hints;
+    return m_shaderhints;
+}
+
+
+
+void
+OSOBinaryWriter::version(const char* specid, int major, int minor)
+{
+    m_specid    = str(specid);
+    m_oso_major = major;
+    m_oso_minor = minor;
+}
+
+
+
+void
+OSOBinaryWriter::shader(const char* shadertype, const char* name)
+{
+    m_shadertype = str(shadertype);
+    m_shadername = str(name);
+}
+
+
+
+void
+OSOBinaryWriter::symbol(SymType symtype, TypeSpec typespec, const char* name)
+{
+    uint32_t structname = no_string;
+    if (typespec.structure() > 0 && typespec.structspec())
+        structname = str(typespec.structspec()->name());
+    m_symbols.push_back({ symtype, typespec, str(name), structname, {}, {} });
+}
+
+
+
+void
+OSOBinaryWriter::symdefault(int def)
+{
+    m_symbols.back().defaults.push_back(DefaultInt);
+    m_symbols.back().defaults.push_back(uint32_t(def));
+}
+
+
+
+void
+OSOBinaryWriter::symdefault(float def)
+{
+    m_symbols.back().defaults.push_back(DefaultFloat);
+    m_symbols.back().defaults.push_back(float_bits(def));
+}
+
+
+
+void
+OSOBinaryWriter::symdefault(const char* def)
+{
+    m_symbols.back().defaults.push_back(DefaultString);
+    m_symbols.back().defaults.push_back(str(def));
+}
+
+
+
+void
+OSOBinaryWriter::hint(string_view hintstring)
+{
+    uint32_t h = str(hintstring);
+    hints().push_back(h);
+}
+
+
+
+void
+OSOBinaryWriter::codemarker(const char* name)
+{
+    m_in_code = true;
+    m_ops.push_back({ -1, true, str(name), {}, {}, {} });
+}
+
+
+
+void
+OSOBinaryWriter::instruction(int label, const char* opcode)
+{
+    m_in_code = true;
+    m_ops.push_back({ label, false, str(opcode), {}, {}, {} });
+}
+
+
+
+void
+OSOBinaryWriter::instruction_arg(const char* name)
+{
+    uint32_t a = str(name);
+    m_ops.back().args.push_back(a);
+}
+
+
+
+void
+OSOBinaryWriter::instruction_jump(int target)
+{
+    m_ops.back().jumps.push_back(uint32_t(target));
+}
+
+
+
+void
+OSOBinaryWriter::instruction_end()
+{
+}
+
+
+
+std::string
+OSOBinaryWriter::binary() const
+{
+    std::vector<uint32_t> words;
+    auto add = [&](const std::vector<uint32_t>& list, uint32_t& n,
+                   uint32_t& first) {
+        n     = uint32_t(list.size());
+        first = uint32_t(words.size());
+        words.insert(words.end(), list.begin(), list.end());
+    };
+
+    Header header;
+    memcpy(header.magic, binary_magic, sizeof(header.magic));
+    header.endian     = endian_tag;
+    header.format     = binary_format;
+    header.oso_major  = m_oso_major;
+    header.oso_minor  = m_oso_minor;
+    header.specid     = m_specid;
+    header.shadertype = m_shadertype;
+    header.shadername = m_shadername;
+    add(m_shaderhints, header.nshaderhints, header.firstshaderhint);
+
+    std::vector<SymbolRecord> symbols(m_symbols.size());
+    for (size_t s = 0; s < m_symbols.size(); ++s) {
+        const Sym& sym        = m_symbols[s];
+        SymbolRecord& rec     = symbols[s];
+        const TypeDesc simple = sym.typespec.simpletype();
+        rec.symtype           = sym.symtype;
+        rec.name              = sym.name;
+        rec.basetype          = simple.basetype;
+        rec.aggregate         = simple.aggregate;
+        rec.vecsemantics      = simple.vecsemantics;
+        rec.arraylen          = simple.arraylen;
+        rec.closure           = sym.typespec.is_closure_based();
+        rec.structname        = sym.structname;
+        add(sym.defaults, rec.ndefaults, rec.firstdefault);
+        rec.ndefaults /= 2;
+        add(sym.hints, rec.nhints, rec.firsthint);
+    }
+
+    std::vector<OpRecord> ops(m_ops.size());
+    for (size_t o = 0; o < m_ops.size(); ++o) {
+        const Op& op  = m_ops[o];
+        OpRecord& rec = ops[o];
+        rec.label     = op.label;
+        rec.marker    = op.marker;
+        rec.name      = op.name;
+        add(op.args, rec.nargs, rec.firstarg);
+        add(op.jumps, rec.njumps, rec.firstjump);
+        add(op.hints, rec.nhints, rec.firsthint);
+    }
+
+    std::vector<uint32_t> stringoffsets;
+    std::string chars;
+    for (const std::string& s : m_strings) {
+        stringoffsets.push_back(uint32_t(chars.size()));
+        chars.append(s.c_str(), s.size() + 1);
+    }
+    header.nstrings = uint32_t(m_strings.size());
+    header.nsymbols = uint32_t(symbols.size());
+    header.nops     = uint32_t(ops.size());
+    header.nwords   = uint32_t(words.size());
+    header.nchars   = uint32_t(chars.size());
+
+    std::string out;
+    out.append((const char*)&header, sizeof(header));
+    out.append((const char*)stringoffsets.data(),
+               stringoffsets.size() * sizeof(uint32_t));
+    out.append((const char*)symbols.data(),
+               symbols.size() * sizeof(SymbolRecord));
+    out.append((const char*)ops.data(), ops.size() * sizeof(OpRecord));
+    out.append((const char*)words.data(), words.size() * sizeof(uint32_t));
+    out += chars;
+    return out;
+}
+
+}  // namespace pvt
+OSL_NAMESPACE_END
@@ -5,9 +5,15 @@
 #pragma once
 
 #include "osl_pvt.h"
+#include <OSL/oslquery.h>
 #include <OSL/platform.h>
 
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 #include <OpenImageIO/string_view.h>
+#include <OpenImageIO/strutil.h>
 #include <OpenImageIO/thread.h>
 
 
@@ -43,6 +49,52 @@ public:
     /// an unrecoverable error reading.
     virtual bool parse_memory(const std::string& buffer);
 
+    /// Parse a binary OSO image (as written by OSOBinaryWriter) of the
+    /// given size, making the same callbacks as parsing the text form
+    /// would. This needs neither the lexer nor its lock, and the strings
+    /// passed to the callbacks point directly into `data`. Both
+    /// parse_file() and parse_memory() detect binary OSO and end up here.
+    bool parse_binary(const char* data, size_t size, string_view what);
+
+    /// Does the buffer begin with the binary OSO signature?
+    static bool is_binary(const char* data, size_t size);
+
+    /// Parse the "%cost{name=value,...}" hint that oslc writes on the
+    /// shader line into `cost`, returning false if `hintstring` is some
+    /// other hint. Names it doesn't know are skipped.
+    static bool parse_cost_hint(string_view hintstring,
+                                OSLQuery::CostEstimate& cost)
+    {
+        using namespace OIIO;
+        if (!Strutil::parse_prefix(hintstring, "%cost{"))
+            return false;
+        cost = OSLQuery::CostEstimate();
+        while (hintstring.size() && !Strutil::parse_char(hintstring, '}')) {
+            string_view name = Strutil::parse_identifier(hintstring);
+            int value        = 0;
+            if (!Strutil::parse_char(hintstring, '=')
+                || !Strutil::parse_int(hintstring, value))
+                break;
+            Strutil::parse_char(hintstring, ',');
+            if (name == "ops")
+                cost.ops = value;
+            else if (name == "arith")
+                cost.arith = value;
+            else if (name == "texture")
+                cost.texture = value;
+            else if (name == "noise")
+                cost.noise = value;
+            else if (name == "trace")
+                cost.trace = value;
+            else if (name == "loops")
+                cost.loops = value;
+            else if (name == "derivs")
+                cost.derivs = value;
+        }
+        cost.known = true;
+        return true;
+    }
+
     /// Declare the shader version.
     ///
     virtual void version(const char* specid, int major, int minor) {}
@@ -131,6 +183,62 @@ private:
     TypeSpec m_current_typespec;
 };
 
+
+
+/// OSOReader that records everything it is told and can then write it back
+/// out as binary OSO: a versioned, byte-order-tagged image holding a string
+/// table, a symbol table and an op table, which OSOReader::parse_binary()
+/// replays without tokenizing anything. Used by `oslc -binary`.
+class OSOBinaryWriter final : public OSOReader {
+public:
+    OSOBinaryWriter(ErrorHandler* errhandler = NULL) : OSOReader(errhandler)
+    {
+    }
+
+    void version(const char* specid, int major, int minor) override;
+    void shader(const char* shadertype, const char* name) override;
+    void symbol(SymType symtype, TypeSpec typespec, const char* name) override;
+    void symdefault(int def) override;
+    void symdefault(float def) override;
+    void symdefault(const char* def) override;
+    void hint(string_view hintstring) override;
+    void codemarker(const char* name) override;
+    void instruction(int label, const char* opcode) override;
+    void instruction_arg(const char* name) override;
+    void instruction_jump(int target) override;
+    void instruction_end() override;
+
+    /// Return the binary image of everything read so far.
+    std::string binary() const;
+
+private:
+    uint32_t str(string_view s);      // Index of s in the string table
+    std::vector<uint32_t>& hints();   // Hint list of the current item
+
+    std::vector<std::string> m_strings;
+    std::unordered_map<std::string, uint32_t> m_stringmap;
+    uint32_t m_specid = 0, m_shadertype = 0, m_shadername = 0;
+    int m_oso_major = 0, m_oso_minor = 0;
+    std::vector<uint32_t> m_shaderhints;
+    struct Sym {
+        SymType symtype;
+        TypeSpec typespec;
+        uint32_t name;
+        uint32_t structname;             // or ~0 if not a struct
+        std::vector<uint32_t> defaults;  // (kind, value) pairs
+        std::vector<uint32_t> hints;
+    };
+    std::vector<Sym> m_symbols;
+    struct Op {
+        int label;
+        bool marker;  // A code marker rather than an instruction
+        uint32_t name;
+        std::vector<uint32_t> args, jumps, hints;
+    };
+    std::vector<Op> m_ops;
+    bool m_in_code = false;  // Have we reached the code section?
+};
+
 OSL_PRAGMA_WARNING_POP
 
 
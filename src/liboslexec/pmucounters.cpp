@@ -0,0 +1,95 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#ifdef __linux__
+#    include <linux/perf_event.h>
+#    include <sys/ioctl.h>
+#    include <sys/syscall.h>
+#    include <unistd.h>
+#endif
+
+#include "pmucounters.h"
+
+OSL_NAMESPACE_BEGIN
+namespace pvt {
+
+#ifdef __linux__
+
+namespace {
+
+// The counter group of one thread.
+struct PmuGroup {
+    int fds[PmuNumCounters] = { -1, -1, -1, -1 };
+    bool tried              = false;
+
+    ~PmuGroup()
+    {
+        for (int fd : fds)
+            if (fd >= 0)
+                close(fd);
+    }
+
+    bool open()
+    {
+        tried = true;
+        static const uint64_t configs[PmuNumCounters]
+            = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+        for (int i = 0; i < PmuNumCounters; ++i) {
+            perf_event_attr attr = {};
+            attr.size            = sizeof(attr);
+            attr.type            = PERF_TYPE_HARDWARE;
+            attr.config          = configs[i];
+            attr.read_format     = PERF_FORMAT_GROUP;
+            attr.exclude_kernel  = 1;
+            attr.exclude_hv      = 1;
+            // The leader starts disabled, the others follow it.
+            attr.disabled = i == 0;
+            fds[i]        = int(syscall(SYS_perf_event_open, &attr,
+                                        0 /*this thread*/, -1 /*any cpu*/,
+                                        i ? fds[0] : -1, 0));
+            if (fds[i] < 0)
+                return false;
+        }
+        ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        return true;
+    }
+};
+
+thread_local PmuGroup pmu_group;
+
+}  // namespace
+
+
+
+bool
+pmu_read(uint64_t* counts)
+{
+    PmuGroup& g(pmu_group);
+    if (!g.tried)
+        g.open();
+    if (g.fds[PmuNumCounters - 1] < 0)
+        return false;
+    // With PERF_FORMAT_GROUP, one read gives the number of counters
+    // followed by their values.
+    uint64_t buf[1 + PmuNumCounters];
+    if (read(g.fds[0], buf, sizeof(buf)) != ssize_t(sizeof(buf)))
+        return false;
+    for (int i = 0; i < PmuNumCounters; ++i)
+        counts[i] = buf[1 + i];
+    return true;
+}
+
+#else
+
+bool
+pmu_read(uint64_t* /*counts*/)
+{
+    return false;
+}
+
+#endif
+
+}  // namespace pvt
+OSL_NAMESPACE_END
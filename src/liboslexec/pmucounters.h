@@ -0,0 +1,33 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <cstdint>
+
+#include <OSL/oslconfig.h>
+
+OSL_NAMESPACE_BEGIN
+namespace pvt {
+
+// The hardware counters read by pmu_read, in order.
+enum PmuCounter {
+    PmuCycles,
+    PmuInstructions,
+    PmuCacheMisses,
+    PmuBranchMisses,
+    PmuNumCounters
+};
+
+// Read the hardware performance counters of the calling thread into
+// counts[PmuNumCounters]. The counters are opened (with Linux
+// perf_event_open, as one group, counting user space only) the first time
+// a thread asks, and closed when it exits. Return false if they aren't
+// available: on other platforms, or if perf_event_paranoid or a container
+// forbids them.
+bool
+pmu_read(uint64_t* counts);
+
+}  // namespace pvt
+OSL_NAMESPACE_END
@@ -2,9 +2,15 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
 #include <cstdarg>
+#include <iostream>
+#include <limits>
+#include <numeric>
 #include <sstream>
 
+#include <OpenImageIO/parallel.h>
+
 #include "pointcloud.h"
 
 #include "oslexec_pvt.h"
@@ -14,53 +20,579 @@
 OSL_NAMESPACE_BEGIN
 namespace pvt {
 
+// State of one PointCloudIndex search: a max-heap of the nearest points
+// found so far, by (squared distance, tree position).
+struct PointCloudIndex::Search {
+    Vec3 center;
+    float maxd2;  // how near a point must be to be added
+    int max_points;
+    int count;
+    std::pair<float, int>* heap;
+
+    void add(float d2, int p)
+    {
+        if (d2 > maxd2)
+            return;
+        if (count < max_points) {
+            heap[count++] = { d2, p };
+            std::push_heap(heap, heap + count);
+            if (count == max_points)
+                maxd2 = heap[0].first;
+        } else if (d2 < heap[0].first) {
+            std::pop_heap(heap, heap + count);
+            heap[count - 1] = { d2, p };
+            std::push_heap(heap, heap + count);
+            maxd2 = heap[0].first;
+        }
+    }
+};
+
+
+
+PointCloudIndex::PointCloudIndex(const float* positions, size_t npoints,
+                                 size_t stride)
+    : m_src(positions), m_stride(stride)
+{
+    int n = int(npoints);
+    std::vector<int> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    m_axis.resize(n, 0);
+
+    // Split the top of the tree here, then build the subtrees it leaves
+    // in parallel -- they are disjoint ranges of order and m_axis.
+    std::vector<std::pair<int, int>> deferred;
+    build(0, n, order, 0, &deferred);
+    OIIO::parallel_for(int64_t(0), int64_t(deferred.size()), [&](int64_t i) {
+        build(deferred[i].first, deferred[i].second, order, 0, nullptr);
+    });
+
+    for (int a = 0; a < 3; ++a) {
+        m_pos[a].resize(n);
+        for (int i = 0; i < n; ++i)
+            m_pos[a][i] = positions[size_t(order[i]) * stride + a];
+    }
+    m_index = std::move(order);
+    m_src   = nullptr;
+    for (int a = 0; a < 3; ++a)
+        m_x[a] = m_pos[a].data();
+    m_indices = m_index.data();
+    m_axes    = m_axis.data();
+    m_size    = m_index.size();
+}
+
+
+
+PointCloudIndex::PointCloudIndex(size_t npoints,
+                                 const float* const positions[3],
+                                 const int* indices, const uint8_t* axes)
+    : m_indices(indices), m_axes(axes), m_size(npoints)
+{
+    for (int a = 0; a < 3; ++a)
+        m_x[a] = positions[a];
+}
+
+
+
+void
+PointCloudIndex::build(int lo, int hi, std::vector<int>& order, int depth,
+                       std::vector<std::pair<int, int>>* deferred)
+{
+    if (hi - lo <= leaf_size)
+        return;
+    // While splitting the top of the tree, leave subtrees that are deep
+    // or small enough (a few per thread) to be built later.
+    if (deferred && (depth >= 8 || hi - lo <= 4096)) {
+        deferred->emplace_back(lo, hi);
+        return;
+    }
+
+    // Split on the axis along which the points spread the most
+    float bmin[3] = { std::numeric_limits<float>::max(),
+                      std::numeric_limits<float>::max(),
+                      std::numeric_limits<float>::max() };
+    float bmax[3] = { -bmin[0], -bmin[1], -bmin[2] };
+    for (int i = lo; i < hi; ++i) {
+        const float* p = m_src + size_t(order[i]) * m_stride;
+        for (int a = 0; a < 3; ++a) {
+            bmin[a] = std::min(bmin[a], p[a]);
+            bmax[a] = std::max(bmax[a], p[a]);
+        }
+    }
+    int axis = 0;
+    for (int a = 1; a < 3; ++a)
+        if (bmax[a] - bmin[a] > bmax[axis] - bmin[axis])
+            axis = a;
+
+    int mid = (lo + hi) / 2;
+    std::nth_element(order.begin() + lo, order.begin() + mid,
+                     order.begin() + hi, [&](int a, int b) {
+                         return m_src[size_t(a) * m_stride + axis]
+                                < m_src[size_t(b) * m_stride + axis];
+                     });
+    m_axis[mid] = uint8_t(axis);
+    build(lo, mid, order, depth + 1, deferred);
+    build(mid + 1, hi, order, depth + 1, deferred);
+}
+
+
+
+void
+PointCloudIndex::search(int lo, int hi, Search& s) const
+{
+    const float* x = m_x[0];
+    const float* y = m_x[1];
+    const float* z = m_x[2];
+    if (hi - lo <= leaf_size) {
+        float d2[leaf_size];
+        int n = hi - lo;
+        OSL_OMP_PRAGMA(omp simd)
+        for (int i = 0; i < n; ++i) {
+            float dx = x[lo + i] - s.center.x;
+            float dy = y[lo + i] - s.center.y;
+            float dz = z[lo + i] - s.center.z;
+            d2[i]    = dx * dx + dy * dy + dz * dz;
+        }
+        for (int i = 0; i < n; ++i)
+            s.add(d2[i], lo + i);
+        return;
+    }
+
+    int mid  = (lo + hi) / 2;
+    int axis = m_axes[mid];
+    float dx = x[mid] - s.center.x;
+    float dy = y[mid] - s.center.y;
+    float dz = z[mid] - s.center.z;
+    s.add(dx * dx + dy * dy + dz * dz, mid);
+    // Search the near side first, then the far side if it's near enough
+    float d = s.center[axis] - m_x[axis][mid];
+    if (d < 0.0f) {
+        search(lo, mid, s);
+        if (d * d <= s.maxd2)
+            search(mid + 1, hi, s);
+    } else {
+        search(mid + 1, hi, s);
+        if (d * d <= s.maxd2)
+            search(lo, mid, s);
+    }
+}
+
+
+
+int
+PointCloudIndex::search(const Vec3& center, float radius, int max_points,
+                        bool sort, int* indices, float* dist2) const
+{
+    if (max_points <= 0 || !m_size)
+        return 0;
+    using Entry = std::pair<float, int>;
+    Search s { center, radius * radius, max_points, 0,
+               OSL_ALLOCA(Entry, max_points) };
+    search(0, int(m_size), s);
+    return finish(s, sort, indices, dist2);
+}
+
+
+
+int
+PointCloudIndex::finish(Search& s, bool sort, int* indices,
+                        float* dist2) const
+{
+    if (sort)
+        std::sort_heap(s.heap, s.heap + s.count);
+    for (int i = 0; i < s.count; ++i) {
+        indices[i] = m_indices[s.heap[i].second];
+        dist2[i]   = s.heap[i].first;
+    }
+    return s.count;
+}
+
+
+
+bool
+PointCloudIndex::collect(int lo, int hi, const Vec3& bmin, const Vec3& bmax,
+                         int* candidates, int& ncandidates) const
+{
+    auto inside = [&](int p) {
+        return m_x[0][p] >= bmin.x && m_x[0][p] <= bmax.x
+               && m_x[1][p] >= bmin.y && m_x[1][p] <= bmax.y
+               && m_x[2][p] >= bmin.z && m_x[2][p] <= bmax.z;
+    };
+    if (hi - lo <= leaf_size) {
+        for (int p = lo; p < hi; ++p) {
+            if (inside(p)) {
+                if (ncandidates == batch_candidates)
+                    return false;
+                candidates[ncandidates++] = p;
+            }
+        }
+        return true;
+    }
+    int mid  = (lo + hi) / 2;
+    int axis = m_axes[mid];
+    if (inside(mid)) {
+        if (ncandidates == batch_candidates)
+            return false;
+        candidates[ncandidates++] = mid;
+    }
+    return (bmin[axis] > m_x[axis][mid]
+            || collect(lo, mid, bmin, bmax, candidates, ncandidates))
+           && (bmax[axis] < m_x[axis][mid]
+               || collect(mid + 1, hi, bmin, bmax, candidates, ncandidates));
+}
+
+
+
+void
+PointCloudIndex::search_batch(int n, const Vec3* centers, const float* radii,
+                              int max_points, bool sort, int* indices,
+                              float* dist2, int* counts) const
+{
+    // Find the points within the box bounding all the searches, one tree
+    // descent for the lot.  Unless the searches are too spread out for
+    // that to be worthwhile, in which case do them one by one.
+    int* candidates = nullptr;
+    int ncandidates = 0;
+    if (n > 1 && max_points > 0 && m_size) {
+        Vec3 bmin = centers[0] - Vec3(radii[0]);
+        Vec3 bmax = centers[0] + Vec3(radii[0]);
+        for (int i = 1; i < n; ++i) {
+            for (int a = 0; a < 3; ++a) {
+                bmin[a] = std::min(bmin[a], centers[i][a] - radii[i]);
+                bmax[a] = std::max(bmax[a], centers[i][a] + radii[i]);
+            }
+        }
+        candidates = OSL_ALLOCA(int, batch_candidates);
+        if (!collect(0, int(m_size), bmin, bmax, candidates, ncandidates))
+            candidates = nullptr;
+    }
+    if (!candidates) {
+        for (int i = 0; i < n; ++i)
+            counts[i] = search(centers[i], radii[i], max_points, sort,
+                               indices + size_t(i) * max_points,
+                               dist2 + size_t(i) * max_points);
+        return;
+    }
+
+    // Gather the candidates' positions, and test them all against each
+    // search, a SIMD vector of them at a time.
+    float* cx = OSL_ALLOCA(float, ncandidates);
+    float* cy = OSL_ALLOCA(float, ncandidates);
+    float* cz = OSL_ALLOCA(float, ncandidates);
+    float* d2 = OSL_ALLOCA(float, ncandidates);
+    for (int c = 0; c < ncandidates; ++c) {
+        cx[c] = m_x[0][candidates[c]];
+        cy[c] = m_x[1][candidates[c]];
+        cz[c] = m_x[2][candidates[c]];
+    }
+    using Entry = std::pair<float, int>;
+    Entry* heap = OSL_ALLOCA(Entry, max_points);
+    for (int i = 0; i < n; ++i) {
+        const Vec3& center(centers[i]);
+        OSL_OMP_PRAGMA(omp simd)
+        for (int c = 0; c < ncandidates; ++c) {
+            float dx = cx[c] - center.x;
+            float dy = cy[c] - center.y;
+            float dz = cz[c] - center.z;
+            d2[c]    = dx * dx + dy * dy + dz * dz;
+        }
+        Search s { center, radii[i] * radii[i], max_points, 0, heap };
+        for (int c = 0; c < ncandidates; ++c)
+            s.add(d2[c], candidates[c]);
+        counts[i] = finish(s, sort, indices + size_t(i) * max_points,
+                           dist2 + size_t(i) * max_points);
+    }
+}
+
+
+
+bool
+PointCloudFile::open(const std::string& filename, std::string& err)
+{
+    if (!m_file.open(filename)) {
+        err = fmtformat("Could not read point cloud \"{}\"", filename);
+        return false;
+    }
+    const char* data = m_file.data();
+    size_t filesize  = m_file.size();
+    auto invalid     = [&]() {
+        err = fmtformat("\"{}\" is not a valid point cloud", filename);
+        return false;
+    };
+    // Is the block of n items of the given size at offset within the file?
+    auto inside = [&](uint64_t offset, uint64_t n, size_t size) {
+        return offset <= filesize && n <= (filesize - offset) / size;
+    };
+
+    const Header* header = (const Header*)data;
+    if (filesize < sizeof(Header)
+        || memcmp(header->magic, magic, sizeof(magic))
+        || header->version != version
+        || !inside(sizeof(Header), header->nattribs, sizeof(AttributeRecord))
+        || !inside(header->index, header->npoints, 3 * sizeof(float)
+                                                       + sizeof(int) + 1)
+        || data[filesize - 1])
+        return invalid();
+    m_npoints = size_t(header->npoints);
+
+    const float* x = (const float*)(data + header->index);
+    const float* positions[3] = { x, x + m_npoints, x + 2 * m_npoints };
+    const int* indices        = (const int*)(x + 3 * m_npoints);
+    const uint8_t* axes       = (const uint8_t*)(indices + m_npoints);
+    m_index.reset(new PointCloudIndex(m_npoints, positions, indices, axes));
+
+    const AttributeRecord* records = (const AttributeRecord*)(header + 1);
+    for (uint32_t i = 0; i < header->nattribs; ++i) {
+        const AttributeRecord& r(records[i]);
+        std::unique_ptr<Attribute> a(new Attribute);
+        a->type     = TypeDesc(TypeDesc::BASETYPE(r.basetype),
+                               TypeDesc::AGGREGATE(r.aggregate), r.arraylen);
+        a->stride   = a->type == TypeString ? sizeof(int) : a->type.size();
+        a->nstrings = r.nstrings;
+        if (r.name >= filesize || !a->stride
+            || !inside(r.data, m_npoints, a->stride)
+            || (a->nstrings && r.strings >= filesize))
+            return invalid();
+        a->data    = data + r.data;
+        a->strings = data + r.strings;
+        m_attributes[ustringhash_from(ustring(data + r.name))] = std::move(
+            a);
+    }
+    return true;
+}
+
+
+
+ustring
+PointCloudFile::string(const Attribute& a, size_t point) const
+{
+    // Make ustrings of the whole table the first time it's needed. The
+    // file ends with a NUL, so none of the strings can run off its end.
+    std::call_once(a.strings_decoded, [&]() {
+        const char* end = m_file.data() + m_file.size();
+        const char* str = a.strings;
+        a.string_table.reserve(a.nstrings);
+        for (size_t i = 0; i < a.nstrings && str < end; ++i) {
+            a.string_table.emplace_back(str);
+            str += a.string_table.back().size() + 1;
+        }
+    });
+    if (point >= m_npoints)
+        return ustring();
+    int s = ((const int*)a.data)[point];
+    return s >= 0 && size_t(s) < a.string_table.size() ? a.string_table[s]
+                                                        : ustring();
+}
+
+
+
 #ifdef USE_PARTIO
+// Save a Partio cloud (which must have a "position" attribute) as a
+// ".opc" file that PointCloudFile can read.
+static bool
+write_point_cloud_file(string_view filename,
+                       const Partio::ParticlesData& cloud, std::string& err)
+{
+    size_t npoints = size_t(cloud.numParticles());
+    Partio::ParticleAttribute pos;
+    if (!cloud.attributeInfo("position", pos) || pos.type != Partio::VECTOR
+        || pos.count != 3) {
+        err = fmtformat("Point cloud \"{}\" has no position attribute",
+                        filename);
+        return false;
+    }
+    std::vector<float> positions(npoints * 3);
+    for (size_t i = 0; i < npoints; ++i) {
+        const float* p = cloud.data<float>(pos, Partio::ParticleIndex(i));
+        std::copy(p, p + 3, &positions[i * 3]);
+    }
+    PointCloudIndex index(positions.data(), npoints, 3);
+
+    // Lay out the file: header and attribute records, then the aligned
+    // blocks, then the names and strings.
+    using Header          = PointCloudFile::Header;
+    using AttributeRecord = PointCloudFile::AttributeRecord;
+    auto align            = [](uint64_t offset) {
+        const uint64_t a = PointCloudFile::block_align;
+        return (offset + a - 1) / a * a;
+    };
+    std::vector<Partio::ParticleAttribute> attribs;
+    std::vector<AttributeRecord> records;
+    std::string chars;
+    for (int i = 0, e = cloud.numAttributes(); i < e; ++i) {
+        Partio::ParticleAttribute a;
+        cloud.attributeInfo(i, a);
+        TypeDesc type = TypeDescOfPartioType(&a);
+        if (type == TypeDesc::UNKNOWN)
+            continue;  // nothing OSL could read, so don't bother
+        AttributeRecord r;
+        memset(&r, 0, sizeof(r));
+        r.name = chars.size();
+        chars.append(a.name.c_str(), a.name.size() + 1);
+        r.basetype  = type.basetype;
+        r.aggregate = type.aggregate;
+        r.arraylen  = type.arraylen;
+        if (a.type == Partio::INDEXEDSTR) {
+            const std::vector<std::string>& strings = cloud.indexedStrs(a);
+            r.nstrings = uint32_t(strings.size());
+            r.strings  = chars.size();
+            for (auto&& str : strings)
+                chars.append(str.c_str(), str.size() + 1);
+        }
+        attribs.push_back(a);
+        records.push_back(r);
+    }
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PointCloudFile::magic, sizeof(header.magic));
+    header.version  = PointCloudFile::version;
+    header.npoints  = npoints;
+    header.nattribs = uint32_t(records.size());
+    header.index    = align(sizeof(Header)
+                            + records.size() * sizeof(AttributeRecord));
+    uint64_t offset = align(header.index
+                            + npoints * (3 * sizeof(float) + sizeof(int) + 1));
+    for (size_t i = 0; i < records.size(); ++i) {
+        records[i].data = offset;
+        offset          = align(offset + npoints * attribs[i].count * 4);
+    }
+    for (auto&& r : records) {
+        r.name += offset;
+        if (r.nstrings)
+            r.strings += offset;
+    }
+    chars.push_back(0);  // so that the file always ends with a NUL
+
+    OIIO::ofstream out;
+    OIIO::Filesystem::open(out, filename,
+                           std::ios_base::out | std::ios_base::binary);
+    uint64_t written = 0;
+    auto put         = [&](const void* data, size_t size) {
+        out.write((const char*)data, std::streamsize(size));
+        written += size;
+    };
+    auto pad_to = [&](uint64_t offset) {
+        static const char zeros[PointCloudFile::block_align] = {};
+        put(zeros, size_t(offset - written));
+    };
+    put(&header, sizeof(header));
+    put(records.data(), records.size() * sizeof(AttributeRecord));
+    pad_to(header.index);
+    for (int a = 0; a < 3; ++a)
+        put(index.positions(a), npoints * sizeof(float));
+    put(index.indices(), npoints * sizeof(int));
+    put(index.axes(), npoints);
+    for (size_t i = 0; i < records.size(); ++i) {
+        pad_to(records[i].data);
+        const Partio::ParticleAttribute& a(attribs[i]);
+        bool floats = a.type == Partio::FLOAT || a.type == Partio::VECTOR;
+        for (size_t p = 0; p < npoints; ++p) {
+            Partio::ParticleIndex pi(p);
+            if (floats)
+                put(cloud.data<float>(a, pi), a.count * sizeof(float));
+            else
+                put(cloud.data<int>(a, pi), a.count * sizeof(int));
+        }
+    }
+    pad_to(offset);
+    put(chars.data(), chars.size());
+    if (!out) {
+        err = fmtformat("Could not write point cloud \"{}\"", filename);
+        return false;
+    }
+    return true;
+}
+
+
+
+// Each cloud is read once, by the first thread to ask for it, outside the
+// lock of the map so that other clouds may be used meanwhile.
+struct PointCloudEntry {
+    std::once_flag read;
+    std::unique_ptr<PointCloud> cloud;
+};
 using PointCloudMap
-    = std::unordered_map<ustringhash, std::unique_ptr<PointCloud>>;
+    = std::unordered_map<ustringhash, std::unique_ptr<PointCloudEntry>>;
 static PointCloudMap pointclouds;
 static OIIO::spin_mutex pointcloudmap_mutex;
 
+// Is it named as one of our own ".opc" point cloud files?
+static bool
+is_point_cloud_file(ustringhash filename)
+{
+    return Strutil::ends_with(ustring_from(filename), ".opc");
+}
+
 PointCloud*
-PointCloud::get(ustringhash filename, bool write)
+PointCloud::get(ustringhash filename, bool write, bool osl_index)
 {
     if (filename.empty())
         return nullptr;
-    spin_lock lock(pointcloudmap_mutex);
-    PointCloudMap::const_iterator found = pointclouds.find(filename);
-    if (found != pointclouds.end())
-        return found->second.get();
-    // Not found. Create a new one.
-    Partio::ParticlesDataMutable* partio_cloud = nullptr;
-    if (!write) {
-        // Mute Partio error prints: by default Partio::read sends errors directly
-        // to std::err, but in most cases we want errors to go via errorfmt so the
-        // renderer can recognize the message as an error, as we do in
-        // pointcloud_search and pointcloud_get.
-        std::stringstream m_errorStream;
-
-        partio_cloud = Partio::read(filename.c_str(), false, m_errorStream);
-        if (!partio_cloud)
-            return nullptr;
-    } else {
-        partio_cloud = Partio::create();
+    PointCloudEntry* entry;
+    {
+        spin_lock lock(pointcloudmap_mutex);
+        std::unique_ptr<PointCloudEntry>& e(pointclouds[filename]);
+        if (!e)
+            e.reset(new PointCloudEntry);
+        entry = e.get();
     }
-    PointCloud* pc = new PointCloud(filename, partio_cloud, write);
-    pointclouds[filename].reset(pc);
-    return pc;
+    std::call_once(entry->read, [&]() {
+        if (!write && is_point_cloud_file(filename)) {
+            std::unique_ptr<PointCloudFile> file(new PointCloudFile);
+            std::string err;
+            if (file->open(filename.c_str(), err))
+                entry->cloud.reset(new PointCloud(filename, std::move(file)));
+            return;
+        }
+        Partio::ParticlesDataMutable* partio_cloud = nullptr;
+        if (!write) {
+            // Mute Partio error prints: by default Partio::read sends errors directly
+            // to std::err, but in most cases we want errors to go via errorfmt so the
+            // renderer can recognize the message as an error, as we do in
+            // pointcloud_search and pointcloud_get.
+            std::stringstream m_errorStream;
+
+            partio_cloud = Partio::read(filename.c_str(), false,
+                                        m_errorStream);
+            if (!partio_cloud)
+                return;
+        } else {
+            partio_cloud = Partio::create();
+        }
+        entry->cloud.reset(
+            new PointCloud(filename, partio_cloud, write, osl_index));
+    });
+    return entry->cloud.get();
 }
 
 
 PointCloud::PointCloud(ustringhash filename,
-                       Partio::ParticlesDataMutable* partio_cloud, bool write)
+                       Partio::ParticlesDataMutable* partio_cloud, bool write,
+                       bool osl_index)
     : m_filename(filename), m_partio_cloud(partio_cloud), m_write(write)
 {
     if (!m_partio_cloud)
         return;  // empty cloud
 
-    if (!m_write) {
+    if (!m_write && osl_index) {
+        // Index the positions ourselves, leaving the particles in file
+        // order (Partio's sort() would reorder them for its own tree).
+        Partio::ParticleAttribute pos;
+        int n = m_partio_cloud->numParticles();
+        if (m_partio_cloud->attributeInfo("position", pos)
+            && pos.type == Partio::VECTOR && pos.count == 3) {
+            std::vector<float> positions(size_t(n) * 3);
+            for (int i = 0; i < n; ++i) {
+                const float* p = m_partio_cloud->data<float>(pos, i);
+                std::copy(p, p + 3, &positions[size_t(i) * 3]);
+            }
+            m_index.reset(new PointCloudIndex(positions.data(), n, 3));
+        }
+    } else if (!m_write) {
         // partio requires this for accelerated lookups
         m_partio_cloud->sort();
+    }
 
+    if (!m_write) {
         // Create & stash a ParticleAttribute record for each attribute.
         // These will be automatically freed by ~PointCloud when the map
         // destructs.
@@ -70,20 +602,215 @@ PointCloud::PointCloud(ustringhash filename,
             m_attributes[ustringhash_from(ustring(a->name))].reset(a);
         }
     }
+
+    if (m_index) {
+        // Also copy each numeric attribute into a contiguous array of our
+        // own, for batched pointcloud_get to gather from.
+        size_t n = size_t(m_partio_cloud->numParticles());
+        std::vector<Partio::ParticleIndex> all(n);
+        for (size_t i = 0; i < n; ++i)
+            all[i] = Partio::ParticleIndex(i);
+        for (auto& attr : m_attributes) {
+            const Partio::ParticleAttribute& a(*attr.second);
+            TypeDesc type = TypeDescOfPartioType(&a);
+            if (type.basetype != TypeDesc::FLOAT
+                && type.basetype != TypeDesc::INT)
+                continue;
+            m_soa_data.emplace_back(n * a.count);
+            std::vector<int>& values(m_soa_data.back());
+            m_partio_cloud->data(a, int(n), all.data(), false, values.data());
+            auto soa      = std::make_unique<PointCloudFile::Attribute>();
+            soa->type     = type;
+            soa->stride   = a.count * sizeof(int);
+            soa->data     = (const char*)values.data();
+            soa->nstrings = 0;
+            soa->strings  = nullptr;
+            m_soa_attributes[attr.first] = std::move(soa);
+        }
+    }
+}
+
+
+
+PointCloud::PointCloud(ustringhash filename,
+                       std::unique_ptr<PointCloudFile> file)
+    : m_filename(filename)
+    , m_partio_cloud(nullptr)
+    , m_file(std::move(file))
+    , m_write(false)
+{
+}
+
+
+
+bool
+PointCloud::Staging::set(ustringhash name, TypeDesc type, const void* value)
+{
+    if (PartioType(type) == Partio::NONE)
+        return false;
+    uint32_t attrib = 0;
+    while (attrib < m_attribs.size()
+           && (m_attribs[attrib].first != name
+               || m_attribs[attrib].second != type))
+        ++attrib;
+    if (attrib == m_attribs.size())
+        m_attribs.emplace_back(name, type);
+    Value v;
+    v.point  = uint32_t(m_pos.size() - 1);
+    v.attrib = attrib;
+    memcpy(v.f, value, type.size());
+    m_values.push_back(v);
+    return true;
+}
+
+
+
+// Each thread's staging buffer of each cloud it writes to.  The buffers
+// belong to the clouds, which live until exit.
+static thread_local std::unordered_map<const PointCloud*, PointCloud::Staging*>
+    thread_staging;
+
+PointCloud::Staging&
+PointCloud::staging()
+{
+    PointCloud::Staging*& s(thread_staging[this]);
+    if (!s) {
+        spin_lock lock(m_mutex);
+        m_staging.emplace_back(new Staging);
+        s = m_staging.back().get();
+    }
+    return *s;
+}
+
+
+
+void
+PointCloud::merge(Staging& staging)
+{
+    if (!staging.size())
+        return;
+    spin_lock lock(m_mutex);
+    Partio::ParticlesDataMutable* cloud = m_partio_cloud;
+    if (!cloud)
+        return;
+
+    // Mark the pointcloud as written, so we will save it later
+    m_write   = true;
+    m_unsaved = true;
+
+    // first time only -- add "position" attribute
+    if (cloud->numParticles() == 0)
+        m_position_attribute = cloud->addAttribute("position", Partio::VECTOR,
+                                                   3);
+
+    // Find the cloud's attribute for each one staged, adding it if it's
+    // new, or nullptr if the cloud has it with a different type.
+    std::vector<Partio::ParticleAttribute*> partattrs;
+    partattrs.reserve(staging.m_attribs.size());
+    for (auto&& sa : staging.m_attribs) {
+        Partio::ParticleAttributeType pt = PartioType(sa.second);
+        Partio::ParticleAttribute* a     = m_attributes[sa.first].get();
+        if (!a) {  // attribute needs to be added
+            a  = new Partio::ParticleAttribute();
+            *a = cloud->addAttribute(ustring_from(sa.first).c_str(), pt,
+                                     pt == Partio::VECTOR ? 3 : 1 /*count*/);
+            m_attributes[sa.first].reset(a);
+        }
+        partattrs.push_back(pt == a->type ? a : nullptr);
+    }
+
+    // Make the new particles
+    int first = cloud->numParticles();
+    cloud->addParticles(int(staging.size()));
+    for (size_t i = 0, e = staging.size(); i < e; ++i)
+        *(Vec3*)cloud->dataWrite<float>(m_position_attribute, first + int(i))
+            = staging.m_pos[i];
+    for (auto&& v : staging.m_values) {
+        Partio::ParticleAttribute* a = partattrs[v.attrib];
+        if (!a)
+            continue;
+        Partio::ParticleIndex p = first + int(v.point);
+        switch (a->type) {
+        case Partio::FLOAT:
+            *(float*)cloud->dataWrite<float>(*a, p) = v.f[0];
+            break;
+        case Partio::VECTOR:
+            *(Vec3*)cloud->dataWrite<float>(*a, p) = *(const Vec3*)v.f;
+            break;
+        case Partio::INT: *(int*)cloud->dataWrite<int>(*a, p) = v.i; break;
+        case Partio::INDEXEDSTR: {
+            ustring s_ustring = ustring_from(ustringhash_from(v.s));
+            const char* sstr  = s_ustring.c_str();
+            int index         = cloud->lookupIndexedStr(*a, sstr);
+            if (index == -1)
+                index = cloud->registerIndexedStr(*a, sstr);
+            *(int*)cloud->dataWrite<int>(*a, p) = index;
+        } break;
+        case Partio::NONE: break;
+        }
+    }
+    staging.m_pos.clear();
+    staging.m_values.clear();
+}
+
+
+
+bool
+PointCloud::save(std::string& err)
+{
+    // Add whatever points the threads had still staged
+    for (auto&& s : m_staging)
+        merge(*s);
+
+    spin_lock lock(m_mutex);
+    if (!m_unsaved || m_filename.empty())
+        return true;
+    m_unsaved = false;
+    if (is_point_cloud_file(m_filename))
+        return write_point_cloud_file(m_filename.c_str(), *m_partio_cloud,
+                                      err);
+
+    // As for Partio::read, catch what Partio would print to std::cerr
+    std::stringstream errors;
+    Partio::write(m_filename.c_str(), *m_partio_cloud, false /*compressed*/,
+                  false /*verbose*/, errors);
+    if (errors.str().empty())
+        return true;
+    err = fmtformat("Could not write point cloud \"{}\": {}",
+                    m_filename.c_str(), Strutil::strip(errors.str()));
+    return false;
 }
 
 
 
 PointCloud::~PointCloud()
 {
-    // Save the file if we wrote to it
-    if (m_write && !m_filename.empty())
-        Partio::write(m_filename.c_str(), *m_partio_cloud);
+    // Normally the ShadingSystem saved the cloud as it was destroyed. If
+    // points were written since, or it never was, nothing else is left to
+    // report a failure to.
+    std::string err;
+    if (!save(err))
+        ErrorHandler::default_handler().error(err);
     if (m_partio_cloud)
         m_partio_cloud->release();
 }
 #endif
 
+
+
+void
+ShadingSystemImpl::save_pointclouds()
+{
+#ifdef USE_PARTIO
+    spin_lock lock(pointcloudmap_mutex);
+    for (auto&& e : pointclouds) {
+        std::string err;
+        if (e.second->cloud && !e.second->cloud->save(err))
+            errorfmt("pointcloud_write: {}", err);
+    }
+#endif
+}
+
 }  // namespace pvt
 
 
@@ -97,30 +824,37 @@ RendererServices::pointcloud_search(ShaderGlobals* sg, ustringhash filename,
 #ifdef USE_PARTIO
     if (filename.empty())
         return 0;
-    PointCloud* pc = PointCloud::get(filename);
+    bool osl_index = sg->context->shadingsys().pointcloud_index()
+                     == u_kdtree;
+    PointCloud* pc = PointCloud::get(filename, false, osl_index);
     if (pc == NULL) {  // The file failed to load
         sg->context->errorfmt("pointcloud_search: could not open \"{}\"",
                               filename);
         return 0;
     }
 
-    const Partio::ParticlesData* cloud = pc->read_access();
-    if (cloud == NULL) {  // The file failed to load
+    const PointCloudFile* file         = pc->file();
+    const Partio::ParticlesData* cloud = file ? nullptr : pc->read_access();
+    if (cloud == NULL && !file) {  // The file failed to load
         sg->context->errorfmt("pointcloud_search: could not open \"{}\"",
                               filename);
         return 0;
     }
 
     // Early exit if the pointcloud contains no particles.
-    if (cloud->numParticles() == 0)
+    if ((file ? file->size() : size_t(cloud->numParticles())) == 0)
         return 0;
 
     // If we need derivs of the distances, we'll need access to the
     // found point's positions.
-    Partio::ParticleAttribute* pos_attr = NULL;
+    Partio::ParticleAttribute* pos_attr            = NULL;
+    const PointCloudFile::Attribute* file_pos_attr = nullptr;
     if (derivs_offset) {
-        pos_attr = pc->m_attributes[u_position].get();
-        if (!pos_attr)
+        if (file)
+            file_pos_attr = file->attribute(u_position);
+        else
+            pos_attr = pc->m_attributes[u_position].get();
+        if (!pos_attr && !file_pos_attr)
             return 0;  // No "position" attribute -- fail
     }
 
@@ -141,9 +875,19 @@ RendererServices::pointcloud_search(ShaderGlobals* sg, ustringhash filename,
         dist2 = (float*)sg->context->alloc_scratch(max_points * sizeof(float),
                                                    sizeof(float));
 
-    float finalRadius;
-    int count = cloud->findNPoints(&center[0], max_points, radius, indices,
+    int count;
+    if (const PointCloudIndex* index = pc->index()) {
+        // Our own index returns the points already sorted if asked to
+        int* found = OSL_ALLOCA(int, max_points);
+        count = index->search(center, radius, max_points, sort, found, dist2);
+        for (int i = 0; i < count; ++i)
+            indices[i] = found[i];
+        sort = false;
+    } else {
+        float finalRadius;
+        count = cloud->findNPoints(&center[0], max_points, radius, indices,
                                    dist2, &finalRadius);
+    }
 
     // If sorting, allocate some temp space and sort the distances and
     // indices at the same time.
@@ -176,10 +920,12 @@ RendererServices::pointcloud_search(ShaderGlobals* sg, ustringhash filename,
             Vec3* positions = (Vec3*)sg->context->alloc_scratch(sizeof(Vec3)
                                                                     * count,
                                                                 sizeof(float));
-            // FIXME(Partio): this function really should be marked as const because it is just a wrapper of a private const method
-            const_cast<Partio::ParticlesData*>(cloud)->data(*pos_attr, count,
-                                                            indices, true,
-                                                            (void*)positions);
+            if (file)
+                file->get(*file_pos_attr, count, indices, positions);
+            else
+                // FIXME(Partio): this function really should be marked as const because it is just a wrapper of a private const method
+                const_cast<Partio::ParticlesData*>(cloud)->data(
+                    *pos_attr, count, indices, true, (void*)positions);
             const Vec3& dCdx     = (&center)[1];
             const Vec3& dCdy     = (&center)[2];
             float* d_distance_dx = out_distances + derivs_offset;
@@ -222,23 +968,31 @@ RendererServices::pointcloud_get(ShaderGlobals* sg, ustringhash filename,
     if (!count)
         return 1;  // always succeed if not asking for any data
 
-    PointCloud* pc = PointCloud::get(filename);
+    bool osl_index = sg->context->shadingsys().pointcloud_index()
+                     == u_kdtree;
+    PointCloud* pc = PointCloud::get(filename, false, osl_index);
     if (pc == NULL) {  // The file failed to load
         sg->context->errorfmt("pointcloud_get: could not open \"{}\"",
                               filename);
         return 0;
     }
 
-    const Partio::ParticlesData* cloud = pc->read_access();
-    if (cloud == NULL) {  // The file failed to load
+    const PointCloudFile* file         = pc->file();
+    const Partio::ParticlesData* cloud = file ? nullptr : pc->read_access();
+    if (cloud == NULL && !file) {  // The file failed to load
         sg->context->errorfmt("pointcloud_get: could not open \"{}\"",
                               filename);
         return 0;
     }
 
     // lookup the ParticleAttribute pointer needed for a query
-    Partio::ParticleAttribute* attr = pc->m_attributes[attr_name].get();
-    if (!attr) {
+    Partio::ParticleAttribute* attr            = nullptr;
+    const PointCloudFile::Attribute* file_attr = nullptr;
+    if (file)
+        file_attr = file->attribute(attr_name);
+    else
+        attr = pc->m_attributes[attr_name].get();
+    if (!attr && !file_attr) {
         sg->context->errorfmt(
             "Accessing unexisting attribute {} in pointcloud \"{}\"", attr_name,
             filename);
@@ -246,7 +1000,8 @@ RendererServices::pointcloud_get(ShaderGlobals* sg, ustringhash filename,
     }
 
     // Type the partio file contains:
-    TypeDesc partio_type = TypeDescOfPartioType(attr);
+    TypeDesc partio_type = file_attr ? file_attr->type
+                                     : TypeDescOfPartioType(attr);
     // Type the OSL shader has provided in destination array:
     TypeDesc element_type = attr_type.elementtype();
 
@@ -277,7 +1032,17 @@ RendererServices::pointcloud_get(ShaderGlobals* sg, ustringhash filename,
     }
 
     // Actual data query
-    if (partio_type == TypeString) {
+    if (file_attr) {
+        // Only the pages of the attribute's values that hold these points
+        // are read in
+        if (partio_type == TypeString) {
+            for (int i = 0; i < count; ++i)
+                ((ustringhash*)out_data)[i] = ustringhash_from(
+                    file->string(*file_attr, indices[i]));
+        } else {
+            file->get(*file_attr, count, indices, out_data);
+        }
+    } else if (partio_type == TypeString) {
         // strings are special cases because they are stored as int index
         int* strindices = OSL_ALLOCA(int, count);
         const_cast<Partio::ParticlesData*>(cloud)->data(*attr, count, indices,
@@ -321,76 +1086,26 @@ RendererServices::pointcloud_write(ShaderGlobals* /*sg*/, ustringhash filename,
     if (filename.empty())
         return false;
     PointCloud* pc = PointCloud::get(filename, true /* create file to write */);
-    spin_lock lock(pc->m_mutex);
-    Partio::ParticlesDataMutable* cloud = pc->write_access();
-    if (cloud == NULL)  // The file failed to load
+    if (pc->write_access() == NULL)  // The file failed to load
         return false;
 
-    // Mark the pointcloud as written, so we will save it later
-    pc->m_write = true;
-
-    // first time only -- add "position" attribute
-    if (cloud->numParticles() == 0)
-        pc->m_position_attribute = cloud->addAttribute("position",
-                                                       Partio::VECTOR, 3);
-
-    // Make sure all the attributes mentioned have been added properly
+    // Stage the new point in this thread's own buffer, which is added to
+    // the cloud (under its lock) only a chunk of points at a time.
+    PointCloud::Staging& staging(pc->staging());
+    staging.add_point(pos);
     bool ok = true;
-    std::vector<Partio::ParticleAttribute*> partattrs;
-    partattrs.reserve(nattribs);
-    for (int i = 0; i < nattribs; ++i) {
-        Partio::ParticleAttribute* a = pc->m_attributes[names[i]].get();
-        if (!a) {  // attribute needs to be added
-            Partio::ParticleAttributeType pt = PartioType(types[i]);
-            if (pt == Partio::NONE) {
-                ok = false;
-            } else {
-                a  = new Partio::ParticleAttribute();
-                *a = cloud->addAttribute(ustring_from(names[i]).c_str(), pt,
-                                         pt == Partio::VECTOR ? 3
-                                                              : 1 /*count*/);
-                pc->m_attributes[names[i]].reset(a);
-            }
-        }
-        partattrs.push_back(a);
-    }
-
-    // Make a new particle
-    Partio::ParticleIndex p = cloud->addParticle();
-    *(Vec3*)cloud->dataWrite<float>(pc->m_position_attribute, p) = pos;
-    for (int i = 0; i < nattribs; ++i) {
-        Partio::ParticleAttribute* a = partattrs[i];
-        if (a && PartioType(types[i]) == a->type) {
-            switch (a->type) {
-            case Partio::FLOAT:
-                *(float*)cloud->dataWrite<float>(*a, p) = *(float*)(data[i]);
-                break;
-            case Partio::VECTOR:
-                *(Vec3*)cloud->dataWrite<float>(*a, p) = *(Vec3*)(data[i]);
-                break;
-            case Partio::INT:
-                *(int*)cloud->dataWrite<int>(*a, p) = *(int*)(data[i]);
-                break;
-            case Partio::INDEXEDSTR: {
-                ustringhash s     = *(ustringhash*)(data[i]);
-                ustring s_ustring = ustring_from(s);
-                const char* sstr  = s_ustring.c_str();
-                int index         = cloud->lookupIndexedStr(*a, sstr);
-                if (index == -1)
-                    index = cloud->registerIndexedStr(*a, sstr);
-                *(int*)cloud->dataWrite<int>(*a, p) = index;
-            } break;
-            case Partio::NONE: break;
-            }
-        }
-    }
-
+    for (int i = 0; i < nattribs; ++i)
+        ok &= staging.set(names[i], types[i], data[i]);
+    if (staging.size() >= PointCloud::Staging::chunk_size)
+        pc->merge(staging);
     return ok;
 #else
     return false;
 #endif
 }
 
+
+
 namespace pvt {
 
 OSL_SHADEOP OSL_HOSTDEVICE int
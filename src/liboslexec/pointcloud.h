@@ -2,23 +2,194 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
 #ifdef USE_PARTIO
 #    include <Partio.h>
-#    include <memory>
-#    include <unordered_map>
 #endif
 
 #include <OSL/oslconfig.h>
 
+#include "mappedfile.h"
+
 OSL_NAMESPACE_BEGIN
 namespace pvt {
 
+// OSL's own spatial index of the positions of a point cloud, used in place
+// of Partio's KD-tree when the "pointcloud_index" option is "kdtree".
+//
+// It is an implicit balanced KD-tree: the points are reordered so that
+// the node of the range [lo,hi) is the point at its middle, splitting on
+// the axis stored for it, with the halves on either side being its
+// children. Ranges of at most leaf_size points are leaves. Positions are
+// kept as separate x, y and z arrays, so that leaves are scanned a SIMD
+// vector at a time, and the top of the tree is split serially with the
+// subtrees below it built in parallel.  An index may also be a view of
+// the arrays of one that was built earlier and saved, as in ".opc" files.
+class OSLEXECPUBLIC PointCloudIndex {
+public:
+    /// Index the positions of the npoints points of a cloud, the position
+    /// of point i at positions[i*stride .. i*stride+2].
+    PointCloudIndex(const float* positions, size_t npoints, size_t stride);
+
+    /// View an index built earlier, given its arrays (which must outlive
+    /// it).
+    PointCloudIndex(size_t npoints, const float* const positions[3],
+                    const int* indices, const uint8_t* axes);
+
+    size_t size() const { return m_size; }
+
+    /// The arrays of the index, for saving it: the positions along axis
+    /// a in tree order, the cloud index of each, and the split axis of
+    /// the node at each.
+    const float* positions(int a) const { return m_x[a]; }
+    const int* indices() const { return m_indices; }
+    const uint8_t* axes() const { return m_axes; }
+
+    /// Find up to max_points of the nearest points within radius of
+    /// center, storing their indices within the cloud and their squared
+    /// distances, nearest first if sort is true. Return how many.
+    int search(const Vec3& center, float radius, int max_points, bool sort,
+               int* indices, float* dist2) const;
+
+    /// Do n searches, the results of search i (there are counts[i] of
+    /// them) going to indices and dist2 starting at i*max_points.  When
+    /// the searches are near one another, as for the lanes of a batch,
+    /// the tree is descended just once, for the box bounding them all,
+    /// and each search then only tests the points found in it.
+    void search_batch(int n, const Vec3* centers, const float* radii,
+                      int max_points, bool sort, int* indices, float* dist2,
+                      int* counts) const;
+
+    static constexpr int leaf_size = 8;
+    /// The most points a batch's box may hold for it to be searched
+    /// jointly, rather than search by search.
+    static constexpr int batch_candidates = 1024;
+
+private:
+    struct Search;
+    void build(int lo, int hi, std::vector<int>& order, int depth,
+               std::vector<std::pair<int, int>>* deferred);
+    void search(int lo, int hi, Search& s) const;
+    int finish(Search& s, bool sort, int* indices, float* dist2) const;
+    // Append the tree positions of the points in [lo,hi) within the box
+    // to candidates, returning false if there are more than
+    // batch_candidates of them.
+    bool collect(int lo, int hi, const Vec3& bmin, const Vec3& bmax,
+                 int* candidates, int& ncandidates) const;
+
+    std::vector<float> m_pos[3];   // positions in tree order, by axis
+    std::vector<int> m_index;      // cloud index of each point
+    std::vector<uint8_t> m_axis;   // split axis of the node at each point
+    const float* m_src = nullptr;  // positions, only while building
+    size_t m_stride    = 0;
+    // The arrays searched: either the ones above or those of a view
+    const float* m_x[3]   = { nullptr, nullptr, nullptr };
+    const int* m_indices  = nullptr;
+    const uint8_t* m_axes = nullptr;
+    size_t m_size         = 0;
+};
+
+
+
+// A read-only ".opc" point cloud file, memory mapped where possible. The
+// file holds a saved PointCloudIndex of the positions, which is searched
+// in place, and each attribute as a separate page-aligned block of values,
+// so that only the attributes (and the parts of them) that pointcloud_get
+// asks for are ever paged in, and renders on one machine share the pages.
+class OSLEXECPUBLIC PointCloudFile {
+public:
+    struct Attribute {
+        TypeDesc type;        // type of the value of each point
+        size_t stride;        // bytes per point
+        const char* data;     // values, of point i at data + i*stride
+        size_t nstrings;      // for strings, the values index a table of
+        const char* strings;  //   nstrings NUL-terminated strings
+        mutable std::once_flag strings_decoded;
+        mutable std::vector<ustring> string_table;
+    };
+
+    PointCloudFile() {}
+    PointCloudFile(const PointCloudFile&) = delete;
+
+    bool open(const std::string& filename, std::string& err);
+
+    size_t size() const { return m_npoints; }
+    const PointCloudIndex* index() const { return m_index.get(); }
+
+    /// The named attribute, or nullptr if there is no such attribute.
+    const Attribute* attribute(ustringhash name) const
+    {
+        auto found = m_attributes.find(name);
+        return found != m_attributes.end() ? found->second.get() : nullptr;
+    }
+
+    /// Copy the values of count points of a non-string attribute to out,
+    /// zero for any point index that is out of range.
+    template<typename Index>
+    void get(const Attribute& a, int count, const Index* indices,
+             void* out) const
+    {
+        char* dst = (char*)out;
+        for (int i = 0; i < count; ++i, dst += a.stride) {
+            size_t p = size_t(indices[i]);
+            if (p < m_npoints)
+                memcpy(dst, a.data + p * a.stride, a.stride);
+            else
+                memset(dst, 0, a.stride);
+        }
+    }
+
+    /// The value of one point of a string attribute.
+    ustring string(const Attribute& a, size_t point) const;
+
+    static constexpr char magic[4]      = { 'O', 'S', 'L', 'P' };
+    static constexpr uint32_t version   = 1;
+    static constexpr size_t block_align = 4096;
+
+    // On-disk layout: a Header, then nattribs AttributeRecords, then
+    // block_align aligned blocks of the index and of each attribute's
+    // values, then the names and string tables (all offsets from the
+    // start of the file).
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint64_t npoints;
+        uint32_t nattribs;
+        uint32_t reserved;
+        uint64_t index;  // x, y, z floats, int indices, uint8 axes
+    };
+    struct AttributeRecord {
+        uint64_t name;
+        uint32_t basetype, aggregate;
+        int32_t arraylen;
+        uint32_t nstrings;
+        uint64_t data;
+        uint64_t strings;
+    };
+
+private:
+    MappedFile m_file;
+    size_t m_npoints = 0;
+    std::unique_ptr<PointCloudIndex> m_index;
+    std::unordered_map<ustringhash, std::unique_ptr<Attribute>> m_attributes;
+};
+
+
+
 #ifdef USE_PARTIO
 
 class OSLEXECPUBLIC PointCloud {
 public:
     PointCloud(ustringhash filename, Partio::ParticlesDataMutable* partio_cloud,
-               bool write);
+               bool write, bool osl_index = false);
+    /// A cloud read from a ".opc" file.
+    PointCloud(ustringhash filename, std::unique_ptr<PointCloudFile> file);
     ~PointCloud();
 
     PointCloud(const PointCloud&)             = delete;
@@ -26,7 +197,11 @@ public:
     PointCloud& operator=(const PointCloud&)  = delete;
     PointCloud& operator=(const PointCloud&&) = delete;
 
-    static PointCloud* get(ustringhash filename, bool write = false);
+    /// Return the cloud, reading it the first time it's asked for. If
+    /// osl_index is true when it is read, it is indexed with our own
+    /// PointCloudIndex rather than Partio's KD-tree.
+    static PointCloud* get(ustringhash filename, bool write = false,
+                           bool osl_index = false);
 
     typedef std::unordered_map<ustringhash,
                                std::unique_ptr<Partio::ParticleAttribute>>
@@ -37,21 +212,95 @@ public:
         OSL_DASSERT(!m_write);
         return m_partio_cloud;
     }
+    /// Our own index of the cloud, or nullptr if it uses Partio's.
+    const PointCloudIndex* index() const
+    {
+        return m_file ? m_file->index() : m_index.get();
+    }
+    /// The ".opc" file the cloud was read from, in which case it has no
+    /// Partio cloud, or nullptr.
+    const PointCloudFile* file() const { return m_file.get(); }
+    /// Number of points of a cloud being read.
+    size_t size() const
+    {
+        return m_file ? m_file->size()
+                      : size_t(m_partio_cloud->numParticles());
+    }
+    /// The values of a (non-string) attribute in one contiguous array,
+    /// those of point i at data + i*stride, as ".opc" files hold them and
+    /// as we copy them for clouds with our own index, so that batched
+    /// lookups can gather them directly. nullptr if there isn't one.
+    const PointCloudFile::Attribute* soa_attribute(ustringhash name) const
+    {
+        if (m_file)
+            return m_file->attribute(name);
+        auto found = m_soa_attributes.find(name);
+        return found != m_soa_attributes.end() ? found->second.get()
+                                               : nullptr;
+    }
     Partio::ParticlesDataMutable* write_access() const
     {
         OSL_DASSERT(m_write);
         return m_partio_cloud;
     }
 
+    /// Points written by pointcloud_write, staged by one thread without
+    /// locking, to be added to the cloud a chunk at a time.
+    class Staging {
+    public:
+        /// Start a new point at pos.
+        void add_point(const Vec3& pos) { m_pos.push_back(pos); }
+        /// Set an attribute of the newest point, returning false if the
+        /// type is not one that point clouds can hold.
+        bool set(ustringhash name, TypeDesc type, const void* value);
+        size_t size() const { return m_pos.size(); }
+
+        /// How many points are staged before they're added to the cloud
+        static constexpr size_t chunk_size = 4096;
+
+    private:
+        friend class PointCloud;
+        struct Value {
+            uint32_t point, attrib;
+            union {
+                float f[3];
+                int i;
+                ustringhash_pod s;
+            };
+        };
+        std::vector<Vec3> m_pos;
+        std::vector<std::pair<ustringhash, TypeDesc>> m_attribs;
+        std::vector<Value> m_values;
+    };
+
+    /// The calling thread's staging buffer for writing to the cloud.
+    Staging& staging();
+    /// Add the staged points to the cloud (they're added automatically
+    /// when there are a chunk of them, and when the cloud is saved), and
+    /// empty the buffer.
+    void merge(Staging& staging);
+    /// Add the points the threads still have staged, and save the cloud
+    /// to its file if points were added since it was last saved. Return
+    /// false, with err set, if that failed. Only call it while no shader
+    /// is writing to the cloud.
+    bool save(std::string& err);
+
     ustringhash m_filename;
 
 private:
     // hide just this field, because we want to control how it is accessed
     Partio::ParticlesDataMutable* m_partio_cloud;
+    std::unique_ptr<PointCloudIndex> m_index;
+    std::unique_ptr<PointCloudFile> m_file;
+    std::vector<std::unique_ptr<Staging>> m_staging;  // of every thread
+    std::unordered_map<ustringhash, std::unique_ptr<PointCloudFile::Attribute>>
+        m_soa_attributes;
+    std::vector<std::vector<int>> m_soa_data;  // values of m_soa_attributes
 
 public:
     AttributeMap m_attributes;
     bool m_write;
+    bool m_unsaved = false;  // points added since the cloud was saved
     Partio::ParticleAttribute m_position_attribute;
     OIIO::spin_mutex m_mutex;
 };
@@ -59,6 +308,7 @@ public:
 namespace {  // anon
 
 static ustring u_position("position");
+static ustring u_kdtree("kdtree");
 
 // some helper classes to make the sort easy
 typedef std::pair<float, Partio::ParticleIndex> SortedPointRecord;  // dist,index
@@ -0,0 +1,144 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+
+#include <OpenImageIO/strutil.h>
+#include <OpenImageIO/ustring.h>
+
+#include "regexcache.h"
+
+OSL_NAMESPACE_BEGIN
+namespace pvt {
+
+// Characters with a meaning in a pattern; escaped, they stand for
+// themselves.
+static const char* regex_special = "^$\\.*+?()[]{}|/";
+
+
+
+// If the pattern is a literal string, optionally starting with ^ and
+// ending with $, set literal to the string it matches and return true.
+static bool
+parse_literal(string_view pattern, std::string& literal, bool& anchor_begin,
+              bool& anchor_end)
+{
+    size_t n     = pattern.size();
+    size_t i     = 0;
+    anchor_begin = (n && pattern[0] == '^');
+    anchor_end   = false;
+    if (anchor_begin)
+        ++i;
+    for (; i < n; ++i) {
+        char c = pattern[i];
+        if (c == '\\') {
+            // Backslash and a letter or digit is a class, an anchor or a
+            // back reference, not a literal.
+            if (i + 1 == n || !pattern[i + 1]
+                || !strchr(regex_special, pattern[i + 1]))
+                return false;
+            literal += pattern[++i];
+        } else if (c == '$' && i + 1 == n) {
+            anchor_end = true;
+        } else if (!c || strchr(regex_special, c)) {
+            return false;
+        } else {
+            literal += c;
+        }
+    }
+    return true;
+}
+
+
+
+CompiledRegex::CompiledRegex(string_view pattern)
+    : m_pattern_length(int(pattern.size()))
+{
+    if (!parse_literal(pattern, m_literal, m_anchor_begin, m_anchor_end)) {
+        m_literal.clear();
+        m_regex.reset(new std::regex(pattern.begin(), pattern.end()));
+    }
+}
+
+
+
+bool
+CompiledRegex::match(string_view subject, bool fullmatch, int* results,
+                     int nresults) const
+{
+    const char* begin = subject.data();
+    const char* end   = begin + subject.size();
+    if (m_regex) {
+        if (nresults <= 0)
+            return fullmatch ? std::regex_match(begin, end, *m_regex)
+                             : std::regex_search(begin, end, *m_regex);
+        std::cmatch m;
+        bool found = fullmatch ? std::regex_match(begin, end, m, *m_regex)
+                               : std::regex_search(begin, end, m, *m_regex);
+        for (int r = 0; r < nresults; ++r) {
+            if (r / 2 < (int)m.size())
+                results[r] = int(((r & 1) ? m[r / 2].second : m[r / 2].first)
+                                 - begin);
+            else
+                results[r] = m_pattern_length;
+        }
+        return found;
+    }
+
+    size_t len = m_literal.size();
+    size_t pos = string_view::npos;
+    if (fullmatch || (m_anchor_begin && m_anchor_end)) {
+        if (subject == m_literal)
+            pos = 0;
+    } else if (m_anchor_begin) {
+        if (OIIO::Strutil::starts_with(subject, m_literal))
+            pos = 0;
+    } else if (m_anchor_end) {
+        if (OIIO::Strutil::ends_with(subject, m_literal))
+            pos = subject.size() - len;
+    } else {
+        pos = subject.find(m_literal);
+    }
+    bool found = (pos != string_view::npos);
+    // A literal has no subexpressions, just the whole match.
+    for (int r = 0; r < nresults; ++r) {
+        if (found && r < 2)
+            results[r] = int(r ? pos + len : pos);
+        else
+            results[r] = m_pattern_length;
+    }
+    return found;
+}
+
+
+
+namespace {
+struct RegexCache {
+    std::mutex mutex;
+    std::unordered_map<ustring, std::unique_ptr<CompiledRegex>> regexes;
+};
+}  // namespace
+
+
+
+const CompiledRegex&
+find_regex(ustring pattern, bool* compiled)
+{
+    // Entries are never removed or changed, so the references handed out
+    // stay good after the lock is released.
+    static RegexCache cache;
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    auto found = cache.regexes.find(pattern);
+    if (found != cache.regexes.end())
+        return *found->second;
+    std::unique_ptr<CompiledRegex> regex(new CompiledRegex(pattern));
+    if (compiled)
+        *compiled = true;
+    return *(cache.regexes[pattern] = std::move(regex));
+}
+
+}  // namespace pvt
+OSL_NAMESPACE_END
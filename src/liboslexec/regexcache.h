@@ -0,0 +1,55 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <memory>
+#include <regex>
+#include <string>
+
+#include <OSL/oslconfig.h>
+
+OSL_NAMESPACE_BEGIN
+namespace pvt {
+
+// A compiled regex_search/regex_match pattern. Most patterns in shaders
+// are just a literal string, maybe anchored with ^ or $, and those are
+// matched with plain string compares rather than std::regex, which is
+// slow even for trivial patterns; anything else goes to std::regex.
+// Once made it's never changed, so any thread may use it.
+class CompiledRegex {
+public:
+    /// Compile the pattern (ECMAScript syntax, like std::regex). Throws
+    /// std::regex_error if it's not a valid pattern.
+    explicit CompiledRegex(string_view pattern);
+
+    /// Search the subject for the pattern, or with fullmatch, match the
+    /// whole subject, returning whether it matched. The first nresults
+    /// of results get the begin and end offsets of the match and then of
+    /// each subexpression, or the pattern length for ones that didn't
+    /// take part in the match.
+    bool match(string_view subject, bool fullmatch, int* results = nullptr,
+               int nresults = 0) const;
+
+    /// Is the pattern matched without std::regex?
+    bool is_literal() const { return !m_regex; }
+
+private:
+    std::unique_ptr<std::regex> m_regex;  // nullptr if it's a literal
+    std::string m_literal;
+    bool m_anchor_begin = false;
+    bool m_anchor_end   = false;
+    int m_pattern_length;
+};
+
+
+
+/// The compiled regex for a pattern, from a cache shared by the whole
+/// process, compiling it (and setting *compiled, if given) if this is its
+/// first use. Throws std::regex_error if it's not a valid pattern.
+const CompiledRegex&
+find_regex(ustring pattern, bool* compiled = nullptr);
+
+}  // namespace pvt
+OSL_NAMESPACE_END
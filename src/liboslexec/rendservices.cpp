@@ -195,17 +195,32 @@ RendererServices::get_userdata(bool derivatives, ustringhash name,
 }
 
 
+
+void
+RendererServices::get_userdata_all(ShaderGlobals* sg,
+                                   span<UserdataGather> requests)
+{
+    for (UserdataGather& r : requests)
+        r.found = get_userdata(r.derivs, r.name, r.type, sg, r.val);
+}
+
+
 void
 RendererServices::errorfmt(OSL::ShaderGlobals* sg,
                            OSL::ustringhash fmt_specification,
                            int32_t arg_count, const EncodedType* arg_types,
-                           uint32_t /*arg_values_size*/, uint8_t* arg_values)
+                           uint32_t arg_values_size, uint8_t* arg_values)
 
 {
+    ShadingContext* ctx = (ShadingContext*)((ShaderGlobals*)sg)->context;
+    if (ctx->defer_formatting()) {
+        ctx->record_encoded(ErrorHandler::EH_ERROR, fmt_specification,
+                            arg_count, arg_types, arg_values_size, arg_values);
+        return;
+    }
     std::string message;
     OSL::decode_message(fmt_specification.hash(), arg_count, arg_types,
                         arg_values, message);
-    ShadingContext* ctx = (ShadingContext*)((ShaderGlobals*)sg)->context;
     ctx->errorfmt(message.c_str());
 }
 
@@ -214,10 +229,16 @@ void
 RendererServices::warningfmt(OSL::ShaderGlobals* sg,
                              OSL::ustringhash fmt_specification,
                              int32_t arg_count, const EncodedType* arg_types,
-                             uint32_t /*arg_values_size*/, uint8_t* arg_values)
+                             uint32_t arg_values_size, uint8_t* arg_values)
 {
     ShadingContext* ctx = (ShadingContext*)((ShaderGlobals*)sg)->context;
     if (ctx->allow_warnings()) {
+        if (ctx->defer_formatting()) {
+            ctx->record_encoded(ErrorHandler::EH_WARNING, fmt_specification,
+                                arg_count, arg_types, arg_values_size,
+                                arg_values);
+            return;
+        }
         std::string message;
         OSL::decode_message(fmt_specification.hash(), arg_count, arg_types,
                             arg_values, message);
@@ -230,12 +251,17 @@ void
 RendererServices::printfmt(OSL::ShaderGlobals* sg,
                            OSL::ustringhash fmt_specification,
                            int32_t arg_count, const EncodedType* arg_types,
-                           uint32_t /*arg_values_size*/, uint8_t* arg_values)
+                           uint32_t arg_values_size, uint8_t* arg_values)
 {
+    ShadingContext* ctx = (ShadingContext*)((ShaderGlobals*)sg)->context;
+    if (ctx->defer_formatting()) {
+        ctx->record_encoded(ErrorHandler::EH_MESSAGE, fmt_specification,
+                            arg_count, arg_types, arg_values_size, arg_values);
+        return;
+    }
     std::string message;
     OSL::decode_message(fmt_specification.hash(), arg_count, arg_types,
                         arg_values, message);
-    ShadingContext* ctx = (ShadingContext*)((ShaderGlobals*)sg)->context;
     ctx->messagefmt(message.c_str());
 }
 
@@ -518,6 +544,17 @@ RendererServices::trace(TraceOpt& options, ShaderGlobals* sg,
 
 
 
+void
+RendererServices::trace_deferred(span<TraceRequest> requests,
+                                 span<ShaderGlobals> globals)
+{
+    for (TraceRequest& r : requests)
+        r.hit = trace(r.options, &globals[r.point], r.P, r.dPdx, r.dPdy, r.R,
+                      r.dRdx, r.dRdy);
+}
+
+
+
 bool
 RendererServices::getmessage(ShaderGlobals* sg, ustringhash source,
                              ustringhash name, TypeDesc type, void* val,
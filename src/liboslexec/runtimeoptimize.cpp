@@ -2,8 +2,14 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
 #include <cmath>
+#include <condition_variable>
 #include <cstdio>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <thread>
 #include <vector>
 
 #include <OpenImageIO/sysutil.h>
@@ -24,6 +30,18 @@ static ustring u_assign("assign");
 static ustring u_add("add");
 static ustring u_sub("sub");
 static ustring u_mul("mul");
+static ustring u_div("div");
+static ustring u_neg("neg");
+static ustring u_eq("eq");
+static ustring u_neq("neq");
+static ustring u_lt("lt");
+static ustring u_le("le");
+static ustring u_gt("gt");
+static ustring u_ge("ge");
+static ustring u_and("and");
+static ustring u_or("or");
+static ustring u_compref("compref");
+static ustring u_compassign("compassign");
 static ustring u_if("if");
 static ustring u_for("for");
 static ustring u_while("while");
@@ -36,6 +54,12 @@ static ustring u_return("return");
 static ustring u_useparam("useparam");
 static ustring u_closure("closure");
 static ustring u_pointcloud_write("pointcloud_write");
+static ustring u_texture("texture");
+static ustring u_transform("transform");
+static ustring u_transformv("transformv");
+static ustring u_transformn("transformn");
+static ustring u_matrix("matrix");
+static ustring u_channels("channels");
 static ustring u_isconnected("isconnected");
 static ustring u_setmessage("setmessage");
 static ustring u_getmessage("getmessage");
@@ -45,6 +69,9 @@ static ustring u_calculatenormal("calculatenormal");
 static ustring u_flipHandedness("flipHandedness");
 static ustring u_N("N");
 static ustring u_I("I");
+static ustring u_precise("precise");
+static ustring u_fast("fast");
+static ustring u_approx("approx");
 static ustring main_method_name("___main___");
 
 
@@ -103,6 +130,9 @@ RuntimeOptimizer::RuntimeOptimizer(ShadingSystemImpl& shadingsys,
     , m_opt_assign(shadingsys.m_opt_assign)
     , m_opt_mix(shadingsys.m_opt_mix)
     , m_opt_middleman(shadingsys.m_opt_middleman)
+    , m_opt_sccp(shadingsys.m_opt_sccp)
+    , m_opt_licm(shadingsys.m_opt_licm)
+    , m_opt_loop_unroll(shadingsys.m_opt_loop_unroll)
     , m_opt_batched_analysis(shadingsys.m_opt_batched_analysis)
     , m_keep_no_return_function_calls(shadingsys.m_llvm_debugging_symbols)
     , m_pass(0)
@@ -141,6 +171,7 @@ OSOProcessorBase::set_inst(int newlayer)
     m_layer = newlayer;
     m_inst  = group()[m_layer];
     OSL_DASSERT(m_inst != NULL);
+    m_loop_counters.clear();  // They were for the old layer's code
     set_debug();
 }
 
@@ -185,6 +216,22 @@ OSOProcessorBase::set_debug()
 
 
 
+const char*
+OSOProcessorBase::math_opname(ustring opname) const
+{
+    static const ustring ops[] = { ustring("exp"), ustring("log"),
+                                   ustring("pow"), ustring("sin"),
+                                   ustring("cos"), ustring("atan2") };
+    ustring tier = group().m_math_precision;
+    if ((tier != u_precise && tier != u_fast && tier != u_approx)
+        || tier == (OSL_FAST_MATH ? u_fast : u_precise)
+        || std::find(std::begin(ops), std::end(ops), opname) == std::end(ops))
+        return opname.c_str();
+    return ustring::fmtformat("{}_{}", tier, opname).c_str();
+}
+
+
+
 void
 RuntimeOptimizer::set_debug()
 {
@@ -210,6 +257,8 @@ RuntimeOptimizer::set_debug()
             m_opt_assign                    = true;
             m_opt_mix                       = true;
             m_opt_middleman                 = true;
+            m_opt_sccp                      = true;
+            m_opt_licm                      = true;
         }
     }
 }
@@ -981,7 +1030,7 @@ RuntimeOptimizer::simplify_params()
                     // earlier analysis by find_params_holding_globals?
                     // If so, make sure the global is in this instance's
                     // symbol table, and alias the parameter to it.
-                    ustringmap_t& g(m_params_holding_globals[c.srclayer]);
+                    ustringmap_t& g(params_holding_globals()[c.srclayer]);
                     auto f = g.find(srcsym->name());
                     if (f != g.end()) {
                         if (debug() > 1)
@@ -1072,7 +1121,7 @@ RuntimeOptimizer::find_params_holding_globals()
         if (debug() > 1)
             debug_optfmt("I think that {}.{} will always be {}\n",
                          inst()->layername(), s.name(), src->name());
-        m_params_holding_globals[layer()][s.name()] = src->name();
+        params_holding_globals()[layer()][s.name()] = src->name();
     }
 }
 
@@ -1165,6 +1214,134 @@ OSOProcessorBase::find_basic_blocks()
 
 
 
+void
+OSOProcessorBase::find_loop_counters()
+{
+    OpcodeVec& code(inst()->ops());
+    m_loop_counters.clear();
+    for (int opnum = 0, e = (int)code.size(); opnum < e; ++opnum) {
+        const Opcode& op(code[opnum]);
+        if (op.opname() != u_for)
+            continue;
+        int condbegin = op.jump(0);
+        int bodybegin = op.jump(1);
+        int stepbegin = op.jump(2);
+        int loopend   = op.jump(3);
+
+        // The condition must be a single comparison of an int counter with
+        // a constant bound.
+        if (bodybegin - condbegin != 1)
+            continue;
+        const Opcode& condop(code[condbegin]);
+        ustring cmp = condop.opname();
+        if ((cmp != u_lt && cmp != u_le && cmp != u_gt && cmp != u_ge)
+            || condop.nargs() != 3 || oparg(condop, 0) != oparg(op, 0))
+            continue;
+        Symbol* A         = opargsym(condop, 1);
+        Symbol* B         = opargsym(condop, 2);
+        bool counter_is_a = !A->is_constant();
+        int counter       = oparg(condop, counter_is_a ? 1 : 2);
+        Symbol* C         = inst()->symbol(counter);
+        Symbol* bound     = counter_is_a ? B : A;
+        if (!C->typespec().is_int() || !bound->is_constant()
+            || !bound->typespec().is_int()
+            || (C->symtype() != SymTypeLocal && C->symtype() != SymTypeTemp))
+            continue;
+        // Put the comparison as "counter cmp bound".
+        if (!counter_is_a)
+            cmp = (cmp == u_lt)   ? u_gt
+                  : (cmp == u_le) ? u_ge
+                  : (cmp == u_gt) ? u_lt
+                                  : u_le;
+
+        // The init code must set the counter to a constant exactly once,
+        // with no control flow of its own.
+        int counter_inits = 0;
+        long long start   = 0;
+        bool ok           = true;
+        for (int i = opnum + 1; i < condbegin && ok; ++i) {
+            const Opcode& iop(code[i]);
+            ok = iop.jump(0) < 0;
+            for (int a = 0, na = iop.nargs(); a < na && ok; ++a) {
+                if (!iop.argwrite(a) || oparg(iop, a) != counter)
+                    continue;
+                ok = iop.opname() == u_assign && a == 0
+                     && opargsym(iop, 1)->is_constant()
+                     && opargsym(iop, 1)->typespec().is_int();
+                if (ok) {
+                    start = opargsym(iop, 1)->get_int();
+                    ++counter_inits;
+                }
+            }
+        }
+        if (!ok || counter_inits != 1)
+            continue;
+
+        // Only the step may change the counter, by adding or subtracting a
+        // constant, toward the bound.
+        long long step = 0;
+        for (int i = condbegin; i < loopend && ok; ++i) {
+            const Opcode& sop(code[i]);
+            for (int a = 0, na = sop.nargs(); a < na && ok; ++a) {
+                if (!sop.argwrite(a) || oparg(sop, a) != counter)
+                    continue;
+                ok = i >= stepbegin && step == 0 && a == 0
+                     && (sop.opname() == u_add || sop.opname() == u_sub)
+                     && sop.nargs() == 3 && oparg(sop, 1) == counter
+                     && opargsym(sop, 2)->is_constant()
+                     && opargsym(sop, 2)->typespec().is_int();
+                if (ok) {
+                    step = opargsym(sop, 2)->get_int();
+                    if (sop.opname() == u_sub)
+                        step = -step;
+                    ok = step != 0;
+                }
+            }
+        }
+        if (!ok || step == 0)
+            continue;
+
+        // Within the body the counter has passed the condition, and has
+        // only moved toward the bound from where it started. A step that
+        // could overflow past the bound would wrap it around, though.
+        long long lim = bound->get_int();
+        long long lowest, highest;
+        if (step > 0 && (cmp == u_lt || cmp == u_le)) {
+            lowest  = start;
+            highest = cmp == u_lt ? lim - 1 : lim;
+        } else if (step < 0 && (cmp == u_gt || cmp == u_ge)) {
+            lowest  = cmp == u_gt ? lim + 1 : lim;
+            highest = start;
+        } else {
+            continue;
+        }
+        if (highest + step > std::numeric_limits<int>::max()
+            || lowest + step < std::numeric_limits<int>::min())
+            continue;
+        m_loop_counters.push_back(
+            { counter, bodybegin, stepbegin, lowest, highest });
+    }
+}
+
+
+
+bool
+OSOProcessorBase::index_in_range(int opnum, int argnum, int length)
+{
+    const Opcode& op(inst()->ops()[opnum]);
+    Symbol* index = opargsym(op, argnum);
+    if (index->is_constant())
+        return index->get_int() >= 0 && index->get_int() < length;
+    int symbol = oparg(op, argnum);
+    for (const LoopCounter& c : m_loop_counters)
+        if (c.symbol == symbol && opnum >= c.bodybegin && opnum < c.bodyend
+            && c.lowest >= 0 && c.highest < length)
+            return true;
+    return false;
+}
+
+
+
 /// For 'R = A_const' where R and A are different, but coerceable,
 /// types, turn it into a constant assignment of the exact type.
 /// Return true if a change was made, otherwise return false.
@@ -1432,6 +1609,7 @@ RuntimeOptimizer::make_param_use_instanceval(Symbol* R, string_view why)
         R->initend(0);
     }
     // Erase R's incoming connections
+    auto lock = lock_connections();
     erase_if(inst()->connections(), ConnectionDestIs(*inst(), R));
 }
 
@@ -1814,18 +1992,25 @@ RuntimeOptimizer::peephole2(int opnum, int op2num)
         }
         if (name->typespec().is_string() && a->firstuse() >= opnum
             && a->lastuse() <= op2num && a == aa
-            && weight->typespec().is_triple()) {
+            && (weight->typespec().is_triple()
+                || (weight->typespec().is_float() && weight->is_constant()))) {
             if (is_zero(*weight)) {
                 turn_into_nop(op, "zero-weighted closure");
                 turn_into_assign(next, add_constant(0.0f),
                                  "zero-weighted closure");
                 return 1;
             }
-            // FIXME - handle weight being a float as well
             std::vector<int> newargs;
             newargs.push_back(oparg(next, 0));  // B
-            if (!is_one(*weight))
-                newargs.push_back(oparg(next, weightarg));  // weight
+            if (!is_one(*weight)) {
+                // The closure op takes a color weight, so a constant
+                // float weight becomes a constant color.
+                if (weight->typespec().is_float())
+                    newargs.push_back(
+                        add_constantc(Color3(weight->get_float())));
+                else
+                    newargs.push_back(oparg(next, weightarg));  // weight
+            }
             for (int i = 1; i < op.nargs(); ++i)
                 newargs.push_back(oparg(op, i));
             turn_into_nop(op, "combine closure+mul");
@@ -1839,6 +2024,53 @@ RuntimeOptimizer::peephole2(int opnum, int op2num)
         }
     }
 
+    // Convert this combination
+    //     mul A X w1          or:    closure A w1 name arg...
+    //     mul B A w2                 mul B A w2
+    // where w1 and w2 are constant, into
+    //     mul B X w1*w2              closure B w1*w2 name arg...
+    // That is, distribute constant weights through the closure tree
+    // rather than stacking up a mul node per weight. (Valid if A is not
+    // used elsewhere.)
+    if ((op.opname() == u_mul || op.opname() == u_closure)
+        && next.opname() == u_mul) {
+        Symbol* a  = opargsym(op, 0);
+        Symbol* aa = opargsym(next, 1);
+        Symbol* w2 = opargsym(next, 2);
+        if (w2->typespec().is_closure())  // opposite order
+            std::swap(aa, w2);
+        // Which args of the first op are the closure X and the weight w1
+        int xarg = 1, w1arg = 2;
+        if (op.opname() == u_closure) {
+            xarg  = -1;
+            w1arg = 1;
+        } else if (!opargsym(op, 1)->typespec().is_closure()) {
+            std::swap(xarg, w1arg);  // opposite order
+        }
+        Symbol* w1 = opargsym(op, w1arg);
+        if (a == aa && a->typespec().is_closure() && a->firstuse() >= opnum
+            && a->lastuse() <= op2num && (xarg < 0 || opargsym(op, xarg) != a)
+            && a->symtype() != SymTypeGlobal
+            && a->symtype() != SymTypeOutputParam && w1->is_constant()
+            && w2->is_constant() && w1->typespec().is_triple_or_float()
+            && w2->typespec().is_triple_or_float()) {
+            Color3 w = Color3(w1->coerce_vec3() * w2->coerce_vec3());
+            std::vector<int> newargs;
+            newargs.push_back(oparg(next, 0));  // B
+            if (xarg >= 0)
+                newargs.push_back(oparg(op, xarg));  // X
+            newargs.push_back(add_constantc(w));
+            for (int i = 2; xarg < 0 && i < op.nargs(); ++i)
+                newargs.push_back(oparg(op, i));
+            ustring opname = op.opname();
+            turn_into_nop(op, "fold closure weights");
+            turn_into_nop(next, "fold closure weights");
+            insert_code(opnum, opname, newargs, RecomputeRWRanges,
+                        GroupWithNext);
+            return 1;
+        }
+    }
+
     // No changes
     return 0;
 }
@@ -1855,6 +2087,7 @@ RuntimeOptimizer::mark_outgoing_connections()
     inst()->outgoing_connections(false);
     FOREACH_PARAM(auto&& s, inst())
     s.connected_down(false);
+    auto lock = lock_connections();
     for (int lay = layer() + 1; lay < group().nlayers(); ++lay) {
         for (auto&& c : group()[lay]->m_connections)
             if (c.srclayer == layer()) {
@@ -1902,6 +2135,7 @@ RuntimeOptimizer::remove_unused_params()
             }
         }
     }
+    auto lock = lock_connections();
     erase_if(inst()->connections(), param_never_used);
 
     return alterations;
@@ -1994,6 +2228,7 @@ RuntimeOptimizer::eliminate_middleman()
         // Find all the downstream connections of s, make them
         // connections to src.
         int s_index = inst()->symbolindex(&s);
+        auto lock   = lock_connections();
         for (int laynum = layer() + 1; laynum < group().nlayers(); ++laynum) {
             ShaderInstance* downinst = group()[laynum];
             for (int i = 0, e = downinst->nconnections(); i < e; ++i) {
@@ -2032,6 +2267,365 @@ RuntimeOptimizer::eliminate_middleman()
 
 
 
+namespace {
+
+// What fuse_texture_calls needs to know of a texture op's args.
+struct TextureCall {
+    int firstopt     = 4;   // first optional arg
+    int firstchannel = 0;   // first channel looked up
+    int alpha        = -1;  // arg holding the "alpha" output, if any
+};
+
+}  // namespace
+
+
+
+// Parse the optional args of texture op `op`, returning false if the op
+// can't be fused: a non-constant option name or first channel, or an
+// "errormessage" output.
+static bool
+texture_call(RuntimeOptimizer& rop, const Opcode& op, TextureCall& call)
+{
+    call = TextureCall();
+    if (op.nargs() > 4 && rop.opargsym(op, 4)->typespec().is_float())
+        call.firstopt = 8;
+    for (int a = call.firstopt; a + 1 < op.nargs(); a += 2) {
+        const Symbol& Name(*rop.opargsym(op, a));
+        const Symbol& Value(*rop.opargsym(op, a + 1));
+        if (!Name.is_constant())
+            return false;
+        ustring name = Name.get_string();
+        if (name == Strings::firstchannel) {
+            if (!Value.is_constant() || !Value.typespec().is_int())
+                return false;
+            call.firstchannel = Value.get_int();
+        } else if (name == Strings::alpha) {
+            call.alpha = a + 1;
+        } else if (name == Strings::errormessage) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+
+// Are A and B the same symbol, or constants of equal value?
+static bool
+same_value(const Symbol& A, const Symbol& B)
+{
+    return &A == &B
+           || (A.is_constant() && B.is_constant()
+               && equivalent(A.typespec(), B.typespec())
+               && !memcmp(A.data(), B.data(), A.size()));
+}
+
+
+
+// Do texture ops A and B look up the same file at the same coordinates
+// with the same options (in the same order), firstchannel and alpha
+// aside?
+static bool
+same_texture_lookup(RuntimeOptimizer& rop, const Opcode& A,
+                    const TextureCall& a, const Opcode& B,
+                    const TextureCall& b)
+{
+    if (a.firstopt != b.firstopt)
+        return false;
+    for (int i = 1; i < a.firstopt; ++i)
+        if (!same_value(*rop.opargsym(A, i), *rop.opargsym(B, i)))
+            return false;
+    auto options = [&](const Opcode& op, int firstopt) {
+        std::vector<std::pair<ustring, const Symbol*>> opts;
+        for (int i = firstopt; i + 1 < op.nargs(); i += 2) {
+            ustring name = rop.opargsym(op, i)->get_string();
+            if (!name.empty() && name != Strings::firstchannel
+                && name != Strings::alpha)
+                opts.emplace_back(name, rop.opargsym(op, i + 1));
+        }
+        return opts;
+    };
+    auto aopts = options(A, a.firstopt);
+    auto bopts = options(B, b.firstopt);
+    if (aopts.size() != bopts.size())
+        return false;
+    for (size_t i = 0; i < aopts.size(); ++i)
+        if (aopts[i].first != bopts[i].first
+            || !same_value(*aopts[i].second, *bopts[i].second))
+            return false;
+    return true;
+}
+
+
+
+int
+RuntimeOptimizer::fuse_texture_calls()
+{
+    int changed = 0;
+    OpcodeVec& code(inst()->ops());
+    for (int opnum = 0, e = (int)code.size(); opnum < e; ++opnum) {
+        TextureCall a;
+        if (code[opnum].opname() != u_texture
+            || !texture_call(*this, code[opnum], a)
+            || !opargsym(code[opnum], 1)->is_constant())
+            continue;
+        // How many channels the file has, once we need to know
+        int filechannels = -1;
+        for (int op2num = next_block_instruction(opnum); op2num;
+             op2num = next_block_instruction(op2num)) {
+            Opcode& A(code[opnum]);
+            Opcode& B(code[op2num]);
+            TextureCall b;
+            if (B.opname() == u_texture && texture_call(*this, B, b)
+                && b.alpha < 0 && oparg(A, 0) != oparg(B, 0)
+                && same_texture_lookup(*this, A, a, B, b)) {
+                // Channel k of A's lookup is component k of its result
+                // or, just past it, its alpha.
+                int na = opargsym(A, 0)->typespec().is_triple() ? 3 : 1;
+                int nb = opargsym(B, 0)->typespec().is_triple() ? 3 : 1;
+                int k  = b.firstchannel - a.firstchannel;
+                bool inresult = k >= 0 && k + nb <= na;
+                bool isalpha  = k == na && nb == 1
+                               && (a.alpha >= 0 || A.nargs() + 2 <= 32);
+                if ((inresult || isalpha) && filechannels < 0) {
+                    // A channel the file doesn't have may read as the
+                    // fill value or, for gray files, as a copy of the
+                    // first, and not the same way for both calls. So
+                    // only fuse the file's own channels.
+                    ustringhash em;
+                    if (!renderer()->get_texture_info(
+                            opargsym(A, 1)->get_string(), nullptr,
+                            shadingcontext()->texture_thread_info(),
+                            shaderglobals(), 0, u_channels, TypeInt,
+                            &filechannels, &em))
+                        filechannels = 0;
+                }
+                if (b.firstchannel + nb > filechannels)
+                    inresult = isalpha = false;
+                if (inresult) {
+                    if (nb == na)
+                        turn_into_assign(B, oparg(A, 0),
+                                         "fused with earlier texture call");
+                    else
+                        turn_into_new_op(B, u_compref, oparg(B, 0),
+                                         oparg(A, 0), add_constant(k),
+                                         "fused with earlier texture call");
+                    ++changed;
+                } else if (isalpha) {
+                    if (a.alpha < 0) {
+                        // Give A an alpha output, by moving its args to
+                        // the end with "alpha" and a new temp after them.
+                        int alphaname     = add_constant(Strings::alpha);
+                        int alphatemp     = add_temp(TypeFloat);
+                        std::vector<int>& args(inst()->args());
+                        int firstarg = (int)args.size(), nargs = A.nargs();
+                        for (int i = 0; i < nargs; ++i)
+                            args.push_back(args[A.firstarg() + i]);
+                        args.push_back(alphaname);
+                        args.push_back(alphatemp);
+                        A.set_args(firstarg, nargs + 2);
+                        A.argreadonly(nargs);
+                        A.argwriteonly(nargs + 1);
+                        inst()->symbol(alphaname)->mark_rw(opnum, true, false);
+                        inst()->symbol(alphatemp)->mark_rw(opnum, false, true);
+                        a.alpha = nargs + 1;
+                    }
+                    turn_into_assign(B, oparg(A, a.alpha),
+                                     "fused with earlier texture call");
+                    ++changed;
+                }
+            }
+            // Stop at the first op that writes anything A reads or writes.
+            bool clobbers = false;
+            for (int i = 0; i < B.nargs() && !clobbers; ++i)
+                if (B.argwrite(i))
+                    for (int j = 0; j < A.nargs() && !clobbers; ++j)
+                        clobbers = oparg(B, i) == oparg(A, j);
+            if (clobbers)
+                break;
+        }
+    }
+    return changed;
+}
+
+
+
+int
+RuntimeOptimizer::hoist_space_transforms()
+{
+    int changed = 0;
+    OpcodeVec& code(inst()->ops());
+    ustring syn = shadingsys().commonspace_synonym();
+    // The spaces of a transform by constant named spaces that the
+    // renderer doesn't transform nonlinearly, or false.
+    auto named_spaces = [&](const Opcode& op, ustring& from, ustring& to) {
+        if (op.opname() != u_transform && op.opname() != u_transformv
+            && op.opname() != u_transformn)
+            return false;
+        int nargs    = op.nargs();
+        Symbol* From = nargs == 3 ? nullptr : opargsym(op, 1);
+        Symbol* To   = opargsym(op, nargs == 3 ? 1 : 2);
+        if (!To->typespec().is_string() || !To->is_constant()
+            || (From && !From->is_constant()))
+            return false;
+        from = From ? From->get_string() : Strings::common;
+        to   = To->get_string();
+        if (from == syn)
+            from = Strings::common;
+        if (to == syn)
+            to = Strings::common;
+        TypeDesc::VECSEMANTICS vectype
+            = op.opname() == u_transformv   ? TypeDesc::VECTOR
+              : op.opname() == u_transformn ? TypeDesc::NORMAL
+                                            : TypeDesc::POINT;
+        return from != to
+               && !renderer()->transform_points(nullptr, from, to, 0.0f,
+                                                nullptr, nullptr, 0, vectype);
+    };
+    for (bool again = true; again;) {
+        again = false;
+        find_conditionals();
+        int begin = inst()->maincodebegin(), end = inst()->maincodeend();
+        for (int opnum = begin; opnum < end && !again; ++opnum) {
+            ustring from, to;
+            if (!named_spaces(code[opnum], from, to)
+                || !op_is_unconditionally_executed(opnum))
+                continue;
+            // Structured control flow means that this op runs before any
+            // later one, so its matrix serves all later ones too.
+            std::vector<int> uses { opnum };
+            for (int op2num = opnum + 1; op2num < end; ++op2num) {
+                ustring from2, to2;
+                if (named_spaces(code[op2num], from2, to2) && from2 == from
+                    && to2 == to)
+                    uses.push_back(op2num);
+            }
+            if (uses.size() < 2)
+                continue;
+            int M = add_temp(TypeMatrix);
+            insert_code(opnum, u_matrix, GroupWithNext, M,
+                        add_constant(from), add_constant(to));
+            for (int u : uses) {
+                Opcode& op(code[u + 1]);
+                int nargs = op.nargs();
+                turn_into_new_op(op, op.opname(), oparg(op, 0), M,
+                                 oparg(op, nargs - 1),
+                                 "transform by hoisted matrix");
+                ++changed;
+            }
+            again = true;
+        }
+    }
+    return changed;
+}
+
+
+
+bool
+RuntimeOptimizer::noise_arg_key(const Symbol& sym,
+                                const std::set<ustring>& written,
+                                std::string& key)
+{
+    key += fmtformat("{}{}:", sym.typespec(), sym.has_derivs() ? "d" : "");
+    if (sym.is_constant()) {
+        const unsigned char* data = (const unsigned char*)sym.data();
+        for (size_t i = 0, e = sym.size(); i < e; ++i)
+            key += fmtformat("{:02x}", data[i]);
+        key += ' ';
+        return true;
+    }
+    if (sym.symtype() == SymTypeGlobal) {
+        if (written.count(sym.name()))
+            return false;
+        key += fmtformat("global {} ", sym.name());
+        return true;
+    }
+    if (sym.symtype() != SymTypeParam || !sym.connected() || sym.everwritten()
+        || sym.has_init_ops() || sym.interpolated() || sym.interactive())
+        return false;
+    int index = inst()->symbolindex(&sym);
+    for (auto&& c : inst()->connections()) {
+        if (c.dst.param == index) {
+            if (!c.is_complete() || !equivalent(c.src.type, c.dst.type))
+                return false;
+            key += fmtformat("layer{} sym{} ", c.srclayer, c.src.param);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+
+void
+RuntimeOptimizer::find_shared_noise()
+{
+    group().m_noise_memos.clear();
+    group().m_noise_memo_types.clear();
+    group().m_noise_memo_derivs.clear();
+    if (!shadingsys().m_opt_noise_memo || group().nlayers() < 2)
+        return;
+
+    // Globals written by any layer may differ from one call to the next
+    std::set<ustring> written;
+    for (int layer = 0, e = group().nlayers(); layer < e; ++layer) {
+        if (group()[layer]->unused())
+            continue;
+        for (auto&& s : group()[layer]->symbols())
+            if (s.symtype() == SymTypeGlobal && s.everwritten())
+                written.insert(s.name());
+    }
+
+    struct Call {
+        int layer, opnum;
+    };
+    std::map<std::string, std::vector<Call>> calls;
+    for (int layer = 0, e = group().nlayers(); layer < e; ++layer) {
+        set_inst(layer);
+        if (inst()->unused())
+            continue;
+        for (int opnum = 0, nops = (int)inst()->ops().size(); opnum < nops;
+             ++opnum) {
+            Opcode& op(inst()->ops()[opnum]);
+            if (op.opname() != Strings::noise && op.opname() != Strings::snoise
+                && op.opname() != Strings::pnoise
+                && op.opname() != Strings::psnoise)
+                continue;
+            const Symbol* R = opargsym(op, 0);
+            std::string key = fmtformat("{} {}{} ", op.opname(), R->typespec(),
+                                        R->has_derivs() ? "d" : "");
+            bool ok = true;
+            for (int a = 1, nargs = op.nargs(); a < nargs && ok; ++a)
+                ok = noise_arg_key(*opargsym(op, a), written, key);
+            if (ok)
+                calls[key].push_back({ layer, opnum });
+        }
+    }
+
+    // Only calls made by more than one layer get a slot; LLVM already
+    // merges the repeats within a layer.
+    for (auto&& k : calls) {
+        const std::vector<Call>& c(k.second);
+        bool multilayer = false;
+        for (auto&& call : c)
+            multilayer |= (call.layer != c[0].layer);
+        if (!multilayer)
+            continue;
+        int slot        = (int)group().m_noise_memo_types.size();
+        const Symbol* R = group()[c[0].layer]->argsymbol(
+            group()[c[0].layer]->op(c[0].opnum).firstarg());
+        group().m_noise_memo_types.push_back(R->typespec());
+        group().m_noise_memo_derivs.push_back(R->has_derivs());
+        for (auto&& call : c)
+            group().m_noise_memos.push_back({ call.layer, call.opnum, slot });
+        shadingsys().m_stat_noise_calls_shared += (int)c.size();
+        if (debug())
+            debug_optfmt("Noise calls sharing slot {}: {}\n", slot, k.first);
+    }
+}
+
+
+
 int
 RuntimeOptimizer::optimize_assignment(Opcode& op, int opnum)
 {
@@ -2147,7 +2741,13 @@ RuntimeOptimizer::optimize_ops(int beginop, int endop,
     // Provide a place where, if we recurse, we can save prior block
     // aliases. Register them on the block_aliases_stack so that calls to
     // block_unalias() will unalias from there, too.
-    FastIntMap saved_block_aliases;
+    // The maps for this recursion depth come from m_block_scratch, so
+    // their storage is reused rather than allocated anew for every block.
+    if (m_block_scratch_depth == m_block_scratch.size())
+        m_block_scratch.emplace_back(new BlockScratch);
+    BlockScratch& scratch = *m_block_scratch[m_block_scratch_depth++];
+    FastIntMap& saved_block_aliases = scratch.saved_aliases;
+    saved_block_aliases.clear();
     m_block_aliases_stack.push_back(&saved_block_aliases);
 
     int lastblock      = -1;
@@ -2279,7 +2879,8 @@ RuntimeOptimizer::optimize_ops(int beginop, int endop,
             && shadingsys().m_opt_seed_bblock_aliases) {
             // Find all symbols written anywhere in the instruction range
             // of the bodies.
-            FastIntSet symwrites;
+            FastIntSet& symwrites = scratch.symwrites;
+            symwrites.clear();
             catalog_symbol_writes(opnum + 1, op->farthest_jump(), symwrites);
             // Save the aliases from the basic block we are exiting.
             // If & function call: save all prior aliases.
@@ -2312,7 +2913,7 @@ RuntimeOptimizer::optimize_ops(int beginop, int endop,
             // function body. For loops, recall that we already excluded
             // the written syms from the saved_block_aliases.
             if (opname == u_if || opname == u_functioncall) {
-                FastIntMap restored_aliases;
+                FastIntMap& restored_aliases = scratch.restored_aliases;
                 restored_aliases.swap(saved_block_aliases);
                 // catalog again, in case optimizations in those blocks
                 // caused writes that weren't apparent before.
@@ -2327,85 +2928,865 @@ RuntimeOptimizer::optimize_ops(int beginop, int endop,
         }
     }
     m_block_aliases_stack.pop_back();  // Done with saved_block_aliases
+    --m_block_scratch_depth;
     return changed;
 }
 
 
 
-void
-RuntimeOptimizer::optimize_instance()
+int
+RuntimeOptimizer::optimize_loops()
 {
-    // If "opt_layername" attribute is set, only optimize the named layer
-    if (!shadingsys().m_opt_layername.empty()
-        && shadingsys().m_opt_layername != inst()->layername())
-        return;
-
-    // Make a list of the indices of all constants.
-    for (int i = 0, e = (int)inst()->symbols().size(); i < e; ++i)
-        if (inst()->symbol(i)->symtype() == SymTypeConst)
-            m_all_consts.push_back(i);
-
-    // Turn all parameters with instance or default values, and which
-    // cannot be overridden by geometry values, into constants or
-    // aliases for globals.  Also turn connections from earlier layers'
-    // outputs that are known to be constants or globals into constants
-    // or global aliases without any connection.
-    if (optimize() >= 2 && m_opt_simplify_param) {
-        simplify_params();
-    }
-
-#ifndef NDEBUG
-    // Confirm that the symbols between [firstparam,lastparam] are all
-    // input or output params.
-    FOREACH_PARAM(const Symbol& s, inst())
-    {
-        OSL_DASSERT(s.symtype() == SymTypeParam
-                    || s.symtype() == SymTypeOutputParam);
+    if (m_opt_loop_unroll <= 0 && !m_opt_licm)
+        return 0;
+    int changed = 0;
+    // Walk backwards, so that inner loops are handled before the loops
+    // containing them, and rewriting a loop never moves the ones before it.
+    for (int opnum = inst()->m_maincodeend - 1;
+         opnum >= inst()->m_maincodebegin; --opnum) {
+        if (inst()->ops()[opnum].opname() != u_for)
+            continue;
+        if (m_opt_loop_unroll > 0 && unroll_loop(opnum))
+            ++changed;
+        else if (m_opt_licm)
+            changed += hoist_loop_invariants(opnum);
     }
-#endif
+    return changed;
+}
 
-    // Recompute which of our params have downstream connections.
-    mark_outgoing_connections();
 
-    // Try to fold constants.  We take several passes, until we get to
-    // the point that not much is improving.  It rarely goes beyond 3-4
-    // passes, but we have a hard cutoff just to be sure we don't
-    // ever get into an infinite loop from an unforeseen cycle where we
-    // end up inadvertently transforming A => B => A => etc.
-    int reallydone = 0;  // Force a few passes after we think we're done
-    int npasses    = shadingsys().opt_passes();
-    for (m_pass = 0; m_pass < npasses; ++m_pass) {
-        // Once we've made one pass (and therefore called
-        // mark_outgoing_connections), we may notice that the layer is
-        // unused, and therefore can stop doing work to optimize it.
-        if (m_pass != 0 && inst()->unused())
-            break;
 
-        if (m_stop_optimizing)
-            break;
+// Evaluate the comparison op `opname` on a and b, as OSL would.
+static bool
+loop_compare(ustring opname, long long a, long long b)
+{
+    if (opname == u_lt)
+        return a < b;
+    if (opname == u_le)
+        return a <= b;
+    if (opname == u_gt)
+        return a > b;
+    if (opname == u_ge)
+        return a >= b;
+    return a != b;  // neq
+}
 
-        if (debug() > 1)
-            debug_optfmt("layer {} \"{}\", pass {}:\n", layer(),
-                         inst()->layername(), m_pass);
 
-        // Track basic blocks and conditional states
-        find_conditionals();
-        find_basic_blocks();
 
-        // Clear local messages for this instance
-        m_local_unknown_message_sent = false;
-        m_local_messages_sent.clear();
+bool
+RuntimeOptimizer::unroll_loop(int opnum)
+{
+    OpcodeVec& code(inst()->ops());
+    std::vector<int>& args(inst()->args());
+    const Opcode& op(code[opnum]);
+    int initbegin = opnum + 1;
+    int condbegin = op.jump(0);
+    int bodybegin = op.jump(1);
+    int stepbegin = op.jump(2);
+    int loopend   = op.jump(3);
+
+    // The condition must be a single comparison of an int counter with a
+    // constant, and the step a single constant increment of the counter.
+    if (bodybegin - condbegin != 1 || loopend - stepbegin != 1)
+        return false;
+    const Opcode& condop(code[condbegin]);
+    const Opcode& stepop(code[stepbegin]);
+    ustring cmp = condop.opname();
+    if ((cmp != u_lt && cmp != u_le && cmp != u_gt && cmp != u_ge
+         && cmp != u_neq)
+        || condop.nargs() != 3 || oparg(condop, 0) != oparg(op, 0))
+        return false;
+    Symbol* condsym = opargsym(op, 0);
+    if (condsym->symtype() != SymTypeTemp)
+        return false;
+    Symbol* A        = opargsym(condop, 1);
+    Symbol* B        = opargsym(condop, 2);
+    bool counter_is_a = !A->is_constant();
+    int counter       = oparg(condop, counter_is_a ? 1 : 2);
+    Symbol* C         = inst()->symbol(counter);
+    Symbol* bound     = counter_is_a ? B : A;
+    if (!C->typespec().is_int() || !bound->is_constant()
+        || !bound->typespec().is_int()
+        || (C->symtype() != SymTypeLocal && C->symtype() != SymTypeTemp))
+        return false;
+    if ((stepop.opname() != u_add && stepop.opname() != u_sub)
+        || stepop.nargs() != 3 || oparg(stepop, 0) != counter)
+        return false;
+    int stepconst;
+    if (oparg(stepop, 1) == counter && opargsym(stepop, 2)->is_constant())
+        stepconst = 2;
+    else if (stepop.opname() == u_add && oparg(stepop, 2) == counter
+             && opargsym(stepop, 1)->is_constant())
+        stepconst = 1;
+    else
+        return false;
+    if (!opargsym(stepop, stepconst)->typespec().is_int())
+        return false;
+    long long step = opargsym(stepop, stepconst)->get_int();
+    if (stepop.opname() == u_sub)
+        step = -step;
+
+    // The init code must set the counter to a constant exactly once, with
+    // no control flow of its own.
+    int counter_inits = 0;
+    long long value   = 0;
+    for (int i = initbegin; i < condbegin; ++i) {
+        const Opcode& iop(code[i]);
+        if (iop.jump(0) >= 0)
+            return false;
+        for (int a = 0, na = iop.nargs(); a < na; ++a) {
+            if (!iop.argwrite(a) || oparg(iop, a) != counter)
+                continue;
+            if (iop.opname() != u_assign || a != 0
+                || !opargsym(iop, 1)->is_constant()
+                || !opargsym(iop, 1)->typespec().is_int())
+                return false;
+            value = opargsym(iop, 1)->get_int();
+            ++counter_inits;
+        }
+    }
+    if (counter_inits != 1)
+        return false;
 
-        // Figure out which params are just aliases for globals (only
-        // necessary to do once, on the first pass).
-        if (m_pass == 0 && optimize() >= 2)
-            find_params_holding_globals();
+    // The body may not change the counter or the condition, nor leave the
+    // loop early, and its jumps must stay within the body and step.
+    for (int i = bodybegin; i < stepbegin; ++i) {
+        const Opcode& bop(code[i]);
+        if (bop.opname() == u_break || bop.opname() == u_continue)
+            return false;
+        for (int a = 0, na = bop.nargs(); a < na; ++a) {
+            int s = oparg(bop, a);
+            if ((s == counter && bop.argwrite(a)) || s == oparg(op, 0))
+                return false;
+        }
+        for (int j = 0; j < (int)Opcode::max_jumps && bop.jump(j) >= 0; ++j)
+            if (bop.jump(j) < bodybegin || bop.jump(j) > loopend)
+                return false;
+    }
 
-        // Here is the meat of the optimization, where we pass over the
-        // code for this instance and make various transformations.
-        int changed = optimize_ops(0, (int)inst()->ops().size());
+    // Run the counter to find the trip count, giving up once the copies
+    // would be too big.
+    int seglen    = loopend - bodybegin;
+    int maxtrips  = m_opt_loop_unroll / std::max(seglen, 1);
+    long long lim = bound->get_int();
+    int trips     = 0;
+    while (counter_is_a ? loop_compare(cmp, value, lim)
+                        : loop_compare(cmp, lim, value)) {
+        if (++trips > maxtrips)
+            return false;
+        value += step;
+        if (value < std::numeric_limits<int>::min()
+            || value > std::numeric_limits<int>::max())
+            return false;
+    }
 
-        // Now that we've rewritten the code, we need to re-track the
+    // No jump from outside may land inside the loop.
+    for (int i = 0, e = (int)code.size(); i < e; ++i) {
+        if (i >= opnum && i < loopend)
+            continue;
+        for (int j = 0; j < (int)Opcode::max_jumps && code[i].jump(j) >= 0;
+             ++j)
+            if (code[i].jump(j) > opnum && code[i].jump(j) < loopend)
+                return false;
+    }
+
+    if (debug() > 1)
+        debug_optfmt("  unroll loop at op {} of {}, {} iterations (@ {}:{})\n",
+                     opnum, inst()->layername(), trips, op.sourcefile(),
+                     op.sourceline());
+
+    // Lay out the init code and then one copy of body+step per trip. Each
+    // copy after the first gets its own args, so that later rewriting of
+    // one copy's args leaves the others alone.
+    int initlen = condbegin - initbegin;
+    int delta   = initlen + trips * seglen - (loopend - opnum);
+    OpcodeVec newcode;
+    newcode.reserve(code.size() + std::max(delta, 0));
+    newcode.insert(newcode.end(), code.begin(), code.begin() + opnum);
+    newcode.insert(newcode.end(), code.begin() + initbegin,
+                   code.begin() + condbegin);
+    for (int k = 0; k < trips; ++k) {
+        int base = (int)newcode.size();
+        for (int i = bodybegin; i < loopend; ++i) {
+            Opcode c(code[i]);
+            for (int j = 0; j < (int)Opcode::max_jumps && c.jump(j) >= 0; ++j)
+                c.jump(j) = base + c.jump(j) - bodybegin;
+            if (k > 0) {
+                int firstarg = (int)args.size();
+                for (int a = 0, na = c.nargs(); a < na; ++a) {
+                    int s = args[c.firstarg() + a];
+                    args.push_back(s);
+                }
+                c.set_args(firstarg, c.nargs());
+            }
+            newcode.push_back(c);
+        }
+    }
+    newcode.insert(newcode.end(), code.begin() + loopend, code.end());
+    // Jumps around the loop now land delta ops away.
+    for (int i = 0, e = (int)newcode.size(); i < e; ++i) {
+        if (i >= opnum && i < opnum + initlen + trips * seglen)
+            continue;
+        Opcode& c(newcode[i]);
+        for (int j = 0; j < (int)Opcode::max_jumps && c.jump(j) >= 0; ++j)
+            if (c.jump(j) >= loopend)
+                c.jump(j) += delta;
+    }
+    code.swap(newcode);
+    inst()->m_maincodeend += delta;
+    return true;
+}
+
+
+
+int
+RuntimeOptimizer::hoist_loop_invariants(int opnum)
+{
+    OpcodeVec& code(inst()->ops());
+    const Opcode& op(code[opnum]);
+    int initbegin = opnum + 1;
+    int condbegin = op.jump(0);
+    int bodybegin = op.jump(1);
+    int stepbegin = op.jump(2);
+    int loopend   = op.jump(3);
+
+    // Keep it simple: no control flow in the init code, and no early
+    // exits from the loop.
+    for (int i = initbegin; i < condbegin; ++i)
+        if (code[i].jump(0) >= 0)
+            return 0;
+    for (int i = condbegin; i < loopend; ++i)
+        if (code[i].opname() == u_break || code[i].opname() == u_continue)
+            return 0;
+
+    // How many times is each symbol written in the loop, where is each
+    // first read in the loop, and which are read outside of it?
+    FastIntMap loopwrites, firstread;
+    FastIntSet readoutside;
+    for (int i = 0, e = (int)code.size(); i < e; ++i) {
+        const Opcode& c(code[i]);
+        bool inloop = (i >= condbegin && i < loopend);
+        for (int a = 0, na = c.nargs(); a < na; ++a) {
+            int s = oparg(c, a);
+            if (c.argread(a)) {
+                if (!inloop)
+                    readoutside.insert(s);
+                else if (firstread.find(s) == firstread.end())
+                    firstread[s] = i;
+            }
+            if (inloop && c.argwrite(a))
+                ++loopwrites[s];
+        }
+    }
+
+    // Find the ops, run on every iteration, whose result only depends on
+    // symbols the loop doesn't change. Once an op is hoisted, its result
+    // doesn't change in the loop either.
+    std::vector<int> hoisted;
+    for (int i = bodybegin; i < stepbegin; ++i) {
+        const Opcode& c(code[i]);
+        if (c.jump(0) >= 0) {
+            i = c.farthest_jump() - 1;  // skip nested, conditional code
+            continue;
+        }
+        const OpDescriptor* opd = shadingsys().op_descriptor(c.opname());
+        if (!opd || !opd->simple_assign
+            || (opd->flags & (OpDescriptor::SideEffects | OpDescriptor::Tex))
+            || c.nargs() < 1 || !c.argwrite(0) || c.argread(0))
+            continue;
+        int r     = oparg(c, 0);
+        Symbol* R = inst()->symbol(r);
+        if ((R->symtype() != SymTypeTemp && R->symtype() != SymTypeLocal)
+            || loopwrites[r] != 1 || readoutside.count(r))
+            continue;
+        auto fr = firstread.find(r);
+        if (fr != firstread.end() && fr->second <= i)
+            continue;  // read earlier in the loop, before this op updates it
+        bool invariant = true;
+        for (int a = 1, na = c.nargs(); a < na && invariant; ++a) {
+            int s     = oparg(c, a);
+            Symbol* S = inst()->symbol(s);
+            if (c.argwrite(a) || loopwrites[s])
+                invariant = false;
+            // Params that may be computed lazily, or are retrieved as
+            // userdata, must still be read after their useparam.
+            else if ((S->symtype() == SymTypeParam
+                      || S->symtype() == SymTypeOutputParam)
+                     && (S->connected() || S->has_init_ops()
+                         || S->interpolated()))
+                invariant = false;
+        }
+        if (!invariant)
+            continue;
+        hoisted.push_back(i);
+        loopwrites[r] = 0;
+    }
+    if (hoisted.empty())
+        return 0;
+
+    if (debug() > 1)
+        debug_optfmt("  hoist {} loop-invariant ops out of the loop at op {} "
+                     "of {} (@ {}:{})\n",
+                     hoisted.size(), opnum, inst()->layername(),
+                     op.sourcefile(), op.sourceline());
+
+    // The hoisted ops go right before the condition. Everything from the
+    // condition on moves down by the number of hoisted ops that follow it.
+    auto moved = [&](int target) {
+        if (target < condbegin || target >= loopend)
+            return target;
+        return target
+               + int(hoisted.end()
+                     - std::lower_bound(hoisted.begin(), hoisted.end(),
+                                        target));
+    };
+    OpcodeVec region;
+    region.reserve(loopend - opnum);
+    region.insert(region.end(), code.begin() + opnum,
+                  code.begin() + condbegin);
+    for (int h : hoisted)
+        region.push_back(code[h]);
+    for (int i = condbegin; i < loopend; ++i)
+        if (!std::binary_search(hoisted.begin(), hoisted.end(), i))
+            region.push_back(code[i]);
+    for (auto&& c : region)
+        for (int j = 0; j < (int)Opcode::max_jumps && c.jump(j) >= 0; ++j)
+            c.jump(j) = moved(c.jump(j));
+    std::copy(region.begin(), region.end(), code.begin() + opnum);
+    return (int)hoisted.size();
+}
+
+
+
+// Add the names of the messages that inst may set to `names`, or set
+// `unknown` if it may set one whose name isn't known.
+static void
+find_messages_sent(ShaderInstance* inst, std::vector<ustring>& names,
+                   bool& unknown)
+{
+    for (auto& op : inst->ops()) {
+        if (op.opname() == u_setmessage) {
+            Symbol& Name(*inst->argsymbol(op.firstarg() + 0));
+            if (Name.is_constant())
+                names.push_back(Name.get_string());
+            else
+                unknown = true;
+        }
+    }
+}
+
+
+
+namespace {
+
+// A lattice value for propagate_constants(): not yet known to be written
+// (Undefined), always the same constant, or possibly varying.
+struct SCCPValue {
+    enum State : uint8_t { Undefined, Constant, Varying };
+    State state = Undefined;
+    TypeDesc type;            // int, float, string, or a float triple
+    int i = 0;                // int value
+    Vec3 f { 0.0f, 0.0f, 0.0f };  // float (in all three) or triple value
+    ustring s;                // string value
+
+    static SCCPValue varying()
+    {
+        SCCPValue v;
+        v.state = Varying;
+        return v;
+    }
+    // Bitwise equality, so that 0 and -0 differ.
+    bool operator==(const SCCPValue& b) const
+    {
+        return state == b.state && type == b.type && i == b.i
+               && !memcmp(&f, &b.f, sizeof(f)) && s == b.s;
+    }
+    bool is_int() const { return type == TypeInt; }
+    bool is_float() const { return type == TypeFloat; }
+    bool is_triple() const { return type.aggregate == TypeDesc::VEC3; }
+    bool is_string() const { return type == TypeString; }
+    bool is_numeric() const { return is_int() || is_float() || is_triple(); }
+    // The value as a triple, promoting ints and floats.
+    Vec3 vec3() const { return is_int() ? Vec3(float(i)) : f; }
+};
+
+
+
+// Is a symbol of this type something propagate_constants() tracks?
+inline bool
+sccp_type(const TypeSpec& t)
+{
+    return !t.is_closure_based() && !t.is_structure_based() && !t.is_array()
+           && (t.is_int() || t.is_float() || t.is_triple() || t.is_string());
+}
+
+
+
+// The value of a constant symbol.
+SCCPValue
+sccp_constant(const Symbol& sym)
+{
+    SCCPValue v;
+    v.state = SCCPValue::Constant;
+    v.type  = sym.typespec().simpletype();
+    if (v.is_int())
+        v.i = sym.get_int();
+    else if (v.is_float())
+        v.f = Vec3(sym.get_float());
+    else if (v.is_triple())
+        v.f = sym.get_vec3();
+    else
+        v.s = sym.get_string();
+    return v;
+}
+
+
+
+// Fold op `opname`, giving a result of type rtype, from constant args a
+// and b (b is unused by the unary ops). Anything not known to give
+// exactly what the shader would compute comes out Varying.
+SCCPValue
+sccp_fold(ustring opname, TypeDesc rtype, const SCCPValue& a,
+          const SCCPValue& b)
+{
+    SCCPValue r;
+    r.state = SCCPValue::Constant;
+    r.type  = rtype;
+    bool rint = (rtype == TypeInt), rfloat = (rtype == TypeFloat);
+    bool rtriple = (rtype.aggregate == TypeDesc::VEC3
+                    && rtype.basetype == TypeDesc::FLOAT);
+    if (opname == u_assign) {
+        if (rint && a.is_int())
+            r.i = a.i;
+        else if ((rfloat && (a.is_int() || a.is_float()))
+                 || (rtriple && a.is_numeric()))
+            r.f = a.vec3();
+        else if (rtype == TypeString && a.is_string())
+            r.s = a.s;
+        else
+            return SCCPValue::varying();
+    } else if (opname == u_neg) {
+        if (rint && a.is_int() && a.i != std::numeric_limits<int>::min())
+            r.i = -a.i;
+        else if ((rfloat && a.is_float()) || (rtriple && a.is_triple()))
+            r.f = -a.f;
+        else
+            return SCCPValue::varying();
+    } else if (opname == u_add || opname == u_sub || opname == u_mul
+               || opname == u_div) {
+        if (rint && a.is_int() && b.is_int()) {
+            int64_t x = a.i, y = b.i, z;
+            if (opname == u_add)
+                z = x + y;
+            else if (opname == u_sub)
+                z = x - y;
+            else if (opname == u_mul)
+                z = x * y;
+            else if (y != 0)
+                z = x / y;
+            else
+                return SCCPValue::varying();  // leave it to constfold_div
+            if (z < std::numeric_limits<int>::min()
+                || z > std::numeric_limits<int>::max())
+                return SCCPValue::varying();
+            r.i = int(z);
+        } else if ((rfloat && !a.is_triple() && !b.is_triple() && a.is_numeric()
+                    && b.is_numeric())
+                   || (rtriple && a.is_numeric() && b.is_numeric())) {
+            Vec3 x = a.vec3(), y = b.vec3();
+            if (opname == u_add)
+                r.f = x + y;
+            else if (opname == u_sub)
+                r.f = x - y;
+            else if (opname == u_mul)
+                r.f = x * y;
+            else if (y.x != 0.0f && y.y != 0.0f && y.z != 0.0f)
+                r.f = x / y;
+            else
+                return SCCPValue::varying();
+        } else {
+            return SCCPValue::varying();
+        }
+    } else if (opname == u_eq || opname == u_neq) {
+        if (!rint)
+            return SCCPValue::varying();
+        bool equal;
+        if (a.is_string() && b.is_string())
+            equal = (a.s == b.s);
+        else if (a.is_int() && b.is_int())
+            equal = (a.i == b.i);
+        else if (a.is_numeric() && b.is_numeric())
+            equal = (a.vec3() == b.vec3());
+        else
+            return SCCPValue::varying();
+        r.i = (equal == (opname == u_eq));
+    } else if (opname == u_lt || opname == u_le || opname == u_gt
+               || opname == u_ge) {
+        if (!rint || a.is_triple() || b.is_triple() || !a.is_numeric()
+            || !b.is_numeric())
+            return SCCPValue::varying();
+        bool ints = a.is_int() && b.is_int();
+        float x = a.vec3().x, y = b.vec3().x;
+        if (opname == u_lt)
+            r.i = ints ? a.i < b.i : x < y;
+        else if (opname == u_le)
+            r.i = ints ? a.i <= b.i : x <= y;
+        else if (opname == u_gt)
+            r.i = ints ? a.i > b.i : x > y;
+        else
+            r.i = ints ? a.i >= b.i : x >= y;
+    } else if (opname == u_and || opname == u_or) {
+        if (!rint || !a.is_int() || !b.is_int())
+            return SCCPValue::varying();
+        r.i = (opname == u_and) ? (a.i && b.i) : (a.i || b.i);
+    } else if (opname == u_compref) {
+        if (!rfloat || !a.is_triple() || !b.is_int() || b.i < 0 || b.i > 2)
+            return SCCPValue::varying();
+        r.f = Vec3(a.f[b.i]);
+    } else {
+        return SCCPValue::varying();
+    }
+    return r;
+}
+
+}  // namespace
+
+
+
+int
+RuntimeOptimizer::propagate_constants()
+{
+    int nops  = (int)inst()->ops().size();
+    int nsyms = (int)inst()->symbols().size();
+
+    // Only locals and temps are tracked; everything else is what it is
+    // (constants) or may be anything (params, globals).
+    std::vector<SCCPValue> value(nsyms);
+    std::vector<bool> tracked(nsyms, false);
+    for (int s = 0; s < nsyms; ++s) {
+        const Symbol& sym(*inst()->symbol(s));
+        if ((sym.symtype() == SymTypeLocal || sym.symtype() == SymTypeTemp)
+            && sccp_type(sym.typespec()))
+            tracked[s] = true;
+        else if (sym.is_constant() && sccp_type(sym.typespec()))
+            value[s] = sccp_constant(sym);
+        else
+            value[s] = SCCPValue::varying();
+    }
+
+    // A tracked symbol that may be read before it is written holds
+    // whatever it held before, so it varies. Walk the code in order,
+    // knowing which symbols are surely written by now: after an `if`,
+    // those written on both sides; after a loop, those written before
+    // its body; after a function call, those written by a body without
+    // an early return. Every op counts as reachable, which only errs on
+    // the side of varying.
+    std::function<void(int, int, std::vector<bool>&)> assigned;
+    assigned = [&](int begin, int end, std::vector<bool>& written) {
+        for (int opnum = begin; opnum < end; ++opnum) {
+            const Opcode& op(inst()->ops()[opnum]);
+            ustring opname = op.opname();
+            bool loop = (opname == u_for || opname == u_while
+                         || opname == u_dowhile);
+            // A loop op reads the condition that its cond code computes.
+            for (int a = 0, e = op.nargs(); a < e && !loop; ++a) {
+                int s = oparg(op, a);
+                if (op.argread(a) && tracked[s] && !written[s])
+                    value[s] = SCCPValue::varying();
+            }
+            if (opname == u_if) {
+                std::vector<bool> other(written);
+                assigned(opnum + 1, op.jump(0), written);
+                assigned(op.jump(0), op.jump(1), other);
+                for (int s = 0; s < nsyms; ++s)
+                    written[s] = written[s] && other[s];
+                opnum = op.farthest_jump() - 1;
+                continue;
+            }
+            if (loop) {
+                // A dowhile runs its body before the condition.
+                assigned(opnum + 1, op.jump(0), written);
+                std::vector<bool> cond(written), body(written);
+                assigned(op.jump(0), op.jump(1), cond);
+                if (opname != u_dowhile)
+                    body = cond;
+                std::vector<bool> step(body);
+                assigned(op.jump(1), op.jump(2), body);
+                assigned(op.jump(2), op.jump(3), step);
+                if (opname != u_dowhile)
+                    written.swap(cond);
+                opnum = op.farthest_jump() - 1;
+                continue;
+            }
+            if (opname == u_functioncall || opname == u_functioncall_nr) {
+                std::vector<bool> body(written);
+                assigned(opnum + 1, op.jump(0), body);
+                bool returns = false;
+                for (int i = opnum + 1; i < op.jump(0); ++i)
+                    returns |= (inst()->ops()[i].opname() == u_return);
+                if (!returns)
+                    written.swap(body);
+                opnum = op.farthest_jump() - 1;
+                continue;
+            }
+            // Assigning one component doesn't write the whole triple.
+            if (opname == u_compassign)
+                continue;
+            for (int a = 0, e = op.nargs(); a < e; ++a)
+                if (op.argwrite(a))
+                    written[oparg(op, a)] = true;
+        }
+    };
+    {
+        std::vector<bool> written(nsyms, false);
+        assigned(0, nops, written);
+    }
+
+    auto arg_value = [&](const Opcode& op, int a) -> const SCCPValue& {
+        int s      = oparg(op, a);
+        auto found = m_symbol_aliases.find(s);
+        if (found != m_symbol_aliases.end())
+            s = found->second;
+        return value[s];
+    };
+
+    // The ops that read each tracked symbol.
+    std::vector<std::vector<int>> readers(nsyms);
+    for (int opnum = 0; opnum < nops; ++opnum) {
+        const Opcode& op(inst()->ops()[opnum]);
+        for (int a = 0, e = op.nargs(); a < e; ++a)
+            if (op.argread(a) && tracked[oparg(op, a)])
+                readers[oparg(op, a)].push_back(opnum);
+    }
+
+    // Mark the ops that can run, given what is known of the conditions of
+    // `if` ops: with a constant condition only one side can run, and with
+    // one not yet written, neither can (yet). Newly reachable ops go on
+    // the worklist.
+    std::vector<bool> executable(nops, false);
+    std::vector<int> worklist;
+    bool undefined_is_varying = false;
+    std::function<void(int, int)> mark = [&](int begin, int end) {
+        for (int opnum = begin; opnum < end; ++opnum) {
+            if (!executable[opnum]) {
+                executable[opnum] = true;
+                worklist.push_back(opnum);
+            }
+            const Opcode& op(inst()->ops()[opnum]);
+            if (op.opname() != u_if)
+                continue;
+            const SCCPValue& cond(arg_value(op, 0));
+            if (cond.state == SCCPValue::Constant && cond.is_numeric()) {
+                bool taken = cond.is_int() ? cond.i != 0 : cond.f.x != 0.0f;
+                if (taken)
+                    mark(opnum + 1, op.jump(0));
+                else
+                    mark(op.jump(0), op.jump(1));
+                opnum = op.farthest_jump() - 1;
+            } else if (cond.state == SCCPValue::Undefined
+                       && !undefined_is_varying) {
+                opnum = op.farthest_jump() - 1;
+            }
+        }
+    };
+
+    // Lower the value of symbol s to include v, queueing its readers if
+    // it changed.
+    auto lower = [&](int s, const SCCPValue& v) {
+        SCCPValue& cur(value[s]);
+        if (cur.state == SCCPValue::Varying || v.state == SCCPValue::Undefined
+            || cur == v)
+            return;
+        if (cur.state == SCCPValue::Undefined)
+            cur = v;
+        else
+            cur = SCCPValue::varying();
+        for (int r : readers[s])
+            if (executable[r])
+                worklist.push_back(r);
+    };
+
+    while (true) {
+        mark(0, nops);
+        if (worklist.empty()) {
+            if (undefined_is_varying)
+                break;
+            // Still-undefined values are read uninitialized. Rather than
+            // guess, let them vary: consider both sides of an `if` on one,
+            // and refold the ops that read one.
+            undefined_is_varying = true;
+            for (int opnum = 0; opnum < nops; ++opnum)
+                if (executable[opnum])
+                    worklist.push_back(opnum);
+            continue;
+        }
+        while (worklist.size()) {
+            int opnum = worklist.back();
+            worklist.pop_back();
+            const Opcode& op(inst()->ops()[opnum]);
+            int nargs = op.nargs();
+            // Which args does it write, and do we know enough to fold it?
+            bool folds = (nargs == 2 || nargs == 3) && op.argwrite(0)
+                         && !op.argread(0);
+            SCCPValue in[2];
+            for (int a = 1; a < nargs && folds; ++a) {
+                in[a - 1] = arg_value(op, a);
+                if (op.argwrite(a))
+                    folds = false;
+            }
+            if (folds) {
+                for (int a = 1; a < nargs; ++a) {
+                    if (in[a - 1].state != SCCPValue::Undefined)
+                        continue;
+                    if (undefined_is_varying)
+                        in[a - 1] = SCCPValue::varying();
+                    else
+                        folds = false;  // wait until the input is known
+                }
+                if (!folds)
+                    continue;
+                SCCPValue r      = SCCPValue::varying();
+                bool any_varying = false;
+                for (int a = 1; a < nargs; ++a)
+                    any_varying |= (in[a - 1].state == SCCPValue::Varying);
+                if (!any_varying)
+                    r = sccp_fold(op.opname(),
+                                  opargsym(op, 0)->typespec().simpletype(),
+                                  in[0], nargs == 3 ? in[1] : in[0]);
+                if (tracked[oparg(op, 0)])
+                    lower(oparg(op, 0), r);
+                continue;
+            }
+            // Anything else we don't understand makes what it writes vary.
+            for (int a = 0; a < nargs; ++a)
+                if (op.argwrite(a) && tracked[oparg(op, a)])
+                    lower(oparg(op, a), SCCPValue::varying());
+        }
+    }
+
+    // Replace the reads of constant variables with the constants.
+    int changed = 0;
+    for (int opnum = 0; opnum < nops; ++opnum) {
+        if (!executable[opnum])
+            continue;
+        Opcode& op(inst()->ops()[opnum]);
+        for (int a = 0, e = op.nargs(); a < e; ++a) {
+            int s = oparg(op, a);
+            if (!tracked[s] || !op.argread(a) || op.argwrite(a)
+                || value[s].state != SCCPValue::Constant)
+                continue;
+            const SCCPValue& v(value[s]);
+            TypeSpec type = inst()->symbol(s)->typespec();
+            int cind      = v.is_int()      ? add_constant(v.i)
+                            : v.is_float()  ? add_constant(v.f.x)
+                            : v.is_string() ? add_constant(v.s)
+                                            : add_constant(type, &v.f);
+            if (debug() > 1)
+                debug_optfmt("SCCP: op {} {} reads {}, always {}\n", opnum,
+                             op.opname(), inst()->symbol(s)->name(),
+                             inst()->symbol(cind)->name());
+            inst()->args()[op.firstarg() + a] = cind;
+            ++changed;
+        }
+    }
+    shadingsys().m_stat_sccp_constants += changed;
+    return changed;
+}
+
+
+
+void
+RuntimeOptimizer::optimize_instance()
+{
+    // If "opt_layername" attribute is set, only optimize the named layer
+    if (!shadingsys().m_opt_layername.empty()
+        && shadingsys().m_opt_layername != inst()->layername())
+        return;
+
+    // Make a list of the indices of all constants.
+    for (int i = 0, e = (int)inst()->symbols().size(); i < e; ++i)
+        if (inst()->symbol(i)->symtype() == SymTypeConst)
+            m_all_consts.push_back(i);
+
+    // Turn all parameters with instance or default values, and which
+    // cannot be overridden by geometry values, into constants or
+    // aliases for globals.  Also turn connections from earlier layers'
+    // outputs that are known to be constants or globals into constants
+    // or global aliases without any connection.
+    if (optimize() >= 2 && m_opt_simplify_param) {
+        simplify_params();
+    }
+
+    // Propagate the constants that are now known through the whole
+    // instance at once, so the pass loop below starts from them.
+    if (optimize() >= 2 && m_opt_sccp && !debug_uninit())
+        propagate_constants();
+
+#ifndef NDEBUG
+    // Confirm that the symbols between [firstparam,lastparam] are all
+    // input or output params.
+    FOREACH_PARAM(const Symbol& s, inst())
+    {
+        OSL_DASSERT(s.symtype() == SymTypeParam
+                    || s.symtype() == SymTypeOutputParam);
+    }
+#endif
+
+    // Recompute which of our params have downstream connections.
+    mark_outgoing_connections();
+
+    // Try to fold constants.  We take several passes, until we get to
+    // the point that not much is improving.  It rarely goes beyond 3-4
+    // passes, but we have a hard cutoff just to be sure we don't
+    // ever get into an infinite loop from an unforeseen cycle where we
+    // end up inadvertently transforming A => B => A => etc.
+    int reallydone = 0;  // Force a few passes after we think we're done
+    int npasses    = shadingsys().opt_passes();
+    for (m_pass = 0; m_pass < npasses; ++m_pass) {
+        // Once we've made one pass (and therefore called
+        // mark_outgoing_connections), we may notice that the layer is
+        // unused, and therefore can stop doing work to optimize it.
+        if (m_pass != 0 && inst()->unused())
+            break;
+
+        if (m_stop_optimizing)
+            break;
+
+        if (debug() > 1)
+            debug_optfmt("layer {} \"{}\", pass {}:\n", layer(),
+                         inst()->layername(), m_pass);
+
+        // Unroll and hoist loops before folding, so that each copy of a
+        // loop body is folded with its own value of the loop counter.
+        int loopchanges = 0;
+        if (optimize() >= 2)
+            loopchanges = optimize_loops();
+
+        // Track basic blocks and conditional states
+        find_conditionals();
+        find_basic_blocks();
+        if (loopchanges)
+            track_variable_lifetimes();
+
+        // Clear local messages for this instance
+        m_local_unknown_message_sent = false;
+        m_local_messages_sent.clear();
+
+        // Figure out which params are just aliases for globals (only
+        // necessary to do once, on the first pass).
+        if (m_pass == 0 && optimize() >= 2)
+            find_params_holding_globals();
+
+        // Here is the meat of the optimization, where we pass over the
+        // code for this instance and make various transformations.
+        int changed = loopchanges
+                      + optimize_ops(0, (int)inst()->ops().size());
+
+        // Read all the channels each texture lookup will need at once.
+        if (optimize() >= 2 && shadingsys().m_opt_texture_fusion)
+            changed += fuse_texture_calls();
+
+        // Now that we've rewritten the code, we need to re-track the
         // variable lifetimes.
         track_variable_lifetimes();
 
@@ -2439,12 +3820,21 @@ RuntimeOptimizer::optimize_instance()
         }
     }
 
+    // Now that the code has settled, fetch the matrix of transforms
+    // repeated between the same spaces just once.
+    if (optimize() >= 2 && shadingsys().m_opt_hoist_transforms
+        && !inst()->unused() && hoist_space_transforms())
+        track_variable_lifetimes();
+
     // A layer that was allowed to run lazily originally, if it no
     // longer (post-optimized) has any outgoing connections, is no
     // longer needed at all.
     if (inst()->unused()) {
         // Not needed.  Remove all its connections and ops.
-        inst()->connections().clear();
+        {
+            auto lock = lock_connections();
+            inst()->connections().clear();
+        }
         turn_into_nop(
             0, (int)inst()->ops().size() - 1,
             debug() > 1
@@ -2459,15 +3849,327 @@ RuntimeOptimizer::optimize_instance()
     // Now that we've optimized this layer, walk through the ops and
     // note which messages may have been sent, so subsequent layers will
     // know.
-    for (auto& op : inst()->ops()) {
-        if (op.opname() == u_setmessage) {
-            Symbol& Name(*inst()->argsymbol(op.firstarg() + 0));
-            if (Name.is_constant())
-                m_messages_sent.push_back(Name.get_string());
-            else
-                m_unknown_message_sent = true;
+    find_messages_sent(inst(), m_messages_sent, m_unknown_message_sent);
+}
+
+
+
+void
+RuntimeOptimizer::optimize_one_layer(int layer, bool reverse)
+{
+    set_inst(layer);
+    if (inst()->unused())
+        return;
+    Timer layer_timer;
+    RuntimeOptimizer* owner = m_parent ? m_parent : this;
+    std::string memo_key;
+    if (!reverse && shadingsys().m_opt_fold_memo > 0) {
+        memo_key = fold_memo_key();
+        if (memo_key.size() && reuse_folded_layer(memo_key)) {
+            shadingsys().m_stat_fold_memo_hits += 1;
+            owner->m_layer_opt_time[layer] += layer_timer();
+            return;
         }
     }
+    // N.B. we need to resolve isconnected() calls before the instance
+    // is otherwise optimized, or else isconnected() may not reflect
+    // the original connectivity after substitutions are made.
+    if (!reverse)
+        resolve_isconnected();
+    optimize_instance();
+    if (memo_key.size())
+        memoize_folded_layer(memo_key);
+    owner->m_layer_opt_time[layer] += layer_timer();
+}
+
+
+
+// Append the bytes of a value to a memo key.
+template<typename T>
+inline void
+append_key(std::string& key, const T& val)
+{
+    key.append((const char*)&val, sizeof(T));
+}
+
+
+
+std::string
+RuntimeOptimizer::fold_memo_key()
+{
+    // Only layers fed by no other layer, and whose optimization doesn't
+    // print anything, are candidates.
+    if (inst()->nconnections() || debug() || !shadingsys().m_opt_layername.empty())
+        return std::string();
+
+    std::string key;
+    append_key(key, (const ShaderMaster*)inst()->master());
+    key += inst()->layername().string();
+    key += '\0';
+    append_key(key, m_raytypes_on);
+    append_key(key, m_raytypes_off);
+    append_key(key, optimize());
+    append_key(key, debug_uninit());
+    int flags = inst()->last_layer() | (inst()->entry_layer() << 1)
+                | (inst()->outgoing_connections() << 2)
+                | (inst()->renderer_outputs() << 3)
+                | (inst()->writes_globals() << 4)
+                | (inst()->userdata_params() << 5);
+    append_key(key, flags);
+
+    // Parameter values and how each may be used downstream.
+    FOREACH_PARAM(const Symbol& s, inst())
+    {
+        int pflags = int(s.valuesource()) | (s.connected_down() << 4)
+                     | (s.renderer_output() << 5) | (s.interpolated() << 6)
+                     | (s.interactive() << 7) | (s.lockgeom() << 8);
+        append_key(key, pflags);
+        append_key(key, s.typespec().simpletype().arraylen);
+        if (s.valuesource() == Symbol::InstanceVal) {
+            // Strings are ustrings, so their bytes identify them too.
+            key.append((const char*)s.data(), s.typespec().simpletype().size());
+        }
+    }
+
+    // What earlier layers may have sent decides how getmessage folds.
+    append_key(key, m_unknown_message_sent);
+    for (ustring m : m_messages_sent) {
+        key += m.string();
+        key += '\0';
+    }
+
+    // Error reports for out-of-range indices name the group and the layer
+    // number, and getattribute may fold to them, so such layers only match
+    // within the same group.
+    bool group_specific = inst()->master()->range_checking();
+    for (auto&& op : inst()->ops())
+        if (op.opname() == u_getattribute)
+            group_specific = true;
+    if (group_specific) {
+        key += group().name().string();
+        key += '\0';
+        append_key(key, layer());
+    }
+    return key;
+}
+
+
+
+bool
+RuntimeOptimizer::reuse_folded_layer(const std::string& key)
+{
+    std::shared_ptr<const FoldedLayer> folded = shadingsys().find_folded_layer(
+        key);
+    if (!folded)
+        return false;
+
+    ShaderInstance* in = inst();
+    in->m_instops      = folded->ops;
+    in->m_instargs     = folded->args;
+    in->m_instsymbols  = folded->symbols;
+    in->m_iparams      = folded->iparams;
+    in->m_fparams      = folded->fparams;
+    in->m_sparams      = folded->sparams;
+    // Symbols keeping their values in the original instance's parameter
+    // arrays now use the same spots in ours.
+    auto rebase = [](Symbol& s, uintptr_t base, void* newbase, size_t bytes) {
+        uintptr_t p = (uintptr_t)s.data();
+        if (s.arena() == SymArena::Absolute && p >= base && p < base + bytes)
+            s.set_dataptr(SymArena::Absolute, (char*)newbase + (p - base));
+    };
+    for (auto&& s : in->m_instsymbols) {
+        rebase(s, folded->iparams_base, in->m_iparams.data(),
+               in->m_iparams.size() * sizeof(int));
+        rebase(s, folded->fparams_base, in->m_fparams.data(),
+               in->m_fparams.size() * sizeof(float));
+        rebase(s, folded->sparams_base, in->m_sparams.data(),
+               in->m_sparams.size() * sizeof(ustring));
+    }
+    in->m_maincodebegin = folded->maincodebegin;
+    in->m_maincodeend   = folded->maincodeend;
+    in->m_Psym          = folded->Psym;
+    in->m_Nsym          = folded->Nsym;
+    in->writes_globals(folded->writes_globals);
+    in->userdata_params(folded->userdata_params);
+    in->has_error_op(folded->has_error_op);
+    in->has_trace_op(folded->has_trace_op);
+    in->outgoing_connections(folded->outgoing_connections);
+    params_holding_globals()[layer()] = folded->params_holding_globals;
+    m_next_newconst = std::max(m_next_newconst, folded->next_newconst);
+    m_next_newtemp  = std::max(m_next_newtemp, folded->next_newtemp);
+    // As optimize_instance() would, note the messages it may send.
+    find_messages_sent(in, m_messages_sent, m_unknown_message_sent);
+    return true;
+}
+
+
+
+void
+RuntimeOptimizer::memoize_folded_layer(const std::string& key)
+{
+    // Only worth it for layers that folded down to constants or a handful
+    // of ops.
+    const ShaderInstance* in = inst();
+    int live_ops             = 0;
+    for (auto&& op : in->ops())
+        if (op.opname() != u_nop)
+            ++live_ops;
+    int master_ops = in->master()->num_ops();
+    if (live_ops > 8 && live_ops * 4 > master_ops)
+        return;
+
+    auto folded           = std::make_shared<FoldedLayer>();
+    folded->master        = in->m_master;
+    folded->ops           = in->m_instops;
+    folded->args          = in->m_instargs;
+    folded->symbols       = in->m_instsymbols;
+    folded->iparams       = in->m_iparams;
+    folded->fparams       = in->m_fparams;
+    folded->sparams       = in->m_sparams;
+    folded->iparams_base  = (uintptr_t)in->m_iparams.data();
+    folded->fparams_base  = (uintptr_t)in->m_fparams.data();
+    folded->sparams_base  = (uintptr_t)in->m_sparams.data();
+    folded->maincodebegin = in->m_maincodebegin;
+    folded->maincodeend   = in->m_maincodeend;
+    folded->Psym          = in->m_Psym;
+    folded->Nsym          = in->m_Nsym;
+    folded->writes_globals       = in->writes_globals();
+    folded->userdata_params      = in->userdata_params();
+    folded->has_error_op         = in->has_error_op();
+    folded->has_trace_op         = in->has_trace_op();
+    folded->outgoing_connections = in->outgoing_connections();
+    folded->params_holding_globals = params_holding_globals()[layer()];
+    folded->next_newconst          = m_next_newconst;
+    folded->next_newtemp           = m_next_newtemp;
+    shadingsys().add_folded_layer(key, std::move(folded));
+}
+
+
+
+void
+RuntimeOptimizer::optimize_layers(bool reverse, int nthreads)
+{
+    int nlayers = group().nlayers();
+    nthreads    = std::min(nthreads, nlayers);
+    if (nthreads <= 1) {
+        for (int i = 0; i < nlayers; ++i)
+            optimize_one_layer(reverse ? nlayers - 1 - i : i, reverse);
+        return;
+    }
+
+    // A layer must wait for the layers feeding it on the forward pass, and
+    // for the layers it feeds on the reverse pass. Those are exactly the
+    // layers whose state its optimization looks at (connected values,
+    // params holding globals, and the downstream connections), or that
+    // eliminate_middleman() may redirect its connections through.
+    std::vector<int> waiting(nlayers, 0);
+    std::vector<std::vector<int>> unblocks(nlayers);
+    std::vector<std::vector<bool>> ancestor(nlayers,
+                                            std::vector<bool>(nlayers));
+    for (int lay = 0; lay < nlayers; ++lay) {
+        for (auto&& c : group()[lay]->connections()) {
+            int before = reverse ? lay : c.srclayer;
+            int after  = reverse ? c.srclayer : lay;
+            ++waiting[after];
+            unblocks[before].push_back(after);
+            ancestor[lay][c.srclayer] = true;
+            for (int a = 0; a < c.srclayer; ++a)
+                if (ancestor[c.srclayer][a])
+                    ancestor[lay][a] = true;
+        }
+    }
+
+    // Whether getmessage can be folded depends on the messages that the
+    // layers before it might set. The serial first pass sees each earlier
+    // layer as already optimized. To not depend on the thread timing, here
+    // a layer sees its own ancestors optimized and every other earlier
+    // layer as it was at the start of the pass, which is a superset. The
+    // reverse pass, like the serial one, sees everything the first pass
+    // found.
+    struct Messages {
+        std::vector<ustring> names;
+        bool unknown = false;
+    };
+    std::vector<Messages> messages(nlayers);
+    if (!reverse)
+        for (int lay = 0; lay < nlayers; ++lay)
+            find_messages_sent(group()[lay], messages[lay].names,
+                               messages[lay].unknown);
+    std::vector<Messages> optimized_messages(messages);
+
+    std::mutex connections_mutex;
+    std::mutex mutex;  // guards everything below, and the counters above
+    std::condition_variable cv;
+    std::deque<int> ready;
+    for (int i = 0; i < nlayers; ++i) {
+        int lay = reverse ? nlayers - 1 - i : i;
+        if (!waiting[lay])
+            ready.push_back(lay);
+    }
+    int remaining      = nlayers;
+    int next_newconst  = m_next_newconst;
+    int next_newtemp   = m_next_newtemp;
+    auto optimize_some = [&](ShadingContext* ctx) {
+        RuntimeOptimizer rop(shadingsys(), group(), ctx);
+        rop.set_raytypes(m_raytypes_on, m_raytypes_off);
+        rop.m_parent            = this;
+        rop.m_connections_mutex = &connections_mutex;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            cv.wait(lock, [&]() { return ready.size() || !remaining; });
+            if (ready.empty())
+                break;
+            int lay = ready.front();
+            ready.pop_front();
+            // Start each layer from the same state as the others, so that
+            // it comes out the same whatever thread gets it.
+            rop.m_next_newconst = m_next_newconst;
+            rop.m_next_newtemp  = m_next_newtemp;
+            rop.m_messages_sent = m_messages_sent;
+            rop.m_unknown_message_sent = m_unknown_message_sent;
+            if (!reverse) {
+                for (int a = 0; a < lay; ++a) {
+                    const Messages& m(ancestor[lay][a] ? optimized_messages[a]
+                                                       : messages[a]);
+                    rop.m_messages_sent.insert(rop.m_messages_sent.end(),
+                                               m.names.begin(), m.names.end());
+                    rop.m_unknown_message_sent |= m.unknown;
+                }
+            }
+            lock.unlock();
+            rop.optimize_one_layer(lay, reverse);
+            Messages sent;
+            if (!reverse)
+                find_messages_sent(group()[lay], sent.names, sent.unknown);
+            lock.lock();
+            optimized_messages[lay] = std::move(sent);
+            next_newconst = std::max(next_newconst, rop.m_next_newconst);
+            next_newtemp  = std::max(next_newtemp, rop.m_next_newtemp);
+            for (int d : unblocks[lay])
+                if (--waiting[d] == 0)
+                    ready.push_back(d);
+            --remaining;
+            cv.notify_all();
+        }
+    };
+    OIIO::thread_group threads;
+    for (int t = 1; t < nthreads; ++t)
+        threads.add_thread(new std::thread([&]() {
+            PerThreadInfo* threadinfo = shadingsys().create_thread_info();
+            ShadingContext* ctx       = shadingsys().get_context(threadinfo);
+            optimize_some(ctx);
+            shadingsys().release_context(ctx);
+            shadingsys().destroy_thread_info(threadinfo);
+        }));
+    optimize_some(shadingcontext());
+    threads.join_all();
+
+    m_next_newconst = next_newconst;
+    m_next_newtemp  = next_newtemp;
+    if (!reverse)
+        for (int lay = 0; lay < nlayers; ++lay)
+            find_messages_sent(group()[lay], m_messages_sent,
+                               m_unknown_message_sent);
 }
 
 
@@ -2770,6 +4472,38 @@ RuntimeOptimizer::track_variable_dependencies()
 
 
 
+int
+RuntimeOptimizer::track_group_derivatives()
+{
+    int nlayers = (int)group().nlayers();
+    for (int layer = nlayers - 1; layer >= 0; --layer) {
+        set_inst(layer);
+        if (inst()->unused())
+            continue;
+        find_basic_blocks();
+        track_variable_dependencies();
+
+        // For our parameters that require derivatives, mark their
+        // upstream connections as also needing derivatives.
+        for (auto&& c : inst()->m_connections) {
+            if (inst()->symbol(c.dst.param)->has_derivs()) {
+                Symbol* source = group()[c.srclayer]->symbol(c.src.param);
+                if (source->typespec().elementtype().is_float_based())
+                    source->has_derivs(true);
+            }
+        }
+    }
+
+    int nderivs = 0;
+    for (int layer = 0; layer < nlayers; ++layer)
+        if (!group()[layer]->unused())
+            for (auto&& s : group()[layer]->symbols())
+                nderivs += s.has_derivs();
+    return nderivs;
+}
+
+
+
 // Is the symbol coalescable?
 inline bool
 coalescable(const Symbol& s)
@@ -2874,8 +4608,10 @@ RuntimeOptimizer::post_optimize_instance()
     // trying to coalesce to avoid merging a varying with
     // a uniform symbol or forced_llvm_bool with an integer
     if (m_opt_batched_analysis) {
+        Timer batched_timer;
         BatchedAnalysis batched_analysis(shadingsys(), group());
         batched_analysis.analyze_layer(inst());
+        m_stat_batched_analysis_time += batched_timer();
     }
 #endif
 
@@ -3140,41 +4876,9 @@ RuntimeOptimizer::serialize()
 
 
 void
-RuntimeOptimizer::run()
+RuntimeOptimizer::optimize_network()
 {
-    Timer rop_timer;
     int nlayers = (int)group().nlayers();
-    if (debug())
-        shadingcontext()->infofmt(
-            "About to optimize shader group {} ({} layers):", group().name(),
-            nlayers);
-    if (debug())
-        std::cout << "About to optimize shader group " << group().name()
-                  << "\n";
-
-    for (int layer = 0; layer < nlayers; ++layer) {
-        set_inst(layer);
-        // These need to happen before merge_instances
-        inst()->copy_code_from_master(group());
-        mark_outgoing_connections();
-    }
-
-    // Inventory the network and print pre-optimized debug info
-    size_t old_nsyms = 0, old_nops = 0;
-    for (int layer = 0; layer < nlayers; ++layer) {
-        set_inst(layer);
-        if (debug() /* && optimize() >= 1*/) {
-            find_basic_blocks();
-            std::cout.flush();
-            std::cout << "Before optimizing layer " << layer << " \""
-                      << inst()->layername() << "\" (ID " << inst()->id()
-                      << ") :\n";
-            printinst(std::cout);
-            std::cout << "\n--------------------------------\n" << std::endl;
-        }
-        old_nsyms += inst()->symbols().size();
-        old_nops += inst()->ops().size();
-    }
 
     // Clear messages sent for the group, they will be filled in by
     // optimize_instance().
@@ -3190,53 +4894,50 @@ RuntimeOptimizer::run()
     // assume the layer is unused.
     check_for_error_calls(false);
 
-    // Optimize each layer, from first to last
-    for (int layer = 0; layer < nlayers; ++layer) {
-        set_inst(layer);
-        if (inst()->unused())
-            continue;
-        // N.B. we need to resolve isconnected() calls before the instance
-        // is otherwise optimized, or else isconnected() may not reflect
-        // the original connectivity after substitutions are made.
-        resolve_isconnected();
-        optimize_instance();
+    // What the code needs before any of it is specialized away. Without
+    // opt_deriv_demand these marks stay, as conservative seeds for the
+    // pass after optimization; with it they only measure what that pass
+    // saves (stat:derivs_removed), and are cleared before optimizing.
+    int derivs_before = track_group_derivatives();
+    if (shadingsys().m_opt_deriv_demand) {
+        for (int layer = 0; layer < nlayers; ++layer)
+            for (auto&& s : group()[layer]->symbols())
+                s.has_derivs(false);
     }
+
+    // Debugging output from several layers at once would be unreadable.
+    int nthreads = shadingsys().opt_threads();
+    if (nthreads < 1)
+        nthreads = (int)std::thread::hardware_concurrency();
+    if (shadingsys().debug() || !shadingsys().debug_groupname().empty()
+        || !shadingsys().debug_layername().empty())
+        nthreads = 1;
+
+    // Optimize each layer, from first to last
+    optimize_layers(false, nthreads);
     check_for_error_calls(false);  // re-check
 
     // Optimize each layer again, from last to first (because some
     // optimizations are only apparent when the subsequent shaders have
     // been simplified).
-    for (int layer = nlayers - 1; layer >= 0; --layer) {
-        set_inst(layer);
-        if (!inst()->unused())
-            optimize_instance();
-    }
+    optimize_layers(true, nthreads);
 
     // Try merging instances again, now that we've optimized
     shadingsys().merge_instances(group(), true);
 
-    for (int layer = nlayers - 1; layer >= 0; --layer) {
-        set_inst(layer);
-        if (inst()->unused())
-            continue;
-        find_basic_blocks();
-        track_variable_dependencies();
-
-        // For our parameters that require derivatives, mark their
-        // upstream connections as also needing derivatives.
-        for (auto&& c : inst()->m_connections) {
-            if (inst()->symbol(c.dst.param)->has_derivs()) {
-                Symbol* source = group()[c.srclayer]->symbol(c.src.param);
-                if (source->typespec().elementtype().is_float_based())
-                    source->has_derivs(true);
-            }
-        }
-    }
+    // Mark what the optimized code demands: derivatives taken by the ops
+    // that are left, renderer outputs that want them, and connections to
+    // the layers that need them.
+    int derivs_after = track_group_derivatives();
+    if (shadingsys().m_opt_deriv_demand && derivs_after < derivs_before)
+        shadingsys().m_stat_derivs_removed += derivs_before - derivs_after;
 
     // Post-opt cleanup: add useparam, coalesce temporaries, etc.
     for (int layer = 0; layer < nlayers; ++layer) {
         set_inst(layer);
+        Timer layer_timer;
         post_optimize_instance();
+        m_layer_opt_time[layer] += layer_timer();
     }
 
     // Last chance to eliminate duplicate instances
@@ -3246,7 +4947,6 @@ RuntimeOptimizer::run()
     check_for_error_calls(true);
 
     // Get rid of nop instructions and unused symbols.
-    size_t new_nsyms = 0, new_nops = 0, new_deriv_syms = 0;
     for (int layer = 0; layer < nlayers; ++layer) {
         set_inst(layer);
         if (inst()->unused())
@@ -3263,8 +4963,71 @@ RuntimeOptimizer::run()
             printinst(std::cout);
             std::cout << "\n--------------------------------\n" << std::endl;
         }
-        new_nsyms += inst()->symbols().size();
-        new_nops += inst()->ops().size();
+    }
+
+    // With the ops in their final places, find noise calls that several
+    // layers can share.
+    find_shared_noise();
+}
+
+
+
+void
+RuntimeOptimizer::run()
+{
+    Timer rop_timer;
+    int nlayers = (int)group().nlayers();
+    if (debug())
+        shadingcontext()->infofmt(
+            "About to optimize shader group {} ({} layers):", group().name(),
+            nlayers);
+    if (debug())
+        std::cout << "About to optimize shader group " << group().name()
+                  << "\n";
+
+    for (int layer = 0; layer < nlayers; ++layer) {
+        set_inst(layer);
+        // These need to happen before merge_instances
+        inst()->copy_code_from_master(group());
+        mark_outgoing_connections();
+    }
+
+    // Inventory the network and print pre-optimized debug info
+    size_t old_nsyms = 0, old_nops = 0;
+    for (int layer = 0; layer < nlayers; ++layer) {
+        set_inst(layer);
+        if (debug() /* && optimize() >= 1*/) {
+            find_basic_blocks();
+            std::cout.flush();
+            std::cout << "Before optimizing layer " << layer << " \""
+                      << inst()->layername() << "\" (ID " << inst()->id()
+                      << ") :\n";
+            printinst(std::cout);
+            std::cout << "\n--------------------------------\n" << std::endl;
+        }
+        old_nsyms += inst()->symbols().size();
+        old_nops += inst()->ops().size();
+    }
+
+    // A snapshot of this group's optimized layers, saved by an earlier
+    // optimization of it (perhaps in another process), takes the place of
+    // the whole optimization.
+    m_layer_opt_time.assign(nlayers, 0.0);
+    std::string snapshot_file;
+    if (shadingsys().opt_snapshot_dir().size() || shadingsys().registry())
+        snapshot_file = snapshot_filename();
+    if (snapshot_file.empty() || !read_snapshot(snapshot_file)) {
+        optimize_network();
+        if (snapshot_file.size())
+            write_snapshot(snapshot_file);
+    }
+
+    size_t new_nsyms = 0, new_nops = 0, new_deriv_syms = 0;
+    for (int layer = 0; layer < nlayers; ++layer) {
+        if (!group()[layer]->unused()) {
+            new_nsyms += group()[layer]->symbols().size();
+            new_nops += group()[layer]->ops().size();
+        }
     }
 
     m_unknown_textures_needed   = false;
@@ -3637,5 +5400,204 @@ RuntimeOptimizer::police_failed_optimizations()
     return err;
 }
 
+
+
+std::string
+RuntimeOptimizer::optimization_report()
+{
+    // Why a symbol's value couldn't be known while optimizing, as bits.
+    enum {
+        Varying      = 1,   // a shader global
+        Userdata     = 2,   // a parameter that geometry may override
+        Interactive  = 4,   // an interactive parameter
+        Runtime      = 8,   // computed by an op that can't be folded
+        Unsimplified = 16,  // a parameter left as it was
+        nreasons     = 5
+    };
+    static const char* reason_names[nreasons]
+        = { "varying globals", "userdata", "interactive params",
+            "unfoldable ops", "unsimplified params" };
+    auto reasons = [&](int why) {
+        std::vector<std::string> r;
+        for (int b = 0; b < nreasons; ++b)
+            if (why & (1 << b))
+                r.emplace_back(reason_names[b]);
+        return Strutil::join(r, ", ");
+    };
+    auto where = [&](int opnum, const Opcode& op) {
+        return op.sourcefile().size()
+                   ? fmtformat("op {} {} ({}:{})", opnum, op.opname(),
+                               op.sourcefile(), op.sourceline())
+                   : fmtformat("op {} {}", opnum, op.opname());
+    };
+
+    int nlayers = (int)group().nlayers();
+    std::vector<std::vector<int>> why(nlayers);
+    std::string out = fmtformat("Optimization report for group \"{}\"\n",
+                                group().name());
+    for (int layer = 0; layer < nlayers; ++layer) {
+        set_inst(layer);
+        out += fmtformat("Layer {} \"{}\" ({}): ", layer, inst()->layername(),
+                         inst()->shadername());
+        if (inst()->unused()) {
+            out += "elided\n";
+            continue;
+        }
+        std::vector<std::string> kept;
+        if (inst()->last_layer())
+            kept.emplace_back("last layer");
+        if (inst()->entry_layer())
+            kept.emplace_back("entry layer");
+        if (inst()->renderer_outputs())
+            kept.emplace_back("renderer outputs");
+        if (inst()->outgoing_connections())
+            kept.emplace_back("connected downstream");
+        if (inst()->writes_globals())
+            kept.emplace_back("writes globals");
+        if (inst()->has_error_op())
+            kept.emplace_back("error calls");
+        out += fmtformat("kept ({}), {} ops\n", Strutil::join(kept, ", "),
+                         inst()->ops().size());
+
+        // Where each symbol's value comes from, seeded by the globals and
+        // parameters and carried through the ops that write the others,
+        // including the conditions of the code those ops are in.
+        std::vector<int>& w(why[layer]);
+        w.assign(inst()->symbols().size(), 0);
+        for (int i = 0, e = (int)w.size(); i < e; ++i) {
+            const Symbol& s(*inst()->symbol(i));
+            if (s.symtype() == SymTypeGlobal)
+                w[i] = Varying;
+            if (s.symtype() != SymTypeParam
+                && s.symtype() != SymTypeOutputParam)
+                continue;
+            if (s.interpolated())
+                w[i] |= Userdata;
+            if (s.interactive())
+                w[i] |= Interactive;
+            if (!w[i] && !s.connected() && s.symtype() == SymTypeParam
+                && s.initbegin() == s.initend())
+                w[i] = Unsimplified;
+        }
+        for (auto&& c : inst()->connections())
+            w[c.dst.param] |= why[c.srclayer][c.src.param];
+        const OpcodeVec& ops(inst()->ops());
+        int nops = (int)ops.size();
+        std::vector<int> control(nops, 0);
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (int opnum = 0; opnum < nops; ++opnum) {
+                const Opcode& op(ops[opnum]);
+                int in = control[opnum];
+                for (int a = 0; a < op.nargs(); ++a)
+                    if (op.argread(a))
+                        in |= w[oparg(op, a)];
+                if (op.jump(0) >= 0 && op.nargs()) {
+                    int cond = w[oparg(op, 0)];
+                    for (int j = opnum + 1; j < op.farthest_jump(); ++j)
+                        if ((control[j] | cond) != control[j]) {
+                            control[j] |= cond;
+                            changed = true;
+                        }
+                }
+                if (!in)
+                    in = Runtime;
+                for (int a = 0; a < op.nargs(); ++a) {
+                    int& dst(w[oparg(op, a)]);
+                    if (op.argwrite(a) && (dst | in) != dst) {
+                        dst |= in;
+                        changed = true;
+                    }
+                }
+            }
+        }
+
+        for (int opnum = 0; opnum < nops; ++opnum) {
+            const Opcode& op(ops[opnum]);
+            const OpDescriptor* opd = shadingsys().op_descriptor(op.opname());
+            if (!opd)
+                continue;
+            if (opd->flags & OpDescriptor::Tex) {
+                int name = oparg(op, 1);  // arg 1 is texture name
+                if (!symbol(name)->is_constant())
+                    out += fmtformat("  {}: texture name not converted to a "
+                                     "handle, it depends on {} via {}\n",
+                                     where(opnum, op), reasons(w[name]),
+                                     symbol(name)->name());
+            }
+            if (!opd->folder)
+                continue;
+            int in = 0;
+            std::vector<ustring> via;
+            for (int a = 0; a < op.nargs(); ++a) {
+                int arg = oparg(op, a);
+                if (op.argread(a) && w[arg]) {
+                    in |= w[arg];
+                    via.push_back(symbol(arg)->name());
+                }
+            }
+            if (in)
+                out += fmtformat("  {}: not folded, depends on {} via {}\n",
+                                 where(opnum, op), reasons(in),
+                                 Strutil::join(via, ", "));
+            else
+                out += fmtformat("  {}: not folded, though its inputs are "
+                                 "known\n",
+                                 where(opnum, op));
+        }
+
+        // Who needs the derivatives still carried: ops taking them, ops
+        // computing other symbols' derivatives from them, connections to
+        // later layers, and renderer outputs.
+        for (int i = 0, e = (int)w.size(); i < e; ++i) {
+            const Symbol& s(*inst()->symbol(i));
+            if (!s.has_derivs() || s.is_constant())
+                continue;
+            std::vector<std::string> users;
+            for (int opnum = 0; opnum < nops; ++opnum) {
+                const Opcode& op(ops[opnum]);
+                for (int a = 0; a < op.nargs(); ++a) {
+                    if (!op.argread(a) || oparg(op, a) != i)
+                        continue;
+                    if (op.argtakesderivs(a)) {
+                        users.push_back(where(opnum, op));
+                        break;
+                    }
+                    if (op.nargs() && op.argwrite(0) && a != 0
+                        && opargsym(op, 0)->has_derivs()) {
+                        users.push_back(fmtformat("derivs of {}",
+                                                  opargsym(op, 0)->name()));
+                        break;
+                    }
+                }
+            }
+            for (int down = layer + 1; down < nlayers; ++down) {
+                ShaderInstance* d = group()[down];
+                if (d->unused())
+                    continue;
+                for (auto&& c : d->connections())
+                    if (c.srclayer == layer && c.src.param == i
+                        && d->symbol(c.dst.param)->has_derivs())
+                        users.push_back(fmtformat("layer \"{}\" {}",
+                                                  d->layername(),
+                                                  d->symbol(c.dst.param)
+                                                      ->name()));
+            }
+            if (s.renderer_output())
+                users.emplace_back("renderer output");
+            std::sort(users.begin(), users.end());
+            users.erase(std::unique(users.begin(), users.end()), users.end());
+            if (users.size() > 4) {
+                users.resize(4);
+                users.emplace_back("...");
+            }
+            out += fmtformat("  derivatives of {} kept for {}\n", s.name(),
+                             users.size() ? Strutil::join(users, ", ")
+                                          : std::string("nothing known"));
+        }
+    }
+    return out;
+}
+
 };  // namespace pvt
 OSL_NAMESPACE_END
@@ -5,6 +5,8 @@
 #pragma once
 
 #include <map>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <vector>
 
@@ -34,6 +36,30 @@ typedef std::set<int> FastIntSet;
 
 
 
+/// A layer with no incoming connections as its first optimization pass
+/// left it, memoized by the shading system (see "opt_fold_memo") so that
+/// identical layers can start from it.
+struct FoldedLayer {
+    ShaderMaster::ref master;  ///< Keeps the master in the key alive
+    OpcodeVec ops;
+    std::vector<int> args;
+    SymbolVec symbols;
+    std::vector<int> iparams;
+    std::vector<float> fparams;
+    std::vector<ustring> sparams;
+    // Where the original instance kept its parameter values, to move the
+    // symbols pointing there over to the instance that reuses them.
+    uintptr_t iparams_base, fparams_base, sparams_base;
+    int maincodebegin, maincodeend;
+    int Psym, Nsym;
+    bool writes_globals, userdata_params, has_error_op, has_trace_op;
+    bool outgoing_connections;
+    std::unordered_map<ustring, ustring> params_holding_globals;
+    int next_newconst, next_newtemp;
+};
+
+
+
 /// OSOProcessor that does runtime optimization on shaders.
 class RuntimeOptimizer final : public OSOProcessorBase {
 public:
@@ -62,12 +88,36 @@ public:
     /// instance variables and connections.
     void optimize_instance();
 
+    /// Run optimize_instance() on every used layer, first to last (or last
+    /// to first if `reverse`), using up to `nthreads` threads. A layer
+    /// only waits for the layers it is connected to in the direction of
+    /// the pass, so layers that aren't linked are optimized concurrently.
+    void optimize_layers(bool reverse, int nthreads);
+
     /// One optimization pass over a range of instructions [begin, end).
     /// Return the number of changes made. If seed_block_aliases is not
     /// NULL, use that as the initial set of block_aliases.
     int optimize_ops(int beginop, int endop,
                      FastIntMap* seed_block_aliases = NULL);
 
+    /// Unroll the 'for' loops of the main code that have a constant trip
+    /// count, and hoist loop-invariant ops out of the others, innermost
+    /// loops first. Changes the code layout, so basic blocks and variable
+    /// lifetimes must be recomputed afterwards. Return the number of
+    /// changes made.
+    int optimize_loops();
+
+    /// Replace the 'for' loop whose op is at opnum with its init code
+    /// followed by one copy of its body and step per iteration, if its
+    /// trip count is a known constant and the copies are small enough.
+    /// Return true if it was unrolled.
+    bool unroll_loop(int opnum);
+
+    /// Move the ops at the top level of the body of the 'for' loop at
+    /// opnum that compute the same thing on every iteration to the end of
+    /// the loop's init code. Return the number of ops moved.
+    int hoist_loop_invariants(int opnum);
+
     /// Post-optimization cleanup of a layer: add 'useparam' instructions,
     /// track variable lifetimes, coalesce temporaries.
     void post_optimize_instance();
@@ -331,6 +381,12 @@ public:
 
     void track_variable_dependencies();
 
+    /// Mark the symbols of every used layer that need derivatives, last
+    /// layer to first, so that each layer's connected params pass the need
+    /// on to the upstream outputs feeding them. Return how many symbols
+    /// are marked in all.
+    int track_group_derivatives();
+
     void add_dependency(SymDependency& dmap, int A, int B);
 
     void mark_symbol_derivatives(SymDependency& symdeps, SymIntSet& visited,
@@ -345,6 +401,42 @@ public:
 
     int eliminate_middleman();
 
+    /// Turn each texture call that reads channels already read by an
+    /// earlier call in the same basic block -- same file, coordinates and
+    /// options, only the channels differing -- into a copy of them from
+    /// the earlier call's result, adding an "alpha" output to the earlier
+    /// call for the channel just past its result. Return the number of
+    /// calls eliminated.
+    int fuse_texture_calls();
+
+    /// Where the main code transforms between the same two constant named
+    /// spaces more than once, and the first such transform always runs,
+    /// fetch the matrix once just before it and make all of them
+    /// transforms by that matrix. Return the number of transforms changed.
+    int hoist_space_transforms();
+
+    /// Find noise calls in different layers of the group that must compute
+    /// the same value (same op, same constant args, same unwritten globals
+    /// or params connected to the same upstream output) and record them in
+    /// group().m_noise_memos so the backend computes each value only once
+    /// per shade.  Call after collapse_ops, since it records op numbers.
+    void find_shared_noise();
+
+    /// Describe the value of noise arg sym of the current layer as a key
+    /// that is equal for args guaranteed to hold the same value in any
+    /// layer of the group, or return false if there is no such guarantee.
+    bool noise_arg_key(const Symbol& sym, const std::set<ustring>& written,
+                       std::string& key);
+
+    /// Sparse conditional constant propagation over the whole instance:
+    /// find the local and temporary variables that hold the same constant
+    /// wherever they may be read, ignoring writes in branches that can't be
+    /// taken, and replace those reads with constants. Unlike the pass
+    /// loop, facts flow across basic blocks and through branches in one
+    /// go, using a worklist of the ops whose inputs changed. Return the
+    /// number of arguments replaced.
+    int propagate_constants();
+
     /// Squeeze out unused symbols from an instance that has been
     /// optimized.
     void collapse_syms();
@@ -447,6 +539,12 @@ public:
     };
     bool police_(int type, const Opcode& op, string_view msg);
 
+    /// After optimization, describe what is left of each layer and why:
+    /// whether it was elided, the ops that couldn't be folded and what
+    /// kept them from it, texture names that couldn't become handles, and
+    /// who needs the derivatives still carried.
+    std::string optimization_report();
+
     template<typename Str, typename... Args>
     bool police(int type, const Opcode& op, const Str& fmt, Args&&... args)
     {
@@ -474,6 +572,9 @@ private:
     bool m_opt_assign;                     ///< Do various assign optimizations?
     bool m_opt_mix;                        ///< Do mix optimizations?
     bool m_opt_middleman;                  ///< Do middleman optimizations?
+    bool m_opt_sccp;                       ///< Sparse constant propagation?
+    bool m_opt_licm;                       ///< Hoist loop-invariant ops?
+    int m_opt_loop_unroll;                 ///< Max ops of an unrolled loop
     bool m_opt_batched_analysis;  ///< Perform extra analysis required for batched execution?
     bool m_keep_no_return_function_calls;  ///< To generate debug info, keep no return function calls
     ShaderGlobals m_shaderglobals;        ///< Dummy ShaderGlobals
@@ -495,6 +596,19 @@ private:
         m_block_aliases_stack;         ///< Stack of saved local block aliases
     FastIntMap m_param_aliases;        ///< Params aliasing to params/globals
     FastIntMap m_stale_syms;           ///< Stale symbols for this block
+
+    // Scratch containers used by each level of optimize_ops recursion.
+    // They are kept for the life of the optimizer (cleared, not freed)
+    // so their storage is recycled across blocks, passes, and layers
+    // instead of going back to the heap for every nested block.
+    struct BlockScratch {
+        FastIntMap saved_aliases;
+        FastIntMap restored_aliases;
+        FastIntSet symwrites;
+    };
+    std::vector<std::unique_ptr<BlockScratch>> m_block_scratch;
+    size_t m_block_scratch_depth = 0;  ///< Levels of m_block_scratch in use
+
     int m_local_unknown_message_sent;  ///< Non-const setmessage in this inst
     std::vector<ustring> m_local_messages_sent;  ///< Messages set in this inst
     std::set<ustring> m_textures_needed;
@@ -509,14 +623,76 @@ private:
     std::set<UserDataNeeded> m_userdata_needed;
     double m_stat_opt_locking_time;     ///<   locking time
     double m_stat_specialization_time;  ///<   specialization time
+    double m_stat_batched_analysis_time = 0;  ///<   batched analysis time
+    std::vector<double> m_layer_opt_time;     ///< Specialization per layer
     bool m_stop_optimizing;             ///< for debugging
     int m_raytypes_on;                  ///< Ray types known to be on
     int m_raytypes_off;                 ///< Ray types known to be off
+    std::string m_snapshot_key;         ///< Everything the snapshot is for
 
     // Persistent data shared between layers
     bool m_unknown_message_sent;  ///< Somebody did a non-const setmessage
     std::vector<ustring> m_messages_sent;  ///< Names of messages set
 
+    // Set on the optimizers that optimize_layers() hands single layers to
+    // when it uses several threads.
+    RuntimeOptimizer* m_parent = nullptr;  ///< Owner of the group-wide state
+    std::mutex* m_connections_mutex = nullptr;  ///< Guards all connections
+
+    /// The group-wide record of params holding globals.
+    std::vector<ustringmap_t>& params_holding_globals()
+    {
+        return m_parent ? m_parent->m_params_holding_globals
+                        : m_params_holding_globals;
+    }
+
+    /// Lock the connection lists of the group's layers, if other threads
+    /// may be optimizing other layers at the same time.
+    std::unique_lock<std::mutex> lock_connections()
+    {
+        return m_connections_mutex
+                   ? std::unique_lock<std::mutex>(*m_connections_mutex)
+                   : std::unique_lock<std::mutex>();
+    }
+
+    /// Optimize just layer `layer` for optimize_layers().
+    void optimize_one_layer(int layer, bool reverse);
+
+    /// Everything that the first optimization pass of the current layer
+    /// depends on, or "" if it can't be memoized (see "opt_fold_memo").
+    std::string fold_memo_key();
+
+    /// Make the current layer what a memoized first pass left, returning
+    /// false if there is none for `key`.
+    bool reuse_folded_layer(const std::string& key);
+
+    /// Memoize the current layer after its first pass, if it came out
+    /// small enough to be worth it.
+    void memoize_folded_layer(const std::string& key);
+
+    /// Everything run() does to the layers between copying in their code
+    /// and taking inventory of what the optimized group needs: all the
+    /// optimization passes, merging instances, and collapsing the ops and
+    /// symbols that are left.
+    void optimize_network();
+
+    /// Where the snapshot of this group's optimized layers is kept in the
+    /// "opt_snapshot_dir", named for a hash of everything they depend on.
+    /// With no directory (only a registry), just the name.
+    std::string snapshot_filename();
+
+    /// Save the optimized layers to the "opt_snapshot_dir" and the
+    /// attached ShaderRegistry, if any. Groups whose
+    /// optimized symbols hold values that can't be saved, such as
+    /// pointers, are skipped.
+    void write_snapshot(const std::string& filename);
+
+    /// Replace the layers with the optimized ones from a snapshot,
+    /// looked for in the registry before the directory, returning false
+    /// (and leaving the layers alone) if there is no usable snapshot for
+    /// this group.
+    bool read_snapshot(const std::string& filename);
+
     friend class ShadingSystemImpl;
 };
 
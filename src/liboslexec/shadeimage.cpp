@@ -9,6 +9,9 @@
 #include <OpenImageIO/thread.h>
 
 #include <OSL/oslexec.h>
+#if OSL_USE_BATCHED
+#    include <OSL/batched_shaderglobals.h>
+#endif
 
 using namespace OSL;
 using namespace OSL::pvt;
@@ -20,13 +23,176 @@ using namespace OSL::pvt;
 
 OSL_NAMESPACE_BEGIN
 
+namespace {
+
+// What shade_image needs to know about each output, gathered once rather
+// than for each pixel.
+struct ShadeImageOutput {
+    const ShaderSymbol* sym;
+    TypeDesc type;
+    int nchans;
+    bool placed;  // A symloc already puts it in the image
+};
+
+}  // namespace
+
+
+
+// The u,v at which to shade pixel (x,y) of the full window.
+static inline void
+shade_image_uv(int x, int y, const OIIO::ROI& roi_full,
+               ShadeImageLocations shadelocations, float& u, float& v)
+{
+    int xres = roi_full.width();
+    int yres = roi_full.height();
+    if (shadelocations == ShadePixelCenters) {
+        u = float(x - roi_full.xbegin + 0.5f) / xres;
+        v = float(y - roi_full.ybegin + 0.5f) / yres;
+        // float w = float(p.z()-roi_full.zbegin+0.5f) / zres;
+    } else {
+        u = (xres == 1) ? 0.5f : float(x - roi_full.xbegin) / (xres - 1);
+        v = (yres == 1) ? 0.5f : float(y - roi_full.ybegin) / (yres - 1);
+        // float w = (zres == 1) ? 0.5f : float(p.z()-roi_full.zbegin) / (zres - 1);
+    }
+}
+
+
+
+// The index of pixel (x,y,z) in the local pixels of buf, which is the
+// shadeindex for outputs that symlocs place in the image.
+static inline int
+shade_image_index(const OIIO::ImageBuf& buf, int x, int y, int z)
+{
+    OIIO::ROI data = buf.roi();
+    return ((z - data.zbegin) * data.height() + (y - data.ybegin))
+               * data.width()
+           + (x - data.xbegin);
+}
+
+
+
+// Copy the outputs of the last execution that aren't placed in the image
+// by symlocs into the pixel's channels (through a float* or an ImageBuf
+// iterator). Lanes of batched outputs are `width` apart (1 when not
+// batched).
+template<typename PixelT>
+static inline void
+shade_image_save(ShadingSystem& shadingsys, const ShadingContext& ctx,
+                 cspan<ShadeImageOutput> outputs, int nchannels, int width,
+                 int lane, PixelT& pixel)
+{
+    int chan = 0;
+    for (auto&& out : outputs) {
+        if (out.placed) {
+            chan += out.nchans;
+            continue;
+        }
+        const void* data = shadingsys.symbol_address(ctx, out.sym);
+        if (!data)
+            continue;  // Skip if symbol isn't found
+        if (chan + out.nchans > nchannels)
+            break;
+        if (out.type.basetype == TypeDesc::FLOAT) {
+            for (int c = 0; c < out.nchans; ++c)
+                pixel[chan++] = ((const float*)data)[c * width + lane];
+        } else if (out.type.basetype == TypeDesc::INT) {
+            for (int c = 0; c < out.nchans; ++c)
+                pixel[chan++] = ((const int*)data)[c * width + lane];
+        }
+        // N.B. Drop any outputs that aren't float- or int-based
+    }
+}
+
+
+
+#if OSL_USE_BATCHED
+// Shade the pixels of roi WidthT at a time, in scanline order, with the
+// batched JIT, starting from the globals in sg.
+template<int WidthT>
+static void
+shade_image_batched(ShadingSystem& shadingsys, ShaderGroup& group,
+                    ShadingContext& ctx, const ShaderGlobals& sg,
+                    OIIO::ImageBuf& buf, OIIO::ROI roi,
+                    ShadeImageLocations shadelocations,
+                    cspan<ShadeImageOutput> outputs, void* output_base_ptr)
+{
+    BatchedShaderGlobals<WidthT> bsg;
+    auto& usg = bsg.uniform;
+    memset(&usg, 0, sizeof(UniformShaderGlobals));
+    usg.renderstate = sg.renderstate;
+    usg.tracedata   = sg.tracedata;
+    usg.objdata     = sg.objdata;
+    usg.raytype     = sg.raytype;
+
+    // Everything but P, u and v is the same for every pixel
+    auto& vsg = bsg.varying;
+    using OSL::assign_all;
+    assign_all(vsg.dPdx, sg.dPdx);
+    assign_all(vsg.dPdy, sg.dPdy);
+    assign_all(vsg.dPdz, sg.dPdz);
+    assign_all(vsg.I, sg.I);
+    assign_all(vsg.dIdx, sg.dIdx);
+    assign_all(vsg.dIdy, sg.dIdy);
+    assign_all(vsg.N, sg.N);
+    assign_all(vsg.Ng, sg.Ng);
+    assign_all(vsg.dudx, sg.dudx);
+    assign_all(vsg.dudy, sg.dudy);
+    assign_all(vsg.dvdx, sg.dvdx);
+    assign_all(vsg.dvdy, sg.dvdy);
+    assign_all(vsg.dPdu, sg.dPdu);
+    assign_all(vsg.dPdv, sg.dPdv);
+    assign_all(vsg.time, sg.time);
+    assign_all(vsg.dtime, sg.dtime);
+    assign_all(vsg.dPdtime, sg.dPdtime);
+    assign_all(vsg.Ps, sg.Ps);
+    assign_all(vsg.dPsdx, sg.dPsdx);
+    assign_all(vsg.dPsdy, sg.dPsdy);
+    assign_all(vsg.object2common, sg.object2common);
+    assign_all(vsg.shader2common, sg.shader2common);
+    assign_all(vsg.surfacearea, sg.surfacearea);
+    assign_all(vsg.flipHandedness, sg.flipHandedness);
+    assign_all(vsg.backfacing, sg.backfacing);
+
+    OIIO::ROI roi_full = buf.roi_full();
+    int width          = roi.width();
+    int height         = roi.height();
+    int npixels        = int(roi.npixels());
+    OSL::Block<int, WidthT> shadeindex;
+    float* pixels[WidthT];
+    for (int begin = 0; begin < npixels; begin += WidthT) {
+        // Lanes run along the scanline, and on to the next one
+        int nlanes = std::min(WidthT, npixels - begin);
+        for (int lane = 0; lane < nlanes; ++lane) {
+            int i = begin + lane;
+            int x = roi.xbegin + i % width;
+            int y = roi.ybegin + (i / width) % height;
+            int z = roi.zbegin + i / (width * height);
+            float u, v;
+            shade_image_uv(x, y, roi_full, shadelocations, u, v);
+            vsg.P[lane]      = Vec3(x, y, z);
+            vsg.u[lane]      = u;
+            vsg.v[lane]      = v;
+            shadeindex[lane] = shade_image_index(buf, x, y, z);
+            pixels[lane]     = (float*)buf.pixeladdr(x, y, z);
+        }
+
+        shadingsys.batched<WidthT>().execute(ctx, group, nlanes, shadeindex,
+                                             bsg, nullptr, output_base_ptr);
+
+        for (int lane = 0; lane < nlanes; ++lane)
+            shade_image_save(shadingsys, ctx, outputs, buf.nchannels(),
+                             WidthT, lane, pixels[lane]);
+    }
+}
+#endif
+
 
 
 bool
 shade_image(ShadingSystem& shadingsys, ShaderGroup& group,
             const ShaderGlobals* defaultsg, OIIO::ImageBuf& buf,
             cspan<ustring> outputs, ShadeImageLocations shadelocations,
-            OIIO::ROI roi, OIIO::paropt popt)
+            OIIO::ROI roi, OIIO::paropt popt, int batch_width)
 {
     using namespace OIIO;
     using namespace ImageBufAlgo;
@@ -39,6 +205,42 @@ shade_image(ShadingSystem& shadingsys, ShaderGroup& group,
         return false;
     }
 
+    // Gather some information about the outputs once, rather than for
+    // each pixel. Outputs with an Outputs-arena symloc are written by the
+    // shader straight into the pixels, at a shadeindex of the pixel's
+    // position in the buffer, so they need the pixels to be packed.
+    std::vector<ShadeImageOutput> outinfo(outputs.size());
+    bool any_placed = false;
+    for (size_t i = 0; i < outputs.size(); ++i) {
+        auto& out  = outinfo[i];
+        out.sym    = shadingsys.find_symbol(group, outputs[i]);
+        out.type   = shadingsys.symbol_typedesc(out.sym);
+        out.nchans = out.type.numelements() * out.type.aggregate;
+        out.placed = shadingsys.find_symloc(&group, outputs[i],
+                                            SymArena::Outputs)
+                     != nullptr;
+        any_placed |= out.placed;
+    }
+    void* output_base_ptr = nullptr;
+    if (any_placed) {
+        output_base_ptr      = buf.localpixels();
+        stride_t pixelstride = buf.nchannels() * sizeof(float);
+        if (!output_base_ptr || buf.pixel_stride() != pixelstride
+            || buf.scanline_stride() != pixelstride * buf.spec().width
+            || buf.z_stride() != buf.scanline_stride() * buf.spec().height) {
+            buf.errorfmt("Cannot OSL::shade_image() outputs placed by "
+                         "symlocs into an ImageBuf without packed pixels");
+            return false;
+        }
+    }
+#if OSL_USE_BATCHED
+    // Batches find their pixels by address
+    if (!buf.localpixels())
+        batch_width = 0;
+#else
+    batch_width = 0;
+#endif
+
     parallel_image(roi, popt, [&](OIIO::ROI roi) {
         // Request an OSL::PerThreadInfo for this thread.
         OSL::PerThreadInfo* thread_info = shadingsys.create_thread_info();
@@ -58,19 +260,6 @@ shade_image(ShadingSystem& shadingsys, ShaderGroup& group,
         int yres           = roi_full.height();
         int zres           = roi_full.depth();
 
-        // Gather some information about the outputs once, rather than for
-        // each pixel.
-        const ShaderSymbol** output_sym = OSL_ALLOCA(const ShaderSymbol*,
-                                                     outputs.size());
-        TypeDesc* output_type           = OSL_ALLOCA(TypeDesc, outputs.size());
-        int* output_nchans              = OSL_ALLOCA(int, outputs.size());
-        for (int i = 0; i < int(outputs.size()); ++i) {
-            output_sym[i]    = shadingsys.find_symbol(group, outputs[i]);
-            output_type[i]   = shadingsys.symbol_typedesc(output_sym[i]);
-            output_nchans[i] = output_type[i].numelements()
-                               * output_type[i].aggregate;
-        }
-
         // Set up shader globals and a little test grid of points to shade.
         // Note that some of the fields can be set up once and used for all of
         // the shades. Others need to be changed for every point shaded.
@@ -118,47 +307,47 @@ shade_image(ShadingSystem& shadingsys, ShaderGroup& group,
             sg.Ng = Vec3(0, 0, 1);
         }
 
+#if OSL_USE_BATCHED
+        // Shade a batch of pixels at a time, if asked to
+        if (batch_width == 16 || batch_width == 8 || batch_width == 4) {
+            if (batch_width == 16) {
+                shadingsys.batched<16>().jit_group(&group, ctx);
+                shade_image_batched<16>(shadingsys, group, *ctx, sg, buf, roi,
+                                        shadelocations, outinfo,
+                                        output_base_ptr);
+            } else if (batch_width == 8) {
+                shadingsys.batched<8>().jit_group(&group, ctx);
+                shade_image_batched<8>(shadingsys, group, *ctx, sg, buf, roi,
+                                       shadelocations, outinfo,
+                                       output_base_ptr);
+            } else {
+                shadingsys.batched<4>().jit_group(&group, ctx);
+                shade_image_batched<4>(shadingsys, group, *ctx, sg, buf, roi,
+                                       shadelocations, outinfo,
+                                       output_base_ptr);
+            }
+            shadingsys.release_context(ctx);
+            shadingsys.destroy_thread_info(thread_info);
+            return;
+        }
+#endif
+
         // Loop over all pixels in the image (in x and y)...
         for (OIIO::ImageBuf::Iterator<float> p(buf, roi); !p.done(); ++p) {
             // Set the shader globals that vary from point to pixel to pixel
             sg.P = Vec3(p.x(), p.y(), p.z());
-            if (shadelocations == ShadePixelCenters) {
-                sg.u = float(p.x() - roi_full.xbegin + 0.5f) / xres;
-                sg.v = float(p.y() - roi_full.ybegin + 0.5f) / yres;
-                // float w = float(p.z()-roi_full.zbegin+0.5f) / zres;
-            } else {
-                sg.u = (xres == 1)
-                           ? 0.5f
-                           : float(p.x() - roi_full.xbegin) / (xres - 1);
-                sg.v = (yres == 1)
-                           ? 0.5f
-                           : float(p.y() - roi_full.ybegin) / (yres - 1);
-                // float w = (zres == 1) ? 0.5f : float(p.z()-roi_full.zbegin) / (zres - 1);
-            }
+            shade_image_uv(p.x(), p.y(), roi_full, shadelocations, sg.u, sg.v);
 
             // Actually run the shader for this point
-            shadingsys.execute(*ctx, group, sg);
+            int shadeindex = output_base_ptr
+                                 ? shade_image_index(buf, p.x(), p.y(), p.z())
+                                 : 0;
+            shadingsys.execute(*ctx, group, 0, shadeindex, sg, nullptr,
+                               output_base_ptr);
 
             // Save all the designated outputs.
-            int chan = 0;
-            for (int i = 0; i < int(outputs.size()); ++i) {
-                const void* data = shadingsys.symbol_address(*ctx,
-                                                             output_sym[i]);
-                if (!data)
-                    continue;  // Skip if symbol isn't found
-                TypeDesc t = output_type[i];
-                int tvals  = output_nchans[i];
-                if (chan + tvals > buf.nchannels())
-                    break;
-                if (t.basetype == TypeDesc::FLOAT) {
-                    for (int c = 0; c < tvals; ++c)
-                        p[chan++] = ((const float*)data)[c];
-                } else if (t.basetype == TypeDesc::INT) {
-                    for (int c = 0; c < int(t.numelements()) * t.aggregate; ++c)
-                        p[chan++] = ((const int*)data)[c];
-                }
-                // N.B. Drop any outputs that aren't float- or int-based
-            }
+            shade_image_save(shadingsys, *ctx, outinfo, buf.nchannels(), 1, 0,
+                             p);
         }
 
         // We're done shading with this context.
@@ -170,6 +359,18 @@ shade_image(ShadingSystem& shadingsys, ShaderGroup& group,
 
 
 
+bool
+shade_image(ShadingSystem& shadingsys, ShaderGroup& group,
+            const ShaderGlobals* defaultsg, OIIO::ImageBuf& buf,
+            cspan<ustring> outputs, ShadeImageLocations shadelocations,
+            OIIO::ROI roi, OIIO::paropt popt)
+{
+    return shade_image(shadingsys, group, defaultsg, buf, outputs,
+                       shadelocations, roi, popt, 0);
+}
+
+
+
 // DEPRECATED(1.14)
 OSLEXECPUBLIC
 bool
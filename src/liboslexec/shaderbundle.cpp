@@ -0,0 +1,188 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include <OpenImageIO/filesystem.h>
+#include <OpenImageIO/strutil.h>
+
+#include "shaderbundle.h"
+
+OSL_NAMESPACE_BEGIN
+namespace pvt {
+
+// Layout of a bundle file, in the byte order of the machine that wrote it:
+//
+//     Header
+//     Entry entries[nentries]       sorted by name
+//     names and code                each entry's code 8-byte aligned
+//
+// Offsets are from the start of the file.
+
+namespace {
+const char bundle_magic[8]   = { 'O', 'S', 'L', 'B', 'N', 'D', 'L', '\n' };
+const uint32_t endian_tag    = 0x01020304;
+const uint32_t bundle_format = 1;
+
+struct Header {
+    char magic[8];
+    uint32_t endian;
+    uint32_t format;
+    uint64_t nentries;
+};
+}  // namespace
+
+struct ShaderBundle::Entry {
+    uint64_t name, code;  // Offsets of the name and the code
+    uint32_t namelen, codelen;
+};
+
+
+
+bool
+ShaderBundle::open(const std::string& filename, std::string& err)
+{
+    m_filename = filename;
+    if (!m_file.open(filename)) {
+        err = OIIO::Strutil::fmt::format("Could not read shader bundle {}",
+                                         filename);
+        return false;
+    }
+    const Header* header = (const Header*)m_file.data();
+    if (m_file.size() < sizeof(Header)
+        || memcmp(header->magic, bundle_magic, sizeof(bundle_magic))) {
+        err = OIIO::Strutil::fmt::format("{} is not a shader bundle",
+                                         filename);
+        return false;
+    }
+    if (header->endian != endian_tag || header->format != bundle_format) {
+        err = OIIO::Strutil::fmt::format(
+            "Shader bundle {} was written for another platform or version",
+            filename);
+        return false;
+    }
+    m_nentries = header->nentries;
+    m_entries  = (const Entry*)(header + 1);
+    if (m_nentries > (m_file.size() - sizeof(Header)) / sizeof(Entry)) {
+        err = OIIO::Strutil::fmt::format("Shader bundle {} is truncated",
+                                         filename);
+        return false;
+    }
+    for (size_t i = 0; i < m_nentries; ++i) {
+        const Entry& e = m_entries[i];
+        if (e.name + e.namelen > m_file.size()
+            || e.code + e.codelen > m_file.size()) {
+            err = OIIO::Strutil::fmt::format("Shader bundle {} is corrupt",
+                                             filename);
+            return false;
+        }
+    }
+    return true;
+}
+
+
+
+string_view
+ShaderBundle::find(string_view name) const
+{
+    const char* data = m_file.data();
+    auto entryname   = [=](const Entry& e) {
+        return string_view(data + e.name, e.namelen);
+    };
+    const Entry* end = m_entries + m_nentries;
+    const Entry* e   = std::lower_bound(m_entries, end, name,
+                                        [&](const Entry& e, string_view n) {
+                                          return entryname(e) < n;
+                                      });
+    if (e == end || entryname(*e) != name)
+        return string_view();
+    return string_view(data + e->code, e->codelen);
+}
+
+
+
+std::vector<string_view>
+ShaderBundle::names() const
+{
+    std::vector<string_view> names;
+    names.reserve(m_nentries);
+    for (size_t i = 0; i < m_nentries; ++i)
+        names.emplace_back(m_file.data() + m_entries[i].name,
+                           m_entries[i].namelen);
+    return names;
+}
+
+
+
+bool
+ShaderBundle::write(const std::string& filename,
+                    const std::vector<std::string>& osofiles, std::string& err)
+{
+    struct Shader {
+        std::string name, code;
+    };
+    std::vector<Shader> shaders;
+    for (const std::string& osofile : osofiles) {
+        Shader s;
+        s.name = OIIO::Filesystem::filename(osofile);
+        if (OIIO::Strutil::ends_with(s.name, ".oso"))
+            s.name.erase(s.name.size() - 4);
+        size_t size = size_t(OIIO::Filesystem::file_size(osofile));
+        s.code.resize(size);
+        if (!size
+            || OIIO::Filesystem::read_bytes(osofile, &s.code[0], size)
+                   != size) {
+            err = OIIO::Strutil::fmt::format("Could not read {}", osofile);
+            return false;
+        }
+        shaders.push_back(std::move(s));
+    }
+    std::sort(shaders.begin(), shaders.end(),
+              [](const Shader& a, const Shader& b) { return a.name < b.name; });
+    shaders.erase(std::unique(shaders.begin(), shaders.end(),
+                              [](const Shader& a, const Shader& b) {
+                                  return a.name == b.name;
+                              }),
+                  shaders.end());
+
+    Header header;
+    memcpy(header.magic, bundle_magic, sizeof(bundle_magic));
+    header.endian   = endian_tag;
+    header.format   = bundle_format;
+    header.nentries = shaders.size();
+    std::vector<Entry> entries(shaders.size());
+    std::string contents;
+    size_t base = sizeof(Header) + entries.size() * sizeof(Entry);
+    for (size_t i = 0; i < shaders.size(); ++i) {
+        entries[i].name    = base + contents.size();
+        entries[i].namelen = uint32_t(shaders[i].name.size());
+        contents += shaders[i].name;
+        // Align the code, so that binary .oso is read in place.
+        contents.resize((base + contents.size() + 7) / 8 * 8 - base);
+        entries[i].code    = base + contents.size();
+        entries[i].codelen = uint32_t(shaders[i].code.size());
+        contents += shaders[i].code;
+    }
+
+    OIIO::ofstream file;
+    OIIO::Filesystem::open(file, filename,
+                           std::ios_base::out | std::ios_base::binary);
+    if (file) {
+        file.write((const char*)&header, sizeof(header));
+        file.write((const char*)entries.data(),
+                   entries.size() * sizeof(Entry));
+        file.write(contents.data(), contents.size());
+    }
+    if (!file.good()) {
+        err = OIIO::Strutil::fmt::format("Could not write shader bundle {}",
+                                         filename);
+        return false;
+    }
+    return true;
+}
+
+}  // namespace pvt
+OSL_NAMESPACE_END
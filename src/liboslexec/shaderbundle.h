@@ -0,0 +1,53 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <OSL/oslconfig.h>
+
+#include "mappedfile.h"
+
+OSL_NAMESPACE_BEGIN
+namespace pvt {
+
+// A shader bundle: the compiled code (text or binary .oso) of many shaders
+// in one file, behind an index sorted by shader name. A bundle is mounted
+// by mapping it, after which finding a shader is a binary search of the
+// index, with no file system access, and its code is read from the mapping
+// only when it is loaded.
+class ShaderBundle {
+public:
+    /// Map the bundle file, returning false (and setting err) if it can't
+    /// be read or is not a bundle.
+    bool open(const std::string& filename, std::string& err);
+
+    const std::string& filename() const { return m_filename; }
+
+    /// The compiled code of the named shader, or an empty view if the
+    /// bundle doesn't hold it.
+    string_view find(string_view name) const;
+
+    /// The names of all the shaders in the bundle, in sorted order.
+    std::vector<string_view> names() const;
+
+    /// Write a bundle holding the given .oso files, each under its name
+    /// without directory or extension. Return false (and set err) if one
+    /// of them couldn't be read or the bundle couldn't be written.
+    static bool write(const std::string& filename,
+                      const std::vector<std::string>& osofiles,
+                      std::string& err);
+
+private:
+    struct Entry;
+    std::string m_filename;
+    MappedFile m_file;
+    const Entry* m_entries = nullptr;
+    size_t m_nentries      = 0;
+};
+
+}  // namespace pvt
+OSL_NAMESPACE_END
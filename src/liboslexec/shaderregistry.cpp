@@ -0,0 +1,77 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <mutex>
+#include <unordered_map>
+
+#include <OSL/oslexec.h>
+
+OSL_NAMESPACE_BEGIN
+
+class ShaderRegistry::Impl {
+public:
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, std::shared_ptr<const std::string>>
+        entries;
+    size_t bytes = 0;
+};
+
+
+
+ShaderRegistry::ShaderRegistry() : m_impl(new Impl) {}
+
+ShaderRegistry::~ShaderRegistry() {}
+
+
+
+std::shared_ptr<const std::string>
+ShaderRegistry::find(string_view key) const
+{
+    std::lock_guard<std::mutex> lock(m_impl->mutex);
+    auto found = m_impl->entries.find(std::string(key));
+    return found != m_impl->entries.end() ? found->second : nullptr;
+}
+
+
+
+void
+ShaderRegistry::add(string_view key, string_view data)
+{
+    // Copy outside the lock; whoever stores first wins, since anything
+    // stored under the same key is the same.
+    auto value = std::make_shared<const std::string>(data);
+    std::lock_guard<std::mutex> lock(m_impl->mutex);
+    if (m_impl->entries.emplace(std::string(key), std::move(value)).second)
+        m_impl->bytes += key.size() + data.size();
+}
+
+
+
+void
+ShaderRegistry::clear()
+{
+    std::lock_guard<std::mutex> lock(m_impl->mutex);
+    m_impl->entries.clear();
+    m_impl->bytes = 0;
+}
+
+
+
+size_t
+ShaderRegistry::size() const
+{
+    std::lock_guard<std::mutex> lock(m_impl->mutex);
+    return m_impl->entries.size();
+}
+
+
+
+size_t
+ShaderRegistry::memory_used() const
+{
+    std::lock_guard<std::mutex> lock(m_impl->mutex);
+    return m_impl->bytes;
+}
+
+OSL_NAMESPACE_END
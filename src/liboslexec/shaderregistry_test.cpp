@@ -0,0 +1,92 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <cstring>
+
+#include <OpenImageIO/unittest.h>
+#include <OpenImageIO/ustring.h>
+
+#include <OSL/oslexec.h>
+#include <OSL/rendererservices.h>
+
+using namespace OSL;
+
+
+// shader test (float scale = 2, output float x = 0) { x = u * scale + v; }
+static const char* test_oso = R"(OpenShadingLanguage 1.00
+# Compiled by oslc 1.14.0
+shader test
+param	float	scale	2		%read{0,0} %write{2147483647,-1}
+oparam	float	x	0		%read{2147483647,-1} %write{1,1}
+global	float	u	%read{0,0} %write{2147483647,-1}
+global	float	v	%read{1,1} %write{2147483647,-1}
+temp	float	$tmp1	%read{1,1} %write{0,0}
+code ___main___
+	mul	$tmp1 u scale 	%argrw{"wrr"}
+	add	x $tmp1 v 	%argrw{"wrr"}
+	end
+)";
+
+
+
+// Make a ShadingSystem attached to registry, build the test group in it,
+// shade one point, and return the stat:jit_cache_hits it ends up with.
+static int
+shade_with_registry(std::shared_ptr<ShaderRegistry> registry, float scale)
+{
+    RendererServices renderer;
+    ShadingSystem ss(&renderer);
+    ss.attach_registry(registry);
+    OIIO_CHECK_ASSERT(ss.LoadMemoryCompiledShader("test", test_oso));
+
+    ShaderGroupRef group = ss.ShaderGroupBegin("group");
+    ss.Parameter(*group, "scale", scale);
+    ss.Shader(*group, "surface", "test", "layer1");
+    ss.ShaderGroupEnd(*group);
+    ustring outputs[] = { ustring("x") };
+    ss.attribute(group.get(), "renderer_outputs",
+                 TypeDesc(TypeDesc::STRING, 1), outputs);
+
+    PerThreadInfo* threadinfo = ss.create_thread_info();
+    ShadingContext* ctx       = ss.get_context(threadinfo);
+    ShaderGlobals sg;
+    memset((char*)&sg, 0, sizeof(sg));
+    sg.u = 0.5f;
+    sg.v = 0.25f;
+    OIIO_CHECK_ASSERT(ss.execute(*ctx, *group, 0, 0, sg, nullptr, nullptr));
+    TypeDesc type;
+    const float* x = (const float*)ss.get_symbol(*ctx, ustring("x"), type);
+    OIIO_CHECK_ASSERT(x != nullptr);
+    if (x)
+        OIIO_CHECK_EQUAL(*x, 0.5f * scale + 0.25f);
+    ss.release_context(ctx);
+    ss.destroy_thread_info(threadinfo);
+
+    int hits = 0;
+    ss.getattribute("stat:jit_cache_hits", hits);
+    return hits;
+}
+
+
+
+// The machine code JITed for a group by one ShadingSystem is reused by
+// another attached to the same registry that makes the same group, but
+// not for a group that differs.
+static void
+test_shared_jit()
+{
+    auto registry = std::make_shared<ShaderRegistry>();
+    OIIO_CHECK_EQUAL(shade_with_registry(registry, 2.0f), 0);
+    OIIO_CHECK_EQUAL(shade_with_registry(registry, 2.0f), 1);
+    OIIO_CHECK_EQUAL(shade_with_registry(registry, 3.0f), 0);
+}
+
+
+
+int
+main(int /*argc*/, char* /*argv*/[])
+{
+    test_shared_jit();
+    return unit_test_failures;
+}
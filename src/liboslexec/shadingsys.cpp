@@ -2,9 +2,13 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <fstream>
+#include <map>
 #include <mutex>
 #include <string>
 #include <vector>
@@ -18,6 +22,7 @@
 #    include <OSL/wide.h>
 #endif
 #include <OSL/oslquery.h>
+#include <OSL/stringtable.h>
 
 #include <OpenImageIO/filesystem.h>
 #include <OpenImageIO/fmath.h>
@@ -27,7 +32,9 @@
 #include <OpenImageIO/thread.h>
 #include <OpenImageIO/timer.h>
 
+#include "devicearena.h"
 #include "opcolor.h"
+#include "shaderbundle.h"
 
 using namespace OSL;
 using namespace OSL::pvt;
@@ -222,6 +229,46 @@ ShadingSystem::ReParameter(ShaderGroup& group, string_view layername,
 
 
 
+void
+ShadingSystem::ReParameterBegin(ShaderGroup& group)
+{
+    m_impl->ReParameterBegin(group);
+}
+
+
+
+bool
+ShadingSystem::ReParameterEnd(ShaderGroup& group)
+{
+    return m_impl->ReParameterEnd(group);
+}
+
+
+
+ShaderGroupRef
+ShadingSystem::specialize_outputs(ShaderGroup& group, cspan<ustring> outputs)
+{
+    return m_impl->specialize_outputs(group, outputs);
+}
+
+
+
+int
+ShadingSystem::find_param(string_view shadername, string_view paramname)
+{
+    return m_impl->find_param(shadername, paramname);
+}
+
+
+
+ShaderGroupRef
+ShadingSystem::build_shader_group(const ShaderGroupDesc& desc)
+{
+    return m_impl->build_shader_group(desc);
+}
+
+
+
 PerThreadInfo*
 ShadingSystem::create_thread_info()
 {
@@ -230,6 +277,14 @@ ShadingSystem::create_thread_info()
 
 
 
+PerThreadInfo*
+ShadingSystem::create_thread_info(int numa_node)
+{
+    return m_impl->create_thread_info(numa_node);
+}
+
+
+
 void
 ShadingSystem::destroy_thread_info(PerThreadInfo* threadinfo)
 {
@@ -267,6 +322,34 @@ ShadingSystem::execute(ShadingContext& ctx, ShaderGroup& group,
 
 
 
+bool
+ShadingSystem::execute_many(ShadingContext& ctx, ShaderGroup& group,
+                            int thread_index, int shadeindex_begin,
+                            span<ShaderGlobals> globals,
+                            void* userdata_base_ptr, void* output_base_ptr,
+                            cspan<OutputBinding> outputs)
+{
+    return ctx.execute_many(group, thread_index, shadeindex_begin, globals,
+                            userdata_base_ptr, output_base_ptr, outputs);
+}
+
+
+
+bool
+ShadingSystem::execute_deferred_trace(ShadingContext& ctx, ShaderGroup& group,
+                                      int thread_index, int shadeindex_begin,
+                                      span<ShaderGlobals> globals,
+                                      void* userdata_base_ptr,
+                                      void* output_base_ptr,
+                                      cspan<OutputBinding> outputs)
+{
+    return ctx.execute_deferred_trace(group, thread_index, shadeindex_begin,
+                                      globals, userdata_base_ptr,
+                                      output_base_ptr, outputs);
+}
+
+
+
 bool
 ShadingSystem::execute_init(ShadingContext& ctx, ShaderGroup& group,
                             int thread_index, int shade_index,
@@ -405,6 +488,14 @@ ShadingSystem::execute_cleanup(ShadingContext& ctx)
 
 
 
+void
+ShadingSystem::retain_closures(ShadingContext& ctx, bool retain)
+{
+    ctx.retain_closures(retain);
+}
+
+
+
 int
 ShadingSystem::find_layer(const ShaderGroup& group, ustring layername) const
 {
@@ -640,6 +731,20 @@ ShadingSystem::configure_batch_execution_at(int width)
                 m_impl->attribute("llvm_jit_fma", 0);
                 return true;
             }
+#    endif
+            if (target_requested) {
+                break;
+            }
+            // fallthrough
+        case TargetISA::NEON:
+#    ifdef __OSL_SUPPORTS_b4_NEON
+            if (LLVM_Util::supports_isa(TargetISA::NEON)) {
+                if (!target_requested)
+                    m_impl->attribute("llvm_jit_target",
+                                      LLVM_Util::target_isa_name(
+                                          TargetISA::NEON));
+                return true;
+            }
 #    endif
             if (target_requested) {
                 break;
@@ -661,6 +766,22 @@ ShadingSystem::getstats(int level) const
 
 
 
+void
+ShadingSystem::enumerate_stats(const StatsFunc& func) const
+{
+    m_impl->enumerate_stats(func);
+}
+
+
+
+void
+ShadingSystem::set_stats_callback(StatsFunc func)
+{
+    m_impl->set_stats_callback(std::move(func));
+}
+
+
+
 void
 ShadingSystem::register_closure(string_view name, int id,
                                 const ClosureParam* params,
@@ -747,6 +868,86 @@ ShadingSystem::optimize_all_groups(int nthreads, bool do_jit)
 
 
 
+void
+ShadingSystem::wait_for_background_jit()
+{
+    m_impl->wait_for_background_jit();
+}
+
+
+
+void
+ShadingSystem::set_task_executor(TaskExecutor executor)
+{
+    m_impl->set_task_executor(std::move(executor));
+}
+
+
+
+size_t
+ShadingSystem::compact_shader_code()
+{
+    return m_impl->compact_shader_code();
+}
+
+
+
+size_t
+ShadingSystem::enforce_memory_budget()
+{
+    return m_impl->enforce_memory_budget();
+}
+
+
+
+size_t
+ShadingSystem::upload_device_data(void* stream)
+{
+    return m_impl->upload_device_data(stream);
+}
+
+
+
+std::vector<std::string>
+ShadingSystem::ptx_compile_groups(cspan<ShaderGroupRef> groups, int nthreads,
+                                  const PTXReadyFunc& ready)
+{
+    return m_impl->ptx_compile_groups(groups, nthreads, ready);
+}
+
+
+
+uint32_t
+ShadingSystem::make_string_table(cspan<ShaderGroupRef> groups,
+                                 cspan<ustring> extra,
+                                 std::vector<int32_t>& seeds,
+                                 std::vector<uint64_t>& keys)
+{
+    return m_impl->make_string_table(groups, extra, seeds, keys);
+}
+
+
+
+std::shared_ptr<const std::string>
+ShadingSystem::device_program(ShaderGroup& group, string_view arch,
+                              const DeviceCompileFunc& compile)
+{
+    return m_impl->device_program(group, arch, compile);
+}
+
+
+
+bool
+ShadingSystem::shade_grid_device(ShaderGroup& group, int npoints, void* sg,
+                                 void* groupdata, void* userdata_base,
+                                 void* output_base, void* stream)
+{
+    return m_impl->shade_grid_device(group, npoints, sg, groupdata,
+                                     userdata_base, output_base, stream);
+}
+
+
+
 TextureSystem*
 ShadingSystem::texturesys() const
 {
@@ -781,6 +982,31 @@ ShadingSystem::archive_shadergroup(ShaderGroup& group, string_view filename)
 }
 
 
+
+bool
+ShadingSystem::write_shader_bundle(string_view filename,
+                                   cspan<std::string> shadernames)
+{
+    return m_impl->write_shader_bundle(filename, shadernames);
+}
+
+
+
+void
+ShadingSystem::attach_registry(std::shared_ptr<ShaderRegistry> registry)
+{
+    m_impl->attach_registry(std::move(registry));
+}
+
+
+
+std::shared_ptr<ShaderRegistry>
+ShadingSystem::registry() const
+{
+    return m_impl->registry();
+}
+
+
 void
 ShadingSystem::set_raytypes(ShaderGroup* group, int raytypes_on,
                             int raytypes_off)
@@ -908,6 +1134,321 @@ ShadingSystem::BatchedExecutor<WidthT>::jit_all_groups(int nthreads)
 template class ShadingSystem::BatchedExecutor<16>;
 template class ShadingSystem::BatchedExecutor<8>;
 template class ShadingSystem::BatchedExecutor<4>;
+
+
+
+template<int WidthT> struct ShadingSystem::BatchFormer<WidthT>::Impl {
+    struct Bin {
+        ShaderGroup* group;
+        int raytype;
+        int count = 0;
+        Block<int, WidthT> shadeindex;
+        BatchedShaderGlobals<WidthT> globals;
+        ShaderGlobals points[WidthT];  ///< Kept for scalar execution
+    };
+
+    Impl(ShadingSystem& ss, pvt::ShadingSystemImpl& ssi, ShadingContext& ctx,
+         void* userdata_base_ptr, void* output_base_ptr,
+         ShadedCallback shaded)
+        : ss(ss)
+        , ssi(ssi)
+        , ctx(ctx)
+        , userdata_base_ptr(userdata_base_ptr)
+        , output_base_ptr(output_base_ptr)
+        , shaded(std::move(shaded))
+    {
+    }
+
+    Bin& find_bin(ShaderGroup& group, int raytype)
+    {
+        if (last < bins.size() && bins[last]->group == &group
+            && bins[last]->raytype == raytype)
+            return *bins[last];
+        for (last = 0; last < bins.size(); ++last)
+            if (bins[last]->group == &group && bins[last]->raytype == raytype)
+                return *bins[last];
+        bins.emplace_back(new Bin);
+        Bin& bin(*bins.back());
+        bin.group   = &group;
+        bin.raytype = raytype;
+        memset((void*)&bin.globals, 0, sizeof(bin.globals));
+        bin.globals.uniform.raytype = raytype;
+        return bin;
+    }
+
+    // Shade the bin, batched or point by point with the scalar JIT,
+    // whichever the group's measurements found cheaper per point.
+    bool shade(Bin& bin)
+    {
+        ShaderGroup& group(*bin.group);
+        int trials = ssi.batch_autoselect();
+        auto route = trials > 0 ? group.exec_route()
+                                : ShaderGroup::RouteBatched;
+        bool measuring = (route == ShaderGroup::RouteMeasuring);
+        bool batched   = measuring ? group.exec_route_try_batched()
+                                   : (route == ShaderGroup::RouteBatched);
+        if (measuring) {
+            // Keep the JIT out of the measurement.
+            if (batched)
+                ss.batched<WidthT>().jit_group(&group, &ctx);
+            else
+                ss.optimize_group(&group, &ctx, true);
+        }
+        OIIO::Timer timer;
+        bool ok = true;
+        if (batched) {
+            ok = ss.batched<WidthT>().execute(ctx, group, bin.count,
+                                              bin.shadeindex, bin.globals,
+                                              userdata_base_ptr,
+                                              output_base_ptr);
+        } else {
+            for (int i = 0; i < bin.count; ++i) {
+                ShaderGlobals& sg(bin.points[i]);
+                ok &= ss.execute(ctx, group, sg.thread_index,
+                                 bin.shadeindex.data[i], sg, userdata_base_ptr,
+                                 output_base_ptr);
+                bin.globals.varying.Ci[i] = sg.Ci;
+            }
+        }
+        if (measuring
+            && group.record_exec_route(batched, bin.count,
+                                       (long long)(timer() * 1.0e9), trials)) {
+            if (group.exec_route() == ShaderGroup::RouteBatched)
+                ssi.m_stat_routed_batched += 1;
+            else
+                ssi.m_stat_routed_scalar += 1;
+        }
+        if (shaded)
+            shaded(bin.globals, bin.count, bin.shadeindex.data);
+        ssi.m_stat_formed_batches += 1;
+        ssi.m_stat_formed_points += bin.count;
+        pending -= bin.count;
+        bin.count = 0;
+        return ok;
+    }
+
+    ShadingSystem& ss;
+    pvt::ShadingSystemImpl& ssi;
+    ShadingContext& ctx;
+    void* userdata_base_ptr;
+    void* output_base_ptr;
+    ShadedCallback shaded;
+    std::vector<std::unique_ptr<Bin>> bins;
+    size_t last = 0;  ///< Index of the most recently used bin
+    int pending = 0;
+};
+
+
+
+template<int WidthT>
+ShadingSystem::BatchFormer<WidthT>::BatchFormer(ShadingSystem& ss,
+                                                ShadingContext& ctx,
+                                                void* userdata_base_ptr,
+                                                void* output_base_ptr,
+                                                ShadedCallback shaded)
+    : m_impl(new Impl(ss, *ss.m_impl, ctx, userdata_base_ptr,
+                      output_base_ptr, std::move(shaded)))
+{
+}
+
+
+
+template<int WidthT> ShadingSystem::BatchFormer<WidthT>::~BatchFormer() {}
+
+
+
+template<int WidthT>
+bool
+ShadingSystem::BatchFormer<WidthT>::push(ShaderGroup& group,
+                                         const ShaderGlobals& sg,
+                                         int shadeindex)
+{
+    bool ok = true;
+    auto& bin(m_impl->find_bin(group, sg.raytype));
+    auto& usg(bin.globals.uniform);
+    if (bin.count
+        && (usg.renderstate != sg.renderstate || usg.tracedata != sg.tracedata
+            || usg.objdata != sg.objdata))
+        ok = m_impl->shade(bin);
+    if (!bin.count) {
+        usg.renderstate = sg.renderstate;
+        usg.tracedata   = sg.tracedata;
+        usg.objdata     = sg.objdata;
+    }
+
+    int lane                  = bin.count;
+    auto& vsg                 = bin.globals.varying;
+    vsg.P[lane]               = sg.P;
+    vsg.dPdx[lane]            = sg.dPdx;
+    vsg.dPdy[lane]            = sg.dPdy;
+    vsg.dPdz[lane]            = sg.dPdz;
+    vsg.I[lane]               = sg.I;
+    vsg.dIdx[lane]            = sg.dIdx;
+    vsg.dIdy[lane]            = sg.dIdy;
+    vsg.N[lane]               = sg.N;
+    vsg.Ng[lane]              = sg.Ng;
+    vsg.u[lane]               = sg.u;
+    vsg.dudx[lane]            = sg.dudx;
+    vsg.dudy[lane]            = sg.dudy;
+    vsg.v[lane]               = sg.v;
+    vsg.dvdx[lane]            = sg.dvdx;
+    vsg.dvdy[lane]            = sg.dvdy;
+    vsg.dPdu[lane]            = sg.dPdu;
+    vsg.dPdv[lane]            = sg.dPdv;
+    vsg.time[lane]            = sg.time;
+    vsg.dtime[lane]           = sg.dtime;
+    vsg.dPdtime[lane]         = sg.dPdtime;
+    vsg.Ps[lane]              = sg.Ps;
+    vsg.dPsdx[lane]           = sg.dPsdx;
+    vsg.dPsdy[lane]           = sg.dPsdy;
+    vsg.object2common[lane]   = sg.object2common;
+    vsg.shader2common[lane]   = sg.shader2common;
+    vsg.Ci[lane]              = sg.Ci;
+    vsg.surfacearea[lane]     = sg.surfacearea;
+    vsg.flipHandedness[lane]  = sg.flipHandedness;
+    vsg.backfacing[lane]      = sg.backfacing;
+    bin.shadeindex[lane]      = shadeindex;
+    if (m_impl->ssi.batch_autoselect() > 0
+        && group.exec_route() != ShaderGroup::RouteBatched)
+        bin.points[lane] = sg;
+    bin.count += 1;
+    m_impl->pending += 1;
+
+    if (bin.count == WidthT)
+        ok &= m_impl->shade(bin);
+    return ok;
+}
+
+
+
+template<int WidthT>
+bool
+ShadingSystem::BatchFormer<WidthT>::flush()
+{
+    bool ok = true;
+    for (auto& bin : m_impl->bins)
+        if (bin->count)
+            ok &= m_impl->shade(*bin);
+    return ok;
+}
+
+
+
+template<int WidthT>
+int
+ShadingSystem::BatchFormer<WidthT>::pending() const
+{
+    return m_impl->pending;
+}
+
+
+
+// Explicitly instantiate
+template class ShadingSystem::BatchFormer<16>;
+template class ShadingSystem::BatchFormer<8>;
+template class ShadingSystem::BatchFormer<4>;
+
+
+
+namespace {
+
+struct WeightedComponent {
+    const ClosureComponent* comp;
+    Color3 weight;
+};
+
+// Depth first walk of a closure tree, in the same order the renderer
+// would visit the components, folding mul weights into each component.
+void
+flatten_closure(const ClosureColor* closure, const Color3& w,
+                std::vector<WeightedComponent>& out)
+{
+    if (!closure)
+        return;
+    switch (closure->id) {
+    case ClosureColor::MUL: {
+        const ClosureMul* mul = closure->as_mul();
+        flatten_closure(mul->closure, w * mul->weight, out);
+        break;
+    }
+    case ClosureColor::ADD: {
+        const ClosureAdd* add = closure->as_add();
+        flatten_closure(add->closureA, w, out);
+        flatten_closure(add->closureB, w, out);
+        break;
+    }
+    default: {
+        const ClosureComponent* comp = closure->as_comp();
+        out.push_back({ comp, w * comp->w });
+        break;
+    }
+    }
+}
+
+}  // namespace
+
+
+
+template<int WidthT>
+bool
+ShadingSystem::closures_to_soa(const ClosureColor* const* ci, int batch_size,
+                               ClosureSoA<WidthT>& soa) const
+{
+    OSL_ASSERT(batch_size >= 0 && batch_size <= WidthT);
+    soa.batch_size = batch_size;
+    soa.components.clear();
+    if (!batch_size)
+        return true;
+
+    std::vector<WeightedComponent> lanes[WidthT];
+    for (int lane = 0; lane < batch_size; ++lane) {
+        flatten_closure(ci[lane], Color3(1.0f), lanes[lane]);
+        if (lanes[lane].size() != lanes[0].size())
+            return false;
+        for (size_t c = 0, e = lanes[0].size(); c < e; ++c)
+            if (lanes[lane][c].comp->id != lanes[0][c].comp->id)
+                return false;
+    }
+
+    soa.components.resize(lanes[0].size());
+    for (size_t c = 0, e = lanes[0].size(); c < e; ++c) {
+        auto& out(soa.components[c]);
+        const auto* entry = m_impl->find_closure(lanes[0][c].comp->id);
+        if (!entry) {
+            soa.components.clear();
+            return false;
+        }
+        out.id         = lanes[0][c].comp->id;
+        out.param_size = entry->struct_size;
+        int nwords     = (entry->struct_size + 3) / 4;
+        out.params.assign(size_t(nwords) * WidthT, 0.0f);
+        for (int lane = 0; lane < WidthT; ++lane) {
+            // Unused lanes repeat the first lane, so SIMD loops over the
+            // whole width read well defined values.
+            const auto& wc(lanes[lane < batch_size ? lane : 0][c]);
+            out.weight[0][lane] = wc.weight.x;
+            out.weight[1][lane] = wc.weight.y;
+            out.weight[2][lane] = wc.weight.z;
+            const char* data    = (const char*)wc.comp->data();
+            for (int word = 0; word < nwords; ++word) {
+                int bytes = std::min(4, entry->struct_size - 4 * word);
+                memcpy(&out.params[size_t(word) * WidthT + lane],
+                       data + 4 * word, bytes);
+            }
+        }
+    }
+    return true;
+}
+
+
+
+// Explicitly instantiate
+template bool ShadingSystem::closures_to_soa<16>(const ClosureColor* const*,
+                                                  int, ClosureSoA<16>&) const;
+template bool ShadingSystem::closures_to_soa<8>(const ClosureColor* const*, int,
+                                                 ClosureSoA<8>&) const;
+template bool ShadingSystem::closures_to_soa<4>(const ClosureColor* const*, int,
+                                                 ClosureSoA<4>&) const;
 #endif
 
 
@@ -1023,7 +1564,10 @@ register_JIT_Global(const char* global_var_name, void* global_var_addr)
     LLVM_Util::add_global_mapping(global_var_name, global_var_addr);
 }
 
-PerThreadInfo::PerThreadInfo() {}
+PerThreadInfo::PerThreadInfo(int numa_node)
+    : numa_node(numa_node)
+{
+}
 
 
 
@@ -1063,6 +1607,7 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
     , m_texturesys(texturesystem)
     , m_err(err)
     , m_statslevel(0)
+    , m_stats_slowest_groups(5)
     , m_lazylayers(true)
     , m_lazyglobals(true)
     , m_lazyunconnected(true)
@@ -1070,6 +1615,7 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
     , m_lazy_userdata(false)
     , m_lazy_trace(true)
     , m_userdata_isconnected(false)
+    , m_reparam_rebuild(false)
     , m_clearmemory(false)
     , m_debugnan(false)
     , m_debug_uninit(false)
@@ -1079,6 +1625,9 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
     , m_range_checking(true)
     , m_connection_error(true)
     , m_greedyjit(false)
+    , m_texture_prefetch(false)
+    , m_memory_budget(0)
+    , m_udim_tile_cache(true)
     , m_countlayerexecs(false)
     , m_relaxed_param_typecheck(false)
     , m_profile(0)
@@ -1094,12 +1643,25 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
     , m_opt_mix(true)
     , m_opt_merge_instances(1)
     , m_opt_merge_instances_with_userdata(true)
+    , m_opt_share_groups(false)
     , m_opt_fold_getattribute(true)
+    , m_opt_fold_dict(true)
     , m_opt_middleman(true)
+    , m_opt_sccp(true)
+    , m_opt_licm(true)
+    , m_opt_loop_unroll(256)
+    , m_opt_deriv_demand(true)
+    , m_opt_noise_memo(true)
+    , m_opt_fold_memo(0)
     , m_opt_texture_handle(true)
+    , m_opt_texture_fusion(true)
+    , m_opt_hoist_transforms(true)
     , m_opt_seed_bblock_aliases(true)
     , m_opt_useparam(false)
     , m_opt_groupdata(true)
+    , m_opt_groupdata_hot(true)
+    , m_opt_groupdata_share(true)
+    , m_opt_readonly_params(true)
 #if OSL_USE_BATCHED
     , m_opt_batched_analysis((renderer->batched(WidthOf<16>()) != nullptr)
                              || (renderer->batched(WidthOf<8>()) != nullptr)
@@ -1107,11 +1669,26 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
 #else
     , m_opt_batched_analysis(false)
 #endif
+    , m_opt_batched_analysis_memo(256)
+    , m_batch_autoselect(4)
+    , m_batch_uniform_scalar(false)
+    , m_batched_attribute_cache(false)
     , m_llvm_jit_fma(false)
     , m_llvm_jit_aggressive(false)
     , m_optimize_nondebug(false)
+    , m_llvm_jit_tiered(0)
+    , m_llvm_jit_threads(1)
+    , m_llvm_shared_ops(0)
+    , m_llvm_shared_constants(256)
+    , m_llvm_jit_lazy_entry(false)
+    , m_llvm_jit_group_memory(false)
+    , m_llvm_jit_huge_pages(false)
+    , m_llvm_pgo(0)
+    , m_llvm_layer_inline(40)
+    , m_llvm_layer_noinline(2000)
     , m_vector_width(4)
     , m_opt_passes(10)
+    , m_opt_threads(1)
     , m_llvm_optimize(1)
     , m_debug(0)
     , m_llvm_debug(0)
@@ -1126,18 +1703,36 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
     , m_dump_uniform_symbols(0)
     , m_dump_varying_symbols(0)
     , m_max_local_mem_KB(2048)
+    , m_closure_pool_max_KB(0)
+    , m_context_heap_presize(false)
+    , m_telemetry_interval(0)
+    , m_pmu_interval(0)
+    , m_stats_interval(10.0f)
     , m_compile_report(0)
     , m_use_optix(renderer->supports("OptiX"))
     , m_use_optix_cache(m_use_optix && renderer->supports("optix_ptx_cache"))
     , m_max_optix_groupdata_alloc(0)
+    , m_optix_wavefront(false)
+    , m_optix_split_threshold(0)
+    , m_optix_host_jit(false)
+    , m_device_arena_size(0)
+    , m_async_device_copies(false)
     , m_buffer_printf(true)
+    , m_defer_printf(false)
     , m_no_noise(false)
+    , m_noise_hash("inthash")
+    , m_math_precision(OSL_FAST_MATH ? "fast" : "precise")
     , m_no_pointcloud(false)
+    , m_pointcloud_index("partio")
     , m_force_derivs(false)
     , m_allow_shader_replacement(false)
     , m_exec_repeat(1)
+    , m_raytype_variants(0)
+    , m_userdata_variants(0)
+    , m_debug_sample_interval(0)
     , m_opt_warnings(0)
     , m_gpu_opt_error(0)
+    , m_opt_report(0)
     , m_optix_no_inline(false)
     , m_optix_no_inline_layer_funcs(false)
     , m_optix_merge_layer_funcs(true)
@@ -1145,6 +1740,8 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
     , m_optix_no_inline_thresh(100000)
     , m_optix_force_inline_thresh(0)
     , m_colorspace("Rec709")
+    , m_op_descriptor(nullptr)
+    , m_stat_startup_time(0)
     , m_stat_opt_locking_time(0)
     , m_stat_specialization_time(0)
     , m_stat_total_llvm_time(0)
@@ -1153,8 +1750,11 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
     , m_stat_llvm_opt_time(0)
     , m_stat_llvm_jit_time(0)
     , m_stat_inst_merge_time(0)
+    , m_stat_background_jit_time(0)
     , m_stat_max_llvm_local_mem(0)
+    , m_max_groupdata_size(0)
 {
+    OIIO::Timer timer;
     m_shading_state_uniform.m_commonspace_synonym     = Strings::world;
     m_shading_state_uniform.m_unknown_coordsys_error  = true;
     m_shading_state_uniform.m_max_warnings_per_thread = 100;
@@ -1166,6 +1766,28 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
     m_stat_instances_compiled                = 0;
     m_stat_groups_compiled                   = 0;
     m_stat_empty_instances                   = 0;
+    m_stat_jit_cache_hits                    = 0;
+    m_stat_jit_cache_misses                  = 0;
+    m_stat_jit_cache_variants                = 0;
+    m_stat_snapshots_loaded                  = 0;
+    m_stat_snapshots_saved                   = 0;
+    m_stat_background_jits                   = 0;
+    m_stat_optix_split_groups                = 0;
+    m_stat_optix_host_jits                   = 0;
+    m_stat_device_upload_bytes               = 0;
+    m_stat_device_uploads                    = 0;
+    m_stat_device_programs_compiled          = 0;
+    m_stat_device_programs_shared            = 0;
+    m_stat_shared_ops_linked                 = 0;
+    m_stat_shared_constants                  = 0;
+    m_stat_groups_shared                     = 0;
+    m_stat_fold_memo_hits                    = 0;
+    m_stat_batched_analysis_memo_hits        = 0;
+    m_stat_lazy_layers_deferred              = 0;
+    m_stat_lazy_layers_jitted                = 0;
+    m_stat_parallel_codegens                 = 0;
+    m_stat_pgo_instrumented                  = 0;
+    m_stat_pgo_applied                       = 0;
     m_stat_merged_inst                       = 0;
     m_stat_merged_inst_opt                   = 0;
     m_stat_empty_groups                      = 0;
@@ -1176,6 +1798,9 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
     m_stat_preopt_ops                        = 0;
     m_stat_postopt_ops                       = 0;
     m_stat_middlemen_eliminated              = 0;
+    m_stat_sccp_constants                    = 0;
+    m_stat_noise_calls_shared                = 0;
+    m_stat_derivs_removed                    = 0;
     m_stat_const_connections                 = 0;
     m_stat_global_connections                = 0;
     m_stat_tex_calls_codegened               = 0;
@@ -1201,6 +1826,24 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
     m_stat_reparam_bytes_total               = 0;
     m_stat_reparam_calls_changed             = 0;
     m_stat_reparam_bytes_changed             = 0;
+    m_stat_reparam_rebuilds                  = 0;
+    m_stat_groups_evicted                    = 0;
+    m_stat_memory_evicted                    = 0;
+    m_stat_output_variants                   = 0;
+    m_stat_raytype_variants                  = 0;
+    m_stat_debug_variants                    = 0;
+    m_stat_userdata_variants                 = 0;
+    m_stat_userdata_misses                   = 0;
+    m_stat_traces_deferred                   = 0;
+    m_stat_traces_strayed                    = 0;
+    m_stat_formed_batches                    = 0;
+    m_stat_formed_points                     = 0;
+    m_stat_routed_batched                    = 0;
+    m_stat_routed_scalar                     = 0;
+    m_stat_uniform_batches                   = 0;
+    m_stat_attribute_gathers                 = 0;
+    m_stat_attribute_cache_hits              = 0;
+    m_stat_closure_pool_trims                = 0;
 
     m_groups_to_compile_count     = 0;
     m_threads_currently_compiling = 0;
@@ -1262,6 +1905,8 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
     setup_op_descriptors();
 
     colorsystem().set_colorspace(ustringhash_from(m_colorspace));
+
+    m_stat_startup_time = timer();
 }
 
 
@@ -1270,6 +1915,7 @@ static void
 shading_system_setup_op_descriptors(
     ShadingSystemImpl::OpDescriptorMap& op_descriptor)
 {
+    // Only called once per process, from setup_op_descriptors().
     // clang-format off
 #if OSL_USE_BATCHED
 #define OP2(alias,name,ll,fold,simp,flag)                                \
@@ -1329,9 +1975,9 @@ shading_system_setup_op_descriptors(
     OP (cross,       generic,             none,          true,      0);
     OP (degrees,     generic,             degrees,       true,      0);
     OP (determinant, generic,             none,          true,      0);
-    OP (dict_find,   dict_find,           none,          false,     0);
+    OP (dict_find,   dict_find,           dict_find,     false,     0);
     OP (dict_next,   dict_next,           none,          false,     0);
-    OP (dict_value,  dict_value,          none,          false,     0);
+    OP (dict_value,  dict_value,          dict_value,    false,     0);
     OP (distance,    generic,             none,          true,      0);
     OP (div,         div,                 div,           true,      0);
     OP (dot,         generic,             dot,           true,      0);
@@ -1467,10 +2113,18 @@ shading_system_setup_op_descriptors(
 void
 ShadingSystemImpl::setup_op_descriptors()
 {
-    // This is not a class member function to avoid namespace issues
-    // with function declarations in the function body, when building
-    // with visual studio.
-    shading_system_setup_op_descriptors(m_op_descriptor);
+    // The table never changes, so every ShadingSystem shares one, made
+    // when the first is constructed, rather than each building its own
+    // map and a ustring per op name.
+    static const OpDescriptorMap op_descriptor_table = []() {
+        OpDescriptorMap table;
+        // This is not a class member function to avoid namespace issues
+        // with function declarations in the function body, when building
+        // with visual studio.
+        shading_system_setup_op_descriptors(table);
+        return table;
+    }();
+    m_op_descriptor = &op_descriptor_table;
 }
 
 
@@ -1521,6 +2175,11 @@ ShadingSystemImpl::query_closure(const char** name, int* id,
 
 ShadingSystemImpl::~ShadingSystemImpl()
 {
+    set_stats_callback(ShadingSystem::StatsFunc());
+    stop_background_jit();
+    if (m_llvm_pgo == 1 && m_llvm_pgo_dir.size())
+        save_branch_profiles();
+
     size_t ngroups = m_all_shader_groups.size();
     for (size_t i = 0; i < ngroups; ++i) {
         if (ShaderGroupRef g = m_all_shader_groups[i].lock()) {
@@ -1533,7 +2192,18 @@ ShadingSystemImpl::~ShadingSystemImpl()
         }
     }
 
+    // Save the point clouds that shaders wrote while our error handler is
+    // still here to hear of any failure.
+    save_pointclouds();
+
     printstats();
+
+    // Thread infos that outlive us mustn't report back to us
+    {
+        spin_lock lock(m_thread_profiles_mutex);
+        for (ThreadProfile* profile : m_thread_profiles)
+            profile->shadingsys = nullptr;
+    }
     // N.B. just let m_texsys go -- if we asked for one to be created,
     // we asked for a shared one.
 
@@ -1579,6 +2249,37 @@ osl_simd_caps()
 
 
 
+// Does the named option change how the first optimization pass leaves a
+// layer, outdating the layers memoized by "opt_fold_memo"?
+static bool
+option_affects_folding(string_view name)
+{
+    if (Strutil::starts_with(name, "opt_"))
+        return name != "opt_fold_memo";
+    static const char* names[] = { "optimize",
+                                   "optimize_nondebug",
+                                   "debug",
+                                   "debug_uninit",
+                                   "range_checking",
+                                   "lockgeom",
+                                   "lazyerror",
+                                   "force_derivs",
+                                   "userdata_isconnected",
+                                   "strict_messages",
+                                   "unknown_coordsys_error",
+                                   "gpu_opt_error",
+                                   "commonspace",
+                                   "colorspace",
+                                   "raytypes",
+                                   "renderer_outputs" };
+    for (const char* n : names)
+        if (name == n)
+            return true;
+    return false;
+}
+
+
+
 bool
 ShadingSystemImpl::attribute(string_view name, TypeDesc type, const void* val)
 {
@@ -1603,8 +2304,16 @@ ShadingSystemImpl::attribute(string_view name, TypeDesc type, const void* val)
         return OIIO::optparser(*this, *(const char**)val);
     }
 
-    lock_guard guard(m_mutex);  // Thread safety
+    // Writers are serialized by m_options_mutex, which getattribute only
+    // takes to read string options, and which shader loading and group
+    // construction (guarded by m_mutex) don't take at all.
+    OIIO::spin_rw_write_lock guard(m_options_mutex);
+    if (option_affects_folding(name)) {
+        spin_lock lock(m_folded_layers_mutex);
+        m_folded_layers.clear();
+    }
     ATTR_SET("statistics:level", int, m_statslevel);
+    ATTR_SET("statistics:slowest_groups", int, m_stats_slowest_groups);
     ATTR_SET("debug", int, m_debug);
     ATTR_SET("lazylayers", int, m_lazylayers);
     ATTR_SET("lazyglobals", int, m_lazyglobals);
@@ -1613,6 +2322,7 @@ ShadingSystemImpl::attribute(string_view name, TypeDesc type, const void* val)
     ATTR_SET("lazytrace", int, m_lazy_trace);
     ATTR_SET("lazy_userdata", int, m_lazy_userdata);
     ATTR_SET("userdata_isconnected", int, m_userdata_isconnected);
+    ATTR_SET("reparam_rebuild", int, m_reparam_rebuild);
     ATTR_SET("clearmemory", int, m_clearmemory);
     ATTR_SET("debug_nan", int, m_debugnan);
     ATTR_SET("debugnan", int, m_debugnan);  // back-compatible alias
@@ -1633,18 +2343,54 @@ ShadingSystemImpl::attribute(string_view name, TypeDesc type, const void* val)
     ATTR_SET("opt_merge_instances", int, m_opt_merge_instances);
     ATTR_SET("opt_merge_instances_with_userdata", int,
              m_opt_merge_instances_with_userdata);
+    ATTR_SET("opt_share_groups", int, m_opt_share_groups);
     ATTR_SET("opt_fold_getattribute", int, m_opt_fold_getattribute);
+    ATTR_SET("opt_fold_dict", int, m_opt_fold_dict);
     ATTR_SET("opt_middleman", int, m_opt_middleman);
+    ATTR_SET("opt_sccp", int, m_opt_sccp);
+    ATTR_SET("opt_licm", int, m_opt_licm);
+    ATTR_SET("opt_loop_unroll", int, m_opt_loop_unroll);
+    ATTR_SET("opt_deriv_demand", int, m_opt_deriv_demand);
+    ATTR_SET("opt_noise_memo", int, m_opt_noise_memo);
+    ATTR_SET("opt_fold_memo", int, m_opt_fold_memo);
     ATTR_SET("opt_texture_handle", int, m_opt_texture_handle);
+    ATTR_SET("opt_texture_fusion", int, m_opt_texture_fusion);
+    ATTR_SET("opt_hoist_transforms", int, m_opt_hoist_transforms);
     ATTR_SET("opt_seed_bblock_aliases", int, m_opt_seed_bblock_aliases);
     ATTR_SET("opt_useparam", int, m_opt_useparam);
     ATTR_SET("opt_groupdata", int, m_opt_groupdata);
+    ATTR_SET("opt_groupdata_hot", int, m_opt_groupdata_hot);
+    ATTR_SET("opt_groupdata_share", int, m_opt_groupdata_share);
+    ATTR_SET("opt_readonly_params", int, m_opt_readonly_params);
     ATTR_SET("opt_batched_analysis", int, m_opt_batched_analysis);
+    ATTR_SET("opt_batched_analysis_memo", int, m_opt_batched_analysis_memo);
+    ATTR_SET("batch_autoselect", int, m_batch_autoselect);
+    ATTR_SET("batch_uniform_scalar", int, m_batch_uniform_scalar);
+    ATTR_SET("batched_attribute_cache", int, m_batched_attribute_cache);
     ATTR_SET("llvm_jit_fma", int, m_llvm_jit_fma);
     ATTR_SET("llvm_jit_aggressive", int, m_llvm_jit_aggressive);
     ATTR_SET_STRING("llvm_jit_target", m_llvm_jit_target);
+    ATTR_SET_STRING("llvm_jit_cache_dir", m_llvm_jit_cache_dir);
+    ATTR_SET_STRING("llvm_jit_isas", m_llvm_jit_isas);
+    ATTR_SET_STRING("opt_snapshot_dir", m_opt_snapshot_dir);
+    ATTR_SET("llvm_jit_tiered", int, m_llvm_jit_tiered);
+    ATTR_SET("llvm_jit_threads", int, m_llvm_jit_threads);
+    ATTR_SET("llvm_jit_lazy_entry", int, m_llvm_jit_lazy_entry);
+    ATTR_SET("llvm_jit_group_memory", int, m_llvm_jit_group_memory);
+    if (name == "llvm_jit_huge_pages" && type == TypeDesc::INT) {
+        m_llvm_jit_huge_pages = *(const int*)val;
+        LLVM_Util::jit_huge_pages(m_llvm_jit_huge_pages);
+        return true;
+    }
+    ATTR_SET("llvm_pgo", int, m_llvm_pgo);
+    ATTR_SET_STRING("llvm_pgo_dir", m_llvm_pgo_dir);
+    ATTR_SET("llvm_layer_inline", int, m_llvm_layer_inline);
+    ATTR_SET("llvm_layer_noinline", int, m_llvm_layer_noinline);
+    ATTR_SET("llvm_shared_ops", int, m_llvm_shared_ops);
+    ATTR_SET("llvm_shared_constants", int, m_llvm_shared_constants);
     ATTR_SET("vector_width", int, m_vector_width);
     ATTR_SET("opt_passes", int, m_opt_passes);
+    ATTR_SET("opt_threads", int, m_opt_threads);
     ATTR_SET("optimize_nondebug", int, m_optimize_nondebug);
     ATTR_SET("llvm_optimize", int, m_llvm_optimize);
     ATTR_SET("llvm_debug", int, m_llvm_debug);
@@ -1666,21 +2412,52 @@ ShadingSystemImpl::attribute(string_view name, TypeDesc type, const void* val)
              m_shading_state_uniform.m_unknown_coordsys_error);
     ATTR_SET("connection_error", int, m_connection_error);
     ATTR_SET("greedyjit", int, m_greedyjit);
+    ATTR_SET("texture_prefetch", int, m_texture_prefetch);
+    ATTR_SET("memory_budget", float, m_memory_budget);
+    ATTR_SET("memory_budget", int, m_memory_budget);
+    ATTR_SET("udim_tile_cache", int, m_udim_tile_cache);
     ATTR_SET("relaxed_param_typecheck", int, m_relaxed_param_typecheck);
     ATTR_SET("countlayerexecs", int, m_countlayerexecs);
     ATTR_SET("max_warnings_per_thread", int,
              m_shading_state_uniform.m_max_warnings_per_thread);
     ATTR_SET("max_local_mem_KB", int, m_max_local_mem_KB);
+    ATTR_SET("closure_pool_max_KB", int, m_closure_pool_max_KB);
+    ATTR_SET("context_heap_presize", int, m_context_heap_presize);
+    ATTR_SET("telemetry_interval", int, m_telemetry_interval);
+    ATTR_SET("pmu_interval", int, m_pmu_interval);
+    ATTR_SET("stats_interval", float, m_stats_interval);
+    ATTR_SET("stats_interval", int, m_stats_interval);
     ATTR_SET("compile_report", int, m_compile_report);
     ATTR_SET("max_optix_groupdata_alloc", int, m_max_optix_groupdata_alloc);
+    ATTR_SET("optix_wavefront", int, m_optix_wavefront);
+    ATTR_SET("optix_split_threshold", int, m_optix_split_threshold);
+    ATTR_SET("optix_host_jit", int, m_optix_host_jit);
+    if (name == "optix_target_arch" && type == TypeDesc::STRING) {
+        // A different arch needs the shadeops compiled again
+        std::lock_guard<std::mutex> lock(m_shadeops_ptx_mutex);
+        m_optix_target_arch = ustring(*(const char**)val);
+        m_shadeops_ptx.clear();
+        return true;
+    }
+    ATTR_SET("device_arena_size", int, m_device_arena_size);
+    ATTR_SET("async_device_copies", int, m_async_device_copies);
     ATTR_SET("buffer_printf", int, m_buffer_printf);
+    ATTR_SET("defer_printf", int, m_defer_printf);
     ATTR_SET("no_noise", int, m_no_noise);
+    ATTR_SET_STRING("noise_hash", m_noise_hash);
+    ATTR_SET_STRING("math_precision", m_math_precision);
     ATTR_SET("no_pointcloud", int, m_no_pointcloud);
+    ATTR_SET_STRING("pointcloud_index", m_pointcloud_index);
     ATTR_SET("force_derivs", int, m_force_derivs);
     ATTR_SET("allow_shader_replacement", int, m_allow_shader_replacement);
     ATTR_SET("exec_repeat", int, m_exec_repeat);
+    ATTR_SET("raytype_variants", int, m_raytype_variants);
+    ATTR_SET("userdata_variants", int, m_userdata_variants);
+    ATTR_SET("debug_sample_interval", int, m_debug_sample_interval);
+    ATTR_SET_STRING("debug_sample_raytype", m_debug_sample_raytype);
     ATTR_SET("opt_warnings", int, m_opt_warnings);
     ATTR_SET("gpu_opt_error", int, m_gpu_opt_error);
+    ATTR_SET("opt_report", int, m_opt_report);
     ATTR_SET("optix_no_inline", int, m_optix_no_inline);
     ATTR_SET("optix_no_inline_layer_funcs", int, m_optix_no_inline_layer_funcs);
     ATTR_SET("optix_merge_layer_funcs", int, m_optix_merge_layer_funcs);
@@ -1690,6 +2467,7 @@ ShadingSystemImpl::attribute(string_view name, TypeDesc type, const void* val)
     ATTR_SET_STRINGHASH("commonspace",
                         m_shading_state_uniform.m_commonspace_synonym);
     ATTR_SET_STRING("debug_groupname", m_debug_groupname);
+    ATTR_SET_STRING("coherence_param", m_coherence_param);
     ATTR_SET_STRING("debug_layername", m_debug_layername);
     ATTR_SET_STRING("opt_layername", m_opt_layername);
     ATTR_SET_STRING("only_groupname", m_only_groupname);
@@ -1699,7 +2477,27 @@ ShadingSystemImpl::attribute(string_view name, TypeDesc type, const void* val)
     // cases for special handling
     if (name == "searchpath:shader" && type == TypeDesc::STRING) {
         m_searchpath = std::string(*(const char**)val);
-        OIIO::Filesystem::searchpath_split(m_searchpath, m_searchpath_dirs);
+        std::vector<std::string> dirs;
+        OIIO::Filesystem::searchpath_split(m_searchpath, dirs);
+        lock_guard guard(m_mutex);  // loadshader may be reading the dirs
+        m_searchpath_dirs.swap(dirs);
+        return true;
+    }
+    if (name == "searchpath:bundle" && type == TypeDesc::STRING) {
+        m_bundle_searchpath = std::string(*(const char**)val);
+        std::vector<std::string> files;
+        OIIO::Filesystem::searchpath_split(m_bundle_searchpath, files);
+        std::vector<std::shared_ptr<ShaderBundle>> bundles;
+        for (const std::string& file : files) {
+            auto bundle = std::make_shared<ShaderBundle>();
+            std::string err;
+            if (bundle->open(file, err))
+                bundles.push_back(bundle);
+            else
+                errorfmt("{}", err);
+        }
+        lock_guard guard(m_mutex);  // loadshader may be reading m_bundles
+        m_bundles.swap(bundles);
         return true;
     }
     if (name == "searchpath:library" && type == TypeDesc::STRING) {
@@ -1760,6 +2558,7 @@ ShadingSystemImpl::attribute(string_view name, TypeDesc type, const void* val)
     if (name == "error_repeats") {
         // Special case: setting error_repeats also clears the "previously
         // seen" error and warning lists.
+        lock_guard errguard(m_errmutex);
         m_errseen.clear();
         m_warnseen.clear();
         ATTR_SET("error_repeats", int, m_error_repeats);
@@ -1780,29 +2579,39 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
         *(_ctype*)(val) = (_ctype)(_src);                              \
         return true;                                                   \
     }
-#define ATTR_DECODE_STRING(_name, _src)              \
-    if (name == _name && type == TypeDesc::STRING) { \
-        *(const char**)(val) = _src.c_str();         \
-        return true;                                 \
+    // Scalar options are read without locking, as the shading code reads
+    // them. A string option is read under a read lock of m_options_mutex,
+    // so that it isn't caught half-assigned, and handed back as a ustring
+    // so the pointer stays good after the lock is dropped.
+#define ATTR_DECODE_STRING(_name, _src)                    \
+    if (name == _name && type == TypeDesc::STRING) {       \
+        OIIO::spin_rw_read_lock lock(m_options_mutex);     \
+        *(const char**)(val) = ustring(_src).c_str();      \
+        return true;                                       \
     }
 
 #define ATTR_DECODE_STRINGHASH(_name, _src)                \
     if (name == _name && type == TypeDesc::STRING) {       \
+        OIIO::spin_rw_read_lock lock(m_options_mutex);     \
         *(const char**)(val) = ustring_from(_src).c_str(); \
         return true;                                       \
     }
 
-    lock_guard guard(m_mutex);  // Thread safety
-
     ATTR_DECODE_STRING("searchpath:shader", m_searchpath);
+    ATTR_DECODE_STRING("searchpath:bundle", m_bundle_searchpath);
     ATTR_DECODE_STRING("searchpath:library", m_library_searchpath);
     ATTR_DECODE("statistics:level", int, m_statslevel);
+    ATTR_DECODE("statistics:slowest_groups", int, m_stats_slowest_groups);
+    ATTR_DECODE_STRING("stat:slowest_groups",
+                       ustring(slowest_groups_report(m_stats_slowest_groups)));
+    ATTR_DECODE_STRING("stat:json", ustring(stats_json()));
     ATTR_DECODE("lazylayers", int, m_lazylayers);
     ATTR_DECODE("lazyglobals", int, m_lazyglobals);
     ATTR_DECODE("lazyunconnected", int, m_lazyunconnected);
     ATTR_DECODE("lazytrace", int, m_lazy_trace);
     ATTR_DECODE("lazy_userdata", int, m_lazy_userdata);
     ATTR_DECODE("userdata_isconnected", int, m_userdata_isconnected);
+    ATTR_DECODE("reparam_rebuild", int, m_reparam_rebuild);
     ATTR_DECODE("clearmemory", int, m_clearmemory);
     ATTR_DECODE("debug_nan", int, m_debugnan);
     ATTR_DECODE("debugnan", int, m_debugnan);  // back-compatible alias
@@ -1823,18 +2632,50 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
     ATTR_DECODE("opt_merge_instances", int, m_opt_merge_instances);
     ATTR_DECODE("opt_merge_instances_with_userdata", int,
                 m_opt_merge_instances_with_userdata);
+    ATTR_DECODE("opt_share_groups", int, m_opt_share_groups);
     ATTR_DECODE("opt_fold_getattribute", int, m_opt_fold_getattribute);
+    ATTR_DECODE("opt_fold_dict", int, m_opt_fold_dict);
     ATTR_DECODE("opt_middleman", int, m_opt_middleman);
+    ATTR_DECODE("opt_sccp", int, m_opt_sccp);
+    ATTR_DECODE("opt_licm", int, m_opt_licm);
+    ATTR_DECODE("opt_loop_unroll", int, m_opt_loop_unroll);
+    ATTR_DECODE("opt_deriv_demand", int, m_opt_deriv_demand);
+    ATTR_DECODE("opt_noise_memo", int, m_opt_noise_memo);
+    ATTR_DECODE("opt_fold_memo", int, m_opt_fold_memo);
     ATTR_DECODE("opt_texture_handle", int, m_opt_texture_handle);
+    ATTR_DECODE("opt_texture_fusion", int, m_opt_texture_fusion);
+    ATTR_DECODE("opt_hoist_transforms", int, m_opt_hoist_transforms);
     ATTR_DECODE("opt_seed_bblock_aliases", int, m_opt_seed_bblock_aliases);
     ATTR_DECODE("opt_useparam", int, m_opt_useparam);
     ATTR_DECODE("opt_groupdata", int, m_opt_groupdata);
+    ATTR_DECODE("opt_groupdata_hot", int, m_opt_groupdata_hot);
+    ATTR_DECODE("opt_groupdata_share", int, m_opt_groupdata_share);
+    ATTR_DECODE("opt_readonly_params", int, m_opt_readonly_params);
     ATTR_DECODE("opt_batched_analysis", int, m_opt_batched_analysis);
+    ATTR_DECODE("opt_batched_analysis_memo", int, m_opt_batched_analysis_memo);
+    ATTR_DECODE("batch_autoselect", int, m_batch_autoselect);
+    ATTR_DECODE("batch_uniform_scalar", int, m_batch_uniform_scalar);
+    ATTR_DECODE("batched_attribute_cache", int, m_batched_attribute_cache);
     ATTR_DECODE("llvm_jit_fma", int, m_llvm_jit_fma);
     ATTR_DECODE("llvm_jit_aggressive", int, m_llvm_jit_aggressive);
     ATTR_DECODE_STRING("llvm_jit_target", m_llvm_jit_target);
+    ATTR_DECODE_STRING("llvm_jit_cache_dir", m_llvm_jit_cache_dir);
+    ATTR_DECODE_STRING("llvm_jit_isas", m_llvm_jit_isas);
+    ATTR_DECODE_STRING("opt_snapshot_dir", m_opt_snapshot_dir);
+    ATTR_DECODE("llvm_jit_tiered", int, m_llvm_jit_tiered);
+    ATTR_DECODE("llvm_jit_threads", int, m_llvm_jit_threads);
+    ATTR_DECODE("llvm_jit_lazy_entry", int, m_llvm_jit_lazy_entry);
+    ATTR_DECODE("llvm_jit_group_memory", int, m_llvm_jit_group_memory);
+    ATTR_DECODE("llvm_jit_huge_pages", int, m_llvm_jit_huge_pages);
+    ATTR_DECODE("llvm_pgo", int, m_llvm_pgo);
+    ATTR_DECODE_STRING("llvm_pgo_dir", m_llvm_pgo_dir);
+    ATTR_DECODE("llvm_layer_inline", int, m_llvm_layer_inline);
+    ATTR_DECODE("llvm_layer_noinline", int, m_llvm_layer_noinline);
+    ATTR_DECODE("llvm_shared_ops", int, m_llvm_shared_ops);
+    ATTR_DECODE("llvm_shared_constants", int, m_llvm_shared_constants);
     ATTR_DECODE("vector_width", int, m_vector_width);
     ATTR_DECODE("opt_passes", int, m_opt_passes);
+    ATTR_DECODE("opt_threads", int, m_opt_threads);
     ATTR_DECODE("optimize_nondebug", int, m_optimize_nondebug);
     ATTR_DECODE("llvm_optimize", int, m_llvm_optimize);
     ATTR_DECODE("debug", int, m_debug);
@@ -1857,6 +2698,10 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
                 m_shading_state_uniform.m_unknown_coordsys_error);
     ATTR_DECODE("connection_error", int, m_connection_error);
     ATTR_DECODE("greedyjit", int, m_greedyjit);
+    ATTR_DECODE("texture_prefetch", int, m_texture_prefetch);
+    ATTR_DECODE("memory_budget", float, m_memory_budget);
+    ATTR_DECODE("memory_budget", int, m_memory_budget);
+    ATTR_DECODE("udim_tile_cache", int, m_udim_tile_cache);
     ATTR_DECODE("countlayerexecs", int, m_countlayerexecs);
     ATTR_DECODE("relaxed_param_typecheck", int, m_relaxed_param_typecheck);
     ATTR_DECODE("max_warnings_per_thread", int,
@@ -1871,16 +2716,44 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
     ATTR_DECODE_STRING("archive_groupname", m_archive_groupname);
     ATTR_DECODE_STRING("archive_filename", m_archive_filename);
     ATTR_DECODE("max_local_mem_KB", int, m_max_local_mem_KB);
+    ATTR_DECODE("closure_pool_max_KB", int, m_closure_pool_max_KB);
+    ATTR_DECODE("context_heap_presize", int, m_context_heap_presize);
+    ATTR_DECODE("telemetry_interval", int, m_telemetry_interval);
+    ATTR_DECODE("pmu_interval", int, m_pmu_interval);
+    ATTR_DECODE("stats_interval", float, m_stats_interval);
     ATTR_DECODE("compile_report", int, m_compile_report);
     ATTR_DECODE("max_optix_groupdata_alloc", int, m_max_optix_groupdata_alloc);
+    ATTR_DECODE("optix_wavefront", int, m_optix_wavefront);
+    ATTR_DECODE("optix_split_threshold", int, m_optix_split_threshold);
+    ATTR_DECODE("optix_host_jit", int, m_optix_host_jit);
+    ATTR_DECODE_STRING("optix_target_arch", m_optix_target_arch);
+    ATTR_DECODE_STRING("coherence_param", m_coherence_param);
+    ATTR_DECODE("device_arena_size", int, m_device_arena_size);
+    ATTR_DECODE("async_device_copies", int, m_async_device_copies);
+    ATTR_DECODE("stat:device_upload_bytes", long long,
+                m_stat_device_upload_bytes);
+    ATTR_DECODE("stat:device_uploads", int, m_stat_device_uploads);
+    ATTR_DECODE("stat:device_programs_compiled", int,
+                m_stat_device_programs_compiled);
+    ATTR_DECODE("stat:device_programs_shared", int,
+                m_stat_device_programs_shared);
     ATTR_DECODE("buffer_printf", int, m_buffer_printf);
+    ATTR_DECODE("defer_printf", int, m_defer_printf);
     ATTR_DECODE("no_noise", int, m_no_noise);
+    ATTR_DECODE_STRING("noise_hash", m_noise_hash);
+    ATTR_DECODE_STRING("math_precision", m_math_precision);
     ATTR_DECODE("no_pointcloud", int, m_no_pointcloud);
+    ATTR_DECODE_STRING("pointcloud_index", m_pointcloud_index);
     ATTR_DECODE("force_derivs", int, m_force_derivs);
     ATTR_DECODE("allow_shader_replacement", int, m_allow_shader_replacement);
     ATTR_DECODE("exec_repeat", int, m_exec_repeat);
+    ATTR_DECODE("raytype_variants", int, m_raytype_variants);
+    ATTR_DECODE("userdata_variants", int, m_userdata_variants);
+    ATTR_DECODE("debug_sample_interval", int, m_debug_sample_interval);
+    ATTR_DECODE_STRING("debug_sample_raytype", m_debug_sample_raytype);
     ATTR_DECODE("opt_warnings", int, m_opt_warnings);
     ATTR_DECODE("gpu_opt_error", int, m_gpu_opt_error);
+    ATTR_DECODE("opt_report", int, m_opt_report);
     ATTR_DECODE("optix_no_inline", int, m_optix_no_inline);
     ATTR_DECODE("optix_no_inline_layer_funcs", int,
                 m_optix_no_inline_layer_funcs);
@@ -1894,6 +2767,25 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
     ATTR_DECODE("stat:instances_compiled", int, m_stat_instances_compiled);
     ATTR_DECODE("stat:groups_compiled", int, m_stat_groups_compiled);
     ATTR_DECODE("stat:empty_instances", int, m_stat_empty_instances);
+    ATTR_DECODE("stat:jit_cache_hits", int, m_stat_jit_cache_hits);
+    ATTR_DECODE("stat:jit_cache_misses", int, m_stat_jit_cache_misses);
+    ATTR_DECODE("stat:jit_cache_variants", int, m_stat_jit_cache_variants);
+    ATTR_DECODE("stat:snapshots_loaded", int, m_stat_snapshots_loaded);
+    ATTR_DECODE("stat:snapshots_saved", int, m_stat_snapshots_saved);
+    ATTR_DECODE("stat:background_jits", int, m_stat_background_jits);
+    ATTR_DECODE("stat:optix_split_groups", int, m_stat_optix_split_groups);
+    ATTR_DECODE("stat:optix_host_jits", int, m_stat_optix_host_jits);
+    ATTR_DECODE("stat:groups_shared", int, m_stat_groups_shared);
+    ATTR_DECODE("stat:fold_memo_hits", int, m_stat_fold_memo_hits);
+    ATTR_DECODE("stat:batched_analysis_memo_hits", int,
+                m_stat_batched_analysis_memo_hits);
+    ATTR_DECODE("stat:shared_ops_linked", int, m_stat_shared_ops_linked);
+    ATTR_DECODE("stat:shared_constants", int, m_stat_shared_constants);
+    ATTR_DECODE("stat:lazy_layers_deferred", int, m_stat_lazy_layers_deferred);
+    ATTR_DECODE("stat:lazy_layers_jitted", int, m_stat_lazy_layers_jitted);
+    ATTR_DECODE("stat:parallel_codegens", int, m_stat_parallel_codegens);
+    ATTR_DECODE("stat:pgo_instrumented", int, m_stat_pgo_instrumented);
+    ATTR_DECODE("stat:pgo_applied", int, m_stat_pgo_applied);
     ATTR_DECODE("stat:merged_inst", int, m_stat_merged_inst);
     ATTR_DECODE("stat:merged_inst_opt", int, m_stat_merged_inst_opt);
     ATTR_DECODE("stat:empty_groups", int, m_stat_empty_groups);
@@ -1905,12 +2797,16 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
     ATTR_DECODE("stat:preopt_ops", int, m_stat_preopt_ops);
     ATTR_DECODE("stat:postopt_ops", int, m_stat_postopt_ops);
     ATTR_DECODE("stat:middlemen_eliminated", int, m_stat_middlemen_eliminated);
+    ATTR_DECODE("stat:sccp_constants", int, m_stat_sccp_constants);
+    ATTR_DECODE("stat:noise_calls_shared", int, m_stat_noise_calls_shared);
+    ATTR_DECODE("stat:derivs_removed", int, m_stat_derivs_removed);
     ATTR_DECODE("stat:const_connections", int, m_stat_const_connections);
     ATTR_DECODE("stat:global_connections", int, m_stat_global_connections);
     ATTR_DECODE("stat:tex_calls_codegened", int, m_stat_tex_calls_codegened);
     ATTR_DECODE("stat:tex_calls_as_handles", int, m_stat_tex_calls_as_handles);
     ATTR_DECODE("stat:useparam_ops", int, m_stat_useparam_ops);
     ATTR_DECODE("stat:call_layers_inserted", int, m_stat_call_layers_inserted);
+    ATTR_DECODE("stat:startup_time", float, m_stat_startup_time);
     ATTR_DECODE("stat:master_load_time", float, m_stat_master_load_time);
     ATTR_DECODE("stat:optimization_time", float, m_stat_optimization_time);
     ATTR_DECODE("stat:opt_locking_time", float, m_stat_opt_locking_time);
@@ -1943,6 +2839,28 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
                 m_stat_reparam_calls_changed);
     ATTR_DECODE("stat:reparam_bytes_changed", long long,
                 m_stat_reparam_bytes_changed);
+    ATTR_DECODE("stat:reparam_rebuilds", long long, m_stat_reparam_rebuilds);
+    ATTR_DECODE("stat:groups_evicted", long long, m_stat_groups_evicted);
+    ATTR_DECODE("stat:memory_evicted", long long, m_stat_memory_evicted);
+    ATTR_DECODE("stat:output_variants", int, m_stat_output_variants);
+    ATTR_DECODE("stat:raytype_variants", int, m_stat_raytype_variants);
+    ATTR_DECODE("stat:debug_variants", int, m_stat_debug_variants);
+    ATTR_DECODE("stat:userdata_variants", int, m_stat_userdata_variants);
+    ATTR_DECODE("stat:userdata_misses", long long, m_stat_userdata_misses);
+    ATTR_DECODE("stat:traces_deferred", long long, m_stat_traces_deferred);
+    ATTR_DECODE("stat:traces_strayed", long long, m_stat_traces_strayed);
+    ATTR_DECODE("stat:formed_batches", long long, m_stat_formed_batches);
+    ATTR_DECODE("stat:formed_points", long long, m_stat_formed_points);
+    ATTR_DECODE("stat:routed_batched", int, m_stat_routed_batched);
+    ATTR_DECODE("stat:routed_scalar", int, m_stat_routed_scalar);
+    ATTR_DECODE("stat:uniform_batches", long long, m_stat_uniform_batches);
+    ATTR_DECODE("stat:attribute_gathers", long long,
+                m_stat_attribute_gathers);
+    ATTR_DECODE("stat:attribute_cache_hits", long long,
+                m_stat_attribute_cache_hits);
+    ATTR_DECODE("stat:closure_pool_trims", long long,
+                m_stat_closure_pool_trims);
+    ATTR_DECODE("stat:max_groupdata_size", long long, m_max_groupdata_size);
     ATTR_DECODE("stat:memory_current", long long, m_stat_memory.current());
     ATTR_DECODE("stat:memory_peak", long long, m_stat_memory.peak());
     ATTR_DECODE("stat:mem_master_current", long long,
@@ -1982,6 +2900,10 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
                 m_stat_mem_inst_connections.current());
     ATTR_DECODE("stat:mem_inst_connections_peak", long long,
                 m_stat_mem_inst_connections.peak());
+    ATTR_DECODE("stat:mem_closures_current", long long,
+                m_stat_mem_closures.current());
+    ATTR_DECODE("stat:mem_closures_peak", long long,
+                m_stat_mem_closures.peak());
 
     if (name == "colorsystem" && type.basetype == TypeDesc::PTR) {
         *(void**)val = &colorsystem();
@@ -2034,13 +2956,35 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
         return true;
     }
 #ifdef OSL_LLVM_CUDA_BITCODE
-    if (name == "shadeops_cuda_ptx" && type.basetype == TypeDesc::PTR) {
-        *(const char**)val = reinterpret_cast<const char*>(
+    if ((name == "shadeops_cuda_ptx" && type.basetype == TypeDesc::PTR)
+        || (name == "shadeops_cuda_ptx_size"
+            && type.basetype == TypeDesc::INT)) {
+        const char* ptx = reinterpret_cast<const char*>(
             shadeops_cuda_ptx_compiled_ops_block);
-        return true;
-    }
-    if (name == "shadeops_cuda_ptx_size" && type.basetype == TypeDesc::INT) {
-        *(int*)val = shadeops_cuda_ptx_compiled_ops_size;
+        int size = shadeops_cuda_ptx_compiled_ops_size;
+        ustring target_arch;
+        {
+            OIIO::spin_rw_read_lock lock(m_options_mutex);
+            target_arch = m_optix_target_arch;
+        }
+        if (target_arch.size() && target_arch != CUDA_TARGET_ARCH) {
+            // Compile the ops for the requested arch, once.
+            std::lock_guard<std::mutex> lock(m_shadeops_ptx_mutex);
+            if (m_shadeops_ptx.empty()) {
+                PerThreadInfo* threadinfo = create_thread_info();
+                if (!compile_shadeops_ptx(threadinfo->llvm_thread_info,
+                                          target_arch, m_shadeops_ptx))
+                    errorfmt("Could not compile the shadeops for {}",
+                             target_arch);
+                destroy_thread_info(threadinfo);
+            }
+            ptx  = m_shadeops_ptx.c_str();
+            size = int(m_shadeops_ptx.size());
+        }
+        if (type.basetype == TypeDesc::PTR)
+            *(const char**)val = ptx;
+        else
+            *(int*)val = size;
         return true;
     }
 #endif
@@ -2076,15 +3020,107 @@ ShadingSystemImpl::attribute(ShaderGroup* group, string_view name,
         group->m_exec_repeat = *(const int*)val;
         return true;
     }
+    if (name == "math_precision" && type == TypeString) {
+        group->m_math_precision = ustring(((const char**)val)[0]);
+        return true;
+    }
     if (name == "groupname" && type == TypeString) {
         group->name(ustring(((const char**)val)[0]));
         return true;
     }
+    if (name == "gpu_registers" && type == TypeInt) {
+        group->m_gpu_registers = *(const int*)val;
+        return true;
+    }
+    if (name == "gpu_spill_bytes" && type == TypeInt) {
+        group->m_gpu_spill_bytes = *(const int*)val;
+        return true;
+    }
+    if (name == "gpu_compile_log" && type == TypeString) {
+        // Take the counts from ptxas-style lines of an OptiX (or NVRTC)
+        // compile log, "Used N registers" and "N bytes spill stores",
+        // keeping the largest of each.
+        string_view log(((const char**)val)[0]);
+        while (log.size()) {
+            string_view line = Strutil::parse_line(log);
+            string_view s;
+            int n;
+            size_t used = line.find("Used ");
+            if (used != string_view::npos) {
+                s = line.substr(used + 5);
+                if (Strutil::parse_int(s, n)
+                    && Strutil::parse_prefix(s, "registers"))
+                    group->m_gpu_registers = std::max(group->m_gpu_registers,
+                                                      n);
+            }
+            size_t spill = line.find(" bytes spill stores");
+            if (spill != string_view::npos) {
+                s            = line.substr(0, spill);
+                size_t start = s.find_last_of(", \t");
+                s.remove_prefix(start == string_view::npos ? 0 : start + 1);
+                if (Strutil::parse_int(s, n))
+                    group->m_gpu_spill_bytes
+                        = std::max(group->m_gpu_spill_bytes, n);
+            }
+        }
+        return true;
+    }
     return false;
 }
 
 
 
+// Fold a hash down to 16 bits.
+static uint32_t
+hash16(uint64_t h)
+{
+    return uint32_t((h ^ (h >> 16) ^ (h >> 32) ^ (h >> 48)) & 0xffff);
+}
+
+
+
+// The group's "coherence_key": a hash of the code it runs -- which
+// shaders, connected how -- in the low 16 bits, and of the value of the
+// named param (in the last layer that has one) in the high 16 bits.
+static int
+coherence_key(const ShaderGroup& group, ustring param)
+{
+    std::string code;
+    for (int layer = 0, n = group.nlayers(); layer < n; ++layer) {
+        const ShaderInstance* inst = group[layer];
+        code += fmtformat("{};", inst->master()->osofilename());
+        for (int c = 0, nc = inst->nconnections(); c < nc; ++c) {
+            const Connection& con(inst->connection(c));
+            code += fmtformat("{}.{}.{}>{}.{};", con.srclayer, con.src.param,
+                              con.src.channel, con.dst.param, con.dst.channel);
+        }
+    }
+    uint32_t key = hash16(Strutil::strhash(code));
+
+    for (int layer = group.nlayers() - 1; !param.empty() && layer >= 0;
+         --layer) {
+        const ShaderInstance* inst = group[layer];
+        int p                      = inst->findparam(param);
+        if (p < 0)
+            continue;
+        TypeDesc type     = inst->mastersymbol(p)->typespec().simpletype();
+        const void* value = inst->param_storage(p);
+        uint64_t h;
+        if (type.basetype == TypeDesc::STRING) {
+            h = 0;
+            for (size_t i = 0, e = type.numelements(); i < e; ++i)
+                h = h * 31 + ((const ustring*)value)[i].hash();
+        } else {
+            h = Strutil::strhash(string_view((const char*)value, type.size()));
+        }
+        key |= hash16(h) << 16;
+        break;
+    }
+    return int(key);
+}
+
+
+
 bool
 ShadingSystemImpl::getattribute(ShaderGroup* group, string_view name,
                                 TypeDesc type, void* val)
@@ -2140,6 +3176,14 @@ ShadingSystemImpl::getattribute(ShaderGroup* group, string_view name,
             ((ustring*)val)[i] = ustring();
         return true;
     }
+    if (name == "coherence_key" && type == TypeInt) {
+        *(int*)val = coherence_key(*group, m_coherence_param);
+        return true;
+    }
+    if (name == "coherence_key_bits" && type == TypeInt) {
+        *(int*)val = m_coherence_param.empty() ? 16 : 32;
+        return true;
+    }
     if (name == "group_init_name" && type.basetype == TypeDesc::STRING) {
         *(ustring*)val = init_function_name(*this, *group, true);
         return true;
@@ -2154,6 +3198,11 @@ ShadingSystemImpl::getattribute(ShaderGroup* group, string_view name,
         *(ustring*)val = fused_function_name(*group);
         return true;
     }
+    if (name == "group_wavefront_name" && type.basetype == TypeDesc::STRING) {
+        *(ustring*)val = optix_wavefront() ? wavefront_function_name(*group)
+                                           : ustring();
+        return true;
+    }
     if (name == "layer_osofiles" && type.basetype == TypeDesc::STRING) {
         size_t n = std::min(type.numelements(), (size_t)group->nlayers());
         for (size_t i = 0; i < n; ++i)
@@ -2164,15 +3213,92 @@ ShadingSystemImpl::getattribute(ShaderGroup* group, string_view name,
         *(ustring*)val = ustring(group->serialize());
         return true;
     }
+    if (name == "stat:compile_breakdown" && type == TypeDesc::STRING) {
+        *(ustring*)val = ustring(group->compile_breakdown());
+        return true;
+    }
+    if (name == "stat:compile_times" && type.basetype == TypeDesc::FLOAT) {
+        const ShaderGroup::CompileTimes& t(group->m_compile_times);
+        double times[] = { t.oso_load,   t.runtime_opt, t.batched_analysis,
+                           t.llvm_setup, t.llvm_irgen,  t.llvm_opt,
+                           t.llvm_jit };
+        size_t n       = std::min(type.numelements(), size_t(7));
+        for (size_t i = 0; i < n; ++i)
+            ((float*)val)[i] = float(times[i]);
+        return true;
+    }
+    if ((name == "stat:layer_optimize_times"
+         || name == "stat:layer_irgen_times")
+        && type.basetype == TypeDesc::FLOAT) {
+        const std::vector<double>& times(name == "stat:layer_optimize_times"
+                                             ? group->m_compile_times.layer_opt
+                                             : group->m_compile_times.layer_irgen);
+        for (size_t i = 0; i < type.numelements(); ++i)
+            ((float*)val)[i] = i < times.size() ? float(times[i]) : 0.0f;
+        return true;
+    }
+    if (name == "stat:telemetry" && type.basetype == TypeDesc::LONGLONG) {
+        // Sampled shades, texture lookups and closures (telemetry_interval)
+        size_t n = std::min(type.numelements(), size_t(3));
+        for (size_t i = 0; i < n; ++i)
+            ((long long*)val)[i] = group->m_telemetry[i];
+        return true;
+    }
+    if (name == "stat:pmu" && type.basetype == TypeDesc::LONGLONG) {
+        // Sampled shades and their cycles, instructions, cache misses and
+        // branch misses (pmu_interval)
+        size_t n = std::min(type.numelements(), size_t(5));
+        for (size_t i = 0; i < n; ++i)
+            ((long long*)val)[i] = group->m_pmu[i];
+        return true;
+    }
+    if (name == "stat:exec_histogram" && type.basetype == TypeDesc::LONGLONG) {
+        // Executes per log2 bucket of timer ticks (only when profiling)
+        merge_profiles();
+        for (size_t i = 0; i < type.numelements(); ++i)
+            ((long long*)val)[i] = i < ShaderGroup::exec_histogram_buckets
+                                       ? (long long)group->m_exec_histogram[i]
+                                       : 0;
+        return true;
+    }
     if (name == "exec_repeat" && type == TypeInt) {
         *(int*)val = group->m_exec_repeat;
         return true;
     }
+    if (name == "math_precision" && type == TypeString) {
+        *(ustring*)val = group->m_math_precision;
+        return true;
+    }
     if (name == "ptx_compiled_version" && type.basetype == TypeDesc::PTR) {
         bool exists        = !group->m_llvm_ptx_compiled_version.empty();
         *(std::string*)val = exists ? group->m_llvm_ptx_compiled_version : "";
         return true;
     }
+    if (name == "ptx_registers" && type == TypeInt) {
+        *(int*)val = group->m_ptx_registers;
+        return true;
+    }
+    if (name == "ptx_local_bytes" && type == TypeInt) {
+        *(int*)val = group->m_ptx_local_bytes;
+        return true;
+    }
+    if (name == "num_device_strings" && type == TypeInt) {
+        *(int*)val = (int)group->m_device_strings.size();
+        return true;
+    }
+    if (name == "device_strings" && type.basetype == TypeDesc::PTR) {
+        size_t n        = group->m_device_strings.size();
+        *(ustring**)val = n ? &group->m_device_strings[0] : NULL;
+        return true;
+    }
+    if (name == "gpu_registers" && type == TypeInt) {
+        *(int*)val = group->m_gpu_registers;
+        return true;
+    }
+    if (name == "gpu_spill_bytes" && type == TypeInt) {
+        *(int*)val = group->m_gpu_spill_bytes;
+        return true;
+    }
     if (name == "interactive_params" && type.basetype == TypeDesc::PTR) {
         *(void**)val = group->m_interactive_arena.get();
         return true;
@@ -2192,6 +3318,10 @@ ShadingSystemImpl::getattribute(ShaderGroup* group, string_view name,
         destroy_thread_info(threadinfo);
     }
 
+    if (name == "optimization_report" && type == TypeDesc::STRING) {
+        *(ustring*)val = ustring(group->m_opt_report);
+        return true;
+    }
     if (name == "num_textures_needed" && type == TypeInt) {
         *(int*)val = (int)group->m_textures_needed.size();
         return true;
@@ -2310,6 +3440,15 @@ ShadingSystemImpl::getattribute(ShaderGroup* group, string_view name,
         *(int*)val = (int)group->llvm_groupdata_size();
         return true;
     }
+    if (name == "memory_used" && type == TypeDesc::INT64) {
+        lock_guard lock(group->m_mutex);
+        *(long long*)val = (long long)group->memory_used();
+        return true;
+    }
+    if (name == "jit_memory_used" && type == TypeDesc::INT64) {
+        *(long long*)val = (long long)group->jit_bytes();
+        return true;
+    }
 
     return false;
 }
@@ -2383,25 +3522,8 @@ struct group_time_compare {  // So looking forward to C++11 lambdas!
 
 
 std::string
-ShadingSystemImpl::getstats(int level) const
+ShadingSystemImpl::options_summary() const
 {
-    int columns = OIIO::Sysutil::terminal_columns() - 2;
-
-    if (level <= 0)
-        return "";
-    std::ostringstream out;
-    out.imbue(std::locale::classic());  // force C locale
-    out << "Open Shading Language " << OSL_LIBRARY_VERSION_STRING << "\n";
-    ustring build_deps;
-    const_cast<ShadingSystemImpl*>(this)->getattribute("osl:dependencies",
-                                                       TypeDesc::STRING,
-                                                       &build_deps);
-    out << "  Build deps: "
-        << Strutil::wordwrap(Strutil::join(Strutil::splitsv(build_deps, ","),
-                                           ", "),
-                             columns, 14)
-        << "\n";
-
     std::string opt;
 #define BOOLOPT(name) opt += fmtformat(#name "={} ", m_##name)
 #define INTOPT(name)  opt += fmtformat(#name "={} ", m_##name)
@@ -2426,6 +3548,7 @@ ShadingSystemImpl::getstats(int level) const
     BOOLOPT(lazy_userdata);
     BOOLOPT(lazy_trace);
     BOOLOPT(userdata_isconnected);
+    BOOLOPT(reparam_rebuild);
     BOOLOPT(clearmemory);
     BOOLOPT(debugnan);
     BOOLOPT(debug_uninit);
@@ -2434,6 +3557,9 @@ ShadingSystemImpl::getstats(int level) const
     BOOLOPT(error_repeats);
     BOOLOPT(range_checking);
     BOOLOPT(greedyjit);
+    BOOLOPT(texture_prefetch);
+    INTOPT(memory_budget);
+    BOOLOPT(udim_tile_cache);
     BOOLOPT(countlayerexecs);
     BOOLOPT(opt_simplify_param);
     BOOLOPT(opt_constant_fold);
@@ -2446,26 +3572,77 @@ ShadingSystemImpl::getstats(int level) const
     BOOLOPT(opt_mix);
     INTOPT(opt_merge_instances);
     BOOLOPT(opt_merge_instances_with_userdata);
+    BOOLOPT(opt_share_groups);
     BOOLOPT(opt_fold_getattribute);
+    BOOLOPT(opt_fold_dict);
     BOOLOPT(opt_middleman);
+    BOOLOPT(opt_sccp);
+    BOOLOPT(opt_licm);
+    INTOPT(opt_loop_unroll);
+    BOOLOPT(opt_deriv_demand);
+    BOOLOPT(opt_noise_memo);
+    INTOPT(opt_fold_memo);
     BOOLOPT(opt_texture_handle);
+    BOOLOPT(opt_texture_fusion);
+    BOOLOPT(opt_hoist_transforms);
     BOOLOPT(opt_seed_bblock_aliases);
     BOOLOPT(opt_batched_analysis);
+    INTOPT(opt_batched_analysis_memo);
+    BOOLOPT(opt_useparam);
+    BOOLOPT(opt_groupdata);
+    BOOLOPT(opt_groupdata_hot);
+    BOOLOPT(opt_groupdata_share);
+    BOOLOPT(opt_readonly_params);
+    BOOLOPT(optimize_nondebug);
+    STROPT(opt_layername);
+    STROPT(opt_snapshot_dir);
+    INTOPT(batch_autoselect);
+    BOOLOPT(batch_uniform_scalar);
+    BOOLOPT(batched_attribute_cache);
     BOOLOPT(llvm_jit_fma);
     BOOLOPT(llvm_jit_aggressive);
     INTOPT(vector_width);
     STROPT(llvm_jit_target);
+    STROPT(llvm_jit_cache_dir);
+    STROPT(llvm_jit_isas);
+    INTOPT(llvm_jit_tiered);
+    INTOPT(llvm_jit_threads);
+    BOOLOPT(llvm_jit_lazy_entry);
+    BOOLOPT(llvm_jit_group_memory);
+    BOOLOPT(llvm_jit_huge_pages);
+    INTOPT(llvm_pgo);
+    STROPT(llvm_pgo_dir);
+    INTOPT(llvm_layer_inline);
+    INTOPT(llvm_layer_noinline);
+    INTOPT(llvm_shared_ops);
+    INTOPT(llvm_shared_constants);
     INTOPT(opt_passes);
+    INTOPT(opt_threads);
     INTOPT(no_noise);
+    STROPT(noise_hash);
+    STROPT(math_precision);
     INTOPT(no_pointcloud);
+    STROPT(pointcloud_index);
     INTOPT(force_derivs);
     INTOPT(allow_shader_replacement);
     INTOPT(exec_repeat);
+    INTOPT(raytype_variants);
+    INTOPT(userdata_variants);
+    INTOPT(debug_sample_interval);
+    STROPT(debug_sample_raytype);
     INTOPT(opt_warnings);
     INTOPT(gpu_opt_error);
+    INTOPT(opt_report);
     BOOLOPT(optix_no_inline);
     BOOLOPT(optix_no_inline_layer_funcs);
     BOOLOPT(optix_merge_layer_funcs);
+    BOOLOPT(optix_wavefront);
+    INTOPT(optix_split_threshold);
+    BOOLOPT(optix_host_jit);
+    STROPT(optix_target_arch);
+    STROPT(coherence_param);
+    INTOPT(device_arena_size);
+    BOOLOPT(async_device_copies);
     BOOLOPT(optix_no_inline_rend_lib);
     INTOPT(optix_no_inline_thresh);
     INTOPT(optix_force_inline_thresh);
@@ -2476,6 +3653,32 @@ ShadingSystemImpl::getstats(int level) const
 #undef BOOLOPT
 #undef INTOPT
 #undef STROPT
+    return opt;
+}
+
+
+
+std::string
+ShadingSystemImpl::getstats(int level) const
+{
+    int columns = OIIO::Sysutil::terminal_columns() - 2;
+
+    if (level <= 0)
+        return "";
+    std::ostringstream out;
+    out.imbue(std::locale::classic());  // force C locale
+    out << "Open Shading Language " << OSL_LIBRARY_VERSION_STRING << "\n";
+    ustring build_deps;
+    const_cast<ShadingSystemImpl*>(this)->getattribute("osl:dependencies",
+                                                       TypeDesc::STRING,
+                                                       &build_deps);
+    out << "  Build deps: "
+        << Strutil::wordwrap(Strutil::join(Strutil::splitsv(build_deps, ","),
+                                           ", "),
+                             columns, 14)
+        << "\n";
+
+    std::string opt = options_summary();
 
     // Print the HW info
     ustring buildsimd;
@@ -2513,6 +3716,8 @@ ShadingSystemImpl::getstats(int level) const
     out << "    Loaded:    " << m_stat_shaders_loaded << "\n";
     out << "    Masters:   " << m_stat_shaders_loaded << "\n";
     out << "    Instances: " << m_stat_instances << "\n";
+    out << "  Time starting up: "
+        << Strutil::timeintervalformat(m_stat_startup_time, 2) << "\n";
     out << "  Time loading masters: "
         << Strutil::timeintervalformat(m_stat_master_load_time, 2) << "\n";
     out << "  Shading groups:   " << m_stat_groups << "\n";
@@ -2545,6 +3750,44 @@ ShadingSystemImpl::getstats(int level) const
 
     out << "  Compiled " << m_stat_groups_compiled << " groups, "
         << m_stat_instances_compiled << " instances\n";
+    if (m_opt_share_groups)
+        print(out, "  Shared the code of identical groups {} times\n",
+              (int)m_stat_groups_shared);
+    if (m_opt_fold_memo)
+        print(out, "  Reused the folded code of {} layers\n",
+              (int)m_stat_fold_memo_hits);
+    if (m_opt_batched_analysis && m_opt_batched_analysis_memo)
+        print(out, "  Reused the batched analysis of {} layers\n",
+              (int)m_stat_batched_analysis_memo_hits);
+    if (m_opt_snapshot_dir.size() || m_registry)
+        print(out, "  Optimized group snapshots: {} loaded, {} saved\n",
+              (int)m_stat_snapshots_loaded, (int)m_stat_snapshots_saved);
+    if (m_llvm_jit_cache_dir.size() || m_registry)
+        print(out, "  JIT object cache: {} hits, {} misses\n",
+              (int)m_stat_jit_cache_hits, (int)m_stat_jit_cache_misses);
+    if (m_stat_jit_cache_variants)
+        print(out, "    Stored for other ISAs: {}\n",
+              (int)m_stat_jit_cache_variants);
+    if (m_registry)
+        print(out, "  Shader registry: {} entries, {}\n", m_registry->size(),
+              Strutil::memformat(m_registry->memory_used()));
+    if (m_llvm_shared_ops > 0)
+        print(out, "  Shared shadeops: {} library functions not recompiled\n",
+              (int)m_stat_shared_ops_linked);
+    if (m_llvm_shared_constants > 0)
+        print(out, "  Shared constants: {} arrays using {} distinct ({})\n",
+              (int)m_stat_shared_constants, m_shared_constants.blocks(),
+              OIIO::Strutil::memformat(m_shared_constants.bytes()));
+    if (m_llvm_jit_lazy_entry)
+        print(out, "  Lazy entry layers: {} deferred, {} JITed on demand\n",
+              (int)m_stat_lazy_layers_deferred,
+              (int)m_stat_lazy_layers_jitted);
+    if (m_llvm_jit_threads > 1)
+        print(out, "  Parallel codegen: {} groups split across threads\n",
+              (int)m_stat_parallel_codegens);
+    if (m_llvm_pgo)
+        print(out, "  Branch profiles: {} groups instrumented, {} optimized\n",
+              (int)m_stat_pgo_instrumented, (int)m_stat_pgo_applied);
     out << "  Merged " << (m_stat_merged_inst + m_stat_merged_inst_opt)
         << " instances (" << m_stat_merged_inst << " initial, "
         << m_stat_merged_inst_opt << " after opt) in "
@@ -2582,10 +3825,19 @@ ShadingSystemImpl::getstats(int level) const
           (int)m_stat_global_connections);
     print(out, "  Middlemen eliminated: {}\n",
           (int)m_stat_middlemen_eliminated);
+    if (m_opt_sccp)
+        print(out, "  Reads made constant by SCCP: {}\n",
+              (int)m_stat_sccp_constants);
+    if (m_stat_noise_calls_shared)
+        print(out, "  Noise calls sharing a result across layers: {}\n",
+              (int)m_stat_noise_calls_shared);
     print(out, "  Derivatives needed on {} / {} symbols ({:.1f}%)\n",
           (int)m_stat_syms_with_derivs, (int)m_stat_postopt_syms,
           (100.0 * (int)m_stat_syms_with_derivs)
               / std::max((int)m_stat_postopt_syms, 1));
+    if (m_stat_derivs_removed)
+        print(out, "    {} symbols marked by oslc found not to need them\n",
+              (int)m_stat_derivs_removed);
     out << "  Runtime optimization cost: "
         << Strutil::timeintervalformat(m_stat_optimization_time, 2) << "\n";
     out << "    locking:                   "
@@ -2602,12 +3854,36 @@ ShadingSystemImpl::getstats(int level) const
         out << "    LLVM JIT:                  "
             << Strutil::timeintervalformat(m_stat_llvm_jit_time, 2) << "\n";
     }
+    if (m_stat_background_jits)
+        print(out, "  Background full-optimization JIT: {} groups in {}\n",
+              (int)m_stat_background_jits,
+              Strutil::timeintervalformat(m_stat_background_jit_time, 2));
+    if (m_stat_optix_split_groups)
+        print(out, "  PTX regenerated with layers split: {} groups\n",
+              (int)m_stat_optix_split_groups);
+    if (m_stat_optix_host_jits)
+        print(out, "  OptiX groups also JITed for the host: {}\n",
+              (int)m_stat_optix_host_jits);
+    if (m_device_arena)
+        print(out, "  Device arena: {} in blocks, {} uploads of {}\n",
+              Strutil::memformat(m_device_arena->capacity()),
+              (int)m_stat_device_uploads,
+              Strutil::memformat(m_stat_device_upload_bytes));
+    if (m_stat_device_programs_compiled)
+        print(out, "  Device programs: {} compiled, {} shared\n",
+              (int)m_stat_device_programs_compiled,
+              (int)m_stat_device_programs_shared);
+    std::string slowest = slowest_groups_report(m_stats_slowest_groups);
+    if (slowest.size())
+        out << "  Slowest shader groups to compile:\n" << slowest;
 
     out << "  Texture calls compiled: " << (int)m_stat_tex_calls_codegened
         << " (" << (int)m_stat_tex_calls_as_handles << " used handles)\n";
     out << "  Regex's compiled: " << m_stat_regexes << "\n";
     out << "  Largest generated function local memory size: "
         << m_stat_max_llvm_local_mem / 1024 << " KB\n";
+    print(out, "  Largest group heap (groupdata): {} bytes\n",
+          m_max_groupdata_size);
     if (m_stat_getattribute_calls) {
         out << "  getattribute calls: " << m_stat_getattribute_calls << " ("
             << Strutil::timeintervalformat(m_stat_getattribute_time, 2)
@@ -2644,7 +3920,48 @@ ShadingSystemImpl::getstats(int level) const
               OIIO::Strutil::memformat(m_stat_reparam_bytes_total),
               (long long)m_stat_reparam_calls_changed,
               OIIO::Strutil::memformat(m_stat_reparam_bytes_changed));
-    }
+        if (m_stat_reparam_rebuilds)
+            print(out, "    {} of them re-optimized their group\n",
+                  (long long)m_stat_reparam_rebuilds);
+    }
+    if (m_stat_output_variants)
+        print(out, "  Groups specialized to a subset of outputs: {}\n",
+              (int)m_stat_output_variants);
+    if (m_stat_raytype_variants)
+        print(out, "  Groups specialized to a ray type: {}\n",
+              (int)m_stat_raytype_variants);
+    if (m_stat_debug_variants)
+        print(out, "  Groups copied with NaN/uninitialized checks: {}\n",
+              (int)m_stat_debug_variants);
+    if (m_stat_userdata_variants)
+        print(out,
+              "  Groups specialized to constant userdata: {} "
+              "({} shades ran the general group)\n",
+              (int)m_stat_userdata_variants,
+              (long long)m_stat_userdata_misses);
+    if (m_stat_traces_deferred) {
+        print(out, "  Deferred trace() rays: {}\n",
+              (long long)m_stat_traces_deferred);
+        if (m_stat_traces_strayed)
+            print(out, "    {} rerun shades strayed and traced at once\n",
+                  (long long)m_stat_traces_strayed);
+    }
+    if (m_stat_formed_batches)
+        print(out, "  Batches formed: {} ({} points, {:.1f} per batch)\n",
+              (long long)m_stat_formed_batches,
+              (long long)m_stat_formed_points,
+              double(m_stat_formed_points) / m_stat_formed_batches);
+    if (m_stat_routed_batched || m_stat_routed_scalar)
+        print(out, "  Batch autoselect: {} groups run batched, {} scalar\n",
+              (int)m_stat_routed_batched, (int)m_stat_routed_scalar);
+    if (m_stat_uniform_batches)
+        print(out, "  Uniform batches run as scalar: {}\n",
+              (long long)m_stat_uniform_batches);
+    if (m_stat_attribute_gathers)
+        print(out,
+              "  Batched attribute gathers: {} ({} lookups from the cache)\n",
+              (long long)m_stat_attribute_gathers,
+              (long long)m_stat_attribute_cache_hits);
     out << "  Memory total: " << m_stat_memory.memstat() << '\n';
     out << "    Master memory: " << m_stat_mem_master.memstat() << '\n';
     out << "        Master ops:            " << m_stat_mem_master_ops.memstat()
@@ -2664,18 +3981,37 @@ ShadingSystemImpl::getstats(int level) const
         << m_stat_mem_inst_paramvals.memstat() << '\n';
     out << "        Instance connections:  "
         << m_stat_mem_inst_connections.memstat() << '\n';
+    out << "    Closure pool memory: " << m_stat_mem_closures.memstat() << '\n';
+    if (m_stat_closure_pool_trims)
+        print(out, "        Trimmed back {} times\n",
+              (long long)m_stat_closure_pool_trims);
 
     size_t jitmem = LLVM_Util::total_jit_memory_held();
     out << "    LLVM JIT memory: " << Strutil::memformat(jitmem) << '\n';
+    size_t slab_reserved = 0, slab_used = 0;
+    LLVM_Util::jit_slab_memory(slab_reserved, slab_used);
+    if (slab_reserved)
+        print(out, "        In huge page slabs: {} of {} ({:.1f}% unused)\n",
+              Strutil::memformat(slab_used), Strutil::memformat(slab_reserved),
+              100.0 * (slab_reserved - slab_used) / slab_reserved);
+    if (m_stat_groups_evicted)
+        print(out, "    Evicted {} idle groups for the memory budget, {}\n",
+              (long long)m_stat_groups_evicted,
+              Strutil::memformat(m_stat_memory_evicted));
 
     if (m_profile) {
+        merge_profiles();
         out << "  Execution profile:\n";
         out << "    Total shader execution time: "
             << Strutil::timeintervalformat(OIIO::Timer::seconds(
                                                m_stat_total_shading_time_ticks),
                                            2)
             << " (sum of all threads)\n";
-        // Account for times of any groups that haven't yet been destroyed
+        // Account for times of any groups that haven't yet been destroyed,
+        // and gather the execution histograms of the live ones by name.
+        constexpr int nbuckets = ShaderGroup::exec_histogram_buckets;
+        using ExecHistogram    = std::array<long long, nbuckets>;
+        std::map<ustring, ExecHistogram> histograms;
         {
             spin_lock lock(m_all_shader_groups_mutex);
             for (auto&& grp : m_all_shader_groups) {
@@ -2683,6 +4019,11 @@ ShadingSystemImpl::getstats(int level) const
                     long long ticks = g->m_stat_total_shading_time_ticks;
                     m_group_profile_times[g->name()] += ticks;
                     g->m_stat_total_shading_time_ticks -= ticks;
+                    if (level >= 2) {
+                        ExecHistogram& h(histograms[g->name()]);
+                        for (int b = 0; b < nbuckets; ++b)
+                            h[b] += g->m_exec_histogram[b];
+                    }
                 }
             }
         }
@@ -2710,8 +4051,56 @@ ShadingSystemImpl::getstats(int level) const
                     << ' '
                     << (i->first.size() ? i->first.c_str() : "<unnamed group>")
                     << "\n";
+                auto h = histograms.find(i->first);
+                if (h == histograms.end())
+                    continue;
+                std::string buckets;
+                for (int b = 0; b < nbuckets; ++b)
+                    if (h->second[b])
+                        buckets += fmtformat(" 2^{}:{}", b, h->second[b]);
+                if (buckets.size())
+                    out << "        Executes by log2 ticks:" << buckets << "\n";
+            }
+        }
+    }
+
+    if (m_pmu_interval > 0) {
+        // Hardware counters of the sampled shades of the live groups, the
+        // most cycles first.
+        struct GroupPmu {
+            ustring name;
+            long long pmu[5];
+        };
+        std::vector<GroupPmu> groups;
+        {
+            spin_lock lock(m_all_shader_groups_mutex);
+            for (auto&& grp : m_all_shader_groups) {
+                ShaderGroupRef g = grp.lock();
+                if (!g || !g->m_pmu[0])
+                    continue;
+                GroupPmu gp { g->name(), {} };
+                for (int i = 0; i < 5; ++i)
+                    gp.pmu[i] = g->m_pmu[i];
+                groups.push_back(gp);
             }
         }
+        std::sort(groups.begin(), groups.end(),
+                  [](const GroupPmu& a, const GroupPmu& b) {
+                      return a.pmu[1] > b.pmu[1];
+                  });
+        out << "  Hardware counters (1 in " << m_pmu_interval
+            << " shades):\n";
+        if (groups.empty())
+            out << "    None read (unavailable, or no scalar shades)\n";
+        for (auto&& gp : groups) {
+            double n = double(gp.pmu[0]);
+            print(out,
+                  "    {}: {} shades, IPC {:.2f}, per shade {:.0f} cycles, "
+                  "{:.1f} cache misses, {:.1f} branch misses\n",
+                  gp.name.size() ? gp.name.c_str() : "<unnamed group>",
+                  gp.pmu[0], gp.pmu[1] ? double(gp.pmu[2]) / gp.pmu[1] : 0.0,
+                  gp.pmu[1] / n, gp.pmu[3] / n, gp.pmu[4] / n);
+        }
     }
 
     return out.str();
@@ -2729,6 +4118,280 @@ ShadingSystemImpl::printstats() const
 
 
 
+std::string
+ShadingSystemImpl::slowest_groups_report(int n) const
+{
+    std::vector<std::pair<ustring, double>> compiletimes;
+    {
+        spin_lock lock(m_stat_mutex);
+        compiletimes.reserve(m_group_compile_times.size());
+        for (auto&& c : m_group_compile_times)
+            compiletimes.push_back(c.second);
+    }
+    std::sort(compiletimes.begin(), compiletimes.end(),
+              [](const auto& a, const auto& b) { return a.second > b.second; });
+    if (compiletimes.size() > size_t(std::max(n, 0)))
+        compiletimes.resize(size_t(std::max(n, 0)));
+    std::ostringstream out;
+    out.imbue(std::locale::classic());  // force C locale
+    for (auto&& c : compiletimes)
+        print(out, "    {} {}\n", Strutil::timeintervalformat(c.second, 2),
+              c.first.size() ? c.first.c_str() : "<unnamed group>");
+    return out.str();
+}
+
+
+
+// Quote a string for JSON.
+static std::string
+json_string(string_view str)
+{
+    std::string r = "\"";
+    for (char c : str) {
+        if (c == '"' || c == '\\')
+            r += '\\';
+        if ((unsigned char)c < 0x20)
+            r += fmtformat("\\u{:04x}", int(c));
+        else
+            r += c;
+    }
+    return r + "\"";
+}
+
+
+
+std::string
+ShadingSystemImpl::stats_json() const
+{
+    // Account for the execution times of the groups still alive, as
+    // getstats does, and count their executes.
+    std::map<ustring, long long> executes;
+    if (m_profile) {
+        merge_profiles();
+        spin_lock lock(m_all_shader_groups_mutex);
+        for (auto&& grp : m_all_shader_groups) {
+            if (ShaderGroupRef g = grp.lock()) {
+                long long ticks = g->m_stat_total_shading_time_ticks;
+                m_group_profile_times[g->name()] += ticks;
+                g->m_stat_total_shading_time_ticks -= ticks;
+                long long& n(executes[g->name()]);
+                for (auto&& b : g->m_exec_histogram)
+                    n += b;
+            }
+        }
+    }
+
+    std::ostringstream out;
+    out.imbue(std::locale::classic());  // force C locale
+    print(out, "{{\n");
+    print(out, "  \"times\": {{\n");
+    print(out, "    \"startup\": {},\n", m_stat_startup_time);
+    print(out, "    \"master_load\": {},\n", m_stat_master_load_time);
+    print(out, "    \"optimization\": {},\n", m_stat_optimization_time);
+    print(out, "    \"opt_locking\": {},\n", m_stat_opt_locking_time);
+    print(out, "    \"specialization\": {},\n", m_stat_specialization_time);
+    print(out, "    \"llvm_total\": {},\n", m_stat_total_llvm_time);
+    print(out, "    \"llvm_setup\": {},\n", m_stat_llvm_setup_time);
+    print(out, "    \"llvm_irgen\": {},\n", m_stat_llvm_irgen_time);
+    print(out, "    \"llvm_opt\": {},\n", m_stat_llvm_opt_time);
+    print(out, "    \"llvm_jit\": {},\n", m_stat_llvm_jit_time);
+    print(out, "    \"inst_merge\": {},\n", m_stat_inst_merge_time);
+    print(out, "    \"background_jit\": {},\n", m_stat_background_jit_time);
+    print(out, "    \"shading\": {}\n",
+          OIIO::Timer::seconds(m_stat_total_shading_time_ticks));
+    print(out, "  }},\n");
+    print(out, "  \"counts\": {{\n");
+    print(out, "    \"masters\": {},\n", int(m_stat_shaders_loaded));
+    print(out, "    \"groups\": {},\n", int(m_stat_groups));
+    print(out, "    \"instances\": {},\n", int(m_stat_groupinstances));
+    print(out, "    \"groups_compiled\": {},\n", int(m_stat_groups_compiled));
+    print(out, "    \"instances_compiled\": {},\n",
+          int(m_stat_instances_compiled));
+    print(out, "    \"jit_cache_hits\": {},\n", int(m_stat_jit_cache_hits));
+    print(out, "    \"jit_cache_misses\": {},\n",
+          int(m_stat_jit_cache_misses));
+    print(out, "    \"jit_cache_variants\": {},\n",
+          int(m_stat_jit_cache_variants));
+    print(out, "    \"layers_executed\": {},\n",
+          (long long)m_stat_layers_executed);
+    print(out, "    \"getattribute_calls\": {},\n",
+          (long long)m_stat_getattribute_calls);
+    print(out, "    \"noise_calls\": {}\n", (long long)m_stat_noise_calls);
+    print(out, "  }},\n");
+
+    // One entry per group name, from the compile and execution times (the
+    // latter are only kept by name, so same-named groups add up).
+    spin_lock lock(m_stat_mutex);
+    std::map<ustring, std::pair<double, long long>> groups;
+    for (auto&& c : m_group_compile_times)
+        groups[c.second.first].first += c.second.second;
+    for (auto&& p : m_group_profile_times)
+        groups[p.first].second = p.second;
+    print(out, "  \"groups\": [");
+    const char* sep = "\n";
+    for (auto&& g : groups) {
+        print(out, "{}    {{ \"name\": {}, \"compile_time\": {}", sep,
+              json_string(g.first), g.second.first);
+        if (m_profile)
+            print(out, ", \"exec_time\": {}, \"executes\": {}",
+                  OIIO::Timer::seconds(g.second.second), executes[g.first]);
+        print(out, " }}");
+        sep = ",\n";
+    }
+    print(out, "{}  ]\n", groups.empty() ? "" : "\n");
+    print(out, "}}\n");
+    return out.str();
+}
+
+
+
+void
+ShadingSystemImpl::enumerate_stats(const ShadingSystem::StatsFunc& func) const
+{
+    auto count = [&](string_view name, long long value) {
+        func(name, TypeDesc::INT64, &value);
+    };
+    auto seconds = [&](string_view name, double value) {
+        func(name, TypeDesc::DOUBLE, &value);
+    };
+
+    count("masters", m_stat_shaders_loaded);
+    count("groups", m_stat_groups);
+    count("instances", m_stat_groupinstances);
+    count("groups_compiled", m_stat_groups_compiled);
+    count("instances_compiled", m_stat_instances_compiled);
+    count("jit_cache_hits", m_stat_jit_cache_hits);
+    count("jit_cache_misses", m_stat_jit_cache_misses);
+    count("jit_cache_variants", m_stat_jit_cache_variants);
+    count("background_jits", m_stat_background_jits);
+    count("groups_evicted", m_stat_groups_evicted);
+
+    // The times are added to under m_stat_mutex; copy them out so that
+    // func isn't called with it held.
+    double times[8];
+    {
+        spin_lock lock(m_stat_mutex);
+        times[0] = m_stat_master_load_time;
+        times[1] = m_stat_optimization_time;
+        times[2] = m_stat_specialization_time;
+        times[3] = m_stat_total_llvm_time;
+        times[4] = m_stat_llvm_opt_time;
+        times[5] = m_stat_llvm_jit_time;
+        times[6] = m_stat_background_jit_time;
+        times[7] = m_stat_optimization_time + m_stat_total_llvm_time;
+    }
+    seconds("master_load_time", times[0]);
+    seconds("optimization_time", times[1]);
+    seconds("specialization_time", times[2]);
+    seconds("total_llvm_time", times[3]);
+    seconds("llvm_opt_time", times[4]);
+    seconds("llvm_jit_time", times[5]);
+    seconds("background_jit_time", times[6]);
+    seconds("compile_time", times[7]);
+
+    // Executes: layers only with "countlayerexecs", shading time and group
+    // executes only with "profile".
+    if (m_profile)
+        merge_profiles();
+    long long executes = 0;
+    {
+        spin_lock lock(m_all_shader_groups_mutex);
+        for (auto&& grp : m_all_shader_groups)
+            if (ShaderGroupRef g = grp.lock())
+                for (auto&& b : g->m_exec_histogram)
+                    executes += b;
+    }
+    count("executes", executes);
+    count("layers_executed", m_stat_layers_executed);
+    seconds("shading_time",
+            OIIO::Timer::seconds(m_stat_total_shading_time_ticks));
+    count("getattribute_calls", m_stat_getattribute_calls);
+    count("get_userdata_calls", m_stat_get_userdata_calls);
+    count("noise_calls", m_stat_noise_calls);
+    count("traces_deferred", m_stat_traces_deferred);
+
+    // Texture lookups, as the texture system counts them
+    long long texture_queries = 0, queries = 0;
+    if (m_texturesys) {
+        for (const char* q : { "stat:texture_queries", "stat:texture3d_queries",
+                               "stat:environment_queries" })
+            if (m_texturesys->getattribute(q, TypeDesc::INT64, &queries))
+                texture_queries += queries;
+    }
+    count("texture_queries", texture_queries);
+    count("tex_calls_codegened", m_stat_tex_calls_codegened);
+
+    count("mem_current", m_stat_memory.current());
+    count("mem_peak", m_stat_memory.peak());
+    count("mem_closures_current", m_stat_mem_closures.current());
+    count("mem_closures_peak", m_stat_mem_closures.peak());
+    count("closure_pool_trims", m_stat_closure_pool_trims);
+    count("jit_memory", (long long)LLVM_Util::total_jit_memory_held());
+    size_t slab_reserved = 0, slab_used = 0;
+    LLVM_Util::jit_slab_memory(slab_reserved, slab_used);
+    count("jit_slab_memory", (long long)slab_reserved);
+    count("jit_slab_unused", (long long)(slab_reserved - slab_used));
+}
+
+
+
+void
+ShadingSystemImpl::set_stats_callback(ShadingSystem::StatsFunc func)
+{
+    if (m_stats_callback_thread
+        && m_stats_callback_thread->get_id() == std::this_thread::get_id()) {
+        // Called from the function itself, whose thread can't join
+        // itself: it goes on with the new function, or ends once the
+        // current call returns.
+        std::lock_guard<std::mutex> lock(m_stats_callback_mutex);
+        m_stats_callback_stop = !func;
+        m_stats_callback      = std::move(func);
+        return;
+    }
+    // Stop the thread calling the old function, if any, before starting
+    // one for the new.
+    {
+        std::lock_guard<std::mutex> lock(m_stats_callback_mutex);
+        m_stats_callback_stop = true;
+    }
+    m_stats_callback_cv.notify_all();
+    if (m_stats_callback_thread) {
+        m_stats_callback_thread->join();
+        m_stats_callback_thread.reset();
+    }
+    if (!func)
+        return;
+    m_stats_callback      = std::move(func);
+    m_stats_callback_stop = false;
+    m_stats_callback_thread.reset(
+        new std::thread(&ShadingSystemImpl::stats_callback_worker, this));
+}
+
+
+
+void
+ShadingSystemImpl::stats_callback_worker()
+{
+    std::unique_lock<std::mutex> lock(m_stats_callback_mutex);
+    for (;;) {
+        auto interval = std::chrono::duration<float>(
+            std::max(m_stats_interval, 0.001f));
+        if (m_stats_callback_cv.wait_for(lock, interval, [this] {
+                return m_stats_callback_stop;
+            }))
+            break;
+        // Not holding the lock while func runs lets set_stats_callback
+        // ask for the thread to stop at any time, and calling a copy lets
+        // func replace itself.
+        ShadingSystem::StatsFunc func = m_stats_callback;
+        lock.unlock();
+        enumerate_stats(func);
+        lock.lock();
+    }
+}
+
+
+
 bool
 ShadingSystemImpl::Parameter(string_view name, TypeDesc t, const void* val,
                              ParamHints hints)
@@ -2750,10 +4413,11 @@ ShadingSystemImpl::Parameter(ShaderGroup& group, string_view name, TypeDesc t,
 
 
 ShaderGroupRef
-ShadingSystemImpl::ShaderGroupBegin(string_view groupname)
+ShadingSystemImpl::new_shader_group(string_view groupname)
 {
     ShaderGroupRef group(new ShaderGroup(groupname, *this));
-    group->m_exec_repeat = m_exec_repeat;
+    group->m_exec_repeat    = m_exec_repeat;
+    group->m_math_precision = m_math_precision;
     {
         // Record the group in the SS's census of all extant groups
         spin_lock lock(m_all_shader_groups_mutex);
@@ -2762,6 +4426,18 @@ ShadingSystemImpl::ShaderGroupBegin(string_view groupname)
         group->add_symlocs(m_symlocs);
         m_all_shader_groups.push_back(group);
         ++m_groups_to_compile_count;
+    }
+    return group;
+}
+
+
+
+ShaderGroupRef
+ShadingSystemImpl::ShaderGroupBegin(string_view groupname)
+{
+    ShaderGroupRef group = new_shader_group(groupname);
+    {
+        spin_lock lock(m_all_shader_groups_mutex);
         m_curgroup = group;
     }
     return group;
@@ -2832,6 +4508,10 @@ ShadingSystemImpl::ShaderGroupEnd(ShaderGroup& group)
         archive_shadergroup(group, filename);
     }
 
+    if (m_opt_share_groups || m_llvm_pgo || m_opt_snapshot_dir.size()
+        || m_registry)
+        group.compute_canonical_hash(m_opt_share_groups);
+
     group.m_complete = true;
     return true;
 }
@@ -3005,6 +4685,21 @@ ShadingSystemImpl::ConnectShaders(ShaderGroup& group, string_view srclayer,
         return true;
     }
 
+    return connect_decoded(group, srcinstindex, srccon, dstinstindex, dstcon,
+                           srcparam, dstparam);
+}
+
+
+
+bool
+ShadingSystemImpl::connect_decoded(ShaderGroup& group, int srcinstindex,
+                                   const ConnectedParam& srccon,
+                                   int dstinstindex,
+                                   const ConnectedParam& dstcon,
+                                   string_view srcparam, string_view dstparam)
+{
+    ShaderInstance* srcinst = group[srcinstindex];
+    ShaderInstance* dstinst = group[dstinstindex];
     if (!assignable(dstcon.type, srccon.type)) {
         if (connection_error())
             errorfmt("ConnectShaders: cannot connect a {} ({}) to a {} ({})\n"
@@ -3021,9 +4716,7 @@ ShadingSystemImpl::ConnectShaders(ShaderGroup& group, string_view srclayer,
 
     const Symbol* dstsym = dstinst->mastersymbol(dstcon.param);
     if (dstsym && !dstsym->allowconnect()) {
-        std::string name = dstlayer.size()
-                               ? fmtformat("{}.{}", dstlayer, dstparam)
-                               : std::string(dstparam);
+        std::string name = fmtformat("{}.{}", dstinst->layername(), dstparam);
         errorfmt(
             "ConnectShaders: cannot connect to {} because it has metadata allowconnect=0\n"
             "        group: {}",
@@ -3045,6 +4738,119 @@ ShadingSystemImpl::ConnectShaders(ShaderGroup& group, string_view srclayer,
 
 
 
+int
+ShadingSystemImpl::find_param(string_view shadername, string_view paramname)
+{
+    ShaderMaster::ref master = loadshader(shadername);
+    if (!master)
+        return -1;
+    int i = master->findsymbol(ustring(paramname));
+    return master->is_param(i) ? i : -1;
+}
+
+
+
+ShaderGroupRef
+ShadingSystemImpl::build_shader_group(const ShaderGroupDesc& desc)
+{
+    // Load and check everything before making the group, so that a bad
+    // descriptor doesn't leave a half-built group behind.
+    if (desc.usage.empty()) {
+        errorfmt("build_shader_group: shader usage required\n"
+                 "        group: {}",
+                 desc.name);
+        return {};
+    }
+    int nlayers = (int)desc.layers.size();
+    std::vector<ShaderMaster::ref> masters(nlayers);
+    for (int l = 0; l < nlayers; ++l) {
+        masters[l] = loadshader(desc.layers[l].shadername);
+        if (!masters[l]) {
+            errorfmt("Could not find shader \"{}\"\n"
+                     "        group: {}",
+                     desc.layers[l].shadername, desc.name);
+            return {};
+        }
+    }
+
+    // Sort the parameter values by layer, so each instance gets all of
+    // its values at once.
+    std::vector<ParamValueList> params(nlayers);
+    std::vector<std::vector<ParamHints>> hints(nlayers);
+    std::vector<std::vector<int>> paramindex(nlayers);
+    for (const auto& p : desc.params) {
+        if (p.layer < 0 || p.layer >= nlayers
+            || !masters[p.layer]->is_param(p.param)) {
+            errorfmt("build_shader_group: no parameter #{} in layer #{}\n"
+                     "        group: {}",
+                     p.param, p.layer, desc.name);
+            return {};
+        }
+        params[p.layer].push_back(p.value);
+        hints[p.layer].push_back(p.hints);
+        paramindex[p.layer].push_back(p.param);
+    }
+    for (const auto& c : desc.connections) {
+        if (c.srclayer < 0 || c.dstlayer >= nlayers
+            || c.dstlayer <= c.srclayer
+            || !masters[c.srclayer]->is_param(c.srcparam)
+            || !masters[c.dstlayer]->is_param(c.dstparam)) {
+            errorfmt(
+                "build_shader_group: invalid connection #{}.#{} -> #{}.#{}\n"
+                "        group: {}",
+                c.srclayer, c.srcparam, c.dstlayer, c.dstparam, desc.name);
+            return {};
+        }
+    }
+
+    ShaderGroupRef group = new_shader_group(desc.name);
+    group->m_group_use   = desc.usage;
+    for (int l = 0; l < nlayers; ++l) {
+        // If a layer name was not supplied, make one up.
+        std::string local_layername;
+        string_view layername = desc.layers[l].layername;
+        if (layername.empty()) {
+            local_layername = fmtformat("{}_{}", masters[l]->shadername(), l);
+            layername       = string_view(local_layername);
+        }
+        ShaderInstanceRef instance(new ShaderInstance(masters[l], layername));
+        instance->parameters(params[l], hints[l], paramindex[l]);
+        group->append(instance);
+    }
+    m_stat_groups += 1;
+    m_stat_groupinstances += nlayers;
+
+    for (const auto& c : desc.connections) {
+        ShaderInstance* srcinst = (*group)[c.srclayer];
+        ShaderInstance* dstinst = (*group)[c.dstlayer];
+        const Symbol* srcsym    = masters[c.srclayer]->symbol(c.srcparam);
+        const Symbol* dstsym    = masters[c.dstlayer]->symbol(c.dstparam);
+        bool ok;
+        if (srcsym->typespec().is_structure()
+            || dstsym->typespec().is_structure()) {
+            // Struct connections are made field by field, by name.
+            ok = ConnectShaders(*group, srcinst->layername(), srcsym->name(),
+                                dstinst->layername(), dstsym->name());
+        } else {
+            ConnectedParam srccon, dstcon;
+            srccon.param = c.srcparam;
+            srccon.type  = srcsym->typespec();
+            dstcon.param = c.dstparam;
+            dstcon.type  = dstsym->typespec();
+            ok = connect_decoded(*group, c.srclayer, srccon, c.dstlayer,
+                                 dstcon, srcsym->name(), dstsym->name());
+        }
+        if (!ok && connection_error())
+            return {};
+    }
+
+    if (!ShaderGroupEnd(*group))
+        return {};
+    return group;
+}
+
+
+
 ShaderGroupRef
 ShadingSystemImpl::ShaderGroupBegin(string_view groupname, string_view usage,
                                     string_view groupspec)
@@ -3357,7 +5163,32 @@ ShadingSystemImpl::ReParameter(ShaderGroup& group, string_view layername_,
                                string_view paramname, TypeDesc type,
                                const void* val)
 {
-    // Find the named layer
+    if (!reparameter_group(group, layername_, paramname, type, val))
+        return false;
+    // The variants (per output set, ray type, debug sampling, and userdata)
+    // are copies of this group's layers, so they need the new value, too --
+    // once the group itself took it, so that a parameter it lacks or can't
+    // change is reported once and leaves every copy alone.
+    for (auto&& variant : group.output_variants())
+        ReParameter(*variant, layername_, paramname, type, val);
+    for (auto&& variant : group.raytype_variants())
+        ReParameter(*variant, layername_, paramname, type, val);
+    if (ShaderGroup* variant = group.find_debug_variant())
+        ReParameter(*variant, layername_, paramname, type, val);
+    if (ShaderGroup* variant = group.find_userdata_variant())
+        ReParameter(*variant, layername_, paramname, type, val);
+    return true;
+}
+
+
+
+bool
+ShadingSystemImpl::reparameter_group(ShaderGroup& group,
+                                     string_view layername_,
+                                     string_view paramname, TypeDesc type,
+                                     const void* val)
+{
+    // Find the named layer
     ustring layername(layername_);
     ShaderInstance* layer = nullptr;
     int layerindex        = -1;
@@ -3376,9 +5207,14 @@ ShadingSystemImpl::ReParameter(ShaderGroup& group, string_view layername_,
                                       false /* don't go to master */);
     if (paramindex < 0) {
         paramindex = layer->findparam(ustring(paramname), true);
-        if (paramindex >= 0)
-            // This param exists, but it got optimized away, no failure
+        if (paramindex >= 0) {
+            // This param exists, but it got optimized away, no failure.
+            // If we can rebuild, though, the new value might still matter.
+            if (group.has_pristine_layers())
+                return reparameter_rebuild(group, layerindex,
+                                           ustring(paramname), type, val);
             return true;
+        }
     }
     if (paramindex < 0)
         return false;  // could not find the named parameter
@@ -3391,6 +5227,12 @@ ShadingSystemImpl::ReParameter(ShaderGroup& group, string_view layername_,
         return false;
     }
 
+    // Values the optimizer may have specialized on can still be changed
+    // by optimizing the group over again.
+    if ((!sym->interactive() || sym->lockgeom())
+        && group.has_pristine_layers())
+        return reparameter_rebuild(group, layerindex, sym->name(), type, val);
+
     // Check that it's declared to be an interactive parameter
     if (!sym->interactive()) {
         errorfmt(
@@ -3431,13 +5273,26 @@ ShadingSystemImpl::ReParameter(ShaderGroup& group, string_view layername_,
         if (memcmp(group.interactive_arena_ptr() + offset, payload, size)) {
             memcpy(group.interactive_arena_ptr() + offset, payload,
                    type.size());
-            if (use_optix())
-                renderer()->copy_to_device(
-                    group.device_interactive_arena().d_get() + offset, payload,
-                    type.size());
+            if (!group.m_reparam_batch)
+                upload_interactive_params(group, offset, offset + size);
+            else if (group.m_reparam_dirty_begin == group.m_reparam_dirty_end) {
+                group.m_reparam_dirty_begin = offset;
+                group.m_reparam_dirty_end   = offset + size;
+            } else {
+                group.m_reparam_dirty_begin
+                    = std::min(group.m_reparam_dirty_begin, size_t(offset));
+                group.m_reparam_dirty_end
+                    = std::max(group.m_reparam_dirty_end, offset + size);
+            }
             m_stat_reparam_calls_changed += 1;
             m_stat_reparam_bytes_changed += size;
         }
+        // Keep the pristine copy in step, for any later rebuild.
+        if (group.has_pristine_layers()) {
+            ShaderInstance* pristine = group.pristine_layer(layerindex);
+            pristine->set_param_value(pristine->findparam(sym->name()), type,
+                                      val);
+        }
         return true;
     } else
         return true;
@@ -3445,10 +5300,515 @@ ShadingSystemImpl::ReParameter(ShaderGroup& group, string_view layername_,
 
 
 
+bool
+ShadingSystemImpl::reparameter_rebuild(ShaderGroup& group, int layerindex,
+                                       ustring paramname, TypeDesc type,
+                                       const void* val)
+{
+    lock_guard lock(group.m_mutex);
+    ShaderInstance* pristine = group.pristine_layer(layerindex);
+    int paramindex           = pristine->findparam(paramname);
+    if (paramindex < 0)
+        return false;
+    if (!relaxed_equivalent(pristine->mastersymbol(paramindex)->typespec(),
+                            type))
+        return false;
+    bool changed = false;
+    if (!pristine->set_param_value(paramindex, type, val, &changed))
+        return false;
+    m_stat_reparam_calls_total += 1;
+    m_stat_reparam_bytes_total += type.size();
+    if (!changed)
+        return true;
+    m_stat_reparam_calls_changed += 1;
+    m_stat_reparam_bytes_changed += type.size();
+
+    bool was_optimized = group.optimized();
+    if (was_optimized) {
+        // Only this layer and the ones downstream of it can see the new
+        // value. If the optimizer found all of them unused, the code we
+        // have is still right, and the value waits in the pristine copy.
+        int nlayers = group.nlayers();
+        std::vector<char> affected(nlayers, 0);
+        affected[layerindex] = 1;
+        bool visible         = false;
+        for (int i = layerindex; i < nlayers && !visible; ++i) {
+            for (auto&& c : group.pristine_layer(i)->connections())
+                if (affected[c.srclayer])
+                    affected[i] = 1;
+            // A layer merged away has its twin doing its work, so assume
+            // that one is affected, too.
+            if (affected[i] && (!group[i]->unused() || group[i]->merged_unused()))
+                visible = true;
+        }
+        if (!visible)
+            return true;
+    }
+    if (group.m_reparam_batch)
+        group.m_reparam_rebuild_pending = true;
+    else
+        rebuild_from_pristine(group);
+    return true;
+}
+
+
+
+void
+ShadingSystemImpl::rebuild_from_pristine(ShaderGroup& group)
+{
+    // Throw away the optimized layers and start over from the pristine
+    // ones. If the group hadn't been optimized again yet since a previous
+    // rebuild, this just refreshes its copies with the new values.
+    bool was_optimized = group.optimized();
+    group_post_jit_cleanup(group);
+    group.restore_pristine_layers();
+    if (m_opt_share_groups || m_llvm_pgo || m_opt_snapshot_dir.size()
+        || m_registry)
+        group.compute_canonical_hash(m_opt_share_groups);
+    if (was_optimized) {
+        m_stat_reparam_rebuilds += 1;
+        ++m_groups_to_compile_count;
+    }
+}
+
+
+
+void
+ShadingSystemImpl::upload_interactive_params(ShaderGroup& group, size_t begin,
+                                             size_t end)
+{
+    const uint8_t* src = group.interactive_arena_ptr() + begin;
+    if (DeviceArena* arena = device_arena())
+        arena->write(group.device_interactive_arena().d_get() + begin, src,
+                     end - begin);
+    else if (use_optix() && m_async_device_copies)
+        group.mark_interactive_dirty(begin, end);
+    else if (use_optix())
+        renderer()->copy_to_device(group.device_interactive_arena().d_get()
+                                       + begin,
+                                   src, end - begin);
+}
+
+
+
+void
+ShadingSystemImpl::ReParameterBegin(ShaderGroup& group)
+{
+    // ReParameter passes each change on to the variants, so they batch up
+    // their work, too.
+    for (auto&& variant : group.output_variants())
+        ReParameterBegin(*variant);
+    for (auto&& variant : group.raytype_variants())
+        ReParameterBegin(*variant);
+    if (ShaderGroup* variant = group.find_debug_variant())
+        ReParameterBegin(*variant);
+    if (ShaderGroup* variant = group.find_userdata_variant())
+        ReParameterBegin(*variant);
+    ++group.m_reparam_batch;
+}
+
+
+
+bool
+ShadingSystemImpl::ReParameterEnd(ShaderGroup& group)
+{
+    // Variants made since ReParameterBegin weren't part of the batch.
+    auto end_variant = [&](ShaderGroup* variant) {
+        if (variant && variant->m_reparam_batch)
+            ReParameterEnd(*variant);
+    };
+    for (auto&& variant : group.output_variants())
+        end_variant(variant.get());
+    for (auto&& variant : group.raytype_variants())
+        end_variant(variant.get());
+    end_variant(group.find_debug_variant());
+    end_variant(group.find_userdata_variant());
+
+    if (group.m_reparam_batch <= 0) {
+        errorfmt("ReParameterEnd: group {} has no ReParameterBegin",
+                 group.name());
+        return false;
+    }
+    if (--group.m_reparam_batch)
+        return true;
+    if (group.m_reparam_dirty_begin != group.m_reparam_dirty_end)
+        upload_interactive_params(group, group.m_reparam_dirty_begin,
+                                  group.m_reparam_dirty_end);
+    group.m_reparam_dirty_begin = group.m_reparam_dirty_end = 0;
+    if (group.m_reparam_rebuild_pending) {
+        lock_guard lock(group.m_mutex);
+        rebuild_from_pristine(group);
+        group.m_reparam_rebuild_pending = false;
+    }
+    return true;
+}
+
+
+
+ShaderGroupRef
+ShadingSystemImpl::copy_group_layers(ShaderGroup& group, string_view name)
+{
+    bool pristine = group.has_pristine_layers();
+    if (group.optimized() && !pristine)
+        return ShaderGroupRef();  // the unoptimized layers are gone
+
+    ShaderGroupRef copy(new ShaderGroup(name, *this));
+    int nlayers = group.nlayers();
+    copy->m_layers.reserve(nlayers);
+    for (int i = 0; i < nlayers; ++i)
+        copy->m_layers.emplace_back(new ShaderInstance(
+            pristine ? *group.pristine_layer(i) : *group[i]));
+    copy->m_exec_repeat      = group.m_exec_repeat;
+    copy->m_math_precision   = group.m_math_precision;
+    copy->m_num_entry_layers = group.m_num_entry_layers;
+    copy->m_raytype_queries  = group.m_raytype_queries;
+    copy->m_raytypes_on      = group.m_raytypes_on;
+    copy->m_raytypes_off     = group.m_raytypes_off;
+    copy->m_renderer_outputs = group.m_renderer_outputs;
+    copy->m_pass_outputs     = group.m_pass_outputs;
+    copy->m_has_pass_outputs = group.m_has_pass_outputs;
+    copy->m_symlocs          = group.m_symlocs;
+    copy->m_group_use        = group.m_group_use;
+    copy->m_layers_hash      = group.m_layers_hash;
+    copy->m_layers_text      = group.m_layers_text;
+    copy->m_complete         = true;
+    {
+        spin_lock lock(m_all_shader_groups_mutex);
+        m_all_shader_groups.push_back(copy);
+        ++m_groups_to_compile_count;
+    }
+    return copy;
+}
+
+
+
+ShaderGroupRef
+ShadingSystemImpl::specialize_outputs(ShaderGroup& group,
+                                      cspan<ustring> outputs)
+{
+    std::vector<ustring> keep(outputs.begin(), outputs.end());
+    std::sort(keep.begin(), keep.end());
+    keep.erase(std::unique(keep.begin(), keep.end()), keep.end());
+    auto find_variant = [&]() {
+        spin_lock lock(group.m_output_variants_mutex);
+        auto found = group.m_output_variants.find(keep);
+        return found != group.m_output_variants.end() ? found->second
+                                                      : ShaderGroupRef();
+    };
+    if (ShaderGroupRef variant = find_variant())
+        return variant;
+
+    if (!group.m_complete) {
+        errorfmt("specialize_outputs: group {} is not complete",
+                 group.name());
+        return ShaderGroupRef();
+    }
+    // Holding the lock keeps the group from being optimized while we copy
+    // its layers, and another thread from making the same variant.
+    lock_guard lock(group.m_mutex);
+    if (ShaderGroupRef variant = find_variant())
+        return variant;
+
+    std::string suffix;
+    for (auto&& k : keep)
+        suffix += fmtformat("{}{}", suffix.empty() ? "" : ",", k);
+    ShaderGroupRef variant
+        = copy_group_layers(group, fmtformat("{}[{}]", group.name(), suffix));
+    if (!variant) {
+        errorfmt(
+            "specialize_outputs: group {} was already optimized without "
+            "\"reparam_rebuild\", so its unoptimized layers are gone",
+            group.name());
+        return ShaderGroupRef();
+    }
+    variant->m_pass_outputs     = keep;
+    variant->m_has_pass_outputs = true;
+    {
+        spin_lock lock(group.m_output_variants_mutex);
+        group.m_output_variants.emplace(keep, variant);
+    }
+    m_stat_output_variants += 1;
+    return variant;
+}
+
+
+
+ShaderGroup&
+ShadingSystemImpl::raytype_variant(ShaderGroup& group, int raytype)
+{
+    // Only the ray types the group asks about, and that it isn't already
+    // specialized on, can make a difference to its code.
+    int unknown = group.raytype_queries()
+                  & ~(group.raytypes_on() | group.raytypes_off());
+    if (unknown <= 0)
+        return group;
+    int key = raytype & unknown;
+    if (ShaderGroup* variant = group.find_raytype_variant(key))
+        return *variant;
+
+    int limit = std::min(m_raytype_variants,
+                         ShaderGroup::max_raytype_variants);
+    if (group.num_raytype_variants() >= limit || !group.m_complete)
+        return group;  // cache is full, run the general version
+    lock_guard lock(group.m_mutex);
+    if (ShaderGroup* variant = group.find_raytype_variant(key))
+        return *variant;
+    if (group.num_raytype_variants() >= limit)
+        return group;
+    ShaderGroupRef variant
+        = copy_group_layers(group,
+                            fmtformat("{}[raytype {}]", group.name(), key));
+    if (!variant)
+        return group;
+    variant->set_raytypes(group.raytypes_on() | key,
+                          group.raytypes_off() | (unknown & ~key));
+    group.add_raytype_variant(key, variant);
+    m_stat_raytype_variants += 1;
+    return *variant;
+}
+
+
+
+ShaderGroup&
+ShadingSystemImpl::debug_variant(ShaderGroup& group)
+{
+    if (group.debug_checks())
+        return group;
+    if (ShaderGroup* variant = group.find_debug_variant())
+        return *variant;
+    if (!group.m_complete)
+        return group;
+    lock_guard lock(group.m_mutex);
+    if (ShaderGroup* variant = group.find_debug_variant())
+        return *variant;
+    ShaderGroupRef variant
+        = copy_group_layers(group, fmtformat("{}[debug]", group.name()));
+    if (!variant)
+        return group;
+    variant->m_debug_checks = true;
+    group.set_debug_variant(variant);
+    m_stat_debug_variants += 1;
+    return *variant;
+}
+
+
+
+ShaderGroup&
+ShadingSystemImpl::userdata_variant(ShaderGroup& group, ShaderGlobals& sg)
+{
+    // Until the group has been optimized, we don't know its userdata.
+    if (!group.optimized() || !group.m_complete)
+        return group;
+
+    // Fetch, with one renderer call, the userdata the variant assumes, or
+    // while profiling, all of them but those that need derivatives.
+    ShaderGroup* variant = group.find_userdata_variant();
+    if (!variant && group.m_userdata_profiled.load(std::memory_order_acquire))
+        return group;  // Nothing was constant, or no copy could be made
+    int n = 0;
+    std::vector<int> profiling;
+    if (variant) {
+        n = int(group.m_userdata_profile.size());
+    } else {
+        for (int i = 0, e = int(group.m_userdata_names.size()); i < e; ++i)
+            if (!group.m_userdata_derivs[i])
+                profiling.push_back(i);
+        n = int(profiling.size());
+    }
+    auto index = [&](int r) {
+        return variant ? group.m_userdata_profile[r].index : profiling[r];
+    };
+    size_t bytes = 0;
+    for (int r = 0; r < n; ++r)
+        bytes += group.m_userdata_types[index(r)].size();
+    RendererServices::UserdataGather* requests
+        = OSL_ALLOCA(RendererServices::UserdataGather, n);
+    char* values = OSL_ALLOCA(char, bytes);
+    bytes        = 0;
+    for (int r = 0; r < n; ++r) {
+        int i       = index(r);
+        requests[r] = { group.m_userdata_names[i], group.m_userdata_types[i],
+                        false, values + bytes, false };
+        bytes += group.m_userdata_types[i].size();
+    }
+    if (n)
+        renderer()->get_userdata_all(&sg, { requests, n });
+    // Is the result of request r what was recorded in p?
+    auto same = [&](int r, const ShaderGroup::UserdataProfile& p) {
+        return requests[r].found == p.found
+               && (!p.found
+                   || !memcmp(requests[r].val, p.value.data(),
+                              p.value.size()));
+    };
+
+    if (variant) {
+        // The guard: every userdata the copy assumes must be as it was.
+        for (int r = 0; r < n; ++r) {
+            if (!same(r, group.m_userdata_profile[r])) {
+                m_stat_userdata_misses += 1;
+                return group;
+            }
+        }
+        return *variant;
+    }
+
+    {
+        spin_lock lock(group.m_userdata_profile_mutex);
+        if (group.m_userdata_profiled)
+            return group;
+        auto& profile(group.m_userdata_profile);
+        if (group.m_userdata_shades_profiled == 0) {
+            for (int r = 0; r < n; ++r) {
+                const char* v = (const char*)requests[r].val;
+                profile.push_back({ profiling[r], requests[r].found, false,
+                                    requests[r].found
+                                        ? std::vector<char>(
+                                              v, v + requests[r].type.size())
+                                        : std::vector<char>() });
+            }
+        } else {
+            for (int r = 0; r < n; ++r)
+                profile[r].varies |= !same(r, profile[r]);
+        }
+        if (++group.m_userdata_shades_profiled < m_userdata_variants)
+            return group;
+        // Enough shades: only the userdata that were found with the same
+        // value every time are worth specializing on.
+        auto unfit = [](const ShaderGroup::UserdataProfile& p) {
+            return p.varies || !p.found;
+        };
+        profile.erase(std::remove_if(profile.begin(), profile.end(), unfit),
+                      profile.end());
+        group.m_userdata_profiled = true;
+    }
+
+    // Only the one thread that finished profiling gets here.
+    auto& profile(group.m_userdata_profile);
+    if (profile.empty())
+        return group;
+    lock_guard lock(group.m_mutex);
+    ShaderGroupRef copy = copy_group_layers(group,
+                                            fmtformat("{}[userdata]",
+                                                      group.name()));
+    if (!copy)
+        return group;
+    // Make each parameter bound to one of those userdata an instance value
+    // that isn't interpolated, so that the optimizer can fold it. Drop the
+    // userdata no parameter could take that way.
+    size_t kept = 0;
+    for (size_t u = 0; u < profile.size(); ++u) {
+        const auto& p(profile[u]);
+        ustring name  = group.m_userdata_names[p.index];
+        TypeDesc type = group.m_userdata_types[p.index];
+        // The renderer hands back string userdata as hashes
+        std::vector<ustring> strings;
+        const void* val = p.value.data();
+        if (type.basetype == TypeDesc::STRING) {
+            for (size_t v = 0; v < type.basevalues(); ++v)
+                strings.push_back(ustring::from_hash(
+                    ((const ustringhash*)p.value.data())[v].hash()));
+            val = strings.data();
+        }
+        bool used = false;
+        for (int l = 0, e = copy->nlayers(); l < e; ++l) {
+            ShaderInstance* inst = (*copy)[l];
+            int param            = inst->findparam(name);
+            if (param < 0 || !inst->instoverride(param)->interpolated())
+                continue;
+            if (inst->set_param_value(param, type, val)) {
+                inst->instoverride(param)->interpolated(false);
+                used = true;
+            }
+        }
+        if (used && kept++ != u)
+            profile[kept - 1] = std::move(profile[u]);
+    }
+    profile.resize(kept);
+    if (profile.empty())
+        return group;
+    if (m_opt_share_groups || m_llvm_pgo || m_opt_snapshot_dir.size()
+        || m_registry)
+        copy->compute_canonical_hash(m_opt_share_groups);
+    group.set_userdata_variant(copy);
+    m_stat_userdata_variants += 1;
+    return *copy;
+}
+
+
+
 PerThreadInfo*
-ShadingSystemImpl::create_thread_info()
+ShadingSystemImpl::create_thread_info(int numa_node)
+{
+    return new PerThreadInfo(numa_node);
+}
+
+
+
+ThreadProfile::ThreadProfile(ShadingSystemImpl& ss)
+    : shadingsys(&ss)
+{
+    ss.add_thread_profile(this);
+}
+
+
+
+ThreadProfile::~ThreadProfile()
+{
+    if (shadingsys)
+        shadingsys->remove_thread_profile(this);
+}
+
+
+
+void
+ShadingSystemImpl::add_thread_profile(ThreadProfile* profile)
 {
-    return new PerThreadInfo;
+    spin_lock lock(m_thread_profiles_mutex);
+    m_thread_profiles.push_back(profile);
+}
+
+
+
+void
+ShadingSystemImpl::remove_thread_profile(ThreadProfile* profile)
+{
+    // Don't lose the times it has recorded since the last merge
+    merge_profiles();
+    spin_lock lock(m_thread_profiles_mutex);
+    auto found = std::find(m_thread_profiles.begin(), m_thread_profiles.end(),
+                           profile);
+    if (found != m_thread_profiles.end())
+        m_thread_profiles.erase(found);
+}
+
+
+
+void
+ShadingSystemImpl::merge_profiles() const
+{
+    std::unordered_map<int, ShaderGroupRef> groups;  // Live groups by id
+    {
+        spin_lock lock(m_all_shader_groups_mutex);
+        for (auto&& grp : m_all_shader_groups)
+            if (ShaderGroupRef g = grp.lock())
+                groups[g->id()] = g;
+    }
+    spin_lock lock(m_thread_profiles_mutex);
+    for (ThreadProfile* profile : m_thread_profiles) {
+        spin_lock profile_lock(profile->mutex);
+        m_stat_total_shading_time_ticks += profile->total_ticks;
+        profile->total_ticks = 0;
+        for (auto&& pg : profile->groups) {
+            auto found = groups.find(pg.first);
+            if (found == groups.end())
+                continue;  // The group is gone, and its times with it
+            ShaderGroup& g(*found->second);
+            g.m_stat_total_shading_time_ticks += pg.second.ticks;
+            for (int b = 0; b < ShaderGroup::exec_histogram_buckets; ++b)
+                g.m_exec_histogram[b] += pg.second.histogram[b];
+        }
+        profile->groups.clear();
+    }
 }
 
 
@@ -3473,6 +5833,16 @@ ShadingSystemImpl::get_context(PerThreadInfo* threadinfo,
                               ? new ShadingContext(*this, threadinfo)
                               : threadinfo->pop_context();
     ctx->texture_thread_info(texture_threadinfo);
+    if (m_context_heap_presize) {
+        // Size the heap for every group JITed so far (e.g., all of them,
+        // after optimize_all_groups), so shading never reallocates it.
+        size_t heapsize;
+        {
+            spin_lock stat_lock(m_stat_mutex);
+            heapsize = m_max_groupdata_size;
+        }
+        ctx->reserve_heap(heapsize);
+    }
     return ctx;
 }
 
@@ -3652,6 +6022,14 @@ ShadingSystemImpl::is_renderer_output(ustring layername, ustring paramname,
                                       ShaderGroup* group) const
 {
     ustring name2 = ustring::fmtformat("{}.{}", layername, paramname);
+    if (group && group->has_pass_outputs()) {
+        // A variant made by specialize_outputs only produces the outputs
+        // it was asked for, whatever else the renderer has declared.
+        const std::vector<ustring>& keep(group->pass_outputs());
+        if (!std::binary_search(keep.begin(), keep.end(), paramname)
+            && !std::binary_search(keep.begin(), keep.end(), name2))
+            return false;
+    }
     if (group) {
         for (auto&& sl : group->m_symlocs) {
             if (sl.arena == SymArena::Outputs
@@ -3729,8 +6107,27 @@ ShadingSystemImpl::optimize_group(ShaderGroup& group, ShadingContext* ctx,
     if (group.optimized() && (!do_jit || group.jitted()))
         return;  // already optimized and optionally jitted
 
+    // Just compiled counts as recently used, for the memory budget.
+    group.mark_used(m_memory_epoch);
+
     OIIO::Timer timer;
-    lock_guard lock(group.m_mutex);
+    std::unique_lock<mutex> lock(group.m_mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        // Another thread is compiling this group. With greedyjit every
+        // group will be compiled anyway, so rather than wait idle, take
+        // on ones nobody has started until this one is free.
+        static thread_local bool helping = false;
+        if (m_greedyjit && !helping) {
+            helping = true;
+            while (!lock.try_lock() && compile_idle_group(group, ctx, do_jit))
+                ;
+            helping = false;
+            if (ctx)
+                ctx->group(&group);
+        }
+        if (!lock.owns_lock())
+            lock.lock();
+    }
     bool need_jit = do_jit && !group.jitted();
     if (group.optimized() && !need_jit) {
         // The group was somehow optimized by another thread between the
@@ -3760,6 +6157,16 @@ ShadingSystemImpl::optimize_group(ShaderGroup& group, ShadingContext* ctx,
 
     double locking_time = timer();
 
+    if (need_jit && !group.optimized() && m_opt_share_groups
+        && share_twin_group(group)) {
+        m_stat_groups_shared += 1;
+        m_groups_to_compile_count -= 1;
+        spin_lock stat_lock(m_stat_mutex);
+        m_stat_opt_locking_time += locking_time;
+        m_stat_optimization_time += timer();
+        return;
+    }
+
     bool ctx_allocated         = false;
     PerThreadInfo* thread_info = nullptr;
     if (!ctx) {
@@ -3768,9 +6175,32 @@ ShadingSystemImpl::optimize_group(ShaderGroup& group, ShadingContext* ctx,
         ctx_allocated = true;
     }
     if (!group.optimized()) {
+        // Hang on to the layers as they were before optimization, so that
+        // ReParameter can change values the optimizer would fold away.
+        // Any raytype, debug or userdata variants made after that come
+        // from them, too.
+        if ((m_reparam_rebuild || m_raytype_variants || debug_sampling()
+             || m_userdata_variants || m_memory_budget > 0)
+            && !use_optix() && !group.has_pristine_layers())
+            group.save_pristine_layers();
+
         RuntimeOptimizer rop(*this, group, ctx);
         rop.run();
         rop.police_failed_optimizations();
+        if (m_opt_report)
+            group.m_opt_report = rop.optimization_report();
+
+        // Each master was loaded once, however many layers use it.
+        std::set<const ShaderMaster*> masters;
+        for (int i = 0, e = group.nlayers(); i < e; ++i)
+            masters.insert(group[i]->master());
+        ShaderGroup::CompileTimes& times(group.m_compile_times);
+        times.oso_load = 0;
+        for (auto&& m : masters)
+            times.oso_load += m->load_time();
+        times.runtime_opt      = rop.m_stat_specialization_time;
+        times.batched_analysis = rop.m_stat_batched_analysis_time;
+        times.layer_opt        = rop.m_layer_opt_time;
 
         // Copy some info recorded by the RuntimeOptimizer into the group
         group.m_unknown_textures_needed = rop.m_unknown_textures_needed;
@@ -3807,7 +6237,8 @@ ShadingSystemImpl::optimize_group(ShaderGroup& group, ShadingContext* ctx,
         group.m_optimized = true;
 
         if (use_optix_cache())
-            group.generate_optix_cache_key(rop.serialize());
+            group.generate_optix_cache_key(rop.serialize()
+                                           + m_optix_target_arch.string());
 
         spin_lock stat_lock(m_stat_mutex);
         if (!need_jit) {
@@ -3830,13 +6261,60 @@ ShadingSystemImpl::optimize_group(ShaderGroup& group, ShadingContext* ctx,
                 optix_cache_unwrap(cache_value,
                                    group.m_llvm_ptx_compiled_version,
                                    group.m_llvm_groupdata_size);
+                ptx_resource_usage(group.m_llvm_ptx_compiled_version,
+                                   group.m_ptx_registers,
+                                   group.m_ptx_local_bytes);
             }
         }
 
+        // A hybrid renderer runs the group on the CPU as well. Generate
+        // that code too, from the same optimized group, rather than have
+        // a second ShadingSystem optimize it all over again.
+        if (use_optix() && m_optix_host_jit) {
+            BackendLLVM hostjitter(*this, group, ctx);
+            hostjitter.host_target();
+            hostjitter.run();
+            m_stat_optix_host_jits += 1;
+            spin_lock stat_lock(m_stat_mutex);
+            m_stat_total_llvm_time += hostjitter.m_stat_total_llvm_time;
+            m_stat_llvm_setup_time += hostjitter.m_stat_llvm_setup_time;
+            m_stat_llvm_irgen_time += hostjitter.m_stat_llvm_irgen_time;
+            m_stat_llvm_opt_time += hostjitter.m_stat_llvm_opt_time;
+            m_stat_llvm_jit_time += hostjitter.m_stat_llvm_jit_time;
+        }
+
         if (!cached) {
+            bool batching = (renderer()->batched(WidthOf<16>()) != nullptr)
+                            || (renderer()->batched(WidthOf<8>()) != nullptr)
+                            || (renderer()->batched(WidthOf<4>()) != nullptr);
+            // In tiered mode, get the group running as quickly as possible
+            // with an unoptimized JIT, and leave the fully optimized one to
+            // the background compile threads, which will swap it in.
+            bool tiered = m_llvm_jit_tiered > 0 && m_llvm_optimize > 0
+                          && !use_optix() && !batching;
+
             BackendLLVM lljitter(*this, group, ctx);
+            if (tiered)
+                lljitter.llvm_optimize(0);
             lljitter.run();
 
+            // If the PTX needs too much local memory per thread, generate
+            // it again with more and more of the most expensive layers
+            // kept out of line, until it fits or none are left to split.
+            if (use_optix() && m_optix_split_threshold > 0) {
+                int ncalled = lljitter.num_called_layers(), nsplit = 0;
+                while (nsplit < ncalled
+                       && group.m_ptx_local_bytes > m_optix_split_threshold) {
+                    nsplit = std::min(std::max(1, 2 * nsplit), ncalled);
+                    BackendLLVM splitter(*this, group, ctx);
+                    splitter.recompiling(true);
+                    splitter.optix_split_layers(nsplit);
+                    splitter.run();
+                }
+                if (nsplit)
+                    m_stat_optix_split_groups += 1;
+            }
+
             // NOTE: it is now possible to optimize and not JIT
             // which would leave the cleanup to happen
             // when the ShadingSystem is destroyed
@@ -3844,14 +6322,24 @@ ShadingSystemImpl::optimize_group(ShaderGroup& group, ShadingContext* ctx,
             // Only cleanup when are not batching or if
             // the batch jit has already happened,
             // as it requires the ops so we can't delete them yet!
-            if (((renderer()->batched(WidthOf<16>()) == nullptr)
-                 && (renderer()->batched(WidthOf<8>()) == nullptr)
-                 && (renderer()->batched(WidthOf<4>()) == nullptr))
-                || group.batch_jitted()) {
+            // Likewise, the background re-JIT of a tiered group still
+            // needs them.
+            if (tiered) {
+                group.m_needs_rejit = true;
+                schedule_background_jit(group);
+            } else if (!batching || group.batch_jitted()) {
                 group_post_jit_cleanup(group);
             }
 
             group.m_jitted = true;
+            if (!tiered && !batching)
+                register_twin_group(group);
+            ShaderGroup::CompileTimes& times(group.m_compile_times);
+            times.llvm_setup  = lljitter.m_stat_llvm_setup_time;
+            times.llvm_irgen  = lljitter.m_stat_llvm_irgen_time;
+            times.llvm_opt    = lljitter.m_stat_llvm_opt_time;
+            times.llvm_jit    = lljitter.m_stat_llvm_jit_time;
+            times.layer_irgen = lljitter.m_layer_irgen_time;
             spin_lock stat_lock(m_stat_mutex);
             m_stat_opt_locking_time += locking_time;
             m_stat_optimization_time += timer();
@@ -3862,18 +6350,383 @@ ShadingSystemImpl::optimize_group(ShaderGroup& group, ShadingContext* ctx,
             m_stat_llvm_jit_time += lljitter.m_stat_llvm_jit_time;
             m_stat_max_llvm_local_mem = std::max(m_stat_max_llvm_local_mem,
                                                  lljitter.m_llvm_local_mem);
+            m_max_groupdata_size = std::max(m_max_groupdata_size,
+                                            group.llvm_groupdata_size());
+        }
+    }
+
+    if (ctx_allocated) {
+        release_context(ctx);
+        destroy_thread_info(thread_info);
+    }
+
+    {
+        spin_lock stat_lock(m_stat_mutex);
+        auto& compiletime(m_group_compile_times[group.id()]);
+        compiletime.first = group.name();
+        compiletime.second += timer() - locking_time;
+    }
+
+    m_stat_groups_compiled += 1;
+    m_stat_instances_compiled += group.nlayers();
+    m_groups_to_compile_count -= 1;
+}
+
+std::shared_ptr<const FoldedLayer>
+ShadingSystemImpl::find_folded_layer(const std::string& key)
+{
+    spin_lock lock(m_folded_layers_mutex);
+    auto found = m_folded_layers.find(key);
+    return found != m_folded_layers.end() ? found->second : nullptr;
+}
+
+
+
+void
+ShadingSystemImpl::add_folded_layer(const std::string& key,
+                                    std::shared_ptr<const FoldedLayer> layer)
+{
+    spin_lock lock(m_folded_layers_mutex);
+    if (m_folded_layers.size() < size_t(m_opt_fold_memo))
+        m_folded_layers.emplace(key, std::move(layer));
+}
+
+
+
+std::shared_ptr<const BatchedLayerAnalysis>
+ShadingSystemImpl::find_batched_analysis(const std::string& key)
+{
+    spin_lock lock(m_batched_analyses_mutex);
+    auto found = m_batched_analyses.find(key);
+    return found != m_batched_analyses.end() ? found->second : nullptr;
+}
+
+
+
+void
+ShadingSystemImpl::add_batched_analysis(
+    const std::string& key, std::shared_ptr<const BatchedLayerAnalysis> a)
+{
+    spin_lock lock(m_batched_analyses_mutex);
+    if (m_batched_analyses.size() < size_t(m_opt_batched_analysis_memo))
+        m_batched_analyses.emplace(key, std::move(a));
+}
+
+
+
+bool
+ShadingSystemImpl::share_twin_group(ShaderGroup& group)
+{
+    // The batched JIT still needs the ops that sharing would leave behind,
+    // and OptiX groups are compiled per group name.
+    if (use_optix() || renderer()->batched(WidthOf<16>())
+        || renderer()->batched(WidthOf<8>())
+        || renderer()->batched(WidthOf<4>()))
+        return false;
+    uint64_t key = group.canonical_hash();
+    if (!key)
+        return false;
+    ShaderGroupRef twin;
+    {
+        spin_lock lock(m_twin_groups_mutex);
+        auto found = m_twin_groups.find(key);
+        if (found != m_twin_groups.end())
+            twin = found->second.lock();
+    }
+    if (!twin || twin.get() == &group)
+        return false;
+
+    // We hold our own lock, and the twin may be holding its own while it
+    // waits for ours (to share our code, if it has been rebuilt since it
+    // was registered), so never wait for the twin's lock: if it's busy,
+    // compile on our own. With its lock, check that it hasn't been rebuilt
+    // since it was registered, and that it truly has the same code and
+    // not just the same hash.
+    std::unique_lock<mutex> twin_lock(twin->m_mutex, std::try_to_lock);
+    if (!twin_lock.owns_lock() || !twin->jitted() || twin->m_needs_rejit
+        || twin->canonical_hash() != key || !group.same_canonical_code(*twin))
+        return false;
+    if ((m_reparam_rebuild || m_memory_budget > 0)
+        && !group.has_pristine_layers())
+        group.save_pristine_layers();
+    group.share_compiled(*twin);
+    return true;
+}
+
+
+
+void
+ShadingSystemImpl::register_twin_group(ShaderGroup& group)
+{
+    if (!m_opt_share_groups || use_optix())
+        return;
+    uint64_t key = group.canonical_hash();
+    if (!key)
+        return;
+    std::weak_ptr<ShaderGroup> ref = group.weak_from_this();
+    if (ref.expired())
+        return;  // not owned by a ShaderGroupRef
+    spin_lock lock(m_twin_groups_mutex);
+    m_twin_groups[key] = ref;
+}
+
+
+
+// Where the branch profile for key and size is saved.
+static std::string
+branch_profile_filename(string_view dir, uint64_t key, size_t size)
+{
+    return fmtformat("{}/{:016x}-{}.oslprof", dir, key, size);
+}
+
+
+
+std::shared_ptr<std::vector<uint64_t>>
+ShadingSystemImpl::branch_profile(uint64_t key, size_t size, bool create)
+{
+    std::lock_guard<std::mutex> lock(m_branch_profiles_mutex);
+    auto& profile = m_branch_profiles[std::make_pair(key, size)];
+    if (!profile && create) {
+        profile = std::make_shared<std::vector<uint64_t>>(size, 0);
+    } else if (!profile && m_llvm_pgo_dir.size()) {
+        std::string text;
+        if (OIIO::Filesystem::read_text_file(
+                branch_profile_filename(m_llvm_pgo_dir, key, size), text)) {
+            auto counts = std::make_shared<std::vector<uint64_t>>();
+            counts->reserve(size);
+            const char* s = text.c_str();
+            char* end     = nullptr;
+            for (; counts->size() < size; s = end) {
+                unsigned long long c = std::strtoull(s, &end, 10);
+                if (end == s)
+                    break;
+                counts->push_back(c);
+            }
+            if (counts->size() == size)
+                profile = counts;
+        }
+    }
+    return profile;
+}
+
+
+
+void
+ShadingSystemImpl::save_branch_profiles()
+{
+    if (!OIIO::Filesystem::is_directory(m_llvm_pgo_dir)
+        && !OIIO::Filesystem::create_directory(m_llvm_pgo_dir)) {
+        errorfmt("Could not create llvm_pgo_dir \"{}\"", m_llvm_pgo_dir);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_branch_profiles_mutex);
+    for (auto&& p : m_branch_profiles) {
+        const std::vector<uint64_t>* counts = p.second.get();
+        if (!counts || std::all_of(counts->begin(), counts->end(),
+                                   [](uint64_t c) { return c == 0; }))
+            continue;  // never ran, don't clobber an earlier profile
+        std::string filename = branch_profile_filename(m_llvm_pgo_dir,
+                                                       p.first.first,
+                                                       p.first.second);
+        // Write to a temporary and rename it into place, so that a reader
+        // never sees a partial profile.
+        std::string tmpname = OIIO::Filesystem::unique_path(filename
+                                                            + ".tmp-%%%%%%%%");
+        {
+            OIIO::ofstream out;
+            OIIO::Filesystem::open(out, tmpname);
+            if (!out) {
+                errorfmt("Could not write branch profile \"{}\"", tmpname);
+                continue;
+            }
+            for (uint64_t c : *counts)
+                out << c << '\n';
+        }
+        std::string err;
+        if (!OIIO::Filesystem::rename(tmpname, filename, err))
+            OIIO::Filesystem::remove(tmpname, err);
+    }
+}
+
+
+
+RunLLVMGroupFunc
+ShadingSystemImpl::jit_deferred_layer(ShaderGroup& group,
+                                      ShaderGroup::CompiledCode& code,
+                                      int layer)
+{
+    // The deferred code and names were set before the code was published
+    // and never change, so they need no lock. The deferred code serializes
+    // requests for the same function itself.
+    if (!code.deferred_code || layer < 0
+        || layer >= (int)code.deferred_names.size()
+        || code.deferred_names[layer].empty())
+        return nullptr;
+    OIIO::Timer timer;
+    std::string err;
+    RunLLVMGroupFunc func = (RunLLVMGroupFunc)LLVM_Util::jit_deferred_function(
+        *code.deferred_code, code.deferred_names[layer], &err);
+    if (!func) {
+        errorfmt("Could not JIT layer {} of shader group {}: {}",
+                 group[layer]->layername(), group.name(), err);
+        return nullptr;
+    }
+    // Keep it for next time, unless another thread got there first.
+    RunLLVMGroupFunc expected = nullptr;
+    if (!code.layers[layer].compare_exchange_strong(expected, func,
+                                                    std::memory_order_acq_rel))
+        return expected;
+    m_stat_lazy_layers_jitted += 1;
+    double t = timer();
+    spin_lock stat_lock(m_stat_mutex);
+    m_stat_llvm_jit_time += t;
+    auto& compiletime(m_group_compile_times[group.id()]);
+    compiletime.first = group.name();
+    compiletime.second += t;
+    return func;
+}
+
+
+
+void
+ShadingSystemImpl::schedule_background_jit(ShaderGroup& group)
+{
+    std::lock_guard<std::mutex> lock(m_background_jit_mutex);
+    if (m_background_jit_stop)
+        return;
+    m_background_jit_queue.push_back(group.weak_from_this());
+    while (m_background_jit_nthreads < m_llvm_jit_tiered) {
+        m_background_jit_threads.add_thread(
+            new std::thread(&ShadingSystemImpl::background_jit_worker, this));
+        ++m_background_jit_nthreads;
+    }
+    m_background_jit_cv.notify_one();
+}
+
+
+
+void
+ShadingSystemImpl::stop_background_jit()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_background_jit_mutex);
+        m_background_jit_stop = true;
+        m_background_jit_queue.clear();
+    }
+    m_background_jit_cv.notify_all();
+    m_background_jit_idle_cv.notify_all();
+    // Any worker in the middle of a group finishes it before exiting.
+    m_background_jit_threads.join_all();
+}
+
+
+
+void
+ShadingSystemImpl::wait_for_background_jit()
+{
+    std::unique_lock<std::mutex> lock(m_background_jit_mutex);
+    m_background_jit_idle_cv.wait(lock, [this] {
+        return m_background_jit_stop
+               || (m_background_jit_queue.empty() && !m_background_jit_busy);
+    });
+}
+
+
+
+void
+ShadingSystemImpl::background_jit_worker()
+{
+    PerThreadInfo* threadinfo = create_thread_info();
+    ShadingContext* ctx       = get_context(threadinfo);
+    for (;;) {
+        ShaderGroupRef group;
+        {
+            std::unique_lock<std::mutex> lock(m_background_jit_mutex);
+            m_background_jit_cv.wait(lock, [this] {
+                return m_background_jit_stop || !m_background_jit_queue.empty();
+            });
+            if (m_background_jit_stop)
+                break;
+            // The group may have been released while it waited in line.
+            group = m_background_jit_queue.front().lock();
+            m_background_jit_queue.pop_front();
+            ++m_background_jit_busy;
+        }
+        if (group)
+            background_jit_group(*group, ctx);
+        std::lock_guard<std::mutex> lock(m_background_jit_mutex);
+        if (--m_background_jit_busy == 0 && m_background_jit_queue.empty())
+            m_background_jit_idle_cv.notify_all();
+    }
+    release_context(ctx);
+    destroy_thread_info(threadinfo);
+}
+
+
+
+void
+ShadingSystemImpl::background_jit_group(ShaderGroup& group,
+                                        ShadingContext* ctx)
+{
+    OIIO::Timer timer;
+    lock_guard lock(group.m_mutex);
+    if (!group.m_needs_rejit)
+        return;
+
+    // The new code uses the same groupdata layout as the quick JIT.
+    // BackendLLVM publishes its entry points all at once when they're
+    // ready, and shades that began with the old ones keep running those.
+    // The old code stays resident in the JIT memory manager, which never
+    // frees it.
+    ctx->group(&group);
+    BackendLLVM lljitter(*this, group, ctx);
+    lljitter.recompiling(true);
+    lljitter.run();
+    group.m_needs_rejit = false;
+    group_post_jit_cleanup(group);
+    register_twin_group(group);
+
+    // Count the full-optimization compile as part of the group's cost.
+    ShaderGroup::CompileTimes& times(group.m_compile_times);
+    times.llvm_setup += lljitter.m_stat_llvm_setup_time;
+    times.llvm_irgen += lljitter.m_stat_llvm_irgen_time;
+    times.llvm_opt += lljitter.m_stat_llvm_opt_time;
+    times.llvm_jit += lljitter.m_stat_llvm_jit_time;
+
+    m_stat_background_jits += 1;
+    spin_lock stat_lock(m_stat_mutex);
+    m_stat_background_jit_time += timer();
+}
+
+
+
+bool
+ShadingSystemImpl::compile_idle_group(const ShaderGroup& busy,
+                                      ShadingContext* ctx, bool do_jit)
+{
+    ShaderGroupRef idle;
+    {
+        spin_lock lock(m_all_shader_groups_mutex);
+        for (auto&& grp : m_all_shader_groups) {
+            ShaderGroupRef g = grp.lock();
+            if (!g || g.get() == &busy || !g->m_complete
+                || (g->optimized() && (!do_jit || g->jitted())))
+                continue;
+            // Skip it if somebody is already at work on it
+            if (!g->m_mutex.try_lock())
+                continue;
+            g->m_mutex.unlock();
+            idle = g;
+            break;
         }
     }
+    if (!idle)
+        return false;
+    optimize_group(*idle, ctx, do_jit);
+    return true;
+}
 
-    if (ctx_allocated) {
-        release_context(ctx);
-        destroy_thread_info(thread_info);
-    }
 
-    m_stat_groups_compiled += 1;
-    m_stat_instances_compiled += group.nlayers();
-    m_groups_to_compile_count -= 1;
-}
 
 #if OSL_USE_BATCHED
 template<int WidthT>
@@ -3943,6 +6796,8 @@ ShadingSystemImpl::Batched<WidthT>::jit_group(ShaderGroup& group,
     m_ssi.m_stat_llvm_jit_time += lljitter.m_stat_llvm_jit_time;
     m_ssi.m_stat_max_llvm_local_mem = std::max(m_ssi.m_stat_max_llvm_local_mem,
                                                lljitter.m_llvm_local_mem);
+    m_ssi.m_max_groupdata_size = std::max(m_ssi.m_max_groupdata_size,
+                                          group.llvm_groupdata_wide_size());
 
     // TODO: not sure how to count these given batched vs. not
     m_ssi.m_stat_groups_compiled += 1;
@@ -3951,23 +6806,426 @@ ShadingSystemImpl::Batched<WidthT>::jit_group(ShaderGroup& group,
 }
 #endif
 
-static void
-optimize_all_groups_wrapper(ShadingSystemImpl* ss, int mythread,
-                            int totalthreads, bool do_jit)
+// Rough guess at the relative cost of optimizing and JITing a group,
+// before the fact: its total op count, plus a bit of fixed overhead per
+// layer. Where oslc recorded static estimates for a shader, its loops
+// (which LLVM works hardest on) and the ops that take derivatives (whose
+// code is about three times the size) add to that.
+static size_t
+estimated_compile_cost(const ShaderGroup& group)
 {
-    ss->optimize_all_groups(1, mythread, totalthreads, do_jit);
+    size_t cost = 0;
+    for (int layer = 0, n = group.nlayers(); layer < n; ++layer) {
+        const ShaderInstance* inst = group[layer];
+        size_t nops                = inst->ops().size();
+        if (!nops && inst->master())
+            nops = inst->master()->num_ops();
+        cost += nops + 10;
+        if (inst->master() && inst->master()->cost().known) {
+            const OSLQuery::CostEstimate& est(inst->master()->cost());
+            cost += 20 * size_t(est.loops) + 2 * size_t(est.derivs);
+        }
+    }
+    return cost;
 }
 
 
-#if OSL_USE_BATCHED
-template<int WidthT>
-static void
-batched_jit_all_groups_wrapper(ShadingSystemImpl* ss, int mythread,
-                               int totalthreads)
+
+std::vector<ShaderGroupRef>
+ShadingSystemImpl::groups_to_compile_by_cost(bool do_jit)
+{
+    std::vector<std::pair<size_t, ShaderGroupRef>> costed;
+    {
+        spin_lock lock(m_all_shader_groups_mutex);
+        costed.reserve(m_all_shader_groups.size());
+        for (auto&& grp : m_all_shader_groups) {
+            ShaderGroupRef g = grp.lock();
+            if (g && g->m_complete
+                && !(g->optimized() && (!do_jit || g->jitted())))
+                costed.emplace_back(0, std::move(g));
+        }
+    }
+    for (auto&& c : costed)
+        c.first = estimated_compile_cost(*c.second);
+    std::stable_sort(costed.begin(), costed.end(),
+                     [](const auto& a, const auto& b) {
+                         return a.first > b.first;
+                     });
+    std::vector<ShaderGroupRef> groups;
+    groups.reserve(costed.size());
+    for (auto&& c : costed)
+        groups.emplace_back(std::move(c.second));
+    return groups;
+}
+
+
+
+void
+ShadingSystemImpl::optimize_group_list(cspan<ShaderGroupRef> groups,
+                                       std::atomic<size_t>& next, bool do_jit)
 {
-    ss->batched<WidthT>().jit_all_groups(1, mythread, totalthreads);
+    PerThreadInfo* threadinfo = create_thread_info();
+    ShadingContext* ctx       = get_context(threadinfo);
+    for (size_t i = next++; i < size_t(groups.size()); i = next++)
+        optimize_group(*groups[i], ctx, do_jit);
+    release_context(ctx);
+    destroy_thread_info(threadinfo);
 }
-#endif
+
+
+
+size_t
+ShadingSystemImpl::compact_shader_code()
+{
+    std::vector<ShaderMaster::ref> masters;
+    {
+        lock_guard guard(m_mutex);
+        for (auto& m : m_shader_masters)
+            if (m.second)
+                masters.push_back(m.second);
+    }
+    size_t saved = 0;
+    for (auto& m : masters)
+        saved += m->compact_code();
+    if (debug())
+        infofmt("Compacted the code of {} shaders, saving {}", masters.size(),
+                OIIO::Strutil::memformat(saved));
+    return saved;
+}
+
+
+
+size_t
+ShadingSystemImpl::enforce_memory_budget()
+{
+    // Groups that ran since the last call carry this epoch; from now on
+    // they'll carry the next.
+    int epoch = m_memory_epoch++;
+    if (m_memory_budget <= 0)
+        return 0;
+
+    std::vector<ShaderGroupRef> groups;
+    {
+        spin_lock lock(m_all_shader_groups_mutex);
+        groups.reserve(m_all_shader_groups.size());
+        for (auto&& g : m_all_shader_groups)
+            if (ShaderGroupRef group = g.lock())
+                groups.push_back(group);
+    }
+    long long held = m_stat_memory.current();
+    for (auto&& group : groups)
+        held += group->jit_bytes();
+    long long budget = (long long)(m_memory_budget * double(1 << 20));
+    if (held <= budget)
+        return 0;
+
+    // Evict the groups that haven't run in the longest time, as long as
+    // they have pristine layers to be optimized again from, until we're
+    // within budget. Groups that ran since the last call are left alone.
+    std::vector<ShaderGroupRef> idle;
+    for (auto&& group : groups)
+        if (group->last_used_epoch() < epoch && group->has_pristine_layers()
+            && group->optimized())
+            idle.push_back(group);
+    std::stable_sort(idle.begin(), idle.end(),
+                     [](const ShaderGroupRef& a, const ShaderGroupRef& b) {
+                         return a->last_used_epoch() < b->last_used_epoch();
+                     });
+    long long freed = 0;
+    int nevicted    = 0;
+    for (auto&& group : idle) {
+        if (held - freed <= budget)
+            break;
+        // Skip any group that another thread is compiling, or that is
+        // waiting on its background JIT.
+        std::unique_lock<mutex> lock(group->m_mutex, std::try_to_lock);
+        if (!lock.owns_lock() || !group->optimized() || group->m_needs_rejit)
+            continue;
+        long long before = group->memory_used();
+        group_post_jit_cleanup(*group);
+        group->restore_pristine_layers();
+        ++m_groups_to_compile_count;
+        freed += std::max(0LL, before - (long long)group->memory_used());
+        ++nevicted;
+    }
+    m_stat_groups_evicted += nevicted;
+    m_stat_memory_evicted += freed;
+    if (debug() && nevicted)
+        infofmt("Evicted {} idle groups to stay within the memory budget, "
+                "freeing {}",
+                nevicted, OIIO::Strutil::memformat(freed));
+    return size_t(freed);
+}
+
+
+
+bool
+ShadingSystemImpl::jit_group_memory(const ShaderGroup& group) const
+{
+    // Groups the memory budget may evict need it, too.
+    return !use_optix()
+           && (m_llvm_jit_group_memory
+               || (m_memory_budget > 0 && group.has_pristine_layers()));
+}
+
+
+
+DeviceArena*
+ShadingSystemImpl::device_arena()
+{
+    if (!use_optix() || m_device_arena_size <= 0)
+        return nullptr;
+    std::lock_guard<std::mutex> lock(m_device_arena_mutex);
+    if (!m_device_arena)
+        m_device_arena.reset(new DeviceArena(renderer(), m_device_arena_size));
+    return m_device_arena.get();
+}
+
+
+
+void
+ShadingSystemImpl::precompile_regex(ustring pattern)
+{
+    bool compiled = false;
+    try {
+        find_regex(pattern, &compiled);
+    } catch (const std::regex_error&) {
+        // Leave it to fail (and be reported) when it's run, as it would
+        // have without this.
+    }
+    if (compiled)
+        m_stat_regexes += 1;
+}
+
+
+
+size_t
+ShadingSystemImpl::upload_device_data(void* stream)
+{
+    std::lock_guard<std::mutex> lock(m_device_arena_mutex);
+    std::vector<DeviceCopy> copies;
+    if (m_device_arena)
+        m_device_arena->take_changes(copies);
+
+    // Stage what's to be copied, so that the host side doesn't change
+    // under an asynchronous copy, alternating buffers so that the last
+    // upload's stays put while the renderer may still be copying it.
+    std::vector<uint8_t>& staging(m_device_staging[m_device_staging_next]);
+    m_device_staging_next ^= 1;
+    staging.clear();
+    for (auto&& c : copies)
+        staging.insert(staging.end(), c.src, c.src + c.size);
+    if (m_async_device_copies && use_optix()) {
+        spin_lock lock(m_all_shader_groups_mutex);
+        for (auto&& g : m_all_shader_groups) {
+            ShaderGroupRef group = g.lock();
+            size_t begin, end;
+            if (!group || !group->take_interactive_dirty(begin, end)
+                || !group->device_interactive_arena())
+                continue;
+            const uint8_t* src = group->interactive_arena_ptr();
+            copies.push_back(
+                { group->device_interactive_arena().d_get() + begin, nullptr,
+                  end - begin });
+            staging.insert(staging.end(), src + begin, src + end);
+        }
+    }
+    if (copies.empty())
+        return 0;
+
+    size_t bytes = 0;
+    for (auto&& c : copies) {
+        renderer()->copy_to_device_async(c.dst, staging.data() + bytes,
+                                         c.size, stream);
+        bytes += c.size;
+    }
+    m_stat_device_uploads += 1;
+    m_stat_device_upload_bytes += bytes;
+    return bytes;
+}
+
+
+
+void
+ShadingSystemImpl::set_task_executor(ShadingSystem::TaskExecutor executor)
+{
+    OIIO::spin_rw_write_lock lock(m_options_mutex);
+    m_task_executor = std::move(executor);
+}
+
+
+
+void
+ShadingSystemImpl::run_tasks(int ntasks, const std::function<void(int)>& task)
+{
+    ShadingSystem::TaskExecutor executor;
+    {
+        OIIO::spin_rw_read_lock lock(m_options_mutex);
+        executor = m_task_executor;
+    }
+    if (executor) {
+        executor(ntasks, task);
+    } else if (ntasks == 1) {
+        task(0);
+    } else if (ntasks > 1) {
+        OIIO::thread_group threads;
+        for (int t = 0; t < ntasks; ++t)
+            threads.add_thread(new std::thread(task, t));
+        threads.join_all();
+    }
+}
+
+
+
+std::vector<std::string>
+ShadingSystemImpl::ptx_compile_groups(cspan<ShaderGroupRef> groups,
+                                      int nthreads,
+                                      const ShadingSystem::PTXReadyFunc& ready)
+{
+    std::vector<std::string> ptx(groups.size());
+    if (!use_optix()) {
+        errorfmt("ptx_compile_groups requires the use_optix option");
+        return ptx;
+    }
+    if (nthreads < 1)  // threads <= 0 means use all hardware available
+        nthreads = (int)std::thread::hardware_concurrency();
+    nthreads = std::max(1, std::min(nthreads, (int)groups.size()));
+
+    // Each thread claims the next group, so that a thread done with a
+    // cheap group goes on to another instead of waiting for the others.
+    std::atomic<size_t> next(0);
+    auto compile = [&]() {
+        PerThreadInfo* threadinfo = create_thread_info();
+        ShadingContext* ctx       = get_context(threadinfo);
+        for (size_t i = next++; i < ptx.size(); i = next++) {
+            if (!groups[i])
+                continue;
+            optimize_group(*groups[i], ctx, true /*do_jit*/);
+            ptx[i] = groups[i]->m_llvm_ptx_compiled_version;
+            if (ready && ptx[i].size())
+                ready(i, ptx[i]);
+        }
+        release_context(ctx);
+        destroy_thread_info(threadinfo);
+    };
+    if (nthreads == 1) {
+        compile();
+    } else {
+        m_threads_currently_compiling += nthreads;
+        run_tasks(nthreads, [&](int) { compile(); });
+        m_threads_currently_compiling -= nthreads;
+    }
+    return ptx;
+}
+
+
+
+uint32_t
+ShadingSystemImpl::make_string_table(cspan<ShaderGroupRef> groups,
+                                     cspan<ustring> extra,
+                                     std::vector<int32_t>& seeds,
+                                     std::vector<uint64_t>& keys)
+{
+    std::vector<uint64_t> hashes;
+    for (auto&& group : groups)
+        if (group)
+            for (ustring s : group->m_device_strings)
+                hashes.push_back(s.hash());
+    for (ustring s : extra)
+        hashes.push_back(s.hash());
+    return OSL::make_string_table(hashes.data(), hashes.size(), seeds, keys);
+}
+
+
+
+bool
+ShadingSystemImpl::shade_grid_device(ShaderGroup& group, int npoints,
+                                     void* sg, void* groupdata,
+                                     void* userdata_base, void* output_base,
+                                     void* stream)
+{
+    if (!use_optix() || !optix_wavefront()) {
+        errorfmt("shade_grid_device requires the use_optix and "
+                 "optix_wavefront options");
+        return false;
+    }
+    if (!group.jitted()) {
+        PerThreadInfo* threadinfo = create_thread_info();
+        ShadingContext* ctx       = get_context(threadinfo);
+        optimize_group(group, ctx, true /*do_jit*/);
+        release_context(ctx);
+        destroy_thread_info(threadinfo);
+    }
+    if (group.m_llvm_ptx_compiled_version.empty()) {
+        errorfmt("Group \"{}\" has no PTX to launch", group.name());
+        return false;
+    }
+    if (npoints <= 0)
+        return true;
+
+    std::string kernel_name  = wavefront_function_name(group);
+    void* interactive_params = group.device_interactive_arena().d_get();
+    void* args[] = { &sg,          &groupdata, &userdata_base,
+                     &output_base, &npoints,   &interactive_params };
+    if (!renderer()->launch_device_kernel(group.m_llvm_ptx_compiled_version,
+                                          kernel_name, npoints, args,
+                                          stream)) {
+        errorfmt("Could not launch the kernel of group \"{}\"", group.name());
+        return false;
+    }
+    return true;
+}
+
+
+
+std::shared_ptr<const std::string>
+ShadingSystemImpl::device_program(
+    ShaderGroup& group, string_view arch,
+    const ShadingSystem::DeviceCompileFunc& compile)
+{
+    if (!group.jitted()) {
+        PerThreadInfo* threadinfo = create_thread_info();
+        ShadingContext* ctx       = get_context(threadinfo);
+        optimize_group(group, ctx, true /*do_jit*/);
+        release_context(ctx);
+        destroy_thread_info(threadinfo);
+    }
+    const std::string& ptx(group.m_llvm_ptx_compiled_version);
+    if (ptx.empty())
+        return nullptr;
+
+    // Identical PTX (from any group) for the same arch compiles once.
+    std::string key = fmtformat("{}-{:016x}-{}", arch, Strutil::strhash(ptx),
+                                ptx.size());
+    std::promise<std::shared_ptr<const std::string>> compiled;
+    DeviceProgramFuture pending;
+    {
+        std::lock_guard<std::mutex> lock(m_device_programs_mutex);
+        auto found = m_device_programs.find(key);
+        if (found != m_device_programs.end())
+            pending = found->second;
+        else
+            m_device_programs[key] = compiled.get_future().share();
+    }
+    if (pending.valid()) {
+        m_stat_device_programs_shared += 1;
+        return pending.get();
+    }
+    std::shared_ptr<const std::string> program;
+    std::string code = compile ? compile(ptx, arch) : std::string();
+    if (code.size()) {
+        program = std::make_shared<const std::string>(std::move(code));
+        m_stat_device_programs_compiled += 1;
+    } else {
+        // Let a later request try again.
+        std::lock_guard<std::mutex> lock(m_device_programs_mutex);
+        m_device_programs.erase(key);
+    }
+    compiled.set_value(program);
+    return program;
+}
+
+
 
 void
 ShadingSystemImpl::optimize_all_groups(int nthreads, int mythread,
@@ -3981,13 +7239,20 @@ ShadingSystemImpl::optimize_all_groups(int nthreads, int mythread,
     if (nthreads > 1) {
         if (m_threads_currently_compiling)
             return;  // never mind, somebody else spawned the JIT threads
-        OIIO::thread_group threads;
+        // Rather than dealing the groups out to threads round-robin, have
+        // every thread claim the next group from one shared list sorted
+        // most expensive first. The big groups then start right away
+        // instead of one of them being the long tail, and a thread that
+        // finishes early simply takes over the remaining work.
+        std::vector<ShaderGroupRef> groups = groups_to_compile_by_cost(do_jit);
+        std::atomic<size_t> next(0);
+        nthreads = std::min(nthreads, std::max(1, (int)groups.size()));
         m_threads_currently_compiling += nthreads;
-        for (int t = 0; t < nthreads; ++t)
-            threads.add_thread(new std::thread(optimize_all_groups_wrapper,
-                                               this, t, nthreads, do_jit));
-        threads.join_all();
+        run_tasks(nthreads,
+                  [&](int) { optimize_group_list(groups, next, do_jit); });
         m_threads_currently_compiling -= nthreads;
+        if (m_texture_prefetch)
+            prefetch_textures(0);
         return;
     }
 
@@ -4013,6 +7278,68 @@ ShadingSystemImpl::optimize_all_groups(int nthreads, int mythread,
     }
     release_context(ctx);
     destroy_thread_info(threadinfo);
+    if (m_texture_prefetch && totalthreads == 1)
+        prefetch_textures(0);
+}
+
+
+
+void
+ShadingSystemImpl::prefetch_textures(int nthreads)
+{
+    static ustring u_texturetype("texturetype");
+    static ustring u_plain_texture("Plain Texture");
+    TextureSystem* ts = renderer()->texturesys();
+    std::vector<ustring> files;
+    {
+        std::set<ustring> seen;
+        spin_lock lock(m_all_shader_groups_mutex);
+        for (auto&& g : m_all_shader_groups) {
+            ShaderGroupRef group = g.lock();
+            if (!group || !group->optimized())
+                continue;
+            for (auto&& f : group->m_textures_needed)
+                if (seen.insert(f).second)
+                    files.push_back(f);
+        }
+    }
+    if (files.empty())
+        return;
+
+    // Each thread claims the next file, gets its handle (which is then
+    // cached, so the handles the JIT baked in resolve at no cost), reads
+    // its header, and for plain textures does one lookup of the whole
+    // image, which reads the single tile of its coarsest MIP level.
+    // Failures are left for the render's own lookups to report.
+    std::atomic<size_t> next(0);
+    auto prefetch = [&]() {
+        PerThreadInfo* threadinfo = create_thread_info();
+        ShadingContext* ctx       = get_context(threadinfo);
+        for (size_t i = next++; i < files.size(); i = next++) {
+            RendererServices::TextureHandle* handle
+                = renderer()->get_texture_handle(files[i], ctx, nullptr);
+            ustringhash type, errormessage;
+            if (!renderer()->get_texture_info(files[i], handle,
+                                              ctx->texture_thread_info(),
+                                              nullptr, 0, u_texturetype,
+                                              TypeString, &type,
+                                              &errormessage))
+                continue;
+            if (ts && handle && ustring_from(type) == u_plain_texture) {
+                TextureOpt opt;
+                float result;
+                if (!ts->texture(handle, ctx->texture_thread_info(), opt, 0.5f,
+                                 0.5f, 1.0f, 0.0f, 0.0f, 1.0f, 1, &result))
+                    (void)ts->geterror();
+            }
+        }
+        release_context(ctx);
+        destroy_thread_info(threadinfo);
+    };
+    if (nthreads < 1)
+        nthreads = (int)std::thread::hardware_concurrency();
+    nthreads = std::max(1, std::min(nthreads, (int)files.size()));
+    run_tasks(nthreads, [&](int) { prefetch(); });
 }
 
 #if OSL_USE_BATCHED
@@ -4029,13 +7356,9 @@ ShadingSystemImpl::Batched<WidthT>::jit_all_groups(int nthreads, int mythread,
     if (nthreads > 1) {
         if (m_ssi.m_threads_currently_compiling)
             return;  // never mind, somebody else spawned the JIT threads
-        OIIO::thread_group threads;
         m_ssi.m_threads_currently_compiling += nthreads;
-        for (int t = 0; t < nthreads; ++t)
-            threads.add_thread(
-                new std::thread(batched_jit_all_groups_wrapper<WidthT>, &m_ssi,
-                                t, nthreads));
-        threads.join_all();
+        m_ssi.run_tasks(nthreads,
+                        [&](int t) { jit_all_groups(1, t, nthreads); });
         m_ssi.m_threads_currently_compiling -= nthreads;
         return;
     }
@@ -4093,13 +7416,18 @@ ShadingSystemImpl::merge_instances(ShaderGroup& group, bool post_opt)
     // general shading and lookdev approach of the studio.  But it was
     // very helpful for us in many cases.
     //
-    // The basic loop below looks very inefficient, O(n^2) in number of
-    // instances in the group. But it's really not -- a few seconds (sum
-    // of all threads) for even our very complex scenes. This is because
-    // most potential pairs have a very fast rejection case if they are
-    // not using the same master.  Since there's no appreciable cost to
-    // the brute force approach, it seems silly to have a complex scheme
-    // to try to reduce the number of pairings.
+    // Comparing every pair of layers is O(n^2), which used to be fine
+    // since most pairs are quickly rejected for having different masters,
+    // but generated groups can have thousands of nodes. So the layers are
+    // bucketed by ShaderInstance::merge_hash(), and only layers in the same
+    // bucket get the full mergeable() comparison.
+    //
+    // Layers are visited in order, which is topological order (a layer's
+    // connections all come from earlier layers), and each is hashed when
+    // it's reached, after any merges of its upstream layers have rewired
+    // its connections. So a chain of duplicates collapses in one pass,
+    // and since a merge only rewires layers not yet visited, that pass
+    // leaves nothing more to merge.
 
     if (!m_opt_merge_instances || optimize() < 1)
         return 0;
@@ -4115,65 +7443,74 @@ ShadingSystemImpl::merge_instances(ShaderGroup& group, bool post_opt)
         if (!group[layer]->unused())
             group[layer]->evaluate_writes_globals_and_userdata_params();
 
-    // Loop over all layers...
-    for (int a = 0; a < nlayers - 1; ++a) {
-        if (group[a]->unused()
-            || group[a]->entry_layer())  // Don't merge a layer that's not used
-            continue;                    // or if it's an entry layer
-        // Check all later layers...
-        for (int b = a + 1; b < nlayers; ++b) {
-            if (group[b]->unused())  // Don't merge a layer that's not used
-                continue;
-            if (b == nlayers - 1)  // Don't merge the last layer -- causes
-                continue;          // many tears because it's the group entry
+    // Earlier layers that may be kept and merged into, by merge_hash
+    std::unordered_map<uint64_t, std::vector<int>> buckets;
+    for (int b = 0; b < nlayers; ++b) {
+        if (group[b]->unused())  // Don't merge a layer that's not used
+            continue;
+        std::vector<int>& bucket(buckets[group[b]->merge_hash()]);
+
+        // Find the first earlier layer in the bucket that's mergeable
+        // (identical). All the heavy lifting is done by
+        // ShaderInstance::mergeable().
+        int a = -1;
+        if (b != nlayers - 1) {  // Don't merge the last layer -- causes
+                                 // many tears because it's the group entry
+            for (int candidate : bucket) {
+                if (group[candidate]->mergeable(*group[b], group)) {
+                    a = candidate;
+                    break;
+                }
+            }
+        }
+        if (a < 0) {
+            // Keep b, and let later layers merge into it, unless it's an
+            // entry layer.
+            if (!group[b]->entry_layer())
+                bucket.push_back(b);
+            continue;
+        }
 
-            // Now we have two used layers, a and b, to examine.
-            // See if they are mergeable (identical).  All the heavy
-            // lifting is done by ShaderInstance::mergeable().
-            if (!group[a]->mergeable(*group[b], group))
+        // The two nodes a and b are mergeable, so merge them.
+        ShaderInstance* A = group[a];
+        ShaderInstance* B = group[b];
+        ++merges;
+
+        // We'll keep A, get rid of B.  For all layers later than B,
+        // check its incoming connections and replace all references
+        // to B with references to A.
+        for (int j = b + 1; j < nlayers; ++j) {
+            ShaderInstance* inst = group[j];
+            if (inst->unused())  // don't bother if it's unused
                 continue;
-
-            // The two nodes a and b are mergeable, so merge them.
-            ShaderInstance* A = group[a];
-            ShaderInstance* B = group[b];
-            ++merges;
-
-            // We'll keep A, get rid of B.  For all layers later than B,
-            // check its incoming connections and replace all references
-            // to B with references to A.
-            for (int j = b + 1; j < nlayers; ++j) {
-                ShaderInstance* inst = group[j];
-                if (inst->unused())  // don't bother if it's unused
-                    continue;
-                for (int c = 0, ce = inst->nconnections(); c < ce; ++c) {
-                    Connection& con = inst->connection(c);
-                    if (con.srclayer == b) {
-                        con.srclayer = a;
-                        A->outgoing_connections(true);
-                        if (A->symbols().size() && B->symbols().size()) {
-                            OSL_DASSERT(A->symbol(con.src.param)->name()
-                                        == B->symbol(con.src.param)->name());
-                        }
+            for (int c = 0, ce = inst->nconnections(); c < ce; ++c) {
+                Connection& con = inst->connection(c);
+                if (con.srclayer == b) {
+                    con.srclayer = a;
+                    A->outgoing_connections(true);
+                    if (A->symbols().size() && B->symbols().size()) {
+                        OSL_DASSERT(A->symbol(con.src.param)->name()
+                                    == B->symbol(con.src.param)->name());
                     }
                 }
             }
+        }
 
-            // Mark parameters of B as no longer connected
-            for (int p = B->firstparam(); p < B->lastparam(); ++p) {
-                if (B->symbols().size())
-                    B->symbol(p)->connected_down(false);
-                if (B->m_instoverrides.size())
-                    B->instoverride(p)->connected_down(false);
-            }
-            // B won't be used, so mark it as having no outgoing
-            // connections and clear its incoming connections (which are
-            // no longer used).
-            OSL_DASSERT(B->merged_unused() == false);
-            B->outgoing_connections(false);
-            connectionmem += B->clear_connections();
-            B->m_merged_unused = true;
-            OSL_DASSERT(B->unused());
+        // Mark parameters of B as no longer connected
+        for (int p = B->firstparam(); p < B->lastparam(); ++p) {
+            if (B->symbols().size())
+                B->symbol(p)->connected_down(false);
+            if (B->m_instoverrides.size())
+                B->instoverride(p)->connected_down(false);
         }
+        // B won't be used, so mark it as having no outgoing
+        // connections and clear its incoming connections (which are
+        // no longer used).
+        OSL_DASSERT(B->merged_unused() == false);
+        B->outgoing_connections(false);
+        connectionmem += B->clear_connections();
+        B->m_merged_unused = true;
+        OSL_DASSERT(B->unused());
     }
 
     {
@@ -4200,14 +7537,22 @@ OIIO::ColorProcessorHandle
 OCIOColorSystem::load_transform(ustring fromspace, ustring tospace,
                                 ShadingSystemImpl* ss)
 {
-    if (fromspace != m_last_colorproc_fromspace
-        || tospace != m_last_colorproc_tospace) {
-        m_last_colorproc = colorconfig(ss).createColorProcessor(fromspace,
-                                                                tospace);
-        m_last_colorproc_fromspace = fromspace;
-        m_last_colorproc_tospace   = tospace;
+    // Move the entry found, or else the new one in place of the oldest,
+    // to the front.
+    int i = 0;
+    while (i < colorproc_cache_size - 1
+           && (m_colorprocs[i].fromspace != fromspace
+               || m_colorprocs[i].tospace != tospace))
+        ++i;
+    if (m_colorprocs[i].fromspace != fromspace
+        || m_colorprocs[i].tospace != tospace) {
+        m_colorprocs[i].processor
+            = colorconfig(ss).createColorProcessor(fromspace, tospace);
+        m_colorprocs[i].fromspace = fromspace;
+        m_colorprocs[i].tospace   = tospace;
     }
-    return m_last_colorproc;
+    std::rotate(m_colorprocs, m_colorprocs + i, m_colorprocs + i + 1);
+    return m_colorprocs[0].processor;
 }
 
 
@@ -4256,6 +7601,23 @@ ShadingSystemImpl::archive_shadergroup(ShaderGroup& group, string_view filename)
     }
     filename_base.erase(filename_base.size() - extension.size());
 
+    if (extension == ".oslbundle") {
+        // Just the group's shaders, as a bundle for "searchpath:bundle".
+        std::vector<std::string> osofiles;
+        {
+            std::lock_guard<ShaderGroup> lock(group);
+            for (int i = 0, nl = group.nlayers(); i < nl; ++i)
+                osofiles.push_back(group[i]->master()->osofilename());
+        }
+        std::string err;
+        if (!ShaderBundle::write(fmtformat("{}{}", filename, extension),
+                                 osofiles, err)) {
+            errorfmt("archive_shadergroup: {}", err);
+            return false;
+        }
+        return true;
+    }
+
     std::string pattern = OIIO::Filesystem::temp_directory_path()
                           + "/OSL-%%%%-%%%%";
     if (!pattern.size()) {
@@ -4339,6 +7701,42 @@ ShadingSystemImpl::archive_shadergroup(ShaderGroup& group, string_view filename)
 
 
 
+bool
+ShadingSystemImpl::write_shader_bundle(string_view filename,
+                                       cspan<std::string> shadernames)
+{
+    std::vector<std::string> searchpath_dirs;
+    {
+        lock_guard guard(m_mutex);
+        searchpath_dirs = m_searchpath_dirs;
+    }
+    std::vector<std::string> osofiles;
+    for (const std::string& name : shadernames) {
+        std::string osofile = name;
+        if (!Strutil::ends_with(osofile, ".oso"))
+            osofile += ".oso";
+        if (!OIIO::Filesystem::exists(osofile))
+            osofile = OIIO::Filesystem::searchpath_find(osofile,
+                                                        searchpath_dirs,
+                                                        searchpath_dirs.empty());
+        if (osofile.empty()) {
+            errorfmt("write_shader_bundle: No .oso file could be found for "
+                     "shader \"{}\"",
+                     name);
+            return false;
+        }
+        osofiles.push_back(osofile);
+    }
+    std::string err;
+    if (!ShaderBundle::write(filename, osofiles, err)) {
+        errorfmt("write_shader_bundle: {}", err);
+        return false;
+    }
+    return true;
+}
+
+
+
 void
 ShadingSystemImpl::register_inline_function(ustring name)
 {
@@ -4404,6 +7802,19 @@ ClosureRegistry::register_closure(string_view name, int id,
         else
             entry.nkeyword++;
     }
+    // Do the formal params leave any gap, or padding, in the struct?
+    std::vector<std::pair<int, int>> ranges;
+    for (int i = 0; i < entry.nformal; ++i)
+        ranges.emplace_back(entry.params[i].offset,
+                            entry.params[i].offset
+                                + int(entry.params[i].type.size()));
+    std::sort(ranges.begin(), ranges.end());
+    int filled = 0;
+    for (auto&& r : ranges)
+        if (r.first <= filled)
+            filled = std::max(filled, r.second);
+    entry.formals_fill_struct = entry.nkeyword == 0
+                                && filled >= entry.struct_size;
     entry.prepare                       = prepare;
     entry.setup                         = setup;
     m_closure_name_to_id[ustring(name)] = id;
@@ -4469,6 +7880,24 @@ ShadingContext::ocio_transform(ustring fromspace, ustring tospace,
 
 
 
+bool
+ShadingContext::ocio_transform(ustring fromspace, ustring tospace,
+                               Color3* colors, int n)
+{
+#ifndef __CUDA_ARCH__
+    if (auto cp = m_ocio_system.load_transform(fromspace, tospace,
+                                               &shadingsys())) {
+        if (n > 0)
+            cp->apply((float*)colors, n, 1, 3, sizeof(float), sizeof(Color3),
+                      n * sizeof(Color3));
+        return true;
+    }
+#endif
+    return false;
+}
+
+
+
 OSL_NAMESPACE_END
 
 
@@ -4629,6 +8058,7 @@ OSL::OSLQuery::init(const ShaderGroup* group, int layernum)
     }
 
     m_meta.clear();  // no metadata available at this point
+    m_cost = master->cost();
 
     return true;
 }
@@ -4786,6 +8216,22 @@ osl_get_attribute(void* sg_, int dest_derivs, ustringhash_pod obj_name_,
 
 
 
+OSL_SHADEOP int
+osl_get_attribute_per_object(void* sg_, int dest_derivs,
+                             ustringhash_pod obj_name_,
+                             ustringhash_pod attr_name_, int array_lookup,
+                             int index, long long attr_type, void* attr_dest)
+{
+    ShaderGlobals* sg     = (ShaderGlobals*)sg_;
+    ustringhash obj_name  = ustringhash_from(obj_name_);
+    ustringhash attr_name = ustringhash_from(attr_name_);
+    return sg->context->osl_get_attribute_per_object(
+        sg, dest_derivs, obj_name, attr_name, array_lookup, index,
+        TYPEDESC(attr_type), attr_dest);
+}
+
+
+
 OSL_SHADEOP int
 osl_bind_interpolated_param(void* sg_, ustringhash_pod name_, long long type,
                             int userdata_has_derivs, void* userdata_data,
@@ -4825,6 +8271,16 @@ osl_bind_interpolated_param(void* sg_, ustringhash_pod name_, long long type,
 
 
 
+OSL_SHADEOP void
+osl_gather_userdata(void* sg_, void* groupdata, void* userdata_initialized)
+{
+    ShaderGlobals* sg = (ShaderGlobals*)sg_;
+    sg->context->gather_userdata(sg, (char*)groupdata,
+                                 (char*)userdata_initialized);
+}
+
+
+
 OSL_SHADEOP void
 osl_incr_get_userdata_calls(void* sg_)
 {
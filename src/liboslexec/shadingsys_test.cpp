@@ -0,0 +1,741 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <OpenImageIO/strutil.h>
+#include <OpenImageIO/unittest.h>
+#include <OpenImageIO/ustring.h>
+
+#include <OSL/genclosure.h>
+#include <OSL/oslclosure.h>
+#include <OSL/oslexec.h>
+#include <OSL/rendererservices.h>
+#if OSL_USE_BATCHED
+#    include <OSL/batched_rendererservices.h>
+#    include <OSL/batched_shaderglobals.h>
+#endif
+
+using namespace OSL;
+
+
+// shader test (float scale = 2, output float x = 0, output float y = 0)
+// {
+//     x = u * scale + v;
+//     y = v * scale;
+// }
+static const char* test_oso = R"(OpenShadingLanguage 1.00
+# Compiled by oslc 1.14.0
+shader test
+param	float	scale	2		%read{0,2} %write{2147483647,-1}
+oparam	float	x	0		%read{2147483647,-1} %write{1,1}
+oparam	float	y	0		%read{2147483647,-1} %write{2,2}
+global	float	u	%read{0,0} %write{2147483647,-1}
+global	float	v	%read{1,2} %write{2147483647,-1}
+temp	float	$tmp1	%read{1,1} %write{0,0}
+code ___main___
+	mul	$tmp1 u scale 	%argrw{"wrr"}
+	add	x $tmp1 v 	%argrw{"wrr"}
+	mul	y v scale 	%argrw{"wrr"}
+	end
+)";
+
+
+
+// Build a group of one "test" layer, with the given scale, and renderer
+// output x.
+static ShaderGroupRef
+make_group(ShadingSystem& ss, string_view name, float scale,
+           ParamHints hints = ParamHints::none)
+{
+    ShaderGroupRef group = ss.ShaderGroupBegin(name);
+    ss.Parameter(*group, "scale", scale, hints);
+    ss.Shader(*group, "surface", "test", "layer1");
+    ss.ShaderGroupEnd(*group);
+    ustring outputs[] = { ustring("x") };
+    ss.attribute(group.get(), "renderer_outputs",
+                 TypeDesc(TypeDesc::STRING, 1), outputs);
+    return group;
+}
+
+
+
+// Shade one point with the group, returning the named output (-1 if the
+// group has no such output).
+static float
+shade(ShadingSystem& ss, ShaderGroup& group, string_view output = "x")
+{
+    PerThreadInfo* threadinfo = ss.create_thread_info();
+    ShadingContext* ctx       = ss.get_context(threadinfo);
+    ShaderGlobals sg;
+    memset((char*)&sg, 0, sizeof(sg));
+    sg.u = 0.5f;
+    sg.v = 0.25f;
+    OIIO_CHECK_ASSERT(ss.execute(*ctx, group, 0, 0, sg, nullptr, nullptr));
+    TypeDesc type;
+    const float* r = (const float*)ss.get_symbol(*ctx, ustring(output), type);
+    float result   = r ? *r : -1.0f;
+    ss.release_context(ctx);
+    ss.destroy_thread_info(threadinfo);
+    return result;
+}
+
+
+
+static long long
+get_stat(ShadingSystem& ss, const std::string& name)
+{
+    int value = 0;
+    if (ss.getattribute("stat:" + name, value))
+        return value;
+    long long llvalue = 0;
+    ss.getattribute("stat:" + name, TypeDesc::INT64, &llvalue);
+    return llvalue;
+}
+
+
+
+#if OSL_USE_BATCHED
+// Batched renderer services that provide nothing beyond the defaults.
+template<int WidthT>
+class TestBatchedRenderer final : public BatchedRendererServices<WidthT> {
+public:
+    bool is_overridden_get_inverse_matrix_WmWxWf() const override
+    {
+        return false;
+    }
+    bool is_overridden_get_matrix_WmWsWf() const override { return false; }
+    bool is_overridden_get_inverse_matrix_WmsWf() const override
+    {
+        return false;
+    }
+    bool is_overridden_get_inverse_matrix_WmWsWf() const override
+    {
+        return false;
+    }
+    bool is_overridden_texture() const override { return false; }
+    bool is_overridden_texture3d() const override { return false; }
+    bool is_overridden_environment() const override { return false; }
+    bool is_overridden_pointcloud_search() const override { return false; }
+    bool is_overridden_pointcloud_get() const override { return false; }
+    bool is_overridden_pointcloud_write() const override { return false; }
+};
+
+
+
+class TestRenderer final : public RendererServices {
+public:
+    BatchedRendererServices<16>* batched(WidthOf<16>) override
+    {
+        return &m_batched16;
+    }
+    BatchedRendererServices<8>* batched(WidthOf<8>) override
+    {
+        return &m_batched8;
+    }
+    BatchedRendererServices<4>* batched(WidthOf<4>) override
+    {
+        return &m_batched4;
+    }
+
+private:
+    TestBatchedRenderer<16> m_batched16;
+    TestBatchedRenderer<8> m_batched8;
+    TestBatchedRenderer<4> m_batched4;
+};
+
+
+
+// Configure ss for the widest batched execution the machine supports,
+// returning the width, or 0 if there is none.
+static int
+configure_batched(ShadingSystem& ss)
+{
+    for (int width : { 16, 8, 4 })
+        if (ss.configure_batch_execution_at(width))
+            return width;
+    return 0;
+}
+#endif
+
+
+
+// With "opt_share_groups", groups that differ only in the values of their
+// interactive parameters share one compile, and each still sees its own
+// values; groups that differ otherwise don't.
+static void
+test_share_groups()
+{
+    RendererServices renderer;
+    ShadingSystem ss(&renderer);
+    ss.attribute("opt_share_groups", 1);
+    OIIO_CHECK_ASSERT(ss.LoadMemoryCompiledShader("test", test_oso));
+
+    ShaderGroupRef a = make_group(ss, "a", 2.0f, ParamHints::interactive);
+    ShaderGroupRef b = make_group(ss, "b", 3.0f, ParamHints::interactive);
+    ShaderGroupRef c = make_group(ss, "c", 3.0f);
+    OIIO_CHECK_EQUAL(shade(ss, *a), 1.25f);
+    OIIO_CHECK_EQUAL(shade(ss, *b), 1.75f);
+    OIIO_CHECK_EQUAL(shade(ss, *c), 1.75f);
+    OIIO_CHECK_EQUAL(get_stat(ss, "groups_shared"), 1);
+}
+
+
+
+// Compile times are kept per group, so same-named groups each get their
+// own line in the slowest groups report.
+static void
+test_compile_times_by_group()
+{
+    RendererServices renderer;
+    ShadingSystem ss(&renderer);
+    OIIO_CHECK_ASSERT(ss.LoadMemoryCompiledShader("test", test_oso));
+
+    ShaderGroupRef a = make_group(ss, "same", 2.0f);
+    ShaderGroupRef b = make_group(ss, "same", 3.0f);
+    OIIO_CHECK_EQUAL(shade(ss, *a), 1.25f);
+    OIIO_CHECK_EQUAL(shade(ss, *b), 1.75f);
+    const char* report = nullptr;
+    OIIO_CHECK_ASSERT(ss.getattribute("stat:slowest_groups", TypeDesc::STRING,
+                                      &report));
+    std::string lines(report ? report : "");
+    int count = 0;
+    for (size_t pos = 0; (pos = lines.find(" same\n", pos)) != lines.npos;
+         ++pos)
+        ++count;
+    OIIO_CHECK_EQUAL(count, 2);
+}
+
+
+
+// With "opt_fold_memo", an identical layer of a later group reuses the
+// folded one, even across options that don't affect folding, but not
+// across ones that do.
+static void
+test_fold_memo()
+{
+    RendererServices renderer;
+    ShadingSystem ss(&renderer);
+    ss.attribute("opt_fold_memo", 16);
+    // Range-checked layers only match within their own group.
+    ss.attribute("range_checking", 0);
+    OIIO_CHECK_ASSERT(ss.LoadMemoryCompiledShader("test", test_oso));
+
+    ShaderGroupRef a = make_group(ss, "a", 2.0f);
+    OIIO_CHECK_EQUAL(shade(ss, *a), 1.25f);
+    OIIO_CHECK_EQUAL(get_stat(ss, "fold_memo_hits"), 0);
+
+    ss.attribute("max_warnings_per_thread", 50);
+    ShaderGroupRef b = make_group(ss, "b", 2.0f);
+    OIIO_CHECK_EQUAL(shade(ss, *b), 1.25f);
+    OIIO_CHECK_EQUAL(get_stat(ss, "fold_memo_hits"), 1);
+
+    ss.attribute("opt_constant_fold", 1);
+    ShaderGroupRef c = make_group(ss, "c", 2.0f);
+    OIIO_CHECK_EQUAL(shade(ss, *c), 1.25f);
+    OIIO_CHECK_EQUAL(get_stat(ss, "fold_memo_hits"), 1);
+}
+
+
+
+// shader down (float a = 0, float b = 0, float on = 0,
+//              output float da = 0, output float db = 0)
+// {
+//     da = Dx(a);
+//     db = b;
+//     if (on > 0)
+//         db = Dx(b);
+// }
+static const char* down_oso = R"(OpenShadingLanguage 1.00
+# Compiled by oslc 1.14.0
+shader down
+param	float	a	0		%read{0,0} %write{2147483647,-1}
+param	float	b	0		%read{1,4} %write{2147483647,-1}
+param	float	on	0		%read{2,2} %write{2147483647,-1}
+oparam	float	da	0		%read{2147483647,-1} %write{0,0}
+oparam	float	db	0		%read{2147483647,-1} %write{1,4}
+const	float	$const1	0		%read{2,2} %write{2147483647,-1}
+temp	int	$tmp1	%read{3,3} %write{2,2}
+code ___main___
+	Dx	da a 	%argrw{"wr"} %argderivs{1}
+	assign	db b 	%argrw{"wr"}
+	gt	$tmp1 on $const1 	%argrw{"wrr"}
+	if	$tmp1 5 5 	%argrw{"r"}
+	Dx	db b 	%argrw{"wr"} %argderivs{1}
+	end
+)";
+
+
+
+// With "opt_deriv_demand", the Dx(b) that optimization folds away no
+// longer makes layer1 carry derivatives of y, while x keeps them for its
+// symloc, which asks for derivatives, and for the Dx(a) in layer2. The
+// shaded results are the same either way.
+static void
+test_deriv_demand()
+{
+    for (int demand : { 1, 0 }) {
+        RendererServices renderer;
+        ShadingSystem ss(&renderer);
+        ss.attribute("opt_deriv_demand", demand);
+        OIIO_CHECK_ASSERT(ss.LoadMemoryCompiledShader("test", test_oso));
+        OIIO_CHECK_ASSERT(ss.LoadMemoryCompiledShader("down", down_oso));
+
+        ShaderGroupRef group = ss.ShaderGroupBegin("group");
+        ss.Shader(*group, "surface", "test", "layer1");
+        ss.Shader(*group, "surface", "down", "layer2");
+        ss.ConnectShaders(*group, "layer1", "x", "layer2", "a");
+        ss.ConnectShaders(*group, "layer1", "y", "layer2", "b");
+        ss.ShaderGroupEnd(*group);
+        ustring outputs[] = { ustring("x"), ustring("da") };
+        ss.attribute(group.get(), "renderer_outputs",
+                     TypeDesc(TypeDesc::STRING, 2), outputs);
+        SymLocationDesc symlocs[] = { SymLocationDesc("x", TypeDesc::FLOAT,
+                                                      /*derivs*/ true,
+                                                      SymArena::Outputs, 0,
+                                                      3 * sizeof(float)) };
+        ss.add_symlocs(group.get(), symlocs);
+
+        PerThreadInfo* threadinfo = ss.create_thread_info();
+        ShadingContext* ctx       = ss.get_context(threadinfo);
+        ShaderGlobals sg;
+        memset((char*)&sg, 0, sizeof(sg));
+        sg.u          = 0.5f;
+        sg.v          = 0.25f;
+        sg.dudx       = 0.5f;
+        sg.dvdy       = 1.0f;
+        float xout[3] = { -1.0f, -1.0f, -1.0f };
+        OIIO_CHECK_ASSERT(ss.execute(*ctx, *group, 0, 0, sg, nullptr, xout));
+        OIIO_CHECK_EQUAL(xout[0], 1.25f);
+        OIIO_CHECK_EQUAL(xout[1], 1.0f);
+        OIIO_CHECK_EQUAL(xout[2], 1.0f);
+        TypeDesc type;
+        const float* da = (const float*)ss.get_symbol(*ctx, ustring("da"),
+                                                      type);
+        OIIO_CHECK_ASSERT(da && *da == 1.0f);
+        ss.release_context(ctx);
+        ss.destroy_thread_info(threadinfo);
+
+        if (demand)
+            OIIO_CHECK_ASSERT(get_stat(ss, "derivs_removed") > 0);
+        else
+            OIIO_CHECK_EQUAL(get_stat(ss, "derivs_removed"), 0);
+    }
+}
+
+
+
+// specialize_outputs makes a variant per set of outputs, and ReParameter
+// of the group reaches every variant -- but only a change the group itself
+// accepts.
+static void
+test_specialize_outputs()
+{
+    RendererServices renderer;
+    ShadingSystem ss(&renderer);
+    OIIO_CHECK_ASSERT(ss.LoadMemoryCompiledShader("test", test_oso));
+
+    ShaderGroupRef group = ss.ShaderGroupBegin("group");
+    ss.Parameter(*group, "scale", 2.0f, ParamHints::interactive);
+    ss.Shader(*group, "surface", "test", "layer1");
+    ss.ShaderGroupEnd(*group);
+    ustring outputs[] = { ustring("x"), ustring("y") };
+    ss.attribute(group.get(), "renderer_outputs",
+                 TypeDesc(TypeDesc::STRING, 2), outputs);
+
+    ustring xname[]       = { ustring("x") };
+    ustring yname[]       = { ustring("y") };
+    ShaderGroupRef xgroup = ss.specialize_outputs(*group, xname);
+    ShaderGroupRef ygroup = ss.specialize_outputs(*group, yname);
+    OIIO_CHECK_ASSERT(xgroup && ygroup && xgroup != ygroup);
+    OIIO_CHECK_ASSERT(ss.specialize_outputs(*group, xname) == xgroup);
+    if (!xgroup || !ygroup)
+        return;
+    OIIO_CHECK_EQUAL(shade(ss, *group, "x"), 1.25f);
+    OIIO_CHECK_EQUAL(shade(ss, *group, "y"), 0.5f);
+    OIIO_CHECK_EQUAL(shade(ss, *xgroup, "x"), 1.25f);
+    OIIO_CHECK_EQUAL(shade(ss, *ygroup, "y"), 0.5f);
+
+    // Rejected by the group: the variants keep what they had.
+    float scale = 4.0f;
+    OIIO_CHECK_ASSERT(!ss.ReParameter(*group, "layer1", "nope", scale));
+    OIIO_CHECK_EQUAL(shade(ss, *xgroup, "x"), 1.25f);
+    OIIO_CHECK_EQUAL(shade(ss, *ygroup, "y"), 0.5f);
+
+    // Accepted by the group: every variant follows.
+    OIIO_CHECK_ASSERT(ss.ReParameter(*group, "layer1", "scale", scale));
+    OIIO_CHECK_EQUAL(shade(ss, *group, "x"), 2.25f);
+    OIIO_CHECK_EQUAL(shade(ss, *xgroup, "x"), 2.25f);
+    OIIO_CHECK_EQUAL(shade(ss, *ygroup, "y"), 1.0f);
+}
+
+
+
+// Different shaders parse at the same time on different threads, and each
+// ends up loaded just as if it had been alone.
+static void
+test_concurrent_loads()
+{
+    RendererServices renderer;
+    ShadingSystem ss(&renderer);
+    const int nshaders = 8;
+    std::vector<std::string> names, osos;
+    for (int i = 0; i < nshaders; ++i) {
+        // Shader "testI" whose scale defaults to I+1.
+        std::string num = std::to_string(i + 1);
+        names.push_back("test" + std::to_string(i));
+        std::string oso = OIIO::Strutil::replace(test_oso, "shader test\n",
+                                                 "shader " + names[i] + "\n");
+        osos.push_back(OIIO::Strutil::replace(oso, "scale\t2\t",
+                                              "scale\t" + num + "\t"));
+    }
+    std::vector<int> loaded(nshaders, 0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nshaders; ++i)
+        threads.emplace_back([&, i]() {
+            loaded[i] = ss.LoadMemoryCompiledShader(names[i], osos[i]);
+        });
+    for (auto&& t : threads)
+        t.join();
+
+    for (int i = 0; i < nshaders; ++i) {
+        OIIO_CHECK_ASSERT(loaded[i]);
+        ShaderGroupRef group = ss.ShaderGroupBegin(names[i]);
+        ss.Shader(*group, "surface", names[i], "layer1");
+        ss.ShaderGroupEnd(*group);
+        ustring outputs[] = { ustring("x") };
+        ss.attribute(group.get(), "renderer_outputs",
+                     TypeDesc(TypeDesc::STRING, 1), outputs);
+        OIIO_CHECK_EQUAL(shade(ss, *group), 0.5f * (i + 1) + 0.25f);
+    }
+}
+
+
+
+// Over a tiny "memory_budget", enforce_memory_budget evicts the groups
+// that haven't run since the previous call, and they compile again, with
+// the same results, the next time they run.
+static void
+test_memory_budget()
+{
+    RendererServices renderer;
+    ShadingSystem ss(&renderer);
+    ss.attribute("memory_budget", 0.001f);
+    OIIO_CHECK_ASSERT(ss.LoadMemoryCompiledShader("test", test_oso));
+
+    ShaderGroupRef a = make_group(ss, "a", 2.0f);
+    ShaderGroupRef b = make_group(ss, "b", 3.0f);
+    OIIO_CHECK_EQUAL(shade(ss, *a), 1.25f);
+    OIIO_CHECK_EQUAL(shade(ss, *b), 1.75f);
+    OIIO_CHECK_EQUAL(get_stat(ss, "groups_compiled"), 2);
+
+    // Both ran since the last call.
+    OIIO_CHECK_EQUAL(ss.enforce_memory_budget(), 0);
+    OIIO_CHECK_EQUAL(get_stat(ss, "groups_evicted"), 0);
+
+    // Neither has run since.
+    OIIO_CHECK_ASSERT(ss.enforce_memory_budget() > 0);
+    OIIO_CHECK_EQUAL(get_stat(ss, "groups_evicted"), 2);
+    OIIO_CHECK_EQUAL(shade(ss, *a), 1.25f);
+    OIIO_CHECK_EQUAL(shade(ss, *b), 1.75f);
+    OIIO_CHECK_EQUAL(get_stat(ss, "groups_compiled"), 4);
+
+    // Only b is idle.
+    ss.enforce_memory_budget();
+    OIIO_CHECK_EQUAL(shade(ss, *a), 1.25f);
+    OIIO_CHECK_ASSERT(ss.enforce_memory_budget() > 0);
+    OIIO_CHECK_EQUAL(get_stat(ss, "groups_evicted"), 3);
+    OIIO_CHECK_EQUAL(shade(ss, *a), 1.25f);
+    OIIO_CHECK_EQUAL(shade(ss, *b), 1.75f);
+    OIIO_CHECK_EQUAL(get_stat(ss, "groups_compiled"), 5);
+}
+
+// enumerate_stats names each statistic with its type, and the stats
+// callback runs every "stats_interval" seconds until it stops itself.
+static void
+test_stats_callback()
+{
+    RendererServices renderer;
+    ShadingSystem ss(&renderer);
+    OIIO_CHECK_ASSERT(ss.LoadMemoryCompiledShader("test", test_oso));
+    ShaderGroupRef a = make_group(ss, "a", 2.0f);
+    OIIO_CHECK_EQUAL(shade(ss, *a), 1.25f);
+
+    std::map<std::string, TypeDesc> types;
+    long long compiled = -1;
+    ss.enumerate_stats([&](string_view name, TypeDesc type, const void* val) {
+        types[std::string(name)] = type;
+        if (name == "groups_compiled")
+            compiled = *(const long long*)val;
+    });
+    OIIO_CHECK_EQUAL(compiled, 1);
+    OIIO_CHECK_EQUAL(types["masters"], TypeDesc::INT64);
+    OIIO_CHECK_EQUAL(types["compile_time"], TypeDesc::DOUBLE);
+    OIIO_CHECK_EQUAL(types["mem_peak"], TypeDesc::INT64);
+
+    // The first call stops the calls from inside the callback.
+    std::atomic<int> ticks(0);
+    ss.attribute("stats_interval", 0.01f);
+    ss.set_stats_callback([&](string_view name, TypeDesc, const void*) {
+        if (name == "groups_compiled" && ticks++ == 0)
+            ss.set_stats_callback(ShadingSystem::StatsFunc());
+    });
+    for (int i = 0; i < 500 && !ticks; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    OIIO_CHECK_EQUAL(ticks.load(), 1);
+}
+
+#if OSL_USE_BATCHED
+// A BatchFormer shades a bin as soon as it is full, first shades the
+// pending points of a bin when a point of another renderstate arrives, and
+// shades the partial bins on flush().
+template<int WidthT>
+static void
+test_batch_former(ShadingSystem& ss)
+{
+    ShaderGroupRef a = make_group(ss, "a", 2.0f);
+    ShaderGroupRef b = make_group(ss, "b", 3.0f);
+
+    struct Shaded {
+        int batch_size;
+        int raytype;
+        void* renderstate;
+        std::vector<int> shadeindex;
+    };
+    std::vector<Shaded> shaded;
+    auto callback = [&](BatchedShaderGlobals<WidthT>& globals, int batch_size,
+                        const int* shadeindex) {
+        shaded.push_back({ batch_size, globals.uniform.raytype,
+                           globals.uniform.renderstate,
+                           std::vector<int>(shadeindex,
+                                            shadeindex + batch_size) });
+    };
+
+    PerThreadInfo* threadinfo = ss.create_thread_info();
+    ShadingContext* ctx       = ss.get_context(threadinfo);
+    int state1 = 1, state2 = 2;
+    {
+        ShadingSystem::BatchFormer<WidthT> former(ss, *ctx, nullptr, nullptr,
+                                                  callback);
+        ShaderGlobals sg;
+        memset((char*)&sg, 0, sizeof(sg));
+        sg.u           = 0.5f;
+        sg.v           = 0.25f;
+        sg.renderstate = &state1;
+        int index      = 0;
+
+        // A full bin is shaded right away.
+        sg.raytype = 1;
+        for (int i = 0; i < WidthT - 1; ++i)
+            OIIO_CHECK_ASSERT(former.push(*a, sg, index++));
+        OIIO_CHECK_EQUAL(former.pending(), WidthT - 1);
+        OIIO_CHECK_EQUAL((int)shaded.size(), 0);
+        OIIO_CHECK_ASSERT(former.push(*a, sg, index++));
+        OIIO_CHECK_EQUAL(former.pending(), 0);
+        OIIO_CHECK_EQUAL((int)shaded.size(), 1);
+
+        // Another raytype and another group each get their own bin.
+        sg.raytype = 2;
+        for (int i = 0; i < 3; ++i)
+            OIIO_CHECK_ASSERT(former.push(*a, sg, index++));
+        sg.raytype = 1;
+        for (int i = 0; i < 2; ++i)
+            OIIO_CHECK_ASSERT(former.push(*b, sg, index++));
+        OIIO_CHECK_EQUAL(former.pending(), 5);
+        OIIO_CHECK_EQUAL((int)shaded.size(), 1);
+
+        // Another renderstate sends off what its bin had so far.
+        sg.renderstate = &state2;
+        OIIO_CHECK_ASSERT(former.push(*b, sg, index++));
+        OIIO_CHECK_EQUAL(former.pending(), 4);
+        OIIO_CHECK_EQUAL((int)shaded.size(), 2);
+
+        OIIO_CHECK_ASSERT(former.flush());
+        OIIO_CHECK_EQUAL(former.pending(), 0);
+    }
+    ss.release_context(ctx);
+    ss.destroy_thread_info(threadinfo);
+
+    OIIO_CHECK_EQUAL((int)shaded.size(), 4);
+    if (shaded.size() != 4)
+        return;
+    const int sizes[]          = { WidthT, 2, 3, 1 };
+    const int raytypes[]       = { 1, 1, 2, 1 };
+    void* const renderstates[] = { &state1, &state1, &state1, &state2 };
+    const int first_index[]    = { 0, WidthT + 3, WidthT, WidthT + 5 };
+    for (int i = 0; i < 4; ++i) {
+        OIIO_CHECK_EQUAL(shaded[i].batch_size, sizes[i]);
+        OIIO_CHECK_EQUAL(shaded[i].raytype, raytypes[i]);
+        OIIO_CHECK_ASSERT(shaded[i].renderstate == renderstates[i]);
+        for (int j = 0; j < shaded[i].batch_size; ++j)
+            OIIO_CHECK_EQUAL(shaded[i].shadeindex[j], first_index[i] + j);
+    }
+    OIIO_CHECK_EQUAL(get_stat(ss, "formed_batches"), 4);
+    OIIO_CHECK_EQUAL(get_stat(ss, "formed_points"), WidthT + 6);
+}
+
+
+
+static void
+test_batch_former()
+{
+    TestRenderer renderer;
+    ShadingSystem ss(&renderer);
+    int width = configure_batched(ss);
+    if (!width)
+        return;
+    // Always batched, rather than measuring which route is faster.
+    ss.attribute("batch_autoselect", 0);
+    OIIO_CHECK_ASSERT(ss.LoadMemoryCompiledShader("test", test_oso));
+    if (width == 16)
+        test_batch_former<16>(ss);
+    else if (width == 8)
+        test_batch_former<8>(ss);
+    else
+        test_batch_former<4>(ss);
+}
+
+
+
+struct TestDiffuse {
+    Vec3 N;
+    float roughness;
+};
+
+struct TestEmission {
+    float strength;
+};
+
+enum { TEST_DIFFUSE_ID = 1, TEST_EMISSION_ID };
+
+template<typename Params> struct TestComponent {
+    ClosureComponent comp;
+    Params params;  ///< Where comp.data() points
+};
+
+// The closure tree of one lane: mul(diffuse) + emission, or the other way
+// around.
+struct TestTree {
+    TestComponent<TestDiffuse> diffuse;
+    TestComponent<TestEmission> emission;
+    ClosureMul mul;
+    ClosureAdd add;
+
+    void build(int lane, bool swapped = false)
+    {
+        diffuse.comp.id          = TEST_DIFFUSE_ID;
+        diffuse.comp.w           = Vec3(1.0f, 0.5f, 0.25f);
+        diffuse.params.N         = Vec3(float(lane), 1.0f, 0.0f);
+        diffuse.params.roughness = 0.125f * lane;
+        emission.comp.id         = TEST_EMISSION_ID;
+        emission.comp.w          = Vec3(0.5f);
+        emission.params.strength = float(lane + 1);
+        mul.id                   = ClosureColor::MUL;
+        mul.weight               = Color3(float(lane + 1), 2.0f, 3.0f);
+        mul.closure              = &diffuse.comp;
+        add.id                   = ClosureColor::ADD;
+        add.closureA             = swapped ? (ClosureColor*)&emission.comp
+                                           : (ClosureColor*)&mul;
+        add.closureB             = swapped ? (ClosureColor*)&mul
+                                           : (ClosureColor*)&emission.comp;
+    }
+};
+
+
+
+// closures_to_soa gives each component the id, weights and parameters of
+// the flattened per-lane trees, and declines batches whose lanes differ
+// in structure.
+static void
+test_closures_to_soa()
+{
+    RendererServices renderer;
+    ShadingSystem ss(&renderer);
+    static const ClosureParam diffuse_params[]
+        = { CLOSURE_VECTOR_PARAM(TestDiffuse, N),
+            CLOSURE_FLOAT_PARAM(TestDiffuse, roughness),
+            CLOSURE_FINISH_PARAM(TestDiffuse) };
+    static const ClosureParam emission_params[]
+        = { CLOSURE_FLOAT_PARAM(TestEmission, strength),
+            CLOSURE_FINISH_PARAM(TestEmission) };
+    ss.register_closure("test_diffuse", TEST_DIFFUSE_ID, diffuse_params,
+                        nullptr, nullptr);
+    ss.register_closure("test_emission", TEST_EMISSION_ID, emission_params,
+                        nullptr, nullptr);
+
+    const int W = 4, batch_size = 3;
+    TestTree trees[batch_size];
+    const ClosureColor* ci[batch_size];
+    for (int lane = 0; lane < batch_size; ++lane) {
+        trees[lane].build(lane);
+        ci[lane] = &trees[lane].add;
+    }
+    ShadingSystem::ClosureSoA<W> soa;
+    OIIO_CHECK_ASSERT(ss.closures_to_soa(ci, batch_size, soa));
+    OIIO_CHECK_EQUAL(soa.batch_size, batch_size);
+    OIIO_CHECK_EQUAL((int)soa.components.size(), 2);
+    if (soa.components.size() == 2) {
+        OIIO_CHECK_EQUAL(soa.components[0].param_size,
+                         (int)sizeof(TestDiffuse));
+        OIIO_CHECK_EQUAL(soa.components[1].param_size,
+                         (int)sizeof(TestEmission));
+    }
+    for (int lane = 0; lane < W; ++lane) {
+        // The lanes past batch_size repeat the first.
+        FlatClosure flat[4];
+        int n = flatten_closure(ci[lane < batch_size ? lane : 0], flat, 4);
+        OIIO_CHECK_EQUAL(n, (int)soa.components.size());
+        for (int c = 0; c < n && c < (int)soa.components.size(); ++c) {
+            const auto& comp(soa.components[c]);
+            OIIO_CHECK_EQUAL(comp.id, flat[c].comp->id);
+            Color3 weight = flat[c].weight * flat[c].comp->w;
+            OIIO_CHECK_EQUAL(comp.weight[0][lane], weight.x);
+            OIIO_CHECK_EQUAL(comp.weight[1][lane], weight.y);
+            OIIO_CHECK_EQUAL(comp.weight[2][lane], weight.z);
+            std::vector<char> params(comp.param_size);
+            for (int word = 0; 4 * word < comp.param_size; ++word)
+                memcpy(params.data() + 4 * word, &comp.params[word * W + lane],
+                       std::min(4, comp.param_size - 4 * word));
+            OIIO_CHECK_ASSERT(memcmp(params.data(), flat[c].comp->data(),
+                                     comp.param_size)
+                              == 0);
+        }
+    }
+
+    // Components in another order, or another number of them.
+    trees[1].build(1, true);
+    OIIO_CHECK_ASSERT(!ss.closures_to_soa(ci, batch_size, soa));
+    trees[1].build(1);
+    ci[2] = &trees[2].mul;
+    OIIO_CHECK_ASSERT(!ss.closures_to_soa(ci, batch_size, soa));
+}
+#endif
+
+
+
+int
+main(int /*argc*/, char* /*argv*/[])
+{
+    test_share_groups();
+    test_compile_times_by_group();
+    test_fold_memo();
+    test_deriv_demand();
+    test_specialize_outputs();
+    test_concurrent_loads();
+    test_memory_budget();
+    test_stats_callback();
+#if OSL_USE_BATCHED
+    test_batch_former();
+    test_closures_to_soa();
+#endif
+    return unit_test_failures;
+}
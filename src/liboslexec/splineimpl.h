@@ -91,6 +91,19 @@ OSL_CONSTANT_DATA const SplineBasis gBasisSet[kNumSplineTypes] = {
 
 
 
+// Largest power of two that is at most nsegs: the first step of the
+// binary search over segments in the inverse.
+OSL_HOSTDEVICE inline int
+segment_search_step(int nsegs)
+{
+    int step = 1;
+    while (step * 2 <= nsegs)
+        step *= 2;
+    return step;
+}
+
+
+
 OSL_HOSTDEVICE static int
 basis_type_of(ustringhash basis_name)
 {
@@ -271,13 +284,35 @@ struct SplineInterp {
 
 
         SplineFunctor<YTYPE, YTYPE> S(*this, knots, knot_count, knot_arraylen);
+        int nsegs     = (knot_count - 4) / spline.basis_step + 1;
+        float nseginv = 1.0f / nsegs;
+
+        // For the usual curve whose values at the segment ends are
+        // monotonic, the segment holding y is the last one starting on the
+        // near side of y.  Binary search for it, in log2(nsegs)
+        // evaluations rather than two per segment, with a trip count that
+        // depends only on nsegs so the wide version stays coherent.
+        int seg = 0;
+        for (int step = segment_search_step(nsegs); step > 0; step >>= 1) {
+            int probe = seg + step;
+            if (probe < nsegs) {
+                YTYPE start = S(YTYPE(nseginv * probe));
+                if (increasing ? (start < y) : (start > y))
+                    seg = probe;
+            }
+        }
+        bool brack;
+        x = OIIO::invert(S, y, YTYPE(nseginv * seg),
+                         YTYPE(nseginv * (seg + 1)), 32, YTYPE(1.0e-6),
+                         &brack);
+        if (brack)
+            return;
+
         // Because of the nature of spline interpolation, monotonic knots
         // can still lead to a non-monotonic curve.  To deal with this,
         // search separately on each spline segment and hope for the best.
-        int nsegs     = (knot_count - 4) / spline.basis_step + 1;
-        float nseginv = 1.0f / nsegs;
-        YTYPE r0      = 0.0;
-        x             = 0;
+        YTYPE r0 = 0.0;
+        x        = 0;
         for (int s = 0; s < nsegs; ++s) {  // Search each interval
             YTYPE r1 = nseginv * (s + 1);
             bool brack;
@@ -0,0 +1,98 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <algorithm>
+#include <numeric>
+
+#include <OSL/oslconfig.h>
+#include <OSL/stringtable.h>
+
+OSL_NAMESPACE_BEGIN
+
+// Seeds to try for a bucket before starting over with more buckets.
+static const uint32_t string_table_max_seed = 1 << 16;
+
+
+
+// Try to place the (sorted, unique) keys with the given number of
+// buckets, by "hash and displace": the buckets, largest first, each find
+// a seed that sends all of their keys to free slots, and the buckets with
+// one key just take the next free slot.
+static bool
+place_keys(const std::vector<uint64_t>& sorted, uint32_t nbuckets,
+           std::vector<int32_t>& seeds, std::vector<uint64_t>& keys)
+{
+    uint32_t n = uint32_t(sorted.size());
+    std::vector<std::vector<uint64_t>> buckets(nbuckets);
+    for (uint64_t h : sorted)
+        buckets[StringTable::bucket(h, nbuckets)].push_back(h);
+    std::vector<uint32_t> order(nbuckets);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return buckets[a].size() > buckets[b].size();
+    });
+
+    seeds.assign(nbuckets, 0);
+    keys.assign(n, 0);
+    std::vector<char> used(n, 0);
+    std::vector<uint32_t> slots;
+    uint32_t next_free = 0;
+    for (uint32_t b : order) {
+        const std::vector<uint64_t>& bucket(buckets[b]);
+        if (bucket.empty())
+            break;
+        if (bucket.size() == 1) {
+            while (used[next_free])
+                ++next_free;
+            seeds[b]        = -int32_t(next_free) - 1;
+            keys[next_free] = bucket[0];
+            used[next_free] = 1;
+            continue;
+        }
+        uint32_t seed = 1;
+        for (; seed < string_table_max_seed; ++seed) {
+            slots.clear();
+            for (uint64_t h : bucket) {
+                uint32_t s = StringTable::mix(h, seed) % n;
+                if (used[s]
+                    || std::find(slots.begin(), slots.end(), s) != slots.end())
+                    break;
+                slots.push_back(s);
+            }
+            if (slots.size() == bucket.size())
+                break;
+        }
+        if (seed == string_table_max_seed)
+            return false;
+        seeds[b] = int32_t(seed);
+        for (size_t i = 0; i < bucket.size(); ++i) {
+            keys[slots[i]] = bucket[i];
+            used[slots[i]] = 1;
+        }
+    }
+    return true;
+}
+
+
+
+uint32_t
+make_string_table(const uint64_t* hashes, size_t n,
+                  std::vector<int32_t>& seeds, std::vector<uint64_t>& keys)
+{
+    std::vector<uint64_t> sorted(hashes, hashes + n);
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    seeds.clear();
+    keys.clear();
+    if (sorted.empty())
+        return 0;
+    // Two keys per bucket on average makes for a small table that's
+    // quick to build; if some bucket can't be placed, try more buckets.
+    uint32_t nbuckets = std::max(uint32_t(sorted.size() / 2), uint32_t(1));
+    while (!place_keys(sorted, nbuckets, seeds, keys))
+        nbuckets *= 2;
+    return nbuckets;
+}
+
+OSL_NAMESPACE_END
@@ -0,0 +1,60 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <set>
+
+#include <OpenImageIO/strutil.h>
+#include <OpenImageIO/unittest.h>
+#include <OpenImageIO/ustring.h>
+
+#include <OSL/stringtable.h>
+
+using namespace OSL;
+
+
+
+// Build a table of n made-up names and check that each maps to its own
+// index, that the indices cover [0,n), and that other names miss.
+static void
+test_table(int n)
+{
+    std::vector<uint64_t> hashes;
+    for (int i = 0; i < n; ++i)
+        hashes.push_back(ustring::fmtformat("attr{}", i).hash());
+    // Duplicates are ignored
+    if (n)
+        hashes.push_back(hashes[0]);
+
+    std::vector<int32_t> seeds;
+    std::vector<uint64_t> keys;
+    uint32_t nbuckets = make_string_table(hashes.data(), hashes.size(), seeds,
+                                          keys);
+    OIIO_CHECK_EQUAL(keys.size(), size_t(n));
+    OIIO_CHECK_EQUAL(seeds.size(), size_t(nbuckets));
+    StringTable table { seeds.data(), keys.data(), nbuckets,
+                        uint32_t(keys.size()) };
+
+    std::set<int> seen;
+    for (int i = 0; i < n; ++i) {
+        int index = table.index(hashes[i]);
+        OIIO_CHECK_ASSERT(index >= 0 && index < n);
+        OIIO_CHECK_EQUAL(keys[index], hashes[i]);
+        seen.insert(index);
+    }
+    OIIO_CHECK_EQUAL(seen.size(), size_t(n));
+
+    for (int i = 0; i < 100; ++i)
+        OIIO_CHECK_EQUAL(
+            table.index(ustring::fmtformat("other{}", i).hash()), -1);
+}
+
+
+
+int
+main(int /*argc*/, char* /*argv*/[])
+{
+    for (int n : { 0, 1, 2, 3, 10, 100, 1000, 10000 })
+        test_table(n);
+    return unit_test_failures;
+}
@@ -21,13 +21,39 @@ namespace __OSL_WIDE_PVT {
 OSL_USING_DATA_WIDTH(__OSL_WIDTH)
 
 
+// Scaling a scaled closure folds into a single mul
+static OSL_FORCEINLINE void
+fold_closure_mul(const ClosureColor*& closure, Color3& w)
+{
+    if (closure && closure->id == ClosureColor::MUL) {
+        w *= closure->as_mul()->weight;
+        closure = closure->as_mul()->closure;
+    }
+}
+
+
+
+// What a set-up mul amounts to: nothing if it scales nothing or scales by
+// zero, and the closure itself if it scales by one.
+static OSL_FORCEINLINE ClosureColorPtr
+closure_mul_result(ClosureMul* m)
+{
+    const Color3& w = m->weight;
+    if (!m->closure || (w.x == 0.0f && w.y == 0.0f && w.z == 0.0f))
+        return nullptr;
+    if (w.x == 1.0f && w.y == 1.0f && w.z == 1.0f)
+        return const_cast<ClosureColor*>(m->closure);
+    return m;
+}
+
+
 OSL_BATCHOP void
 __OSL_MASKED_OP(add_closure_closure)(void* bsg_, void* wide_out_,
                                      void* wide_closure_a_,
                                      void* wide_closure_b_,
                                      unsigned int mask_value)
 {
-    // TODO avoid allot if !a or !b?
+    // TODO avoid allot when no lane needs an add
     auto* bsg = reinterpret_cast<BatchedShaderGlobals*>(bsg_);
     Mask mask(mask_value);
     Masked<ClosureColorPtr> wide_out(wide_out_, mask);
@@ -55,8 +81,16 @@ __OSL_MASKED_OP(add_closure_closure)(void* bsg_, void* wide_out_,
     // new result
     OSL_OMP_PRAGMA(omp simd simdlen(__OSL_WIDTH))
     for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
-        ClosureColorPtr a = (ClosureColorPtr)&add[lane];
-        wide_out[lane]    = a;
+        if (mask[lane]) {
+            // Adding nothing to a closure leaves just the closure
+            ClosureAdd* a = &add[lane];
+            if (!a->closureA)
+                wide_out[lane] = const_cast<ClosureColor*>(a->closureB);
+            else if (!a->closureB)
+                wide_out[lane] = const_cast<ClosureColor*>(a->closureA);
+            else
+                wide_out[lane] = a;
+        }
     }
 }
 
@@ -68,7 +102,7 @@ __OSL_MASKED_OP(mul_closure_color)(void* bsg_, void* wide_out_,
                                    unsigned int mask_value)
 {
     auto* bsg = reinterpret_cast<BatchedShaderGlobals*>(bsg_);
-    // TODO avoid allot if weight = 0 or closure = null?
+    // TODO avoid allot when no lane needs a mul
     Mask mask(mask_value);
     Masked<ClosureColorPtr> wide_out(wide_out_, mask);
     Wide<const Color3> wide_weight(wide_weight_);
@@ -81,9 +115,10 @@ __OSL_MASKED_OP(mul_closure_color)(void* bsg_, void* wide_out_,
     OSL_OMP_PRAGMA(omp simd simdlen(__OSL_WIDTH))
     for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
         ClosureMul* m          = &mul[lane];
-        const Color3 w         = wide_weight[lane];
+        Color3 w               = wide_weight[lane];
         const ClosureColor* ca = wide_closure_a[lane];
         if (mask[lane]) {
+            fold_closure_mul(ca, w);
             m->id      = ClosureColor::MUL;
             m->weight  = w;
             m->closure = ca;
@@ -94,10 +129,9 @@ __OSL_MASKED_OP(mul_closure_color)(void* bsg_, void* wide_out_,
     // do the write-back to the output after we've set-up the
     // new result
     OSL_OMP_PRAGMA(omp simd simdlen(__OSL_WIDTH))
-    for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
-        ClosureColorPtr m = (ClosureColorPtr)&mul[lane];
-        wide_out[lane]    = m;
-    }
+    for (int lane = 0; lane < __OSL_WIDTH; ++lane)
+        if (mask[lane])
+            wide_out[lane] = closure_mul_result(&mul[lane]);
 }
 
 
@@ -107,7 +141,7 @@ __OSL_MASKED_OP(mul_closure_float)(void* bsg_, void* wide_out_,
                                    unsigned int mask_value)
 {
     auto* bsg = reinterpret_cast<BatchedShaderGlobals*>(bsg_);
-    // TODO avoid allot if weight = 0 or closure = null?
+    // TODO avoid allot when no lane needs a mul
     Mask mask(mask_value);
     Masked<ClosureColorPtr> wide_out(wide_out_, mask);
     Wide<const float> wide_weight(wide_weight_);
@@ -121,9 +155,10 @@ __OSL_MASKED_OP(mul_closure_float)(void* bsg_, void* wide_out_,
     for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
         ClosureMul* m = &mul[lane];
         const float w = wide_weight[lane];
-        const Color3 weight(w, w, w);
+        Color3 weight(w, w, w);
         const ClosureColor* ca = wide_closure_a[lane];
         if (mask[lane]) {
+            fold_closure_mul(ca, weight);
             m->id      = ClosureColor::MUL;
             m->weight  = weight;
             m->closure = ca;
@@ -134,10 +169,9 @@ __OSL_MASKED_OP(mul_closure_float)(void* bsg_, void* wide_out_,
     // do the write-back to the output after we've set-up the
     // new result
     OSL_OMP_PRAGMA(omp simd simdlen(__OSL_WIDTH))
-    for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
-        ClosureColorPtr m = (ClosureColorPtr)&mul[lane];
-        wide_out[lane]    = m;
-    }
+    for (int lane = 0; lane < __OSL_WIDTH; ++lane)
+        if (mask[lane])
+            wide_out[lane] = closure_mul_result(&mul[lane]);
 }
 
 
@@ -178,6 +178,62 @@ __OSL_OP(prepend_color_from_vs)(void* bsg_, void* c_, const char* from)
 
 namespace {
 
+// Apply an OCIO transform to the active lanes with one call to the
+// processor: gather them into a packed buffer, transform that, and
+// scatter the results. Return false, having changed nothing, if OCIO
+// doesn't know the transform.
+template<typename InputT>
+bool
+wide_ocio_transform(ShadingContext* ctx, ustring fromspace, ustring tospace,
+                    Masked<Color3> wOutput, const InputT& wInput)
+{
+    Color3 colors[__OSL_WIDTH];
+    int n = 0;
+    wOutput.mask().foreach ([&](ActiveLane lane) -> void {
+        colors[n++] = Color3(wInput[lane]);
+    });
+    if (!ctx->ocio_transform(fromspace, tospace, colors, n))
+        return false;
+    n = 0;
+    wOutput.mask().foreach ([&](ActiveLane lane) -> void {
+        wOutput[lane] = colors[n++];
+    });
+    return true;
+}
+
+
+
+// As above, with the derivatives approximated by finite differences, as
+// the scalar ShadingContext::ocio_transform does, in the same batch.
+bool
+wide_ocio_transform(ShadingContext* ctx, ustring fromspace, ustring tospace,
+                    Masked<Dual2<Color3>> wOutput,
+                    const Wide<const Dual2<Color3>>& wInput)
+{
+    const float eps = 0.001f;
+    Color3 colors[3 * __OSL_WIDTH];
+    int n = 0;
+    wOutput.mask().foreach ([&](ActiveLane lane) -> void {
+        Dual2<Color3> C = wInput[lane];
+        colors[n]       = C.val();
+        colors[n + 1]   = C.val() + eps * C.dx();
+        colors[n + 2]   = C.val() + eps * C.dy();
+        n += 3;
+    });
+    if (!ctx->ocio_transform(fromspace, tospace, colors, n))
+        return false;
+    n = 0;
+    wOutput.mask().foreach ([&](ActiveLane lane) -> void {
+        Color3 val    = colors[n];
+        wOutput[lane] = Dual2<Color3>(val, (colors[n + 1] - val) * (1.0f / eps),
+                                      (colors[n + 2] - val) * (1.0f / eps));
+        n += 3;
+    });
+    return true;
+}
+
+
+
 // NOTE: keep implementation as mirror of ColorSystem::to_rgb
 void
 wide_prepend_color_from(ShadingContext* ctx, const ColorSystem& cs,
@@ -251,7 +307,10 @@ wide_prepend_color_from(ShadingContext* ctx, const ColorSystem& cs,
         return;
     }
 
-    // Serialize calls to ocio
+    if (wide_ocio_transform(ctx, fromspace, Strings::RGB, wR, wR))
+        return;
+
+    // Unknown to OCIO: serialize calls to ocio, which report the error
     wR.mask().foreach ([=, &cs](ActiveLane lane) -> void {
         Color3 C = wR[lane];
         Color3 R = cs.ocio_transform(fromspace, Strings::RGB, C, ctx);
@@ -459,8 +518,9 @@ wide_transformc(const ColorSystem cs, ustring fromspace, ustring tospace,
         use_colorconfig = true;
     }
 
-    if (use_colorconfig) {
-        // Serialize calls to ocio
+    if (use_colorconfig
+        && !wide_ocio_transform(context, fromspace, tospace, wOutput, wInput)) {
+        // Unknown to OCIO: serialize calls to ocio, which report the error
         wOutput.mask().foreach ([=, &cs](ActiveLane lane) -> void {
             COLOR C       = wInput[lane];
             COLOR Cto     = cs.ocio_transform(fromspace, tospace, C, context);
@@ -55,35 +55,49 @@ block_ustringhash_from_ptr(Block<ustringhash>& b, const void* w_ptr)
 }
 
 
+// Invert m inside a SIMD loop, affine matrices taking the cheaper
+// affineInverse and others Cramer's rule.  Returns false if the lane
+// still needs the nonAffineInverse slow path, for a (nearly) singular m.
+static OSL_FORCEINLINE bool
+simd_inverse(const Matrix44& m, Matrix44& r)
+{
+    if (test_if_affine(m)) {
+        r = OSL::affineInverse(m);
+        return true;
+    }
+    bool ok;
+    r = OSL::cofactorInverse(m, ok);
+    return ok;
+}
+
+
 OSL_FORCEINLINE void
 invert_wide_matrix(Masked<Matrix44> wresult, Wide<const Matrix44> wmatrix)
 {
     if (wresult.mask().any_on()) {
-        Block<int> notAffineBlock;
-        Wide<int> wnotAffine(notAffineBlock);
+        Block<int> slowPathBlock;
+        Wide<int> wslowPath(slowPathBlock);
 
         OSL_FORCEINLINE_BLOCK
         {
             OSL_OMP_PRAGMA(omp simd simdlen(__OSL_WIDTH))
             for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
                 Matrix44 m     = wmatrix[lane];
-                bool is_affine = true;
+                bool slow_path = false;
                 if (wresult.mask()[lane]) {
-                    is_affine = test_if_affine(m);
-                    if (OSL_UNLIKELY(is_affine)) {
-                        Matrix44 r                = OSL::affineInverse(m);
+                    Matrix44 r { Imath::UNINITIALIZED };
+                    slow_path = !simd_inverse(m, r);
+                    if (OSL_LIKELY(!slow_path))
                         wresult[ActiveLane(lane)] = r;
-                    }
                 }
-                wnotAffine[lane]
-                    = (!is_affine);  // false when lane is masked off
+                wslowPath[lane] = slow_path;  // false when lane is masked off
             }
         }
 
-        if (testIfAnyLaneIsNonZero(wnotAffine)) {
+        if (testIfAnyLaneIsNonZero(wslowPath)) {
             invoke([=]() -> void {
                 for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
-                    if (wnotAffine[lane]) {
+                    if (wslowPath[lane]) {
                         OSL_DASSERT(wresult.mask().is_on(lane));
                         Matrix44 m                = wmatrix[lane];
                         Matrix44 invm             = OSL::nonAffineInverse(m);
@@ -331,13 +345,12 @@ __OSL_MASKED_OP3(div, Wm, Wm, Wm)(void* wr_, void* wa_, void* wb_,
     Wide<const Matrix44> wb(wb_);
     Masked<Matrix44> wresult(wr_, Mask(mask_value));
 
-    Block<int> notAffineBlock;
-    Wide<int> wnotAffine(notAffineBlock);
+    Block<int> slowPathBlock;
+    Wide<int> wslowPath(slowPathBlock);
 
-    // Rather than calling b.inverse() which has to handle affine and
-    // non-affine matrices, we will test if b is affine and only
-    // vectorize the fast path and create a test to skip the
-    // slow path for non-affine inverses and avoiding attempting to
+    // Rather than calling b.inverse() which pivots, we vectorize the
+    // branch free inverses of simd_inverse and create a test to skip the
+    // slow path for (nearly) singular matrices, avoiding attempting to
     // vectorize the slow path.
     OSL_FORCEINLINE_BLOCK
     {
@@ -345,23 +358,24 @@ __OSL_MASKED_OP3(div, Wm, Wm, Wm)(void* wr_, void* wa_, void* wb_,
         for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
             Matrix44 a     = wa[lane];
             Matrix44 b     = wb[lane];
-            bool is_affine = true;
+            bool slow_path = false;
             if (wresult.mask()[lane]) {
-                is_affine = test_if_affine(b);
-                if (OSL_UNLIKELY(is_affine)) {
-                    wresult[ActiveLane(lane)]
-                        = multiplyMatrixByMatrix(a, OSL::affineInverse(b));
+                Matrix44 binv { Imath::UNINITIALIZED };
+                slow_path = !simd_inverse(b, binv);
+                if (OSL_LIKELY(!slow_path)) {
+                    wresult[ActiveLane(lane)] = multiplyMatrixByMatrix(a,
+                                                                       binv);
                 }
             }
-            wnotAffine[lane] = (!is_affine);  // false when lane is masked off
+            wslowPath[lane] = slow_path;  // false when lane is masked off
         }
     }
 
-    if (testIfAnyLaneIsNonZero(wnotAffine)) {
+    if (testIfAnyLaneIsNonZero(wslowPath)) {
         invoke([=]() -> void {
             // DO NOT VECTORIZE the slow path
             for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
-                if (wnotAffine[lane]) {
+                if (wslowPath[lane]) {
                     OSL_DASSERT(wresult.mask().is_on(lane));
                     Matrix44 a                = wa[lane];
                     Matrix44 b                = wb[lane];
@@ -427,13 +441,12 @@ __OSL_MASKED_OP3(div, Wm, Wf, Wm)(void* wr_, void* wa_, void* wb_,
     Wide<const Matrix44> wb(wb_);
     Masked<Matrix44> wresult(wr_, Mask(mask_value));
 
-    Block<int> notAffineBlock;
-    Wide<int> wnotAffine(notAffineBlock);
+    Block<int> slowPathBlock;
+    Wide<int> wslowPath(slowPathBlock);
 
-    // Rather than calling b.inverse() which has to handle affine and
-    // non-affine matrices, we will test if b is affine and only
-    // vectorize the fast path and create a test to skip the
-    // slow path for non-affine inverses and avoiding attempting to
+    // Rather than calling b.inverse() which pivots, we vectorize the
+    // branch free inverses of simd_inverse and create a test to skip the
+    // slow path for (nearly) singular matrices, avoiding attempting to
     // vectorize the slow path.
     OSL_FORCEINLINE_BLOCK
     {
@@ -441,24 +454,25 @@ __OSL_MASKED_OP3(div, Wm, Wf, Wm)(void* wr_, void* wa_, void* wb_,
         for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
             const float a    = wa[lane];
             const Matrix44 b = wb[lane];
-            bool is_affine   = true;
+            bool slow_path   = false;
             if (wresult.mask()[lane]) {
-                is_affine = test_if_affine(b);
-                if (OSL_UNLIKELY(is_affine)) {
-                    Matrix44 r = a * OSL::affineInverse(b);
+                Matrix44 binv { Imath::UNINITIALIZED };
+                slow_path = !simd_inverse(b, binv);
+                if (OSL_LIKELY(!slow_path)) {
+                    Matrix44 r = a * binv;
 
                     wresult[ActiveLane(lane)] = r;
                 }
             }
-            wnotAffine[lane] = (!is_affine);  // false when lane is masked off
+            wslowPath[lane] = slow_path;  // false when lane is masked off
         }
     }
 
-    if (testIfAnyLaneIsNonZero(wnotAffine)) {
+    if (testIfAnyLaneIsNonZero(wslowPath)) {
         invoke([=]() -> void {
             // DO NOT VECTORIZE the slow path
             for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
-                if (wnotAffine[lane]) {
+                if (wslowPath[lane]) {
                     OSL_DASSERT(wresult.mask().is_on(lane));
                     float a                   = wa[lane];
                     Matrix44 b                = wb[lane];
@@ -472,6 +486,59 @@ __OSL_MASKED_OP3(div, Wm, Wf, Wm)(void* wr_, void* wa_, void* wb_,
 
 
 
+// A uniform divisor, the same for the whole batch, is inverted just once
+// rather than once per lane.
+static OSL_FORCEINLINE Matrix44
+uniform_inverse(const Matrix44& b)
+{
+    return test_if_affine(b) ? OSL::affineInverse(b)
+                             : OSL::nonAffineInverse(b);
+}
+
+
+
+OSL_BATCHOP void
+__OSL_MASKED_OP3(div, Wm, Wm, m)(void* wr_, void* wa_, void* b_,
+                                 unsigned int mask_value)
+{
+    Wide<const Matrix44> wa(wa_);
+    Masked<Matrix44> wresult(wr_, Mask(mask_value));
+    const Matrix44 binv = uniform_inverse(*reinterpret_cast<Matrix44*>(b_));
+
+    OSL_FORCEINLINE_BLOCK
+    {
+        OSL_OMP_PRAGMA(omp simd simdlen(__OSL_WIDTH))
+        for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
+            Matrix44 a = wa[lane];
+            if (wresult.mask()[lane])
+                wresult[ActiveLane(lane)] = multiplyMatrixByMatrix(a, binv);
+        }
+    }
+}
+
+
+
+OSL_BATCHOP void
+__OSL_MASKED_OP3(div, Wm, Wf, m)(void* wr_, void* wa_, void* b_,
+                                 unsigned int mask_value)
+{
+    Wide<const float> wa(wa_);
+    Masked<Matrix44> wresult(wr_, Mask(mask_value));
+    const Matrix44 binv = uniform_inverse(*reinterpret_cast<Matrix44*>(b_));
+
+    OSL_FORCEINLINE_BLOCK
+    {
+        OSL_OMP_PRAGMA(omp simd simdlen(__OSL_WIDTH))
+        for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
+            float a = wa[lane];
+            if (wresult.mask()[lane])
+                wresult[ActiveLane(lane)] = a * binv;
+        }
+    }
+}
+
+
+
 OSL_BATCHOP void
 __OSL_OP2(transpose, Wm, Wm)(void* wr_, void* wm_)
 {
@@ -530,6 +597,42 @@ makeIdentity(Masked<Matrix44> wrm)
     }
 }
 
+// For a uniform space name, when the renderer can look up a matrix for a
+// single time and the active lanes all share one, ask for it just once and
+// broadcast it (or its inverse).  Returns false, leaving wrm alone, if the
+// wide lookup is needed after all.
+OSL_FORCEINLINE bool
+get_uniform_time_matrix(BatchedShaderGlobals* bsg, Masked<Matrix44> wrm,
+                        ustringhash from, bool inverse, Mask& succeeded)
+{
+    auto* bsr = bsg->uniform.context->batched<__OSL_WIDTH>().renderer();
+    Mask mask = wrm.mask();
+    if (!bsr->is_overridden_get_matrix_uniform() || !mask.any_on())
+        return false;
+    Wide<const float> wtime(bsg->varying.time);
+    float time = wtime[mask.first_on()];
+    bool same  = true;
+    mask.foreach([&](ActiveLane lane) { same &= (wtime[lane] == time); });
+    if (!same)
+        return false;
+
+    Matrix44 m;
+    if (!bsr->get_matrix_uniform(bsg, m, from, time)) {
+        succeeded = Mask(false);
+        return true;
+    }
+    if (inverse)
+        m.invert();
+    OSL_FORCEINLINE_BLOCK
+    {
+        OSL_OMP_PRAGMA(omp simd simdlen(__OSL_WIDTH))
+        for (int lane = 0; lane < __OSL_WIDTH; ++lane)
+            wrm[lane] = m;
+    }
+    succeeded = mask;
+    return true;
+}
+
 OSL_FORCEINLINE Mask
 impl_get_uniform_from_matrix_masked(void* bsg_, Masked<Matrix44> wrm,
                                     const char* from)
@@ -557,8 +660,10 @@ impl_get_uniform_from_matrix_masked(void* bsg_, Masked<Matrix44> wrm,
         return wrm.mask();
     }
 
-    Mask succeeded = ctx->batched<__OSL_WIDTH>().renderer()->get_matrix(
-        bsg, wrm, USTR(from), bsg->varying.time);
+    Mask succeeded(false);
+    if (!get_uniform_time_matrix(bsg, wrm, USTR(from), false, succeeded))
+        succeeded = ctx->batched<__OSL_WIDTH>().renderer()->get_matrix(
+            bsg, wrm, USTR(from), bsg->varying.time);
     auto failedResults = wrm & succeeded.invert();
     if (failedResults.mask().any_on()) {
         makeIdentity(failedResults);
@@ -600,9 +705,11 @@ impl_get_uniform_to_inverse_matrix_masked(void* bsg_, Masked<Matrix44> wrm,
     // Based on the 1 function that calls this function
     // the results of the failed data lanes will get overwritten
     // so no need to make sure that the values are valid (assuming FP exceptions are disabled)
-    Mask succeeded
-        = dispatch_get_inverse_matrix(ctx->batched<__OSL_WIDTH>().renderer(),
-                                      bsg, wrm, USTR(to), bsg->varying.time);
+    Mask succeeded(false);
+    if (!get_uniform_time_matrix(bsg, wrm, USTR(to), true, succeeded))
+        succeeded = dispatch_get_inverse_matrix(
+            ctx->batched<__OSL_WIDTH>().renderer(), bsg, wrm, USTR(to),
+            bsg->varying.time);
 
     auto failedResults = wrm & succeeded.invert();
     if (failedResults.mask().any_on()) {
@@ -1405,8 +1512,8 @@ impl_transform_normal_masked(void* Pin, void* Pout, Wide<const Matrix44> wM,
 
     // Transform with Normal semantics
 
-    Block<int> notAffineBlock;
-    Wide<int> wnotAffine(notAffineBlock);
+    Block<int> slowPathBlock;
+    Wide<int> wslowPath(slowPathBlock);
 
     OSL_FORCEINLINE_BLOCK
     {
@@ -1414,23 +1521,24 @@ impl_transform_normal_masked(void* Pin, void* Pout, Wide<const Matrix44> wM,
         for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
             DataType v     = inPoints[lane];
             Matrix44 M     = wM[lane];
-            bool is_affine = true;
+            bool slow_path = false;
             if (wresult.mask()[lane]) {
-                is_affine = test_if_affine(M);
-                if (is_affine) {
-                    wresult[ActiveLane(lane)] = multiplyDirByMatrix(
-                        inlinedTransposed(OSL::affineInverse(M)), v);
+                Matrix44 invM { Imath::UNINITIALIZED };
+                slow_path = !simd_inverse(M, invM);
+                if (!slow_path) {
+                    wresult[ActiveLane(lane)]
+                        = multiplyDirByMatrix(inlinedTransposed(invM), v);
                 }
             }
-            wnotAffine[lane] = (!is_affine);  // false when lane is masked off
+            wslowPath[lane] = slow_path;  // false when lane is masked off
         }
     }
 
-    if (testIfAnyLaneIsNonZero(wnotAffine)) {
+    if (testIfAnyLaneIsNonZero(wslowPath)) {
         invoke([=]() -> void {
             // DO NOT VECTORIZE the slow path
             for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
-                if (wnotAffine[lane]) {
+                if (wslowPath[lane]) {
                     OSL_DASSERT(wresult.mask().is_on(lane));
 
                     DataType v       = inPoints[lane];
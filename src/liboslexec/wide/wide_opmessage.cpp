@@ -109,6 +109,16 @@ public:
 
     MessageBlock* find(ustring name) const
     {
+        constexpr size_t hashmask = BatchedMessageBuffer::HashSize - 1;
+        if (m_buffer.count <= BatchedMessageBuffer::MaxHashed) {
+            size_t i = name.hash() & hashmask;
+            for (; m_buffer.table[i]; i = (i + 1) & hashmask) {
+                auto* m = reinterpret_cast<MessageBlock*>(m_buffer.table[i]);
+                if (m->name == name)
+                    return m;
+            }
+            return nullptr;
+        }
         for (MessageBlock* m = list_head(); m != nullptr; m = m->next)
             if (m->name == name)
                 return m;  // name matches
@@ -129,6 +139,13 @@ public:
                                           alignment);
         list_head()->import_data(wsrcval, lanes_to_populate, layeridx,
                                  sourcefile, sourceline);
+        if (++m_buffer.count <= BatchedMessageBuffer::MaxHashed) {
+            constexpr size_t hashmask = BatchedMessageBuffer::HashSize - 1;
+            size_t i                  = name.hash() & hashmask;
+            while (m_buffer.table[i])
+                i = (i + 1) & hashmask;
+            m_buffer.table[i] = list_head();
+        }
     }
 };
 
@@ -0,0 +1,189 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <limits>
+
+#include <OSL/oslconfig.h>
+
+#include <OSL/batched_shaderglobals.h>
+#include <OSL/wide.h>
+
+#include "oslexec_pvt.h"
+
+#include <OSL/Imathx/Imathx.h>
+#include <OSL/dual_vec.h>
+#include <OSL/oslnoise.h>
+
+#include "fractal_noise.h"
+
+#include <OpenImageIO/fmath.h>
+
+using namespace OSL;
+
+OSL_NAMESPACE_BEGIN
+namespace __OSL_WIDE_PVT {
+
+OSL_USING_DATA_WIDTH(__OSL_WIDTH)
+
+#include "define_opname_macros.h"
+#define __OSL_NOISE_OP2(A, B)    __OSL_MASKED_OP2(fractalnoise, A, B)
+#define __OSL_NOISE_OP3(A, B, C) __OSL_MASKED_OP3(fractalnoise, A, B, C)
+
+namespace  // anonymous
+{
+
+// Sum the octaves of each active lane with the same FractalSum as the
+// scalar shadeops; the noise type and its options are uniform (varying
+// options were binned by the code generator).
+template<typename R, typename S>
+void
+wide_fractal(const char* name_ptr, const NoiseParams* opt,
+             Masked<Dual2<R>> wresult, Wide<const Dual2<S>> ws)
+{
+    ustring name = USTR(name_ptr);
+    bool fold    = (name != Strings::fbm);
+    bool ridged  = (name == Strings::ridged);
+    wresult.mask().foreach ([=](ActiveLane lane) -> void {
+        FractalSum<SNoiseScalar> fsum;
+        Dual2<S> s = ws[lane];
+        Dual2<R> result;
+        fsum(fold, ridged, result, s, opt);
+        wresult[lane] = result;
+    });
+}
+
+template<typename R, typename S, typename T>
+void
+wide_fractal(const char* name_ptr, const NoiseParams* opt,
+             Masked<Dual2<R>> wresult, Wide<const Dual2<S>> ws,
+             Wide<const Dual2<T>> wt)
+{
+    ustring name = USTR(name_ptr);
+    bool fold    = (name != Strings::fbm);
+    bool ridged  = (name == Strings::ridged);
+    wresult.mask().foreach ([=](ActiveLane lane) -> void {
+        FractalSum<SNoiseScalar> fsum;
+        Dual2<S> s = ws[lane];
+        Dual2<T> t = wt[lane];
+        Dual2<R> result;
+        fsum(fold, ridged, result, s, t, opt);
+        wresult[lane] = result;
+    });
+}
+
+}  // namespace
+
+
+
+OSL_BATCHOP void
+__OSL_NOISE_OP2(Wdf, Wdf)(char* name, char* r_ptr, char* x_ptr, char* bsg,
+                          char* opt, char* varying_direction_ptr,
+                          unsigned int mask_value)
+{
+    wide_fractal(name, reinterpret_cast<const NoiseParams*>(opt),
+                 Masked<Dual2<float>>(r_ptr, Mask(mask_value)),
+                 Wide<const Dual2<float>>(x_ptr));
+}
+
+
+
+OSL_BATCHOP void
+__OSL_NOISE_OP3(Wdf, Wdf, Wdf)(char* name, char* r_ptr, char* x_ptr,
+                               char* y_ptr, char* bsg, char* opt,
+                               char* varying_direction_ptr,
+                               unsigned int mask_value)
+{
+    wide_fractal(name, reinterpret_cast<const NoiseParams*>(opt),
+                 Masked<Dual2<float>>(r_ptr, Mask(mask_value)),
+                 Wide<const Dual2<float>>(x_ptr),
+                 Wide<const Dual2<float>>(y_ptr));
+}
+
+
+
+OSL_BATCHOP void
+__OSL_NOISE_OP2(Wdf, Wdv)(char* name, char* r_ptr, char* p_ptr, char* bsg,
+                          char* opt, char* varying_direction_ptr,
+                          unsigned int mask_value)
+{
+    wide_fractal(name, reinterpret_cast<const NoiseParams*>(opt),
+                 Masked<Dual2<float>>(r_ptr, Mask(mask_value)),
+                 Wide<const Dual2<Vec3>>(p_ptr));
+}
+
+
+
+OSL_BATCHOP void
+__OSL_NOISE_OP3(Wdf, Wdv, Wdf)(char* name, char* r_ptr, char* p_ptr,
+                               char* t_ptr, char* bsg, char* opt,
+                               char* varying_direction_ptr,
+                               unsigned int mask_value)
+{
+    wide_fractal(name, reinterpret_cast<const NoiseParams*>(opt),
+                 Masked<Dual2<float>>(r_ptr, Mask(mask_value)),
+                 Wide<const Dual2<Vec3>>(p_ptr),
+                 Wide<const Dual2<float>>(t_ptr));
+}
+
+
+
+OSL_BATCHOP void
+__OSL_NOISE_OP3(Wdv, Wdv, Wdf)(char* name, char* r_ptr, char* p_ptr,
+                               char* t_ptr, char* bsg, char* opt,
+                               char* varying_direction_ptr,
+                               unsigned int mask_value)
+{
+    wide_fractal(name, reinterpret_cast<const NoiseParams*>(opt),
+                 Masked<Dual2<Vec3>>(r_ptr, Mask(mask_value)),
+                 Wide<const Dual2<Vec3>>(p_ptr),
+                 Wide<const Dual2<float>>(t_ptr));
+}
+
+
+
+OSL_BATCHOP void
+__OSL_NOISE_OP2(Wdv, Wdf)(char* name, char* r_ptr, char* x_ptr, char* bsg,
+                          char* opt, char* varying_direction_ptr,
+                          unsigned int mask_value)
+{
+    wide_fractal(name, reinterpret_cast<const NoiseParams*>(opt),
+                 Masked<Dual2<Vec3>>(r_ptr, Mask(mask_value)),
+                 Wide<const Dual2<float>>(x_ptr));
+}
+
+
+
+OSL_BATCHOP void
+__OSL_NOISE_OP3(Wdv, Wdf, Wdf)(char* name, char* r_ptr, char* x_ptr,
+                               char* y_ptr, char* bsg, char* opt,
+                               char* varying_direction_ptr,
+                               unsigned int mask_value)
+{
+    wide_fractal(name, reinterpret_cast<const NoiseParams*>(opt),
+                 Masked<Dual2<Vec3>>(r_ptr, Mask(mask_value)),
+                 Wide<const Dual2<float>>(x_ptr),
+                 Wide<const Dual2<float>>(y_ptr));
+}
+
+
+
+OSL_BATCHOP void
+__OSL_NOISE_OP2(Wdv, Wdv)(char* name, char* r_ptr, char* p_ptr, char* bsg,
+                          char* opt, char* varying_direction_ptr,
+                          unsigned int mask_value)
+{
+    wide_fractal(name, reinterpret_cast<const NoiseParams*>(opt),
+                 Masked<Dual2<Vec3>>(r_ptr, Mask(mask_value)),
+                 Wide<const Dual2<Vec3>>(p_ptr));
+}
+
+
+
+}  // namespace __OSL_WIDE_PVT
+OSL_NAMESPACE_END
+
+#undef __OSL_NOISE_OP2
+#undef __OSL_NOISE_OP3
+
+#include "undef_opname_macros.h"
@@ -83,6 +83,11 @@ zero_derivs(Masked<Dual2<float>> wr)
                                          char* x_ptr, char* bsg, char* opt,   \
                                          char* varying_direction_ptr,         \
                                          unsigned int mask_value);            \
+    OSL_BATCHOP void __OSL_MASKED_OP2(fractalnoise, A,                        \
+                                      B)(char* name_ptr, char* r_ptr,         \
+                                         char* x_ptr, char* bsg, char* opt,   \
+                                         char* varying_direction_ptr,         \
+                                         unsigned int mask_value);            \
     OSL_BATCHOP void __OSL_MASKED_OP2(noise, A, B)(char* r_ptr, char* x_ptr,  \
                                                    unsigned int mask_value);  \
     OSL_BATCHOP void __OSL_MASKED_OP2(simplexnoise, A,                        \
@@ -105,6 +110,9 @@ zero_derivs(Masked<Dual2<float>> wr)
     OSL_BATCHOP void __OSL_MASKED_OP2(hashnoise, NONDERIV_A,                  \
                                       NONDERIV_B)(char* r_ptr, char* x_ptr,   \
                                                   unsigned int mask_value);   \
+    OSL_BATCHOP void __OSL_MASKED_OP2(voronoinoise, A,                        \
+                                      B)(char* r_ptr, char* x_ptr,            \
+                                         unsigned int mask_value);            \
     OSL_BATCHOP void __OSL_MASKED_OP2(genericnoise, A,                        \
                                       B)(char* name_ptr, char* r_ptr,         \
                                          char* x_ptr, char* bsg, char* opt,   \
@@ -132,6 +140,13 @@ zero_derivs(Masked<Dual2<float>> wr)
             __OSL_MASKED_OP2(gabornoise, A, B)                                \
             (name_ptr, r_ptr, x_ptr, bsg, opt, varying_direction_ptr,         \
              mask_value);                                                     \
+        } else if (name == Strings::fbm || name == Strings::turbulence        \
+                   || name == Strings::ridged) {                              \
+            __OSL_MASKED_OP2(fractalnoise, A, B)                              \
+            (name_ptr, r_ptr, x_ptr, bsg, opt, varying_direction_ptr,         \
+             mask_value);                                                     \
+        } else if (name == Strings::voronoi || name == Strings::worley) {     \
+            __OSL_MASKED_OP2(voronoinoise, A, B)(r_ptr, x_ptr, mask_value);   \
         } else if (name == Strings::null) {                                   \
             __OSL_MASKED_OP2(nullnoise, A, B)(r_ptr, x_ptr, mask_value);      \
         } else if (name == Strings::unull) {                                  \
@@ -158,6 +173,9 @@ __OSL_GENERIC_DISPATCH2(Wdf, Wdf, Wf, Wf, Dual2<float>)
     OSL_BATCHOP void __OSL_MASKED_OP3(gabornoise, A, B, C)(                    \
         char* name_ptr, char* r_ptr, char* x_ptr, char* y_ptr, char* bsg,      \
         char* opt, char* varying_direction_ptr, unsigned int mask_value);      \
+    OSL_BATCHOP void __OSL_MASKED_OP3(fractalnoise, A, B, C)(                  \
+        char* name_ptr, char* r_ptr, char* x_ptr, char* y_ptr, char* bsg,      \
+        char* opt, char* varying_direction_ptr, unsigned int mask_value);      \
     OSL_BATCHOP void __OSL_MASKED_OP3(noise, A, B,                             \
                                       C)(char* r_ptr, char* x_ptr,             \
                                          char* y_ptr,                          \
@@ -190,6 +208,10 @@ __OSL_GENERIC_DISPATCH2(Wdf, Wdf, Wf, Wf, Dual2<float>)
                                       NONDERIV_C)(char* r_ptr, char* x_ptr,    \
                                                   char* y_ptr,                 \
                                                   unsigned int mask_value);    \
+    OSL_BATCHOP void __OSL_MASKED_OP3(voronoinoise, A, B,                      \
+                                      C)(char* r_ptr, char* x_ptr,             \
+                                         char* y_ptr,                          \
+                                         unsigned int mask_value);             \
     OSL_BATCHOP void __OSL_MASKED_OP3(genericnoise, A, B, C)(                  \
         char* name_ptr, char* r_ptr, char* x_ptr, char* y_ptr, char* bsg,      \
         char* opt, char* varying_direction_ptr, unsigned int mask_value)       \
@@ -218,6 +240,14 @@ __OSL_GENERIC_DISPATCH2(Wdf, Wdf, Wf, Wf, Dual2<float>)
             __OSL_MASKED_OP3(gabornoise, A, B, C)                              \
             (name_ptr, r_ptr, x_ptr, y_ptr, bsg, opt, varying_direction_ptr,   \
              mask_value);                                                      \
+        } else if (name == Strings::fbm || name == Strings::turbulence         \
+                   || name == Strings::ridged) {                               \
+            __OSL_MASKED_OP3(fractalnoise, A, B, C)                            \
+            (name_ptr, r_ptr, x_ptr, y_ptr, bsg, opt, varying_direction_ptr,   \
+             mask_value);                                                      \
+        } else if (name == Strings::voronoi || name == Strings::worley) {      \
+            __OSL_MASKED_OP3(voronoinoise, A, B, C)                            \
+            (r_ptr, x_ptr, y_ptr, mask_value);                                 \
         } else if (name == Strings::null) {                                    \
             __OSL_MASKED_OP3(nullnoise, A, B, C)                               \
             (r_ptr, x_ptr, y_ptr, mask_value);                                 \
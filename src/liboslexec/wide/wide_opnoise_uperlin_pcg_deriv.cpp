@@ -0,0 +1,14 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#ifndef __OSL_USE_REFERENCE_INT_HASH
+#    define __OSL_USE_REFERENCE_INT_HASH 0
+#endif
+#if __OSL_USE_REFERENCE_INT_HASH
+// incorrect results when vectorizing with reference hash
+#    undef OSL_OPENMP_SIMD
+#endif
+
+#define __OSL_XMACRO_ARGS (noise_pcg, NoisePCGScalar, NoisePCG)
+#include "wide_opnoise_impl_deriv_xmacro.h"
@@ -47,7 +47,8 @@ default_pointcloud_search(BatchedShaderGlobals* bsg, ustringhash filename,
         assign_all(results.wnum_points(), 0);
         return;
     }
-    PointCloud* pc = PointCloud::get(filename);
+    bool osl_index = ctx->shadingsys().pointcloud_index() == u_kdtree;
+    PointCloud* pc = PointCloud::get(filename, false, osl_index);
     if (pc == NULL) {  // The file failed to load
         ctx->batched<__OSL_WIDTH>().errorfmt(
             results.mask(), "pointcloud_search: could not open \"{}\"",
@@ -56,8 +57,9 @@ default_pointcloud_search(BatchedShaderGlobals* bsg, ustringhash filename,
         return;
     }
 
-    const Partio::ParticlesData* cloud = pc->read_access();
-    if (cloud == NULL) {  // The file failed to load
+    const PointCloudFile* file         = pc->file();
+    const Partio::ParticlesData* cloud = file ? nullptr : pc->read_access();
+    if (cloud == NULL && !file) {  // The file failed to load
         ctx->batched<__OSL_WIDTH>().errorfmt(
             results.mask(), "pointcloud_search: could not open \"{}\"",
             filename);
@@ -66,17 +68,21 @@ default_pointcloud_search(BatchedShaderGlobals* bsg, ustringhash filename,
     }
 
     // Early exit if the pointcloud contains no particles.
-    if (cloud->numParticles() == 0) {
+    if ((file ? file->size() : size_t(cloud->numParticles())) == 0) {
         assign_all(results.wnum_points(), 0);
         return;
     }
 
     // If we need derivs of the distances, we'll need access to the
     // found point's positions.
-    Partio::ParticleAttribute* pos_attr = NULL;
+    Partio::ParticleAttribute* pos_attr            = NULL;
+    const PointCloudFile::Attribute* file_pos_attr = nullptr;
     if (results.distances_have_derivs()) {
-        pos_attr = pc->m_attributes[u_position].get();
-        if (!pos_attr) {
+        if (file)
+            file_pos_attr = file->attribute(u_position);
+        else
+            pos_attr = pc->m_attributes[u_position].get();
+        if (!pos_attr && !file_pos_attr) {
             // No "position" attribute -- fail
             assign_all(results.wnum_points(), 0);
             return;
@@ -102,21 +108,58 @@ default_pointcloud_search(BatchedShaderGlobals* bsg, ustringhash filename,
     // and our batched representation is
     // structure of arrays (wide) so we need a scalar temporary
     // distances array
-    float* dist2              = OSL_ALLOCA(float, max_points);
+    float* lane_dist2         = OSL_ALLOCA(float, max_points);
     SortedPointRecord* sorted = OSL_ALLOCA(SortedPointRecord, max_points);
     auto windices             = results.windices();
     auto wnum_points          = results.wnum_points();
+
+    // With our own index, search all the active lanes in one batch up
+    // front, already sorted if asked for; lanes then just copy out.
+    const PointCloudIndex* index = pc->index();
+    int* batch_indices           = nullptr;
+    float* batch_dist2           = nullptr;
+    int* batch_counts            = nullptr;
+    int* slot                    = nullptr;
+    if (index) {
+        Vec3* centers = OSL_ALLOCA(Vec3, __OSL_WIDTH);
+        float* radii  = OSL_ALLOCA(float, __OSL_WIDTH);
+        slot          = OSL_ALLOCA(int, __OSL_WIDTH);
+        int nsearches = 0;
+        results.mask().foreach ([&](ActiveLane lane) -> void {
+            slot[lane]         = nsearches;
+            centers[nsearches] = wcenter[lane];
+            radii[nsearches]   = wradius[lane];
+            ++nsearches;
+        });
+        batch_indices = OSL_ALLOCA(int, __OSL_WIDTH * max_points);
+        batch_dist2   = OSL_ALLOCA(float, __OSL_WIDTH * max_points);
+        batch_counts  = OSL_ALLOCA(int, __OSL_WIDTH);
+        index->search_batch(nsearches, centers, radii, max_points, sort,
+                            batch_indices, batch_dist2, batch_counts);
+    }
+
     results.mask().foreach ([=](ActiveLane lane) -> void {
         const OSL::Vec3 center = wcenter[lane];
 
         const float radius = wradius[lane];
-        float finalRadius;
-        int count = cloud->findNPoints(&center[0], max_points, radius, indices,
-                                       dist2, &finalRadius);
+        int count;
+        float* dist2 = lane_dist2;
+        if (index) {
+            int s            = slot[lane];
+            const int* found = batch_indices + s * max_points;
+            count            = batch_counts[s];
+            for (int i = 0; i < count; ++i)
+                indices[i] = found[i];
+            dist2 = batch_dist2 + s * max_points;
+        } else {
+            float finalRadius;
+            count = cloud->findNPoints(&center[0], max_points, radius,
+                                       indices, dist2, &finalRadius);
+        }
 
         // If sorting, allocate some temp space and sort the distances and
         // indices at the same time.
-        if (sort && count > 1) {
+        if (sort && !index && count > 1) {
             //SortedPointRecord *sorted = (SortedPointRecord *) sg->context->alloc_scratch (count * sizeof(SortedPointRecord), sizeof(SortedPointRecord));
             //SortedPointRecord *sorted = OSL_ALLOCA(SortedPointRecord, count);
             for (int i = 0; i < count; ++i)
@@ -155,9 +198,12 @@ default_pointcloud_search(BatchedShaderGlobals* bsg, ustringhash filename,
                 // distance derivs
                 //OSL::Vec3 *positions = (OSL::Vec3 *) sg->context->alloc_scratch (sizeof(OSL::Vec3) * count, sizeof(float));
                 OSL::Vec3* positions = OSL_ALLOCA(OSL::Vec3, count);
-                // FIXME(Partio): this function really should be marked as const because it is just a wrapper of a private const method
-                const_cast<Partio::ParticlesData*>(cloud)->data(
-                    *pos_attr, count, indices, true, (void*)positions);
+                if (file)
+                    file->get(*file_pos_attr, count, indices, positions);
+                else
+                    // FIXME(Partio): this function really should be marked as const because it is just a wrapper of a private const method
+                    const_cast<Partio::ParticlesData*>(cloud)->data(
+                        *pos_attr, count, indices, true, (void*)positions);
 
                 Wide<const Dual2<OSL::Vec3>> wdcenter(wcenter_);
                 const Dual2<OSL::Vec3> dcenter = wdcenter[lane];
@@ -216,6 +262,49 @@ dispatch_pointcloud_search(BatchedShaderGlobals* bsg, ustringhash filename,
 
 
 
+#ifdef USE_PARTIO
+// Gather the values of the first wcount[lane] points of windices, for each
+// lane of gather_lanes, from an attribute's contiguous array (of 32-bit
+// values, nbase of them per point) straight into the wide output. Each
+// point slot is done for all the lanes at once, while the points of the
+// next slot are prefetched.
+static void
+gather_soa_attribute(const PointCloudFile::Attribute& a, size_t npoints,
+                     int nbase, Wide<const int[]> windices, Wide<int> wcount,
+                     int maxcount, Mask gather_lanes, void* out)
+{
+    const int* src  = reinterpret_cast<const int*>(a.data);
+    Block<int>* dst = reinterpret_cast<Block<int>*>(out);
+    for (int i = 0; i < maxcount; ++i) {
+        Wide<const int> windex = windices.get_element(i);
+#    if defined(__GNUC__) || defined(__clang__)
+        if (i + 1 < maxcount) {
+            Wide<const int> wnext = windices.get_element(i + 1);
+            for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
+                size_t p = size_t(wnext[lane]);
+                if (gather_lanes[lane] && i + 1 < wcount[lane] && p < npoints)
+                    __builtin_prefetch(src + p * nbase);
+            }
+        }
+#    endif
+        // The output is flat arrays of base values, each one wide: the
+        // values of point slot i start at base value i*nbase.
+        for (int k = 0; k < nbase; ++k) {
+            Masked<int> wdst(dst[i * nbase + k], gather_lanes);
+            OSL_OMP_PRAGMA(omp simd simdlen(__OSL_WIDTH))
+            for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
+                if (i < wcount[lane]) {
+                    size_t p   = size_t(windex[lane]);
+                    wdst[lane] = p < npoints ? src[p * nbase + k] : 0;
+                }
+            }
+        }
+    }
+}
+#endif
+
+
+
 OSL_FORCEINLINE Mask
 default_pointcloud_get(BatchedShaderGlobals* bsg, ustringhash filename,
                        Wide<const int[]> windices, Wide<const int> wnum_points,
@@ -225,15 +314,22 @@ default_pointcloud_get(BatchedShaderGlobals* bsg, ustringhash filename,
     Mask success { false };
     ShadingContext* ctx = bsg->uniform.context;
 
-    PointCloud* pc = PointCloud::get(filename);
+    bool osl_index = ctx->shadingsys().pointcloud_index() == u_kdtree;
+    PointCloud* pc = PointCloud::get(filename, false, osl_index);
     // defer reporting errors as only lanes with non zero num_points
     // should report errors
+    const PointCloudFile* file         = nullptr;
     const Partio::ParticlesData* cloud = nullptr;
     if (pc != nullptr) {
-        cloud = pc->read_access();
+        file = pc->file();
+        if (!file)
+            cloud = pc->read_access();
     }
-    Partio::ParticleAttribute* attr = nullptr;
-    if (cloud != nullptr) {
+    Partio::ParticleAttribute* attr            = nullptr;
+    const PointCloudFile::Attribute* file_attr = nullptr;
+    if (file != nullptr) {
+        file_attr = file->attribute(attr_name);
+    } else if (cloud != nullptr) {
         attr = pc->m_attributes[attr_name].get();
     }
 
@@ -247,8 +343,9 @@ default_pointcloud_get(BatchedShaderGlobals* bsg, ustringhash filename,
     void* aos_buffer               = nullptr;
     bool is_compatible_with_partio = false;
     int maxn                       = 0;
-    if (attr != nullptr) {
-        partio_type               = TypeDescOfPartioType(attr);
+    if (attr != nullptr || file_attr != nullptr) {
+        partio_type               = file_attr ? file_attr->type
+                                              : TypeDescOfPartioType(attr);
         is_compatible_with_partio = compatiblePartioType(partio_type,
                                                          element_type);
         maxn                      = basevals(attr_type) / basevals(partio_type);
@@ -261,10 +358,24 @@ default_pointcloud_get(BatchedShaderGlobals* bsg, ustringhash filename,
         }
     }
 
+    // Numeric attributes held in contiguous arrays are gathered for all
+    // the lanes together, after checking each lane below.
+    const PointCloudFile::Attribute* soa = nullptr;
+    if (pc != nullptr && is_compatible_with_partio
+        && (partio_type.basetype == TypeDesc::FLOAT
+            || partio_type.basetype == TypeDesc::INT))
+        soa = pc->soa_attribute(attr_name);
+    Block<int> countBlock;
+    Wide<int> wcount(countBlock);
+    assign_all(countBlock, 0);
+    Mask gather_lanes(false);
+    int maxcount = 0;
+
     Partio::ParticleIndex* indices
         = (Partio::ParticleIndex*)OSL_ALLOCA(size_t, windices.length());
 
-    wout_data.mask().foreach ([=, &success](ActiveLane lane) -> void {
+    wout_data.mask().foreach ([=, &success, &gather_lanes,
+                               &maxcount](ActiveLane lane) -> void {
         int count = wnum_points[lane];
         if (!count) {
             success.set_on(lane);  // always succeed if not asking for any data
@@ -278,7 +389,7 @@ default_pointcloud_get(BatchedShaderGlobals* bsg, ustringhash filename,
             return;
         }
 
-        if (cloud == nullptr) {  // The file failed to load
+        if (cloud == nullptr && file == nullptr) {  // The file failed to load
             ctx->batched<__OSL_WIDTH>().errorfmt(
                 Mask { lane }, "pointcloud_get: could not open \"{}\"",
                 filename);
@@ -286,7 +397,7 @@ default_pointcloud_get(BatchedShaderGlobals* bsg, ustringhash filename,
         }
 
         // lookup the ParticleAttribute pointer needed for a query
-        if (attr == nullptr) {
+        if (attr == nullptr && file_attr == nullptr) {
             ctx->batched<__OSL_WIDTH>().errorfmt(
                 Mask { lane },
                 "Accessing unexisting attribute {} in pointcloud \"{}\"",
@@ -312,6 +423,13 @@ default_pointcloud_get(BatchedShaderGlobals* bsg, ustringhash filename,
                 attr_name, partio_type, count, attr_type);
             count = maxn;
         }
+        if (soa) {
+            wcount[lane] = count;
+            gather_lanes.set_on(lane);
+            maxcount = std::max(maxcount, count);
+            success.set_on(lane);
+            return;
+        }
         // Copy int indices out of SOA wide format into local AOS size_t
         auto int_indices = windices[lane];
         for (int i = 0; i < count; ++i) {
@@ -325,7 +443,16 @@ default_pointcloud_get(BatchedShaderGlobals* bsg, ustringhash filename,
         // then copy them back to the caller's indices.
 
         // Actual data query
-        if (partio_type == OIIO::TypeString) {
+        if (file_attr && partio_type == OIIO::TypeString) {
+            OSL_DASSERT(Masked<ustring[]>::is(wout_data));
+            Masked<ustring[]> wout_strings(wout_data);
+            auto out_strings = wout_strings[lane];
+            for (int i = 0; i < count; ++i)
+                out_strings[i] = file->string(*file_attr, indices[i]);
+        } else if (file_attr) {
+            file->get(*file_attr, count, indices, aos_buffer);
+            wout_data.assign_val_lane_from_scalar(lane, aos_buffer);
+        } else if (partio_type == OIIO::TypeString) {
             // strings are special cases because they are stored as int index
             const_cast<Partio::ParticlesData*>(cloud)->data(
                 *attr, count, (const Partio::ParticleIndex*)indices,
@@ -355,6 +482,10 @@ default_pointcloud_get(BatchedShaderGlobals* bsg, ustringhash filename,
         }
         success.set_on(lane);
     });
+    if (gather_lanes.any_on())
+        gather_soa_attribute(*soa, pc->size(), basevals(partio_type),
+                             windices, wcount, maxcount, gather_lanes,
+                             wout_data.ptr());
     return success;
 #else
     return Mask { false };
@@ -391,77 +522,43 @@ default_pointcloud_write(BatchedShaderGlobals* bsg, ustringhash filename,
         return Mask { false };
 
     PointCloud* pc = PointCloud::get(filename, true /* create file to write */);
-    spin_lock lock(pc->m_mutex);
-    Partio::ParticlesDataMutable* cloud = pc->write_access();
-    if (cloud == NULL)  // The file failed to load
+    if (pc->write_access() == NULL)  // The file failed to load
         return Mask { false };
 
-    // Mark the pointcloud as written, so we will save it later
-    pc->m_write = true;
-
-    // first time only -- add "position" attribute
-    if (cloud->numParticles() == 0)
-        pc->m_position_attribute = cloud->addAttribute("position",
-                                                       Partio::VECTOR, 3);
-
-    // Make sure all the attributes mentioned have been added properly
+    // Stage the new points in this thread's own buffer, which is added to
+    // the cloud (under its lock) only a chunk of points at a time.
+    PointCloud::Staging& staging(pc->staging());
     bool ok = true;
-    std::vector<Partio::ParticleAttribute*> partattrs;
-    partattrs.reserve(nattribs);
-    for (int i = 0; i < nattribs; ++i) {
-        const ustring attr_name      = attr_names[i];
-        Partio::ParticleAttribute* a = pc->m_attributes[attr_name].get();
-        if (!a) {  // attribute needs to be added
-            Partio::ParticleAttributeType pt = PartioType(attr_types[i]);
-            if (pt == Partio::NONE) {
-                ok = false;
-            } else {
-                a  = new Partio::ParticleAttribute();
-                *a = cloud->addAttribute(attr_name.c_str(), pt,
-                                         pt == Partio::VECTOR ? 3
-                                                              : 1 /*count*/);
-                pc->m_attributes[attr_name].reset(a);
-            }
-        }
-        partattrs.push_back(a);
-    }
-
-    mask.foreach ([=](ActiveLane lane) -> void {
-        // Make a new particle
-        Partio::ParticleIndex p = cloud->addParticle();
-        const Vec3 pos          = wpos[lane];
-        *(Vec3*)cloud->dataWrite<float>(pc->m_position_attribute, p) = pos;
+    mask.foreach ([&](ActiveLane lane) -> void {
+        staging.add_point(wpos[lane]);
         for (int i = 0; i < nattribs; ++i) {
-            Partio::ParticleAttribute* a       = partattrs[i];
-            const void* ptr_to_wide_attr_value = ptrs_to_wide_attr_value[i];
-            if (a && PartioType(attr_types[i]) == a->type) {
-                switch (a->type) {
-                case Partio::FLOAT: {
-                    Wide<const float> wdata(ptr_to_wide_attr_value);
-                    *(float*)cloud->dataWrite<float>(*a, p) = wdata[lane];
-                } break;
-                case Partio::VECTOR: {
-                    Wide<const Vec3> wdata(ptr_to_wide_attr_value);
-                    *(Vec3*)cloud->dataWrite<float>(*a, p) = wdata[lane];
-                } break;
-                case Partio::INT: {
-                    Wide<const int> wdata(ptr_to_wide_attr_value);
-                    *(int*)cloud->dataWrite<int>(*a, p) = wdata[lane];
-                } break;
-                case Partio::INDEXEDSTR: {
-                    Wide<const ustring> wdata(ptr_to_wide_attr_value);
-                    ustring ustr  = wdata[lane];
-                    const char* s = ustr.c_str();
-                    int index     = cloud->lookupIndexedStr(*a, s);
-                    if (index == -1)
-                        index = cloud->registerIndexedStr(*a, s);
-                    *(int*)cloud->dataWrite<int>(*a, p) = index;
-                } break;
-                case Partio::NONE: break;
-                }
+            ustringhash name   = ustringhash_from(attr_names[i]);
+            TypeDesc type      = attr_types[i];
+            const void* wvalue = ptrs_to_wide_attr_value[i];
+            if (type == TypeFloat) {
+                Wide<const float> wdata(wvalue);
+                float value = wdata[lane];
+                ok &= staging.set(name, type, &value);
+            } else if (type.basetype == TypeDesc::FLOAT
+                       && type.aggregate == TypeDesc::VEC3) {
+                Wide<const Vec3> wdata(wvalue);
+                Vec3 value = wdata[lane];
+                ok &= staging.set(name, type, &value);
+            } else if (type == TypeInt) {
+                Wide<const int> wdata(wvalue);
+                int value = wdata[lane];
+                ok &= staging.set(name, type, &value);
+            } else if (type == TypeString) {
+                Wide<const ustring> wdata(wvalue);
+                ustringhash value = ustringhash_from(wdata[lane]);
+                ok &= staging.set(name, type, &value);
+            } else {
+                ok = false;  // not a type that point clouds can hold
             }
         }
     });
+    if (staging.size() >= PointCloud::Staging::chunk_size)
+        pc->merge(staging);
 
     return ok ? mask : Mask { false };
 #else
@@ -333,20 +333,40 @@ splineinverse_search(const MatrixT& M, R_T& result, X_T& xval, KArrayT knots,
         /*initial_result=*/0, S, xval, X_T(1.0e-6)
     };
 
+    int nsegs     = (knot_count - 4) / BasisStepT + 1;
+    float nseginv = 1.0f / nsegs;
+
+    // Binary search for the last segment starting on the near side of
+    // xval, which holds it when the segment end values are monotonic.
+    // The trip count depends only on the uniform nsegs, so all lanes
+    // iterate together.
+    int seg = 0;
+    for (int step = Spline::segment_search_step(nsegs); step > 0;
+         step >>= 1) {
+        int probe = seg + step;
+        if (probe < nsegs) {
+            X_T start = S(X_T(nseginv * probe));
+            if ((increasing & (start < xval))
+                | ((!increasing) & (start > xval)))
+                seg = probe;
+        }
+    }
+    X_T r0             = nseginv * seg;
+    X_T r1             = nseginv * (seg + 1);
+    bool bracket_found = inverter.is_bracketed_by(r0, r1);
+
     // Because of the nature of spline interpolation, monotonic knots
     // can still lead to a non-monotonic curve.  To deal with this,
     // search separately on each spline segment and hope for the best.
-    int nsegs     = (knot_count - 4) / BasisStepT + 1;
-    float nseginv = 1.0f / nsegs;
-    X_T r0        = 0.0;
-    X_T r1;
-    bool bracket_found = false;
-    for (int s = 0; s < nsegs; ++s) {  // Search each interval
-        r1            = nseginv * (s + 1);
-        bracket_found = inverter.is_bracketed_by(r0, r1);
-        if (bracket_found)
-            break;
-        r0 = r1;  // Start of next interval is end of this one
+    if (!bracket_found) {
+        r0 = 0.0;
+        for (int s = 0; s < nsegs; ++s) {  // Search each interval
+            r1            = nseginv * (s + 1);
+            bracket_found = inverter.is_bracketed_by(r0, r1);
+            if (bracket_found)
+                break;
+            r0 = r1;  // Start of next interval is end of this one
+        }
     }
 
     if (bracket_found) {
@@ -11,6 +11,7 @@
 /////////////////////////////////////////////////////////////////////////
 
 #include <cstdarg>
+#include <tuple>
 
 #include <OSL/oslconfig.h>
 
@@ -30,6 +31,36 @@ OSL_USING_DATA_WIDTH(__OSL_WIDTH)
 #include "define_opname_macros.h"
 
 
+namespace {
+
+// Active lanes of a batch frequently carry identical strings (a uniform
+// texture path prefix, a handful of distinct material names, etc.) even
+// when BatchedAnalysis could not prove the operands uniform.  Remember the
+// inputs and result of the previous active lane so a run of identical
+// inputs, including a batch that is uniform at runtime, evaluates the
+// scalar string function only once and broadcasts its result.
+template<typename ResultT, typename... ArgsT> class LastLaneMemo {
+public:
+    template<typename FunctorT>
+    ResultT operator()(FunctorT&& f, const ArgsT&... args)
+    {
+        if (!m_valid || m_args != std::tie(args...)) {
+            m_result = f(args...);
+            m_args   = std::make_tuple(args...);
+            m_valid  = true;
+        }
+        return m_result;
+    }
+
+private:
+    std::tuple<ArgsT...> m_args;
+    ResultT m_result {};
+    bool m_valid = false;
+};
+
+}  // namespace
+
+
 OSL_BATCHOP void
 __OSL_MASKED_OP3(concat, Ws, Ws, Ws)(void* wr_, void* ws_, void* wt_,
                                      unsigned int mask_value)
@@ -41,28 +72,30 @@ __OSL_MASKED_OP3(concat, Ws, Ws, Ws)(void* wr_, void* ws_, void* wt_,
     char local_buf[256];
     std::unique_ptr<char[]> heap_buf;
     size_t heap_buf_len = 0;
+    LastLaneMemo<ustring, ustring, ustring> memo;
+
+    auto concat_impl = [&](ustring s, ustring t) -> ustring {
+        size_t sl  = s.length();
+        size_t tl  = t.length();
+        size_t len = sl + tl;
+        char* buf  = local_buf;
+        if (len > sizeof(local_buf)) {
+            if (len > heap_buf_len) {
+                heap_buf.reset(new char[len]);
+                heap_buf_len = len;
+            }
+            buf = heap_buf.get();
+        }
+        memcpy(buf, s.c_str(), sl);
+        memcpy(buf + sl, t.c_str(), tl);
+        return ustring(buf, len);
+    };
 
     // Must check mask before dereferencing s or t
     // as they are undefined when masked off
-    wR.mask().foreach (
-        [=, &local_buf, &heap_buf, &heap_buf_len](ActiveLane lane) -> void {
-            ustring s  = wS[lane];
-            ustring t  = wT[lane];
-            size_t sl  = s.length();
-            size_t tl  = t.length();
-            size_t len = sl + tl;
-            char* buf  = local_buf;
-            if (len > sizeof(local_buf)) {
-                if (len > heap_buf_len) {
-                    heap_buf.reset(new char[len]);
-                    heap_buf_len = len;
-                }
-                buf = heap_buf.get();
-            }
-            memcpy(buf, s.c_str(), sl);
-            memcpy(buf + sl, t.c_str(), tl);
-            wR[lane] = ustring(buf, len);
-        });
+    wR.mask().foreach ([=, &memo, &concat_impl](ActiveLane lane) -> void {
+        wR[lane] = memo(concat_impl, ustring(wS[lane]), ustring(wT[lane]));
+    });
 }
 
 
@@ -178,10 +211,11 @@ __OSL_MASKED_OP3(startswith, Wi, Ws, Ws)(void* wr_, void* ws_, void* wsubs_,
     Wide<const ustring> wSubs(wsubs_);
     Masked<int> wR(wr_, Mask(mask_value));
 
-    wR.mask().foreach ([=](ActiveLane lane) -> void {
+    LastLaneMemo<int, ustring, ustring> memo;
+    wR.mask().foreach ([=, &memo](ActiveLane lane) -> void {
         ustring substr = wSubs[lane];
         ustring s      = wS[lane];
-        wR[lane]       = startswith_iss_impl(s, substr);
+        wR[lane]       = memo(startswith_iss_impl, s, substr);
     });
 }
 
@@ -210,10 +244,11 @@ __OSL_MASKED_OP3(endswith, Wi, Ws, Ws)(void* wr_, void* ws_, void* wsubs_,
     Wide<const ustring> wSubs(wsubs_);
     Masked<int> wR(wr_, Mask(mask_value));
 
-    wR.mask().foreach ([=](ActiveLane lane) -> void {
+    LastLaneMemo<int, ustring, ustring> memo;
+    wR.mask().foreach ([=, &memo](ActiveLane lane) -> void {
         ustring substr = wSubs[lane];
         ustring s      = wS[lane];
-        wR[lane]       = endswith_iss_impl(s, substr);
+        wR[lane]       = memo(endswith_iss_impl, s, substr);
     });
 }
 
@@ -229,11 +264,16 @@ __OSL_MASKED_OP2(stoi, Wi, Ws)(void* wint_ptr, void* wstr_ptr,
     // Avoid cost of strtol if lane is masked off
     // Also the value of str for a masked off lane could be
     // invalid/undefined and not safe to call strtol on.
-    wR.mask().foreach ([=](ActiveLane lane) -> void {
+    LastLaneMemo<int, const char*> memo;
+    wR.mask().foreach ([=, &memo](ActiveLane lane) -> void {
         const char* str = unproxy(wstr[lane]).c_str();
         // TODO: Suspect we could implement SIMD friendly version
         // that is more efficient than the library call
-        wR[lane] = str ? OIIO::Strutil::from_string<int>(str) : 0;
+        wR[lane] = memo(
+            [](const char* str) -> int {
+                return str ? OIIO::Strutil::from_string<int>(str) : 0;
+            },
+            str);
     });
 }
 
@@ -248,11 +288,16 @@ __OSL_MASKED_OP2(stof, Wf, Ws)(void* wr_, void* ws_, unsigned int mask_value)
     // Avoid cost of strtof if lane is masked off
     // Also the value of str for a masked off lane could be
     // invalid/undefined and not safe to call strtod on.
-    wR.mask().foreach ([=](ActiveLane lane) -> void {
+    LastLaneMemo<float, const char*> memo;
+    wR.mask().foreach ([=, &memo](ActiveLane lane) -> void {
         const char* str = unproxy(wS[lane]).c_str();
         // TODO: Suspect we could implement SIMD friendly version
         // that is more efficient than the library call
-        wR[lane] = str ? OIIO::Strutil::from_string<float>(str) : 0.0f;
+        wR[lane] = memo(
+            [](const char* str) -> float {
+                return str ? OIIO::Strutil::from_string<float>(str) : 0.0f;
+            },
+            str);
     });
 }
 
@@ -285,11 +330,12 @@ __OSL_MASKED_OP4(substr, Ws, Ws, Wi, Wi)(void* wr_, void* ws_, void* wstart_,
     Wide<const int> wSt(wstart_);
     Masked<ustring> wR(wr_, Mask(mask_value));
 
-    wR.mask().foreach ([=](ActiveLane lane) -> void {
+    LastLaneMemo<ustring, ustring, int, int> memo;
+    wR.mask().foreach ([=, &memo](ActiveLane lane) -> void {
         ustring s  = wS[lane];
         int start  = wSt[lane];
         int length = wL[lane];
-        wR[lane]   = substr_ssii_impl(s, start, length);
+        wR[lane]   = memo(substr_ssii_impl, s, start, length);
     });
 }
 
@@ -307,28 +353,8 @@ __OSL_OP(regex_impl)(void* bsg_, const char* subject_, void* results,
     OSL_ASSERT(ustring::is_unique(pattern));
 
     const std::string& subject(ustring::from_unique(subject_).string());
-    std::match_results<std::string::const_iterator> mresults;
-    const std::regex& regex(ctx->find_regex(USTR(pattern)));
-    if (nresults > 0) {
-        std::string::const_iterator start = subject.begin();
-        int res = fullmatch ? std::regex_match(subject, mresults, regex)
-                            : std::regex_search(subject, mresults, regex);
-        int* m  = (int*)results;
-        for (int r = 0; r < nresults; ++r) {
-            if (r / 2 < (int)mresults.size()) {
-                if ((r & 1) == 0)
-                    m[r] = mresults[r / 2].first - start;
-                else
-                    m[r] = mresults[r / 2].second - start;
-            } else {
-                m[r] = USTR(pattern).length();
-            }
-        }
-        return res;
-    } else {
-        return fullmatch ? regex_match(subject, regex)
-                         : regex_search(subject, regex);
-    }
+    return ctx->find_regex(USTR(pattern))
+        .match(subject, fullmatch, (int*)results, nresults);
 }
 
 
@@ -349,6 +375,8 @@ __OSL_MASKED_OP(regex_impl)(void* bsg_, void* wsuccess_ptr, void* wsubject_ptr,
     Masked<int[]> wresults(wresults_ptr, nresults, mask);
     Wide<const ustring> wsubject(wsubject_ptr);
     Wide<const ustring> wpattern(wpattern_ptr);
+    // Each lane's results are gathered here, then scattered to its lane
+    int* m = OSL_ALLOCA(int, nresults);
 
     mask.foreach ([=](ActiveLane lane) -> void {
         ustring usubject = wsubject[lane];
@@ -359,27 +387,10 @@ __OSL_MASKED_OP(regex_impl)(void* bsg_, void* wsuccess_ptr, void* wsubject_ptr,
         auto results = wresults[lane];
 
         const std::string& subject = usubject.string();
-        std::match_results<std::string::const_iterator> mresults;
-        const std::regex& regex(ctx->find_regex(pattern));
-        if (nresults > 0) {
-            std::string::const_iterator start = subject.begin();
-            int res = fullmatch ? std::regex_match(subject, mresults, regex)
-                                : std::regex_search(subject, mresults, regex);
-            for (int r = 0; r < nresults; ++r) {
-                if (r / 2 < (int)mresults.size()) {
-                    if ((r & 1) == 0)
-                        results[r] = mresults[r / 2].first - start;
-                    else
-                        results[r] = mresults[r / 2].second - start;
-                } else {
-                    results[r] = pattern.length();
-                }
-            }
-            wsuccess[lane] = res;
-        } else {
-            wsuccess[lane] = fullmatch ? regex_match(subject, regex)
-                                       : regex_search(subject, regex);
-        }
+        wsuccess[lane] = ctx->find_regex(pattern).match(subject, fullmatch, m,
+                                                        nresults);
+        for (int r = 0; r < nresults; ++r)
+            results[r] = m[r];
     });
 }
 
@@ -394,7 +405,19 @@ __OSL_OP(format)(void* wide_output, unsigned int mask_value,
     std::string s = Strutil::vsprintf(format_str, args);
     va_end(args);
 
-    ustring result = ustring(s);
+    // Varying format() is called once per active lane, and lanes of a
+    // batch usually produce only a few distinct strings.  Remember the
+    // last (format, result) pair on this thread to skip re-interning
+    // the same string in the ustring table.
+    thread_local const char* last_format = nullptr;
+    thread_local std::string last_string;
+    thread_local ustring last_result;
+    if (format_str != last_format || s != last_string) {
+        last_format = format_str;
+        last_string = s;
+        last_result = ustring(s);
+    }
+    ustring result = last_result;
     Masked<ustring> wOut(wide_output, Mask(mask_value));
 
     OSL::assign_all(wOut, result);
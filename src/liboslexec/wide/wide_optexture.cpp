@@ -8,6 +8,9 @@
 /// Shader interpreter implementation of texture operations.
 ///
 /////////////////////////////////////////////////////////////////////////
+#include <algorithm>
+#include <cmath>
+
 #include <OSL/oslconfig.h>
 
 #include <OSL/batched_rendererservices.h>
@@ -32,6 +35,60 @@ using WidthTag                = OSL::WidthOf<__OSL_WIDTH>;
 namespace {
 
 
+// OIIO's per-thread microcache remembers the tiles it used last, so
+// consecutive lookups that land in the same tile skip the shared tile
+// cache and its locks.  Fill order with the active lanes sorted so that
+// lookups into the same mip level and tile are issued back to back.
+// Tiles are estimated from the base resolution and the filter footprint
+// assuming 64 texel tiles (the "autotile" size the default texture
+// system uses); a wrong guess only costs locality, never changes results.
+// Return the number of active lanes.
+int
+coherent_lane_order(BatchedRendererServices* bsr,
+                    TextureSystem::TextureHandle* texture_handle,
+                    TextureSystem::Perthread* texture_thread_info, Mask mask,
+                    Wide<const float> ws, Wide<const float> wt,
+                    Wide<const float> wdsdx, Wide<const float> wdtdx,
+                    Wide<const float> wdsdy, Wide<const float> wdtdy,
+                    int* order)
+{
+    int count = 0;
+    mask.foreach ([&](ActiveLane lane) { order[count++] = lane.value(); });
+
+    int res[2] = { 0, 0 };
+    if (count < 3
+        || !bsr->texturesys()->get_texture_info(texture_handle,
+                                                texture_thread_info, 0,
+                                                ustring("resolution"),
+                                                TypeDesc(TypeDesc::INT, 2),
+                                                res)
+        || res[0] <= 0 || res[1] <= 0)
+        return count;
+
+    uint64_t key[__OSL_WIDTH];
+    for (int i = 0; i < count; ++i) {
+        int lane  = order[i];
+        float fpx = std::max(std::fabs(wdsdx[lane]), std::fabs(wdsdy[lane]))
+                    * res[0];
+        float fpy = std::max(std::fabs(wdtdx[lane]), std::fabs(wdtdy[lane]))
+                    * res[1];
+        float footprint = std::max(1.0f, std::max(fpx, fpy));
+        int mip         = std::min(24, int(std::log2(footprint)));
+        float tile_size = float(64 << mip);
+        float tx        = std::floor(ws[lane] * res[0] / tile_size);
+        float ty        = std::floor(wt[lane] * res[1] / tile_size);
+        // Non-finite coordinates end up in an arbitrary (but legal) bucket
+        uint32_t ix = std::isfinite(tx) ? uint32_t(int(tx)) & 0xffff : 0;
+        uint32_t iy = std::isfinite(ty) ? uint32_t(int(ty)) & 0xffff : 0;
+        key[lane]   = (uint64_t(mip) << 32) | (iy << 16) | ix;
+    }
+    std::stable_sort(order, order + count,
+                     [&key](int a, int b) { return key[a] < key[b]; });
+    return count;
+}
+
+
+
 Mask
 default_texture(BatchedRendererServices* bsr, ustring filename,
                 TextureSystem::TextureHandle* texture_handle,
@@ -85,7 +142,13 @@ default_texture(BatchedRendererServices* bsr, ustring filename,
 
     const auto& vary_opt = options.varying;
 
-    mask.foreach ([=, &opt, &vary_opt, &outputs, &status](ActiveLane lane) {
+    // The handle and coordinates each lane looks up: those of its tile,
+    // for UDIM textures.
+    TextureSystem::TextureHandle* lane_handle[__OSL_WIDTH];
+    float lane_s[__OSL_WIDTH], lane_t[__OSL_WIDTH];
+
+    auto lookup = [=, &opt, &vary_opt, &outputs, &status, &lane_handle,
+                   &lane_s, &lane_t](ActiveLane lane) {
         opt.sblur  = vary_opt.sblur[lane];
         opt.tblur  = vary_opt.tblur[lane];
         opt.swidth = vary_opt.swidth[lane];
@@ -112,8 +175,8 @@ default_texture(BatchedRendererServices* bsr, ustring filename,
         float dsdy = wdsdy[lane];
         float dtdy = wdtdy[lane];
         retVal     = bsr->texturesys()->texture(
-            texture_handle, texture_thread_info, opt, ws[lane], wt[lane], dsdx,
-            dtdx, dsdy, dtdy, 4, (float*)&result_simd,
+            lane_handle[lane], texture_thread_info, opt, lane_s[lane],
+            lane_t[lane], dsdx, dtdx, dsdy, dtdy, 4, (float*)&result_simd,
             has_derivs ? (float*)&dresultds_simd : NULL,
             has_derivs ? (float*)&dresultdt_simd : NULL);
 
@@ -179,7 +242,35 @@ default_texture(BatchedRendererServices* bsr, ustring filename,
                     Mask(Lane(lane)), "[RendererServices::texture] {}", err);
             }
         }
-    });
+    };
+
+    int order[__OSL_WIDTH];
+    int count = 0;
+    if (const UdimTileTable* udim = context->udim_tile_table(texture_handle)) {
+        // Resolve each lane's tile, and look the lanes up tile by tile.
+        int tile[__OSL_WIDTH];
+        mask.foreach ([&](ActiveLane lane) {
+            order[count++] = lane.value();
+            lane_s[lane]   = ws[lane];
+            lane_t[lane]   = wt[lane];
+            tile[lane]     = udim->tile(lane_s[lane], lane_t[lane]);
+            lane_handle[lane] = tile[lane] >= 0 ? udim->tiles[tile[lane]]
+                                                : texture_handle;
+        });
+        std::stable_sort(order, order + count,
+                         [&tile](int a, int b) { return tile[a] < tile[b]; });
+    } else {
+        count = coherent_lane_order(bsr, texture_handle, texture_thread_info,
+                                    mask, ws, wt, wdsdx, wdtdx, wdsdy, wdtdy,
+                                    order);
+        for (int i = 0; i < count; ++i) {
+            lane_handle[order[i]] = texture_handle;
+            lane_s[order[i]]      = ws[order[i]];
+            lane_t[order[i]]      = wt[order[i]];
+        }
+    }
+    for (int i = 0; i < count; ++i)
+        lookup(ActiveLane(order[i]));
     return status;
 }
 
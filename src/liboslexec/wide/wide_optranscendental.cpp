@@ -16,6 +16,7 @@
 
 #include <OSL/oslconfig.h>
 
+#include <OSL/approxmath.h>
 #include <OSL/batched_shaderglobals.h>
 #include <OSL/dual.h>
 #include <OSL/dual_vec.h>
@@ -104,6 +105,49 @@ OSL_USING_DATA_WIDTH(__OSL_WIDTH)
 #define __OSL_XMACRO_ARGS (logb, OIIO::fast_logb)
 #include "wide_opunary_per_component_float_or_vector_xmacro.h"
 
+// The other "math_precision" tiers, named with the tier as a prefix. As
+// above, pow needs only the masked versions.
+#if OSL_FAST_MATH
+#    define __OSL_XMACRO_ARGS (precise_exp, expf, exp)
+#    include "wide_opunary_per_component_xmacro.h"
+
+#    define __OSL_XMACRO_ARGS (precise_log, OIIO::safe_log, safe_log)
+#    include "wide_opunary_per_component_xmacro.h"
+
+#    define __OSL_XMACRO_ARGS (precise_pow, OIIO::safe_pow, safe_pow)
+#    define __OSL_XMACRO_MASKED_ONLY
+#    include "wide_opbinary_per_component_xmacro.h"
+#    define __OSL_XMACRO_ARGS (precise_pow, OIIO::safe_pow, safe_pow)
+#    define __OSL_XMACRO_MASKED_ONLY
+#    include "wide_opbinary_per_component_mixed_vector_float_xmacro.h"
+#else
+#    define __OSL_XMACRO_ARGS (fast_exp, OIIO::fast_exp, fast_exp)
+#    include "wide_opunary_per_component_xmacro.h"
+
+#    define __OSL_XMACRO_ARGS (fast_log, OIIO::fast_log, fast_log)
+#    include "wide_opunary_per_component_xmacro.h"
+
+#    define __OSL_XMACRO_ARGS (fast_pow, OIIO::fast_safe_pow, fast_safe_pow)
+#    define __OSL_XMACRO_MASKED_ONLY
+#    include "wide_opbinary_per_component_xmacro.h"
+#    define __OSL_XMACRO_ARGS (fast_pow, OIIO::fast_safe_pow, fast_safe_pow)
+#    define __OSL_XMACRO_MASKED_ONLY
+#    include "wide_opbinary_per_component_mixed_vector_float_xmacro.h"
+#endif
+
+#define __OSL_XMACRO_ARGS (approx_exp, approx_exp, approx_exp)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (approx_log, approx_log, approx_log)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (approx_pow, approx_safe_pow, approx_safe_pow)
+#define __OSL_XMACRO_MASKED_ONLY
+#include "wide_opbinary_per_component_xmacro.h"
+#define __OSL_XMACRO_ARGS (approx_pow, approx_safe_pow, approx_safe_pow)
+#define __OSL_XMACRO_MASKED_ONLY
+#include "wide_opbinary_per_component_mixed_vector_float_xmacro.h"
+
 }  // namespace __OSL_WIDE_PVT
 OSL_NAMESPACE_END
 
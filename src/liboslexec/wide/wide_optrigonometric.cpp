@@ -17,6 +17,7 @@
 
 #include <OSL/oslconfig.h>
 
+#include <OSL/approxmath.h>
 #include <OSL/batched_shaderglobals.h>
 #include <OSL/dual.h>
 #include <OSL/dual_vec.h>
@@ -99,6 +100,36 @@ OSL_USING_DATA_WIDTH(__OSL_WIDTH)
 #    include "wide_opunary_per_component_xmacro.h"
 #endif
 
+// The other "math_precision" tiers, named with the tier as a prefix
+#if OSL_FAST_MATH
+#    define __OSL_XMACRO_ARGS (precise_sin, sinf, OSL::sin)
+#    include "wide_opunary_per_component_xmacro.h"
+
+#    define __OSL_XMACRO_ARGS (precise_cos, cosf, OSL::cos)
+#    include "wide_opunary_per_component_xmacro.h"
+
+#    define __OSL_XMACRO_ARGS (precise_atan2, atan2f, OSL::atan2)
+#    include "wide_opbinary_per_component_xmacro.h"
+#else
+#    define __OSL_XMACRO_ARGS (fast_sin, OIIO::fast_sin, OSL::fast_sin)
+#    include "wide_opunary_per_component_xmacro.h"
+
+#    define __OSL_XMACRO_ARGS (fast_cos, OIIO::fast_cos, OSL::fast_cos)
+#    include "wide_opunary_per_component_xmacro.h"
+
+#    define __OSL_XMACRO_ARGS (fast_atan2, OIIO::fast_atan2, OSL::fast_atan2)
+#    include "wide_opbinary_per_component_xmacro.h"
+#endif
+
+#define __OSL_XMACRO_ARGS (approx_sin, OSL::approx_sin, OSL::approx_sin)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (approx_cos, OSL::approx_cos, OSL::approx_cos)
+#include "wide_opunary_per_component_xmacro.h"
+
+#define __OSL_XMACRO_ARGS (approx_atan2, OSL::approx_atan2, OSL::approx_atan2)
+#include "wide_opbinary_per_component_xmacro.h"
+
 
 
 static OSL_FORCEINLINE void
@@ -537,6 +537,11 @@ __OSL_OP1(get_attribute, s)(void* bsg_, int dest_derivs, ustring_pod obj_name_,
     if (array_lookup) {
         success = renderer->get_array_attribute(bsg, obj_name, attr_name, index,
                                                 dest);
+    } else if (bsg->uniform.context->shadingsys().batched_attribute_cache()) {
+        success = bsg->uniform.context->batched<__OSL_WIDTH>()
+                      .get_attribute_cached(bsg, obj_name, attr_name,
+                                            dest.type(), dest_derivs,
+                                            wide_attr_dest, mask);
     } else {
         success = renderer->get_attribute(bsg, obj_name, attr_name, dest);
     }
@@ -560,6 +565,8 @@ __OSL_MASKED_OP1(get_attribute,
     auto* renderer = bsg->uniform.context->batched<__OSL_WIDTH>().renderer();
 
     Mask retVal(false);
+    bool use_cache
+        = bsg->uniform.context->shadingsys().batched_attribute_cache();
 
     // We have a varying attribute name.
     // Lets find all the lanes with the same values and
@@ -581,6 +588,12 @@ __OSL_MASKED_OP1(get_attribute,
                 lanesPopulated = renderer->get_array_attribute(bsg, obj_name,
                                                                attr_name, index,
                                                                dest);
+            } else if (use_cache) {
+                lanesPopulated
+                    = bsg->uniform.context->batched<__OSL_WIDTH>()
+                          .get_attribute_cached(bsg, obj_name, attr_name,
+                                                dest.type(), dest_derivs,
+                                                wide_attr_dest, matching_lanes);
             } else {
                 lanesPopulated = renderer->get_attribute(bsg, obj_name,
                                                          attr_name, dest);
@@ -113,6 +113,23 @@ gabor_sample(GaborParams& gp, const Vec3& /*x_c*/, fast_rng& rng, Vec3& omega,
 }
 
 
+
+// Advance rng exactly as gabor_sample would, without computing omega and
+// phi. Used for impulses that lie outside the kernel radius, so that the
+// random sequence of the remaining impulses in the cell is unchanged.
+static OSL_HOSTDEVICE void
+gabor_skip_sample(const GaborParams& gp, fast_rng& rng)
+{
+    if (gp.anisotropic == 0 /* isotropic */) {
+        rng();
+        rng();
+    } else if (gp.anisotropic != 1 /* hybrid */) {
+        rng();
+    }
+    rng();  // phi
+}
+
+
 // Evaluate the summed contribution of all gabor impulses within the
 // cell whose corner is c_i.  x_c_i is vector from x (the point
 // we are trying to evaluate noise at) and c_i.
@@ -134,55 +151,59 @@ gabor_cell(GaborParams& gp, const Vec3& c_i, const Dual2<Vec3>& x_c_i,
         float z_rng = rng(), y_rng = rng(), x_rng = rng();
         Vec3 x_i_c(x_rng, y_rng, z_rng);
         Dual2<Vec3> x_k_i = gp.radius * (x_c_i - x_i_c);
+        if (!(x_k_i.val().length2() < gp.radius2)) {
+            // Out of range impulses contribute nothing; skip the sincos
+            // in gabor_sample but keep the rng sequence in step.
+            gabor_skip_sample(gp, rng);
+            continue;
+        }
         float phi_i;
         Vec3 omega_i;
         gabor_sample(gp, c_i, rng, omega_i, phi_i);
-        if (x_k_i.val().length2() < gp.radius2) {
-            if (!gp.do_filter) {
-                // N.B. if determinant(gp.filter) is too small, we will
-                // run into numerical problems.  But the filtering isn't
-                // needed in that case anyway, so just don't filter.
-                // This seems to only come up when the filter region is
-                // tiny.
-                sum += gabor_kernel(gp.weight, omega_i, phi_i, gp.a,
-                                    x_k_i);  // 3D
-            } else {
-                // Transform the impulse's anisotropy into tangent space
-                Vec3 omega_i_t;
-                multMatrix(gp.local, omega_i, omega_i_t);
-
-                // Slice to get a 2D kernel
-                Dual2<float> d_i = -dot(gp.N, x_k_i);
-                Dual2<float> w_i_t_s;
-                Vec2 omega_i_t_s;
-                Dual2<float> phi_i_t_s;
-                slice_gabor_kernel_3d(d_i, gp.weight, gp.a, omega_i_t, phi_i,
-                                      w_i_t_s, omega_i_t_s, phi_i_t_s);
-
-                // Filter the 2D kernel
-                Dual2<float> w_i_t_s_f;
-                float a_i_t_s_f;
-                Vec2 omega_i_t_s_f;
-                Dual2<float> phi_i_t_s_f;
-                filter_gabor_kernel_2d(gp.filter, w_i_t_s, gp.a, omega_i_t_s,
-                                       phi_i_t_s, w_i_t_s_f, a_i_t_s_f,
-                                       omega_i_t_s_f, phi_i_t_s_f);
-
-                // Now evaluate the 2D filtered kernel
-                Dual2<Vec3> xkit;
-                multMatrix(gp.local, x_k_i, xkit);
-                Dual2<Vec2> x_k_i_t = make_Vec2(comp_x(xkit), comp_y(xkit));
-                Dual2<float> gk     = gabor_kernel(w_i_t_s_f, omega_i_t_s_f,
-                                                   phi_i_t_s_f, a_i_t_s_f,
-                                                   x_k_i_t);  // 2D
-                if (!std::isfinite(gk.val())) {
-                    // Numeric failure of the filtered version.  Fall
-                    // back on the unfiltered.
-                    gk = gabor_kernel(gp.weight, omega_i, phi_i, gp.a,
-                                      x_k_i);  // 3D
-                }
-                sum += gk;
+        if (!gp.do_filter) {
+            // N.B. if determinant(gp.filter) is too small, we will
+            // run into numerical problems.  But the filtering isn't
+            // needed in that case anyway, so just don't filter.
+            // This seems to only come up when the filter region is
+            // tiny.
+            sum += gabor_kernel(gp.weight, omega_i, phi_i, gp.a,
+                                x_k_i);  // 3D
+        } else {
+            // Transform the impulse's anisotropy into tangent space
+            Vec3 omega_i_t;
+            multMatrix(gp.local, omega_i, omega_i_t);
+
+            // Slice to get a 2D kernel
+            Dual2<float> d_i = -dot(gp.N, x_k_i);
+            Dual2<float> w_i_t_s;
+            Vec2 omega_i_t_s;
+            Dual2<float> phi_i_t_s;
+            slice_gabor_kernel_3d(d_i, gp.weight, gp.a, omega_i_t, phi_i,
+                                  w_i_t_s, omega_i_t_s, phi_i_t_s);
+
+            // Filter the 2D kernel
+            Dual2<float> w_i_t_s_f;
+            float a_i_t_s_f;
+            Vec2 omega_i_t_s_f;
+            Dual2<float> phi_i_t_s_f;
+            filter_gabor_kernel_2d(gp.filter, w_i_t_s, gp.a, omega_i_t_s,
+                                   phi_i_t_s, w_i_t_s_f, a_i_t_s_f,
+                                   omega_i_t_s_f, phi_i_t_s_f);
+
+            // Now evaluate the 2D filtered kernel
+            Dual2<Vec3> xkit;
+            multMatrix(gp.local, x_k_i, xkit);
+            Dual2<Vec2> x_k_i_t = make_Vec2(comp_x(xkit), comp_y(xkit));
+            Dual2<float> gk     = gabor_kernel(w_i_t_s_f, omega_i_t_s_f,
+                                               phi_i_t_s_f, a_i_t_s_f,
+                                               x_k_i_t);  // 2D
+            if (!std::isfinite(gk.val())) {
+                // Numeric failure of the filtered version.  Fall
+                // back on the unfiltered.
+                gk = gabor_kernel(gp.weight, omega_i, phi_i, gp.a,
+                                  x_k_i);  // 3D
             }
+            sum += gk;
         }
     }
 
@@ -190,6 +211,17 @@ gabor_cell(GaborParams& gp, const Vec3& c_i, const Dual2<Vec3>& x_c_i,
 }
 
 
+// Squared distance along one axis from a point at fractional cell
+// coordinate f (in [0,1)) to the neighboring cell at offset o (-1, 0, 1).
+static OSL_HOSTDEVICE inline float
+cell_box_dist2(int o, float f)
+{
+    float d = o < 0 ? f : (o > 0 ? 1.0f - f : 0.0f);
+    return d * d;
+}
+
+
+
 // Sum the contributions of gabor impulses in all neighboring cells
 // surrounding position x_g.
 static OSL_HOSTDEVICE Dual2<float>
@@ -202,6 +234,15 @@ gabor_grid(GaborParams& gp, const Dual2<Vec3>& x_g, int seed = 0)
     for (int k = -1; k <= 1; k++) {
         for (int j = -1; j <= 1; j++) {
             for (int i = -1; i <= 1; i++) {
+                // Every impulse of a cell lies inside its unit box, so if
+                // the box is farther than one cell width from x_c no
+                // impulse can pass the radius test in gabor_cell. The
+                // small slack keeps the cull conservative under rounding.
+                float dist2 = cell_box_dist2(i, x_c.val().x)
+                              + cell_box_dist2(j, x_c.val().y)
+                              + cell_box_dist2(k, x_c.val().z);
+                if (dist2 > 1.0001f)
+                    continue;
                 Vec3 c(i, j, k);
                 Vec3 c_i          = floor_x_g + c;
                 Dual2<Vec3> x_c_i = x_c - c;
@@ -0,0 +1,373 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+// Timing of every noise type, dimension, result type, derivative and
+// periodic flavor, both as single scalar calls and as batches of lanes
+// evaluated the way the wide (batched) shadeops do it: the SIMD friendly
+// "Scalar" variants inside an omp simd loop of the batch width.  Use --csv
+// to get machine readable results for tracking regressions or comparing
+// builds for different ISAs.
+
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <OpenImageIO/argparse.h>
+#include <OpenImageIO/benchmark.h>
+#include <OpenImageIO/strutil.h>
+
+#include "null_noise.h"
+#include "oslexec_pvt.h"
+#include <OSL/dual_vec.h>
+#include <OSL/oslnoise.h>
+
+using namespace OSL;
+using namespace OSL::pvt;
+using namespace OIIO;
+
+
+static int iterations = 100000;
+static int ntrials    = 5;
+static bool csv       = false;
+static std::string filter;
+
+// Which flavors a noise type offers
+enum { Plain = 1, Derivs = 2, PlainAndDerivs = Plain | Derivs };
+
+static const int maxwidth = 16;
+
+
+
+struct BenchResult {
+    std::string noisename;
+    int dims;
+    const char* result;
+    bool derivs;
+    bool periodic;
+    int width;
+    double ns;         // per point
+    double stddev_ns;  // per point
+};
+
+static std::vector<BenchResult> results;
+
+
+
+inline float
+make_input(float s, float)
+{
+    return s;
+}
+
+inline Dual2<float>
+make_input(float s, Dual2<float>)
+{
+    return Dual2<float>(s, 0.01f, 0.02f);
+}
+
+inline Vec3
+make_input(const Vec3& p, Vec3)
+{
+    return p;
+}
+
+inline Dual2<Vec3>
+make_input(const Vec3& p, Dual2<Vec3>)
+{
+    return Dual2<Vec3>(p, Vec3(0.01f, 0.0f, 0.0f), Vec3(0.0f, 0.01f, 0.0f));
+}
+
+
+
+// Distinct, non-lattice inputs for each lane
+template<typename F, typename V> struct BenchInputs {
+    F x[maxwidth], y[maxwidth];
+    V p[maxwidth];
+
+    BenchInputs()
+    {
+        for (int i = 0; i < maxwidth; ++i) {
+            float s = 0.37f + 1.13f * i;
+            float t = 2.71f - 0.57f * i;
+            x[i]    = make_input(s, F());
+            y[i]    = make_input(t, F());
+            p[i]    = make_input(Vec3(s, t, 0.5f * s + 0.19f), V());
+        }
+    }
+};
+
+template<typename F, typename V>
+const BenchInputs<F, V>&
+bench_inputs()
+{
+    static BenchInputs<F, V> inputs;
+    return inputs;
+}
+
+
+
+template<int DimsT, int WidthT, bool PeriodicT, typename ImplT, typename R,
+         typename F, typename V>
+OSL_NOINLINE void
+noise_lanes(R* r, const F* x, const F* y, const V* p)
+{
+    ImplT impl;
+    const float fp = 4.0f;
+    const Vec3 vp(4.0f, 4.0f, 4.0f);
+    OSL_OMP_PRAGMA(omp simd simdlen(WidthT))
+    for (int i = 0; i < WidthT; ++i) {
+        if constexpr (PeriodicT) {
+            if constexpr (DimsT == 1)
+                impl(r[i], x[i], fp);
+            else if constexpr (DimsT == 2)
+                impl(r[i], x[i], y[i], fp, fp);
+            else if constexpr (DimsT == 3)
+                impl(r[i], p[i], vp);
+            else
+                impl(r[i], p[i], y[i], vp, fp);
+        } else {
+            if constexpr (DimsT == 1)
+                impl(r[i], x[i]);
+            else if constexpr (DimsT == 2)
+                impl(r[i], x[i], y[i]);
+            else if constexpr (DimsT == 3)
+                impl(r[i], p[i]);
+            else
+                impl(r[i], p[i], y[i]);
+        }
+    }
+}
+
+
+
+template<int DimsT, int WidthT, bool PeriodicT, typename ImplT, typename R,
+         typename F, typename V>
+void
+bench_one(Benchmarker& bench, string_view noisename, const char* rname)
+{
+    constexpr bool derivs = !std::is_same<F, float>::value;
+    std::string label = fmtformat("  {}({}D) {}{}{} x{}", noisename, DimsT,
+                                  rname, derivs ? " derivs" : "",
+                                  PeriodicT ? " periodic" : "", WidthT);
+    if (filter.size() && !Strutil::contains(label, filter))
+        return;
+    const BenchInputs<F, V>& in = bench_inputs<F, V>();
+    R r[WidthT];
+    bench.work(WidthT);
+    bench(label, [&]() {
+        noise_lanes<DimsT, WidthT, PeriodicT, ImplT>(r, in.x, in.y, in.p);
+        DoNotOptimize(r[0]);
+    });
+    results.push_back({ std::string(noisename), DimsT, rname, derivs,
+                        PeriodicT, WidthT, bench.avg() * 1.0e9 / WidthT,
+                        bench.stddev() * 1.0e9 / WidthT });
+}
+
+
+
+template<int WidthT, bool PeriodicT, typename ImplT, typename R, typename F,
+         typename V>
+void
+bench_dims(Benchmarker& bench, string_view noisename, const char* rname)
+{
+    bench_one<1, WidthT, PeriodicT, ImplT, R, F, V>(bench, noisename, rname);
+    bench_one<2, WidthT, PeriodicT, ImplT, R, F, V>(bench, noisename, rname);
+    bench_one<3, WidthT, PeriodicT, ImplT, R, F, V>(bench, noisename, rname);
+    bench_one<4, WidthT, PeriodicT, ImplT, R, F, V>(bench, noisename, rname);
+}
+
+
+
+template<int WidthT, bool PeriodicT, int FlavorsT, typename ImplT>
+void
+bench_width(Benchmarker& bench, string_view noisename)
+{
+    if constexpr ((FlavorsT & Plain) != 0) {
+        bench_dims<WidthT, PeriodicT, ImplT, float, float, Vec3>(bench,
+                                                                 noisename,
+                                                                 "float");
+        bench_dims<WidthT, PeriodicT, ImplT, Vec3, float, Vec3>(bench,
+                                                                noisename,
+                                                                "vector");
+    }
+    if constexpr ((FlavorsT & Derivs) != 0) {
+        bench_dims<WidthT, PeriodicT, ImplT, Dual2<float>, Dual2<float>,
+                   Dual2<Vec3>>(bench, noisename, "float");
+        bench_dims<WidthT, PeriodicT, ImplT, Dual2<Vec3>, Dual2<float>,
+                   Dual2<Vec3>>(bench, noisename, "vector");
+    }
+}
+
+
+
+// Time one noise type: ImplT one point at a time, then SimdImplT (if not
+// void) across each batch width.
+template<bool PeriodicT, int FlavorsT, typename ImplT, typename SimdImplT>
+void
+bench_noise(Benchmarker& bench, string_view noisename)
+{
+    bench_width<1, PeriodicT, FlavorsT, ImplT>(bench, noisename);
+    if constexpr (!std::is_void<SimdImplT>::value) {
+        bench_width<8, PeriodicT, FlavorsT, SimdImplT>(bench, noisename);
+        bench_width<16, PeriodicT, FlavorsT, SimdImplT>(bench, noisename);
+    }
+}
+
+
+
+// Gabor noise is not a functor and always takes options and derivatives
+static NoiseParams gabor_params;
+
+struct GaborBench {
+    void operator()(Dual2<float>& r, const Dual2<float>& x) const
+    {
+        r = gabor(x, &gabor_params);
+    }
+    void operator()(Dual2<float>& r, const Dual2<float>& x,
+                    const Dual2<float>& y) const
+    {
+        r = gabor(x, y, &gabor_params);
+    }
+    void operator()(Dual2<float>& r, const Dual2<Vec3>& p) const
+    {
+        r = gabor(p, &gabor_params);
+    }
+    void operator()(Dual2<float>& r, const Dual2<Vec3>& p,
+                    const Dual2<float>& /*t*/) const
+    {
+        r = gabor(p, &gabor_params);  // 4D gabor slices 3D
+    }
+    void operator()(Dual2<Vec3>& r, const Dual2<float>& x) const
+    {
+        r = gabor3(x, &gabor_params);
+    }
+    void operator()(Dual2<Vec3>& r, const Dual2<float>& x,
+                    const Dual2<float>& y) const
+    {
+        r = gabor3(x, y, &gabor_params);
+    }
+    void operator()(Dual2<Vec3>& r, const Dual2<Vec3>& p) const
+    {
+        r = gabor3(p, &gabor_params);
+    }
+    void operator()(Dual2<Vec3>& r, const Dual2<Vec3>& p,
+                    const Dual2<float>& /*t*/) const
+    {
+        r = gabor3(p, &gabor_params);
+    }
+};
+
+struct PGaborBench {
+    void operator()(Dual2<float>& r, const Dual2<float>& x, float px) const
+    {
+        r = pgabor(x, px, &gabor_params);
+    }
+    void operator()(Dual2<float>& r, const Dual2<float>& x,
+                    const Dual2<float>& y, float px, float py) const
+    {
+        r = pgabor(x, y, px, py, &gabor_params);
+    }
+    void operator()(Dual2<float>& r, const Dual2<Vec3>& p,
+                    const Vec3& pp) const
+    {
+        r = pgabor(p, pp, &gabor_params);
+    }
+    void operator()(Dual2<float>& r, const Dual2<Vec3>& p,
+                    const Dual2<float>& /*t*/, const Vec3& pp,
+                    float /*pt*/) const
+    {
+        r = pgabor(p, pp, &gabor_params);
+    }
+    void operator()(Dual2<Vec3>& r, const Dual2<float>& x, float px) const
+    {
+        r = pgabor3(x, px, &gabor_params);
+    }
+    void operator()(Dual2<Vec3>& r, const Dual2<float>& x,
+                    const Dual2<float>& y, float px, float py) const
+    {
+        r = pgabor3(x, y, px, py, &gabor_params);
+    }
+    void operator()(Dual2<Vec3>& r, const Dual2<Vec3>& p,
+                    const Vec3& pp) const
+    {
+        r = pgabor3(p, pp, &gabor_params);
+    }
+    void operator()(Dual2<Vec3>& r, const Dual2<Vec3>& p,
+                    const Dual2<float>& /*t*/, const Vec3& pp,
+                    float /*pt*/) const
+    {
+        r = pgabor3(p, pp, &gabor_params);
+    }
+};
+
+
+
+static void
+getargs(int argc, const char* argv[])
+{
+    OIIO::ArgParse ap;
+    // clang-format off
+    ap.intro("oslnoise_bench  (" OSL_INTRO_STRING ")");
+    ap.usage("oslnoise_bench [options]");
+    ap.arg("--iterations %d:N", &iterations)
+      .help(ustring::fmtformat("Number of iterations (default: {})", iterations).c_str());
+    ap.arg("--trials %d:N", &ntrials)
+      .help("Number of trials");
+    ap.arg("--filter %s:SUBSTRING", &filter)
+      .help("Only run benchmarks whose label contains SUBSTRING");
+    ap.arg("--csv", &csv)
+      .help("Print results as CSV (ns per point) instead of a report");
+    // clang-format on
+
+    ap.parse_args(argc, (const char**)argv);
+}
+
+
+
+int
+main(int argc, char const* argv[])
+{
+    getargs(argc, argv);
+
+    Benchmarker bench;
+    bench.iterations(iterations);
+    bench.trials(ntrials);
+    bench.verbose(csv ? 0 : 1);
+
+    bench_noise<false, PlainAndDerivs, Noise, NoiseScalar>(bench, "uperlin");
+    bench_noise<false, PlainAndDerivs, SNoise, SNoiseScalar>(bench, "perlin");
+    bench_noise<false, PlainAndDerivs, USimplexNoise, USimplexNoiseScalar>(
+        bench, "usimplex");
+    bench_noise<false, PlainAndDerivs, SimplexNoise, SimplexNoiseScalar>(
+        bench, "simplex");
+    bench_noise<false, Plain, CellNoise, CellNoise>(bench, "cell");
+    bench_noise<false, Plain, HashNoise, HashNoise>(bench, "hash");
+    bench_noise<false, PlainAndDerivs, VoronoiNoise, VoronoiNoise>(bench,
+                                                                   "voronoi");
+    bench_noise<false, Derivs, GaborBench, void>(bench, "gabor");
+    bench_noise<false, PlainAndDerivs, UNullNoise, UNullNoise>(bench,
+                                                               "unull");
+    bench_noise<false, PlainAndDerivs, NullNoise, NullNoise>(bench, "null");
+
+    bench_noise<true, PlainAndDerivs, PeriodicNoise, PeriodicNoiseScalar>(
+        bench, "uperlin");
+    bench_noise<true, PlainAndDerivs, PeriodicSNoise, PeriodicSNoiseScalar>(
+        bench, "perlin");
+    bench_noise<true, Plain, PeriodicCellNoise, PeriodicCellNoise>(bench,
+                                                                   "cell");
+    bench_noise<true, Plain, PeriodicHashNoise, PeriodicHashNoise>(bench,
+                                                                   "hash");
+    bench_noise<true, Derivs, PGaborBench, void>(bench, "gabor");
+
+    if (csv) {
+        print("noise,dims,result,derivs,periodic,width,ns_per_point,"
+              "stddev_ns\n");
+        for (const BenchResult& r : results)
+            print("{},{},{},{},{},{},{:.4f},{:.4f}\n", r.noisename, r.dims,
+                  r.result, int(r.derivs), int(r.periodic), r.width, r.ns,
+                  r.stddev_ns);
+    }
+    return 0;
+}
@@ -3,16 +3,23 @@
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
 
+#include <algorithm>
 #include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <functional>
+#include <map>
 #include <string>
 #include <vector>
 
 #include "../liboslexec/osoreader.h"
+#include "../liboslexec/shaderbundle.h"
 #include <OSL/oslquery.h>
 using namespace OSL;
 using namespace OSL::pvt;
 
 #include <OpenImageIO/filesystem.h>
+#include <OpenImageIO/parallel.h>
 #include <OpenImageIO/strutil.h>
 namespace Filesystem = OIIO::Filesystem;
 namespace Strutil    = OIIO::Strutil;
@@ -160,6 +167,7 @@ OSOReaderQuery::parameter_done()
 void
 OSOReaderQuery::hint(string_view hintstring)
 {
+    string_view h(hintstring);
     if (!Strutil::parse_char(hintstring, '%'))
         return;
     if (Strutil::parse_prefix(hintstring, "meta{")) {
@@ -201,6 +209,8 @@ OSOReaderQuery::hint(string_view hintstring)
             m_query.m_meta.push_back(p);
         return;
     }
+    if (!m_reading_param && OSOReader::parse_cost_hint(h, m_query.m_cost))
+        return;
     if (m_reading_param && Strutil::parse_prefix(hintstring, "structfields{")) {
         OSLQuery::Parameter& param(m_query.m_params[m_query.nparams() - 1]);
         while (1) {
@@ -239,6 +249,146 @@ OSOReaderQuery::codemarker(const char* /*name*/)
 }
 
 
+
+// A query needs only the start of a text .oso, up to its first temp
+// symbol or its code. Is this the line where that part ends?
+static bool
+ends_query_header(string_view line)
+{
+    for (string_view word : { "temp", "code" })
+        if (Strutil::starts_with(line, word) && line.size() > word.size()
+            && (line[word.size()] == '\t' || line[word.size()] == ' '))
+            return true;
+    return false;
+}
+
+// What ends the part that a query reads, so that it parses as a whole .oso.
+static const char query_header_end[] = "code ___main___\n";
+
+
+
+// The part of a text .oso file that a query needs. Return false if the
+// file can't be read, or (with header left empty) if it is binary.
+static bool
+read_query_header(const std::string& filename, std::string& header)
+{
+    header.clear();
+    OIIO::ifstream in;
+    Filesystem::open(in, filename, std::ios_base::in | std::ios_base::binary);
+    char magic[8];
+    if (!in.read(magic, sizeof(magic)))
+        return false;
+    if (OSOReader::is_binary(magic, sizeof(magic)))
+        return true;
+    in.seekg(0);
+    std::string line;
+    while (std::getline(in, line) && !ends_query_header(line)) {
+        header += line;
+        header += '\n';
+    }
+    header += query_header_end;
+    return true;
+}
+
+
+
+// The same, from the contents of a .oso, returning it whole if it's
+// binary.
+static std::string
+query_header(string_view oso)
+{
+    if (OSOReader::is_binary(oso.data(), oso.size()))
+        return std::string(oso);
+    std::string header;
+    while (oso.size()) {
+        size_t eol       = std::min(oso.find('\n'), oso.size() - 1);
+        string_view line = oso.substr(0, eol + 1);
+        if (ends_query_header(line))
+            break;
+        header += line;
+        oso.remove_prefix(line.size());
+    }
+    if (header.size() && header.back() != '\n')
+        header += '\n';
+    header += query_header_end;
+    return header;
+}
+
+
+
+// What query_all() keeps in its cache file about each text .oso: the
+// file's modification time and the part of it that a query needs. The
+// cache file is a line "oslquery cache 1", then for each .oso a line
+// "<mtime> <header length> <filename>" followed by the header itself.
+class QueryCache {
+public:
+    struct Entry {
+        std::time_t mtime = 0;
+        std::string header;
+    };
+
+    void read(const std::string& cachefile)
+    {
+        std::string contents;
+        if (!Filesystem::read_text_file(cachefile, contents))
+            return;
+        string_view rest = contents;
+        if (!Strutil::parse_prefix(rest, "oslquery cache 1\n"))
+            return;
+        while (rest.size()) {
+            size_t eol = rest.find('\n');
+            if (eol == string_view::npos)
+                return;
+            std::string line(rest.substr(0, eol));
+            rest.remove_prefix(eol + 1);
+            char* end     = nullptr;
+            Entry e;
+            e.mtime       = std::time_t(strtoll(line.c_str(), &end, 10));
+            size_t length = size_t(strtoull(end, &end, 10));
+            if (!end || *end != ' ' || length > rest.size())
+                return;
+            e.header = rest.substr(0, length);
+            rest.remove_prefix(length);
+            m_entries[std::string(end + 1)] = std::move(e);
+        }
+    }
+
+    bool write(const std::string& cachefile) const
+    {
+        std::string contents = "oslquery cache 1\n";
+        for (auto& e : m_entries)
+            contents += Strutil::fmt::format("{} {} {}\n{}",
+                                             int64_t(e.second.mtime),
+                                             e.second.header.size(), e.first,
+                                             e.second.header);
+        // Write then rename, so that concurrent queries never read half
+        // of it.
+        std::string tmp = Filesystem::unique_path(cachefile + ".%%%%%%%%");
+        OIIO::ofstream out;
+        Filesystem::open(out, tmp, std::ios_base::out | std::ios_base::binary);
+        out << contents;
+        out.close();
+        std::string err;
+        return out.good() && Filesystem::rename(tmp, cachefile, err);
+    }
+
+    // The cached header for the file, if it's unchanged since.
+    const std::string* find(const std::string& filename,
+                            std::time_t mtime) const
+    {
+        auto found = m_entries.find(filename);
+        return found != m_entries.end() && found->second.mtime == mtime
+                   ? &found->second.header
+                   : nullptr;
+    }
+
+    std::map<std::string, Entry>& entries() { return m_entries; }
+
+private:
+    std::map<std::string, Entry> m_entries;  // by .oso filename
+};
+
+
 };  // namespace pvt
 
 
@@ -380,6 +530,11 @@ OSLQuery::open(string_view shadername, string_view searchpath)
         return false;
     }
 
+    // Read only the part of a text .oso that holds the parameters and
+    // metadata, rather than parsing all its code.
+    std::string header;
+    if (read_query_header(filename, header) && header.size())
+        return oso.parse_memory(header);
     bool ok = oso.parse_file(filename);
     return ok;
 }
@@ -388,8 +543,95 @@ bool
 OSLQuery::open_bytecode(string_view buffer)
 {
     OSOReaderQuery oso(*this);
-    bool ok = oso.parse_memory(buffer);
+    bool ok = oso.parse_memory(query_header(buffer));
     return ok;
 }
 
+
+
+std::vector<OSLQuery>
+OSLQuery::query_all(string_view path, string_view cachefile, int nthreads,
+                    std::string* err)
+{
+    std::vector<OSLQuery> queries;
+    auto parallel = [&](size_t n, const std::function<void(size_t)>& f) {
+        queries.resize(n);
+        OIIO::parallel_for(int64_t(0), int64_t(n),
+                           [&](int64_t i) { f(size_t(i)); },
+                           OIIO::paropt(nthreads));
+    };
+
+    if (!Filesystem::is_directory(path)) {
+        ShaderBundle bundle;
+        std::string bundle_err;
+        if (!bundle.open(path, bundle_err)) {
+            if (err)
+                *err = bundle_err;
+            return queries;
+        }
+        std::vector<string_view> names = bundle.names();
+        parallel(names.size(), [&](size_t i) {
+            queries[i].open_bytecode(bundle.find(names[i]));
+        });
+        return queries;
+    }
+
+    std::vector<std::string> files;
+    if (!Filesystem::get_directory_entries(path, files)) {
+        if (err)
+            *err = Strutil::fmt::format("Could not read directory \"{}\"",
+                                        path);
+        return queries;
+    }
+    files.erase(std::remove_if(files.begin(), files.end(),
+                               [](const std::string& f) {
+                                   return Filesystem::extension(f) != ".oso";
+                               }),
+                files.end());
+    std::sort(files.begin(), files.end());
+
+    QueryCache cache;
+    if (cachefile.size())
+        cache.read(cachefile);
+    std::vector<std::time_t> mtimes(files.size());
+    std::vector<std::string> headers(files.size());
+    std::vector<char> reread(files.size(), 0);
+    parallel(files.size(), [&](size_t i) {
+        mtimes[i]                 = Filesystem::last_write_time(files[i]);
+        const std::string* cached = cachefile.size()
+                                        ? cache.find(files[i], mtimes[i])
+                                        : nullptr;
+        if (cached) {
+            queries[i].open_bytecode(*cached);
+            return;
+        }
+        if (read_query_header(files[i], headers[i]) && headers[i].size()) {
+            queries[i].open_bytecode(headers[i]);
+            reread[i] = 1;
+        } else {
+            queries[i].open(files[i]);  // Binary, or failing to read
+        }
+    });
+
+    if (cachefile.size()
+        && std::find(reread.begin(), reread.end(), 1) != reread.end()) {
+        // Keep entries only for the files that are still there.
+        QueryCache updated;
+        for (size_t i = 0; i < files.size(); ++i) {
+            auto& entry = updated.entries()[files[i]];
+            if (reread[i]) {
+                entry.mtime  = mtimes[i];
+                entry.header = std::move(headers[i]);
+            } else if (auto cached = cache.find(files[i], mtimes[i])) {
+                entry.mtime  = mtimes[i];
+                entry.header = *cached;
+            } else {
+                updated.entries().erase(files[i]);
+            }
+        }
+        updated.write(cachefile);
+    }
+    return queries;
+}
+
 OSL_NAMESPACE_END
@@ -113,6 +113,19 @@ declare_oslquery(py::module& m)
             },
             "buffer"_a)
 
+        .def_static(
+            "query_all",
+            [](const std::string& path, const std::string& cachefile,
+               int nthreads) {
+                std::string err;
+                std::vector<OSLQuery> queries
+                    = OSLQuery::query_all(path, cachefile, nthreads, &err);
+                if (err.size())
+                    throw std::runtime_error(err);
+                return queries;
+            },
+            "path"_a, "cachefile"_a = "", "nthreads"_a = 0)
+
         //    bool init (const ShaderGroup *group, int layernum);
 
         .def("shadertype",
@@ -130,6 +143,19 @@ declare_oslquery(py::module& m)
         .def_property_readonly(
             "metadata", [](const OSLQuery& self) { return self.metadata(); },
             py::return_value_policy::reference_internal)
+        .def_property_readonly("cost",
+                               [](const OSLQuery& self) -> py::object {
+                                   const OSLQuery::CostEstimate& c(self.cost());
+                                   if (!c.known)
+                                       return py::none();
+                                   return py::dict("ops"_a     = c.ops,
+                                                   "arith"_a   = c.arith,
+                                                   "texture"_a = c.texture,
+                                                   "noise"_a   = c.noise,
+                                                   "trace"_a   = c.trace,
+                                                   "loops"_a   = c.loops,
+                                                   "derivs"_a  = c.derivs);
+                               })
 
         .def("__len__", [](const OSLQuery& p) { return p.nparams(); })
         .def(
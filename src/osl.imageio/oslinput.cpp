@@ -6,6 +6,7 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <unordered_map>
 
 #include <OpenImageIO/filesystem.h>
 #include <OpenImageIO/imagebufalgo.h>
@@ -17,6 +18,9 @@
 #include <OSL/oslcomp.h>
 #include <OSL/oslexec.h>
 #include <OSL/rendererservices.h>
+#if OSL_USE_BATCHED
+#    include <OSL/batched_rendererservices.h>
+#endif
 
 using namespace OIIO;
 
@@ -95,6 +99,7 @@ private:
     void init()
     {
         m_group.reset();
+        m_outputs.clear();
         m_mip      = false;
         m_subimage = -1;
         m_miplevel = -1;
@@ -130,14 +135,70 @@ OIIO_PLUGIN_EXPORTS_END
 namespace pvt {
 
 
+#if OSL_USE_BATCHED
+// None of the batched callbacks are overridden, so batched shading uses
+// OSL's own defaults, which go straight to the TextureSystem.
+template<int WidthT>
+class OIIO_BatchedRendererServices final
+    : public BatchedRendererServices<WidthT> {
+public:
+    explicit OIIO_BatchedRendererServices(TextureSystem* texsys)
+        : BatchedRendererServices<WidthT>(texsys)
+    {
+    }
+
+    bool is_overridden_get_inverse_matrix_WmWxWf() const override
+    {
+        return false;
+    }
+    bool is_overridden_get_matrix_WmWsWf() const override { return false; }
+    bool is_overridden_get_inverse_matrix_WmsWf() const override
+    {
+        return false;
+    }
+    bool is_overridden_get_inverse_matrix_WmWsWf() const override
+    {
+        return false;
+    }
+    bool is_overridden_texture() const override { return false; }
+    bool is_overridden_texture3d() const override { return false; }
+    bool is_overridden_environment() const override { return false; }
+    bool is_overridden_pointcloud_search() const override { return false; }
+    bool is_overridden_pointcloud_get() const override { return false; }
+    bool is_overridden_pointcloud_write() const override { return false; }
+};
+#endif
+
+
+
 class OIIO_RendererServices final : public RendererServices {
 public:
     OIIO_RendererServices(TextureSystem* texsys = NULL)
         : RendererServices(texsys)
+#if OSL_USE_BATCHED
+        , m_batch_16(texsys)
+        , m_batch_8(texsys)
+        , m_batch_4(texsys)
+#endif
     {
     }
     ~OIIO_RendererServices() {}
 
+#if OSL_USE_BATCHED
+    BatchedRendererServices<16>* batched(WidthOf<16>) override
+    {
+        return &m_batch_16;
+    }
+    BatchedRendererServices<8>* batched(WidthOf<8>) override
+    {
+        return &m_batch_8;
+    }
+    BatchedRendererServices<4>* batched(WidthOf<4>) override
+    {
+        return &m_batch_4;
+    }
+#endif
+
     int supports(string_view /*feature*/) const override { return false; }
 
     bool get_matrix(ShaderGlobals* /*sg*/, Matrix44& /*result*/,
@@ -181,6 +242,13 @@ public:
     {
         return false;  // FIXME?
     }
+
+#if OSL_USE_BATCHED
+private:
+    OIIO_BatchedRendererServices<16> m_batch_16;
+    OIIO_BatchedRendererServices<8> m_batch_8;
+    OIIO_BatchedRendererServices<4> m_batch_4;
+#endif
 };
 
 
@@ -219,6 +287,16 @@ static ShadingSystem* shadingsys       = NULL;
 static OIIO_RendererServices* renderer = NULL;
 static ErrorRecorder errhandler;
 static std::shared_ptr<TextureSystem> shared_texsys;
+static int batch_width = 0;  // Width for batched shading, or 0 for scalar
+
+// Shader groups already built, by the URI that asked for them, so that
+// opening a URI again (as an ImageCache does after closing files to stay
+// under its open file limit) reuses the group and its JIT instead of
+// rebuilding it. And the shaders already compiled from .oslbody
+// expressions, by expression, so that URIs that differ only in their
+// parameters compile the expression once.
+static std::unordered_map<std::string, ShaderGroupRef> group_cache;
+static std::unordered_map<std::string, std::string> body_shaders;
 
 
 static void
@@ -235,6 +313,15 @@ setup_shadingsys()
 #endif
         renderer   = new OIIO_RendererServices(ts);
         shadingsys = new ShadingSystem(renderer, NULL, &errhandler);
+#if OSL_USE_BATCHED
+        // Shade batches of pixels at the widest width this machine runs
+        for (int width : { 16, 8, 4 }) {
+            if (shadingsys->configure_batch_execution_at(width)) {
+                batch_width = width;
+                break;
+            }
+        }
+#endif
     }
 }
 
@@ -484,8 +571,17 @@ OSLInput::open(const std::string& name, ImageSpec& newspec,
     m_topspec.full_height = m_topspec.height;
     m_topspec.full_depth  = m_topspec.depth;
 
+    {
+        OIIO::lock_guard lock(shading_mutex);
+        auto found = group_cache.find(name);
+        if (found != group_cache.end())
+            m_group = found->second;
+    }
+    bool cached = m_group.get() != NULL;
+
     bool ok = true;
-    if (Strutil::ends_with(shadername, ".oslgroup")) {  // Serialized group
+    if (!cached && Strutil::ends_with(shadername, ".oslgroup")) {
+        // Serialized group
         // No further processing necessary
         std::string groupspec;
         if (!OIIO::Filesystem::read_text_file(shadername, groupspec)) {
@@ -501,7 +597,8 @@ OSLInput::open(const std::string& name, ImageSpec& newspec,
             return false;  // Failed
         shadingsys->ShaderGroupEnd();
     }
-    if (Strutil::ends_with(shadername, ".oso")) {  // Compiled shader
+    if (!cached && Strutil::ends_with(shadername, ".oso")) {
+        // Compiled shader
         OIIO::lock_guard lock(shading_mutex);
         shadername.remove_suffix(4);
         m_group = shadingsys->ShaderGroupBegin();
@@ -519,29 +616,35 @@ OSLInput::open(const std::string& name, ImageSpec& newspec,
 
     if (Strutil::ends_with(shadername, ".osl")) {  // shader source
     }
-    if (Strutil::ends_with(shadername, ".oslbody")) {  // shader source
+    if (!cached && Strutil::ends_with(shadername, ".oslbody")) {
+        // shader source
         OIIO::lock_guard lock(shading_mutex);
         shadername.remove_suffix(8);
-        static int exprcount   = 0;
-        std::string exprname   = OIIO::Strutil::fmt::format("expr_{}",
-                                                            exprcount++);
-        std::string sourcecode = OIIO::Strutil::fmt::format(
-            "shader {} (\n"
-            "    float s = u [[ int interpolated=1 ]],\n"
-            "    float t = v [[ int interpolated=1 ]],\n"
-            "    output color result = 0,\n"
-            "    output float alpha = 1,\n"
-            "  )\n"
-            "{{\n"
-            "    {}\n"
-            "    ;\n"
-            "}}\n",
-            exprname, shadername);
-        // print("Expression-based shader text is:\n---\n{}\n---\n", sourcecode);
-        std::string err;
-        if (!compile_buffer(sourcecode, exprname, err)) {
-            errorfmt("{}", err);
-            return false;
+        std::string& exprname = body_shaders[std::string(shadername)];
+        if (exprname.empty()) {
+            static int exprcount   = 0;
+            std::string newname    = OIIO::Strutil::fmt::format("expr_{}",
+                                                                exprcount++);
+            std::string sourcecode = OIIO::Strutil::fmt::format(
+                "shader {} (\n"
+                "    float s = u [[ int interpolated=1 ]],\n"
+                "    float t = v [[ int interpolated=1 ]],\n"
+                "    output color result = 0,\n"
+                "    output float alpha = 1,\n"
+                "  )\n"
+                "{{\n"
+                "    {}\n"
+                "    ;\n"
+                "}}\n",
+                newname, shadername);
+            // print("Expression-based shader text is:\n---\n{}\n---\n", sourcecode);
+            std::string err;
+            if (!compile_buffer(sourcecode, newname, err)) {
+                body_shaders.erase(std::string(shadername));
+                errorfmt("{}", err);
+                return false;
+            }
+            exprname = newname;
         }
         m_group = shadingsys->ShaderGroupBegin();
         for (const auto& pv : m_topspec.extra_attribs) {
@@ -555,9 +658,13 @@ OSLInput::open(const std::string& name, ImageSpec& newspec,
     if (!ok || m_group.get() == NULL)
         return false;
 
-    shadingsys->attribute(m_group.get(), "renderer_outputs",
-                          TypeDesc(TypeDesc::STRING, m_outputs.size()),
-                          &m_outputs[0]);
+    if (!cached) {
+        shadingsys->attribute(m_group.get(), "renderer_outputs",
+                              TypeDesc(TypeDesc::STRING, m_outputs.size()),
+                              &m_outputs[0]);
+        OIIO::lock_guard lock(shading_mutex);
+        group_cache.emplace(name, m_group);
+    }
 
     ok &= seek_subimage(0, 0);
     if (ok)
@@ -629,11 +736,13 @@ OSLInput::read_native_scanlines(int subimage, int miplevel, int ybegin,
     ImageBuf ibwrapper(spec, data);
 
     // Now run the shader on the ImageBuf pixels, which really point to
-    // the caller's data buffer.
+    // the caller's data buffer. Regions too small to be worth splitting
+    // up, like single tiles, are shaded on this thread, larger ones in
+    // parallel.
     ROI roi(spec.x, spec.x + spec.width, spec.y, spec.y + spec.height, spec.z,
             spec.z + spec.depth);
     return shade_image(*shadingsys, *m_group, NULL, ibwrapper, m_outputs,
-                       ShadePixelCenters, roi, 1);
+                       ShadePixelCenters, roi, paropt(0), batch_width);
 }
 
 
@@ -671,11 +780,13 @@ OSLInput::read_native_tiles(int subimage, int miplevel, int xbegin, int xend,
     ImageBuf ibwrapper(spec, data);
 
     // Now run the shader on the ImageBuf pixels, which really point to
-    // the caller's data buffer.
+    // the caller's data buffer. Regions too small to be worth splitting
+    // up, like single tiles, are shaded on this thread, larger ones in
+    // parallel.
     ROI roi(spec.x, spec.x + spec.width, spec.y, spec.y + spec.height, spec.z,
             spec.z + spec.depth);
     return shade_image(*shadingsys, *m_group, NULL, ibwrapper, m_outputs,
-                       ShadePixelCenters, roi, 1);
+                       ShadePixelCenters, roi, paropt(0), batch_width);
 }
 
 
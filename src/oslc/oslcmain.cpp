@@ -3,10 +3,14 @@
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
 
+#include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <OpenImageIO/filesystem.h>
@@ -15,6 +19,8 @@
 
 #include <OSL/oslcomp.h>
 #include <OSL/oslexec.h>
+
+#include "osoreader.h"
 using namespace OSL;
 
 
@@ -25,7 +31,7 @@ usage()
     std::cout
         << "oslc -- Open Shading Language compiler " OSL_LIBRARY_VERSION_STRING
            "\n" OSL_COPYRIGHT_STRING "\n"
-           "Usage:  oslc [options] file\n"
+           "Usage:  oslc [options] file [file ...]\n"
            "  Options:\n"
            "\t--help         Print this usage message\n"
            "\t-o filename    Specify output filename\n"
@@ -34,12 +40,20 @@ usage()
            "\t-Ipath         Add path to the #include search path\n"
            "\t-Dsym[=val]    Define preprocessor symbol\n"
            "\t-Usym          Undefine preprocessor symbol\n"
-           "\t-O0, -O1, -O2  Set optimization level (default=1)\n"
+           "\t-include file  Include the file before the shader source\n"
+           "\t-header-cache dir  Reuse preprocessed stdosl.h and -include files\n"
+           "\t                   across compiles, keeping them in dir\n"
+           "\t-O0, -O1, -O2  Set optimization level (default=1); -O2 also\n"
+           "\t               folds constants and removes dead code and\n"
+           "\t               needless copies from the .oso\n"
            "\t-d             Debug mode\n"
            "\t-E             Only preprocess the input and output to stdout\n"
            "\t-Werror        Treat all warnings as errors\n"
            "\t-embed-source  Embed preprocessed source in the oso file\n"
            "\t-buffer        (debugging) Force compile from buffer\n"
+           "\t-binary        Write binary OSO, which loads without parsing\n"
+           "\t-j n           Compile several files with n threads (default: all cores)\n"
+           "\t-serve         Compile each command line read from stdin, until EOF\n"
            "\t-MD, -MMD      Write a depfile containing headers used, to a file\n"
            "\t-M, -MM        Like -MD, but write depfile to stdout\n"
            "\t-MF filename   Specify the name of the depfile to output (for -MD, -MMD)\n"
@@ -83,101 +97,113 @@ public:
 };
 
 static OSLC_ErrorHandler default_oslc_error_handler;
-}  // anonymous namespace
 
 
 
-int
-main(int argc, const char* argv[])
+// Replace the text .oso just written with its binary OSO equivalent.
+bool
+write_binary_oso(const std::string& filename)
 {
-    // Globally force classic "C" locale, and turn off all formatting
-    // internationalization, for the entire oslc application.
-    std::locale::global(std::locale::classic());
-
-#ifdef OIIO_HAS_STACKTRACE
-    // Helpful for debugging to make sure that any crashes dump a stack
-    // trace.
-    OIIO::Sysutil::setup_crash_stacktrace("stdout");
-#endif
+    OSL::pvt::OSOBinaryWriter writer(&default_oslc_error_handler);
+    if (!writer.parse_file(filename))
+        return false;
+    std::string binary = writer.binary();
+    OIIO::ofstream file;
+    OIIO::Filesystem::open(file, filename,
+                           std::ios_base::out | std::ios_base::binary);
+    if (file)
+        file.write(binary.data(), binary.size());
+    return file.good();
+}
 
-    OIIO::Filesystem::convert_native_arguments(argc, (const char**)argv);
 
-    if (argc <= 1) {
-        usage();
-        return EXIT_SUCCESS;
-    }
 
-    std::vector<std::string> args;
+// Everything one oslc command line asks for.
+struct Invocation {
+    std::vector<std::string> args;          // Options for the compiler
+    std::vector<std::string> shader_paths;  // Shaders to compile
+    bool help                = false;
     bool quiet               = false;
     bool compile_from_buffer = false;
-    std::string shader_path;
+    bool binary_oso          = false;
+    bool preprocess_only     = false;
+    bool serve               = false;
+    int nthreads             = 0;
+};
 
-    // Parse arguments from command line
-    for (int a = 1; a < argc; ++a) {
-        if (!strcmp(argv[a], "--help") | !strcmp(argv[a], "-h")) {
-            usage();
-            return EXIT_SUCCESS;
-        } else if (!strcmp(argv[a], "-q") || !strcmp(argv[a], "-v")) {
-            args.emplace_back(argv[a]);
-            quiet = (strcmp(argv[a], "-q") == 0);
-        } else if (!strcmp(argv[a], "-E") || !strcmp(argv[a], "-M")
-                   || !strcmp(argv[a], "--dependencies")
-                   || !strcmp(argv[a], "-MM")
-                   || !strcmp(argv[a], "--user-dependencies")) {
-            args.emplace_back(argv[a]);
-            quiet = true;
-        } else if (!strcmp(argv[a], "-v") || !strcmp(argv[a], "-d")
-                   || !strcmp(argv[a], "-O") || !strcmp(argv[a], "-O0")
-                   || !strcmp(argv[a], "-O1") || !strcmp(argv[a], "-O2")
-                   || !strcmp(argv[a], "-Werror")
-                   || !strcmp(argv[a], "-embed-source")
-                   || !strcmp(argv[a], "--embed-source")
-                   || !strcmp(argv[a], "-MD")
-                   || !strcmp(argv[a], "--write-dependencies")
-                   || !strcmp(argv[a], "-MMD")
-                   || !strcmp(argv[a], "--write-user-dependencies")
+
+
+void
+parse_args(const std::vector<std::string>& argv, Invocation& inv)
+{
+    auto is = [&](size_t a, const char* opt) { return argv[a] == opt; };
+    for (size_t a = 0; a < argv.size(); ++a) {
+        if (is(a, "--help") || is(a, "-h")) {
+            inv.help = true;
+        } else if (is(a, "-q") || is(a, "-v")) {
+            inv.args.emplace_back(argv[a]);
+            inv.quiet = is(a, "-q");
+        } else if (is(a, "-E") || is(a, "-M") || is(a, "--dependencies")
+                   || is(a, "-MM") || is(a, "--user-dependencies")) {
+            inv.args.emplace_back(argv[a]);
+            inv.quiet           = true;
+            inv.preprocess_only = true;
+        } else if (is(a, "-v") || is(a, "-d") || is(a, "-O") || is(a, "-O0")
+                   || is(a, "-O1") || is(a, "-O2") || is(a, "-Werror")
+                   || is(a, "-embed-source") || is(a, "--embed-source")
+                   || is(a, "-MD") || is(a, "--write-dependencies")
+                   || is(a, "-MMD") || is(a, "--write-user-dependencies")
                    || OIIO::Strutil::starts_with(argv[a], "-MF")
                    || OIIO::Strutil::starts_with(argv[a], "-MT")) {
             // Valid command-line argument
-            args.emplace_back(argv[a]);
-            if (a < argc - 1
-                && (!strcmp(argv[a], "-MF") || !strcmp(argv[a], "-MT"))) {
+            inv.args.emplace_back(argv[a]);
+            if (a < argv.size() - 1 && (is(a, "-MF") || is(a, "-MT"))) {
                 ++a;
-                args.emplace_back(argv[a]);
+                inv.args.emplace_back(argv[a]);
             }
-        } else if (!strcmp(argv[a], "-o") && a < argc - 1) {
-            // Output filepath
-            args.emplace_back(argv[a]);
+        } else if ((is(a, "-o") || is(a, "-include") || is(a, "-header-cache"))
+                   && a < argv.size() - 1) {
+            // Option with a filepath argument
+            inv.args.emplace_back(argv[a]);
             ++a;
-            args.emplace_back(argv[a]);
+            inv.args.emplace_back(argv[a]);
         } else if (argv[a][0] == '-'
                    && (argv[a][1] == 'D' || argv[a][1] == 'U'
                        || argv[a][1] == 'I')) {
-            args.emplace_back(argv[a]);
-        } else if (!strcmp(argv[a], "-buffer")) {
-            compile_from_buffer = true;
+            inv.args.emplace_back(argv[a]);
+        } else if (is(a, "-buffer")) {
+            inv.compile_from_buffer = true;
+        } else if (is(a, "-binary") || is(a, "--binary")) {
+            inv.binary_oso = true;
+        } else if ((is(a, "-j") || is(a, "--threads")) && a < argv.size() - 1) {
+            ++a;
+            inv.nthreads = OIIO::Strutil::stoi(argv[a]);
+        } else if (is(a, "-serve") || is(a, "--serve")) {
+            inv.serve = true;
         } else {
             // Shader to compile
-            shader_path = argv[a];
+            inv.shader_paths.emplace_back(argv[a]);
         }
     }
+}
 
-    if (shader_path.empty()) {
-        std::cout << "ERROR: Missing shader path"
-                  << "\n\n";
-        usage();
-        return EXIT_FAILURE;
-    }
 
+
+// Compile one shader as asked. Each gets its own compiler, so that
+// several may be compiled at once.
+bool
+compile_shader(const Invocation& inv, const std::string& shader_path)
+{
+    static std::mutex output_mutex;
     OSLCompiler compiler(&default_oslc_error_handler);
     bool ok = true;
-    if (compile_from_buffer) {
+    if (inv.compile_from_buffer) {
         // Force a compile-from-buffer for debugging purposes
         std::string sourcecode;
         ok = OIIO::Filesystem::read_text_file(shader_path, sourcecode);
         std::string osobuffer;
         if (ok)
-            ok = compiler.compile_buffer(sourcecode, osobuffer, args, "",
+            ok = compiler.compile_buffer(sourcecode, osobuffer, inv.args, "",
                                          shader_path);
         if (ok) {
             OIIO::ofstream file;
@@ -188,17 +214,117 @@ main(int argc, const char* argv[])
         }
     } else {
         // Ordinary compile from file
-        ok = compiler.compile(shader_path, args);
+        ok = compiler.compile(shader_path, inv.args);
     }
+    if (ok && inv.binary_oso && !inv.preprocess_only)
+        ok = write_binary_oso(std::string(compiler.output_filename()));
 
+    std::lock_guard<std::mutex> lock(output_mutex);
     if (ok) {
-        if (!quiet)
+        if (!inv.quiet)
             std::cout << "Compiled " << shader_path << " -> "
                       << compiler.output_filename() << "\n";
     } else {
         std::cout << "FAILED " << shader_path << "\n";
+    }
+    return ok;
+}
+
+
+
+// Compile all the shaders of a command line, several at once if there are
+// many, returning the exit status.
+int
+run(const Invocation& inv)
+{
+    if (inv.help) {
+        usage();
+        return EXIT_SUCCESS;
+    }
+    if (inv.shader_paths.empty()) {
+        std::cout << "ERROR: Missing shader path"
+                  << "\n\n";
+        usage();
         return EXIT_FAILURE;
     }
+    if (inv.shader_paths.size() > 1
+        && std::find(inv.args.begin(), inv.args.end(), "-o")
+               != inv.args.end()) {
+        std::cout << "ERROR: -o may not be used with several shaders\n";
+        return EXIT_FAILURE;
+    }
+
+    size_t nshaders = inv.shader_paths.size();
+    size_t nthreads = inv.nthreads > 0 ? size_t(inv.nthreads)
+                                       : size_t(OIIO::Sysutil::hardware_concurrency());
+    nthreads = std::max(std::min(nthreads, nshaders), size_t(1));
+    std::atomic<size_t> next(0);
+    std::atomic<bool> ok(true);
+    auto worker = [&]() {
+        for (size_t i; (i = next++) < nshaders;)
+            if (!compile_shader(inv, inv.shader_paths[i]))
+                ok = false;
+    };
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < nthreads; ++t)
+        threads.emplace_back(worker);
+    worker();
+    for (auto& t : threads)
+        t.join();
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 
+
+// Persistent mode for build systems: read command lines (options and
+// shaders, separated by white space) from stdin, compile each, and answer
+// with a line "oslc: done <exit status>" after its output.
+int
+serve(const Invocation& defaults)
+{
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        std::vector<std::string> argv;
+        for (auto word : OIIO::Strutil::splitsv(line))
+            argv.emplace_back(word);
+        if (argv.empty())
+            continue;
+        Invocation inv = defaults;
+        inv.shader_paths.clear();
+        parse_args(argv, inv);
+        int status = run(inv);
+        std::cout << "oslc: done " << status << std::endl;
+    }
     return EXIT_SUCCESS;
 }
+}  // anonymous namespace
+
+
+
+int
+main(int argc, const char* argv[])
+{
+    // Globally force classic "C" locale, and turn off all formatting
+    // internationalization, for the entire oslc application.
+    std::locale::global(std::locale::classic());
+
+#ifdef OIIO_HAS_STACKTRACE
+    // Helpful for debugging to make sure that any crashes dump a stack
+    // trace.
+    OIIO::Sysutil::setup_crash_stacktrace("stdout");
+#endif
+
+    OIIO::Filesystem::convert_native_arguments(argc, (const char**)argv);
+
+    if (argc <= 1) {
+        usage();
+        return EXIT_SUCCESS;
+    }
+
+    // Parse arguments from command line
+    Invocation inv;
+    parse_args(std::vector<std::string>(argv + 1, argv + argc), inv);
+    if (inv.serve)
+        return serve(inv);
+    return run(inv);
+}
@@ -39,8 +39,10 @@ using namespace OSL;
 
 
 static std::string searchpath;
+static std::string cachefile;
 static bool verbose  = false;
 static bool runstats = false;
+static bool showcost = false;
 static std::string oneparam;
 static std::vector<std::string> filenames;
 
@@ -141,21 +143,13 @@ print_metadata(const OSLQuery::Parameter& m)
 
 
 static void
-oslinfo(const std::string& name)
+print_query(OSLQuery& g, const std::string& name)
 {
-    OIIO::Timer t(runstats ? OIIO::Timer::StartNow : OIIO::Timer::DontStartNow);
-    OSLQuery g;
-    g.open(name, searchpath);
     std::string e = g.geterror();
     if (!e.empty()) {
         std::cout << "ERROR opening shader \"" << name << "\" (" << e << ")\n";
         return;
     }
-    if (runstats) {
-        // display timings in an easy to sort form
-        std::cout << t.stop() << " sec for " << name << "\n";
-        return;  // don't show anything else, we are just benchmarking
-    }
 
     if (oneparam.empty()) {
         std::cout << g.shadertype() << " \"" << g.shadername() << "\"\n";
@@ -163,6 +157,16 @@ oslinfo(const std::string& name)
             for (unsigned int m = 0; m < g.metadata().size(); ++m)
                 print_metadata(g.metadata()[m]);
         }
+        if (showcost) {
+            const OSLQuery::CostEstimate& c(g.cost());
+            if (c.known)
+                std::cout << "\tcost: ops " << c.ops << ", arith " << c.arith
+                          << ", texture " << c.texture << ", noise "
+                          << c.noise << ", trace " << c.trace << ", loops "
+                          << c.loops << ", derivs " << c.derivs << "\n";
+            else
+                std::cout << "\tcost: unknown\n";
+        }
     }
 
     for (size_t i = 0; i < g.nparams(); ++i) {
@@ -219,6 +223,39 @@ oslinfo(const std::string& name)
 
 
 
+static void
+oslinfo(const std::string& name)
+{
+    OIIO::Timer t(runstats ? OIIO::Timer::StartNow : OIIO::Timer::DontStartNow);
+    // A directory or shader bundle is queried all at once, in parallel.
+    if (OIIO::Filesystem::is_directory(name)
+        || OIIO::Filesystem::extension(name) == ".oslbundle") {
+        std::string err;
+        std::vector<OSLQuery> queries = OSLQuery::query_all(name, cachefile,
+                                                            0, &err);
+        if (err.size())
+            std::cout << "ERROR querying \"" << name << "\" (" << err << ")\n";
+        else if (runstats)
+            std::cout << t.stop() << " sec for " << queries.size()
+                      << " shaders in " << name << "\n";
+        else
+            for (auto& g : queries)
+                print_query(g, g.shadername().string());
+        return;
+    }
+
+    OSLQuery g;
+    g.open(name, searchpath);
+    if (runstats && g.geterror(false).empty()) {
+        // display timings in an easy to sort form
+        std::cout << t.stop() << " sec for " << name << "\n";
+        return;  // don't show anything else, we are just benchmarking
+    }
+    print_query(g, name);
+}
+
+
+
 int
 main(int argc, char* argv[])
 {
@@ -247,8 +284,12 @@ main(int argc, char* argv[])
       .help("Benchmark shader loading time for queries");
     ap.arg("-p %s:SEARCHPATH", &searchpath)
       .help("Set searchpath for shaders");
+    ap.arg("--cost", &showcost)
+      .help("Show the static cost estimates oslc recorded for each shader");
     ap.arg("--param %s:NAME", &oneparam)
       .help("Output information about just this parameter");
+    ap.arg("--cache %s:FILE", &cachefile)
+      .help("Cache what is read of the shaders in a directory in FILE");
     // clang-format on
 
     ap.parse_args(argc, (const char**)argv);
@@ -41,6 +41,8 @@
 // It is recommended any uses of QT's foreach be migrated
 // to use C++11 range based loops.
 
+#include <mutex>
+
 #include <OpenImageIO/errorhandler.h>
 #include <OpenImageIO/filesystem.h>
 #include <OpenImageIO/imagebuf.h>
@@ -670,6 +672,12 @@ OSLToyMainWindow::OSLToyMainWindow(OSLToyRenderer* rend, int xr, int yr)
                                 0.0f /* black */);
     renderView->update(checks);
 
+    edittimer = new QTimer(this);
+    edittimer->setSingleShot(true);
+    edittimer->setInterval(500);
+    connect(edittimer, &QTimer::timeout, this,
+            &OSLToyMainWindow::recompile_shaders);
+
     textTabs = new QTabWidget;
     action_newfile();  // Start with one tab
 
@@ -876,6 +884,8 @@ OSLToyMainWindow::add_new_editor_window(const std::string& filename)
     // Make the code editor itself
     auto texteditor = new CodeEditor(nullptr, filename);
     editors.push_back(texteditor);
+    connect(texteditor, &QPlainTextEdit::textChanged, this,
+            &OSLToyMainWindow::source_edited);
 
     // Make an error display widget
     auto errdisplay = new QTextEdit;
@@ -1067,15 +1077,36 @@ void
 OSLToyMainWindow::osl_do_rerender(float /*frametime*/)
 {
     using namespace OIIO;
-    m_rerender_needed = 0;
+    bool changed    = m_rerender_needed.exchange(0);
+    m_cancel_render = 0;
 
     if (renderer()->shadergroup()) {
         float start = timer();
         renderer()->set_time(start);
-        renderer()->render_image();
-        OIIO_MAYBE_UNUSED float rendertime = timer() - start;
-
-        renderView->update(renderer()->framebuffer());
+        // When frames are slow, show them as they fill in, and after a
+        // change start with a coarse one, so edits get a quick look.
+        bool progressive = last_full_render_time > 0.1f;
+        bool finished    = true;
+        if (progressive) {
+            if (changed) {
+                renderer()->render_preview(8);
+                renderView->update(renderer()->framebuffer());
+            }
+            finished = renderer()->render_image(&m_cancel_render, [&]() {
+                renderView->update(renderer()->framebuffer());
+            });
+        } else {
+            renderer()->render_image();
+            renderView->update(renderer()->framebuffer());
+        }
+        float rendertime = timer() - start;
+        if (!finished) {
+            // Something changed underneath us; start again
+            m_rerender_needed = 1;
+            m_working         = 0;
+            return;
+        }
+        last_full_render_time = rendertime;
 
         float now = timer();
         // std::cout <<"render only " << (1.0f/rendertime) << "  with coco " << 1.0f/(now-start)
@@ -1131,74 +1162,126 @@ OSLToyMainWindow::regenerate_compile_options()
 }
 
 
+// What a background compile needs, and what it found.
+struct OSLToyCompileJob {
+    int generation;
+    int tab;
+    std::string briefname;
+    std::string shadername;
+    std::string source;
+    std::vector<std::string> options;
+    bool ok = false;
+    std::string error_message;
+};
+
+// Compiles run here, off the GUI thread, one at a time.
+static OIIO::thread_pool compile_pool;
+static std::mutex compile_mutex;
+
+
+
+void
+OSLToyMainWindow::source_edited()
+{
+    // Abandon any frame underway, and recompile once typing pauses.
+    m_cancel_render = 1;
+    edittimer->start();
+}
+
+
+
 void
 OSLToyMainWindow::recompile_shaders()
 {
-    m_groupspec.clear();
-    m_firstshadername.clear();
-    m_groupname.clear();
+    edittimer->stop();
+    if (m_should_regenerate_compile_options)
+        regenerate_compile_options();
 
-    QtUtils::clear_layout(paramLayout);
-    bool ok = true;
+    auto job        = std::make_shared<OSLToyCompileJob>();
+    job->generation = ++m_compile_generation;
+    job->tab        = -1;
     for (int tab = 0; tab < ntabs(); ++tab) {
-        auto editor            = editors[tab];
-        std::string briefname  = editor->brief_filename();
-        std::string shadername = OIIO::Filesystem::filename(briefname);
-        std::string source     = editor->text_string();
-        if (OIIO::Strutil::ends_with(briefname, ".oslgroup")) {
-            continue;
-            // FIXME!  No current support for shader group specs
+        auto editor           = editors[tab];
+        std::string briefname = editor->brief_filename();
+        // FIXME!  No current support for shader group specs
+        if (OIIO::Strutil::ends_with(briefname, ".osl")) {
+            // This is a shader. FIXME!  Only one shader currently!
+            job->tab        = tab;
+            job->briefname  = briefname;
+            job->shadername = OIIO::Filesystem::filename(briefname);
+            job->source     = editor->text_string();
+            job->options    = m_compile_options;
+            break;
+        }
+    }
+    if (job->tab < 0)
+        return;
 
-            m_groupname = shadername;
-            m_groupspec = source;
-            // This is the group!
-        } else if (OIIO::Strutil::ends_with(briefname, ".osl")) {
-            // This is a shader
-            MyOSLCErrorHandler errhandler(this);
-            OSLCompiler oslcomp(&errhandler);
-            std::string osooutput;
+    ++m_compiles_running;
+    compile_pool.push([this, job](int) { compile_in_background(job); });
+}
 
-            if (m_should_regenerate_compile_options)
-                regenerate_compile_options();
 
-            ok = oslcomp.compile_buffer(source, osooutput, m_compile_options,
-                                        "", briefname);
 
-            auto error_message = OIIO::Strutil::fmt::format(
+void
+OSLToyMainWindow::compile_in_background(std::shared_ptr<OSLToyCompileJob> job)
+{
+    {
+        std::lock_guard<std::mutex> lock(compile_mutex);
+        // Don't bother if more edits came along while this one waited.
+        // Unchanged source comes straight from the compiler's cache.
+        if (job->generation == m_compile_generation) {
+            MyOSLCErrorHandler errhandler(this);
+            OSLCompiler oslcomp(&errhandler);
+            std::string osooutput;
+            job->ok = oslcomp.compile_buffer(job->source, osooutput,
+                                             job->options, "", job->briefname);
+            job->error_message = OIIO::Strutil::fmt::format(
                 "{}\n\nCompiled {} with options: {}",
-                OIIO::Strutil::join(errhandler.errors, "\n"), briefname,
-                OIIO::Strutil::join(m_compile_options, " "));
-            set_error_message(tab, error_message);
-
-            if (ok) {
+                OIIO::Strutil::join(errhandler.errors, "\n"), job->briefname,
+                OIIO::Strutil::join(job->options, " "));
+            if (job->ok) {
                 // std::cout << osooutput << "\n";
-                ok = shadingsys()->LoadMemoryCompiledShader(briefname,
-                                                            osooutput);
-                if (!ok) {
+                job->ok = shadingsys()->LoadMemoryCompiledShader(
+                    job->briefname, osooutput);
+                if (!job->ok) {
                     // FIXME -- handle .oso error. What can happen?
                 }
-            } else {
-                // Force tab display to the error
-                textTabs->setCurrentIndex(tab);
-                break;
             }
-            if (m_firstshadername.empty())
-                m_firstshadername = shadername;
-
-            // FIXME!  Only one shader currently!
-            break;
         }
     }
+    // Qt drops the call if the window is gone by the time it's handled.
+    QMetaObject::invokeMethod(
+        this, [this, job]() { finish_recompile(*job); }, Qt::QueuedConnection);
+    --m_compiles_running;
+}
 
-    if (ok) {
-        // If everything went ok so far, make a shader group
-        build_shader_group();
-        inventory_params();
-        rebuild_param_area();
-        if (paused && fps == 0 /* never started */)
-            toggle_pause();
-        rerender_needed();
+
+
+void
+OSLToyMainWindow::finish_recompile(const OSLToyCompileJob& job)
+{
+    if (job.generation != m_compile_generation)
+        return;  // Superseded by a later edit
+
+    set_error_message(job.tab, job.error_message);
+    if (!job.ok) {
+        // Force tab display to the error
+        textTabs->setCurrentIndex(job.tab);
+        return;
     }
+
+    // If everything went ok so far, make a shader group
+    m_groupspec.clear();
+    m_groupname.clear();
+    m_firstshadername = job.shadername;
+    QtUtils::clear_layout(paramLayout);
+    build_shader_group();
+    inventory_params();
+    rebuild_param_area();
+    if (paused && fps == 0 /* never started */)
+        toggle_pause();
+    rerender_needed();
 }
 
 
@@ -1248,7 +1331,7 @@ OSLToyMainWindow::build_shader_group()
         group = ss->ShaderGroupBegin();
         for (auto&& instparam : m_shaderparam_instvalues) {
             ss->Parameter(instparam.name(), instparam.type(), instparam.data(),
-                          !m_diddlers[instparam.name().string()]);
+                          !is_interactive(instparam.name().string()));
         }
         ss->Shader("surface", m_firstshadername, "layer1");
         ss->ShaderGroupEnd();
@@ -1321,7 +1404,7 @@ OSLToyMainWindow::make_param_adjustment_row(ParamRec* param,
                                             QGridLayout* layout, int row)
 {
     auto diddleCheckbox = new QCheckBox("  ");
-    if (m_diddlers[param->name.string()])
+    if (is_interactive(param->name.string()))
         diddleCheckbox->setCheckState(Qt::Checked);
 #if QT_VERSION >= QT_VERSION_CHECK(6, 8, 0)
     connect(diddleCheckbox, &QCheckBox::checkStateChanged, this,
@@ -1523,12 +1606,15 @@ OSLToyMainWindow::set_param_instance_value(ParamRec* param)
             OIIO::ParamValue(param->name, param->type, 1, &v));
     }
 
-    if (m_diddlers[param->name.string()]) {
-        auto val = m_shaderparam_instvalues.find(param->name);
-        if (val != m_shaderparam_instvalues.end())
-            shadingsys()->ReParameter(*renderer()->shadergroup(),
-                                      param->layername, param->name,
-                                      param->type, val->data());
+    // An interactive parameter is changed in place, without building a
+    // new group -- unless the group was built before it had a value, so
+    // the shading system doesn't know it's interactive yet.
+    auto val = m_shaderparam_instvalues.find(param->name);
+    if (is_interactive(param->name.string())
+        && val != m_shaderparam_instvalues.end()
+        && shadingsys()->ReParameter(*renderer()->shadergroup(),
+                                     param->layername, param->name,
+                                     param->type, val->data())) {
         rerender_needed();
     } else {
         build_shader_group();
@@ -1590,9 +1676,9 @@ OSLToyMainWindow::finish_and_close()
     // wait for any shading jobs to finish
     for (; true; OIIO::Sysutil::usleep(10000)) {
         OIIO::spin_lock lock(m_job_mutex);
-        if (m_working) {
-            // If shading is still happening, release the lock and sleep
-            // for 1/100 s.
+        if (m_working || m_compiles_running) {
+            // If shading or compiling is still happening, release the
+            // lock and sleep for 1/100 s.
             continue;
         }
         close();  // wrap it up for real
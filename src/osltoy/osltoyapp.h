@@ -58,6 +58,7 @@ public:
 
 class OSLToyRenderView;
 class OSLToySearchPathEditor;
+struct OSLToyCompileJob;
 
 class OSLToyMainWindow final : public QMainWindow {
     Q_OBJECT
@@ -97,7 +98,12 @@ public:
     void set_include_search_paths(const std::vector<std::string>& paths);
     void update_include_search_paths(const std::vector<std::string>& paths);
 
-    void rerender_needed() { m_rerender_needed = 1; }
+    // Ask for a new frame, abandoning any one underway.
+    void rerender_needed()
+    {
+        m_rerender_needed = 1;
+        m_cancel_render   = 1;
+    }
 
 private slots:
 
@@ -120,6 +126,7 @@ private:
     std::vector<CodeEditor*> editors;
     std::vector<QTextEdit*> error_displays;
     QTimer* maintimer;
+    QTimer* edittimer;  // Recompiles once typing has paused
 
     // Add an action, with optional label (if different than the name),
     // hotkey shortcut and the method of lambda to call when the action is
@@ -181,6 +188,23 @@ private:
     void set_param_instance_value(ParamRec* param);
     void set_param_diddle(ParamRec* param, int state);
 
+    // Parameters are adjusted in place with ReParameter, without building
+    // a new group, unless the user unchecks their box.
+    bool is_interactive(const std::string& name) const
+    {
+        auto found = m_diddlers.find(name);
+        return found == m_diddlers.end() || found->second;
+    }
+
+    // Called when the text of any editor changes.
+    void source_edited();
+
+    // Compile and load the job's source; runs on a compile thread.
+    void compile_in_background(std::shared_ptr<OSLToyCompileJob> job);
+
+    // Take up the results of a background compile, on the GUI thread.
+    void finish_recompile(const OSLToyCompileJob& job);
+
     virtual void mousePressEvent(QMouseEvent* event);
 
     void timed_rerender_trigger();
@@ -226,6 +250,10 @@ private:
     std::atomic<int> m_working { 0 };
     std::atomic<int> m_shaders_recompiled { 0 };
     std::atomic<int> m_rerender_needed { 0 };
+    std::atomic<int> m_cancel_render { 0 };
+    // Only the latest recompile request's results are used
+    std::atomic<int> m_compile_generation { 0 };
+    std::atomic<int> m_compiles_running { 0 };
     //vvv--- access by the GUI thread only if m_working == 0, and by the
     //       shading thread only if m_working == 1.
     OIIO::Timer timer { false /*don't start*/ };
@@ -233,6 +261,7 @@ private:
     float last_frame_update_time  = -1;
     float last_fps_update_time    = -1;
     float last_finished_frametime = 0;
+    float last_full_render_time   = 0;
     bool paused                   = true;
 };
 
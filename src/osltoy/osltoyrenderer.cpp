@@ -129,13 +129,9 @@ OSLToyRenderer::set_output_getter(std::function<ustring()> getter)
 
 
 
-void
-OSLToyRenderer::render_image()
+ustring
+OSLToyRenderer::select_output()
 {
-    if (!m_framebuffer.initialized())
-        m_framebuffer.reset(
-            OIIO::ImageSpec(m_xres, m_yres, 3, TypeDesc::FLOAT));
-
     // Use the getter to get the selected output in the app
     ustring selected_output = ustring("Cout");  // Default to "Cout"
     if (m_get_selected_output) {
@@ -148,11 +144,57 @@ OSLToyRenderer::render_image()
     ustring outputs[] = { selected_output };
     m_shadingsys->attribute("renderer_outputs", TypeDesc(TypeDesc::STRING, 1),
                             &outputs);
+    return selected_output;
+}
+
+
+
+bool
+OSLToyRenderer::render_image(const std::atomic<int>* cancel,
+                             const std::function<void()>& progress)
+{
+    if (!m_framebuffer.initialized())
+        m_framebuffer.reset(
+            OIIO::ImageSpec(m_xres, m_yres, 3, TypeDesc::FLOAT));
 
+    ustring outputs[]    = { select_output() };
+    ShaderGroupRef group = shadergroup();
+
+    // Shade in bands only when someone is watching, since each band waits
+    // for its slowest tile.
+    const int nbands = progress ? 8 : 1;
     OIIO::paropt popt(0, OIIO::paropt::SplitDir::Tile, 4096);
+    OIIO::ROI roi = m_framebuffer.roi();
+    for (int b = 0; b < nbands; ++b) {
+        OIIO::ROI band = roi;
+        band.ybegin    = roi.ybegin + roi.height() * b / nbands;
+        band.yend      = roi.ybegin + roi.height() * (b + 1) / nbands;
+        shade_image(*shadingsys(), *group, &m_shaderglobals_template,
+                    m_framebuffer, outputs, ShadePixelCenters, band, popt);
+        if (progress)
+            progress();
+        if (cancel && *cancel)
+            return false;
+    }
+    return true;
+}
+
+
+
+void
+OSLToyRenderer::render_preview(int factor)
+{
+    if (!m_framebuffer.initialized())
+        m_framebuffer.reset(
+            OIIO::ImageSpec(m_xres, m_yres, 3, TypeDesc::FLOAT));
+
+    ustring outputs[] = { select_output() };
+    OIIO::ImageBuf small(OIIO::ImageSpec(std::max(1, m_xres / factor),
+                                         std::max(1, m_yres / factor), 3,
+                                         TypeDesc::FLOAT));
     shade_image(*shadingsys(), *shadergroup(), &m_shaderglobals_template,
-                m_framebuffer, outputs, ShadePixelCenters, OIIO::ROI(), popt);
-    //    std::cout << timer() << "\n";
+                small, outputs, ShadePixelCenters);
+    OIIO::ImageBufAlgo::resample(m_framebuffer, small, false /*interpolate*/);
 }
 
 
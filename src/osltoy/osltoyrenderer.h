@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <functional>
 #include <map>
 #include <memory>
@@ -65,7 +66,21 @@ public:
 
     void set_output_getter(std::function<ustring()> getter);
 
-    void render_image();
+    // Tell the shading system which output to shade, and return it.
+    ustring select_output();
+
+    // Shade the whole framebuffer. If progress is given, shade it a band
+    // of scanlines at a time and call progress after each, so the display
+    // can follow along; then if *cancel becomes nonzero, stop after the
+    // current band and return false, leaving the rest as it was.
+    bool render_image(const std::atomic<int>* cancel        = nullptr,
+                      const std::function<void()>& progress = nullptr);
+
+    // Shade an image 1/factor the resolution and fill the framebuffer
+    // with its pixels enlarged, as a quick first look before a slow
+    // render_image(). Shaders see the smaller image's P (and the same
+    // u,v range), so this is only a preview.
+    void render_preview(int factor);
 
     // vvv Methods necessary to be a RendererServices
     virtual int supports(string_view feature) const;
@@ -7,6 +7,11 @@
 #include <OSL/dual_vec.h>
 #include <OSL/oslconfig.h>
 #include <algorithm>  // upper_bound
+#ifndef __CUDACC__
+#    include <vector>
+
+#    include <OpenImageIO/parallel.h>
+#endif
 
 OSL_NAMESPACE_BEGIN
 
@@ -46,10 +51,18 @@ struct Background {
         delete[] values;
         delete[] rows;
         delete[] cols;
+        delete[] row_prob;
+        delete[] row_alias;
+        delete[] col_prob;
+        delete[] col_alias;
 #endif
     }
 
-    template<typename F, typename T> void prepare(int resolution, F cb, T* data)
+    // If use_alias, sample() picks the row, then the column, with alias
+    // tables rather than by searching the CDFs, in constant time (the
+    // pdfs are the same, but not which sample goes where).
+    template<typename F, typename T>
+    void prepare(int resolution, F cb, T* data, bool use_alias = false)
     {
         // These values are set via set_variables() in CUDA
         res = resolution;
@@ -96,6 +109,27 @@ struct Background {
             out->write_image(TypeFloat, &values[0]);
         delete out;
 #endif
+
+#ifndef __CUDACC__
+        if (use_alias) {
+            row_prob  = new float[res];
+            row_alias = new int[res];
+            col_prob  = new float[res * res];
+            col_alias = new int[res * res];
+            std::vector<float> weights(res);
+            for (int y = 0; y < res; y++)
+                weights[y] = rows[y] - (y > 0 ? rows[y - 1] : 0.0f);
+            build_alias(weights.data(), res, row_prob, row_alias);
+            OIIO::parallel_for(int64_t(0), int64_t(res), [&](int64_t y) {
+                const float* c = cols + y * res;
+                std::vector<float> weights(res);
+                for (int x = 0; x < res; x++)
+                    weights[x] = c[x] - (x > 0 ? c[x - 1] : 0.0f);
+                build_alias(weights.data(), res, col_prob + y * res,
+                            col_alias + y * res);
+            });
+        }
+#endif
     }
 
     OSL_HOSTDEVICE
@@ -130,8 +164,17 @@ struct Background {
     {
         float row_pdf, col_pdf;
         unsigned x, y;
-        ry  = sample_cdf(rows, res, ry, &y, &row_pdf);
-        rx  = sample_cdf(cols + y * res, res, rx, &x, &col_pdf);
+        if (row_prob) {
+            ry      = sample_alias(row_prob, row_alias, res, ry, &y);
+            rx      = sample_alias(col_prob + y * res, col_alias + y * res,
+                                   res, rx, &x);
+            row_pdf = rows[y] - (y > 0 ? rows[y - 1] : 0.0f);
+            const float* c = cols + y * res;
+            col_pdf        = c[x] - (x > 0 ? c[x - 1] : 0.0f);
+        } else {
+            ry = sample_cdf(rows, res, ry, &y, &row_pdf);
+            rx = sample_cdf(cols + y * res, res, rx, &x, &col_pdf);
+        }
         dir = map(x + rx, y + ry);
         // FIXME: This sometimes comes out negative in Optix
         pdf = std::max(0.0f, row_pdf * col_pdf * invjacobian);
@@ -266,10 +309,70 @@ private:
         return std::min(scaled_sample, 0.99999994f);
     }
 
+#ifndef __CUDACC__
+    // Walker's alias method: fill in, for each of the n entries, the
+    // probability of keeping it and the entry to take otherwise, so that
+    // entries come out in proportion to their weights.
+    static void build_alias(const float* weights, int n, float* prob,
+                            int* alias)
+    {
+        float total = 0;
+        for (int i = 0; i < n; i++)
+            total += weights[i];
+        std::vector<int> small, large;
+        for (int i = 0; i < n; i++) {
+            prob[i]  = total > 0 ? weights[i] * n / total : 1.0f;
+            alias[i] = i;
+            (prob[i] < 1 ? small : large).push_back(i);
+        }
+        while (!small.empty() && !large.empty()) {
+            int s = small.back(), l = large.back();
+            small.pop_back();
+            alias[s] = l;
+            prob[l] -= 1 - prob[s];
+            if (prob[l] < 1) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        // whatever is left is 1, up to rounding
+        for (int i : small)
+            prob[i] = 1;
+        for (int i : large)
+            prob[i] = 1;
+    }
+#endif
+
+    // Pick one of the n entries of an alias table with x in [0,1),
+    // returning the rest of x, rescaled to [0,1).
+    static OSL_HOSTDEVICE float sample_alias(const float* prob,
+                                             const int* alias, unsigned n,
+                                             float x, unsigned* idx)
+    {
+        float s    = x * n;
+        unsigned i = std::min(unsigned(s), n - 1);
+        float f    = s - i;
+        float scaled_sample;
+        if (f < prob[i]) {
+            *idx          = i;
+            scaled_sample = f / prob[i];
+        } else {
+            *idx          = alias[i];
+            scaled_sample = (f - prob[i]) / (1 - prob[i]);
+        }
+        // keep result in [0,1)
+        return std::min(scaled_sample, 0.99999994f);
+    }
+
     Vec3* values = nullptr;  // actual map
     float* rows  = nullptr;  // probability of choosing a given row 'y'
     float* cols
         = nullptr;  // probability of choosing a given column 'x', given that we've chosen row 'y'
+    // alias tables for the rows, and the columns of each row (host only)
+    float* row_prob   = nullptr;
+    int* row_alias    = nullptr;
+    float* col_prob   = nullptr;
+    int* col_alias    = nullptr;
     int res           = -1;    // resolution in pixels of the precomputed table
     float invres      = 0.0f;  // 1 / resolution
     float invjacobian = 0.0f;
@@ -0,0 +1,79 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include "batched_raytracer.h"
+#include "simpleraytracer.h"
+
+using namespace OSL;
+
+OSL_NAMESPACE_BEGIN
+
+template<int WidthT>
+BatchedSimpleRaytracer<WidthT>::BatchedSimpleRaytracer(SimpleRaytracer& sr)
+    : BatchedRendererServices<WidthT>(sr.shadingsys->texturesys()), m_sr(sr)
+{
+}
+
+
+
+template<int WidthT>
+typename BatchedSimpleRaytracer<WidthT>::Mask
+BatchedSimpleRaytracer<WidthT>::get_matrix(BatchedShaderGlobals* /*bsg*/,
+                                           Masked<Matrix44> result,
+                                           Wide<const TransformationPtr> xform,
+                                           Wide<const float> /*time*/)
+{
+    result.mask().template foreach<1 /*MinOccupancyT*/>(
+        [&](ActiveLane lane) -> void {
+            Matrix44 M;
+            m_sr.get_matrix(nullptr, M, xform[lane]);
+            result[lane] = M;
+        });
+    return result.mask();
+}
+
+
+
+template<int WidthT>
+typename BatchedSimpleRaytracer<WidthT>::Mask
+BatchedSimpleRaytracer<WidthT>::get_matrix(BatchedShaderGlobals* /*bsg*/,
+                                           Masked<Matrix44> result,
+                                           ustringhash from,
+                                           Wide<const float> /*time*/)
+{
+    Matrix44 M;
+    if (!m_sr.get_matrix(nullptr, M, from))
+        return Mask(false);
+    result.mask().template foreach<1 /*MinOccupancyT*/>(
+        [&](ActiveLane lane) -> void { result[lane] = M; });
+    return Mask(true);
+}
+
+
+
+template<int WidthT>
+typename BatchedSimpleRaytracer<WidthT>::Mask
+BatchedSimpleRaytracer<WidthT>::get_matrix(BatchedShaderGlobals* /*bsg*/,
+                                           Masked<Matrix44> result,
+                                           Wide<const ustringhash> from,
+                                           Wide<const float> /*time*/)
+{
+    Mask succeeded(false);
+    result.mask().template foreach<1 /*MinOccupancyT*/>(
+        [&](ActiveLane lane) -> void {
+            Matrix44 M;
+            if (m_sr.get_matrix(nullptr, M, from[lane])) {
+                result[lane] = M;
+                succeeded.set_on(lane);
+            }
+        });
+    return succeeded;
+}
+
+
+// Explicitly instantiate BatchedSimpleRaytracer template
+template class BatchedSimpleRaytracer<16>;
+template class BatchedSimpleRaytracer<8>;
+
+OSL_NAMESPACE_END
@@ -0,0 +1,59 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <OSL/oslconfig.h>
+
+#include <OSL/batched_rendererservices.h>
+
+OSL_NAMESPACE_BEGIN
+
+class SimpleRaytracer;
+
+// The batched services of SimpleRaytracer, for its wavefront mode: the
+// transformations come from the SimpleRaytracer, and the rest (texture,
+// attributes, ...) is left to the defaults.
+template<int WidthT>
+class BatchedSimpleRaytracer : public BatchedRendererServices<WidthT> {
+public:
+    explicit BatchedSimpleRaytracer(SimpleRaytracer& sr);
+
+    OSL_USING_DATA_WIDTH(WidthT);
+
+    Mask get_matrix(BatchedShaderGlobals* bsg, Masked<Matrix44> result,
+                    Wide<const TransformationPtr> xform,
+                    Wide<const float> time) override;
+    Mask get_matrix(BatchedShaderGlobals* bsg, Masked<Matrix44> result,
+                    ustringhash from, Wide<const float> time) override;
+    Mask get_matrix(BatchedShaderGlobals* bsg, Masked<Matrix44> result,
+                    Wide<const ustringhash> from,
+                    Wide<const float> time) override;
+
+    bool is_overridden_get_inverse_matrix_WmWxWf() const override
+    {
+        return false;
+    }
+    bool is_overridden_get_matrix_WmWsWf() const override { return true; }
+    bool is_overridden_get_inverse_matrix_WmsWf() const override
+    {
+        return false;
+    }
+    bool is_overridden_get_inverse_matrix_WmWsWf() const override
+    {
+        return false;
+    }
+
+    bool is_overridden_texture() const override { return false; }
+    bool is_overridden_texture3d() const override { return false; }
+    bool is_overridden_environment() const override { return false; }
+    bool is_overridden_pointcloud_search() const override { return false; }
+    bool is_overridden_pointcloud_get() const override { return false; }
+    bool is_overridden_pointcloud_write() const override { return false; }
+
+private:
+    SimpleRaytracer& m_sr;
+};
+
+OSL_NAMESPACE_END
@@ -6,6 +6,8 @@
 #include "raytracer.h"
 
 #include <Imath/ImathBox.h>
+#include <OpenImageIO/parallel.h>
+#include <OpenImageIO/simd.h>
 #include <OpenImageIO/timer.h>
 
 OSL_NAMESPACE_BEGIN
@@ -39,6 +41,205 @@ comp(const Vec3& vec, int i)
 static constexpr int NumBins  = 16;
 static constexpr int MaxDepth = 64;
 
+// Nodes with more primitives than this are split before the rest of the
+// build is handed out to threads, one subtree each.
+static constexpr unsigned SubtreePrims = 1 << 14;
+// Nodes with more primitives than this bin them in parallel, in chunks.
+static constexpr unsigned ParallelBinPrims = 1 << 16;
+static constexpr unsigned BinChunk         = 1 << 14;
+
+namespace {
+
+// Primitive count and bounds of each bin, per axis.
+struct Bins {
+    Box3 bounds[3][NumBins];
+    unsigned count[3][NumBins];
+
+    Bins() { memset(count, 0, sizeof(count)); }
+
+    void merge(const Bins& other)
+    {
+        for (int axis = 0; axis < 3; axis++)
+            for (int i = 0; i < NumBins; i++) {
+                count[axis][i] += other.count[axis][i];
+                bounds[axis][i].extendBy(other.bounds[axis][i]);
+            }
+    }
+};
+
+struct BVHBuilder {
+    const std::vector<Box3>& triangle_bounds;
+    unsigned* indices;
+
+    // Bin the primitives [begin,end) of the node by centroid.
+    void bin(const BuildNode& node, const float binFactor[3], unsigned begin,
+             unsigned end, Bins& bins) const
+    {
+        for (unsigned i = begin; i < end; i++) {
+            unsigned prim = indices[i];
+            Box3 bbox     = triangle_bounds[prim];
+            Vec3 center   = bbox.center();
+            for (int axis = 0; axis < 3; axis++) {
+                int binID = (int)((comp(center, axis)
+                                   - comp(node.centroid.min, axis))
+                                  * binFactor[axis]);
+                OSL_ASSERT(binID >= 0 && binID < NumBins);
+                bins.count[axis][binID]++;
+                bins.bounds[axis][binID].extendBy(bbox);
+            }
+        }
+    }
+
+    // Find the best SAH split of the node (of half area `area`) and
+    // partition its primitives, returning false if it should be a leaf.
+    bool split(const BuildNode& current, float area, BuildNode bn[2],
+               Box3 bounds[2]) const
+    {
+        const unsigned numPrims = current.right - current.left;
+        if (numPrims <= 1 || current.depth >= MaxDepth)
+            return false;
+
+        float binFactor[3];
+        for (int axis = 0; axis < 3; axis++) {
+            binFactor[axis] = comp(current.centroid.max, axis)
+                              - comp(current.centroid.min, axis);
+            binFactor[axis] = (binFactor[axis] > 0)
+                                  ? float(0.999f * NumBins) / binFactor[axis]
+                                  : 0;
+        }
+        // for each primitive, figure out in which bin it lands per axis
+        Bins bins;
+        if (numPrims > ParallelBinPrims) {
+            unsigned nchunks = (numPrims + BinChunk - 1) / BinChunk;
+            std::vector<Bins> chunk_bins(nchunks);
+            OIIO::parallel_for(int64_t(0), int64_t(nchunks), [&](int64_t c) {
+                unsigned begin = current.left + unsigned(c) * BinChunk;
+                unsigned end   = std::min(begin + BinChunk, current.right);
+                bin(current, binFactor, begin, end, chunk_bins[c]);
+            });
+            for (const Bins& b : chunk_bins)
+                bins.merge(b);
+        } else {
+            bin(current, binFactor, current.left, current.right, bins);
+        }
+
+        // compute the SAH cost of partitioning at each bin
+        const float invArea = 1 / area;
+        float bestCost      = numPrims;
+        int bestAxis        = -1;
+        int bestBin         = -1;
+        unsigned bestNL     = 0;
+        unsigned bestNR     = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            // skip if the current bbox is flat along this axis (splitting would not make sense)
+            if (binFactor[axis] == 0)
+                continue;
+            unsigned countL = 0;
+            Box3 bbox;
+            unsigned numL[NumBins];
+            float areaL[NumBins];
+            for (int i = 0; i < NumBins; i++) {
+                countL += bins.count[axis][i];
+                numL[i] = countL;
+                bbox.extendBy(bins.bounds[axis][i]);
+                areaL[i] = half_area(bbox);
+            }
+            OSL_ASSERT(countL == numPrims);
+            bbox = bins.bounds[axis][NumBins - 1];
+            for (int i = NumBins - 2; i >= 0; i--) {
+                if (numL[i] == 0 || numL[i] == numPrims)
+                    continue;  // skip if this candidate split does not partition the prims
+                float areaR = half_area(bbox);
+                const float trav_cost
+                    = 4;  // TODO: tune this if intersection function changes
+                const float cost = trav_cost
+                                   + invArea
+                                         * (areaL[i] * numL[i]
+                                            + areaR * (numPrims - numL[i]));
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin  = i;
+                    bestNL   = numL[i];
+                    bestNR   = numPrims - bestNL;
+                }
+                bbox.extendBy(bins.bounds[axis][i]);
+            }
+        }
+        if (bestAxis == -1)
+            return false;
+
+        // split along the found best split
+        bn[0].depth = bn[1].depth = current.depth + 1;
+        unsigned right            = current.right;
+        for (unsigned i = current.left; i < right;) {
+            unsigned prim = indices[i];
+            Box3 bbox     = triangle_bounds[prim];
+            float center  = comp(bbox.center(), bestAxis);
+            int binID = (int)((center - comp(current.centroid.min, bestAxis))
+                              * binFactor[bestAxis]);
+            OSL_ASSERT(binID >= 0 && binID < NumBins);
+            if (binID <= bestBin) {
+                bounds[0].extendBy(bbox);
+                bn[0].centroid.extendBy(bbox.center());
+                i++;
+            } else {
+                bounds[1].extendBy(bbox);
+                bn[1].centroid.extendBy(bbox.center());
+                std::swap(indices[i], indices[--right]);
+            }
+        }
+        OSL_ASSERT(bestNL == (right - current.left));
+        OSL_ASSERT(bestNR == (current.right - right));
+        OSL_ASSERT(bestNL + bestNR == numPrims);
+        bn[0].left  = current.left;
+        bn[0].right = right;
+        bn[1].left  = right;
+        bn[1].right = current.right;
+        return true;
+    }
+
+    // Split the node `current` of `nodes` until its leaves, adding the
+    // nodes below it to `nodes`.
+    void build(BuildNode current, std::vector<BVHNode>& nodes) const
+    {
+        int stackPtr = 0;
+        BuildNode stack[MaxDepth];
+        while (true) {
+            BuildNode bn[2];
+            Box3 bounds[2];
+            if (split(current, nodes[current.nodeIndex].half_area(), bn,
+                      bounds)) {
+                // allocate 2 child nodes
+                unsigned nextIndex = nodes.size();
+                nodes.emplace_back();
+                nodes.emplace_back();
+                // write to current node
+                nodes[current.nodeIndex].child  = nextIndex;
+                nodes[current.nodeIndex].nprims = 0;
+                bn[0].nodeIndex                 = nextIndex + 0;
+                bn[1].nodeIndex                 = nextIndex + 1;
+                nodes[nextIndex + 0].set(bounds[0].min, bounds[0].max);
+                nodes[nextIndex + 1].set(bounds[1].min, bounds[1].max);
+                current           = bn[0];
+                stack[stackPtr++] = bn[1];
+                continue;  // keep building
+            }
+            // nothing more to be done with this node - create a leaf
+            nodes[current.nodeIndex].child  = current.left;
+            nodes[current.nodeIndex].nprims = current.right - current.left;
+            // pop the stack
+            if (stackPtr == 0)
+                break;
+            current = stack[--stackPtr];
+        }
+    }
+};
+
+}  // namespace
+
+
+
 static std::unique_ptr<BVH>
 build_bvh(OIIO::cspan<Vec3> verts, OIIO::cspan<TriangleIndices> triangles,
           OIIO::ErrorHandler& errhandler)
@@ -48,161 +249,85 @@ build_bvh(OIIO::cspan<Vec3> verts, OIIO::cspan<TriangleIndices> triangles,
     bvh->indices = std::make_unique<unsigned[]>(triangles.size());
 
     std::vector<BVHNode> buildnodes;
-    std::vector<Box3> triangle_bounds;
+    std::vector<Box3> triangle_bounds(triangles.size());
     buildnodes.reserve(2 * triangles.size() + 1);
     buildnodes.emplace_back();
-    triangle_bounds.reserve(triangles.size());
-    BuildNode current;
+    OIIO::parallel_for(int64_t(0), int64_t(triangles.size()), [&](int64_t i) {
+        bvh->indices[i] = unsigned(i);
+        Box3 b(verts[triangles[i].a]);
+        b.extendBy(verts[triangles[i].b]);
+        b.extendBy(verts[triangles[i].c]);
+        triangle_bounds[i] = b;
+    });
+    BuildNode root;
     Box3 shape_bounds;
-    for (unsigned i = 0; i < triangles.size(); i++) {
-        bvh->indices[i] = i;
-        Vec3 va         = verts[triangles[i].a];
-        Vec3 vb         = verts[triangles[i].b];
-        Vec3 vc         = verts[triangles[i].c];
-        Box3 b(va);
-        b.extendBy(vb);
-        b.extendBy(vc);
-        triangle_bounds.emplace_back(b);
-        current.centroid.extendBy(b.center());
+    for (const Box3& b : triangle_bounds) {
+        root.centroid.extendBy(b.center());
         shape_bounds.extendBy(b);
     }
     buildnodes[0].set(shape_bounds.min, shape_bounds.max);
-    current.left      = 0;
-    current.right     = triangles.size();
-    current.depth     = 1;
-    current.nodeIndex = 0;
-    int stackPtr      = 0;
-    BuildNode stack[MaxDepth];
-    while (true) {
-        const unsigned numPrims = current.right - current.left;
-        if (numPrims > 1 && current.depth < MaxDepth) {
-            // try to split this set of primitives
-            Box3 binBounds[3][NumBins];
-            unsigned binN[3][NumBins];
-            memset(binN, 0, sizeof(binN));
+    root.left      = 0;
+    root.right     = triangles.size();
+    root.depth     = 1;
+    root.nodeIndex = 0;
 
-            float binFactor[3];
-            for (int axis = 0; axis < 3; axis++) {
-                binFactor[axis] = comp(current.centroid.max, axis)
-                                  - comp(current.centroid.min, axis);
-                binFactor[axis] = (binFactor[axis] > 0)
-                                      ? float(0.999f * NumBins)
-                                            / binFactor[axis]
-                                      : 0;
-            }
-            // for each primitive, figure out in which bin it lands per axis
-            for (unsigned i = current.left; i < current.right; i++) {
-                unsigned prim = bvh->indices[i];
-                Box3 bbox     = triangle_bounds[prim];
-                Vec3 center   = bbox.center();
-                for (int axis = 0; axis < 3; axis++) {
-                    int binID = (int)((comp(center, axis)
-                                       - comp(current.centroid.min, axis))
-                                      * binFactor[axis]);
-                    OSL_ASSERT(binID >= 0 && binID < NumBins);
-                    binN[axis][binID]++;
-                    binBounds[axis][binID].extendBy(bbox);
-                }
-            }
-            // compute the SAH cost of partitioning at each bin
-            const float invArea = 1 / buildnodes[current.nodeIndex].half_area();
-            float bestCost      = numPrims;
-            int bestAxis        = -1;
-            int bestBin         = -1;
-            unsigned bestNL     = 0;
-            unsigned bestNR     = 0;
-            for (int axis = 0; axis < 3; axis++) {
-                // skip if the current bbox is flat along this axis (splitting would not make sense)
-                if (binFactor[axis] == 0)
-                    continue;
-                unsigned countL = 0;
-                Box3 bbox;
-                unsigned numL[NumBins];
-                float areaL[NumBins];
-                for (int i = 0; i < NumBins; i++) {
-                    countL += binN[axis][i];
-                    numL[i] = countL;
-                    bbox.extendBy(binBounds[axis][i]);
-                    areaL[i] = half_area(bbox);
-                }
-                OSL_ASSERT(countL == numPrims);
-                bbox = binBounds[axis][NumBins - 1];
-                for (int i = NumBins - 2; i >= 0; i--) {
-                    if (numL[i] == 0 || numL[i] == numPrims)
-                        continue;  // skip if this candidate split does not partition the prims
-                    float areaR = half_area(bbox);
-                    const float trav_cost
-                        = 4;  // TODO: tune this if intersection function changes
-                    const float cost = trav_cost
-                                       + invArea
-                                             * (areaL[i] * numL[i]
-                                                + areaR * (numPrims - numL[i]));
-                    if (cost < bestCost) {
-                        bestCost = cost;
-                        bestAxis = axis;
-                        bestBin  = i;
-                        bestNL   = numL[i];
-                        bestNR   = numPrims - bestNL;
-                    }
-                    bbox.extendBy(binBounds[axis][i]);
-                }
-            }
-            if (bestAxis != -1) {
-                // split along the found best split
-                Box3 boundsL, boundsR;
-                BuildNode bn[2];
-                bn[0].depth = bn[1].depth = current.depth + 1;
-                unsigned rightOrig        = current.right;
-                for (unsigned i = current.left; i < current.right;) {
-                    unsigned prim = bvh->indices[i];
-                    Box3 bbox     = triangle_bounds[prim];
-                    float center  = comp(bbox.center(), bestAxis);
-                    int binID
-                        = (int)((center - comp(current.centroid.min, bestAxis))
-                                * binFactor[bestAxis]);
-                    OSL_ASSERT(binID >= 0 && binID < NumBins);
-                    if (binID <= bestBin) {
-                        boundsL.extendBy(bbox);
-                        bn[0].centroid.extendBy(bbox.center());
-                        i++;
-                    } else {
-                        boundsR.extendBy(bbox);
-                        bn[1].centroid.extendBy(bbox.center());
-                        std::swap(bvh->indices[i],
-                                  bvh->indices[--current.right]);
-                    }
-                }
-                OSL_ASSERT(bestNL == (current.right - current.left));
-                OSL_ASSERT(bestNR == (rightOrig - current.right));
-                OSL_ASSERT(bestNL + bestNR == numPrims);
-                // allocate 2 child nodes
-                unsigned nextIndex = buildnodes.size();
-                buildnodes.emplace_back();
-                buildnodes.emplace_back();
-                // write to current node
-                buildnodes[current.nodeIndex].child  = nextIndex;
-                buildnodes[current.nodeIndex].nprims = 0;
-                bn[0].left                           = current.left;
-                bn[0].right                          = current.right;
-                bn[1].left                           = current.right;
-                bn[1].right                          = rightOrig;
-                bn[0].nodeIndex                      = nextIndex + 0;
-                bn[1].nodeIndex                      = nextIndex + 1;
-                buildnodes[nextIndex + 0].set(boundsL.min, boundsL.max);
-                buildnodes[nextIndex + 1].set(boundsR.min, boundsR.max);
-                current           = bn[0];
-                stack[stackPtr++] = bn[1];
-                continue;  // keep building
-            }
+    BVHBuilder builder { triangle_bounds, bvh->indices.get() };
+
+    // Split the big nodes first (binning each in parallel), down to
+    // subtrees small enough to hand out to the threads.
+    std::vector<BuildNode> subtrees;
+    std::vector<BuildNode> pending(1, root);
+    while (pending.size()) {
+        BuildNode current = pending.back();
+        pending.pop_back();
+        if (current.right - current.left <= SubtreePrims) {
+            subtrees.push_back(current);
+            continue;
         }
-        // nothing more to be done with this node - create a leaf
-        buildnodes[current.nodeIndex].child  = current.left;
-        buildnodes[current.nodeIndex].nprims = numPrims;
-        // pop the stack
-        if (stackPtr == 0)
-            break;
-        current = stack[--stackPtr];
+        BuildNode bn[2];
+        Box3 bounds[2];
+        if (!builder.split(current,
+                           buildnodes[current.nodeIndex].half_area(), bn,
+                           bounds)) {
+            buildnodes[current.nodeIndex].child  = current.left;
+            buildnodes[current.nodeIndex].nprims = current.right
+                                                   - current.left;
+            continue;
+        }
+        unsigned nextIndex = buildnodes.size();
+        buildnodes.emplace_back();
+        buildnodes.emplace_back();
+        buildnodes[current.nodeIndex].child  = nextIndex;
+        buildnodes[current.nodeIndex].nprims = 0;
+        bn[0].nodeIndex                      = nextIndex + 0;
+        bn[1].nodeIndex                      = nextIndex + 1;
+        buildnodes[nextIndex + 0].set(bounds[0].min, bounds[0].max);
+        buildnodes[nextIndex + 1].set(bounds[1].min, bounds[1].max);
+        pending.push_back(bn[1]);
+        pending.push_back(bn[0]);
+    }
+
+    // Build the subtrees in parallel, each into its own nodes (with its
+    // root first), then append them in order, so that the result doesn't
+    // depend on the threads.
+    std::vector<std::vector<BVHNode>> subnodes(subtrees.size());
+    OIIO::parallel_for(int64_t(0), int64_t(subtrees.size()), [&](int64_t i) {
+        BuildNode current = subtrees[i];
+        subnodes[i].push_back(buildnodes[current.nodeIndex]);
+        current.nodeIndex = 0;
+        builder.build(current, subnodes[i]);
+    });
+    for (size_t i = 0; i < subtrees.size(); i++) {
+        std::vector<BVHNode>& nodes = subnodes[i];
+        // Local node k > 0 goes to base + k
+        unsigned base = buildnodes.size() - 1;
+        for (BVHNode& node : nodes)
+            if (node.nprims == 0 && nodes.size() > 1)
+                node.child += base;
+        buildnodes[subtrees[i].nodeIndex] = nodes[0];
+        buildnodes.insert(buildnodes.end(), nodes.begin() + 1, nodes.end());
     }
+
     bvh->nodes = std::make_unique<BVHNode[]>(buildnodes.size());
     memcpy(bvh->nodes.get(), buildnodes.data(),
            buildnodes.size() * sizeof(BVHNode));
@@ -217,6 +342,94 @@ build_bvh(OIIO::cspan<Vec3> verts, OIIO::cspan<TriangleIndices> triangles,
     return bvh;
 }
 
+// Collapse the binary BVH to nodes of up to `width` children: each wide
+// node starts from the children of a binary node and keeps opening up its
+// largest inner child until it has `width` of them. The triangles of each
+// leaf go to packets of 8.
+static void
+collapse_bvh(BVH& bvh, int width, OIIO::cspan<Vec3> verts,
+             OIIO::cspan<TriangleIndices> triangles,
+             OIIO::ErrorHandler& errhandler)
+{
+    OIIO::Timer timer;
+    std::vector<WideBVHNode> nodes;
+    std::vector<TrianglePacket> packets;
+    // binary node, and the wide node to make from it
+    std::vector<std::pair<unsigned, unsigned>> pending;
+    nodes.emplace_back();
+    pending.emplace_back(0, 0);
+    while (pending.size()) {
+        const std::pair<unsigned, unsigned> current = pending.back();
+        pending.pop_back();
+        unsigned children[WideBVHNode::Width] = { current.first };
+        int nchildren                         = 1;
+        while (nchildren < width) {
+            int best        = -1;
+            float best_area = -1;
+            for (int i = 0; i < nchildren; i++) {
+                const BVHNode& n = bvh.nodes[children[i]];
+                if (n.nprims == 0 && n.half_area() > best_area) {
+                    best      = i;
+                    best_area = n.half_area();
+                }
+            }
+            if (best == -1)
+                break;  // all leaves
+            unsigned child        = bvh.nodes[children[best]].child;
+            children[best]        = child;
+            children[nchildren++]   = child + 1;
+        }
+        WideBVHNode node;
+        memset(&node, 0, sizeof(node));
+        node.nchildren = nchildren;
+        for (int i = 0; i < nchildren; i++) {
+            const BVHNode& n = bvh.nodes[children[i]];
+            for (int axis = 0; axis < 3; axis++) {
+                node.lo[axis][i] = n.bounds[2 * axis + 0];
+                node.hi[axis][i] = n.bounds[2 * axis + 1];
+            }
+            if (n.nprims == 0) {
+                node.child[i]    = nodes.size();
+                node.npackets[i] = 0;
+                nodes.emplace_back();
+                pending.emplace_back(children[i], node.child[i]);
+                continue;
+            }
+            node.child[i]    = packets.size();
+            node.npackets[i] = (n.nprims + 7) / 8;
+            for (unsigned first = 0; first < n.nprims; first += 8) {
+                packets.emplace_back();
+                TrianglePacket& packet = packets.back();
+                memset(&packet, 0, sizeof(packet));
+                for (unsigned l = 0; l < 8; l++) {
+                    if (first + l >= n.nprims) {
+                        packet.id[l] = ~0u;  // degenerate, never hit
+                        continue;
+                    }
+                    unsigned id  = bvh.indices[n.child + first + l];
+                    packet.id[l] = id;
+                    for (int axis = 0; axis < 3; axis++) {
+                        packet.a[axis][l] = comp(verts[triangles[id].a], axis);
+                        packet.b[axis][l] = comp(verts[triangles[id].b], axis);
+                        packet.c[axis][l] = comp(verts[triangles[id].c], axis);
+                    }
+                }
+            }
+        }
+        nodes[current.second] = node;
+    }
+
+    bvh.wide_nodes = std::make_unique<WideBVHNode[]>(nodes.size());
+    std::copy(nodes.begin(), nodes.end(), bvh.wide_nodes.get());
+    bvh.packets = std::make_unique<TrianglePacket[]>(packets.size());
+    std::copy(packets.begin(), packets.end(), bvh.packets.get());
+    double collapsetime = timer();
+    errhandler.infofmt(
+        "BVH collapsed to {} nodes of up to {} children and {} triangle packets in {}",
+        nodes.size(), width, packets.size(),
+        OIIO::Strutil::timeintervalformat(collapsetime, 2));
+}
+
 // min and max, written such that any NaNs in 'b' get ignored
 static inline float
 minf(float a, float b)
@@ -261,10 +474,24 @@ xorf(float a, unsigned b)
     return OIIO::bitcast<float>(OIIO::bitcast<unsigned>(a) ^ b);
 }
 
+// minf and maxf, for 8 values at once
+static inline OIIO::simd::vfloat8
+minf(const OIIO::simd::vfloat8& a, const OIIO::simd::vfloat8& b)
+{
+    return OIIO::simd::select(b < a, b, a);
+}
+static inline OIIO::simd::vfloat8
+maxf(const OIIO::simd::vfloat8& a, const OIIO::simd::vfloat8& b)
+{
+    return OIIO::simd::select(b > a, b, a);
+}
+
 Intersection
 Scene::intersect(const Ray& ray, const float tmax, unsigned skipID1,
                  unsigned skipID2) const
 {
+    if (bvh->wide_nodes)
+        return intersect_wide(ray, tmax, skipID1, skipID2);
     struct StackItem {
         BVHNode* node;
         float dist;
@@ -355,8 +582,129 @@ Scene::intersect(const Ray& ray, const float tmax, unsigned skipID1,
     return result;
 }
 
+// Same as intersect(), over the wide BVH: the ray is tested against all
+// the children of a node at once, and against the triangles of a leaf 8
+// at a time.
+Intersection
+Scene::intersect_wide(const Ray& ray, const float tmax, unsigned skipID1,
+                      unsigned skipID2) const
+{
+    using OIIO::simd::vbool8;
+    using OIIO::simd::vfloat8;
+    using OIIO::simd::vint8;
+    struct StackItem {
+        unsigned child, npackets;
+        float dist;
+    } stack[MaxDepth * WideBVHNode::Width];
+    Intersection result;
+    result.t       = tmax;
+    stack[0]       = { 0, 0, result.t };
+    const Vec3 org = ray.origin;
+    const Vec3 dir = ray.direction;
+    const Vec3 rdir(1 / dir.x, 1 / dir.y, 1 / dir.z);
+    int kz = 0;
+    if (fabsf(dir.y) > fabsf(comp(dir, kz)))
+        kz = 1;
+    if (fabsf(dir.z) > fabsf(comp(dir, kz)))
+        kz = 2;
+    int kx = kz == 2 ? 0 : kz + 1;
+    int ky = kx == 2 ? 0 : kx + 1;
+    const Vec3 shearDir(comp(dir, kx) / comp(dir, kz),
+                        comp(dir, ky) / comp(dir, kz), comp(rdir, kz));
+    const vfloat8 zero     = vfloat8::Zero();
+    const vfloat8 org8[3]  = { vfloat8(org.x), vfloat8(org.y), vfloat8(org.z) };
+    const vfloat8 rdir8[3] = { vfloat8(rdir.x), vfloat8(rdir.y),
+                               vfloat8(rdir.z) };
+    const vfloat8 shearX(shearDir.x), shearY(shearDir.y), shearZ(shearDir.z);
+    const vint8 signbit(int(0x80000000u));
+    for (int stackPtr = 1; stackPtr != 0;) {
+        if (result.t < stack[--stackPtr].dist)
+            continue;
+        const StackItem item = stack[stackPtr];
+        if (item.npackets) {
+            for (unsigned p = item.child, end = p + item.npackets; p < end;
+                 p++) {
+                const TrianglePacket& packet = bvh->packets[p];
+                // Watertight Ray/Triangle Intersection - JCGT 2013
+                // https://jcgt.org/published/0002/01/05/
+                const vfloat8 Az = vfloat8(packet.a[kz]) - org8[kz];
+                const vfloat8 Bz = vfloat8(packet.b[kz]) - org8[kz];
+                const vfloat8 Cz = vfloat8(packet.c[kz]) - org8[kz];
+                const vfloat8 Ax = vfloat8(packet.a[kx]) - org8[kx]
+                                   - shearX * Az;
+                const vfloat8 Ay = vfloat8(packet.a[ky]) - org8[ky]
+                                   - shearY * Az;
+                const vfloat8 Bx = vfloat8(packet.b[kx]) - org8[kx]
+                                   - shearX * Bz;
+                const vfloat8 By = vfloat8(packet.b[ky]) - org8[ky]
+                                   - shearY * Bz;
+                const vfloat8 Cx = vfloat8(packet.c[kx]) - org8[kx]
+                                   - shearX * Cz;
+                const vfloat8 Cy = vfloat8(packet.c[ky]) - org8[ky]
+                                   - shearY * Cz;
+                const vfloat8 U = Cx * By - Cy * Bx;
+                const vfloat8 V = Ax * Cy - Ay * Cx;
+                const vfloat8 W = Bx * Ay - By * Ax;
+                vbool8 valid   = !(((U < zero) | (V < zero) | (W < zero))
+                                & ((U > zero) | (V > zero) | (W > zero)));
+                const vfloat8 det = U + V + W;
+                valid &= det != zero;
+                const vfloat8 T    = shearZ * (U * Az + V * Bz + W * Cz);
+                const vint8 mask   = OIIO::simd::bitcast_to_int(det) & signbit;
+                const vfloat8 Tm   = OIIO::simd::bitcast_to_float(
+                    OIIO::simd::bitcast_to_int(T) ^ mask);
+                const vfloat8 detm = OIIO::simd::bitcast_to_float(
+                    OIIO::simd::bitcast_to_int(det) ^ mask);
+                valid &= !(Tm < zero) & !(Tm > vfloat8(result.t) * detm);
+                const vint8 id(reinterpret_cast<const int*>(packet.id));
+                valid &= (id != vint8(int(skipID1)))
+                         & (id != vint8(int(skipID2)));
+                // record the hits in order, keeping the closest
+                for (int bits = valid.bitmask(), l = 0; bits; bits >>= 1, l++) {
+                    if (!(bits & 1))
+                        continue;
+                    if (Tm[l] > result.t * detm[l])
+                        continue;
+                    const float rcpDet = 1 / det[l];
+                    result.t           = T[l] * rcpDet;
+                    result.u           = V[l] * rcpDet;
+                    result.v           = W[l] * rcpDet;
+                    result.id          = packet.id[l];
+                }
+            }
+        } else {
+            // box_intersect() for all the children at once
+            const WideBVHNode& node = bvh->wide_nodes[item.child];
+            vfloat8 tmin = zero, tmax8 = vfloat8(result.t);
+            for (int axis = 0; axis < 3; axis++) {
+                const vfloat8 t1 = (vfloat8(node.lo[axis]) - org8[axis])
+                                   * rdir8[axis];
+                const vfloat8 t2 = (vfloat8(node.hi[axis]) - org8[axis])
+                                   * rdir8[axis];
+                tmin  = axis == 0 ? minf(t1, t2) : maxf(tmin, minf(t1, t2));
+                tmax8 = minf(tmax8, maxf(t1, t2));
+            }
+            const vbool8 hit = maxf(zero, tmin) <= tmax8;
+            const int bits   = hit.bitmask() & ((1 << node.nchildren) - 1);
+            // push the children hit farthest first, so the nearest is next
+            const int first = stackPtr;
+            for (unsigned i = 0; i < node.nchildren; i++) {
+                if (!(bits & (1 << i)))
+                    continue;
+                const StackItem child = { node.child[i], node.npackets[i],
+                                          tmin[i] };
+                int j                 = stackPtr++;
+                for (; j > first && stack[j - 1].dist < child.dist; j--)
+                    stack[j] = stack[j - 1];
+                stack[j] = child;
+            }
+        }
+    }
+    return result;
+}
+
 void
-Scene::prepare(OIIO::ErrorHandler& errhandler)
+Scene::prepare(OIIO::ErrorHandler& errhandler, int bvh_width)
 {
     verts.shrink_to_fit();
     normals.shrink_to_fit();
@@ -368,6 +716,9 @@ Scene::prepare(OIIO::ErrorHandler& errhandler)
     OSL_DASSERT(triangles.size() == uv_triangles.size());
     shaderids.shrink_to_fit();
     bvh = build_bvh(verts, triangles, errhandler);
+    if (bvh_width > 2 && triangles.size())
+        collapse_bvh(*bvh, std::min(bvh_width, WideBVHNode::Width), verts,
+                     triangles, errhandler);
 }
 
 OSL_NAMESPACE_END
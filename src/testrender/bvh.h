@@ -31,6 +31,24 @@ struct BVHNode {
         return vx * vy + vy * vz + vz * vx;
     }
 };
+
+// A node of the wide BVH, with the bounds of its (up to 8) children laid
+// out so that a ray can be tested against all of them at once.
+struct WideBVHNode {
+    static constexpr int Width = 8;
+    float lo[3][Width], hi[3][Width];
+    unsigned child[Width];     // node index, or first packet of a leaf
+    unsigned npackets[Width];  // leaf packets, or 0 for an inner node
+    unsigned nchildren;
+};
+
+// Up to 8 triangles of a leaf of the wide BVH, laid out to be intersected
+// at once. Unused lanes are degenerate (and never hit).
+struct TrianglePacket {
+    float a[3][8], b[3][8], c[3][8];
+    unsigned id[8];
+};
+
 struct Intersection {
     float t, u, v;
     unsigned id;
@@ -39,6 +57,10 @@ struct Intersection {
 struct BVH {
     std::unique_ptr<BVHNode[]> nodes;
     std::unique_ptr<unsigned[]> indices;
+    // The same tree collapsed to up to 8 children per node, traversed
+    // instead of the binary one when present.
+    std::unique_ptr<WideBVHNode[]> wide_nodes;
+    std::unique_ptr<TrianglePacket[]> packets;
 };
 
 OSL_NAMESPACE_END
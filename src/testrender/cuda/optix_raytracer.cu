@@ -79,6 +79,26 @@ execute_shader(ShaderGlobalsType& sg, const int shader_id,
 }
 
 
+// With --reorder, regroup the threads of the launch by the coherence key
+// of the shader group each is about to run (Shader Execution Reordering),
+// so that the threads of a warp run the same code. Needs OptiX 8, and
+// does nothing on GPUs without SER.
+static inline __device__ void
+reorder_for_shading(const int shader_id)
+{
+#if OPTIX_VERSION >= 80000
+    if (!render_params.coherence_keys)
+        return;
+    const unsigned int key
+        = shader_id < 0 ? 0u
+                        : reinterpret_cast<const unsigned int*>(
+                              render_params.coherence_keys)[shader_id];
+    optixMakeNopHitObject();
+    optixReorder(key, render_params.coherence_key_bits);
+#endif
+}
+
+
 static inline __device__ void
 trace_ray(OptixTraversableHandle handle, Payload& payload, const float3& origin,
           const float3& direction, const float tmin)
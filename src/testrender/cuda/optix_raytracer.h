@@ -37,6 +37,8 @@ struct Payload {
 
 OSL_NAMESPACE_BEGIN
 
+struct ShadingResult;
+
 struct SimpleRaytracer {
     using ShadingContext = ShadingContextCUDA;
 
@@ -63,8 +65,17 @@ struct SimpleRaytracer {
                                          int id, float u, float v);
     OSL_HOSTDEVICE Vec3 eval_background(const Dual2<Vec3>& dir,
                                         ShadingContext* ctx, int bounce = -1);
+    OSL_HOSTDEVICE Color3 background_radiance(const Ray& r, float bsdf_pdf,
+                                              int bounce, ShadingContext* ctx);
     OSL_HOSTDEVICE Color3 subpixel_radiance(float x, float y, Sampler& sampler,
                                             ShadingContext* ctx = nullptr);
+    OSL_HOSTDEVICE bool
+    continue_path(Ray& r, const OSL_CUDA::ShaderGlobals& sg,
+                  const Intersection& hit, ShadingResult& result, int bounce,
+                  Sampler& sampler, Color3& path_weight, Color3& path_radiance,
+                  float& bsdf_pdf, int& prev_id, ShadingContext* ctx);
+    OSL_HOSTDEVICE Color3 pixel_sample(int x, int y, int si,
+                                       ShadingContext* ctx = nullptr);
     OSL_HOSTDEVICE Color3 antialias_pixel(int x, int y,
                                           ShadingContext* ctx = nullptr);
 };
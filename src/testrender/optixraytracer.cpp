@@ -171,6 +171,23 @@ OptixRaytracer::copy_to_device(void* dst_device, const void* src_host,
 
 
 
+void*
+OptixRaytracer::copy_to_device_async(void* dst_device, const void* src_host,
+                                     size_t size, void* stream)
+{
+    cudaError_t res = cudaMemcpyAsync(dst_device, src_host, size,
+                                      cudaMemcpyHostToDevice,
+                                      reinterpret_cast<cudaStream_t>(stream));
+    if (res != cudaSuccess) {
+        errhandler().errorfmt(
+            "cudaMemcpyAsync host->device of size {} failed with error: {}\n",
+            size, cudaGetErrorString(res));
+    }
+    return dst_device;
+}
+
+
+
 std::string
 OptixRaytracer::load_ptx_file(string_view filename)
 {
@@ -220,6 +237,11 @@ OptixRaytracer::synch_attributes()
     // Set the maximum groupdata buffer allocation size
     shadingsys->attribute("max_optix_groupdata_alloc", 1024);
 
+    // Pool the per-group device data, sent in one copy before each launch
+    shadingsys->attribute("device_arena_size", 1 << 20);
+    // ... and copy it on our stream, ahead of the launch
+    shadingsys->attribute("async_device_copies", 1);
+
     {
         // TODO: utilize opaque shading state uniform data structure
         // which has a device friendly representation this data
@@ -481,20 +503,26 @@ OptixRaytracer::create_shaders()
     int mtl_id = 0;
 
     std::vector<void*> material_interactive_params;
+    std::vector<int> coherence_keys;
 
+    // Generate the PTX of all the groups at once, in parallel.
+    std::vector<ShaderGroupRef> groups;
     for (const auto& groupref : shaders()) {
-        std::string group_name, fused_name;
-        shadingsys->getattribute(groupref.surf.get(), "groupname", group_name);
-        shadingsys->getattribute(groupref.surf.get(), "group_fused_name",
-                                 fused_name);
-
         shadingsys->attribute(groupref.surf.get(), "renderer_outputs",
                               TypeDesc(TypeDesc::STRING, outputs.size()),
                               outputs.data());
-        shadingsys->optimize_group(groupref.surf.get(), nullptr);
+        groups.push_back(groupref.surf);
+    }
+    std::vector<std::string> groups_ptx = shadingsys->ptx_compile_groups(
+        groups);
+
+    for (size_t g = 0; g < groups.size(); ++g) {
+        const ShaderGroupRef& group = groups[g];
+        std::string group_name, fused_name;
+        shadingsys->getattribute(group.get(), "groupname", group_name);
+        shadingsys->getattribute(group.get(), "group_fused_name", fused_name);
 
-        if (!shadingsys->find_symbol(*groupref.surf.get(),
-                                     ustring(outputs[0]))) {
+        if (!shadingsys->find_symbol(*group, ustring(outputs[0]))) {
             // FIXME: This is for cases where testshade is run with 1x1 resolution
             //        Those tests may not have a Cout parameter to write to.
             if (m_xres > 1 && m_yres > 1) {
@@ -503,10 +531,7 @@ OptixRaytracer::create_shaders()
             }
         }
 
-        // Retrieve the compiled ShaderGroup PTX
-        std::string osl_ptx;
-        shadingsys->getattribute(groupref.surf.get(), "ptx_compiled_version",
-                                 OSL::TypeDesc::PTR, &osl_ptx);
+        const std::string& osl_ptx(groups_ptx[g]);
         if (osl_ptx.empty()) {
             errhandler().errorfmt("Failed to generate PTX for ShaderGroup {}",
                                   group_name);
@@ -519,11 +544,19 @@ OptixRaytracer::create_shaders()
         }
 
         void* interactive_params = nullptr;
-        shadingsys->getattribute(groupref.surf.get(),
-                                 "device_interactive_params", TypeDesc::PTR,
-                                 &interactive_params);
+        shadingsys->getattribute(group.get(), "device_interactive_params",
+                                 TypeDesc::PTR, &interactive_params);
         material_interactive_params.push_back(interactive_params);
 
+        // The key to regroup threads by before running this group
+        if (options.get_int("reorder")) {
+            int key = 0, bits = 16;
+            shadingsys->getattribute(group.get(), "coherence_key", key);
+            shadingsys->getattribute(group.get(), "coherence_key_bits", bits);
+            coherence_keys.push_back(key);
+            m_coherence_key_bits = std::max(m_coherence_key_bits, bits);
+        }
+
         OptixModule optix_module;
 
         // Create Programs from the init and group_entry functions,
@@ -539,6 +572,10 @@ OptixRaytracer::create_shaders()
                         fmtformat("Creating module for PTX group {}: {}",
                                   group_name, msg_log));
         m_shader_modules.push_back(optix_module);
+        // Let the shading system know how many registers the group needed.
+        shadingsys->attribute(group.get(), "gpu_compile_log",
+                              string_view(msg_log, std::min(sizeof_msg_log,
+                                                            sizeof(msg_log))));
 
         // Create program groups (for direct callables)
         OptixProgramGroupDesc pgDesc[1] = {};
@@ -563,6 +600,12 @@ OptixRaytracer::create_shaders()
                                         * material_interactive_params.size());
     COPY_TO_DEVICE(d_interactive_params, material_interactive_params.data(),
                    sizeof(void*) * material_interactive_params.size());
+
+    if (coherence_keys.size()) {
+        d_coherence_keys = DEVICE_ALLOC(sizeof(int) * coherence_keys.size());
+        COPY_TO_DEVICE(d_coherence_keys, coherence_keys.data(),
+                       sizeof(int) * coherence_keys.size());
+    }
 }
 
 
@@ -1044,6 +1087,7 @@ void
 OptixRaytracer::warmup()
 {
     // Perform a tiny launch to warm up the OptiX context
+    shadingsys->upload_device_data(m_cuda_stream);
     OPTIX_CHECK(optixLaunch(m_optix_pipeline, m_cuda_stream, d_launch_params,
                             sizeof(RenderParams), &m_optix_sbt, 0, 0, 1));
     CUDA_SYNC_CHECK();
@@ -1056,6 +1100,7 @@ OptixRaytracer::render(int xres OSL_MAYBE_UNUSED, int yres OSL_MAYBE_UNUSED)
 {
     d_output_buffer = DEVICE_ALLOC(xres * yres * 4 * sizeof(float));
     d_launch_params = DEVICE_ALLOC(sizeof(RenderParams));
+    shadingsys->upload_device_data(m_cuda_stream);
 
     m_xres = xres;
     m_yres = yres;
@@ -1093,18 +1138,20 @@ OptixRaytracer::render(int xres OSL_MAYBE_UNUSED, int yres OSL_MAYBE_UNUSED)
     params.test_str_2            = test_str_2;
 
     // Mesh data
-    params.verts           = d_vertices;
-    params.triangles       = d_vert_indices;
-    params.uvs             = d_uvs;
-    params.uv_indices      = d_uv_indices;
-    params.normals         = d_normals;
-    params.normal_indices  = d_normal_indices;
-    params.shader_ids      = d_shader_ids;
-    params.shader_is_light = d_shader_is_light;
-    params.lightprims      = d_lightprims;
-    params.lightprims_size = OptixRaytracer::lightprims().size();
-    params.mesh_ids        = d_mesh_ids;
-    params.surfacearea     = d_surfacearea;
+    params.verts              = d_vertices;
+    params.triangles          = d_vert_indices;
+    params.uvs                = d_uvs;
+    params.uv_indices         = d_uv_indices;
+    params.normals            = d_normals;
+    params.normal_indices     = d_normal_indices;
+    params.shader_ids         = d_shader_ids;
+    params.shader_is_light    = d_shader_is_light;
+    params.coherence_keys     = d_coherence_keys;
+    params.coherence_key_bits = m_coherence_key_bits;
+    params.lightprims         = d_lightprims;
+    params.lightprims_size    = OptixRaytracer::lightprims().size();
+    params.mesh_ids           = d_mesh_ids;
+    params.surfacearea        = d_surfacearea;
 
     // For the background shader
     params.bg_res    = std::max<int>(32, getBackgroundResolution());
@@ -74,6 +74,8 @@ public:
     virtual void device_free(void* ptr) override;
     virtual void* copy_to_device(void* dst_device, const void* src_host,
                                  size_t size) override;
+    virtual void* copy_to_device_async(void* dst_device, const void* src_host,
+                                       size_t size, void* stream) override;
 
 private:
     // OptiX state
@@ -113,6 +115,8 @@ private:
     CUdeviceptr d_uv_indices          = 0;
     CUdeviceptr d_shader_ids          = 0;
     CUdeviceptr d_shader_is_light     = 0;
+    CUdeviceptr d_coherence_keys      = 0;
+    int m_coherence_key_bits          = 0;
     CUdeviceptr d_mesh_ids            = 0;
     CUdeviceptr d_surfacearea         = 0;
     CUdeviceptr d_lightprims          = 0;
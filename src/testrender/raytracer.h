@@ -5,6 +5,7 @@
 
 #pragma once
 
+#include <memory>
 #include <vector>
 
 #include <OpenImageIO/fmath.h>
@@ -187,6 +188,10 @@ struct LightSample {
 
 using ShaderMap = std::unordered_map<std::string, int>;
 
+#ifndef __CUDACC__
+struct ParsedModel;
+#endif
+
 struct Scene {
 #ifndef __CUDACC__
     void add_sphere(const Vec3& c, float r, int shaderID, int resolution);
@@ -194,13 +199,21 @@ struct Scene {
     void add_quad(const Vec3& p, const Vec3& ex, const Vec3& ey, int shaderID,
                   int resolution);
 
-    // add models parsed from a .obj file
+    // Parse .obj files in parallel, ahead of adding them with add_model
+    static std::vector<std::shared_ptr<ParsedModel>>
+    parse_models(const std::vector<std::string>& filenames);
+
+    // add models parsed from a .obj file (here, unless parse_models
+    // already did)
     void add_model(const std::string& filename, const ShaderMap& shadermap,
-                   int shaderID, OIIO::ErrorHandler& errhandler);
+                   int shaderID, OIIO::ErrorHandler& errhandler,
+                   const ParsedModel* parsed = nullptr);
 
     int num_prims() const { return triangles.size(); }
 
-    void prepare(OIIO::ErrorHandler& errhandler);
+    // Build the BVH, collapsed to bvh_width (4 or 8) children per node
+    // for SIMD traversal if asked, else left binary.
+    void prepare(OIIO::ErrorHandler& errhandler, int bvh_width = 2);
 #endif
 
     // NB: OptiX needs to populate the ShaderGlobals in the closest-hit program,
@@ -209,6 +222,11 @@ struct Scene {
     Intersection intersect(const Ray& r, const float tmax,
                            const unsigned skipID1,
                            const unsigned skipID2 = ~0u) const;
+#ifndef __CUDACC__
+    Intersection intersect_wide(const Ray& r, const float tmax,
+                                const unsigned skipID1,
+                                const unsigned skipID2) const;
+#endif
 
     OSL_HOSTDEVICE
     LightSample sample(int primID, const Vec3& x, float xi, float yi) const
@@ -50,6 +50,8 @@ struct RenderParams {
     CUdeviceptr normal_indices;
     CUdeviceptr shader_ids;
     CUdeviceptr shader_is_light;
+    CUdeviceptr coherence_keys;  // per shader, or 0 not to reorder
+    int coherence_key_bits;
     CUdeviceptr mesh_ids;
     CUdeviceptr surfacearea;
     CUdeviceptr lightprims;
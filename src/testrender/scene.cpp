@@ -6,26 +6,65 @@
 #include "raytracer.h"
 
 #include <OpenImageIO/filesystem.h>
+#include <OpenImageIO/parallel.h>
 #include <OpenImageIO/strutil.h>
 #include <OpenImageIO/timer.h>
 
 OSL_NAMESPACE_BEGIN
 
-void
-Scene::add_model(const std::string& filename, const ShaderMap& shadermap,
-                 int shaderID, OIIO::ErrorHandler& errhandler)
+// An .obj file, parsed and triangulated, ready for add_model
+struct ParsedModel {
+    rapidobj::Result obj_file;
+    bool triangulated;
+    double parsetime;
+};
+
+static std::shared_ptr<ParsedModel>
+parse_model(const std::string& filename)
 {
     OIIO::Timer timer;
     rapidobj::MaterialLibrary materials = rapidobj::MaterialLibrary::Default(
         rapidobj::Load::Optional);
-    rapidobj::Result obj_file = rapidobj::ParseFile(filename, materials);
+    std::shared_ptr<ParsedModel> parsed(
+        new ParsedModel { rapidobj::ParseFile(filename, materials), false, 0 });
+    if (!parsed->obj_file.error)
+        parsed->triangulated = Triangulate(parsed->obj_file);
+    parsed->parsetime = timer();
+    return parsed;
+}
+
+std::vector<std::shared_ptr<ParsedModel>>
+Scene::parse_models(const std::vector<std::string>& filenames)
+{
+    // rapidobj splits each file into chunks for its own threads, but
+    // scenes made of many small files still gain from parsing the files
+    // side by side
+    std::vector<std::shared_ptr<ParsedModel>> parsed(filenames.size());
+    OIIO::parallel_for(int64_t(0), int64_t(filenames.size()), [&](int64_t i) {
+        parsed[i] = parse_model(filenames[i]);
+    });
+    return parsed;
+}
+
+void
+Scene::add_model(const std::string& filename, const ShaderMap& shadermap,
+                 int shaderID, OIIO::ErrorHandler& errhandler,
+                 const ParsedModel* parsed)
+{
+    OIIO::Timer timer;
+    std::shared_ptr<ParsedModel> parsed_here;
+    if (!parsed) {
+        parsed_here = parse_model(filename);
+        parsed      = parsed_here.get();
+    }
+    const rapidobj::Result& obj_file = parsed->obj_file;
     if (obj_file.error) {
         // we were unable to parse the scene
         errhandler.errorfmt("Error while reading {} - {}", filename,
                             obj_file.error.code.message());
         return;
     }
-    if (!Triangulate(obj_file)) {
+    if (!parsed->triangulated) {
         errhandler.errorfmt("Unable to triangulate model from {}", filename);
         return;
     }
@@ -128,7 +167,7 @@ Scene::add_model(const std::string& filename, const ShaderMap& shadermap,
         }
         last_index.emplace_back(triangles.size());
     }
-    double loadtime = timer();
+    double loadtime = parsed->parsetime + timer();
     errhandler.infofmt("Parsed {} vertices and {} triangles from {} in {}",
                        nverts, ntris, filename,
                        OIIO::Strutil::timeintervalformat(loadtime, 2));
@@ -1233,6 +1233,31 @@ evaluate_layer_opacity(const ShaderGlobalsType& sg, float path_roughness,
     return weight;
 }
 
+// Most closure components process_bsdf_closure handles at a time
+static constexpr int MAX_FLAT_CLOSURES = 32;
+
+// Flatten closure c into the list (of n components) right after its i-th
+// component, so that the list stays in the order of a depth-first walk,
+// and return the new length.
+OSL_HOSTDEVICE static int
+flatten_closure_after(FlatClosure* flat, int n, int i, const ClosureColor* c,
+                      const Color3& w)
+{
+    int m        = flatten_closure(c, flat + n, MAX_FLAT_CLOSURES - n, w);
+    auto reverse = [](FlatClosure* a, FlatClosure* b) {
+        for (; a < --b; ++a) {
+            FlatClosure t = *a;
+            *a            = *b;
+            *b            = t;
+        }
+    };
+    // Rotate the new components in ahead of the rest
+    reverse(flat + i + 1, flat + n);
+    reverse(flat + n, flat + n + m);
+    reverse(flat + i + 1, flat + n + m);
+    return n + m;
+}
+
 OSL_HOSTDEVICE void
 process_medium_closure(const ShaderGlobalsType& sg, float path_roughness,
                        ShadingResult& result, const ClosureColor* closure,
@@ -1350,223 +1375,200 @@ process_bsdf_closure(const ShaderGlobalsType& sg, float path_roughness,
     if (!closure)
         return;
 
-    // Non-recursive traversal stack
-    const int STACK_SIZE = 16;
-    int stack_idx        = 0;
-    const ClosureColor* ptr_stack[STACK_SIZE];
-    Color3 weight_stack[STACK_SIZE];
-    Color3 weight = w;
-
-    while (closure) {
-        switch (closure->id) {
-        case ClosureColor::MUL: {
-            weight *= closure->as_mul()->weight;
-            closure = closure->as_mul()->closure;
-            break;
-        }
-        case ClosureColor::ADD: {
-            ptr_stack[stack_idx]      = closure->as_add()->closureB;
-            weight_stack[stack_idx++] = weight;
-            closure                   = closure->as_add()->closureA;
-            break;
-        }
-        default: {
-            const ClosureComponent* comp = closure->as_comp();
-            Color3 cw                    = weight * comp->w;
-            closure                      = nullptr;
-            if (comp->id == EMISSION_ID)
-                result.Le += cw;
-            else if (comp->id == MX_UNIFORM_EDF_ID)
-                result.Le += cw * comp->as<MxUniformEdfParams>()->emittance;
-            else if (!light_only) {
-                bool ok = false;
-                switch (comp->id) {
-                case DIFFUSE_ID:
-                    ok = result.bsdf.add_bsdf<Diffuse<0>>(
-                        cw, *comp->as<DiffuseParams>());
-                    break;
-                case OREN_NAYAR_ID: {
-                    const OrenNayarParams& orig = *comp->as<OrenNayarParams>();
-                    const MxOrenNayarDiffuse::Data params
-                        = { orig.N, { 1, 1, 1 }, orig.sigma, false, 0 };
-                    ok = result.bsdf.add_bsdf<MxOrenNayarDiffuse>(
-                        cw, params, -sg.I, sg.backfacing, path_roughness);
-                    break;
-                }
-                case TRANSLUCENT_ID:
-                    ok = result.bsdf.add_bsdf<Diffuse<1>>(
-                        cw, *comp->as<DiffuseParams>());
-                    break;
-                case PHONG_ID:
-                    ok = result.bsdf.add_bsdf<Phong>(cw,
-                                                     *comp->as<PhongParams>());
-                    break;
-                case WARD_ID:
-                    ok = result.bsdf.add_bsdf<Ward>(cw,
-                                                    *comp->as<WardParams>());
-                    break;
-                case MICROFACET_ID: {
-                    const MicrofacetParams* mp = comp->as<MicrofacetParams>();
-                    if (mp->dist == uh_ggx) {
-                        switch (mp->refract) {
-                        case 0:
-                            ok = result.bsdf.add_bsdf<MicrofacetGGXRefl>(cw,
-                                                                         *mp);
-                            break;
-                        case 1:
-                            ok = result.bsdf.add_bsdf<MicrofacetGGXRefr>(cw,
-                                                                         *mp);
-                            break;
-                        case 2:
-                            ok = result.bsdf.add_bsdf<MicrofacetGGXBoth>(cw,
-                                                                         *mp);
-                            break;
-                        }
-                    } else if (mp->dist == uh_beckmann
-                               || mp->dist == uh_default) {
-                        switch (mp->refract) {
-                        case 0:
-                            ok = result.bsdf.add_bsdf<MicrofacetBeckmannRefl>(
-                                cw, *mp);
-                            break;
-                        case 1:
-                            ok = result.bsdf.add_bsdf<MicrofacetBeckmannRefr>(
-                                cw, *mp);
-                            break;
-                        case 2:
-                            ok = result.bsdf.add_bsdf<MicrofacetBeckmannBoth>(
-                                cw, *mp);
-                            break;
-                        }
+    // Set up the BSDFs from a flat list of the closure's components; a
+    // layer puts its top and base in the list right after itself.
+    FlatClosure flat[MAX_FLAT_CLOSURES];
+    int ncomps = flatten_closure(closure, flat, MAX_FLAT_CLOSURES, w);
+    for (int i = 0; i < ncomps; ++i) {
+        const ClosureComponent* comp = flat[i].comp;
+        Color3 weight                = flat[i].weight;
+        Color3 cw                    = weight * comp->w;
+        if (comp->id == EMISSION_ID)
+            result.Le += cw;
+        else if (comp->id == MX_UNIFORM_EDF_ID)
+            result.Le += cw * comp->as<MxUniformEdfParams>()->emittance;
+        else if (!light_only) {
+            bool ok = false;
+            switch (comp->id) {
+            case DIFFUSE_ID:
+                ok = result.bsdf.add_bsdf<Diffuse<0>>(
+                    cw, *comp->as<DiffuseParams>());
+                break;
+            case OREN_NAYAR_ID: {
+                const OrenNayarParams& orig = *comp->as<OrenNayarParams>();
+                const MxOrenNayarDiffuse::Data params
+                    = { orig.N, { 1, 1, 1 }, orig.sigma, false, 0 };
+                ok = result.bsdf.add_bsdf<MxOrenNayarDiffuse>(
+                    cw, params, -sg.I, sg.backfacing, path_roughness);
+                break;
+            }
+            case TRANSLUCENT_ID:
+                ok = result.bsdf.add_bsdf<Diffuse<1>>(
+                    cw, *comp->as<DiffuseParams>());
+                break;
+            case PHONG_ID:
+                ok = result.bsdf.add_bsdf<Phong>(cw,
+                                                 *comp->as<PhongParams>());
+                break;
+            case WARD_ID:
+                ok = result.bsdf.add_bsdf<Ward>(cw,
+                                                *comp->as<WardParams>());
+                break;
+            case MICROFACET_ID: {
+                const MicrofacetParams* mp = comp->as<MicrofacetParams>();
+                if (mp->dist == uh_ggx) {
+                    switch (mp->refract) {
+                    case 0:
+                        ok = result.bsdf.add_bsdf<MicrofacetGGXRefl>(cw,
+                                                                     *mp);
+                        break;
+                    case 1:
+                        ok = result.bsdf.add_bsdf<MicrofacetGGXRefr>(cw,
+                                                                     *mp);
+                        break;
+                    case 2:
+                        ok = result.bsdf.add_bsdf<MicrofacetGGXBoth>(cw,
+                                                                     *mp);
+                        break;
+                    }
+                } else if (mp->dist == uh_beckmann
+                           || mp->dist == uh_default) {
+                    switch (mp->refract) {
+                    case 0:
+                        ok = result.bsdf.add_bsdf<MicrofacetBeckmannRefl>(
+                            cw, *mp);
+                        break;
+                    case 1:
+                        ok = result.bsdf.add_bsdf<MicrofacetBeckmannRefr>(
+                            cw, *mp);
+                        break;
+                    case 2:
+                        ok = result.bsdf.add_bsdf<MicrofacetBeckmannBoth>(
+                            cw, *mp);
+                        break;
                     }
-                    break;
-                }
-                case REFLECTION_ID:
-                case FRESNEL_REFLECTION_ID:
-                    ok = result.bsdf.add_bsdf<Reflection>(
-                        cw, *comp->as<ReflectionParams>());
-                    break;
-                case REFRACTION_ID:
-                    ok = result.bsdf.add_bsdf<Refraction>(
-                        cw, *comp->as<RefractionParams>());
-                    break;
-                case TRANSPARENT_ID:
-                    ok = result.bsdf.add_bsdf<Transparent>(cw);
-                    break;
-                case MxOrenNayarDiffuse::closureid(): {
-                    const MxOrenNayarDiffuse::Data& params
-                        = *comp->as<MxOrenNayarDiffuse::Data>();
-                    ok = result.bsdf.add_bsdf<MxOrenNayarDiffuse>(
-                        cw, params, -sg.I, sg.backfacing, path_roughness);
-                    break;
-                }
-                case MxBurleyDiffuse::closureid(): {
-                    const MxBurleyDiffuse::Data& params
-                        = *comp->as<MxBurleyDiffuse::Data>();
-                    ok = result.bsdf.add_bsdf<MxBurleyDiffuse>(cw, params,
-                                                               -sg.I,
-                                                               sg.backfacing,
-                                                               path_roughness);
-                    break;
-                }
-                case MxDielectric::closureid(): {
-                    const MxDielectric::Data& params
-                        = *comp->as<MxDielectric::Data>();
-                    ok = result.bsdf.add_bsdf<MxDielectric>(cw, params, -sg.I,
-                                                            sg.backfacing,
-                                                            path_roughness);
-                    break;
-                }
-                case MxGeneralizedSchlick::closureid(): {
-                    const MxGeneralizedSchlick::Data& params
-                        = *comp->as<MxGeneralizedSchlick::Data>();
-                    ok = result.bsdf.add_bsdf<MxGeneralizedSchlick>(
-                        cw, params, -sg.I, sg.backfacing, path_roughness);
-                    break;
                 }
-                case MxConductor::closureid(): {
-                    const MxConductor::Data& params
-                        = *comp->as<MxConductor::Data>();
-                    ok = result.bsdf.add_bsdf<MxConductor>(cw, params, -sg.I,
+                break;
+            }
+            case REFLECTION_ID:
+            case FRESNEL_REFLECTION_ID:
+                ok = result.bsdf.add_bsdf<Reflection>(
+                    cw, *comp->as<ReflectionParams>());
+                break;
+            case REFRACTION_ID:
+                ok = result.bsdf.add_bsdf<Refraction>(
+                    cw, *comp->as<RefractionParams>());
+                break;
+            case TRANSPARENT_ID:
+                ok = result.bsdf.add_bsdf<Transparent>(cw);
+                break;
+            case MxOrenNayarDiffuse::closureid(): {
+                const MxOrenNayarDiffuse::Data& params
+                    = *comp->as<MxOrenNayarDiffuse::Data>();
+                ok = result.bsdf.add_bsdf<MxOrenNayarDiffuse>(
+                    cw, params, -sg.I, sg.backfacing, path_roughness);
+                break;
+            }
+            case MxBurleyDiffuse::closureid(): {
+                const MxBurleyDiffuse::Data& params
+                    = *comp->as<MxBurleyDiffuse::Data>();
+                ok = result.bsdf.add_bsdf<MxBurleyDiffuse>(cw, params,
+                                                           -sg.I,
                                                            sg.backfacing,
                                                            path_roughness);
-                    break;
-                }
-                case MxTranslucent::closureid(): {
-                    const MxTranslucent::Data& params
-                        = *comp->as<MxTranslucent::Data>();
-                    ok = result.bsdf.add_bsdf<MxTranslucent>(cw, params, -sg.I,
-                                                             sg.backfacing,
-                                                             path_roughness);
-                    break;
-                }
-                case MX_TRANSPARENT_ID: {
-                    ok = result.bsdf.add_bsdf<Transparent>(cw);
-                    break;
-                }
-                case MX_SUBSURFACE_ID: {
-                    // TODO: implement BSSRDF support?
-                    const MxSubsurfaceParams* srcparams
-                        = comp->as<MxSubsurfaceParams>();
-                    DiffuseParams params = {};
-                    params.N             = srcparams->N;
-                    ok = result.bsdf.add_bsdf<Diffuse<0>>(cw * srcparams->albedo,
-                                                          params);
-                    break;
-                }
-                case MxSheen::closureid(): {
-                    const MxSheen::Data& params = *comp->as<MxSheen::Data>();
-                    ok = result.bsdf.add_bsdf<MxSheen>(cw, params, -sg.I,
+                break;
+            }
+            case MxDielectric::closureid(): {
+                const MxDielectric::Data& params
+                    = *comp->as<MxDielectric::Data>();
+                ok = result.bsdf.add_bsdf<MxDielectric>(cw, params, -sg.I,
+                                                        sg.backfacing,
+                                                        path_roughness);
+                break;
+            }
+            case MxGeneralizedSchlick::closureid(): {
+                const MxGeneralizedSchlick::Data& params
+                    = *comp->as<MxGeneralizedSchlick::Data>();
+                ok = result.bsdf.add_bsdf<MxGeneralizedSchlick>(
+                    cw, params, -sg.I, sg.backfacing, path_roughness);
+                break;
+            }
+            case MxConductor::closureid(): {
+                const MxConductor::Data& params
+                    = *comp->as<MxConductor::Data>();
+                ok = result.bsdf.add_bsdf<MxConductor>(cw, params, -sg.I,
                                                        sg.backfacing,
                                                        path_roughness);
-                    break;
-                }
-                case MX_LAYER_ID: {
-                    const MxLayerParams* srcparams = comp->as<MxLayerParams>();
-                    Color3 base_w
-                        = weight
-                          * (Color3(1, 1, 1)
-                             - clamp(evaluate_layer_opacity(sg, path_roughness,
-                                                            srcparams->top),
-                                     0.f, 1.f));
-                    closure = srcparams->top;
-                    weight  = cw;
-                    if (!is_black(base_w)) {
-                        ptr_stack[stack_idx]      = srcparams->base;
-                        weight_stack[stack_idx++] = base_w;
-                    }
-                    ok = true;
-                    break;
-                }
-                case MX_ANISOTROPIC_VDF_ID:
-                case MX_MEDIUM_VDF_ID: {
-                    // already processed by process_medium_closure
-                    ok = true;
-                    break;
-                }
-                case SpiThinLayer::closureid(): {
-                    const SpiThinLayer::Data& params
-                        = *comp->as<SpiThinLayer::Data>();
-                    ok = result.bsdf.add_bsdf<SpiThinLayer>(cw, params, -sg.I,
-                                                            path_roughness);
-                    break;
-                }
-                }
+                break;
+            }
+            case MxTranslucent::closureid(): {
+                const MxTranslucent::Data& params
+                    = *comp->as<MxTranslucent::Data>();
+                ok = result.bsdf.add_bsdf<MxTranslucent>(cw, params, -sg.I,
+                                                         sg.backfacing,
+                                                         path_roughness);
+                break;
+            }
+            case MX_TRANSPARENT_ID: {
+                ok = result.bsdf.add_bsdf<Transparent>(cw);
+                break;
+            }
+            case MX_SUBSURFACE_ID: {
+                // TODO: implement BSSRDF support?
+                const MxSubsurfaceParams* srcparams
+                    = comp->as<MxSubsurfaceParams>();
+                DiffuseParams params = {};
+                params.N             = srcparams->N;
+                ok = result.bsdf.add_bsdf<Diffuse<0>>(cw * srcparams->albedo,
+                                                      params);
+                break;
+            }
+            case MxSheen::closureid(): {
+                const MxSheen::Data& params = *comp->as<MxSheen::Data>();
+                ok = result.bsdf.add_bsdf<MxSheen>(cw, params, -sg.I,
+                                                   sg.backfacing,
+                                                   path_roughness);
+                break;
+            }
+            case MX_LAYER_ID: {
+                const MxLayerParams* srcparams = comp->as<MxLayerParams>();
+                Color3 base_w
+                    = weight
+                      * (Color3(1, 1, 1)
+                         - clamp(evaluate_layer_opacity(sg, path_roughness,
+                                                        srcparams->top),
+                                 0.f, 1.f));
+                // Top, then base, ahead of the rest of the list
+                if (!is_black(base_w))
+                    ncomps = flatten_closure_after(flat, ncomps, i,
+                                                   srcparams->base, base_w);
+                ncomps = flatten_closure_after(flat, ncomps, i, srcparams->top,
+                                               cw);
+                ok     = true;
+                break;
+            }
+            case MX_ANISOTROPIC_VDF_ID:
+            case MX_MEDIUM_VDF_ID: {
+                // already processed by process_medium_closure
+                ok = true;
+                break;
+            }
+            case SpiThinLayer::closureid(): {
+                const SpiThinLayer::Data& params
+                    = *comp->as<SpiThinLayer::Data>();
+                ok = result.bsdf.add_bsdf<SpiThinLayer>(cw, params, -sg.I,
+                                                        path_roughness);
+                break;
+            }
+            }
 #ifndef __CUDACC__
-                OSL_ASSERT(ok && "Invalid closure invoked in surface shader");
+            OSL_ASSERT(ok && "Invalid closure invoked in surface shader");
 #else
-                // TODO: We should never get here, but we sometimes do, e.g. in
-                // the render-material-layer test.
-                if (false && !ok)
-                    printf("Invalid closure invoked in surface shader\n");
+            // TODO: We should never get here, but we sometimes do, e.g. in
+            // the render-material-layer test.
+            if (false && !ok)
+                printf("Invalid closure invoked in surface shader\n");
 #endif
-            }
-            break;
-        }
-        }
-        if (closure == nullptr && stack_idx > 0) {
-            closure = ptr_stack[--stack_idx];
-            weight  = weight_stack[stack_idx];
         }
     }
 }
@@ -1621,22 +1623,128 @@ process_background_closure(const ClosureColor* closure)
     return weight;
 }
 
+// The lobes are passed by reference, some of them are big enough that
+// copying them for every call shows up.
 OSL_HOSTDEVICE Color3
 BSDF::get_albedo_vrtl(const Vec3& wo) const
 {
-    return dispatch([&](auto bsdf) { return bsdf.get_albedo(wo); });
+    return dispatch([&](const auto& bsdf) { return bsdf.get_albedo(wo); });
 }
 
 OSL_HOSTDEVICE BSDF::Sample
 BSDF::eval_vrtl(const Vec3& wo, const Vec3& wi) const
 {
-    return dispatch([&](auto bsdf) { return bsdf.eval(wo, wi); });
+    return dispatch([&](const auto& bsdf) { return bsdf.eval(wo, wi); });
 }
 
 OSL_HOSTDEVICE BSDF::Sample
 BSDF::sample_vrtl(const Vec3& wo, float rx, float ry, float rz) const
 {
-    return dispatch([&](auto bsdf) { return bsdf.sample(wo, rx, ry, rz); });
+    return dispatch(
+        [&](const auto& bsdf) { return bsdf.sample(wo, rx, ry, rz); });
+}
+
+OSL_HOSTDEVICE void
+CompositeBSDF::prepare(const Vec3& wo, const Color3& path_weight, bool absorb)
+{
+    float total = 0;
+    for (int i = 0; i < num_bsdfs; i++) {
+        pdfs[i] = weights[i].dot(path_weight * bsdfs[i]->get_albedo_vrtl(wo))
+                  / (path_weight.x + path_weight.y + path_weight.z);
+#ifndef __CUDACC__
+        // TODO: Figure out what to do with weights/albedos with negative
+        //       components (e.g., as might happen when bipolar noise is
+        //       used as a color).
+
+        // The PDF is out-of-range in some test scenes on the CPU path, but
+        // these asserts are no-ops in release builds. The asserts are active
+        // on the CUDA path, so we need to skip them.
+        assert(pdfs[i] >= 0);
+        assert(pdfs[i] <= 1);
+#endif
+        total += pdfs[i];
+    }
+    if ((!absorb && total > 0) || total > 1) {
+        for (int i = 0; i < num_bsdfs; i++) {
+#ifndef __CUDACC__
+            pdfs[i] /= total;
+#else
+            // TODO: This helps avoid NaNs, but it's not clear where the
+            // NaNs are coming from.
+            pdfs[i] = __fdiv_rz(pdfs[i], total);
+#endif
+        }
+    }
+}
+
+OSL_HOSTDEVICE Color3
+CompositeBSDF::get_albedo(const Vec3& wo) const
+{
+    Color3 result(0, 0, 0);
+    for (int i = 0; i < num_bsdfs; i++)
+        result += weights[i] * bsdfs[i]->get_albedo_vrtl(wo);
+    return result;
+}
+
+OSL_HOSTDEVICE BSDF::Sample
+CompositeBSDF::eval(const Vec3& wo, const Vec3& wi) const
+{
+    BSDF::Sample s = {};
+    for (int i = 0; i < num_bsdfs; i++) {
+        BSDF::Sample b = bsdfs[i]->eval_vrtl(wo, wi);
+        b.weight *= weights[i];
+        MIS::update_eval(&s.weight, &s.pdf, b.weight, b.pdf, pdfs[i]);
+        s.roughness += b.roughness * pdfs[i];
+    }
+    return s;
+}
+
+OSL_HOSTDEVICE void
+CompositeBSDF::eval(const Vec3& wo, const Vec3* wi, int n,
+                    BSDF::Sample* out) const
+{
+    for (int k = 0; k < n; k++)
+        out[k] = {};
+    for (int i = 0; i < num_bsdfs; i++) {
+        bsdfs[i]->dispatch([&](const auto& bsdf) {
+            for (int k = 0; k < n; k++) {
+                BSDF::Sample b = bsdf.eval(wo, wi[k]);
+                b.weight *= weights[i];
+                MIS::update_eval(&out[k].weight, &out[k].pdf, b.weight,
+                                 b.pdf, pdfs[i]);
+                out[k].roughness += b.roughness * pdfs[i];
+            }
+        });
+    }
+}
+
+OSL_HOSTDEVICE BSDF::Sample
+CompositeBSDF::sample(const Vec3& wo, float rx, float ry, float rz) const
+{
+    float accum = 0;
+    for (int i = 0; i < num_bsdfs; i++) {
+        if (rx < (pdfs[i] + accum)) {
+            rx = (rx - accum) / pdfs[i];
+            rx = std::min(rx, 0.99999994f);  // keep result in [0,1)
+            BSDF::Sample s = bsdfs[i]->sample_vrtl(wo, rx, ry, rz);
+            s.weight *= weights[i] * (1 / pdfs[i]);
+            s.pdf *= pdfs[i];
+            if (s.pdf == 0.0f)
+                return {};
+            // we sampled PDF i, now figure out how much the other bsdfs contribute to the chosen direction
+            for (int j = 0; j < num_bsdfs; j++) {
+                if (i != j) {
+                    BSDF::Sample b = bsdfs[j]->eval_vrtl(wo, s.wi);
+                    b.weight *= weights[j];
+                    MIS::update_eval(&s.weight, &s.pdf, b.weight, b.pdf,
+                                     pdfs[j]);
+                }
+            }
+            return s;
+        }
+        accum += pdfs[i];
+    }
+    return {};
 }
 
 
@@ -317,88 +317,18 @@ struct BSDF : public AbstractBSDF {
 struct CompositeBSDF {
     OSL_HOSTDEVICE CompositeBSDF() : num_bsdfs(0), num_bytes(0) {}
 
+    // These are defined in shading.cpp, next to the lobes, so that the
+    // switch over the lobe types inlines into their loops over the lobes.
     OSL_HOSTDEVICE void prepare(const Vec3& wo, const Color3& path_weight,
-                                bool absorb)
-    {
-        float total = 0;
-        for (int i = 0; i < num_bsdfs; i++) {
-            pdfs[i] = weights[i].dot(path_weight
-                                     * bsdfs[i]->get_albedo_vrtl(wo))
-                      / (path_weight.x + path_weight.y + path_weight.z);
-#ifndef __CUDACC__
-            // TODO: Figure out what to do with weights/albedos with negative
-            //       components (e.g., as might happen when bipolar noise is
-            //       used as a color).
-
-            // The PDF is out-of-range in some test scenes on the CPU path, but
-            // these asserts are no-ops in release builds. The asserts are active
-            // on the CUDA path, so we need to skip them.
-            assert(pdfs[i] >= 0);
-            assert(pdfs[i] <= 1);
-#endif
-            total += pdfs[i];
-        }
-        if ((!absorb && total > 0) || total > 1) {
-            for (int i = 0; i < num_bsdfs; i++) {
-#ifndef __CUDACC__
-                pdfs[i] /= total;
-#else
-                // TODO: This helps avoid NaNs, but it's not clear where the
-                // NaNs are coming from.
-                pdfs[i] = __fdiv_rz(pdfs[i], total);
-#endif
-            }
-        }
-    }
-
-    OSL_HOSTDEVICE Color3 get_albedo(const Vec3& wo) const
-    {
-        Color3 result(0, 0, 0);
-        for (int i = 0; i < num_bsdfs; i++)
-            result += weights[i] * bsdfs[i]->get_albedo_vrtl(wo);
-        return result;
-    }
-
-    OSL_HOSTDEVICE BSDF::Sample eval(const Vec3& wo, const Vec3& wi) const
-    {
-        BSDF::Sample s = {};
-        for (int i = 0; i < num_bsdfs; i++) {
-            BSDF::Sample b = bsdfs[i]->eval_vrtl(wo, wi);
-            b.weight *= weights[i];
-            MIS::update_eval(&s.weight, &s.pdf, b.weight, b.pdf, pdfs[i]);
-            s.roughness += b.roughness * pdfs[i];
-        }
-        return s;
-    }
-
+                                bool absorb);
+    OSL_HOSTDEVICE Color3 get_albedo(const Vec3& wo) const;
+    OSL_HOSTDEVICE BSDF::Sample eval(const Vec3& wo, const Vec3& wi) const;
     OSL_HOSTDEVICE BSDF::Sample sample(const Vec3& wo, float rx, float ry,
-                                       float rz) const
-    {
-        float accum = 0;
-        for (int i = 0; i < num_bsdfs; i++) {
-            if (rx < (pdfs[i] + accum)) {
-                rx = (rx - accum) / pdfs[i];
-                rx = std::min(rx, 0.99999994f);  // keep result in [0,1)
-                BSDF::Sample s = bsdfs[i]->sample_vrtl(wo, rx, ry, rz);
-                s.weight *= weights[i] * (1 / pdfs[i]);
-                s.pdf *= pdfs[i];
-                if (s.pdf == 0.0f)
-                    return {};
-                // we sampled PDF i, now figure out how much the other bsdfs contribute to the chosen direction
-                for (int j = 0; j < num_bsdfs; j++) {
-                    if (i != j) {
-                        BSDF::Sample b = bsdfs[j]->eval_vrtl(wo, s.wi);
-                        b.weight *= weights[j];
-                        MIS::update_eval(&s.weight, &s.pdf, b.weight, b.pdf,
-                                         pdfs[j]);
-                    }
-                }
-                return s;
-            }
-            accum += pdfs[i];
-        }
-        return {};
-    }
+                                       float rz) const;
+    /// Evaluate n directions at once, as eval() would each of them. Each
+    /// lobe dispatches once and loops over all of the directions.
+    OSL_HOSTDEVICE void eval(const Vec3& wo, const Vec3* wi, int n,
+                             BSDF::Sample* out) const;
 
     template<typename BSDF_Type, typename... BSDF_Args>
     OSL_HOSTDEVICE bool add_bsdf(const Color3& w, BSDF_Args&&... args)
@@ -4,6 +4,10 @@
 
 
 #ifndef __CUDACC__
+#    include <algorithm>
+#    include <atomic>
+#    include <numeric>
+
 #    include <OpenImageIO/filesystem.h>
 #    include <OpenImageIO/parallel.h>
 #    include <OpenImageIO/timer.h>
@@ -297,6 +301,25 @@ SimpleRaytracer::parse_scene_xml(const std::string& scenefile)
         errhandler().severefmt(
             "Error reading scene: Root element <World> is missing");
 
+    // find the .obj models, and parse them all in parallel up front, to be
+    // added in order below
+    auto find_model = [&](const std::string& filename) {
+        std::vector<std::string> searchpath;
+        searchpath.emplace_back(OIIO::Filesystem::parent_path(scenefile));
+        return OIIO::Filesystem::searchpath_find(filename, searchpath, false);
+    };
+    std::vector<std::string> model_files;
+    for (auto node = root.first_child(); node; node = node.next_sibling()) {
+        pugi::xml_attribute filename_attr = node.attribute("filename");
+        if (strcmp(node.name(), "Model") == 0 && filename_attr) {
+            std::string actual_filename = find_model(filename_attr.value());
+            if (!actual_filename.empty())
+                model_files.push_back(actual_filename);
+        }
+    }
+    auto parsed_models = Scene::parse_models(model_files);
+    size_t next_model  = 0;
+
     // loop over all children of world
     for (auto node = root.first_child(); node; node = node.next_sibling()) {
         if (strcmp(node.name(), "Option") == 0) {
@@ -379,20 +402,16 @@ SimpleRaytracer::parse_scene_xml(const std::string& scenefile)
             // load .obj model
             pugi::xml_attribute filename_attr = node.attribute("filename");
             if (filename_attr) {
-                std::string filename = filename_attr.value();
-                std::vector<std::string> searchpath;
-                searchpath.emplace_back(
-                    OIIO::Filesystem::parent_path(scenefile));
-                std::string actual_filename
-                    = OIIO::Filesystem::searchpath_find(filename, searchpath,
-                                                        false);
+                std::string filename        = filename_attr.value();
+                std::string actual_filename = find_model(filename);
                 if (actual_filename.empty()) {
                     errhandler().errorfmt("Unable to find model file {}",
                                           filename);
                 } else {
-                    // we got a valid filename, try to load the model
+                    // we got a valid filename, add the model parsed above
                     scene.add_model(actual_filename, shadermap,
-                                    int(shaders().size() - 1), errhandler());
+                                    int(shaders().size() - 1), errhandler(),
+                                    parsed_models[next_model++].get());
                 }
             }
         } else if (strcmp(node.name(), "Background") == 0) {
@@ -953,6 +972,24 @@ SimpleRaytracer::eval_background(const Dual2<Vec3>& dir, ShadingContext* ctx,
     return process_background_closure((const ClosureColor*)sg.Ci);
 }
 
+// What the background shader gives a ray that hit nothing at the given
+// bounce (unweighted).
+OSL_HOSTDEVICE Color3
+SimpleRaytracer::background_radiance(const Ray& r, float bsdf_pdf, int bounce,
+                                     ShadingContext* ctx)
+{
+    if (backgroundShaderID < 0)
+        return Color3(0, 0, 0);
+    if (bounce > 0 && backgroundResolution > 0) {
+        float bg_pdf = 0;
+        Vec3 bg      = background.eval(r.direction, bg_pdf);
+        return bg
+               * MIS::power_heuristic<MIS::WEIGHT_WEIGHT>(bsdf_pdf, bg_pdf);
+    }
+    // we aren't importance sampling the background - so just run it directly
+    return eval_background(r.direction, ctx, bounce);
+}
+
 Color3
 SimpleRaytracer::subpixel_radiance(float x, float y, Sampler& sampler,
                                    ShadingContext* ctx)
@@ -960,7 +997,6 @@ SimpleRaytracer::subpixel_radiance(float x, float y, Sampler& sampler,
 #ifdef __CUDACC__
     // Scratch space for the output closures
     StackClosurePool closure_pool;
-    StackClosurePool light_closure_pool;
 #endif
 
     constexpr float inf = std::numeric_limits<float>::infinity();
@@ -977,23 +1013,17 @@ SimpleRaytracer::subpixel_radiance(float x, float y, Sampler& sampler,
         Intersection hit = scene.intersect(r, inf, prev_id);
         if (hit.t == inf) {
             // we hit nothing? check background shader
-            if (backgroundShaderID >= 0) {
-                if (b > 0 && backgroundResolution > 0) {
-                    float bg_pdf = 0;
-                    Vec3 bg      = background.eval(r.direction, bg_pdf);
-                    path_radiance
-                        += path_weight * bg
-                           * MIS::power_heuristic<MIS::WEIGHT_WEIGHT>(bsdf_pdf,
-                                                                      bg_pdf);
-                } else {
-                    // we aren't importance sampling the background - so just run it directly
-                    path_radiance += path_weight
-                                     * eval_background(r.direction, ctx, b);
-                }
-            }
+            path_radiance += path_weight
+                             * background_radiance(r, bsdf_pdf, b, ctx);
             break;
         }
 
+#ifdef __CUDACC__
+        // Now that the hit is known, and before setting up its globals, is
+        // the place to regroup threads by the shader they'll run.
+        reorder_for_shading(scene.shaderid(hit.id));
+#endif
+
         // construct a shader globals for the hit point
         globals_from_hit(sg, r, hit.t, hit.id, hit.u, hit.v);
 
@@ -1015,8 +1045,6 @@ SimpleRaytracer::subpixel_radiance(float x, float y, Sampler& sampler,
             break;
         }
 
-        const float radius = r.radius + r.spread * hit.t;
-
         int shaderID = scene.shaderid(hit.id);
 
 #ifndef __CUDACC__
@@ -1035,140 +1063,200 @@ SimpleRaytracer::subpixel_radiance(float x, float y, Sampler& sampler,
         process_closure(sg, r.roughness, result, (const ClosureColor*)sg.Ci,
                         last_bounce);
 
+        if (!continue_path(r, sg, hit, result, b, sampler, path_weight,
+                           path_radiance, bsdf_pdf, prev_id, ctx))
+            break;
+    }
+    return path_radiance;
+}
+
+
+// Having shaded the hit of ray r, add its emission and the direct
+// lighting it receives to path_radiance, then sample its BSDF for the next
+// bounce, updating r and the path state. Returns false if the path ends
+// here.
+OSL_HOSTDEVICE bool
+SimpleRaytracer::continue_path(Ray& r, const ShaderGlobalsType& sg,
+                               const Intersection& hit, ShadingResult& result,
+                               int bounce, Sampler& sampler,
+                               Color3& path_weight, Color3& path_radiance,
+                               float& bsdf_pdf, int& prev_id,
+                               ShadingContext* ctx)
+{
+#ifdef __CUDACC__
+    // Scratch space for the output closures of the light shader
+    StackClosurePool light_closure_pool;
+#endif
+
+    constexpr float inf = std::numeric_limits<float>::infinity();
+    const float radius  = r.radius + r.spread * hit.t;
+    const int shaderID  = scene.shaderid(hit.id);
 #ifndef __CUDACC__
-        const size_t lightprims_size = m_lightprims.size();
+    const size_t lightprims_size = m_lightprims.size();
 #endif
 
-        // add self-emission
-        float k = 1;
-        if (m_shader_is_light[shaderID] && lightprims_size > 0) {
-            const float light_pick_pdf = 1.0f / lightprims_size;
-            // figure out the probability of reaching this point
-            float light_pdf = light_pick_pdf
-                              * scene.shapepdf(hit.id, r.origin, sg.P);
-            k = MIS::power_heuristic<MIS::WEIGHT_EVAL>(bsdf_pdf, light_pdf);
-        }
-        path_radiance += path_weight * k * result.Le;
+    // add self-emission
+    float k = 1;
+    if (m_shader_is_light[shaderID] && lightprims_size > 0) {
+        const float light_pick_pdf = 1.0f / lightprims_size;
+        // figure out the probability of reaching this point
+        float light_pdf = light_pick_pdf
+                          * scene.shapepdf(hit.id, r.origin, sg.P);
+        k = MIS::power_heuristic<MIS::WEIGHT_EVAL>(bsdf_pdf, light_pdf);
+    }
+    path_radiance += path_weight * k * result.Le;
 
-        // last bounce? nothing left to do
-        if (last_bounce)
-            break;
+    // last bounce? nothing left to do
+    if (bounce == max_bounces)
+        return false;
 
-        // build internal pdf for sampling between bsdf closures
-        result.bsdf.prepare(-sg.I, path_weight, b >= rr_depth);
+    // build internal pdf for sampling between bsdf closures
+    result.bsdf.prepare(-sg.I, path_weight, bounce >= rr_depth);
 
-        if (show_albedo_scale > 0) {
-            // Instead of path tracing, just visualize the albedo
-            // of the bsdf. This can be used to validate the accuracy of
-            // the get_albedo method for a particular bsdf.
-            path_radiance += path_weight * result.bsdf.get_albedo(-sg.I)
-                             * show_albedo_scale;
-            break;
-        }
+    if (show_albedo_scale > 0) {
+        // Instead of path tracing, just visualize the albedo
+        // of the bsdf. This can be used to validate the accuracy of
+        // the get_albedo method for a particular bsdf.
+        path_radiance += path_weight * result.bsdf.get_albedo(-sg.I)
+                         * show_albedo_scale;
+        return false;
+    }
 
-        // get three random numbers
-        Vec3 s   = sampler.get();
-        float xi = s.x;
-        float yi = s.y;
-        float zi = s.z;
-
-        // trace one ray to the background
-        if (backgroundResolution > 0) {
-            Dual2<Vec3> bg_dir;
-            float bg_pdf   = 0;
-            Vec3 bg        = background.sample(xi, yi, bg_dir, bg_pdf);
-            BSDF::Sample b = result.bsdf.eval(-sg.I, bg_dir.val());
-            Color3 contrib = path_weight * b.weight * bg
-                             * MIS::power_heuristic<MIS::WEIGHT_WEIGHT>(bg_pdf,
-                                                                        b.pdf);
-            if ((contrib.x + contrib.y + contrib.z) > 0) {
-                ShaderGlobalsType shadow_sg;
-                Ray shadow_ray          = Ray(sg.P, bg_dir.val(), radius, 0, 0,
-                                              Ray::SHADOW);
-                Intersection shadow_hit = scene.intersect(shadow_ray, inf,
-                                                          hit.id);
-                if (shadow_hit.t == inf)  // ray reached the background?
-                    path_radiance += contrib;
-            }
+    // get three random numbers
+    Vec3 s   = sampler.get();
+    float xi = s.x;
+    float yi = s.y;
+    float zi = s.z;
+
+    // pick the directions towards the background and one of the light
+    // emitting primitives (with uniform probability for each light), and
+    // evaluate the bsdf for both at once
+    Vec3 light_wi[2];
+    BSDF::Sample light_eval[2];
+    int nlight_wi = 0;
+
+    Dual2<Vec3> bg_dir;
+    float bg_pdf = 0;
+    Vec3 bg;
+    if (backgroundResolution > 0) {
+        bg                    = background.sample(xi, yi, bg_dir, bg_pdf);
+        light_wi[nlight_wi++] = bg_dir.val();
+    }
+
+    LightSample sample;
+    uint32_t lid   = 0;
+    int sample_idx = -1;
+    if (lightprims_size > 0) {
+        float xl = xi * lightprims_size;
+        int ls   = floorf(xl);
+        xl -= ls;
+
+        lid = m_lightprims[ls];
+        if (lid != hit.id) {
+            // sample a random direction towards the object
+            sample                = scene.sample(lid, sg.P, xl, yi);
+            sample_idx            = nlight_wi;
+            light_wi[nlight_wi++] = sample.dir;
         }
+    }
+    result.bsdf.eval(-sg.I, light_wi, nlight_wi, light_eval);
+
+    // trace one ray to the background
+    if (backgroundResolution > 0) {
+        const BSDF::Sample& b = light_eval[0];
+        Color3 contrib        = path_weight * b.weight * bg
+                         * MIS::power_heuristic<MIS::WEIGHT_WEIGHT>(bg_pdf,
+                                                                    b.pdf);
+        if ((contrib.x + contrib.y + contrib.z) > 0) {
+            ShaderGlobalsType shadow_sg;
+            Ray shadow_ray          = Ray(sg.P, bg_dir.val(), radius, 0, 0,
+                                          Ray::SHADOW);
+            Intersection shadow_hit = scene.intersect(shadow_ray, inf,
+                                                      hit.id);
+            if (shadow_hit.t == inf)  // ray reached the background?
+                path_radiance += contrib;
+        }
+    }
 
-        // trace a shadow ray to one of the light emitting primitives
-        if (lightprims_size > 0) {
-            const float light_pick_pdf = 1.0f / lightprims_size;
-
-            // uniform probability for each light
-            float xl = xi * lightprims_size;
-            int ls   = floorf(xl);
-            xl -= ls;
-
-            uint32_t lid = m_lightprims[ls];
-            if (lid != hit.id) {
-                int shaderID = scene.shaderid(lid);
-
-                // sample a random direction towards the object
-                LightSample sample = scene.sample(lid, sg.P, xl, yi);
-                BSDF::Sample b     = result.bsdf.eval(-sg.I, sample.dir);
-                Color3 contrib     = path_weight * b.weight
-                                 * MIS::power_heuristic<MIS::EVAL_WEIGHT>(
-                                     light_pick_pdf * sample.pdf, b.pdf);
-                if ((contrib.x + contrib.y + contrib.z) > 0) {
-                    ShaderGlobalsType light_sg;
-                    Ray shadow_ray = Ray(sg.P, sample.dir, radius, 0, 0,
-                                         Ray::SHADOW);
-                    // trace a shadow ray and see if we actually hit the target
-                    // in this tiny renderer, tracing a ray is probably cheaper than evaluating the light shader
-                    Intersection shadow_hit
-                        = scene.intersect(shadow_ray, sample.dist, hit.id, lid);
+    // trace a shadow ray to the light emitting primitive
+    if (sample_idx >= 0) {
+        const float light_pick_pdf = 1.0f / lightprims_size;
+        int shaderID               = scene.shaderid(lid);
+
+        const BSDF::Sample& b = light_eval[sample_idx];
+        Color3 contrib        = path_weight * b.weight
+                         * MIS::power_heuristic<MIS::EVAL_WEIGHT>(
+                             light_pick_pdf * sample.pdf, b.pdf);
+        if ((contrib.x + contrib.y + contrib.z) > 0) {
+            ShaderGlobalsType light_sg;
+            Ray shadow_ray = Ray(sg.P, sample.dir, radius, 0, 0, Ray::SHADOW);
+            // trace a shadow ray and see if we actually hit the target
+            // in this tiny renderer, tracing a ray is probably cheaper than evaluating the light shader
+            Intersection shadow_hit = scene.intersect(shadow_ray, sample.dist,
+                                                      hit.id, lid);
 
 #ifndef __CUDACC__
-                    const bool did_hit = shadow_hit.t == sample.dist;
+            const bool did_hit = shadow_hit.t == sample.dist;
 #else
-                    // The hit distance on the device is not as precise as on
-                    // the CPU, so we need to allow a little wiggle room. An
-                    // epsilon of 1e-3f empirically gives results that closely
-                    // match the CPU for the test scenes, so that's what we're
-                    // using.
-                    const bool did_hit = fabsf(shadow_hit.t - sample.dist)
-                                         < 1e-3f;
+            // The hit distance on the device is not as precise as on
+            // the CPU, so we need to allow a little wiggle room. An
+            // epsilon of 1e-3f empirically gives results that closely
+            // match the CPU for the test scenes, so that's what we're
+            // using.
+            const bool did_hit = fabsf(shadow_hit.t - sample.dist) < 1e-3f;
 #endif
-                    if (did_hit) {
-                        // setup a shader global for the point on the light
-                        globals_from_hit(light_sg, shadow_ray, sample.dist, lid,
-                                         sample.u, sample.v);
+            if (did_hit) {
+                // setup a shader global for the point on the light
+                globals_from_hit(light_sg, shadow_ray, sample.dist, lid,
+                                 sample.u, sample.v);
 #ifndef __CUDACC__
-                        // execute the light shader (for emissive closures only)
-                        shadingsys->execute(*ctx, *m_shaders[shaderID].surf,
-                                            light_sg);
+                // execute the light shader (for emissive closures only)
+                shadingsys->execute(*ctx, *m_shaders[shaderID].surf,
+                                    light_sg);
 #else
-                        execute_shader(light_sg, shaderID, light_closure_pool);
+                execute_shader(light_sg, shaderID, light_closure_pool);
 #endif
-                        ShadingResult light_result;
-                        process_closure(light_sg, r.roughness, light_result,
-                                        (const ClosureColor*)light_sg.Ci, true);
-                        // accumulate contribution
-                        path_radiance += contrib * light_result.Le;
-                    }
-                }
+                ShadingResult light_result;
+                process_closure(light_sg, r.roughness, light_result,
+                                (const ClosureColor*)light_sg.Ci, true);
+                // accumulate contribution
+                path_radiance += contrib * light_result.Le;
             }
         }
-
-        // trace indirect ray and continue
-        BSDF::Sample p = result.bsdf.sample(-sg.I, xi, yi, zi);
-        path_weight *= p.weight;
-        bsdf_pdf  = p.pdf;
-        r.raytype = Ray::DIFFUSE;  // FIXME? Use DIFFUSE for all indiirect rays
-        r.direction = p.wi;
-        r.radius    = radius;
-        // Just simply use roughness as spread slope
-        r.spread    = std::max(r.spread, p.roughness);
-        r.roughness = p.roughness;
-        if (!(path_weight.x > 0) && !(path_weight.y > 0)
-            && !(path_weight.z > 0))
-            break;  // filter out all 0's or NaNs
-        prev_id  = hit.id;
-        r.origin = sg.P;
     }
-    return path_radiance;
+
+    // trace indirect ray and continue
+    BSDF::Sample p = result.bsdf.sample(-sg.I, xi, yi, zi);
+    path_weight *= p.weight;
+    bsdf_pdf  = p.pdf;
+    r.raytype = Ray::DIFFUSE;  // FIXME? Use DIFFUSE for all indiirect rays
+    r.direction = p.wi;
+    r.radius    = radius;
+    // Just simply use roughness as spread slope
+    r.spread    = std::max(r.spread, p.roughness);
+    r.roughness = p.roughness;
+    if (!(path_weight.x > 0) && !(path_weight.y > 0)
+        && !(path_weight.z > 0))
+        return false;  // filter out all 0's or NaNs
+    prev_id  = hit.id;
+    r.origin = sg.P;
+    return true;
+}
+
+
+OSL_HOSTDEVICE Color3
+SimpleRaytracer::pixel_sample(int x, int y, int si, ShadingContext* ctx)
+{
+    Sampler sampler(x, y, si);
+    // jitter pixel coordinate [0,1)^2
+    Vec3 j = no_jitter ? Vec3(0.5f, 0.5f, 0) : sampler.get();
+    // warp distribution to approximate a tent filter [-1,+1)^2
+    j.x *= 2;
+    j.x = j.x < 1 ? sqrtf(j.x) - 1 : 1 - sqrtf(2 - j.x);
+    j.y *= 2;
+    j.y = j.y < 1 ? sqrtf(j.y) - 1 : 1 - sqrtf(2 - j.y);
+    // trace eye ray (apply jitter from center of the pixel)
+    return subpixel_radiance(x + 0.5f + j.x, y + 0.5f + j.y, sampler, ctx);
 }
 
 
@@ -1177,17 +1265,7 @@ SimpleRaytracer::antialias_pixel(int x, int y, ShadingContext* ctx)
 {
     Color3 result(0, 0, 0);
     for (int si = 0, n = aa * aa; si < n; si++) {
-        Sampler sampler(x, y, si);
-        // jitter pixel coordinate [0,1)^2
-        Vec3 j = no_jitter ? Vec3(0.5f, 0.5f, 0) : sampler.get();
-        // warp distribution to approximate a tent filter [-1,+1)^2
-        j.x *= 2;
-        j.x = j.x < 1 ? sqrtf(j.x) - 1 : 1 - sqrtf(2 - j.x);
-        j.y *= 2;
-        j.y = j.y < 1 ? sqrtf(j.y) - 1 : 1 - sqrtf(2 - j.y);
-        // trace eye ray (apply jitter from center of the pixel)
-        Color3 r = subpixel_radiance(x + 0.5f + j.x, y + 0.5f + j.y, sampler,
-                                     ctx);
+        Color3 r = pixel_sample(x, y, si, ctx);
         // mix in result via lerp for numerical stability
         result = OIIO::lerp(result, r, 1.0f / (si + 1));
     }
@@ -1200,12 +1278,28 @@ void
 SimpleRaytracer::prepare_render()
 {
     // Retrieve and validate options
-    aa                = std::max(1, options.get_int("aa"));
-    no_jitter         = options.get_int("no_jitter") != 0;
-    max_bounces       = options.get_int("max_bounces");
-    rr_depth          = options.get_int("rr_depth");
-    show_albedo_scale = options.get_float("show_albedo_scale");
-    show_globals      = options.get_int("show_globals");
+    aa                 = std::max(1, options.get_int("aa"));
+    no_jitter          = options.get_int("no_jitter") != 0;
+    max_bounces        = options.get_int("max_bounces");
+    rr_depth           = options.get_int("rr_depth");
+    show_albedo_scale  = options.get_float("show_albedo_scale");
+    show_globals       = options.get_int("show_globals");
+    batch_size         = options.get_int("batch_size");
+    adaptive_threshold = options.get_float("adaptive_threshold");
+
+#    if OSL_USE_BATCHED
+    // The wavefront mode is for path tracing, not the visualizations
+    if (show_globals)
+        batch_size = 0;
+    if (batch_size == 16)
+        m_batched_16.reset(new BatchedSimpleRaytracer<16>(*this));
+    else if (batch_size == 8)
+        m_batched_8.reset(new BatchedSimpleRaytracer<8>(*this));
+    else
+        batch_size = 0;
+#    else
+    batch_size = 0;
+#    endif
 
     // prepare background importance table (if requested)
     if (backgroundResolution > 0 && backgroundShaderID >= 0) {
@@ -1217,7 +1311,8 @@ SimpleRaytracer::prepare_render()
         auto evaler = [this](const Dual2<Vec3>& dir, ShadingContext* ctx) {
             return this->eval_background(dir, ctx);
         };
-        background.prepare(backgroundResolution, evaler, ctx);
+        background.prepare(backgroundResolution, evaler, ctx,
+                           options.get_int("alias_sampling") != 0);
 
         // release context
         shadingsys->release_context(ctx);
@@ -1230,7 +1325,7 @@ SimpleRaytracer::prepare_render()
     prepare_geometry();
 
     // build bvh and prepare triangles
-    scene.prepare(errhandler());
+    scene.prepare(errhandler(), options.get_int("bvh_width", 2));
     prepare_lights();
 
 #    if 0
@@ -1399,40 +1494,319 @@ SimpleRaytracer::prepare_geometry()
     }
 }
 
+int
+SimpleRaytracer::render_tile(const OIIO::ROI& roi, ShadingContext* ctx)
+{
+    const int nsamples = aa * aa;
+#    if OSL_USE_BATCHED
+    if (batch_size == 16) {
+        render_wavefront<16>(roi, ctx);
+        return int(roi.npixels()) * nsamples;
+    }
+    if (batch_size == 8) {
+        render_wavefront<8>(roi, ctx);
+        return int(roi.npixels()) * nsamples;
+    }
+#    endif
+    if (!(adaptive_threshold > 0)) {
+        OIIO::ImageBuf::Iterator<float> p(pixelbuf, roi);
+        for (; !p.done(); ++p) {
+            Color3 c = antialias_pixel(p.x(), p.y(), ctx);
+            p[0]     = c.x;
+            p[1]     = c.y;
+            p[2]     = c.z;
+        }
+        return int(roi.npixels()) * nsamples;
+    }
+
+    // Adaptive sampling: take the samples a pass (one per pixel) at a
+    // time, keeping the running mean and variance of each pixel's
+    // luminance, and stop once the standard error of every pixel's mean is
+    // below the threshold (relative to the mean).
+    const int npixels    = int(roi.npixels());
+    const int minsamples = std::min(nsamples, std::max(4, nsamples / 8));
+    std::vector<Color3> color(npixels, Color3(0, 0, 0));
+    std::vector<float> mean(npixels, 0.0f), m2(npixels, 0.0f);
+    int si = 0;
+    while (si < nsamples) {
+        for (int y = roi.ybegin, i = 0; y < roi.yend; y++) {
+            for (int x = roi.xbegin; x < roi.xend; x++, i++) {
+                Color3 c    = pixel_sample(x, y, si, ctx);
+                color[i]    = OIIO::lerp(color[i], c, 1.0f / (si + 1));
+                float lum   = (c.x + c.y + c.z) * (1.0f / 3);
+                float delta = lum - mean[i];
+                mean[i] += delta / (si + 1);
+                m2[i] += delta * (lum - mean[i]);
+            }
+        }
+        ++si;
+        if (si < minsamples || si == nsamples)
+            continue;
+        bool converged = true;
+        for (int i = 0; i < npixels && converged; i++) {
+            float stderr2 = m2[i] / ((si - 1) * si);
+            float bound   = adaptive_threshold * std::max(mean[i], 1e-3f);
+            converged     = stderr2 <= bound * bound;
+        }
+        if (converged)
+            break;
+    }
+    OIIO::ImageBuf::Iterator<float> p(pixelbuf, roi);
+    for (int i = 0; !p.done(); ++p, ++i) {
+        p[0] = color[i].x;
+        p[1] = color[i].y;
+        p[2] = color[i].z;
+    }
+    return npixels * si;
+}
+
+
+
 void
 SimpleRaytracer::render(int xres, int yres)
 {
     OIIO::Timer timer;
     ShadingSystem* shadingsys = this->shadingsys;
-    OIIO::parallel_for_chunked(
-        0, yres, 0, [&, this](int64_t ybegin, int64_t yend) {
-            // Request an OSL::PerThreadInfo for this thread.
-            OSL::PerThreadInfo* thread_info = shadingsys->create_thread_info();
-
-            // Request a shading context so that we can execute the shader.
-            // We could get_context/release_context for each shading point,
-            // but to save overhead, it's more efficient to reuse a context
-            // within a thread.
-            ShadingContext* ctx = shadingsys->get_context(thread_info);
-
-            OIIO::ImageBuf::Iterator<float> p(pixelbuf,
-                                              OIIO::ROI(0, xres, ybegin, yend));
-            for (; !p.done(); ++p) {
-                Color3 c = antialias_pixel(p.x(), p.y(), ctx);
-                p[0]     = c.x;
-                p[1]     = c.y;
-                p[2]     = c.z;
-            }
 
-            // We're done shading with this context.
-            shadingsys->release_context(ctx);
-            shadingsys->destroy_thread_info(thread_info);
-        });
+    // Split the image into tiles, which the threads take from a shared
+    // queue (in scanline order) as they finish their last one, so that
+    // expensive or slowly converging tiles don't hold up the rest.
+    const int tiles_x = (xres + tile_size - 1) / tile_size;
+    const int tiles_y = (yres + tile_size - 1) / tile_size;
+    const int ntiles  = tiles_x * tiles_y;
+    std::vector<int> tile_samples(ntiles);
+    std::vector<double> tile_time(ntiles);
+    std::atomic<int> next_tile(0);
+    const int nworkers = std::max(
+        1, std::min(ntiles, OIIO::default_thread_pool()->size() + 1));
+    OIIO::parallel_for(int64_t(0), int64_t(nworkers), [&, this](int64_t) {
+        // Request an OSL::PerThreadInfo for this thread.
+        OSL::PerThreadInfo* thread_info = shadingsys->create_thread_info();
+
+        // Request a shading context so that we can execute the shader.
+        // We could get_context/release_context for each shading point,
+        // but to save overhead, it's more efficient to reuse a context
+        // within a thread.
+        ShadingContext* ctx = shadingsys->get_context(thread_info);
+
+        for (int t; (t = next_tile++) < ntiles;) {
+            OIIO::Timer tile_timer;
+            int x = (t % tiles_x) * tile_size;
+            int y = (t / tiles_x) * tile_size;
+            OIIO::ROI roi(x, std::min(x + tile_size, xres), y,
+                          std::min(y + tile_size, yres));
+            tile_samples[t] = render_tile(roi, ctx);
+            tile_time[t]    = tile_timer();
+        }
+
+        // We're done shading with this context.
+        shadingsys->release_context(ctx);
+        shadingsys->destroy_thread_info(thread_info);
+    });
     double rendertime = timer();
     errhandler().infofmt("Rendered {}x{} image with {} samples in {}", xres,
                          yres, aa * aa,
                          OIIO::Strutil::timeintervalformat(rendertime, 2));
+
+    // Tile stats
+    int64_t total_samples = 0;
+    int stopped_early     = 0;
+    for (int t = 0; t < ntiles; t++) {
+        int x = (t % tiles_x) * tile_size, y = (t / tiles_x) * tile_size;
+        int npixels = (std::min(x + tile_size, xres) - x)
+                      * (std::min(y + tile_size, yres) - y);
+        total_samples += tile_samples[t];
+        stopped_early += tile_samples[t] < npixels * aa * aa;
+    }
+    auto minmax = std::minmax_element(tile_time.begin(), tile_time.end());
+    errhandler().infofmt(
+        "  {} tiles of {}x{}: {} samples ({:.1f} per pixel), {} stopped early",
+        ntiles, tile_size, tile_size, total_samples,
+        double(total_samples) / (double(xres) * yres), stopped_early);
+    errhandler().infofmt("  Time per tile: {} to {}, {} on average",
+                         OIIO::Strutil::timeintervalformat(*minmax.first, 2),
+                         OIIO::Strutil::timeintervalformat(*minmax.second, 2),
+                         OIIO::Strutil::timeintervalformat(
+                             std::accumulate(tile_time.begin(),
+                                             tile_time.end(), 0.0)
+                                 / ntiles,
+                             2));
+}
+
+
+
+#    if OSL_USE_BATCHED
+namespace {
+
+// A path of the wavefront, between bounces
+struct WavefrontPath {
+    WavefrontPath(const Ray& r, const Sampler& sampler)
+        : r(r), sampler(sampler)
+    {
+    }
+
+    Ray r;
+    Sampler sampler;
+    Color3 path_weight   = Color3(1, 1, 1);
+    Color3 path_radiance = Color3(0, 0, 0);
+    float bsdf_pdf       = std::numeric_limits<float>::infinity();
+    int prev_id          = -1;
+    Intersection hit;
+    int shaderID = -1;
+};
+
+template<int WidthT>
+void
+globals_to_batch(const ShaderGlobals& sg, int lane,
+                 VaryingShaderGlobals<WidthT>& vsg)
+{
+    vsg.P[lane]              = sg.P;
+    vsg.dPdx[lane]           = sg.dPdx;
+    vsg.dPdy[lane]           = sg.dPdy;
+    vsg.dPdz[lane]           = sg.dPdz;
+    vsg.I[lane]              = sg.I;
+    vsg.dIdx[lane]           = sg.dIdx;
+    vsg.dIdy[lane]           = sg.dIdy;
+    vsg.N[lane]              = sg.N;
+    vsg.Ng[lane]             = sg.Ng;
+    vsg.u[lane]              = sg.u;
+    vsg.dudx[lane]           = sg.dudx;
+    vsg.dudy[lane]           = sg.dudy;
+    vsg.v[lane]              = sg.v;
+    vsg.dvdx[lane]           = sg.dvdx;
+    vsg.dvdy[lane]           = sg.dvdy;
+    vsg.dPdu[lane]           = sg.dPdu;
+    vsg.dPdv[lane]           = sg.dPdv;
+    vsg.time[lane]           = sg.time;
+    vsg.dtime[lane]          = sg.dtime;
+    vsg.dPdtime[lane]        = sg.dPdtime;
+    vsg.Ps[lane]             = sg.Ps;
+    vsg.dPsdx[lane]          = sg.dPsdx;
+    vsg.dPsdy[lane]          = sg.dPsdy;
+    vsg.object2common[lane]  = sg.object2common;
+    vsg.shader2common[lane]  = sg.shader2common;
+    vsg.Ci[lane]             = nullptr;
+    vsg.surfacearea[lane]    = sg.surfacearea;
+    vsg.flipHandedness[lane] = sg.flipHandedness;
+    vsg.backfacing[lane]     = sg.backfacing;
+}
+
+}  // namespace
+
+
+
+// Render the tile as a wavefront: the paths of all of its samples go a
+// bounce at a time, and the hits of each bounce are sorted by shader and
+// shaded WidthT at a time with the batched interface.
+template<int WidthT>
+void
+SimpleRaytracer::render_wavefront(const OIIO::ROI& roi, ShadingContext* ctx)
+{
+    constexpr float inf = std::numeric_limits<float>::infinity();
+    const int nsamples  = aa * aa;
+    std::vector<WavefrontPath> paths;
+    paths.reserve(size_t(roi.npixels()) * nsamples);
+    for (int y = roi.ybegin; y < roi.yend; y++) {
+        for (int x = roi.xbegin; x < roi.xend; x++) {
+            for (int si = 0; si < nsamples; si++) {
+                // jitter and warp as in antialias_pixel()
+                Sampler sampler(x, y, si);
+                Vec3 j = no_jitter ? Vec3(0.5f, 0.5f, 0) : sampler.get();
+                j.x *= 2;
+                j.x = j.x < 1 ? sqrtf(j.x) - 1 : 1 - sqrtf(2 - j.x);
+                j.y *= 2;
+                j.y = j.y < 1 ? sqrtf(j.y) - 1 : 1 - sqrtf(2 - j.y);
+                paths.emplace_back(camera.get(x + 0.5f + j.x, y + 0.5f + j.y),
+                                   sampler);
+            }
+        }
+    }
+
+    std::vector<unsigned> active(paths.size()), shade;
+    std::iota(active.begin(), active.end(), 0u);
+    std::unique_ptr<BatchedShaderGlobals<WidthT>> bsg(
+        new BatchedShaderGlobals<WidthT>);
+    ShaderGlobals sg[WidthT];
+    for (int b = 0; b <= max_bounces && active.size(); b++) {
+        // trace all the rays against the scene
+        shade.clear();
+        for (unsigned i : active) {
+            WavefrontPath& p = paths[i];
+            p.hit            = scene.intersect(p.r, inf, p.prev_id);
+            if (p.hit.t == inf) {
+                p.path_radiance += p.path_weight
+                                   * background_radiance(p.r, p.bsdf_pdf, b,
+                                                         ctx);
+                continue;
+            }
+            p.shaderID = scene.shaderid(p.hit.id);
+            if (p.shaderID < 0 || !m_shaders[p.shaderID].surf)
+                continue;  // no shader attached? done
+            shade.push_back(i);
+        }
+
+        // shade the hits of each shader together, WidthT at a time (all the
+        // rays of a bounce have the same raytype)
+        std::stable_sort(shade.begin(), shade.end(),
+                         [&](unsigned a, unsigned c) {
+                             return paths[a].shaderID < paths[c].shaderID;
+                         });
+        active.clear();
+        const bool last_bounce = b == max_bounces;
+        for (size_t begin = 0; begin < shade.size();) {
+            const int shaderID = paths[shade[begin]].shaderID;
+            int n              = 0;
+            while (n < WidthT && begin + n < shade.size()
+                   && paths[shade[begin + n]].shaderID == shaderID)
+                n++;
+
+            memset((char*)&bsg->uniform, 0, sizeof(UniformShaderGlobals));
+            bsg->uniform.raytype = paths[shade[begin]].r.raytype;
+            Block<int, WidthT> shadeindex;
+            for (int lane = 0; lane < n; lane++) {
+                const WavefrontPath& p = paths[shade[begin + lane]];
+                globals_from_hit(sg[lane], p.r, p.hit.t, p.hit.id, p.hit.u,
+                                 p.hit.v);
+                globals_to_batch(sg[lane], lane, bsg->varying);
+                shadeindex[lane] = lane;
+            }
+            shadingsys->batched<WidthT>().execute(*ctx,
+                                                  *m_shaders[shaderID].surf, n,
+                                                  shadeindex, *bsg, nullptr,
+                                                  nullptr);
+
+            // The closures only last until the next execute on ctx (as for
+            // a light shader in continue_path()), so process them all first.
+            ShadingResult results[WidthT];
+            for (int lane = 0; lane < n; lane++) {
+                const WavefrontPath& p = paths[shade[begin + lane]];
+                sg[lane].Ci            = bsg->varying.Ci[lane];
+                process_closure(sg[lane], p.r.roughness, results[lane],
+                                (const ClosureColor*)sg[lane].Ci, last_bounce);
+            }
+            for (int lane = 0; lane < n; lane++) {
+                WavefrontPath& p = paths[shade[begin + lane]];
+                if (continue_path(p.r, sg[lane], p.hit, results[lane], b,
+                                  p.sampler, p.path_weight, p.path_radiance,
+                                  p.bsdf_pdf, p.prev_id, ctx))
+                    active.push_back(shade[begin + lane]);
+            }
+            begin += n;
+        }
+    }
+
+    // mix the samples of each pixel as antialias_pixel() does
+    OIIO::ImageBuf::Iterator<float> p(pixelbuf, roi);
+    for (size_t i = 0; !p.done(); ++p) {
+        Color3 c(0, 0, 0);
+        for (int si = 0; si < nsamples; si++, i++)
+            c = OIIO::lerp(c, paths[i].path_radiance, 1.0f / (si + 1));
+        p[0] = c.x;
+        p[1] = c.y;
+        p[2] = c.z;
+    }
 }
+#    endif
 
 
 
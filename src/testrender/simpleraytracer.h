@@ -15,10 +15,15 @@
 #include "background.h"
 #include "raytracer.h"
 #include "sampling.h"
+#if OSL_USE_BATCHED
+#    include "batched_raytracer.h"
+#endif
 
 
 OSL_NAMESPACE_BEGIN
 
+struct ShadingResult;
+
 struct Material {
     ShaderGroupRef surf;
     ShaderGroupRef disp;
@@ -52,6 +57,16 @@ public:
                        TypeDesc type, ustringhash name, void* val) override;
     bool get_userdata(bool derivatives, ustringhash name, TypeDesc type,
                       ShaderGlobals* sg, void* val) override;
+#if OSL_USE_BATCHED
+    BatchedRendererServices<16>* batched(WidthOf<16>) override
+    {
+        return m_batched_16.get();
+    }
+    BatchedRendererServices<8>* batched(WidthOf<8>) override
+    {
+        return m_batched_8.get();
+    }
+#endif
 
     void name_transform(const char* name, const Transformation& xform);
 
@@ -129,6 +144,10 @@ private:
     int rr_depth             = 5;
     float show_albedo_scale  = 0.0f;
     int show_globals         = 0;
+    int batch_size           = 0;     // Wavefront batch width, or 0
+    float adaptive_threshold = 0.0f;  // Adaptive sampling relative error
+
+    static constexpr int tile_size = 16;
     MaterialVec m_shaders;
     std::vector<bool> m_shader_is_light;
     std::vector<float>
@@ -194,9 +213,26 @@ private:
                           const Dual2<float>& t, int id, float u, float v);
     Vec3 eval_background(const Dual2<Vec3>& dir, ShadingContext* ctx,
                          int bounce = -1);
+    Color3 background_radiance(const Ray& r, float bsdf_pdf, int bounce,
+                               ShadingContext* ctx);
     Color3 subpixel_radiance(float x, float y, Sampler& sampler,
                              ShadingContext* ctx);
+    bool continue_path(Ray& r, const ShaderGlobals& sg,
+                       const Intersection& hit, ShadingResult& result,
+                       int bounce, Sampler& sampler, Color3& path_weight,
+                       Color3& path_radiance, float& bsdf_pdf, int& prev_id,
+                       ShadingContext* ctx);
+    Color3 pixel_sample(int x, int y, int si, ShadingContext* ctx);
     Color3 antialias_pixel(int x, int y, ShadingContext* ctx);
+    // Render a tile, returning how many samples it took
+    int render_tile(const OIIO::ROI& roi, ShadingContext* ctx);
+#if OSL_USE_BATCHED
+    template<int WidthT>
+    void render_wavefront(const OIIO::ROI& roi, ShadingContext* ctx);
+
+    std::unique_ptr<BatchedSimpleRaytracer<16>> m_batched_16;
+    std::unique_ptr<BatchedSimpleRaytracer<8>> m_batched_8;
+#endif
 
     friend class ErrorHandler;
 };
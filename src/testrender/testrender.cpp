@@ -39,6 +39,7 @@ static bool debug2               = false;
 static bool verbose              = false;
 static bool runstats             = false;
 static bool saveptx              = false;
+static bool reorder              = false;
 static bool warmup               = false;
 static bool profile              = false;
 static bool O0 = false, O1 = false, O2 = false;
@@ -50,12 +51,17 @@ static std::string extraoptions;
 static std::string texoptions;
 static int xres = 640, yres = 480;
 static int aa = 1, max_bounces = 1000000, rr_depth = 5;
-static bool no_jitter          = false;
-static float show_albedo_scale = 0.0f;
-static int show_globals        = 0;
-static int num_threads         = 0;
-static int iters               = 1;
+static bool no_jitter           = false;
+static float show_albedo_scale  = 0.0f;
+static int show_globals         = 0;
+static int num_threads          = 0;
+static int bvh_width            = 2;
+static bool batched             = false;
+static float adaptive_threshold = 0.0f;
+static bool alias_sampling      = false;
+static int iters                = 1;
 static std::string scenefile, imagefile;
+static std::string stats_json;
 static std::string shaderpath;
 static bool shadingsys_options_set = false;
 static bool use_optix              = OIIO::Strutil::stoi(
@@ -164,8 +170,13 @@ getargs(int argc, const char* argv[])
       .hidden(); // DEPRECATED 1.7
     ap.arg("--profile", &profile)
       .help("Print profile information");
+    ap.arg("--stats_json %s:FILE", &stats_json)
+      .help("Write the time of each stage, and the shading system statistics, to FILE as JSON");
     ap.arg("--saveptx", &saveptx)
       .help("Save the generated PTX (OptiX mode only)");
+    ap.arg("--reorder", &reorder)
+      .help("Regroup shading threads by shader with Shader Execution "
+            "Reordering (OptiX 8+ only)");
     ap.arg("--warmup", &warmup)
       .help("Perform a warmup launch");
     ap.arg("--res %d:W %d:H", &xres, &yres)
@@ -193,6 +204,14 @@ getargs(int argc, const char* argv[])
     ap.arg("-uvs")
       .help("Visualize the texture coordinates instead of path tracing")
       .action([&](cspan<const char*> argv) { show_globals = 5; });
+    ap.arg("--adaptive %f:THRESH", &adaptive_threshold)
+      .help("Stop sampling a tile once the error of its pixels is below THRESH, relative to their value (default 0: take all samples)");
+    ap.arg("--alias_sampling", &alias_sampling)
+      .help("Importance sample the background with alias tables, in constant time, instead of searching its CDFs (CPU only)");
+    ap.arg("--batched", &batched)
+      .help("Trace paths as wavefronts and shade them in batches (CPU only)");
+    ap.arg("--bvh_width %d:N", &bvh_width)
+      .help("Children per BVH node: 2, or 4 or 8 to traverse with SIMD (CPU only)");
     ap.arg("--iters %d:N", &iters)
       .help("Number of iterations");
     ap.arg("-O0", &O0)
@@ -240,6 +259,30 @@ getargs(int argc, const char* argv[])
     }
 }
 
+
+
+
+// Write the time of each stage of the render and the shading system's
+// statistics to a JSON file, for tracking performance over time.
+static void
+write_stats_json(const std::string& filename,
+                 cspan<std::pair<const char*, double>> stages)
+{
+    std::string json = "{\n  \"tool\": \"testrender\",\n  \"stages\": {";
+    for (size_t i = 0; i < stages.size(); ++i)
+        json += fmtformat("{}\n    \"{}\": {}", i ? "," : "",
+                          stages[i].first, stages[i].second);
+    json += "\n  },\n  \"shadingsys\": ";
+    const char* stats = nullptr;
+    if (shadingsys->getattribute("stat:json", TypeDesc::STRING, &stats))
+        json += OIIO::Strutil::strip(stats);
+    else
+        json += "{}";
+    json += "\n}\n";
+    if (!OIIO::Filesystem::write_text_file(filename, json))
+        std::cerr << "testrender: Unable to write " << filename << "\n";
+}
+
 }  // anonymous namespace
 
 
@@ -293,10 +336,14 @@ main(int argc, const char* argv[])
     rend->attribute("no_jitter", (int)no_jitter);
     rend->attribute("show_albedo_scale", show_albedo_scale);
     rend->attribute("show_globals", show_globals);
+    rend->attribute("bvh_width", bvh_width);
+    rend->attribute("adaptive_threshold", adaptive_threshold);
+    rend->attribute("alias_sampling", (int)alias_sampling);
     OIIO::attribute("threads", num_threads);
 
 #if OSL_USE_OPTIX
     rend->attribute("saveptx", (int)saveptx);
+    rend->attribute("reorder", (int)reorder);
     rend->attribute("no_rend_lib_bitcode", (int)optix_no_rend_lib_bitcode);
 #endif
 
@@ -316,6 +363,22 @@ main(int argc, const char* argv[])
     // Setup common attributes
     set_shadingsys_options();
 
+    // The wavefront mode shades with the widest batches the hardware and
+    // the library support
+    int batch_size = 0;
+#if OSL_USE_BATCHED
+    if (batched && !use_optix) {
+        if (shadingsys->configure_batch_execution_at(16))
+            batch_size = 16;
+        else if (shadingsys->configure_batch_execution_at(8))
+            batch_size = 8;
+        else
+            rend->errhandler().warningfmt(
+                "Batched execution isn't supported here, shading one point at a time");
+    }
+#endif
+    rend->attribute("batch_size", batch_size);
+
 #if OSL_USE_OPTIX
     if (use_optix)
         reinterpret_cast<OptixRaytracer*>(rend)->synch_attributes();
@@ -324,12 +387,14 @@ main(int argc, const char* argv[])
     // Loads a scene, creating camera, geometry and assigning shaders
     rend->camera.resolution(xres, yres);
     rend->parse_scene_xml(scenefile);
+    double loadtime = timer.lap();
 
     rend->prepare_render();
 
     rend->pixelbuf.reset(ImageSpec(xres, yres, 3, TypeDesc::FLOAT));
 
-    double setuptime = timer.lap();
+    double preparetime = timer.lap();
+    double setuptime   = loadtime + preparetime;
 
     if (warmup)
         rend->warmup();
@@ -378,6 +443,15 @@ main(int argc, const char* argv[])
         std::cout << ustring::getstats() << "\n";
     }
 
+    if (stats_json.size()) {
+        std::pair<const char*, double> stages[] = { { "load", loadtime },
+                                                    { "prepare", preparetime },
+                                                    { "warmup", warmuptime },
+                                                    { "run", runtime },
+                                                    { "write", writetime } };
+        write_stats_json(stats_json, stages);
+    }
+
     // We're done with the shading system now, destroy it
     rend->clear();
     delete shadingsys;
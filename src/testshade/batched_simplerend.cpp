@@ -215,6 +215,21 @@ BatchedSimpleRenderer<WidthT>::get_matrix(BatchedShaderGlobals* /*bsg*/,
 
 
 
+template<int WidthT>
+bool
+BatchedSimpleRenderer<WidthT>::get_matrix_uniform(
+    BatchedShaderGlobals* /*bsg*/, Matrix44& result, ustringhash from,
+    float /*time*/)
+{
+    auto found = m_sr.m_named_xforms.find(from);
+    if (found == m_sr.m_named_xforms.end())
+        return false;
+    result = *(found->second);
+    return true;
+}
+
+
+
 template<int WidthT>
 typename BatchedSimpleRenderer<WidthT>::Mask
 BatchedSimpleRenderer<WidthT>::get_matrix(BatchedShaderGlobals* /*bsg*/,
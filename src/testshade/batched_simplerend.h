@@ -42,6 +42,9 @@ public:
                     Wide<const ustringhash> from,
                     Wide<const float> time) override;
     bool is_overridden_get_matrix_WmWsWf() const override { return true; }
+    bool get_matrix_uniform(BatchedShaderGlobals* bsg, Matrix44& result,
+                            ustringhash from, float time) override;
+    bool is_overridden_get_matrix_uniform() const override { return true; }
 
 private:
     template<typename RAccessorT>
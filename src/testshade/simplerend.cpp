@@ -277,6 +277,8 @@ SimpleRenderer::supports(string_view feature) const
         return true;
     else if (m_use_rs_bitcode && feature == "build_interpolated_getter")
         return true;
+    else if (feature == "trace_deferred")
+        return true;  // trace() and getmessage("trace") keep no state
     return false;
 }
 
@@ -514,6 +516,18 @@ SimpleRenderer::get_attribute(ShaderGlobals* sg, bool derivatives,
 
 
 
+AttributeConstancy
+SimpleRenderer::attribute_constancy(ustringhash /*object*/,
+                                    ustringhash name) const
+{
+    // The camera attributes don't change over the course of a run
+    if (m_attr_getters.find(name) != m_attr_getters.end())
+        return AttributeConstancy::PerFrame;
+    return AttributeConstancy::Varying;
+}
+
+
+
 bool
 SimpleRenderer::get_userdata(bool derivatives, ustringhash name, TypeDesc type,
                              ShaderGlobals* sg, void* val)
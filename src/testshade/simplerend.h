@@ -59,6 +59,8 @@ public:
                              ustringhash name, int index, void* val) override;
     bool get_attribute(ShaderGlobals* sg, bool derivatives, ustringhash object,
                        TypeDesc type, ustringhash name, void* val) override;
+    AttributeConstancy attribute_constancy(ustringhash object,
+                                           ustringhash name) const override;
     bool get_userdata(bool derivatives, ustringhash name, TypeDesc type,
                       ShaderGlobals* sg, void* val) override;
 
@@ -3,6 +3,7 @@
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
 
+#include <algorithm>
 #include <cmath>
 #include <fstream>
 #include <iostream>
@@ -81,11 +82,16 @@ static bool debug_uninit         = false;
 static bool use_group_outputs    = false;
 static bool do_oslquery          = false;
 static bool print_groupdata      = false;
+static bool compact_code         = false;
+static bool use_groupdesc        = false;
 static bool inbuffer             = false;
 static bool use_shade_image      = false;
 static bool userdata_isconnected = false;
 static bool print_outputs        = false;
 static bool output_placement     = true;
+static bool globals_placement    = false;
+static bool execute_many         = false;
+static bool deferred_trace       = false;
 static bool use_optix            = OIIO::Strutil::stoi(
     OIIO::Sysutil::getenv("TESTSHADE_OPTIX"));
 static bool optix_no_inline             = false;
@@ -105,8 +111,12 @@ static std::vector<std::string> connections;
 static ParamValueList params;
 static std::vector<ParamHints> param_hints;
 static ParamValueList reparams;
+static ShaderGroupDesc groupdesc;
 static std::string reparam_layer;
 static int iters                = 1;
+static int benchmark            = 0;
+static int pmu_interval         = 0;
+static bool perfmap             = false;
 static std::string raytype_name = "camera";
 static int raytype_bit          = 0;
 static bool raytype_opt         = false;
@@ -117,6 +127,9 @@ static OSL::Matrix44 Mshad;  // "shader" space to "common" space matrix
 static OSL::Matrix44 Mobj;   // "object" space to "common" space matrix
 static ShaderGroupRef shadergroup;
 static std::string archivegroup;
+static std::string stats_json;
+static std::string optreport;
+static std::vector<std::string> printstats;
 static int exprcount               = 0;
 static bool shadingsys_options_set = false;
 static float uscale = 1, vscale = 1;
@@ -126,6 +139,17 @@ static std::string localename = OIIO::Sysutil::getenv("TESTSHADE_LOCALE");
 static OIIO::ParamValueList userdata;
 static char* userdata_base_ptr = nullptr;
 static char* output_base_ptr   = nullptr;
+
+// With --globals-placement, the shaders read these globals from a record
+// per point, as a renderer's might from its hit records, rather than from
+// ShaderGlobals. The records are the userdata arena.
+struct GlobalsRecord {
+    Vec3 P, dPdx, dPdy;
+    float u, dudx, dudy;
+    float v, dvdx, dvdy;
+    Vec3 N;
+};
+static std::vector<GlobalsRecord> globals_records;
 static bool use_rs_bitcode
     = false;  // use free function bitcode version of renderer services
 static int jbufferMB = 16;
@@ -184,6 +208,27 @@ inject_params()
 
 
 
+// For --groupdesc, record the layer about to be added to the group, with
+// its pending parameters resolved to indices.
+static void
+describe_layer(string_view shadername)
+{
+    if (!use_groupdesc)
+        return;
+    int layer = (int)groupdesc.layers.size();
+    groupdesc.layers.push_back({ ustring(shadername), ustring(layername) });
+    int pi = 0;
+    for (auto&& pv : params) {
+        int param = shadingsys->find_param(shadername, pv.name());
+        if (param >= 0)
+            groupdesc.set_param(layer, param, pv.type(), pv.data(),
+                                param_hints[pi]);
+        ++pi;
+    }
+}
+
+
+
 // Set shading system global attributes based on command line options.
 static void
 set_shadingsys_options()
@@ -198,8 +243,9 @@ set_shadingsys_options()
     // Always generate llvm debugging info
     shadingsys->attribute("llvm_debugging_symbols", 1);
 
-    // Always emit llvm Intel profiling events
-    shadingsys->attribute("llvm_profiling_events", 1);
+    // Always emit llvm Intel profiling events, and with --perfmap, the
+    // perf map of the JITed functions too
+    shadingsys->attribute("llvm_profiling_events", perfmap ? 3 : 1);
 
     OSL_DEV_ONLY(llvm_debug = true);
     shadingsys->attribute("llvm_debug", (llvm_debug ? 2 : 0));
@@ -250,7 +296,10 @@ set_shadingsys_options()
                               testshade_llvm_compiled_rs_block);
     }
 
+    if (optreport.size())
+        shadingsys->attribute("opt_report", 1);
     shadingsys->attribute("profile", int(profile));
+    shadingsys->attribute("pmu_interval", pmu_interval);
     shadingsys->attribute("debug_nan", debugnan);
     shadingsys->attribute("debug_uninit", debug_uninit);
     shadingsys->attribute("userdata_isconnected", userdata_isconnected);
@@ -348,7 +397,8 @@ set_shadingsys_options()
 
     if (use_optix) {
         // FIXME: For now, output placement is disabled for OptiX mode
-        output_placement = false;
+        output_placement  = false;
+        globals_placement = false;
     }
 
     shadingsys_options_set = true;
@@ -409,6 +459,7 @@ add_shader(cspan<const char*> argv)
         shader_from_buffers(shadername);
 
     inject_params();
+    describe_layer(shadername);
     shadernames.push_back(shadername);
     shadingsys->Shader(*shadergroup, "surface", shadername, layername);
     layername.clear();
@@ -465,6 +516,7 @@ specify_expr(cspan<const char*> argv)
     compile_buffer(sourcecode, shadername);
 
     inject_params();
+    describe_layer(shadername);
     shadernames.push_back(shadername);
     shadingsys->Shader(*shadergroup, "surface", shadername, layername);
     layername.clear();
@@ -695,6 +747,32 @@ print_info()
 
 
 
+static void
+compile_dict(cspan<const char*> argv)
+{
+    OSL_ASSERT(argv.size() == 3);
+    std::string err;
+    if (!OSL::compile_dictionary(argv[1], argv[2], err)) {
+        std::cerr << "ERROR: " << err << "\n";
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+
+static void
+compile_pointcloud(cspan<const char*> argv)
+{
+    OSL_ASSERT(argv.size() == 3);
+    std::string err;
+    if (!OSL::compile_pointcloud(argv[1], argv[2], err)) {
+        std::cerr << "ERROR: " << err << "\n";
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+
 static void
 getargs(int argc, const char* argv[])
 {
@@ -726,10 +804,18 @@ getargs(int argc, const char* argv[])
       .help("Turn on LLVM debugging info");
     ap.arg("--runstats", &runstats)
       .help("Print run statistics");
+    ap.arg("--compact", &compact_code)
+      .help("Compact the shaders' code before optimizing the group");
+    ap.arg("--groupdesc", &use_groupdesc)
+      .help("Build the group from a ShaderGroupDesc");
     ap.arg("--stats", &runstats)
       .hidden(); // DEPRECATED 1.7
     ap.arg("--batched", &batched)
       .help("Submit batches to ShadingSystem");
+    ap.arg("--execute_many", &execute_many)
+      .help("Shade each row of points with a single execute_many call");
+    ap.arg("--deferred_trace", &deferred_trace)
+      .help("Like --execute_many, but with each row's rays traced together");
     ap.arg("--vary_pdxdy", &vary_Pdxdy)
       .help("populate Dx(P) & Dy(P) with varying values (vs. uniform)");
     ap.arg("--vary_udxdy", &vary_udxdy)
@@ -738,10 +824,22 @@ getargs(int argc, const char* argv[])
       .help("populate Dx(v) & Dy(v) with varying values (vs. uniform)");
     ap.arg("--profile", &profile)
       .help("Print profile information");
+    ap.arg("--stats_json %s:FILE", &stats_json)
+      .help("Write the time of each stage, and the shading system statistics, to FILE as JSON");
+    ap.arg("--optreport %s:FILE", &optreport)
+      .help("Write the group's optimization report (see the \"opt_report\" option) to FILE");
+    ap.arg("--printstat %L:NAME", &printstats)
+      .help("Print the value of the integer or long long statistic \"stat:NAME\" when done (after any background JIT)");
     ap.arg("--saveptx", &saveptx)
       .help("Save the generated PTX (OptiX mode only)");
     ap.arg("--warmup", &warmup)
       .help("Perform a warmup launch");
+    ap.arg("--benchmark %d:TRIALS", &benchmark)
+      .help("Time TRIALS runs over the image, scalar and (with --batched) batched, and report the time per point");
+    ap.arg("--pmu %d:N", &pmu_interval)
+      .help("Read hardware counters over every Nth shade and print them per group (Linux)");
+    ap.arg("--perfmap", &perfmap)
+      .help("Write /tmp/perf-PID.map, so that perf can name the JITed shader functions");
     ap.arg("--res %d:XRES %d:YRES", &xres, &yres)
       .help("Set resolution");
     ap.arg("-g %d:XRES %d:YRES", &xres, &yres)
@@ -782,6 +880,12 @@ getargs(int argc, const char* argv[])
       .help("Specify a full group command");
     ap.arg("--archivegroup %s:FILENAME", &archivegroup)
       .help("Archive the group to a given filename");
+    ap.arg("--compile_dict %s:XML %s:ODICT")
+      .action([&](cspan<const char*> argv){ compile_dict(argv); })
+      .help("Compile an XML dictionary to a binary .odict file");
+    ap.arg("--compile_pointcloud %s:CLOUD %s:OPC")
+      .action([&](cspan<const char*> argv){ compile_pointcloud(argv); })
+      .help("Convert a point cloud to a memory mapped .opc file");
     ap.arg("--raytype %s", &raytype_name)
       .help("Set the raytype");
     ap.arg("--raytype_opt", &raytype_opt)
@@ -833,6 +937,8 @@ getargs(int argc, const char* argv[])
     ap.arg("--no-output-placement")
       .help("Turn off use of output placement, rely only on get_symbol")
       .action(OIIO::ArgParse::store_false());
+    ap.arg("--globals-placement", &globals_placement)
+      .help("Have the shaders read P, u, v and N from per-point records rather than ShaderGlobals");
     ap.arg("--shadeimage", &use_shade_image)
       .help("Use shade_image utility");
     ap.arg("--noshadeimage %!", &use_shade_image)
@@ -1040,6 +1146,24 @@ setup_shaderglobals(ShaderGlobals& sg, ShadingSystem* shadingsys,
     // Set the surface area of the patch to 1 (which it is).  This is
     // only used for light shaders that call the surfacearea() function.
     sg.surfacearea = 1;
+
+    if (globals_placement) {
+        // Move the placed globals into the point's record, leaving zeros
+        // in ShaderGlobals so that reading them from there would show.
+        GlobalsRecord& r(globals_records[size_t(y) * xres + x]);
+        r.P    = sg.P;
+        r.dPdx = sg.dPdx;
+        r.dPdy = sg.dPdy;
+        r.u    = sg.u;
+        r.dudx = sg.dudx;
+        r.dudy = sg.dudy;
+        r.v    = sg.v;
+        r.dvdx = sg.dvdx;
+        r.dvdy = sg.dvdy;
+        r.N    = sg.N;
+        sg.P = sg.dPdx = sg.dPdy = sg.N = Vec3(0.0f);
+        sg.u = sg.dudx = sg.dudy = sg.v = sg.dvdx = sg.dvdy = 0.0f;
+    }
 }
 
 
@@ -1154,6 +1278,22 @@ setup_output_images(SimpleRenderer* rend, ShadingSystem* shadingsys,
         shadingsys->add_symlocs(shadergroup.get(), symlocs);
     }
 
+    if (globals_placement) {
+        globals_records.resize(size_t(xres) * yres);
+        userdata_base_ptr = reinterpret_cast<char*>(globals_records.data());
+        const SymLocationDesc::stride_t stride = sizeof(GlobalsRecord);
+        SymLocationDesc symlocs[]
+            = { { "P", TypePoint, true, SymArena::ShaderGlobals,
+                  offsetof(GlobalsRecord, P), stride },
+                { "u", TypeFloat, true, SymArena::ShaderGlobals,
+                  offsetof(GlobalsRecord, u), stride },
+                { "v", TypeFloat, true, SymArena::ShaderGlobals,
+                  offsetof(GlobalsRecord, v), stride },
+                { "N", TypeNormal, false, SymArena::ShaderGlobals,
+                  offsetof(GlobalsRecord, N), stride } };
+        shadingsys->add_symlocs(shadergroup.get(), symlocs);
+    }
+
     if (!output_placement && outputvars.size()) {
         // Old fashined way -- tell the shading system which outputs we want
         std::vector<const char*> aovnames(outputvars.size());
@@ -1599,6 +1739,35 @@ shade_region(SimpleRenderer* rend, ShaderGroup* shadergroup, OIIO::ROI roi,
 
     raytype_bit = shadingsys->raytype_bit(ustring(raytype_name));
 
+    // Shade a row at a time if asked, when there are no outputs to save
+    // from the context after each point.
+    if ((execute_many || deferred_trace) && entrylayer_index.empty()
+        && !(save && (print_outputs || !output_placement))) {
+        if (this_threads_index == uninitialized_thread_index) {
+            this_threads_index = next_thread_index.fetch_add(1u);
+        }
+        std::vector<ShaderGlobals> row(roi.width());
+        for (int y = roi.ybegin; y < roi.yend; ++y) {
+            for (int x = roi.xbegin; x < roi.xend; ++x)
+                setup_shaderglobals(row[x - roi.xbegin], shadingsys,
+                                    renderState, &closure_pool, x, y);
+            if (deferred_trace)
+                shadingsys->execute_deferred_trace(*ctx, *shadergroup,
+                                                   this_threads_index,
+                                                   y * xres + roi.xbegin, row,
+                                                   userdata_base_ptr,
+                                                   output_base_ptr);
+            else
+                shadingsys->execute_many(*ctx, *shadergroup,
+                                         this_threads_index,
+                                         y * xres + roi.xbegin, row,
+                                         userdata_base_ptr, output_base_ptr);
+        }
+        shadingsys->release_context(ctx);
+        shadingsys->destroy_thread_info(thread_info);
+        return;
+    }
+
     // Loop over all pixels in the image (in x and y)...
     for (int y = roi.ybegin; y < roi.yend; ++y) {
         int shadeindex = y * xres + roi.xbegin;
@@ -1919,6 +2088,148 @@ batched_shade_region(SimpleRenderer* rend, ShaderGroup* shadergroup,
 }
 #endif
 
+// Shade the roi in parallel, a batch of `width` points at a time, or one
+// at a time if width is 1.
+static void
+shade_image_region(SimpleRenderer* rend, ShaderGroup* group, OIIO::ROI roi,
+                   int width, bool save)
+{
+#if OSL_USE_BATCHED
+    if (width == 16) {
+        OIIO::ImageBufAlgo::parallel_image(
+            roi, num_threads, [&](OIIO::ROI sub_roi) -> void {
+                batched_shade_region<16>(rend, group, sub_roi, save);
+            });
+        return;
+    } else if (width == 8) {
+        OIIO::ImageBufAlgo::parallel_image(
+            roi, num_threads, [&](OIIO::ROI sub_roi) -> void {
+                batched_shade_region<8>(rend, group, sub_roi, save);
+            });
+        return;
+    } else if (width == 4) {
+        OIIO::ImageBufAlgo::parallel_image(
+            roi, num_threads, [&](OIIO::ROI sub_roi) -> void {
+                batched_shade_region<4>(rend, group, sub_roi, save);
+            });
+        return;
+    }
+#endif
+    OSL_ASSERT(width == 1 && "Unsupported batch size");
+    OIIO::ImageBufAlgo::parallel_image(roi, num_threads,
+                                       [&](OIIO::ROI sub_roi) -> void {
+                                           shade_region(rend, group, sub_roi,
+                                                        save);
+                                       });
+}
+
+
+
+// For --benchmark: optimize the group, then for scalar shading and (with
+// --batched) batched shading, JIT it, shade the image once to warm up,
+// and time `benchmark` more runs over the image. Print the JIT time and
+// the min, median and 95th percentile of the time per point, and return
+// the same as JSON. Output images aren't saved from these runs.
+static std::string
+run_benchmark(SimpleRenderer* rend, ShaderGroup* group)
+{
+    OIIO::ROI roi(0, xres, 0, yres);
+    double npoints = double(xres) * double(yres);
+    std::vector<int> widths { 1 };
+    if (batched)
+        widths.push_back(batch_size);
+
+    OSL::PerThreadInfo* thread_info = shadingsys->create_thread_info();
+    ShadingContext* ctx             = shadingsys->get_context(thread_info);
+    OIIO::Timer timer;
+    if (raytype_opt)
+        shadingsys->optimize_group(group, raytype_bit, ~raytype_bit, ctx,
+                                   false /*do_jit*/);
+    else
+        shadingsys->optimize_group(group, ctx, false /*do_jit*/);
+    double opttime = timer.lap();
+    std::cout << fmtformat("Benchmark: {} trials of {} points, optimize {}\n",
+                           benchmark, int64_t(npoints),
+                           OIIO::Strutil::timeintervalformat(opttime, 4));
+    std::string json = fmtformat("{{\n    \"trials\": {},\n    \"points\": {},"
+                                 "\n    \"optimize\": {},\n    \"modes\": [",
+                                 benchmark, int64_t(npoints), opttime);
+
+    for (size_t m = 0; m < widths.size(); ++m) {
+        int width = widths[m];
+        timer.lap();
+#if OSL_USE_BATCHED
+        if (width == 16)
+            shadingsys->batched<16>().jit_group(group, ctx);
+        else if (width == 8)
+            shadingsys->batched<8>().jit_group(group, ctx);
+        else if (width == 4)
+            shadingsys->batched<4>().jit_group(group, ctx);
+        else
+#endif
+            shadingsys->optimize_group(group, ctx);
+        double jittime = timer.lap();
+
+        shade_image_region(rend, group, roi, width, false);
+        std::vector<double> times;  // Nanoseconds per point
+        for (int t = 0; t < benchmark; ++t) {
+            timer.lap();
+            shade_image_region(rend, group, roi, width, false);
+            times.push_back(timer.lap() * 1.0e9 / npoints);
+        }
+        std::sort(times.begin(), times.end());
+        size_t n      = times.size();
+        double min    = n ? times[0] : 0.0;
+        double median = n ? times[n / 2] : 0.0;
+        double p95    = n ? times[std::min(n - 1, size_t(0.95 * n))] : 0.0;
+
+        std::string mode = width == 1 ? std::string("scalar")
+                                      : fmtformat("batched{}", width);
+        std::cout << fmtformat(
+            "  {:>10}: JIT {}, per point min {:.1f} ns, median {:.1f} ns, "
+            "p95 {:.1f} ns\n",
+            mode, OIIO::Strutil::timeintervalformat(jittime, 4), min, median,
+            p95);
+        json += fmtformat("{}\n      {{ \"mode\": \"{}\", \"jit\": {}, "
+                          "\"min_ns\": {}, \"median_ns\": {}, "
+                          "\"p95_ns\": {} }}",
+                          m ? "," : "", mode, jittime, min, median, p95);
+    }
+    json += "\n    ]\n  }";
+
+    shadingsys->release_context(ctx);
+    shadingsys->destroy_thread_info(thread_info);
+    return json;
+}
+
+
+
+// Write the time of each stage of the run and the shading system's
+// statistics to a JSON file, for tracking performance over time, along
+// with the --benchmark results if there are any.
+static void
+write_stats_json(const std::string& filename,
+                 cspan<std::pair<const char*, double>> stages,
+                 const std::string& benchmark_json)
+{
+    std::string json = "{\n  \"tool\": \"testshade\",\n  \"stages\": {";
+    for (size_t i = 0; i < stages.size(); ++i)
+        json += fmtformat("{}\n    \"{}\": {}", i ? "," : "",
+                          stages[i].first, stages[i].second);
+    json += "\n  },";
+    if (benchmark_json.size())
+        json += "\n  \"benchmark\": " + benchmark_json + ",";
+    json += "\n  \"shadingsys\": ";
+    const char* stats = nullptr;
+    if (shadingsys->getattribute("stat:json", TypeDesc::STRING, &stats))
+        json += OIIO::Strutil::strip(stats);
+    else
+        json += "{}";
+    json += "\n}\n";
+    if (!OIIO::Filesystem::write_text_file(filename, json))
+        std::cerr << "testshade: Unable to write " << filename << "\n";
+}
+
 static void
 synchio()
 {
@@ -2073,8 +2384,49 @@ test_shade(int argc, const char* argv[])
         }
     }
 
-    // End the group
-    shadingsys->ShaderGroupEnd(*shadergroup);
+    if (use_groupdesc) {
+        // Build the same group again, in one call, from its description
+        // by layer and parameter indices.
+        groupdesc.name  = ustring(groupname);
+        groupdesc.usage = ustring("surface");
+        for (size_t i = 0; i + 3 < connections.size(); i += 4) {
+            ShaderGroupDesc::Connection c { -1, -1, -1, -1 };
+            for (int l = 0; l < (int)groupdesc.layers.size(); ++l) {
+                const auto& layer(groupdesc.layers[l]);
+                if (layer.layername == connections[i]) {
+                    c.srclayer = l;
+                    c.srcparam = shadingsys->find_param(layer.shadername,
+                                                        connections[i + 1]);
+                }
+                if (layer.layername == connections[i + 2]) {
+                    c.dstlayer = l;
+                    c.dstparam = shadingsys->find_param(layer.shadername,
+                                                        connections[i + 3]);
+                }
+            }
+            if (c.srcparam < 0 || c.dstparam < 0) {
+                std::cerr << "ERROR: --groupdesc can't describe connection "
+                          << connections[i] << "." << connections[i + 1]
+                          << " to " << connections[i + 2] << "."
+                          << connections[i + 3] << "\n";
+                return EXIT_FAILURE;
+            }
+            groupdesc.connections.push_back(c);
+        }
+        shadergroup = shadingsys->build_shader_group(groupdesc);
+        if (!shadergroup) {
+            std::cerr << "ERROR: Could not build the shader group.\n";
+            return EXIT_FAILURE;
+        }
+    } else {
+        // End the group
+        shadingsys->ShaderGroupEnd(*shadergroup);
+    }
+
+    // Compacting the shaders' code before the group is optimized makes its
+    // optimization unpack it again.
+    if (compact_code)
+        shadingsys->compact_shader_code();
 
     if (verbose || do_oslquery) {
         std::string pickle;
@@ -2183,6 +2535,20 @@ test_shade(int argc, const char* argv[])
     theRenderContext.journal_buffer = jbuffer.get();
 
 
+    //Just to match existing behavior we extract the current error_repeats attribute but intent is for renderers to make
+    //their own decision about this.
+    int error_repeats;
+    shadingsys->getattribute("error_repeats", error_repeats);
+    bool limit_errors                  = !error_repeats;
+    bool limit_warnings                = !error_repeats;
+    const int error_history_capacity   = 25;
+    const int warning_history_capacity = 25;
+
+    journal::TrackRecentlyReported tracker_error_warnings(
+        limit_errors, error_history_capacity, limit_warnings,
+        warning_history_capacity);
+    TestshadeReporter reporter(&rend->errhandler(), tracker_error_warnings);
+
     // Allow a settable number of iterations to "render" the whole image,
     // which is useful for time trials of things that would be too quick
     // to accurately time for a single iteration
@@ -2192,83 +2558,53 @@ test_shade(int argc, const char* argv[])
         if (use_optix) {
             rend->render(xres, yres);
         } else if (use_shade_image) {
-            // TODO: do we need a batched option/version of shade_image?
             OSL::shade_image(*shadingsys, *shadergroup, NULL,
                              *rend->outputbuf(0), outputvarnames,
                              pixelcenters ? ShadePixelCenters : ShadePixelGrid,
-                             roi, num_threads);
+                             roi, num_threads, batched ? batch_size : 0);
         } else {
             bool save = (iter == (iters - 1));  // save on last iteration
-#if 0
-            shade_region (rend, shadergroup.get(), roi, save);
-#else
-#    if OSL_USE_BATCHED
-            if (batched) {
-                if (batch_size == 16) {
-                    OIIO::ImageBufAlgo::parallel_image(
-                        roi, num_threads, [&](OIIO::ROI sub_roi) -> void {
-                            batched_shade_region<16>(rend.get(),
-                                                     shadergroup.get(), sub_roi,
-                                                     save);
-                        });
-                } else if (batch_size == 8) {
-                    OIIO::ImageBufAlgo::parallel_image(
-                        roi, num_threads, [&](OIIO::ROI sub_roi) -> void {
-                            batched_shade_region<8>(rend.get(),
-                                                    shadergroup.get(), sub_roi,
-                                                    save);
-                        });
-                } else {
-                    OSL_ASSERT((batch_size == 4) && "Unsupported batch size");
-                    OIIO::ImageBufAlgo::parallel_image(
-                        roi, num_threads, [&](OIIO::ROI sub_roi) -> void {
-                            batched_shade_region<4>(rend.get(),
-                                                    shadergroup.get(), sub_roi,
-                                                    save);
-                        });
-                }
-            } else
-#    endif
-            {
-                OIIO::ImageBufAlgo::parallel_image(
-                    roi, num_threads, [&](OIIO::ROI sub_roi) -> void {
-                        shade_region(rend.get(), shadergroup.get(), sub_roi,
-                                     save);
-                    });
-            }
-#endif
+            shade_image_region(rend.get(), shadergroup.get(), roi,
+                               batched ? batch_size : 1, save);
         }
 
         // If any reparam was requested, do it now
         if (reparams.size() && reparam_layer.size() && (iter + 1 < iters)) {
+            shadingsys->ReParameterBegin(*shadergroup);
             for (size_t p = 0; p < reparams.size(); ++p) {
                 const ParamValue& pv(reparams[p]);
                 shadingsys->ReParameter(*shadergroup, reparam_layer.c_str(),
                                         pv.name().c_str(), pv.type(),
                                         pv.data());
             }
+            shadingsys->ReParameterEnd(*shadergroup);
         }
-    }
 
-    //Just to match existing behavior we extract the current error_repeats attribute but intent is for renderers to make
-    //their own decision about this.
-    int error_repeats;
-    shadingsys->getattribute("error_repeats", error_repeats);
-    bool limit_errors                  = !error_repeats;
-    bool limit_warnings                = !error_repeats;
-    const int error_history_capacity   = 25;
-    const int warning_history_capacity = 25;
+        // Between iterations, drain a journal that is filling up rather
+        // than letting later output be dropped.
+        if (!use_optix && iter + 1 < iters
+            && journal::buffer_usage(jbuffer.get()) > 0.5f)
+            journal::drain_buffer(jbuffer.get(), reporter);
+    }
 
-    journal::TrackRecentlyReported tracker_error_warnings(
-        limit_errors, error_history_capacity, limit_warnings,
-        warning_history_capacity);
-    TestshadeReporter reporter(&rend->errhandler(), tracker_error_warnings);
+    // Decode the shading threads' messages in parallel; they are still
+    // reported in thread order.
     OSL::journal::Reader jreader(jbuffer.get(), reporter);
-    jreader.process();
+    jreader.process(0 /* one thread per core */);
     // Need to call journal::initialize_buffer before re-using the jbuffer
 
     double runtime = timer.lap();
 
+    // Time trials of the shading, if asked for, on a fresh journal whose
+    // output (from however many runs) is discarded.
+    std::string benchmark_json;
+    if (benchmark > 0 && !use_optix) {
+        OSL::journal::initialize_buffer(jbuffer.get(), jbuffer_bytes,
+                                        jbuffer_pagesize, num_threads);
+        benchmark_json = run_benchmark(rend.get(), shadergroup.get());
+    }
+    double benchmarktime = timer.lap();
+
     // This awkward condition preserves an output oddity from long ago,
     // eliminating the need to update hundreds of ref outputs.
     if (outputfiles.size() == 1 && outputfiles[0] == "null")
@@ -2306,9 +2642,10 @@ test_shade(int argc, const char* argv[])
         }
     }
 
+    double writetime = timer.lap();
+
     // Print some debugging info
-    if (debug1 || runstats || profile) {
-        double writetime = timer.lap();
+    if (debug1 || runstats || profile || pmu_interval) {
         std::cout << "\n";
         std::cout << "Setup : "
                   << OIIO::Strutil::timeintervalformat(setuptime, 4) << "\n";
@@ -2326,6 +2663,38 @@ test_shade(int argc, const char* argv[])
         std::cout << ustring::getstats() << "\n";
     }
 
+    if (printstats.size()) {
+        shadingsys->wait_for_background_jit();
+        for (auto&& name : printstats) {
+            long long value = 0;
+            int ivalue      = 0;
+            if (shadingsys->getattribute("stat:" + name, ivalue))
+                value = ivalue;
+            else
+                shadingsys->getattribute("stat:" + name, TypeDesc::INT64,
+                                         &value);
+            std::cout << "stat:" << name << " = " << value << "\n";
+        }
+    }
+
+    if (optreport.size()) {
+        ustring report;
+        shadingsys->getattribute(shadergroup.get(), "optimization_report",
+                                 TypeDesc::STRING, &report);
+        if (!OIIO::Filesystem::write_text_file(optreport, report))
+            std::cerr << "testshade: Unable to write " << optreport << "\n";
+    }
+
+    if (stats_json.size()) {
+        std::pair<const char*, double> stages[]
+            = { { "setup", setuptime },
+                { "warmup", warmuptime },
+                { "run", runtime },
+                { "benchmark", benchmarktime },
+                { "write", writetime } };
+        write_stats_json(stats_json, stages, benchmark_json);
+    }
+
     // TODO: Include batched support
     if ((debug1 || print_groupdata) && !batched) {
         int groupdata_size;
@@ -0,0 +1,11 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Array and component indices that loop counters keep in range, both in
+# loops that get unrolled and in loops that are left alone (whose range
+# checks are skipped).
+command  = testshade("test")
+command += testshade("--options opt_loop_unroll=0 test")
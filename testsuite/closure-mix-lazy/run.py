@@ -0,0 +1,13 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# A closure weighted by zero should not run the layer it's connected to
+# (and with opt_mix off, both always run)
+layers = ("-layer baselayer base -layer coatlayer coat -layer mixlayer mixer "
+          + "--connect baselayer c_out mixlayer base "
+          + "--connect coatlayer c_out mixlayer coat")
+command  = testshade("-g 2 2 " + layers)
+command += testshade("-g 2 2 --options opt_mix=0 " + layers)
@@ -0,0 +1,9 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Compact the shader's code before the group is optimized, so that the
+# optimizer works from the unpacked code.
+command = testshade("-g 1 1 --compact test")
@@ -0,0 +1,12 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# The NaN is found without debug_nan: once by sampling 1 in 4 shades, and
+# once by checking every shade of the "camera" rays testshade shoots.
+command  = testshade("-t 1 -g 2 2 --options debug_sample_interval=4 "
+                     + "-o Cout Cout.tif test")
+command += testshade("-t 1 -g 2 2 --options debug_sample_raytype=camera "
+                     + "-o Cout Cout.tif test")
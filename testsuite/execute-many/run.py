@@ -0,0 +1,9 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Shading a row at a time must give the same results as a point at a time
+command  = testshade("-g 3 2 test")
+command += testshade("-g 3 2 --execute_many test")
@@ -0,0 +1,14 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Four points make one batch at any width.  With the attribute cache, the
+# batch gathers its attributes once and every lookup is a cache hit;
+# without it, the results must be the same.
+stats = "--printstat attribute_gathers --printstat attribute_cache_hits "
+command = testshade("-t 1 -g 2 2 --options batched_attribute_cache=1 "
+                    + stats + "test")
+command += testshade("-t 1 -g 2 2 --options batched_attribute_cache=0 "
+                     + stats + "test")
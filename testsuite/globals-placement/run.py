@@ -0,0 +1,11 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# With --globals-placement, testshade moves P, u, v and N out of
+# ShaderGlobals into records of its own, declared with SymArena::ShaderGlobals
+# symlocs. The shader must see the same values, derivatives included.
+command += testshade ("test")
+command += testshade ("--globals-placement test")
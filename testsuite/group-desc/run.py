@@ -0,0 +1,9 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Build the group from a ShaderGroupDesc, with parameters and connections
+# given by index rather than by name.
+command += testshade("--groupdesc -param Kd 0.25 -param n 3 -layer alayer a -param label desc --layer blayer b --connect alayer f_out blayer f_in --connect alayer c_out blayer c_in")
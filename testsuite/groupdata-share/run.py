@@ -0,0 +1,18 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Layers a and b never run at the same time, so with opt_groupdata_share
+# their "k" params (kept as params by opt_simplify_param=0) share one
+# groupdata field, and the results are unchanged.
+shader_commands = " ".join([
+    "-layer alayer a",
+    "-layer blayer b",
+    "-layer main sum",
+    "--connect alayer Out main A",
+    "--connect blayer Out main B",
+])
+for opt in [0, 1]:
+    command += testshade("-g 2 2 --options opt_simplify_param=0,opt_groupdata_share={} --print-groupdata {}".format(opt, shader_commands))
@@ -0,0 +1,24 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Start from an empty cache directory so the first run must populate it.
+shutil.rmtree ("jitcache", ignore_errors=True)
+os.makedirs ("jitcache")
+
+statopt = ("--printstat jit_cache_hits --printstat jit_cache_misses "
+           + "--printstat jit_cache_variants ")
+
+# As a build node would, also store the code for plain x64 hosts.
+command = "echo Populating the x64 variant:>> out.txt 2>&1 ;\n"
+command += testshade("--options llvm_jit_cache_dir=jitcache,llvm_jit_isas=x64 "
+                     + statopt + "-g 1 1 test")
+
+# Leave only that variant, as a host that can't run the build node's own
+# code would find the cache: the lesser ISA's code must still be used.
+command += "echo Falling back to the x64 variant:>> out.txt 2>&1 ;\n"
+command += pythonbin + " src/keep_variant.py jitcache x64 ;\n"
+command += testshade("--options llvm_jit_cache_dir=jitcache "
+                     + statopt + "-g 1 1 test")
@@ -0,0 +1,16 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# keep_variant.py DIR ISA: delete every cached object in DIR but the
+# variants for ISA, without relying on a POSIX shell.
+
+import os
+import sys
+
+cachedir, isa = sys.argv[1], sys.argv[2]
+for f in os.listdir(cachedir) :
+    if f.endswith(".o") and not f.endswith("." + isa + ".o") :
+        os.remove(os.path.join(cachedir, f))
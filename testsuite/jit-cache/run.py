@@ -0,0 +1,34 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Start from an empty cache directory so the first run must populate it.
+shutil.rmtree ("jitcache", ignore_errors=True)
+os.makedirs ("jitcache")
+
+cacheopt = "--options llvm_jit_cache_dir=jitcache "
+statopt = "--printstat jit_cache_hits --printstat jit_cache_misses "
+
+command = "echo Populating the cache:>> out.txt 2>&1 ;\n"
+command += testshade(cacheopt + statopt + "-g 1 1 test")
+command += pythonbin + " src/swap_object.py remember jitcache ;\n"
+
+command += "echo Reusing the cache:>> out.txt 2>&1 ;\n"
+command += testshade(cacheopt + statopt + "-g 1 1 test")
+
+command += "echo Different parameter value:>> out.txt 2>&1 ;\n"
+command += testshade(cacheopt + statopt + "-g 1 1 --param scale 3 test")
+
+# Put the object of the new entry (scale 3) in place of the first one, as
+# a collision of the file names would: it must not be used.
+command += "echo Mismatched object:>> out.txt 2>&1 ;\n"
+command += pythonbin + " src/swap_object.py clobber jitcache ;\n"
+command += testshade(cacheopt + statopt + "-g 1 1 test")
+
+# Code that counts branches for PGO points at this process's counters, so
+# it must neither come from the cache nor go into it.
+command += "echo Counting branches:>> out.txt 2>&1 ;\n"
+command += testshade("--options llvm_jit_cache_dir=jitcache,llvm_pgo=1 "
+                     + statopt + "--printstat pgo_instrumented -g 1 1 test")
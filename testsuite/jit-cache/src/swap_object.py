@@ -0,0 +1,45 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Stand in for a collision of cache file names, without relying on a POSIX
+# shell or on file timestamps:
+#
+#   swap_object.py remember DIR   Note which objects DIR holds now.
+#   swap_object.py clobber DIR    Copy the one object added since over the
+#                                 remembered one.
+
+import os
+import shutil
+import sys
+
+
+def header(path) :
+    with open(path, "rb") as f :
+        return f.readline()
+
+
+mode, cachedir = sys.argv[1], sys.argv[2]
+listfile = os.path.join(cachedir, "remembered.txt")
+objects = sorted(f for f in os.listdir(cachedir) if f.endswith(".o"))
+
+if mode == "remember" :
+    with open(listfile, "w") as f :
+        f.write("\n".join(objects))
+    sys.exit(0)
+
+with open(listfile) as f :
+    old = f.read().split()
+new = [o for o in objects if o not in old]
+if len(old) != 1 or len(new) != 1 :
+    sys.exit("expected one remembered and one new object, not %s and %s"
+             % (old, new))
+src = os.path.join(cachedir, new[0])
+dst = os.path.join(cachedir, old[0])
+# The loader must turn the copy down by its header, so the two must differ.
+if (not header(src).startswith(b"OSL JIT object ")
+        or header(src) == header(dst)) :
+    sys.exit("%s and %s lack distinct OSL JIT object headers" % (src, dst))
+shutil.copyfile(src, dst)
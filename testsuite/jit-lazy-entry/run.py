@@ -0,0 +1,24 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Same group as layers-entry, but with entry layers that no other layer
+# calls left out of the group's JIT and compiled when first executed.
+# The execution order must not change.
+
+groupsetup = ("-layer A -param name A -param id 1 -param in 1.0 -param set_Ci 1 node " +
+              "-layer B -param name B -param id 2 -param in 2.0 node " +
+              "-layer C -param name C -param id 3 -param in 3.0 node " +
+              "-layer D -param name D -param id 4 -param in 4.0 node " +
+              "-layer E -param name E -param id 5 -param in 5.0 node -connect B out E in " +
+              "-layer F -param name F -param id 6 -param in 6.0 node -connect E out F in " +
+              "-layer G -param name G -param id 7 -param in 7.0 node -connect E out G in " +
+              "--options llvm_debug_layers=1,lazyglobals=0,llvm_jit_lazy_entry=1 "
+              )
+
+command += testshade(groupsetup +
+                     "-O2 -groupoutputs -o D.out out.exr " +
+                     "-entry B -entry F -entry E "
+                     )
@@ -0,0 +1,9 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Call the larger shadeops functions in the copy JITed once for all groups.
+command = testshade("--options llvm_shared_ops=1 -g 1 1 test")
+command += testshade("--options llvm_shared_ops=1 -g 1 1 --param:type=point p 4,5,6 test")
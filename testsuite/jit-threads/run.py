@@ -0,0 +1,17 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Generate the group's machine code on several threads; the answer must
+# not change.
+command = testshade("--options llvm_jit_threads=4 -g 1 1 test")
+command += testshade("--options llvm_jit_threads=4 -g 1 1 --param n 6 test")
+
+# A chain of layers has plenty of functions to split among the threads.
+command += testshade("--options llvm_jit_threads=4 "
+                     + "--printstat parallel_codegens -g 1 1 "
+                     + "--layer a test --layer b test --layer c test "
+                     + "--layer d test --connect a sum b in "
+                     + "--connect b sum c in --connect c sum d in")
@@ -0,0 +1,11 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Shade with the quick unoptimized JIT while the background thread
+# prepares the fully optimized one; the answer must not change, and the
+# group must have been re-JITed by the time testshade is done.
+command = testshade("--options llvm_jit_tiered=1 -g 1 1 --printstat background_jits test")
+command += testshade("--options llvm_jit_tiered=1 -g 1 1 --param n 6 test")
@@ -4,4 +4,8 @@
 # SPDX-License-Identifier: BSD-3-Clause
 # https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
-command += testshade("-g 2 2 -layer alayer a -layer blayer b --layer clayer c --connect alayer f_out clayer f_in --connect alayer c_out clayer c_in --connect blayer out clayer unused")
+# The results are the same whether the group data puts the most used
+# params first or keeps them in declaration order.
+layers = "-layer alayer a -layer blayer b --layer clayer c --connect alayer f_out clayer f_in --connect alayer c_out clayer c_in --connect blayer out clayer unused"
+command += testshade("-g 2 2 --options opt_groupdata_hot=1 " + layers)
+command += testshade("-g 2 2 --options opt_groupdata_hot=0 " + layers)
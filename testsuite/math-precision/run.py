@@ -0,0 +1,9 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+command  = testshade("-g 1 1 --options math_precision=precise test")
+command += testshade("-g 1 1 --options math_precision=fast test")
+command += testshade("-g 1 1 --options math_precision=approx test")
@@ -0,0 +1,7 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+command += testshade("-g 2 2 -layer alayer a --layer blayer b --layer clayer c --connect alayer q_out blayer q_in --connect alayer q_out clayer q_in --connect alayer n_out clayer na_in --connect blayer n_out clayer nb_in")
@@ -0,0 +1,9 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Loop unrolling and invariant hoisting must not change the answer.
+command = testshade("test")
+command += testshade("--options opt_loop_unroll=0,opt_licm=0 test")
@@ -0,0 +1,13 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Each output depends on something the optimizer can't know: a varying
+# global, a userdata param, and a texture name that is userdata.  The
+# report must give those as the reasons the ops weren't folded and the
+# texture name wasn't made a handle.
+command += testshade("-g 2 2 --optreport report.txt "
+                     + "-o a a.exr -o b b.exr -o c c.exr test")
+command += pythonbin + " src/reasons.py report.txt >> out.txt ;\n"
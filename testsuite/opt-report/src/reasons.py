@@ -0,0 +1,21 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Print the per-op reasons and derivative users of an optimization report,
+# without the op numbers, which change with any change to the optimizer.
+#
+#   reasons.py REPORT
+
+import re
+import sys
+
+with open(sys.argv[1]) as f:
+    for line in f:
+        line = line.rstrip("\n")
+        if re.match(r"  op \d+ ", line):
+            print(re.sub(r"^  op \d+ ", "  ", line))
+        elif line.startswith("  derivatives of "):
+            print(line)
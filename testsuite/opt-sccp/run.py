@@ -0,0 +1,14 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Sparse constant propagation must not change the answer.
+command = testshade("test")
+command += testshade("--options opt_sccp=0 test")
+
+# It makes the reads of mode, the if condition, and k constant, but not
+# the read of j that comes before j is written.
+command += testshade("--printstat sccp_constants fold")
+command += testshade("--options opt_sccp=0 --printstat sccp_constants fold")
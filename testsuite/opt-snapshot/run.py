@@ -0,0 +1,21 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Start from an empty snapshot directory so the first run must write it.
+shutil.rmtree ("snapshots", ignore_errors=True)
+os.makedirs ("snapshots")
+
+snapopt = "--options opt_snapshot_dir=snapshots "
+group = "-g 1 1 --layer a src --layer b dst --connect a x b x --connect a label b label "
+
+command = "echo Writing the snapshot:>> out.txt 2>&1 ;\n"
+command += testshade(snapopt + group)
+
+command += "echo Loading the snapshot:>> out.txt 2>&1 ;\n"
+command += testshade(snapopt + group)
+
+command += "echo Different parameter value:>> out.txt 2>&1 ;\n"
+command += testshade(snapopt + "--param scale 3 " + group)
@@ -0,0 +1,12 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# The two src layers don't depend on each other, so they are optimized
+# concurrently; the messages they set must still reach the sum layer.
+command += testshade("--options opt_threads=4 "
+                     + "-param scale 2.0 -param msg alpha -layer a src "
+                     + "-param scale 3.0 -param msg beta -layer b src "
+                     + "-layer c sum -connect a out c a -connect b out c b")
@@ -0,0 +1,10 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# The shader is compiled with oslc's own optimizations, which must not
+# change what it computes.
+oslcargs = "-Wall -O2"
+command = testshade("test")
@@ -0,0 +1,8 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#define GREETING "hello from common.h"
+#define TWICE(x) ((x) + (x))
+
+float common_half (float x) { return x / 2; }
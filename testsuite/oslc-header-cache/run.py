@@ -0,0 +1,13 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Compile with an -include file and a header cache, once to fill the cache
+# and once to use it, and make sure the shader still works.
+compile_osl_files = False
+
+command = oslc("-q -include common.h -header-cache hcache test.osl")
+command += oslc("-q -include common.h -header-cache hcache test.osl")
+command += testshade("test")
@@ -0,0 +1,14 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Compile several shaders with one oslc, using several threads, and make
+# sure each came out right.
+compile_osl_files = False
+
+command = oslc("-q -j 3 a.osl b.osl c.osl")
+command += testshade("a")
+command += testshade("b")
+command += testshade("c")
@@ -0,0 +1,10 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# old.oso predates the cost estimates, so has none to report.
+command = oslinfo("--cost a")
+command += oslinfo("--cost b")
+command += oslinfo("--cost data/old.oso")
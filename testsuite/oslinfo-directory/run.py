@@ -0,0 +1,10 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Query a whole directory of shaders, once to fill the cache and once to
+# answer from it.
+command = oslinfo("-v --cache query.cache .")
+command += oslinfo("-v --cache query.cache .")
@@ -0,0 +1,11 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Compile to binary OSO, and make sure both oslinfo and the shading system
+# read it the same as the text form.
+command += oslc("-q -binary -o binary.oso test.osl")
+command += oslinfo("-v binary")
+command += testshade("binary")
@@ -0,0 +1,12 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Write a cloud straight to an .opc file, and another through Partio and
+# then converted, and read both back.
+command += testshade("-g 4 4 -param filename cloud.opc wrcloud")
+command += testshade("-g 4 4 -param filename cloud.geo wrcloud")
+command += testshade("-g 1 1 -param filename cloud.opc test")
+command += testshade("--compile_pointcloud cloud.geo cloud2.opc -g 1 1 -param filename cloud2.opc test")
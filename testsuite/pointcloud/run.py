@@ -26,6 +26,10 @@ command += testshade("--center --vary_pdxdy -g 256 256 -t 1 -param radius 0.1 -o
 
 command += testshade("--vary_pdxdy -g 256 256 -t 1 -param radius 0.01 -od uint8 -o Cout out_rdcloud_get_varying_filename.tif rdcloud_get_varying_filename")
 
+# The same lookups through OSL's own point cloud index instead of Partio's
+command += testshade("--options pointcloud_index=kdtree -g 256 256 -param radius 0.01 -od uint8 -o Cout out1_kdtree.tif rdcloud")
+command += testshade("--options pointcloud_index=kdtree --center --vary_pdxdy -g 256 256 -t 1 -param radius 0.1 -od uint8 -o Cout out_rdcloud_varying_sort_kdtree.tif rdcloud_varying_sort")
+
 command += testshade("--center --vary_pdxdy -g 256 256 -t 1 -param radius 0.1 -od uint8 -o Cout out_rdcloud_varying.tif rdcloud_varying")
 command += testshade("--center --vary_pdxdy -g 256 256 -t 1 -param radius 0.1 -od uint8 -o Cout out_rdcloud_varying_no_index.tif rdcloud_varying_no_index")
 command += testshade("--center --vary_pdxdy -g 256 256 -t 1 -param radius 0.1 -od uint8 -o Cout out_rdcloud_varying_mismatch.tif rdcloud_varying_mismatch")
@@ -51,6 +55,8 @@ outputs += [ "out_rdcloud_varying_no_index.tif" ]
 outputs += [ "out_rdcloud_varying_mismatch.tif" ]
 
 outputs += [ "out_rdcloud_get_varying_filename.tif" ]
+outputs += [ "out1_kdtree.tif" ]
+outputs += [ "out_rdcloud_varying_sort_kdtree.tif" ]
 
 
 # expect a few LSB failures
@@ -0,0 +1,13 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Each ray type runs its own specialized copy of the group, which must
+# behave just like the general one; without the option, no copy is made.
+opts = "--options raytype_variants=4 --printstat raytype_variants "
+command = testshade(opts + "--raytype camera test")
+command += testshade(opts + "--raytype shadow test")
+command += testshade(opts + "--raytype diffuse test")
+command += testshade("--printstat raytype_variants --raytype camera test")
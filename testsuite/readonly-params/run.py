@@ -0,0 +1,11 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Keep the params from being turned into constants by the runtime optimizer,
+# and check that they are read from the module's constants rather than
+# copied into the groupdata, with the same results.
+for opt in [0, 1]:
+    command += testshade("-g 2 2 --options opt_simplify_param=0,opt_readonly_params={} --print-groupdata test".format(opt))
@@ -0,0 +1,10 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# testshade makes all the --reparam changes between iterations in one
+# ReParameterBegin/End batch: two that need the group optimized again and
+# an interactive one, all of which must be seen by the next execution.
+command += testshade ("--options reparam_rebuild=1 --layer lay0 --param f 2.0 --param:type=float:interactive=1 k 3 test --iters 3 --reparam lay0 f 10.0 --reparam lay0 name b --reparam:type=float:interactive=1 lay0 k 5")
@@ -0,0 +1,9 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# With reparam_rebuild, ReParameter can change parameters that the group
+# was specialized on, and the group is optimized again before it next runs.
+command += testshade ("--options reparam_rebuild=1 --layer lay0 --param f 2.0 test --iters 2 --reparam lay0 f 10.0 --reparam lay0 name b")
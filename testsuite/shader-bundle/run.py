@@ -0,0 +1,11 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Bundle the shader, then move its .oso aside so that only the mounted
+# bundle can supply it.
+command += testshade("-g 1 1 --archivegroup shaders.oslbundle test")
+command += "mv test.oso test.oso.aside ;\n"
+command += testshade("-g 1 1 --options searchpath:bundle=shaders.oslbundle test")
@@ -0,0 +1,9 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Constant arrays read from the shared pool must match private copies.
+command = testshade("-g 4 1 test")
+command += testshade("-g 4 1 --options llvm_shared_constants=0 test")
@@ -0,0 +1,9 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Texture calls differing only in their channels are fused into one
+# lookup; make sure they give the same answers as separate lookups.
+command = testshade("-g 2 2 test")
@@ -0,0 +1,15 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+command += oiiotool ("-pattern constant:color=.6,.2,.2 64x64 3 -d uint8 -otex file.1001.tx")
+command += oiiotool ("-pattern constant:color=.2,.6,.2 64x64 3 -d uint8 -otex file.1002.tx")
+command += oiiotool ("-pattern constant:color=.2,.2,.6 64x64 3 -d uint8 -otex file.1011.tx")
+
+# Tile 1012 is purposely missing. Each shade point lands in its own tile,
+# and the lookups give the same colors whether or not the tiles are found
+# through the tile table.
+command += testshade("-g 2 2 --center -scaleuv 2 2 --options udim_tile_cache=1 test")
+command += testshade("-g 2 2 --center -scaleuv 2 2 --options udim_tile_cache=0 test")
@@ -0,0 +1,11 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Tracing each row's rays together must give the same results, and print
+# the same, as tracing them one at a time
+command  = testshade("-g 3 2 test")
+command += testshade("-g 3 2 --execute_many test")
+command += testshade("-g 3 2 --deferred_trace test")
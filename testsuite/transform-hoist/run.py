@@ -0,0 +1,10 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Repeated transforms between the same named spaces give the same results
+# whether or not their matrix is fetched just once.
+command = testshade("-g 2 2 --options opt_hoist_transforms=1 test")
+command += testshade("-g 2 2 --options opt_hoist_transforms=0 test")
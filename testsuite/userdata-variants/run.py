@@ -0,0 +1,10 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# The first two shades see t = 0 every time, so the rest of the first row
+# runs a copy of the group with t folded to 0. The second row has t = 1,
+# fails the copy's guard, and must run the general group.
+command = testshade("-g 4 2 --options userdata_variants=2 test")
@@ -0,0 +1,10 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Constant dictionary lookups fold at optimize time; make sure they give
+# the same answers as when they run.
+command = testshade("-g 1 1 test")
+command += testshade("--options opt_fold_dict=0 -g 1 1 test")